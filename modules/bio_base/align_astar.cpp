@@ -1,7 +1,22 @@
 
 #include "modules/bio_base/align_astar.h"
+#include "modules/bio_base/align_dp.h"
 #include "modules/bio_base/astar.h"
 
+#include <atomic>
+
+static std::atomic<align_engine> g_align_engine{align_engine::astar};
+
+void set_align_engine(align_engine engine)
+{
+	g_align_engine = engine;
+}
+
+align_engine get_align_engine()
+{
+	return g_align_engine;
+}
+
 bool align_state::operator<(const align_state& rhs) const
 {
 	if (read_pos != rhs.read_pos)
@@ -95,6 +110,8 @@ struct align_astar_exact_context : public align_astar_base
 
 double align_astar_exact(std::vector<align_state>& out, const dna_sequence& read, const dna_sequence& seq, const cost_matrix& costs, double max_cost)
 {
+	if (get_align_engine() == align_engine::dp)
+		return align_dp_exact(out, read, seq, costs, max_cost);
 	return wrap_as_func<align_astar_exact_context>(out, read, seq, costs, max_cost);
 }
 
@@ -134,6 +151,8 @@ struct align_astar_float_context : public align_astar_base
 
 double align_astar_float(std::vector<align_state>& out, const dna_sequence& read, const dna_sequence& seq, const cost_matrix& costs, double max_cost)
 {
+	if (get_align_engine() == align_engine::dp)
+		return align_dp_float(out, read, seq, costs, max_cost);
 	return wrap_as_func<align_astar_float_context>(out, read, seq, costs, max_cost);
 }
 struct align_astar_skip_context : public align_astar_base
@@ -171,6 +190,8 @@ struct align_astar_skip_context : public align_astar_base
 
 double align_astar_skip(std::vector<align_state>& out, const dna_sequence& read, const std::vector<dna_sequence>& seqs, const cost_matrix& costs, double max_cost)
 {
+	if (get_align_engine() == align_engine::dp)
+		return align_dp_skip(out, read, seqs, costs, max_cost);
 	return wrap_as_func<align_astar_skip_context>(out, read, seqs, costs, max_cost);
 }
 
@@ -212,6 +233,8 @@ struct align_astar_any_context : public align_astar_base
 
 double align_astar_any(std::vector<align_state>& out, const dna_sequence& read, const std::vector<dna_sequence>& seqs, const cost_matrix& costs, double max_cost)
 {
+	if (get_align_engine() == align_engine::dp)
+		return align_dp_any(out, read, seqs, costs, max_cost);
 	return wrap_as_func<align_astar_any_context>(out, read, seqs, costs, max_cost);
 }
 
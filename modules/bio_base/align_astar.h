@@ -50,6 +50,15 @@ struct cost_matrix
 	double extend_del;
 };
 
+// Selects the implementation used by the align_astar_* functions.
+// "dp" fills a dynamic programming matrix (see align_dp.h) instead of
+// doing an A* search, which is much faster on divergent reads.  Since
+// the A* search doesn't distinguish states by whether a gap is open, it
+// can miss the cheapest alignment, so "dp" may return lower costs.
+enum class align_engine { astar, dp };
+void set_align_engine(align_engine engine);
+align_engine get_align_engine();
+
 // Aligns read against sequence, must use all of both
 double align_astar_exact(std::vector<align_state>& out, const dna_sequence& read, const dna_sequence& seq, const cost_matrix& costs, double max_cost);
 
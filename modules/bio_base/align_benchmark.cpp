@@ -0,0 +1,270 @@
+#include "benchmark/benchmark.h"
+#include "modules/bio_base/align_astar.h"
+#include "modules/bio_base/align_dp.h"
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/bio_base/reference.h"
+
+#include <htslib/sam.h>
+#include <iostream>
+#include <random>
+
+namespace {
+
+constexpr size_t k_read_len = 150;
+// Reads align somewhere in a window this much longer than the read.
+constexpr size_t k_window_pad = 50;
+constexpr size_t k_num_reads = 64;
+// Maximum cost, as used when aligning reads.
+constexpr double k_max_cost = 30;
+
+// Golden data: E. coli reads aligned by BWA, and the reference they
+// were aligned to.
+const char k_golden_bam[] = "datasets/bams/e_coli/e_coli_test.bam";
+const char k_golden_ref_dir[] = "datasets/reference";
+const char k_golden_ref_name[] = "e_coli_k12_ASM584v1";
+constexpr size_t k_num_golden_reads = 1000;
+// Only use every this many reads, so the reads come from across the
+// reference instead of just its start.
+constexpr size_t k_golden_read_stride = 16;
+
+struct read_and_window {
+  dna_sequence read;
+  dna_sequence window;
+  // The part of the window the read came from.
+  dna_sequence aligned;
+};
+
+// Generates reads with an error every "error_rate" bases on average,
+// split evenly between mismatches, inserts, and deletes.
+std::vector<read_and_window> make_reads(unsigned error_rate) {
+  std::mt19937 rand_source(error_rate);
+  std::vector<read_and_window> result;
+  for (size_t i = 0; i < k_num_reads; ++i) {
+    read_and_window r;
+    r.window = rand_dna_sequence(rand_source, k_read_len + 2 * k_window_pad);
+    r.aligned = r.window.subseq(k_window_pad, k_read_len);
+    for (size_t j = 0; j < r.aligned.size(); ++j) {
+      if (rand_source() % error_rate) {
+        r.read.push_back(r.aligned[j]);
+        continue;
+      }
+      switch (rand_source() % 3) {
+        case 0:
+          r.read.push_back(dna_base(int(rand_source() % 4)));
+          break;
+        case 1:
+          r.read.push_back(dna_base(int(rand_source() % 4)));
+          r.read.push_back(r.aligned[j]);
+          break;
+        case 2:
+          break;
+      }
+    }
+    result.push_back(std::move(r));
+  }
+  return result;
+}
+
+// Loads mapped reads from the golden BAM, each with the reference
+// around where BWA aligned it.  Clipped reads are skipped, so "aligned"
+// covers all of the read.
+const std::vector<read_and_window>& golden_reads() {
+  static std::vector<read_and_window> result;
+  if (!result.empty()) {
+    return result;
+  }
+
+  reference ref(k_golden_ref_name, k_golden_ref_dir);
+  samFile* fp = sam_open(k_golden_bam, "r");
+  CHECK(fp) << k_golden_bam;
+  bam_hdr_t* hdr = sam_hdr_read(fp);
+  CHECK(hdr);
+  bam1_t* b = bam_init1();
+  size_t mapped = 0;
+  while (result.size() < k_num_golden_reads && sam_read1(fp, hdr, b) >= 0) {
+    if (b->core.flag & (BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) {
+      continue;
+    }
+    if (mapped++ % k_golden_read_stride) {
+      continue;
+    }
+
+    const uint32_t* cigar = bam_get_cigar(b);
+    bool clipped = false;
+    for (uint32_t i = 0; i < b->core.n_cigar; ++i) {
+      int op = bam_cigar_op(cigar[i]);
+      clipped |= op == BAM_CSOFT_CLIP || op == BAM_CHARD_CLIP;
+    }
+    size_t ref_start = b->core.pos;
+    size_t ref_len = bam_cigar2rlen(b->core.n_cigar, cigar);
+    if (clipped || ref_start < k_window_pad ||
+        ref_start + ref_len + k_window_pad > hdr->target_len[b->core.tid]) {
+      continue;
+    }
+
+    std::string seq;
+    const uint8_t* bam_seq = bam_get_seq(b);
+    for (int32_t i = 0; i < b->core.l_qseq; ++i) {
+      seq.push_back(seq_nt16_str[bam_seqi(bam_seq, i)]);
+    }
+    if (seq.find_first_not_of("ACGT") != std::string::npos) {
+      continue;
+    }
+
+    read_and_window r;
+    r.read = dna_sequence(seq);
+    size_t window_start = ref.flatten(hdr->target_name[b->core.tid], ref_start - k_window_pad);
+    dna_const_iterator window_it = ref.get_dna(window_start);
+    r.window = dna_sequence(window_it, window_it + ref_len + 2 * k_window_pad);
+    r.aligned = r.window.subseq(k_window_pad, ref_len);
+    result.push_back(std::move(r));
+  }
+  bam_destroy1(b);
+  bam_hdr_destroy(hdr);
+  sam_close(fp);
+  CHECK(!result.empty());
+  return result;
+}
+
+// Aligns every golden read with both engines, and reports how the
+// costs they find compare.  The DP engine always finds the cheapest
+// alignment, so it should never be more expensive than A*.
+void compare_golden() {
+  static bool compared = false;
+  if (compared) {
+    return;
+  }
+  compared = true;
+
+  const auto& reads = golden_reads();
+  cost_matrix costs;
+  for (bool exact : {false, true}) {
+    size_t aligned[2] = {0, 0};
+    size_t dp_cheaper = 0;
+    double total_cost[2] = {0, 0};
+    for (const auto& r : reads) {
+      double cost[2];
+      for (align_engine engine : {align_engine::astar, align_engine::dp}) {
+        set_align_engine(engine);
+        std::vector<align_state> path;
+        int e = int(engine);
+        cost[e] = exact ? align_astar_exact(path, r.read, r.aligned, costs, k_max_cost)
+                        : align_astar_float(path, r.read, r.window, costs, k_max_cost);
+        if (cost[e] < k_max_cost) {
+          ++aligned[e];
+          total_cost[e] += cost[e];
+        }
+      }
+      CHECK_LE(cost[1], cost[0]);
+      if (cost[1] < cost[0]) {
+        ++dp_cheaper;
+      }
+    }
+    set_align_engine(align_engine::astar);
+    std::cerr << (exact ? "Exact" : "Float") << " alignment of " << reads.size()
+              << " golden reads: A* aligned " << aligned[0] << " with total cost "
+              << total_cost[0] << ", DP aligned " << aligned[1] << " with total cost "
+              << total_cost[1] << ", DP cheaper for " << dp_cheaper << "\n";
+  }
+}
+
+void run_float(benchmark::State& state, align_engine engine,
+               const std::vector<read_and_window>& reads) {
+  set_align_engine(engine);
+  cost_matrix costs;
+  size_t read_idx = 0;
+  size_t aligned = 0;
+  std::vector<align_state> path;
+  while (state.KeepRunning()) {
+    const auto& r = reads[read_idx];
+    path.clear();
+    if (align_astar_float(path, r.read, r.window, costs, k_max_cost) < k_max_cost) {
+      ++aligned;
+    }
+    read_idx = (read_idx + 1) % reads.size();
+  }
+  set_align_engine(align_engine::astar);
+  state.SetItemsProcessed(state.iterations());
+  state.counters["aligned"] = double(aligned) / state.iterations();
+}
+
+void run_exact(benchmark::State& state, align_engine engine,
+               const std::vector<read_and_window>& reads) {
+  set_align_engine(engine);
+  cost_matrix costs;
+  size_t read_idx = 0;
+  std::vector<align_state> path;
+  while (state.KeepRunning()) {
+    const auto& r = reads[read_idx];
+    path.clear();
+    benchmark::DoNotOptimize(align_astar_exact(path, r.read, r.aligned, costs, k_max_cost));
+    read_idx = (read_idx + 1) % reads.size();
+  }
+  set_align_engine(align_engine::astar);
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+// Arguments are the average number of bases per error.
+static void BM_align_float_astar(benchmark::State& state) {
+  run_float(state, align_engine::astar, make_reads(state.range(0)));
+}
+BENCHMARK(BM_align_float_astar)->Arg(200)->Arg(50)->Arg(20)->Arg(5);
+
+static void BM_align_float_dp(benchmark::State& state) {
+  run_float(state, align_engine::dp, make_reads(state.range(0)));
+}
+BENCHMARK(BM_align_float_dp)->Arg(200)->Arg(50)->Arg(20)->Arg(5);
+
+static void BM_align_exact_astar(benchmark::State& state) {
+  run_exact(state, align_engine::astar, make_reads(state.range(0)));
+}
+BENCHMARK(BM_align_exact_astar)->Arg(200)->Arg(50)->Arg(20)->Arg(5);
+
+static void BM_align_exact_dp(benchmark::State& state) {
+  run_exact(state, align_engine::dp, make_reads(state.range(0)));
+}
+BENCHMARK(BM_align_exact_dp)->Arg(200)->Arg(50)->Arg(20)->Arg(5);
+
+static void BM_align_float_golden_astar(benchmark::State& state) {
+  compare_golden();
+  run_float(state, align_engine::astar, golden_reads());
+}
+BENCHMARK(BM_align_float_golden_astar);
+
+static void BM_align_float_golden_dp(benchmark::State& state) {
+  compare_golden();
+  run_float(state, align_engine::dp, golden_reads());
+}
+BENCHMARK(BM_align_float_golden_dp);
+
+static void BM_align_exact_golden_astar(benchmark::State& state) {
+  compare_golden();
+  run_exact(state, align_engine::astar, golden_reads());
+}
+BENCHMARK(BM_align_exact_golden_astar);
+
+static void BM_align_exact_golden_dp(benchmark::State& state) {
+  compare_golden();
+  run_exact(state, align_engine::dp, golden_reads());
+}
+BENCHMARK(BM_align_exact_golden_dp);
+
+// Argument is the align_dp_simd instruction set to fill DP matrices with.
+static void BM_align_float_golden_dp_simd(benchmark::State& state) {
+  align_dp_simd simd = align_dp_simd(state.range(0));
+  if (simd > align_dp_best_simd()) {
+    state.SkipWithError("CPU does not support this instruction set");
+    return;
+  }
+  set_align_dp_simd(simd);
+  run_float(state, align_engine::dp, golden_reads());
+  set_align_dp_simd(align_dp_simd::avx2);
+}
+BENCHMARK(BM_align_float_golden_dp_simd)
+    ->Arg(int(align_dp_simd::none))
+    ->Arg(int(align_dp_simd::sse41))
+    ->Arg(int(align_dp_simd::avx2));
+
+BENCHMARK_MAIN();
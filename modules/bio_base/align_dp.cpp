@@ -0,0 +1,650 @@
+#include "modules/bio_base/align_dp.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "modules/io/log.h"
+#include "modules/io/make_unique.h"
+
+namespace {
+
+constexpr double k_inf = std::numeric_limits<double>::infinity();
+
+// Matrices, indexed by align_state::last_op.
+constexpr int k_op_match = 0;
+constexpr int k_op_ins = 1;
+constexpr int k_op_del = 2;
+constexpr int k_num_ops = 3;
+
+double min_op_cost(const cost_matrix& costs) {
+  return std::min({costs.mismatch, costs.ins, costs.del, costs.extend_ins, costs.extend_del});
+}
+
+// True if an alignment with the given unit edit distance can't cost
+// less than max_cost.
+bool edit_distance_exceeds(unsigned edit_distance, const cost_matrix& costs, double max_cost) {
+  double min_cost = min_op_cost(costs);
+  return min_cost > 0 && edit_distance * min_cost >= max_cost;
+}
+
+// Vectors of L doubles, for filling DP rows in striped order.  These
+// use GCC vector extensions instead of intrinsics so the same kernel
+// can be compiled for each instruction set we dispatch on.  (They're
+// member typedefs since attributes are dropped from template
+// arguments, and rows are only 8 byte aligned.)
+template <size_t L>
+struct simd_doubles {
+  typedef double vec __attribute__((vector_size(8 * L), aligned(8), may_alias));
+  typedef int64_t mask __attribute__((vector_size(8 * L)));
+};
+
+// A row of a DP matrix covering sequence positions [0, n] is stored in
+// striped order: with L lanes and seg_len = ceil((n + 1) / L), position
+// j is in lane j / seg_len of vector j % seg_len.  Adjacent positions
+// are in the same lane of adjacent vectors, so the dependency on the
+// previous position is a vector operation except at the start of each
+// segment.  Positions past n are padding, and are always infinite.
+struct striped_row_args {
+  size_t seg_len;
+  const double* prev_match;
+  const double* prev_ins;
+  const double* prev_del;
+  // Cost of aligning the read base to each sequence position.
+  const double* sub;
+  // 0 where an alignment may enter the match matrix, infinite elsewhere.
+  const double* entry_bias;
+  double entry_cost;
+  const cost_matrix* costs;
+  double* match;
+  double* ins;
+  double* del;
+};
+
+// Fills a row of all three matrices, Farrar style.  Match and insert
+// entries only depend on the previous row.  Deletions depend on the
+// entry to their left, so they're first calculated within each
+// segment, and then corrections are carried across segments until none
+// of them improve anything.
+//
+// Every entry is computed with the same additions as a plain
+// left-to-right fill, so costs compare equal when tracing back.
+template <size_t L>
+inline __attribute__((always_inline)) void fill_row_striped(const striped_row_args& args) {
+  typedef typename simd_doubles<L>::vec V;
+  typedef typename simd_doubles<L>::mask Lanes;
+  const size_t seg_len = args.seg_len;
+  const cost_matrix& costs = *args.costs;
+  const V* prev_match = reinterpret_cast<const V*>(args.prev_match);
+  const V* prev_ins = reinterpret_cast<const V*>(args.prev_ins);
+  const V* prev_del = reinterpret_cast<const V*>(args.prev_del);
+  const V* sub = reinterpret_cast<const V*>(args.sub);
+  const V* entry_bias = reinterpret_cast<const V*>(args.entry_bias);
+  V* match = reinterpret_cast<V*>(args.match);
+  V* ins = reinterpret_cast<V*>(args.ins);
+  V* del = reinterpret_cast<V*>(args.del);
+
+  const V inf = V{} + k_inf;
+  const V entry_cost = V{} + args.entry_cost;
+
+  // Moves each lane up by one, shifting in infinity at lane 0.
+  Lanes shift_up;
+  shift_up[0] = L;
+  for (size_t lane = 1; lane < L; ++lane) {
+    shift_up[lane] = lane - 1;
+  }
+
+  // Element-wise minimum; this isn't a function, since vectors wider
+  // than the default target can't be passed by value.
+#define VEC_MIN(a, b) ((a) < (b) ? (a) : (b))
+  const size_t last = seg_len - 1;
+  V diag = VEC_MIN(prev_match[last], VEC_MIN(prev_ins[last], prev_del[last]));
+  diag = __builtin_shuffle(diag, inf, shift_up);
+  for (size_t v = 0; v != seg_len; ++v) {
+    const V entry = entry_cost + entry_bias[v];
+    const V diag_match = diag + sub[v];
+    match[v] = VEC_MIN(diag_match, entry);
+    const V extend_ins = prev_ins[v] + costs.extend_ins;
+    const V open_ins = VEC_MIN(prev_match[v], prev_del[v]) + costs.ins;
+    ins[v] = VEC_MIN(extend_ins, open_ins);
+    diag = VEC_MIN(prev_match[v], VEC_MIN(prev_ins[v], prev_del[v]));
+  }
+
+  V carry = inf;
+  for (size_t v = 0; v != seg_len; ++v) {
+    del[v] = carry;
+    const V extend_del = carry + costs.extend_del;
+    const V open_del = VEC_MIN(match[v], ins[v]) + costs.del;
+    carry = VEC_MIN(extend_del, open_del);
+  }
+  // Each pass carries the deletions at the end of each segment into
+  // the next one.  After L - 1 passes, everything carried has fallen
+  // off the end of the row.
+  for (size_t pass = 1; pass < L; ++pass) {
+    carry = __builtin_shuffle(carry, inf, shift_up);
+    for (size_t v = 0; v != seg_len; ++v) {
+      Lanes improves = carry < del[v];
+      bool any_improves = false;
+      for (size_t lane = 0; lane != L; ++lane) {
+        any_improves |= improves[lane] != 0;
+      }
+      if (!any_improves) {
+        // Anything carried further would be even more expensive.
+        return;
+      }
+      del[v] = VEC_MIN(del[v], carry);
+      carry += costs.extend_del;
+    }
+  }
+#undef VEC_MIN
+}
+
+__attribute__((target("avx2"))) void fill_row_avx2(const striped_row_args& args) {
+  fill_row_striped<4>(args);
+}
+
+__attribute__((target("sse4.1"))) void fill_row_sse41(const striped_row_args& args) {
+  fill_row_striped<2>(args);
+}
+
+void fill_row_default(const striped_row_args& args) {
+  fill_row_striped<1>(args);
+}
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+bool cpu_has_sse41() {
+  static const bool has_sse41 = __builtin_cpu_supports("sse4.1");
+  return has_sse41;
+}
+
+// Widest instruction set allowed by set_align_dp_simd.
+std::atomic<align_dp_simd> g_align_dp_simd_limit{align_dp_simd::avx2};
+
+unsigned simd_lanes(align_dp_simd simd) {
+  switch (simd) {
+    case align_dp_simd::avx2:
+      return 4;
+    case align_dp_simd::sse41:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// Returns storage for matrices to the calling thread's pool when
+// destroyed.  Matrices for long reads are big enough that allocating
+// them for each alignment is a significant cost.
+class pooled_matrix {
+ public:
+  pooled_matrix() {
+    auto& pool = get_pool();
+    if (!pool.empty()) {
+      m_data = std::move(pool.back());
+      pool.pop_back();
+    }
+  }
+  pooled_matrix(pooled_matrix&&) = default;
+  ~pooled_matrix() {
+    auto& pool = get_pool();
+    if (m_data.capacity() && pool.size() < k_max_pool_size) {
+      pool.push_back(std::move(m_data));
+    }
+  }
+
+  void resize(size_t size) { m_data.resize(size); }
+  double* data() { return m_data.data(); }
+  const double* data() const { return m_data.data(); }
+
+ private:
+  static constexpr size_t k_max_pool_size = 16;
+
+  static std::vector<std::vector<double>>& get_pool() {
+    static thread_local std::vector<std::vector<double>> pool;
+    return pool;
+  }
+
+  std::vector<double> m_data;
+};
+
+// Affine gap DP matrices for aligning a read against a single sequence.
+//
+// An alignment may start in the match matrix at read position r and
+// sequence position j < entry_limit at the cost given by entry_costs[r].
+//
+// Rows are stored in striped order (see striped_row_args), with as many
+// lanes as the selected instruction set fits in a vector.
+class affine_dp {
+ public:
+  affine_dp(const dna_sequence& read, const dna_sequence& seq, const cost_matrix& costs,
+            const std::vector<double>& entry_costs, size_t entry_limit);
+
+  double at(int op, size_t r, size_t j) const {
+    return m_matrix[op].data()[r * m_row_size + striped_index(j)];
+  }
+
+  // Returns the lowest cost of any state at read position r.  If
+  // "j_out" and "op_out" are given, they are set to the position and
+  // matrix of that state.
+  double row_min(size_t r, size_t* j_out = nullptr, int* op_out = nullptr) const;
+
+  // Returns the lowest cost of any state at (r, j).
+  double cell_min(size_t r, size_t j, int* op_out = nullptr) const {
+    return cell_min_at(r * m_row_size + striped_index(j), op_out);
+  }
+
+  // Traces back from the given state to where it entered the matrix,
+  // appending states to "rpath" in reverse order.  The entry state is
+  // the last one appended.  Returns the read position of the entry.
+  size_t trace(size_t r, size_t j, int op, int seq_num, std::vector<align_state>& rpath) const;
+
+ private:
+  size_t striped_index(size_t j) const { return (j % m_seg_len) * m_lanes + j / m_seg_len; }
+  double cell_min_at(size_t idx, int* op_out) const;
+
+  const dna_sequence& m_read;
+  const cost_matrix& m_costs;
+  const std::vector<double>& m_entry_costs;
+  const size_t m_entry_limit;
+  const size_t m_seq_size;
+  const align_dp_simd m_simd;
+  const unsigned m_lanes;
+  const size_t m_seg_len;
+  const size_t m_row_size;
+
+  // Cost of aligning each read base to each sequence position, in
+  // striped order.  Position j is aligned against seq[j - 1].
+  std::vector<double> m_sub[4];
+  pooled_matrix m_matrix[k_num_ops];
+};
+
+affine_dp::affine_dp(const dna_sequence& read, const dna_sequence& seq, const cost_matrix& costs,
+                     const std::vector<double>& entry_costs, size_t entry_limit)
+    : m_read(read),
+      m_costs(costs),
+      m_entry_costs(entry_costs),
+      m_entry_limit(entry_limit),
+      m_seq_size(seq.size()),
+      m_simd(get_align_dp_simd()),
+      m_lanes(simd_lanes(m_simd)),
+      m_seg_len((seq.size() + m_lanes) / m_lanes),
+      m_row_size(m_seg_len * m_lanes) {
+  const size_t m = read.size();
+  const size_t n = seq.size();
+  CHECK_EQ(entry_costs.size(), m + 1);
+  CHECK_LE(entry_limit, n + 1);
+
+  std::vector<double> entry_bias(m_row_size, k_inf);
+  for (size_t j = 0; j < entry_limit; ++j) {
+    entry_bias[striped_index(j)] = 0;
+  }
+  for (int base = 0; base < 4; ++base) {
+    m_sub[base].assign(m_row_size, k_inf);
+    for (size_t j = 1; j <= n; ++j) {
+      m_sub[base][striped_index(j)] = int(seq[j - 1]) == base ? 0 : costs.mismatch;
+    }
+  }
+  for (auto& matrix : m_matrix) {
+    matrix.resize((m + 1) * m_row_size);
+  }
+
+  void (*fill_row)(const striped_row_args&) = fill_row_default;
+  switch (m_simd) {
+    case align_dp_simd::avx2:
+      fill_row = fill_row_avx2;
+      break;
+    case align_dp_simd::sse41:
+      fill_row = fill_row_sse41;
+      break;
+    default:
+      break;
+  }
+
+  const std::vector<double> inf_row(m_row_size, k_inf);
+  striped_row_args args;
+  args.seg_len = m_seg_len;
+  args.entry_bias = entry_bias.data();
+  args.costs = &costs;
+  for (size_t r = 0; r <= m; ++r) {
+    args.match = m_matrix[k_op_match].data() + r * m_row_size;
+    args.ins = m_matrix[k_op_ins].data() + r * m_row_size;
+    args.del = m_matrix[k_op_del].data() + r * m_row_size;
+    if (r == 0) {
+      args.prev_match = args.prev_ins = args.prev_del = inf_row.data();
+      // Only entry is possible in the first row, so any base will do.
+      args.sub = m_sub[0].data();
+    } else {
+      args.prev_match = args.match - m_row_size;
+      args.prev_ins = args.ins - m_row_size;
+      args.prev_del = args.del - m_row_size;
+      args.sub = m_sub[int(read[r - 1])].data();
+    }
+    args.entry_cost = entry_costs[r];
+    fill_row(args);
+  }
+}
+
+double affine_dp::cell_min_at(size_t idx, int* op_out) const {
+  double best = k_inf;
+  for (int op = 0; op != k_num_ops; ++op) {
+    double cost = m_matrix[op].data()[idx];
+    if (cost < best) {
+      best = cost;
+      if (op_out) {
+        *op_out = op;
+      }
+    }
+  }
+  return best;
+}
+
+double affine_dp::row_min(size_t r, size_t* j_out, int* op_out) const {
+  double best = k_inf;
+  // Visit positions in order, so ties go to the lowest j.
+  size_t j = 0;
+  for (unsigned lane = 0; lane != m_lanes; ++lane) {
+    size_t idx = r * m_row_size + lane;
+    for (size_t v = 0; v != m_seg_len && j <= m_seq_size; ++v, ++j, idx += m_lanes) {
+      int op;
+      double cost = cell_min_at(idx, &op);
+      if (cost < best) {
+        best = cost;
+        if (j_out) {
+          *j_out = j;
+        }
+        if (op_out) {
+          *op_out = op;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+size_t affine_dp::trace(size_t r, size_t j, int op, int seq_num,
+                        std::vector<align_state>& rpath) const {
+  for (;;) {
+    rpath.emplace_back(r, seq_num, j, op);
+    double cost = at(op, r, j);
+    switch (op) {
+      case k_op_match: {
+        if (j < m_entry_limit && cost == m_entry_costs[r]) {
+          return r;
+        }
+        CHECK_GT(r, 0);
+        CHECK_GT(j, 0);
+        double sub = m_sub[int(m_read[r - 1])][striped_index(j)];
+        --r;
+        --j;
+        if (at(k_op_match, r, j) + sub == cost) {
+          op = k_op_match;
+        } else {
+          op = at(k_op_ins, r, j) + sub == cost ? k_op_ins : k_op_del;
+        }
+        break;
+      }
+      case k_op_ins:
+        CHECK_GT(r, 0);
+        --r;
+        if (at(k_op_ins, r, j) + m_costs.extend_ins == cost) {
+          op = k_op_ins;
+        } else {
+          op = at(k_op_match, r, j) + m_costs.ins == cost ? k_op_match : k_op_del;
+        }
+        break;
+      case k_op_del:
+        CHECK_GT(j, 0);
+        --j;
+        if (at(k_op_del, r, j) + m_costs.extend_del == cost) {
+          op = k_op_del;
+        } else {
+          op = at(k_op_match, r, j) + m_costs.del == cost ? k_op_match : k_op_ins;
+        }
+        break;
+      default:
+        LOG(FATAL) << "Unknown op " << op;
+    }
+    DCHECK_LT(at(op, r, j), k_inf);
+  }
+}
+
+std::vector<double> entry_at_start(const dna_sequence& read) {
+  std::vector<double> entry_costs(read.size() + 1, k_inf);
+  entry_costs[0] = 0;
+  return entry_costs;
+}
+
+// Appends a path traced in reverse to "out".  (std::reverse can't be
+// used, since swapping align_states doesn't swap last_op.)
+void append_path(std::vector<align_state>& out, const std::vector<align_state>& rpath) {
+  out.insert(out.end(), rpath.rbegin(), rpath.rend());
+}
+
+}  // namespace
+
+align_dp_simd align_dp_best_simd() {
+  if (cpu_has_avx2()) {
+    return align_dp_simd::avx2;
+  }
+  if (cpu_has_sse41()) {
+    return align_dp_simd::sse41;
+  }
+  return align_dp_simd::none;
+}
+
+void set_align_dp_simd(align_dp_simd simd) { g_align_dp_simd_limit = simd; }
+
+align_dp_simd get_align_dp_simd() {
+  return std::min(g_align_dp_simd_limit.load(), align_dp_best_simd());
+}
+
+unsigned myers_edit_distance(const dna_sequence& read, const dna_sequence& seq, bool global) {
+  const size_t m = read.size();
+  if (m == 0) {
+    return global ? seq.size() : 0;
+  }
+
+  // Each block tracks the vertical deltas of 64 rows of the DP matrix.
+  const size_t blocks = (m + 63) / 64;
+  std::vector<uint64_t> peq(4 * blocks, 0);
+  for (size_t i = 0; i < m; ++i) {
+    peq[int(read[i]) * blocks + i / 64] |= uint64_t(1) << (i % 64);
+  }
+  std::vector<uint64_t> pv(blocks, ~uint64_t(0));
+  std::vector<uint64_t> mv(blocks, 0);
+  const uint64_t last_high_bit = uint64_t(1) << ((m - 1) % 64);
+
+  long score = m;
+  long best = score;
+  for (dna_base b : seq) {
+    const uint64_t* eqs = peq.data() + int(b) * blocks;
+    // The top row is all zeros if read can start anywhere in seq.
+    int hin = global ? 1 : 0;
+    for (size_t block = 0; block != blocks; ++block) {
+      const uint64_t high_bit = block + 1 == blocks ? last_high_bit : uint64_t(1) << 63;
+      uint64_t eq = eqs[block];
+      const uint64_t p = pv[block];
+      const uint64_t mm = mv[block];
+
+      const uint64_t xv = eq | mm;
+      if (hin < 0) {
+        eq |= 1;
+      }
+      const uint64_t xh = (((eq & p) + p) ^ p) | eq;
+      uint64_t ph = mm | ~(xh | p);
+      uint64_t mh = p & xh;
+
+      int hout = 0;
+      if (ph & high_bit) {
+        hout = 1;
+      } else if (mh & high_bit) {
+        hout = -1;
+      }
+
+      ph <<= 1;
+      mh <<= 1;
+      if (hin < 0) {
+        mh |= 1;
+      } else if (hin > 0) {
+        ph |= 1;
+      }
+      pv[block] = mh | ~(xv | ph);
+      mv[block] = ph & xv;
+      hin = hout;
+    }
+    score += hin;
+    best = std::min(best, score);
+  }
+  return global ? score : best;
+}
+
+double align_dp_exact(std::vector<align_state>& out, const dna_sequence& read,
+                      const dna_sequence& seq, const cost_matrix& costs, double max_cost) {
+  if (edit_distance_exceeds(myers_edit_distance(read, seq, true /* global */), costs, max_cost)) {
+    return max_cost;
+  }
+
+  std::vector<double> entry_costs = entry_at_start(read);
+  affine_dp dp(read, seq, costs, entry_costs, 1 /* entry only at start of seq */);
+  int op;
+  double cost = dp.cell_min(read.size(), seq.size(), &op);
+  if (cost >= max_cost) {
+    return max_cost;
+  }
+
+  std::vector<align_state> rpath;
+  dp.trace(read.size(), seq.size(), op, 0, rpath);
+  // The goal state doesn't record how it was reached.
+  rpath.front().last_op = 0;
+  append_path(out, rpath);
+  return cost;
+}
+
+double align_dp_float(std::vector<align_state>& out, const dna_sequence& read,
+                      const dna_sequence& seq, const cost_matrix& costs, double max_cost) {
+  if (seq.size() == 0 ||
+      edit_distance_exceeds(myers_edit_distance(read, seq, false /* global */), costs,
+                            max_cost)) {
+    return max_cost;
+  }
+
+  std::vector<double> entry_costs = entry_at_start(read);
+  affine_dp dp(read, seq, costs, entry_costs, seq.size());
+  size_t j;
+  int op;
+  double cost = dp.row_min(read.size(), &j, &op);
+  if (cost >= max_cost) {
+    return max_cost;
+  }
+
+  std::vector<align_state> rpath;
+  rpath.emplace_back(read.size(), 1, -1);
+  dp.trace(read.size(), j, op, 0, rpath);
+  rpath.emplace_back(0, 0, -1);
+  append_path(out, rpath);
+  return cost;
+}
+
+double align_dp_skip(std::vector<align_state>& out, const dna_sequence& read,
+                     const std::vector<dna_sequence>& seqs, const cost_matrix& costs,
+                     double max_cost) {
+  if (seqs.empty()) {
+    if (read.size() == 0 && max_cost > 0) {
+      out.emplace_back(0, 0, -1);
+      return 0;
+    }
+    return max_cost;
+  }
+
+  // entry_costs[k][r] is the cost to reach read position r before
+  // attaching to seqs[k]; entry_costs[seqs.size()] is the cost of
+  // finishing at each read position.  There's no useful edit distance
+  // bound here, since any part of the read may align to any of the
+  // sequences.
+  //
+  // Only the entry costs are kept from the forward pass, so only one
+  // sequence's matrices are allocated at a time.  The matrices are
+  // rebuilt from them one at a time when tracing back.
+  std::vector<std::vector<double>> entry_costs;
+  entry_costs.reserve(seqs.size() + 1);
+  entry_costs.push_back(entry_at_start(read));
+  for (const auto& seq : seqs) {
+    if (seq.size() == 0 ||
+        *std::min_element(entry_costs.back().begin(), entry_costs.back().end()) >= max_cost) {
+      return max_cost;
+    }
+    affine_dp dp(read, seq, costs, entry_costs.back(), seq.size());
+    std::vector<double> next_entry(read.size() + 1);
+    for (size_t r = 0; r <= read.size(); ++r) {
+      next_entry[r] = dp.row_min(r);
+    }
+    entry_costs.push_back(std::move(next_entry));
+  }
+
+  double cost = entry_costs.back()[read.size()];
+  if (cost >= max_cost) {
+    return max_cost;
+  }
+
+  std::vector<align_state> rpath;
+  size_t r = read.size();
+  rpath.emplace_back(r, seqs.size(), -1);
+  for (size_t k = seqs.size(); k--;) {
+    affine_dp dp(read, seqs[k], costs, entry_costs[k], seqs[k].size());
+    size_t j;
+    int op;
+    dp.row_min(r, &j, &op);
+    r = dp.trace(r, j, op, k, rpath);
+    rpath.emplace_back(r, k, -1);
+  }
+  CHECK_EQ(r, 0);
+  append_path(out, rpath);
+  return cost;
+}
+
+double align_dp_any(std::vector<align_state>& out, const dna_sequence& read,
+                    const std::vector<dna_sequence>& seqs, const cost_matrix& costs,
+                    double max_cost) {
+  if (seqs.empty()) {
+    if (read.size() == 0 && max_cost > 0) {
+      out.emplace_back(0, 0, -1);
+      return 0;
+    }
+    return max_cost;
+  }
+
+  std::vector<double> entry_costs = entry_at_start(read);
+  std::unique_ptr<affine_dp> best_dp;
+  size_t best_seq_num = 0;
+  double cost = max_cost;
+  for (size_t k = 0; k != seqs.size(); ++k) {
+    const dna_sequence& seq = seqs[k];
+    if (seq.size() == 0 ||
+        edit_distance_exceeds(myers_edit_distance(read, seq, false /* global */), costs, cost)) {
+      continue;
+    }
+    auto dp = make_unique<affine_dp>(read, seq, costs, entry_costs, seq.size());
+    double seq_cost = dp->row_min(read.size());
+    if (seq_cost < cost) {
+      cost = seq_cost;
+      best_dp = std::move(dp);
+      best_seq_num = k;
+    }
+  }
+  if (!best_dp) {
+    return max_cost;
+  }
+
+  std::vector<align_state> rpath;
+  size_t j;
+  int op;
+  best_dp->row_min(read.size(), &j, &op);
+  rpath.emplace_back(read.size(), seqs.size(), -1);
+  best_dp->trace(read.size(), j, op, best_seq_num, rpath);
+  rpath.emplace_back(0, 0, -1);
+  append_path(out, rpath);
+  return cost;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Dynamic programming implementations of the align_astar_* alignment
+// modes.  These compute optimal alignments under the same cost_matrix
+// model as the A* search (a gap is opened by the first inserted or
+// deleted base, and extended by each subsequent one), but run in time
+// proportional to the DP matrix instead of degrading on divergent
+// reads.
+//
+// Matrix rows are filled with a striped (Farrar) SIMD kernel, using
+// AVX2 or SSE4.1 if the CPU supports them.  Before filling the matrix,
+// a bit-parallel (Myers) edit distance is used to reject alignments
+// that can't possibly cost less than max_cost.
+//
+// Return values and paths match align_astar_*: on success, the path of
+// align_states from start to goal is appended to "out" and the cost is
+// returned.  Otherwise, max_cost is returned and "out" is left alone.
+
+#include <vector>
+
+#include "modules/bio_base/align_astar.h"
+
+// Instruction sets the DP matrix fill can use.  Wider ones process
+// more sequence positions per instruction; all give identical results.
+enum class align_dp_simd { none, sse41, avx2 };
+
+// Returns the widest instruction set this CPU supports.
+align_dp_simd align_dp_best_simd();
+
+// Limits the instruction set used to fill DP matrices, for testing and
+// benchmarking.  get_align_dp_simd returns the one actually used.
+void set_align_dp_simd(align_dp_simd simd);
+align_dp_simd get_align_dp_simd();
+
+// Returns the unit cost edit distance between read and seq, using
+// Myers' bit-parallel algorithm.  If "global" is false, read may align
+// to any substring of seq.
+unsigned myers_edit_distance(const dna_sequence& read, const dna_sequence& seq, bool global);
+
+double align_dp_exact(std::vector<align_state>& out, const dna_sequence& read,
+                      const dna_sequence& seq, const cost_matrix& costs, double max_cost);
+double align_dp_float(std::vector<align_state>& out, const dna_sequence& read,
+                      const dna_sequence& seq, const cost_matrix& costs, double max_cost);
+double align_dp_skip(std::vector<align_state>& out, const dna_sequence& read,
+                     const std::vector<dna_sequence>& seqs, const cost_matrix& costs,
+                     double max_cost);
+double align_dp_any(std::vector<align_state>& out, const dna_sequence& read,
+                    const std::vector<dna_sequence>& seqs, const cost_matrix& costs,
+                    double max_cost);
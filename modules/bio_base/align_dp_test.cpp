@@ -0,0 +1,273 @@
+#include "modules/bio_base/align_dp.h"
+
+#include <gtest/gtest.h>
+#include <random>
+
+#include "modules/bio_base/dna_testutil.h"
+
+namespace {
+
+constexpr double k_max_cost = 1000;
+
+// Unit cost edit distance, calculated the slow way.
+unsigned naive_edit_distance(const dna_sequence& read, const dna_sequence& seq, bool global) {
+  std::vector<unsigned> prev(seq.size() + 1), cur(seq.size() + 1);
+  for (size_t j = 0; j <= seq.size(); ++j) {
+    prev[j] = global ? j : 0;
+  }
+  for (size_t i = 1; i <= read.size(); ++i) {
+    cur[0] = i;
+    for (size_t j = 1; j <= seq.size(); ++j) {
+      cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1,
+                         prev[j - 1] + (read[i - 1] == seq[j - 1] ? 0 : 1)});
+    }
+    std::swap(prev, cur);
+  }
+  return global ? prev.back() : *std::min_element(prev.begin(), prev.end());
+}
+
+dna_sequence mutate(std::mt19937& rand_source, const dna_sequence& seq, unsigned error_rate) {
+  dna_sequence result;
+  for (size_t i = 0; i < seq.size(); ++i) {
+    if (rand_source() % error_rate) {
+      result.push_back(seq[i]);
+      continue;
+    }
+    switch (rand_source() % 3) {
+      case 0:
+        result.push_back(dna_base(int(rand_source() % 4)));
+        break;
+      case 1:
+        result += rand_dna_sequence(rand_source, 1 + rand_source() % 3);
+        result.push_back(seq[i]);
+        break;
+      case 2:
+        i += rand_source() % 3;
+        break;
+    }
+  }
+  return result;
+}
+
+// Returns the cost of the given path under the A* cost model, and
+// checks that each step is a valid transition.
+double path_cost(const std::vector<align_state>& path, const dna_sequence& read,
+                 const std::vector<dna_sequence>& seqs, const cost_matrix& costs) {
+  double cost = 0;
+  for (size_t i = 1; i < path.size(); ++i) {
+    const align_state& a = path[i - 1];
+    const align_state& b = path[i];
+    if (a.seq_pos == -1 || b.seq_pos == -1) {
+      // Attaching to or detaching from a sequence is free.
+      EXPECT_EQ(a.read_pos, b.read_pos);
+      continue;
+    }
+    EXPECT_EQ(a.seq_num, b.seq_num);
+    const dna_sequence& seq = seqs[a.seq_num];
+    int dr = b.read_pos - a.read_pos;
+    int ds = b.seq_pos - a.seq_pos;
+    if (dr == 1 && ds == 1) {
+      if (read[a.read_pos] != seq[a.seq_pos]) {
+        cost += costs.mismatch;
+      }
+    } else if (dr == 1 && ds == 0) {
+      cost += a.last_op == 1 ? costs.extend_ins : costs.ins;
+    } else if (dr == 0 && ds == 1) {
+      cost += a.last_op == 2 ? costs.extend_del : costs.del;
+    } else {
+      ADD_FAILURE() << "Invalid step from " << a.read_pos << ":" << a.seq_num << ":" << a.seq_pos
+                    << " to " << b.read_pos << ":" << b.seq_num << ":" << b.seq_pos;
+    }
+  }
+  return cost;
+}
+
+class align_dp_test : public ::testing::Test {
+ public:
+  void TearDown() override {
+    set_align_engine(align_engine::astar);
+    set_align_dp_simd(align_dp_simd::avx2);
+  }
+
+  std::mt19937 m_rand_source{1};
+  cost_matrix m_costs;
+};
+
+}  // namespace
+
+TEST_F(align_dp_test, myers_matches_naive) {
+  for (unsigned read_len : {0, 1, 5, 63, 64, 65, 130, 200}) {
+    for (int i = 0; i < 20; ++i) {
+      dna_sequence seq = rand_dna_sequence(m_rand_source, 1 + m_rand_source() % 250);
+      dna_sequence read;
+      if (read_len) {
+        size_t start = m_rand_source() % seq.size();
+        read = mutate(m_rand_source, seq.subseq(start, std::min<size_t>(seq.size() - start,
+                                                                          read_len)),
+                      10);
+      }
+      EXPECT_EQ(naive_edit_distance(read, seq, true), myers_edit_distance(read, seq, true))
+          << read << " vs " << seq;
+      EXPECT_EQ(naive_edit_distance(read, seq, false), myers_edit_distance(read, seq, false))
+          << read << " vs " << seq;
+    }
+  }
+}
+
+TEST_F(align_dp_test, exact) {
+  std::vector<align_state> path;
+  EXPECT_EQ(0, align_dp_exact(path, dna_sequence("ACGTACGT"), dna_sequence("ACGTACGT"), m_costs,
+                              k_max_cost));
+  ASSERT_EQ(9, path.size());
+  EXPECT_EQ(align_state(0, 0, 0), path.front());
+  EXPECT_EQ(align_state(8, 0, 8), path.back());
+
+  path.clear();
+  EXPECT_EQ(m_costs.mismatch, align_dp_exact(path, dna_sequence("ACGTACGT"),
+                                             dna_sequence("ACGAACGT"), m_costs, k_max_cost));
+
+  // A 3 base gap is opened once and extended twice.
+  path.clear();
+  EXPECT_EQ(m_costs.del + 2 * m_costs.extend_del,
+            align_dp_exact(path, dna_sequence("ACGTACGT"), dna_sequence("ACGTTTTACGT"), m_costs,
+                           k_max_cost));
+  EXPECT_EQ(m_costs.del + 2 * m_costs.extend_del,
+            path_cost(path, dna_sequence("ACGTACGT"), {dna_sequence("ACGTTTTACGT")}, m_costs));
+
+  path.clear();
+  EXPECT_EQ(m_costs.ins + 2 * m_costs.extend_ins,
+            align_dp_exact(path, dna_sequence("ACGTTTTACGT"), dna_sequence("ACGTACGT"), m_costs,
+                           k_max_cost));
+
+  // Too expensive.
+  path.clear();
+  EXPECT_EQ(2, align_dp_exact(path, dna_sequence("AAAA"), dna_sequence("CCCC"), m_costs, 2));
+  EXPECT_TRUE(path.empty());
+}
+
+TEST_F(align_dp_test, float_and_any) {
+  dna_sequence seq("TTTTTTACGTACGTGGGGG");
+  std::vector<align_state> path;
+  EXPECT_EQ(0, align_dp_float(path, dna_sequence("ACGTACGT"), seq, m_costs, k_max_cost));
+  ASSERT_EQ(11, path.size());
+  EXPECT_EQ(align_state(0, 0, -1), path[0]);
+  EXPECT_EQ(align_state(0, 0, 6), path[1]);
+  EXPECT_EQ(align_state(8, 0, 14), path[9]);
+  EXPECT_EQ(align_state(8, 1, -1), path[10]);
+
+  path.clear();
+  EXPECT_EQ(0, align_dp_any(path, dna_sequence("ACGTACGT"),
+                            {dna_sequence("GGGGGGGG"), seq, dna_sequence("AAAAAAAA")}, m_costs,
+                            k_max_cost));
+  ASSERT_EQ(11, path.size());
+  EXPECT_EQ(align_state(0, 0, -1), path[0]);
+  EXPECT_EQ(align_state(0, 1, 6), path[1]);
+  EXPECT_EQ(align_state(8, 3, -1), path[10]);
+}
+
+TEST_F(align_dp_test, skip) {
+  std::vector<dna_sequence> genes = {dna_sequence("ACTTACGTAGCTAGCTCAGCTTTAGC"),
+                                     dna_sequence("CCGTAGAAAACTGACCTGACTAGCTA")};
+  dna_sequence read("TAGCAGCTCAGAAAACTGACCCTGA");
+  std::vector<align_state> path;
+  double cost = align_dp_skip(path, read, genes, m_costs, k_max_cost);
+  EXPECT_LT(cost, k_max_cost);
+  EXPECT_EQ(cost, path_cost(path, read, genes, m_costs));
+  EXPECT_EQ(align_state(0, 0, -1), path.front());
+  EXPECT_EQ(align_state(read.size(), 2, -1), path.back());
+
+  std::vector<align_state> astar_path;
+  EXPECT_LE(cost, align_astar_skip(astar_path, read, genes, m_costs, k_max_cost));
+}
+
+// Compares against the A* search, which may not always find the best
+// alignment but should be close.
+TEST_F(align_dp_test, matches_astar) {
+  for (int i = 0; i < 50; ++i) {
+    dna_sequence seq = rand_dna_sequence(m_rand_source, 30 + m_rand_source() % 40);
+    dna_sequence read = mutate(m_rand_source, seq.subseq(5, seq.size() - 10), 15);
+    std::vector<dna_sequence> seqs = {rand_dna_sequence(m_rand_source, 20), seq};
+
+    std::vector<align_state> dp_path, astar_path;
+    double dp_cost = align_dp_exact(dp_path, read, seq, m_costs, k_max_cost);
+    double astar_cost = align_astar_exact(astar_path, read, seq, m_costs, k_max_cost);
+    EXPECT_LE(dp_cost, astar_cost);
+    EXPECT_GE(dp_cost + 2 * m_costs.ins, astar_cost);
+    EXPECT_EQ(dp_cost, path_cost(dp_path, read, {seq}, m_costs));
+
+    dp_path.clear();
+    astar_path.clear();
+    dp_cost = align_dp_float(dp_path, read, seq, m_costs, k_max_cost);
+    astar_cost = align_astar_float(astar_path, read, seq, m_costs, k_max_cost);
+    EXPECT_LE(dp_cost, astar_cost);
+    EXPECT_EQ(dp_cost, path_cost(dp_path, read, {seq}, m_costs));
+
+    dp_path.clear();
+    astar_path.clear();
+    dp_cost = align_dp_any(dp_path, read, seqs, m_costs, k_max_cost);
+    astar_cost = align_astar_any(astar_path, read, seqs, m_costs, k_max_cost);
+    EXPECT_LE(dp_cost, astar_cost);
+    EXPECT_EQ(dp_cost, path_cost(dp_path, read, seqs, m_costs));
+
+    dp_path.clear();
+    astar_path.clear();
+    dp_cost = align_dp_skip(dp_path, read, seqs, m_costs, k_max_cost);
+    astar_cost = align_astar_skip(astar_path, read, seqs, m_costs, k_max_cost);
+    EXPECT_LE(dp_cost, astar_cost);
+    EXPECT_EQ(dp_cost, path_cost(dp_path, read, seqs, m_costs));
+  }
+}
+
+TEST_F(align_dp_test, select_engine) {
+  dna_sequence read("ACGTACGT");
+  dna_sequence seq("ACGAACGT");
+  std::vector<align_state> astar_path, dp_path;
+  EXPECT_EQ(m_costs.mismatch, align_astar_exact(astar_path, read, seq, m_costs, k_max_cost));
+  set_align_engine(align_engine::dp);
+  EXPECT_EQ(align_engine::dp, get_align_engine());
+  EXPECT_EQ(m_costs.mismatch, align_astar_exact(dp_path, read, seq, m_costs, k_max_cost));
+  EXPECT_EQ(astar_path, dp_path);
+}
+
+// Each instruction set should find exactly the same alignments as the
+// scalar fill, including with gap costs that need deletions carried
+// across several segments.
+TEST_F(align_dp_test, simd_matches_scalar) {
+  for (int i = 0; i < 200; ++i) {
+    cost_matrix costs;
+    costs.mismatch = 0.5 * (1 + m_rand_source() % 8);
+    costs.ins = 0.5 * (1 + m_rand_source() % 8);
+    costs.del = 0.5 * (1 + m_rand_source() % 8);
+    costs.extend_ins = 0.5 * (1 + m_rand_source() % 8);
+    costs.extend_del = 0.25 * (1 + m_rand_source() % 8);
+    dna_sequence seq = rand_dna_sequence(m_rand_source, 1 + m_rand_source() % 150);
+    dna_sequence read = mutate(m_rand_source, seq, 2 + m_rand_source() % 20);
+    std::vector<dna_sequence> seqs = {rand_dna_sequence(m_rand_source, 1 + m_rand_source() % 30),
+                                      seq};
+
+    std::vector<align_state> expected[4];
+    double expected_cost[4];
+    set_align_dp_simd(align_dp_simd::none);
+    ASSERT_EQ(align_dp_simd::none, get_align_dp_simd());
+    expected_cost[0] = align_dp_exact(expected[0], read, seq, costs, k_max_cost);
+    expected_cost[1] = align_dp_float(expected[1], read, seq, costs, k_max_cost);
+    expected_cost[2] = align_dp_any(expected[2], read, seqs, costs, k_max_cost);
+    expected_cost[3] = align_dp_skip(expected[3], read, seqs, costs, k_max_cost);
+
+    for (align_dp_simd simd : {align_dp_simd::sse41, align_dp_simd::avx2}) {
+      if (simd > align_dp_best_simd()) {
+        continue;
+      }
+      set_align_dp_simd(simd);
+      ASSERT_EQ(simd, get_align_dp_simd());
+      std::vector<align_state> path[4];
+      EXPECT_EQ(expected_cost[0], align_dp_exact(path[0], read, seq, costs, k_max_cost));
+      EXPECT_EQ(expected_cost[1], align_dp_float(path[1], read, seq, costs, k_max_cost));
+      EXPECT_EQ(expected_cost[2], align_dp_any(path[2], read, seqs, costs, k_max_cost));
+      EXPECT_EQ(expected_cost[3], align_dp_skip(path[3], read, seqs, costs, k_max_cost));
+      for (int mode = 0; mode != 4; ++mode) {
+        EXPECT_EQ(expected[mode], path[mode]) << "Mode " << mode << " simd " << int(simd);
+      }
+    }
+  }
+}
@@ -62,6 +62,14 @@ public:
 		return fs::path(m_path / fs::path("assembly") / fs::path(sp + ".seqpath")).string();
 	}
 
+	// Nominal path to the reference map for the reference with the given
+	// checksum (see variants::ref_map::reference_checksum).  Maps for
+	// several references can be kept side by side.  Does not check for
+	// existence.
+	std::string ref_map(const std::string& ref_checksum) const {
+		return fs::path(m_path / fs::path("ref_map") / fs::path(ref_checksum + ".ref_map")).string();
+	}
+
 	// metadata
 	const biograph_metadata& get_metadata() const { return m_metadata; };
 
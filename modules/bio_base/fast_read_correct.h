@@ -5,7 +5,10 @@
 #include "modules/bio_base/kmer.h"
 #include "modules/io/string_view.h"
 
+#include <algorithm>
 #include <functional>
+#include <limits>
+#include <vector>
 
 struct frc_kmer {
   // True if kmer was flipped to look up in the kmer set.
@@ -61,3 +64,332 @@ struct frc_params {
 };
 
 frc_output fast_read_correct(string_view input, const frc_params& params);
+
+// Performs fast read correction like above, but calls "lookup"
+// instead of params.kmer_lookup_f so lookups can be inlined.
+// "lookup" must provide:
+//
+//   bool operator()(kmer_t kmer, frc_kmer* kmer_info) const;
+//   void prefetch(kmer_t kmer) const;
+//
+// Before correcting, all kmers in the input are looked up in one
+// batch, prefetching ahead of each lookup.  Correction then only calls
+// "lookup" for kmers containing corrected bases.  Results are
+// identical to the unbatched version.
+template <typename KmerLookup>
+frc_output fast_read_correct(string_view input, const frc_params& params,
+                             const KmerLookup& lookup);
+
+namespace frc_internal {
+
+inline kmer_t kmer_shift_left(kmer_t orig, unsigned kmer_size, dna_base b) {
+  kmer_t result = orig;
+  result <<= 2;
+  result |= int(b);
+  result &= ~(std::numeric_limits<kmer_t>::max() << (kmer_size * 2));
+  return result;
+}
+
+// Saves the results of looking up all the kmers in a read.
+class kmer_batch {
+ public:
+  // Number of lookups to prefetch ahead.
+  static constexpr size_t k_prefetch_distance = 8;
+
+  // Looks up all kmers in "input".  Reverse complements are only
+  // needed to correct bases before the first valid kmer, so only
+  // those are looked up.
+  template <typename KmerLookup>
+  void fill(string_view input, unsigned kmer_size, const KmerLookup& lookup) {
+    m_kmers.clear();
+    kmer_t kmer = 0;
+    unsigned valid_bases = 0;
+    for (char c : input) {
+      if (c == 'N') {
+        valid_bases = 0;
+        continue;
+      }
+      kmer = kmer_shift_left(kmer, kmer_size, dna_base(c));
+      if (++valid_bases >= kmer_size) {
+        m_kmers.push_back(kmer);
+      }
+    }
+
+    size_t table_size = 64;
+    while (table_size < m_kmers.size() * 4) {
+      table_size *= 2;
+    }
+    if (m_entries.size() < table_size) {
+      m_entries.resize(table_size);
+    }
+    m_mask = table_size - 1;
+    if (++m_generation == 0) {
+      // Generation wrapped around; invalidate everything.
+      for (entry& e : m_entries) {
+        e.generation = 0;
+      }
+      m_generation = 1;
+    }
+
+    size_t first_present = lookup_all(lookup);
+    m_kmers.resize(first_present);
+    for (kmer_t& kmer : m_kmers) {
+      kmer = rev_comp(kmer, kmer_size);
+    }
+    lookup_all(lookup);
+  }
+
+  // Looks up a kmer, using the saved results if available.
+  template <typename KmerLookup>
+  bool find(kmer_t kmer, frc_kmer* kmer_info, const KmerLookup& lookup) const {
+    const entry* e = probe(kmer);
+    if (e->generation != m_generation) {
+      return lookup(kmer, kmer_info);
+    }
+    if (e->present) {
+      *kmer_info = e->info;
+    }
+    return e->present;
+  }
+
+ private:
+  struct entry {
+    kmer_t kmer = 0;
+    frc_kmer info;
+    uint32_t generation = 0;
+    bool present = false;
+  };
+
+  // Looks up everything in m_kmers that hasn't been looked up yet.
+  // Returns the index of the first kmer present, or m_kmers.size() if
+  // none are.
+  template <typename KmerLookup>
+  size_t lookup_all(const KmerLookup& lookup) {
+    size_t first_present = m_kmers.size();
+    for (size_t i = 0; i != m_kmers.size(); ++i) {
+      if (i + k_prefetch_distance < m_kmers.size()) {
+        lookup.prefetch(m_kmers[i + k_prefetch_distance]);
+      }
+      entry* e = probe(m_kmers[i]);
+      if (e->generation != m_generation) {
+        e->generation = m_generation;
+        e->kmer = m_kmers[i];
+        e->present = lookup(m_kmers[i], &e->info);
+      }
+      if (e->present && first_present == m_kmers.size()) {
+        first_present = i;
+      }
+    }
+    return first_present;
+  }
+
+  // Returns the entry for the given kmer, or the empty entry where it
+  // would go.
+  entry* probe(kmer_t kmer) const {
+    size_t pos = (kmer * 0x9E3779B97F4A7C15ULL) >> 32;
+    for (;;) {
+      pos &= m_mask;
+      entry* e = &m_entries[pos];
+      if (e->generation != m_generation || e->kmer == kmer) {
+        return e;
+      }
+      ++pos;
+    }
+  }
+
+  std::vector<kmer_t> m_kmers;
+  mutable std::vector<entry> m_entries;
+  size_t m_mask = 0;
+  uint32_t m_generation = 0;
+};
+
+// Performs read correction down a slice.
+// "kmer" is the kmer of the bases up to but not including the first base in
+// "input".
+template <typename FindKmer>
+void correct_internal(frc_output* result, string_view input, kmer_t kmer, const frc_params& params,
+                      unsigned min_good_run_here, unsigned max_corrections,
+                      bool require_run_at_end, const FindKmer& find_kmer) {
+  auto it = input.begin();
+  DCHECK(it != input.end());
+  frc_kmer kmer_info;
+  DCHECK(find_kmer(kmer, &kmer_info));
+
+  if (*it != 'N') {
+    kmer_t next_kmer = kmer_shift_left(kmer, params.kmer_size, dna_base(*it));
+    while (find_kmer(next_kmer, &kmer_info)) {
+      result->corrected.push_back(dna_base(*it));
+      result->kmers.push_back(kmer_info);
+      ++it;
+      if (it == input.end()) {
+        return;
+      }
+      kmer = next_kmer;
+      if (*it == 'N') {
+        break;
+      }
+      next_kmer = kmer_shift_left(kmer, params.kmer_size, dna_base(*it));
+    }
+  }
+
+  if (result->corrected.size() < min_good_run_here) {
+    return;
+  }
+
+  if (max_corrections == 0) {
+    return;
+  }
+
+  ++it;
+
+  dna_base_array<frc_output> try_outputs;
+  unsigned best_size = 0;
+  dna_base best_b;
+  size_t input_left = input.end() - it;
+  for (dna_base b : dna_bases()) {
+    kmer_t try_kmer = kmer_shift_left(kmer, params.kmer_size, b);
+
+    if (!find_kmer(try_kmer, &kmer_info)) {
+      continue;
+    }
+
+    try_outputs[b].kmers.reserve(input_left);
+    try_outputs[b].kmers.push_back(kmer_info);
+
+    if (it != input.end()) {
+      correct_internal(&try_outputs[b], string_view(it, input_left), try_kmer, params,
+                       params.min_good_run, max_corrections - 1, require_run_at_end, find_kmer);
+    }
+    if (require_run_at_end && try_outputs[b].corrected.size() < params.min_good_run) {
+      continue;
+    }
+
+    CHECK_LT(try_outputs[b].corrections, max_corrections);
+    if (try_outputs[b].corrected.size() >= best_size) {
+      best_size = try_outputs[b].corrected.size() + 1;
+      best_b = b;
+    }
+  }
+
+  if (best_size) {
+    result->corrected.push_back(best_b);
+    result->corrections++;
+    const auto& best_output = try_outputs[best_b];
+    result->corrected += best_output.corrected;
+    result->corrections += best_output.corrections;
+    result->kmers.insert(result->kmers.end(), best_output.kmers.begin(), best_output.kmers.end());
+  }
+}
+
+// If "batched" is false, calls "lookup" for each kmer as needed
+// instead of looking them all up first.
+template <typename KmerLookup>
+frc_output fast_read_correct(string_view input, const frc_params& params,
+                             const KmerLookup& lookup, bool batched) {
+  frc_output result;
+  if (input.size() < params.kmer_size) {
+    return frc_output{};
+  }
+
+  static thread_local kmer_batch batch;
+  if (batched) {
+    batch.fill(input, params.kmer_size, lookup);
+  }
+  auto find_kmer = [&lookup, batched](kmer_t kmer, frc_kmer* kmer_info) {
+    if (batched) {
+      return batch.find(kmer, kmer_info, lookup);
+    }
+    return lookup(kmer, kmer_info);
+  };
+
+  unsigned max_corrections = params.max_corrections;
+
+  auto it = input.begin();
+  kmer_t kmer = 0;
+  unsigned initial_kmer_left = params.kmer_size;
+  frc_kmer kmer_info;
+
+  while (initial_kmer_left || !find_kmer(kmer, &kmer_info)) {
+    if (it == input.end()) {
+      // Unsuccessful finding any valid kmers.
+      return frc_output{};
+    }
+    if (*it == 'N') {
+      ++it;
+      initial_kmer_left = params.kmer_size;
+      continue;
+    }
+    kmer = kmer_shift_left(kmer, params.kmer_size, dna_base(*it));
+    ++it;
+    if (initial_kmer_left) {
+      --initial_kmer_left;
+    }
+  }
+
+  frc_output right_correct;
+  if (it == input.begin() + params.kmer_size) {
+    result.corrected = dna_sequence(string_view(input.begin(), params.kmer_size));
+    if (it == input.end()) {
+      result.kmers.push_back(kmer_info);
+      return result;
+    } else {
+      right_correct.kmers.reserve(input.size() - params.kmer_size);
+      right_correct.kmers.push_back(kmer_info);
+    }
+  } else {
+    auto kmer_start = it - params.kmer_size;
+    std::string left_to_correct(input.begin(), kmer_start - input.begin());
+    dna_sequence left_ok(string_view(kmer_start, params.kmer_size));
+
+    std::reverse(left_to_correct.begin(), left_to_correct.end());
+    for (char& c : left_to_correct) {
+      if (c != 'N') {
+        c = char(dna_base(c).complement());
+      }
+    }
+    frc_output left_correct;
+    left_correct.kmers.reserve(input.size() - params.kmer_size);
+    correct_internal(&left_correct, left_to_correct, rev_comp(kmer, params.kmer_size), params, 0,
+                     max_corrections, false /* don't require a run at the end */, find_kmer);
+
+    if (left_correct.corrected.size() != left_to_correct.size()) {
+      // Left correction failed.
+      return frc_output{};
+    }
+
+    result.corrected = left_correct.corrected.rev_comp();
+    result.corrected += left_ok;
+    for (auto& ki : left_correct.kmers) {
+      ki = ki.as_flipped();
+    }
+    CHECK(result.kmers.empty());
+    result.kmers = std::move(left_correct.kmers);
+    std::reverse(result.kmers.begin(), result.kmers.end());
+    result.kmers.push_back(kmer_info);
+    CHECK_LE(left_correct.corrections, max_corrections);
+    max_corrections -= left_correct.corrections;
+    result.corrections += left_correct.corrections;
+  }
+
+  if (it != input.end()) {
+    correct_internal(&right_correct, string_view(it, input.end() - it), kmer, params, 0,
+                     max_corrections, true /* require a run at the end */, find_kmer);
+  }
+  CHECK_LE(right_correct.corrections, max_corrections);
+  result.corrected += right_correct.corrected;
+  result.corrections += right_correct.corrections;
+  if (result.kmers.empty()) {
+    result.kmers = std::move(right_correct.kmers);
+  } else {
+    result.kmers.insert(result.kmers.end(), right_correct.kmers.begin(), right_correct.kmers.end());
+  }
+  return result;
+}
+
+}  // namespace frc_internal
+
+template <typename KmerLookup>
+frc_output fast_read_correct(string_view input, const frc_params& params,
+                             const KmerLookup& lookup) {
+  return frc_internal::fast_read_correct(input, params, lookup, true /* batched */);
+}
@@ -0,0 +1,92 @@
+#include "benchmark/benchmark.h"
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/bio_base/fast_read_correct.h"
+#include "modules/bio_base/kmer.h"
+#include "modules/bio_mapred/kmer_set.h"
+
+#include <random>
+
+namespace {
+
+constexpr unsigned k_kmer_size = 30;
+constexpr size_t k_genome_size = 16 * 1024 * 1024;
+constexpr size_t k_read_len = 150;
+constexpr size_t k_num_reads = 16 * 1024;
+// Error rate per base, as 1 in this many.
+constexpr unsigned k_error_rate = 200;
+
+std::unique_ptr<kmer_set> g_ks;
+std::vector<std::string> g_reads;
+
+void init() {
+  if (g_ks) {
+    return;
+  }
+  std::mt19937 rand_source(1);
+  dna_sequence genome = rand_dna_sequence(rand_source, k_genome_size);
+  g_ks = make_unique<kmer_set>(
+      k_genome_size, k_kmer_size, 1024ULL * 1024 * 1024,
+      [&](const kmer_set::kmer_output_f& output_f, progress_handler_t) {
+        for (kmer_t kmer : kmer_view(genome, k_kmer_size)) {
+          output_f(canonicalize(kmer, k_kmer_size), 0 /* flags */);
+        }
+      });
+
+  for (size_t i = 0; i < k_num_reads; ++i) {
+    size_t start = rand_source() % (genome.size() - k_read_len);
+    std::string read = genome.subseq(start, k_read_len).as_string();
+    for (char& c : read) {
+      if (rand_source() % k_error_rate == 0) {
+        c = "ACGT"[rand_source() % 4];
+      }
+    }
+    g_reads.push_back(read);
+  }
+}
+
+frc_params make_params() {
+  frc_params params;
+  params.kmer_size = k_kmer_size;
+  const kmer_set* ks = g_ks.get();
+  params.kmer_lookup_f = [ks](kmer_t kmer, frc_kmer* ki) -> bool {
+    kmer_t canon = canonicalize(kmer, ks->kmer_size(), ki->flipped);
+    auto index = ks->find_table_index(canon);
+    if (index == kmer_set::k_not_present) {
+      return false;
+    }
+    ki->index = index;
+    return true;
+  };
+  return params;
+}
+
+}  // namespace
+
+// Looks up each kmer through frc_params::kmer_lookup_f as needed.
+static void BM_fast_read_correct_function(benchmark::State& state) {
+  init();
+  frc_params params = make_params();
+  size_t read_idx = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(fast_read_correct(g_reads[read_idx], params));
+    read_idx = (read_idx + 1) % g_reads.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_fast_read_correct_function);
+
+// Looks up all kmers in each read in a batch with prefetching.
+static void BM_fast_read_correct_batched(benchmark::State& state) {
+  init();
+  frc_params params = make_params();
+  kmer_set_frc_lookup lookup(*g_ks);
+  size_t read_idx = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(fast_read_correct(g_reads[read_idx], params, lookup));
+    read_idx = (read_idx + 1) % g_reads.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_fast_read_correct_batched);
+
+BENCHMARK_MAIN();
@@ -4,6 +4,7 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <random>
 #include <set>
 #include <unordered_set>
 
@@ -256,3 +257,80 @@ INSTANTIATE_TEST_CASE_P(
                                          89, 90, 91, 92, 118, 119, 120, 121,
                                          122, 260),
                        ::testing::Values(error_behavior::DIFFERENT_BASE)));
+
+namespace {
+
+// Lookup functor for the templated version that counts lookups.
+class counting_lookup {
+ public:
+  counting_lookup(const std::function<bool(kmer_t, frc_kmer*)>& f) : m_f(f) {}
+
+  bool operator()(kmer_t kmer, frc_kmer* kmer_info) const {
+    ++m_lookups;
+    return m_f(kmer, kmer_info);
+  }
+  void prefetch(kmer_t) const { ++m_prefetches; }
+
+  size_t lookups() const { return m_lookups; }
+  size_t prefetches() const { return m_prefetches; }
+
+ private:
+  const std::function<bool(kmer_t, frc_kmer*)>& m_f;
+  mutable size_t m_lookups = 0;
+  mutable size_t m_prefetches = 0;
+};
+
+}  // namespace
+
+// The batched, templated version must produce exactly the same
+// results as calling kmer_lookup_f for each kmer.
+TEST(fast_read_correct_batched, matches_unbatched) {
+  std::mt19937 rand_source(1);
+  constexpr unsigned k_kmer_size = 30;
+  dna_sequence genome = rand_dna_sequence(rand_source, 5000);
+  std::unordered_set<kmer_t> kmers;
+  for (kmer_t kmer : kmer_view(genome, k_kmer_size)) {
+    kmers.insert(kmer);
+  }
+
+  frc_params params;
+  params.kmer_size = k_kmer_size;
+  size_t unbatched_lookups = 0;
+  std::function<bool(kmer_t, frc_kmer*)> find_kmer = [&](kmer_t kmer, frc_kmer* kmer_info) {
+    for (bool flipped : {false, true}) {
+      auto it = kmers.find(flipped ? rev_comp(kmer, k_kmer_size) : kmer);
+      if (it != kmers.end()) {
+        kmer_info->index = *it % 1000003;
+        kmer_info->flipped = flipped;
+        return true;
+      }
+    }
+    return false;
+  };
+  params.kmer_lookup_f = [&](kmer_t kmer, frc_kmer* kmer_info) {
+    ++unbatched_lookups;
+    return find_kmer(kmer, kmer_info);
+  };
+
+  size_t batched_lookups = 0;
+  for (size_t i = 0; i < 2000; ++i) {
+    size_t read_len = 40 + rand_source() % 120;
+    size_t start = rand_source() % (genome.size() - read_len);
+    std::string read = genome.subseq(start, read_len).as_string();
+    size_t num_errors = rand_source() % 4;
+    for (size_t j = 0; j < num_errors; ++j) {
+      char& c = read[rand_source() % read.size()];
+      c = (rand_source() % 5 == 0) ? 'N' : "ACGT"[rand_source() % 4];
+    }
+
+    frc_output expected = fast_read_correct(read, params);
+    counting_lookup lookup(find_kmer);
+    frc_output actual = fast_read_correct(read, params, lookup);
+    EXPECT_EQ(expected.corrected, actual.corrected) << read;
+    EXPECT_EQ(expected.corrections, actual.corrections) << read;
+    EXPECT_EQ(expected.kmers, actual.kmers) << read;
+    EXPECT_LE(lookup.prefetches(), lookup.lookups());
+    batched_lookups += lookup.lookups();
+  }
+  SPLOG("%lu lookups through kmer_lookup_f, %lu batched", unbatched_lookups, batched_lookups);
+}
@@ -0,0 +1,238 @@
+#include "modules/bio_base/packed_read_store.h"
+#include "modules/io/log.h"
+#include "modules/io/utils.h"
+
+const product_version packed_read_store::k_packed_read_store_version{"1.0.0"};
+const char packed_read_store::k_manifest_encoding[] = "packed_read_store";
+constexpr uint8_t packed_read_store::k_flag_trace_me;
+constexpr size_t packed_read_store_builder::k_default_records_per_chunk;
+
+namespace {
+
+constexpr char k_part_name[] = "packed_reads";
+constexpr char k_metadata_name[] = "packed_reads.json";
+
+// Sequence data is padded on both sides so comparisons, which may
+// read whole words past either end of a slice, stay in bounds.
+constexpr size_t k_pad_bytes = 8;
+constexpr size_t k_pad_bases = k_pad_bytes * 4;
+
+std::string chunk_name(size_t chunk_id) { return printstring("chunk_%06lu", chunk_id); }
+
+size_t seq_bytes(size_t num_bases) { return (k_pad_bases + num_bases + 3) / 4 + k_pad_bytes; }
+
+template <typename T>
+membuf vector_membuf(const std::vector<T>& v, const std::string& description) {
+  return membuf(new owned_membuf(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T),
+                                 description));
+}
+
+}  // namespace
+
+dna_slice packed_read_chunk::sequence(size_t read) const {
+  DCHECK_LT(read, m_info.num_reads);
+  dna_const_iterator start(reinterpret_cast<const unsigned char*>(m_seq.data()),
+                           m_read_offsets[read], false /* rev_comp */);
+  return dna_slice(start, lengths()[read]);
+}
+
+bool packed_read_chunk::trace_me(size_t read) const {
+  return flags(read) & packed_read_store::k_flag_trace_me;
+}
+
+std::string packed_read_chunk::quality(size_t read) const {
+  if (m_quality_offsets.empty()) {
+    return std::string();
+  }
+  size_t start = m_quality_offsets[read];
+  return std::string(m_quality.data() + start, m_quality_offsets[read + 1] - start);
+}
+
+packed_read_store::packed_read_store(const spiral_file_open_state& top_state) {
+  top_state.enforce_max_version("packed_read_store", k_packed_read_store_version);
+  spiral_file_open_state state = top_state.open_subpart(k_part_name);
+  state.enforce_max_version("packed_reads", k_packed_read_store_version);
+  m_metadata = state.open_json<packed_read_store_metadata>(k_metadata_name);
+
+  size_t first_record = 0;
+  size_t total_reads = 0;
+  size_t total_bases = 0;
+  m_chunks.resize(m_metadata.chunks.size());
+  for (size_t chunk_id = 0; chunk_id != m_metadata.chunks.size(); ++chunk_id) {
+    const packed_read_chunk_info& info = m_metadata.chunks[chunk_id];
+    spiral_file_open_state chunk_state = state.open_subpart(chunk_name(chunk_id));
+    chunk_state.enforce_max_version("packed_read_chunk", k_packed_read_store_version);
+
+    packed_read_chunk& chunk = m_chunks[chunk_id];
+    chunk.m_info = info;
+    chunk.m_first_record_id = first_record;
+    chunk.m_seq = chunk_state.open_membuf("seq");
+    CHECK_EQ(seq_bytes(info.num_bases), chunk.m_seq.size());
+    chunk.m_lengths = chunk_state.open_membuf("lengths");
+    CHECK_EQ(info.num_reads * sizeof(uint32_t), chunk.m_lengths.size());
+    chunk.m_pairs = chunk_state.open_membuf("pairs");
+    CHECK_EQ(info.num_records, chunk.m_pairs.size());
+    chunk.m_flags = chunk_state.open_membuf("flags");
+    CHECK_EQ(info.num_reads, chunk.m_flags.size());
+    if (m_metadata.has_quality) {
+      chunk.m_quality = chunk_state.open_membuf("quality");
+      CHECK_EQ(info.quality_size, chunk.m_quality.size());
+      chunk.m_quality_sizes = chunk_state.open_membuf("quality_sizes");
+      CHECK_EQ(info.num_reads * sizeof(uint32_t), chunk.m_quality_sizes.size());
+    }
+
+    m_chunk_first_record.push_back(first_record);
+    first_record += info.num_records;
+    total_reads += info.num_reads;
+    total_bases += info.num_bases;
+  }
+  CHECK_EQ(first_record, m_metadata.num_records);
+  CHECK_EQ(total_reads, m_metadata.num_reads);
+  CHECK_EQ(total_bases, m_metadata.num_bases);
+}
+
+packed_read_chunk packed_read_store::chunk(size_t chunk_id) const {
+  CHECK_LT(chunk_id, m_chunks.size());
+  packed_read_chunk chunk = m_chunks[chunk_id];
+  const packed_read_chunk_info& info = chunk.m_info;
+
+  chunk.m_read_offsets.resize(info.num_reads + 1);
+  size_t offset = k_pad_bases;
+  const uint32_t* lengths = chunk.lengths();
+  for (size_t read = 0; read != info.num_reads; ++read) {
+    chunk.m_read_offsets[read] = offset;
+    offset += lengths[read];
+  }
+  chunk.m_read_offsets[info.num_reads] = offset;
+  CHECK_EQ(offset - k_pad_bases, info.num_bases);
+
+  chunk.m_record_reads.resize(info.num_records + 1);
+  size_t read = 0;
+  const uint8_t* pairs = chunk.pairs();
+  for (size_t record = 0; record != info.num_records; ++record) {
+    chunk.m_record_reads[record] = read;
+    read += pairs[record];
+  }
+  chunk.m_record_reads[info.num_records] = read;
+  CHECK_EQ(read, info.num_reads);
+
+  if (m_metadata.has_quality) {
+    chunk.m_quality_offsets.resize(info.num_reads + 1);
+    size_t quality_offset = 0;
+    const uint32_t* quality_sizes =
+        reinterpret_cast<const uint32_t*>(chunk.m_quality_sizes.data());
+    for (size_t read = 0; read != info.num_reads; ++read) {
+      chunk.m_quality_offsets[read] = quality_offset;
+      quality_offset += quality_sizes[read];
+    }
+    chunk.m_quality_offsets[info.num_reads] = quality_offset;
+    CHECK_EQ(quality_offset, info.quality_size);
+  }
+
+  return chunk;
+}
+
+packed_read_store_builder::packed_read_store_builder(const spiral_file_create_state& state,
+                                                     bool with_quality, size_t records_per_chunk)
+    : m_state(state.create_subpart(k_part_name)),
+      m_records_per_chunk(records_per_chunk),
+      m_with_quality(with_quality) {
+  CHECK_GT(m_records_per_chunk, 0);
+  state.set_version("packed_read_store", packed_read_store::k_packed_read_store_version);
+  m_state.set_version("packed_reads", packed_read_store::k_packed_read_store_version);
+  m_metadata.has_quality = with_quality;
+}
+
+packed_read_store_builder::~packed_read_store_builder() {
+  if (!m_finalized) {
+    SPLOG("Packed read store destroyed without being finalized");
+  }
+}
+
+void packed_read_store_builder::add(const corrected_reads& reads) {
+  for (const corrected_read& read : reads) {
+    add_read(read.corrected, read.quality,
+             read.trace_me ? packed_read_store::k_flag_trace_me : 0);
+  }
+  end_record();
+}
+
+void packed_read_store_builder::add_read(const dna_slice& seq, const std::string& quality,
+                                         uint8_t flags) {
+  CHECK(!m_finalized);
+  CHECK_LT(m_record_reads, std::numeric_limits<uint8_t>::max());
+  CHECK_LE(seq.size(), std::numeric_limits<uint32_t>::max());
+
+  size_t start = k_pad_bases + m_chunk.num_bases;
+  m_chunk.num_bases += seq.size();
+  m_seq.resize(seq_bytes(m_chunk.num_bases));
+  dna_iterator out(m_seq.data(), start, false /* rev_comp */);
+  for (dna_base b : seq) {
+    *out = b;
+    ++out;
+  }
+  m_lengths.push_back(seq.size());
+  m_flags.push_back(flags);
+
+  if (m_with_quality) {
+    m_quality += quality;
+    m_quality_sizes.push_back(quality.size());
+    m_chunk.quality_size += quality.size();
+  }
+
+  ++m_chunk.num_reads;
+  ++m_record_reads;
+}
+
+void packed_read_store_builder::end_record() {
+  CHECK(!m_finalized);
+  m_pairs.push_back(m_record_reads);
+  m_record_reads = 0;
+  ++m_chunk.num_records;
+  if (m_chunk.num_records == m_records_per_chunk) {
+    flush_chunk();
+  }
+}
+
+void packed_read_store_builder::flush_chunk() {
+  if (!m_chunk.num_records) {
+    return;
+  }
+  CHECK_EQ(0, m_record_reads) << "Records must be ended before flushing";
+
+  spiral_file_create_state chunk_state =
+      m_state.create_subpart(chunk_name(m_metadata.chunks.size()));
+  chunk_state.set_version("packed_read_chunk", packed_read_store::k_packed_read_store_version);
+
+  CHECK_EQ(m_seq.size(), seq_bytes(m_chunk.num_bases));
+  chunk_state.create_membuf("seq", vector_membuf(m_seq, "packed_read_store:seq"));
+  chunk_state.create_membuf("lengths", vector_membuf(m_lengths, "packed_read_store:lengths"));
+  chunk_state.create_membuf("pairs", vector_membuf(m_pairs, "packed_read_store:pairs"));
+  chunk_state.create_membuf("flags", vector_membuf(m_flags, "packed_read_store:flags"));
+  if (m_with_quality) {
+    chunk_state.create_membuf("quality",
+                              owned_membuf::from_str(m_quality, "packed_read_store:quality"));
+    chunk_state.create_membuf("quality_sizes",
+                              vector_membuf(m_quality_sizes, "packed_read_store:quality_sizes"));
+  }
+
+  m_metadata.chunks.push_back(m_chunk);
+  m_metadata.num_records += m_chunk.num_records;
+  m_metadata.num_reads += m_chunk.num_reads;
+  m_metadata.num_bases += m_chunk.num_bases;
+
+  m_chunk = packed_read_chunk_info();
+  m_seq.clear();
+  m_lengths.clear();
+  m_pairs.clear();
+  m_flags.clear();
+  m_quality.clear();
+  m_quality_sizes.clear();
+}
+
+void packed_read_store_builder::finalize() {
+  CHECK(!m_finalized);
+  flush_chunk();
+  m_state.create_json<packed_read_store_metadata>(k_metadata_name, m_metadata);
+  m_finalized = true;
+}
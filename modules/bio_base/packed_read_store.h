@@ -0,0 +1,189 @@
+#pragma once
+
+// Columnar storage for intermediate reads passed between stages of
+// "biograph create".
+//
+// Records (a read and its optional mate) are grouped into fixed-size
+// chunks.  Each chunk is a subpart of the "packed_reads" part with one
+// membuf per column:
+//
+//   seq           Read sequences, 2-bit packed in dna_sequence layout
+//                 and stored back to back.
+//   lengths       uint32_t length of each read.
+//   pairs         uint8_t number of reads in each record.
+//   flags         uint8_t flags for each read; see k_flag_*.
+//   quality       Quality strings, back to back.  Only present if
+//                 the store was built with quality.
+//   quality_sizes uint32_t size of each quality string.
+//
+// The chunk index in packed_reads.json lets readers find any record
+// without opening the chunks before it.  When the store is opened
+// with spiral_file_open_mmap, sequences are returned as dna_slices
+// pointing straight into the mapped file.
+//
+// Read names are not stored; records are identified by position.
+
+#include "modules/bio_base/corrected_read.h"
+#include "modules/bio_base/dna_sequence.h"
+#include "modules/io/membuf.h"
+#include "modules/io/spiral_file.h"
+#include "modules/io/transfer_object.h"
+#include "modules/io/version.h"
+
+struct packed_read_chunk_info {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(num_records, TF_STRICT);
+    FIELD(num_reads, TF_STRICT);
+    FIELD(num_bases, TF_STRICT);
+    FIELD(quality_size, TF_STRICT);
+  };
+
+  size_t num_records = 0;
+  size_t num_reads = 0;
+  size_t num_bases = 0;
+  size_t quality_size = 0;
+};
+
+struct packed_read_store_metadata {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(num_records, TF_STRICT);
+    FIELD(num_reads, TF_STRICT);
+    FIELD(num_bases, TF_STRICT);
+    FIELD(has_quality, TF_STRICT);
+    FIELD(chunks, TF_STRICT);
+  };
+
+  size_t num_records = 0;
+  size_t num_reads = 0;
+  size_t num_bases = 0;
+  bool has_quality = false;
+  std::vector<packed_read_chunk_info> chunks;
+};
+
+// A read-only view of a single chunk.  Copies are cheap and share
+// the underlying storage.
+class packed_read_chunk {
+ public:
+  packed_read_chunk() = default;
+
+  // Global id of the first record in this chunk.
+  size_t first_record_id() const { return m_first_record_id; }
+  // Number of records in this chunk.
+  size_t size() const { return m_info.num_records; }
+  // Number of reads in this chunk.
+  size_t num_reads() const { return m_info.num_reads; }
+
+  // Number of reads in the given record, indexed relative to this chunk.
+  unsigned read_count(size_t record) const { return pairs()[record]; }
+  // Index of the first read of the given record.
+  size_t first_read(size_t record) const { return m_record_reads[record]; }
+
+  // Sequence of the given read.  The slice stays valid as long as
+  // this chunk or the store it came from is open.
+  dna_slice sequence(size_t read) const;
+  uint8_t flags(size_t read) const { return flag_data()[read]; }
+  bool trace_me(size_t read) const;
+  // Returns the empty string if the store has no quality.
+  std::string quality(size_t read) const;
+
+ private:
+  friend class packed_read_store;
+
+  const uint32_t* lengths() const { return reinterpret_cast<const uint32_t*>(m_lengths.data()); }
+  const uint8_t* pairs() const { return reinterpret_cast<const uint8_t*>(m_pairs.data()); }
+  const uint8_t* flag_data() const { return reinterpret_cast<const uint8_t*>(m_flags.data()); }
+
+  packed_read_chunk_info m_info;
+  size_t m_first_record_id = 0;
+
+  membuf m_seq;
+  membuf m_lengths;
+  membuf m_pairs;
+  membuf m_flags;
+  membuf m_quality;
+  membuf m_quality_sizes;
+
+  // Offsets computed when the chunk is opened.  m_read_offsets has
+  // num_reads + 1 entries, and m_record_reads has num_records + 1.
+  std::vector<size_t> m_read_offsets;
+  std::vector<size_t> m_quality_offsets;
+  std::vector<size_t> m_record_reads;
+};
+
+class packed_read_store {
+ public:
+  static const product_version k_packed_read_store_version;
+
+  // Manifests whose file_infos point to packed read stores instead
+  // of KV files use this as their encoding.
+  static const char k_manifest_encoding[];
+
+  // Flag bits stored for each read.
+  static constexpr uint8_t k_flag_trace_me = 1;
+
+  explicit packed_read_store(const spiral_file_open_state& state);
+
+  // Number of records.
+  size_t size() const { return m_metadata.num_records; }
+  size_t num_reads() const { return m_metadata.num_reads; }
+  size_t num_bases() const { return m_metadata.num_bases; }
+  bool has_quality() const { return m_metadata.has_quality; }
+
+  size_t num_chunks() const { return m_metadata.chunks.size(); }
+  // Global id of the first record in the given chunk.
+  size_t chunk_first_record(size_t chunk_id) const { return m_chunk_first_record[chunk_id]; }
+  // Opens the given chunk.  Safe to call from multiple threads.
+  packed_read_chunk chunk(size_t chunk_id) const;
+
+ private:
+  packed_read_store_metadata m_metadata;
+  std::vector<size_t> m_chunk_first_record;
+  // Columns of each chunk, without the computed offsets.
+  std::vector<packed_read_chunk> m_chunks;
+};
+
+class packed_read_store_builder {
+ public:
+  static constexpr size_t k_default_records_per_chunk = 64 * 1024;
+
+  packed_read_store_builder(const spiral_file_create_state& state, bool with_quality,
+                            size_t records_per_chunk = k_default_records_per_chunk);
+  ~packed_read_store_builder();
+
+  // Adds a record with the corrected sequences of the given reads.
+  void add(const corrected_reads& reads);
+
+  // Adds a read to the current record.
+  void add_read(const dna_slice& seq, const std::string& quality = "", uint8_t flags = 0);
+  // Finishes the current record.
+  void end_record();
+
+  // Writes any buffered reads and the chunk index.  No more records
+  // may be added afterwards.
+  void finalize();
+
+  size_t num_records() const { return m_metadata.num_records; }
+  size_t num_reads() const { return m_metadata.num_reads; }
+  size_t num_bases() const { return m_metadata.num_bases; }
+
+ private:
+  void flush_chunk();
+
+  spiral_file_create_state m_state;
+  size_t m_records_per_chunk;
+  bool m_with_quality;
+  packed_read_store_metadata m_metadata;
+  bool m_finalized = false;
+
+  // Buffered contents of the current chunk.
+  packed_read_chunk_info m_chunk;
+  unsigned m_record_reads = 0;
+  std::vector<unsigned char> m_seq;
+  std::vector<uint32_t> m_lengths;
+  std::vector<uint8_t> m_pairs;
+  std::vector<uint8_t> m_flags;
+  std::string m_quality;
+  std::vector<uint32_t> m_quality_sizes;
+};
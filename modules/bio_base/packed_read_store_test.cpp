@@ -0,0 +1,133 @@
+#include "modules/bio_base/packed_read_store.h"
+#include "modules/io/spiral_file_mem.h"
+#include "modules/io/spiral_file_mmap.h"
+#include "modules/test/test_utils.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <random>
+
+using namespace testing;
+
+namespace {
+
+dna_sequence random_sequence(std::mt19937& rand_source, size_t len) {
+  dna_sequence seq;
+  for (size_t i = 0; i < len; ++i) {
+    seq.push_back(dna_base(int(rand_source() & 3)));
+  }
+  return seq;
+}
+
+}  // namespace
+
+class packed_read_store_test : public TestWithParam<bool /* with quality */> {
+ protected:
+  void SetUp() override {
+    std::mt19937 rand_source(GetParam());
+    for (size_t i = 0; i < 1000; ++i) {
+      corrected_reads record;
+      size_t num_reads = (i % 3 == 0) ? 1 : 2;
+      for (size_t j = 0; j < num_reads; ++j) {
+        corrected_read read;
+        // Include some empty and some very long reads.
+        size_t len = (i == 7) ? 0 : (i == 8) ? 5000 : 1 + (rand_source() % 150);
+        read.corrected = random_sequence(rand_source, len);
+        read.quality = std::string(len, 'A' + (i % 20));
+        read.trace_me = (i % 17 == 0);
+        record.push_back(read);
+      }
+      m_expected.push_back(record);
+    }
+  }
+
+  void build(const spiral_file_create_state& state) {
+    packed_read_store_builder b(state, GetParam(), 64 /* records per chunk */);
+    for (const auto& record : m_expected) {
+      b.add(record);
+    }
+    b.finalize();
+    EXPECT_EQ(m_expected.size(), b.num_records());
+  }
+
+  void check(const packed_read_store& store) {
+    ASSERT_EQ(m_expected.size(), store.size());
+    EXPECT_EQ(GetParam(), store.has_quality());
+    EXPECT_EQ(16, store.num_chunks());
+
+    size_t record_id = 0;
+    size_t num_reads = 0;
+    size_t num_bases = 0;
+    for (size_t chunk_id = 0; chunk_id < store.num_chunks(); ++chunk_id) {
+      packed_read_chunk chunk = store.chunk(chunk_id);
+      EXPECT_EQ(record_id, chunk.first_record_id());
+      EXPECT_EQ(record_id, store.chunk_first_record(chunk_id));
+      for (size_t record = 0; record < chunk.size(); ++record, ++record_id) {
+        const corrected_reads& expected = m_expected[record_id];
+        ASSERT_EQ(expected.size(), chunk.read_count(record)) << record_id;
+        for (size_t i = 0; i < expected.size(); ++i) {
+          size_t read = chunk.first_read(record) + i;
+          EXPECT_EQ(expected[i].corrected, dna_sequence(chunk.sequence(read))) << record_id;
+          EXPECT_EQ(expected[i].trace_me, chunk.trace_me(read));
+          EXPECT_EQ(GetParam() ? expected[i].quality : "", chunk.quality(read));
+          num_bases += expected[i].corrected.size();
+        }
+        num_reads += expected.size();
+      }
+    }
+    EXPECT_EQ(m_expected.size(), record_id);
+    EXPECT_EQ(num_reads, store.num_reads());
+    EXPECT_EQ(num_bases, store.num_bases());
+  }
+
+  std::vector<corrected_reads> m_expected;
+};
+
+TEST_P(packed_read_store_test, mem_round_trip) {
+  spiral_file_create_mem c;
+  build(c.create());
+  spiral_file_open_mem o(c.close());
+  check(packed_read_store(o.open()));
+}
+
+TEST_P(packed_read_store_test, mmap_round_trip) {
+  std::string path = make_path("packed_read_store");
+  {
+    spiral_file_create_mmap c(path);
+    build(c.create());
+  }
+  spiral_file_open_mmap o(path);
+  check(packed_read_store(o.open()));
+}
+
+TEST_P(packed_read_store_test, slices_compare) {
+  spiral_file_create_mem c;
+  build(c.create());
+  spiral_file_open_mem o(c.close());
+  packed_read_store store(o.open());
+
+  // Comparisons read past the ends of slices, including when
+  // reverse complemented.
+  packed_read_chunk first = store.chunk(0);
+  packed_read_chunk last = store.chunk(store.num_chunks() - 1);
+  dna_slice a = first.sequence(0);
+  dna_slice b = last.sequence(last.num_reads() - 1);
+  EXPECT_EQ(dna_sequence(a) < dna_sequence(b), a < b);
+  EXPECT_EQ(dna_sequence(a).rev_comp() < dna_sequence(b).rev_comp(), a.rev_comp() < b.rev_comp());
+  EXPECT_EQ(m_expected[0][0].corrected.rev_comp(), dna_sequence(a.rev_comp()));
+}
+
+TEST_P(packed_read_store_test, empty) {
+  spiral_file_create_mem c;
+  {
+    packed_read_store_builder b(c.create(), GetParam());
+    b.finalize();
+  }
+  spiral_file_open_mem o(c.close());
+  packed_read_store store(o.open());
+  EXPECT_EQ(0, store.size());
+  EXPECT_EQ(0, store.num_chunks());
+}
+
+INSTANTIATE_TEST_CASE_P(packed_read_store_tests, packed_read_store_test, Bool());
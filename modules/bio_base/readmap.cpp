@@ -11,6 +11,7 @@
 #include "modules/io/spiral_file_mem.h"
 
 const product_version k_readmap_version{"1.2.0"};
+const product_version k_compact_readmap_version{"1.3.0"};
 constexpr uint64_t readmap_header::k_magic;
 constexpr uint32_t readmap::k_null_index;
 
@@ -32,7 +33,7 @@ readmap::readmap(const std::string& readmap_file_path) : m_path(readmap_file_pat
 }
 
 void readmap::open_spiral_file(const spiral_file_open_state& state) {
-  state.enforce_max_version("readmap", k_readmap_version);
+  state.enforce_max_version("readmap", k_compact_readmap_version);
 
   m_metadata = state.open_json<readmap_metadata>("readmap.json");
   if (m_seqset) {
@@ -431,6 +432,28 @@ membuf_cachelist readmap::membufs() const {
   return results;
 }
 
+membuf_cachelist readmap::read_ordered_membufs() const {
+  membuf_cachelist results;
+  if (m_is_forward) {
+    results += m_is_forward->membufs();
+  }
+  if (m_read_lengths) {
+    results += m_read_lengths->membufs();
+  }
+  if (m_mate_loop_ptr) {
+    results += m_mate_loop_ptr->membufs();
+  }
+  if (m_sparse_multi) {
+    // Each read belongs to a single entry, so mid indexes are in read
+    // order.
+    results += m_sparse_multi->ordered_membufs();
+  }
+  if (m_mate_pair_ptr) {
+    results += m_mate_pair_ptr->membufs();
+  }
+  return results;
+}
+
 readmap::read_iterator_range readmap::get_prefix_reads(const seqset_range& r,
                                                        int read_len_limit) const {
   if (m_seqset.get() != r.get_seqset()) {
@@ -14,6 +14,9 @@
 #include <boost/range.hpp>
 
 extern const product_version k_readmap_version;
+// Version for readmaps whose read ids may be Elias-Fano encoded; see
+// make_readmap::compact.
+extern const product_version k_compact_readmap_version;
 
 struct alignas(8) readmap_header {
   uint64_t m_magic = k_magic;
@@ -124,6 +127,13 @@ class readmap : public seqset_bitmap_base {
 
   size_t size() const { return m_read_lengths->size(); }
 
+  // Returns true if the entry to read id mapping is Elias-Fano encoded.
+  bool has_compact_read_ids() const { return m_sparse_multi->is_compact(); }
+  // Returns true if make_readmap::compact would make this readmap smaller.
+  bool can_compact_read_ids() const {
+    return m_sparse_multi->compact_size() < m_sparse_multi->stored_size();
+  }
+
   // Support for pairing data:
   bool has_pairing_data() const { return m_pairing_data_present; }
   int get_readlength(uint32_t index) const;
@@ -188,6 +198,9 @@ class readmap : public seqset_bitmap_base {
 
   // Returns a list of membufs to cache if memory caching is requested.
   membuf_cachelist membufs() const;
+  // Returns the membufs stored in read id order, where a range of
+  // reads maps to about the same fraction of each of them.
+  membuf_cachelist read_ordered_membufs() const;
 
 private:
   spiral_file_options m_spiral_file_opts;
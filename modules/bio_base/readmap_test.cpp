@@ -1,6 +1,7 @@
 #include "gtest/gtest.h"
 
 #include "modules/io/file_io.h"
+#include "modules/io/parallel.h"
 #include "modules/io/spiral_file_mem.h"
 #include "modules/io/spiral_file_mmap.h"
 #include "modules/io/json_transfer.h"
@@ -615,3 +616,52 @@ TEST_F(reads_containing_test, single_match) {
 
   EXPECT_THAT(m_actual, UnorderedElementsAre(Pair(tseq("doesnotm").size(), tseq("doesnotm*tch"))));
 }
+
+// Parallel mate loop linking should link every read exactly the same
+// as linking serially.
+TEST(readmap, parallel_linking_matches_serial) {
+  std::mt19937 rand_source(1);
+  // Use a small number of distinct sequences so that many reads share
+  // the same entries, and reads have to claim among them.
+  std::vector<dna_sequence> seqs;
+  for (size_t i = 0; i < 30; ++i) {
+    seqs.push_back(rand_dna_sequence(rand_source, 20 + (i % 3)));
+  }
+  auto pick = [&]() {
+    return seqs[std::uniform_int_distribution<size_t>(0, seqs.size() - 1)(rand_source)];
+  };
+
+  std::vector<std::pair<dna_sequence, dna_sequence>> paired;
+  std::vector<dna_sequence> unpaired;
+  for (size_t i = 0; i < 3000; ++i) {
+    dna_sequence read = pick();
+    if (i % 5 == 0) {
+      unpaired.push_back(read);
+    } else {
+      paired.emplace_back(read, pick());
+    }
+  }
+  std::shared_ptr<seqset> the_seqset = seqset_for_reads(seqs);
+
+  g_make_readmap_serial_linking = true;
+  std::unique_ptr<readmap> serial = readmap_for_reads(the_seqset, paired, unpaired);
+  g_make_readmap_serial_linking = false;
+  ASSERT_TRUE(serial->has_mate_loop());
+
+  // The number of partitions depends on the number of threads.
+  size_t orig_threads = get_thread_count();
+  for (size_t threads : {2, 3, 16, 200}) {
+    set_thread_count(threads);
+    std::unique_ptr<readmap> parallel = readmap_for_reads(the_seqset, paired, unpaired);
+    ASSERT_EQ(serial->size(), parallel->size());
+    for (uint32_t read_id = 0; read_id < serial->size(); ++read_id) {
+      ASSERT_EQ(serial->get_is_forward(read_id), parallel->get_is_forward(read_id)) << read_id;
+      ASSERT_EQ(serial->get_rev_comp(read_id), parallel->get_rev_comp(read_id)) << read_id;
+      ASSERT_EQ(serial->has_mate(read_id), parallel->has_mate(read_id)) << read_id;
+      if (serial->has_mate(read_id)) {
+        ASSERT_EQ(serial->get_mate(read_id), parallel->get_mate(read_id)) << read_id;
+      }
+    }
+  }
+  set_thread_count(orig_threads);
+}
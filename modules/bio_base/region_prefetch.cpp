@@ -0,0 +1,103 @@
+#include "modules/bio_base/region_prefetch.h"
+#include "modules/io/log.h"
+#include "modules/io/parallel.h"
+
+#include <mutex>
+
+constexpr unsigned region_prefetch::k_kmer_stride;
+constexpr unsigned region_prefetch::k_kmer_size;
+constexpr uint64_t region_prefetch::k_entry_margin;
+
+region_prefetch::region_prefetch(const seqset* the_seqset, const readmap* the_readmap)
+    : m_seqset(the_seqset), m_readmap(the_readmap) {
+  CHECK(m_seqset);
+}
+
+void region_prefetch::add_sequence(const dna_slice& seq) {
+  if (seq.size()) {
+    m_seqs.emplace_back(seq);
+  }
+}
+
+void region_prefetch::add_entry_part(const open_entry_range_f& open_range) {
+  m_entry_parts.push_back(open_range);
+}
+
+prefetch_stats region_prefetch::run(progress_handler_t progress) {
+  using entry_range = std::pair<uint64_t, uint64_t>;
+  std::vector<entry_range> entry_ranges;
+  std::mutex mu;
+
+  // Looking up the kmers faults in the pages near them, so do
+  // lookups in parallel to keep many reads outstanding.
+  parallel_for(  //
+      0, m_seqs.size() * 2,
+      [&](size_t idx) {
+        dna_slice seq = m_seqs[idx / 2];
+        if (idx % 2) {
+          seq = seq.rev_comp();
+        }
+        std::vector<entry_range> found;
+        for (size_t pos = 0; pos < seq.size(); pos += k_kmer_stride) {
+          dna_slice kmer = seq.subseq(pos, std::min<size_t>(k_kmer_size, seq.size() - pos));
+          // Keep the longest suffix of the kmer present, so sequences
+          // that differ from the sample still get their neighborhood.
+          seqset_range r = m_seqset->ctx_begin();
+          for (size_t i = kmer.size(); i > 0; --i) {
+            seqset_range next = r.push_front(kmer[i - 1]);
+            if (!next.valid()) {
+              break;
+            }
+            r = next;
+          }
+          if (r.size()) {
+            found.emplace_back(r.begin(), r.end());
+          }
+        }
+        std::lock_guard<std::mutex> l(mu);
+        entry_ranges.insert(entry_ranges.end(), found.begin(), found.end());
+      },
+      subprogress(progress, 0, 0.5));
+
+  std::sort(entry_ranges.begin(), entry_ranges.end());
+  std::vector<entry_range> merged;
+  for (const entry_range& r : entry_ranges) {
+    uint64_t begin = r.first > k_entry_margin ? r.first - k_entry_margin : 0;
+    uint64_t end = std::min<uint64_t>(r.second + k_entry_margin, m_seqset->size());
+    if (!merged.empty() && begin <= merged.back().second) {
+      merged.back().second = std::max(merged.back().second, end);
+    } else {
+      merged.emplace_back(begin, end);
+    }
+  }
+
+  prefetch_plan plan;
+  // Only buffers stored in entry or read order can be mapped by
+  // fraction; search indexes laid out some other way are skipped.
+  membuf_cachelist seqset_bufs = m_seqset->entry_ordered_membufs();
+  membuf_cachelist readmap_bufs;
+  if (m_readmap) {
+    readmap_bufs = m_readmap->read_ordered_membufs();
+  }
+  // The plan only keeps pointers, so hold on to the entry part ranges
+  // until it's executed.
+  std::vector<membuf> entry_part_bufs;
+  double num_entries = m_seqset->size();
+  for (const entry_range& r : merged) {
+    plan.add_fraction(seqset_bufs, r.first / num_entries, r.second / num_entries);
+    if (m_readmap && m_readmap->size()) {
+      std::pair<uint64_t, uint64_t> reads = m_readmap->entry_to_index_range(r.first, r.second);
+      double num_reads = m_readmap->size();
+      plan.add_fraction(readmap_bufs, reads.first / num_reads, reads.second / num_reads);
+    }
+    for (const open_entry_range_f& open_range : m_entry_parts) {
+      entry_part_bufs.push_back(open_range(r.first, r.second));
+      plan.add(entry_part_bufs.back(), 0, entry_part_bufs.back().size());
+    }
+  }
+
+  prefetch_stats stats = plan.execute(subprogress(progress, 0.5, 1));
+  SPLOG("Prefetched %lu sequences covering %lu seqset ranges: %s", m_seqs.size(), merged.size(),
+        stats.to_string().c_str());
+  return stats;
+}
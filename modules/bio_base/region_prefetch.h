@@ -0,0 +1,58 @@
+#pragma once
+
+// Prefetches the parts of a seqset and readmap needed to query a few
+// regions, so targeted queries against a BioGraph that doesn't fit
+// in RAM don't stall on random page faults.
+//
+// Each added sequence is looked up in the seqset a kmer at a time,
+// in parallel.  Since the seqset and readmap store everything in
+// seqset entry order (and reads are numbered in seqset entry order),
+// the entries found map to about the same fraction of each of their
+// buffers.  Those ranges are then read with a prefetch_plan.  Indexes
+// that aren't stored in entry order, like bitcount select indexes and
+// the less_than_search sparse table, aren't prefetched.
+//
+// Mates of reads in the region are not prefetched.
+//
+// Other files indexed by seqset entry, such as a saved ref_map, can be
+// added with add_entry_part.  Those are opened a range of entries at
+// a time, so only the parts near the regions are read.
+
+#include <functional>
+
+#include "modules/bio_base/dna_sequence.h"
+#include "modules/bio_base/readmap.h"
+#include "modules/bio_base/seqset.h"
+#include "modules/io/prefetch.h"
+
+class region_prefetch {
+ public:
+  // Kmers are looked up starting every k_kmer_stride bases.
+  static constexpr unsigned k_kmer_stride = 16;
+  static constexpr unsigned k_kmer_size = 32;
+  // Entries to include on each side of the entries found, to cover
+  // nearby sequences that the query may also visit.
+  static constexpr uint64_t k_entry_margin = 16 * 1024;
+
+  region_prefetch(const seqset* the_seqset, const readmap* the_readmap = nullptr);
+
+  // Opens the bytes of a part covering seqset entries [first_entry,
+  // limit_entry).
+  using open_entry_range_f = std::function<membuf(uint64_t first_entry, uint64_t limit_entry)>;
+
+  // Adds a sequence to prefetch.  Both strands are prefetched.
+  void add_sequence(const dna_slice& seq);
+
+  // Also prefetches the entries found from a part stored in seqset
+  // entry order, e.g. one opened with ref_map::open_entry_range.
+  void add_entry_part(const open_entry_range_f& open_range);
+
+  // Finds and reads everything needed for the added sequences.
+  prefetch_stats run(progress_handler_t progress = null_progress_handler);
+
+ private:
+  const seqset* m_seqset = nullptr;
+  const readmap* m_readmap = nullptr;
+  std::vector<dna_sequence> m_seqs;
+  std::vector<open_entry_range_f> m_entry_parts;
+};
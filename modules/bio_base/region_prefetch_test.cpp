@@ -0,0 +1,67 @@
+#include "modules/bio_base/region_prefetch.h"
+#include "modules/bio_base/biograph.h"
+
+#include <gtest/gtest.h>
+
+TEST(region_prefetch_test, prefetch_region) {
+  biograph bg("golden/e_coli_merged.bg", biograph::cache_strategy::MMAP);
+  std::shared_ptr<seqset> ss = bg.get_seqset();
+  std::shared_ptr<readmap> rm = bg.open_readmap("test_accession_id");
+
+  region_prefetch prefetch(ss.get(), rm.get());
+  prefetch.add_sequence(ss->ctx_entry(ss->size() / 3).sequence());
+  prefetch.add_sequence(ss->ctx_entry(ss->size() / 2).sequence());
+  // Sequences not in the seqset should still prefetch whatever
+  // part of them is present.
+  prefetch.add_sequence(dna_sequence("AAAATTACAGAGTACACAACATCCATGAAACGCATGGGGGGGGGGGGGGGG"));
+  prefetch_stats stats = prefetch.run();
+  EXPECT_GT(stats.ranges, 0);
+  EXPECT_GT(stats.pages, 0);
+
+  // Everything should be resident the second time around.
+  region_prefetch again(ss.get(), rm.get());
+  again.add_sequence(ss->ctx_entry(ss->size() / 3).sequence());
+  prefetch_stats again_stats = again.run();
+  EXPECT_GT(again_stats.pages, 0);
+  EXPECT_EQ(1, again_stats.hit_rate());
+}
+
+TEST(region_prefetch_test, seqset_only) {
+  biograph bg("golden/e_coli_merged.bg", biograph::cache_strategy::MMAP);
+  std::shared_ptr<seqset> ss = bg.get_seqset();
+
+  region_prefetch prefetch(ss.get());
+  prefetch.add_sequence(ss->ctx_entry(0).sequence());
+  prefetch.add_sequence(dna_slice());
+  EXPECT_GT(prefetch.run().pages, 0);
+}
+
+TEST(region_prefetch_test, entry_part) {
+  biograph bg("golden/e_coli_merged.bg", biograph::cache_strategy::MMAP);
+  std::shared_ptr<seqset> ss = bg.get_seqset();
+  uint64_t entry = ss->size() / 3;
+
+  // One byte per seqset entry.
+  std::string entry_bytes(ss->size(), 'x');
+  membuf entry_buf(new borrowed_membuf(entry_bytes.data(), entry_bytes.size()));
+  std::vector<std::pair<uint64_t, uint64_t>> opened;
+
+  region_prefetch prefetch(ss.get());
+  prefetch.add_sequence(ss->ctx_entry(entry).sequence());
+  prefetch.add_entry_part([&](uint64_t first_entry, uint64_t limit_entry) {
+    opened.emplace_back(first_entry, limit_entry);
+    return entry_buf.subbuf(first_entry, limit_entry - first_entry);
+  });
+  EXPECT_GT(prefetch.run().pages, 0);
+
+  ASSERT_FALSE(opened.empty());
+  bool covered = false;
+  for (const auto& r : opened) {
+    EXPECT_LT(r.first, r.second);
+    EXPECT_LE(r.second, ss->size());
+    if (r.first <= entry && entry < r.second) {
+      covered = true;
+    }
+  }
+  EXPECT_TRUE(covered);
+}
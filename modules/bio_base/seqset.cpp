@@ -31,6 +31,8 @@ seqset::seqset(const spiral_file_create_state &state, size_t entries, unsigned m
   m_mutable_shared = make_unique<mutable_packed_varbit_vector>(state.create_subpart("shared"),
                                                                entries, max_entry_len - 1);
   m_shared = m_mutable_shared->get_int_map_interface();
+  m_shared_lt_state =
+      make_unique<spiral_file_create_state>(state.create_subpart("shared_lt_search"));
 
   m_fixed = m_mutable_fixed;
 
@@ -60,6 +62,10 @@ void seqset::initialize_from_spiral_file(const spiral_file_open_state& state) {
 
   m_shared = int_map_interface::detect_subpart_or_uint8_membuf(state, "shared");
   CHECK_EQ(m_entries, m_shared->size());
+  if (state.subpart_present("shared_lt_search")) {
+    m_shared_lt_search =
+        make_unique<less_than_search>(m_shared.get(), state.open_subpart("shared_lt_search"));
+  }
 
   for (dna_base b : dna_bases()) {
     std::string prev_name = "prev_";
@@ -126,6 +132,11 @@ void seqset::finalize(progress_handler_t prog) {
   }
   m_is_final = true;
   compute_read_len();
+
+  // Save the summary table for push_front_drop so readers don't have
+  // to rebuild it every time the seqset is opened.
+  m_shared_lt_search = make_unique<less_than_search>(m_shared.get(), *m_shared_lt_state);
+  m_shared_lt_state.reset();
 }
 
 seqset_range seqset::ctx_begin() const {
@@ -811,12 +822,26 @@ boost::optional<uint64_t> seqset::kmer_push_front(uint64_t seqset_id,
 
 membuf_cachelist seqset::membufs() const {
   membuf_cachelist results{m_shared->membufs(), m_entry_sizes->membufs()};
+  if (m_shared_lt_search) {
+    results += m_shared_lt_search->membufs();
+  }
   for (dna_base b : dna_bases()) {
     results += m_prev[b]->membufs();
   }
   return results;
 }
 
+membuf_cachelist seqset::entry_ordered_membufs() const {
+  membuf_cachelist results{m_shared->membufs(), m_entry_sizes->membufs()};
+  if (m_shared_lt_search) {
+    results += m_shared_lt_search->ordered_membufs();
+  }
+  for (dna_base b : dna_bases()) {
+    results += m_prev[b]->ordered_membufs();
+  }
+  return results;
+}
+
 namespace {
 
 // Header for old non-zip file format.  Deprecated.
@@ -59,6 +59,9 @@ public:
 
   // Returns a list of membufs to cache if memory caching is requested.
   membuf_cachelist membufs() const;
+  // Returns the membufs stored in entry order, where a range of
+  // entries maps to about the same fraction of each of them.
+  membuf_cachelist entry_ordered_membufs() const;
 
   size_t size() const { return m_entries; }
 
@@ -74,6 +77,8 @@ public:
   seqset_range ctx_begin() const;
   // Makes a range for a specific entry of the table
   inline seqset_range ctx_entry(uint64_t offset) const;
+  // Remakes a range previously saved from its size(), begin(), and end().
+  inline seqset_range ctx_range(unsigned size, uint64_t begin, uint64_t end) const;
   // Return the seqset entry for this specific readmap entry
   seqset_range read_ctx_entry(const readmap& rm, uint32_t readentry) const;
   // Makes an invalid end seqset range
@@ -127,7 +132,9 @@ public:
 
   std::string uuid() const { return m_uuid; }
 
-  // Compute summary table for entry_shared to speed up push_front_drop.
+  // Compute summary table for entry_shared to speed up
+  // push_front_drop.  Seqsets created by finalize() save this table,
+  // so this only needs to do work for older seqsets.
   void init_shared_lt_search();
 
 private:
@@ -168,6 +175,8 @@ private:
   std::unique_ptr<mutable_packed_varbit_vector> m_mutable_shared;
   std::unique_ptr<int_map_interface> m_shared;
   std::unique_ptr<less_than_search> m_shared_lt_search;
+  // Where to save m_shared_lt_search during construction.
+  std::unique_ptr<spiral_file_create_state> m_shared_lt_state;
   std::string m_uuid;
 
   bool m_is_final =
@@ -341,6 +350,10 @@ inline seqset_range seqset::ctx_entry(uint64_t offset) const {
   return seqset_range(this, entry_size(offset), offset, offset + 1);
 }
 
+inline seqset_range seqset::ctx_range(unsigned size, uint64_t begin, uint64_t end) const {
+  return seqset_range(this, size, begin, end);
+}
+
 inline seqset_range seqset::end() const { return seqset_range(this, 0, 0, 0); }
 
 inline uint64_t seqset::entry_pop_front(uint64_t entry) const {
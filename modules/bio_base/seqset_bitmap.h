@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include "modules/io/tunstall.h"
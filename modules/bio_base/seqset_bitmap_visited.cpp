@@ -0,0 +1,152 @@
+#include "modules/bio_base/seqset_bitmap_visited.h"
+
+#include <algorithm>
+
+#include "base/base.h"
+
+constexpr size_t seqset_bitmap_visited::buffer::k_default_flush_size;
+constexpr size_t seqset_bitmap_visited::k_num_shards;
+
+seqset_bitmap_visited::seqset_bitmap_visited(uint64_t size, mode m) : m_size(size), m_mode(m) {
+  switch (m_mode) {
+    case mode::DENSE:
+      // Value-initialization zeroes all the words.
+      m_words.reset(new std::atomic<uint64_t>[(m_size + 63) / 64]());
+      break;
+    case mode::SPARSE:
+      m_shards.reset(new shard[k_num_shards]);
+      break;
+  }
+}
+
+seqset_bitmap_visited::~seqset_bitmap_visited() = default;
+
+bool seqset_bitmap_visited::get_bit(uint64_t loc) const {
+  DCHECK_LT(loc, m_size);
+  if (m_mode == mode::DENSE) {
+    uint64_t mask = uint64_t(1) << (loc % 64);
+    return m_words[loc / 64].load(std::memory_order_relaxed) & mask;
+  }
+
+  shard& s = m_shards[shard_for(loc)];
+  std::lock_guard<std::mutex> l(s.mu);
+  return s.entries.count(loc);
+}
+
+bool seqset_bitmap_visited::test_and_set(uint64_t loc) {
+  DCHECK_LT(loc, m_size);
+  if (m_mode == mode::DENSE) {
+    uint64_t mask = uint64_t(1) << (loc % 64);
+    std::atomic<uint64_t>& word = m_words[loc / 64];
+    if (word.load(std::memory_order_relaxed) & mask) {
+      // Avoid taking the cache line exclusively if it's already set.
+      return false;
+    }
+    return !(word.fetch_or(mask) & mask);
+  }
+
+  shard& s = m_shards[shard_for(loc)];
+  std::lock_guard<std::mutex> l(s.mu);
+  return s.entries.insert(loc).second;
+}
+
+void seqset_bitmap_visited::test_and_set(std::vector<uint64_t>* locs) {
+  locs->resize(set_sorted(locs, true /* keep new */));
+}
+
+void seqset_bitmap_visited::set_bits(std::vector<uint64_t>* locs) {
+  set_sorted(locs, false /* keep new */);
+}
+
+size_t seqset_bitmap_visited::set_sorted(std::vector<uint64_t>* locs, bool keep_new) {
+  if (m_mode == mode::SPARSE) {
+    return set_sorted_sparse(locs, keep_new);
+  }
+
+  std::sort(locs->begin(), locs->end());
+  size_t out = 0;
+  auto it = locs->begin();
+  while (it != locs->end()) {
+    uint64_t word_id = *it / 64;
+    auto word_end = it;
+    uint64_t mask = 0;
+    while (word_end != locs->end() && *word_end / 64 == word_id) {
+      DCHECK_LT(*word_end, m_size);
+      mask |= uint64_t(1) << (*word_end % 64);
+      ++word_end;
+    }
+
+    std::atomic<uint64_t>& word = m_words[word_id];
+    uint64_t old = word.load(std::memory_order_relaxed);
+    if ((old & mask) != mask) {
+      old = word.fetch_or(mask);
+    }
+
+    if (keep_new) {
+      uint64_t newly_set = mask & ~old;
+      for (; it != word_end; ++it) {
+        uint64_t bit = uint64_t(1) << (*it % 64);
+        if (newly_set & bit) {
+          (*locs)[out++] = *it;
+          // Only output duplicates once.
+          newly_set &= ~bit;
+        }
+      }
+    }
+    it = word_end;
+  }
+  return out;
+}
+
+size_t seqset_bitmap_visited::set_sorted_sparse(std::vector<uint64_t>* locs, bool keep_new) {
+  std::sort(locs->begin(), locs->end(), [](uint64_t a, uint64_t b) {
+    return std::make_pair(shard_for(a), a) < std::make_pair(shard_for(b), b);
+  });
+
+  size_t out = 0;
+  auto it = locs->begin();
+  while (it != locs->end()) {
+    size_t shard_id = shard_for(*it);
+    shard& s = m_shards[shard_id];
+    std::lock_guard<std::mutex> l(s.mu);
+    for (; it != locs->end() && shard_for(*it) == shard_id; ++it) {
+      DCHECK_LT(*it, m_size);
+      if (s.entries.insert(*it).second && keep_new) {
+        (*locs)[out++] = *it;
+      }
+    }
+  }
+
+  if (keep_new) {
+    std::sort(locs->begin(), locs->begin() + out);
+  }
+  return out;
+}
+
+uint64_t seqset_bitmap_visited::count() const {
+  uint64_t total = 0;
+  if (m_mode == mode::DENSE) {
+    for (uint64_t i = 0; i != (m_size + 63) / 64; ++i) {
+      total += __builtin_popcountll(m_words[i].load(std::memory_order_relaxed));
+    }
+  } else {
+    for (size_t i = 0; i != k_num_shards; ++i) {
+      std::lock_guard<std::mutex> l(m_shards[i].mu);
+      total += m_shards[i].entries.size();
+    }
+  }
+  return total;
+}
+
+seqset_bitmap_visited::buffer::buffer(seqset_bitmap_visited* bitmap, size_t flush_size)
+    : m_bitmap(bitmap), m_flush_size(flush_size) {
+  m_pending.reserve(m_flush_size);
+}
+
+void seqset_bitmap_visited::buffer::flush() {
+  if (m_pending.empty()) {
+    return;
+  }
+  m_bitmap->set_bits(&m_pending);
+  m_pending.clear();
+}
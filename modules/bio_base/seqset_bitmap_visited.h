@@ -0,0 +1,120 @@
+#pragma once
+
+// A set of seqset entry ids that can be added to from many threads at
+// once, for keeping track of which entries have been visited during a
+// parallel traversal of a seqset.
+//
+// In dense mode, each 64-bit word of the bitmap is updated with a
+// single atomic OR, so no locks are taken and threads only contend
+// when marking entries within 64 ids of each other.
+//
+// In sparse mode, set entries are stored in hash sets sharded by entry
+// id, each with its own lock.  This uses memory proportional to the
+// number of entries visited instead of to the size of the seqset, so
+// it's better for traversals that only visit a small part of a large
+// seqset.
+//
+// Batch operations sort the entries given so that each word (or
+// shard) only needs to be updated once.  seqset_bitmap_visited::buffer
+// accumulates entries to set from a single worker thread and sets them
+// in batches; it's meant to be used with parallel_state::get_local.
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "modules/bio_base/seqset_bitmap.h"
+#include "modules/io/parallel.h"
+
+class seqset_bitmap_visited : public seqset_bitmap_base {
+ public:
+  enum class mode { DENSE, SPARSE };
+
+  explicit seqset_bitmap_visited(uint64_t size, mode m = mode::DENSE);
+  seqset_bitmap_visited(const seqset_bitmap_visited&) = delete;
+  seqset_bitmap_visited& operator=(const seqset_bitmap_visited&) = delete;
+  ~seqset_bitmap_visited() override;
+
+  bool get_bit(uint64_t loc) const override;
+
+  // Sets the given bit.  Returns true if it was not previously set.
+  bool test_and_set(uint64_t loc);
+  void set_bit(uint64_t loc) { test_and_set(loc); }
+
+  // Sets all the bits in "locs".  Afterwards, "locs" contains only
+  // the entries that were not previously set, in sorted order.  Each
+  // entry is only returned once, even if it was present in "locs"
+  // multiple times.
+  void test_and_set(std::vector<uint64_t>* locs);
+  // Same as test_and_set, but doesn't return anything.  "locs" is
+  // reordered but otherwise not modified.
+  void set_bits(std::vector<uint64_t>* locs);
+
+  uint64_t size() const { return m_size; }
+  mode get_mode() const { return m_mode; }
+
+  // Returns the number of bits set.  This is not synchronized with
+  // concurrent updates.
+  uint64_t count() const;
+
+  // Accumulates bits to set from a single thread, and sets them in
+  // bulk once enough have been accumulated.  Bits aren't guaranteed to
+  // be set in the bitmap until the buffer is flushed.
+  //
+  // Example:
+  //   parallel_for(0, n, [&](size_t start, size_t limit, parallel_state& st) {
+  //     auto* buf = st.get_local<seqset_bitmap_visited::buffer>(&visited);
+  //     ...
+  //     buf->add(entry_id);
+  //   });
+  //
+  // Worker threads flush their locals when the parallel_for finishes.
+  class buffer : public parallel_local {
+   public:
+    static constexpr size_t k_default_flush_size = 4096;
+
+    explicit buffer(seqset_bitmap_visited* bitmap, size_t flush_size = k_default_flush_size);
+    buffer(const buffer&) = delete;
+    buffer& operator=(const buffer&) = delete;
+    // parallel_state::get_local may replace this buffer without
+    // flushing it, so make sure nothing gets lost.
+    ~buffer() override { flush(); }
+
+    void add(uint64_t loc) {
+      m_pending.push_back(loc);
+      if (m_pending.size() >= m_flush_size) {
+        flush();
+      }
+    }
+
+    void flush() override;
+
+   private:
+    seqset_bitmap_visited* const m_bitmap;
+    const size_t m_flush_size;
+    std::vector<uint64_t> m_pending;
+  };
+
+ private:
+  static constexpr size_t k_num_shards = 64;
+
+  struct shard {
+    std::mutex mu;
+    std::unordered_set<uint64_t> entries;
+  };
+
+  static size_t shard_for(uint64_t loc) { return loc % k_num_shards; }
+
+  // Sets the bits in "locs", and removes the ones that were already
+  // set if "keep_new" is true.  Returns the new size of "locs".
+  size_t set_sorted(std::vector<uint64_t>* locs, bool keep_new);
+  size_t set_sorted_sparse(std::vector<uint64_t>* locs, bool keep_new);
+
+  const uint64_t m_size;
+  const mode m_mode;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+  std::unique_ptr<shard[]> m_shards;
+};
@@ -0,0 +1,104 @@
+#include "modules/bio_base/seqset_bitmap_visited.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+#include <set>
+
+using namespace testing;
+
+class seqset_bitmap_visited_test : public TestWithParam<seqset_bitmap_visited::mode> {
+ public:
+  seqset_bitmap_visited_test() : m_visited(k_size, GetParam()) {}
+
+ protected:
+  static constexpr uint64_t k_size = 10000;
+
+  seqset_bitmap_visited m_visited;
+};
+
+constexpr uint64_t seqset_bitmap_visited_test::k_size;
+
+TEST_P(seqset_bitmap_visited_test, single) {
+  EXPECT_EQ(k_size, m_visited.size());
+  EXPECT_FALSE(m_visited.get_bit(5));
+  EXPECT_TRUE(m_visited.test_and_set(5));
+  EXPECT_TRUE(m_visited.get_bit(5));
+  EXPECT_FALSE(m_visited.test_and_set(5));
+
+  m_visited.set_bit(k_size - 1);
+  EXPECT_TRUE(m_visited.get_bit(k_size - 1));
+  EXPECT_FALSE(m_visited.get_bit(4));
+  EXPECT_FALSE(m_visited.get_bit(6));
+  EXPECT_EQ(2, m_visited.count());
+}
+
+TEST_P(seqset_bitmap_visited_test, batch) {
+  m_visited.set_bit(64);
+  m_visited.set_bit(200);
+
+  std::vector<uint64_t> locs = {200, 3, 65, 64, 3, 9999, 63, 128};
+  m_visited.test_and_set(&locs);
+  EXPECT_THAT(locs, ElementsAre(3, 63, 65, 128, 9999));
+  for (uint64_t loc : {3, 63, 64, 65, 128, 200, 9999}) {
+    EXPECT_TRUE(m_visited.get_bit(loc)) << loc;
+  }
+  EXPECT_EQ(7, m_visited.count());
+
+  locs = {3, 65, 4};
+  m_visited.test_and_set(&locs);
+  EXPECT_THAT(locs, ElementsAre(4));
+
+  locs = {5, 6, 5};
+  m_visited.set_bits(&locs);
+  EXPECT_THAT(locs, UnorderedElementsAre(5, 5, 6));
+  EXPECT_EQ(10, m_visited.count());
+}
+
+TEST_P(seqset_bitmap_visited_test, parallel_claims) {
+  // Each entry is claimed by several work items, but only one of
+  // them should succeed.
+  constexpr size_t k_claims_per_entry = 8;
+  std::atomic<size_t> single_claimed{0};
+  std::atomic<size_t> batch_claimed{0};
+  parallel_for(0, k_size * k_claims_per_entry, [&](size_t start, size_t limit) {
+    std::vector<uint64_t> batch;
+    for (size_t i = start; i != limit; ++i) {
+      uint64_t loc = (i * 7919) % k_size;
+      if (i % 2) {
+        batch.push_back(loc);
+      } else if (m_visited.test_and_set(loc)) {
+        ++single_claimed;
+      }
+    }
+    m_visited.test_and_set(&batch);
+    batch_claimed += batch.size();
+  });
+  EXPECT_EQ(k_size, single_claimed.load() + batch_claimed.load());
+  EXPECT_EQ(k_size, m_visited.count());
+}
+
+TEST_P(seqset_bitmap_visited_test, local_buffer) {
+  std::mt19937 rand(1);
+  std::vector<uint64_t> locs;
+  for (size_t i = 0; i != 5000; ++i) {
+    locs.push_back(rand() % k_size);
+  }
+
+  parallel_for(0, locs.size(), [&](size_t start, size_t limit, parallel_state& st) {
+    auto* buf = st.get_local<seqset_bitmap_visited::buffer>(&m_visited, 16 /* flush size */);
+    for (size_t i = start; i != limit; ++i) {
+      buf->add(locs[i]);
+    }
+  });
+
+  std::set<uint64_t> expected(locs.begin(), locs.end());
+  EXPECT_EQ(expected.size(), m_visited.count());
+  for (uint64_t loc = 0; loc != k_size; ++loc) {
+    EXPECT_EQ(expected.count(loc), m_visited.get_bit(loc)) << loc;
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(seqset_bitmap_visited_modes, seqset_bitmap_visited_test,
+                        Values(seqset_bitmap_visited::mode::DENSE,
+                               seqset_bitmap_visited::mode::SPARSE));
@@ -0,0 +1,322 @@
+#include "modules/bio_base/unitig_assemble.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#include "modules/io/parallel.h"
+
+unitig_assembler::unitig_assembler(const readmap* rm, const unitig_assemble_options& options)
+    : m_readmap(rm),
+      m_seqset(rm->get_seqset().get()),
+      m_options(options),
+      m_visited(m_seqset->size()) {
+  CHECK_GT(m_options.min_overlap, 0);
+  CHECK_GT(m_options.max_overlaps, 0);
+}
+
+boost::optional<uint64_t> unitig_assembler::rc_entry(uint64_t entry) const {
+  unsigned entry_size = m_seqset->entry_size(entry);
+  auto read_ids = m_readmap->entry_to_index(entry);
+  for (uint64_t read_id = read_ids.first; read_id != read_ids.second; ++read_id) {
+    if (unsigned(m_readmap->get_readlength(read_id)) != entry_size) {
+      continue;
+    }
+    uint64_t rc = m_readmap->index_to_entry(m_readmap->get_rev_comp(read_id));
+    if (m_seqset->entry_size(rc) != entry_size) {
+      // The reverse complement is contained in a longer read.
+      return boost::none;
+    }
+    return rc;
+  }
+  return boost::none;
+}
+
+uint64_t unitig_assembler::canonical_entry(uint64_t entry) const {
+  boost::optional<uint64_t> rc = rc_entry(entry);
+  CHECK(rc) << entry;
+  return std::min(entry, *rc);
+}
+
+bool unitig_assembler::left_overlaps(uint64_t entry,
+                                     std::vector<overlap_result_t>* result) const {
+  std::vector<overlap_result_t> overlaps = m_seqset->ctx_entry(entry).find_overlap_reads_fair(
+      m_options.max_overlaps, m_options.min_overlap, *m_readmap, true /* rely on read bitmap */);
+  if (overlaps.size() > m_options.max_overlaps) {
+    return false;
+  }
+  for (const overlap_result_t& overlap : overlaps) {
+    // Skip reads that are contained in other reads.
+    if (rc_entry(overlap.seqset_id)) {
+      result->push_back(overlap);
+    }
+  }
+  return true;
+}
+
+boost::optional<overlap_result_t> unitig_assembler::unique_left(uint64_t entry) const {
+  std::vector<overlap_result_t> overlaps;
+  if (!left_overlaps(entry, &overlaps) || overlaps.empty()) {
+    return boost::none;
+  }
+
+  const overlap_result_t& best = overlaps.front();
+  unsigned best_added = m_seqset->entry_size(best.seqset_id) - best.overlap_bases;
+  dna_sequence best_bases;
+  for (size_t i = 1; i < overlaps.size(); ++i) {
+    const overlap_result_t& other = overlaps[i];
+    unsigned other_added = m_seqset->entry_size(other.seqset_id) - other.overlap_bases;
+    if (best_bases.size() == 0) {
+      best_bases = m_seqset->ctx_entry(best.seqset_id).sequence(best_added);
+    }
+    dna_sequence other_bases = m_seqset->ctx_entry(other.seqset_id).sequence(other_added);
+
+    // Other overlaps must agree with the best one on the bases they
+    // add next to "entry".
+    unsigned common = std::min(best_added, other_added);
+    if (!(best_bases.subseq(best_added - common, common) ==
+          other_bases.subseq(other_added - common, common))) {
+      return boost::none;
+    }
+  }
+  return best;
+}
+
+boost::optional<overlap_result_t> unitig_assembler::next_left(uint64_t entry) const {
+  boost::optional<overlap_result_t> left = unique_left(entry);
+  if (!left) {
+    return boost::none;
+  }
+
+  // "entry" must also be the single best extension to the right of
+  // the read we found.
+  boost::optional<overlap_result_t> back = unique_left(*rc_entry(left->seqset_id));
+  if (!back || back->seqset_id != *rc_entry(entry)) {
+    return boost::none;
+  }
+  return left;
+}
+
+void unitig_assembler::walk_left(uint64_t start, std::unordered_set<uint64_t>* seen,
+                                 walk_result* result) const {
+  uint64_t cur = start;
+  for (;;) {
+    boost::optional<overlap_result_t> next = next_left(cur);
+    if (!next) {
+      return;
+    }
+    if (next->seqset_id == start) {
+      result->circular = true;
+      return;
+    }
+    uint64_t canon = canonical_entry(next->seqset_id);
+    if (m_visited.get_bit(canon)) {
+      result->visited = true;
+      return;
+    }
+    if (!seen->insert(canon).second) {
+      // Ran into the other orientation of a read already in this
+      // unitig.
+      return;
+    }
+    result->steps.push_back(*next);
+    cur = next->seqset_id;
+  }
+}
+
+dna_sequence unitig_assembler::left_bases(const std::vector<overlap_result_t>& steps) const {
+  dna_sequence result;
+  for (auto it = steps.rbegin(); it != steps.rend(); ++it) {
+    unsigned added = m_seqset->entry_size(it->seqset_id) - it->overlap_bases;
+    result += m_seqset->ctx_entry(it->seqset_id).sequence(added);
+  }
+  return result;
+}
+
+void unitig_assembler::mark_visited(uint64_t start, const walk_result& left,
+                                    const walk_result& right, seqset_bitmap_visited::buffer* marks,
+                                    unitig* result) {
+  auto add_read = [&](uint64_t entry) {
+    marks->add(canonical_entry(entry));
+    auto read_ids = m_readmap->entry_to_index(entry);
+    result->read_count += read_ids.second - read_ids.first;
+    ++result->entry_count;
+  };
+  add_read(start);
+  for (const overlap_result_t& step : left.steps) {
+    add_read(step.seqset_id);
+  }
+  for (const overlap_result_t& step : right.steps) {
+    add_read(step.seqset_id);
+  }
+}
+
+void unitig_assembler::assemble_from(uint64_t start, seqset_bitmap_visited::buffer* marks,
+                                     std::vector<unitig>* result) {
+  // Only start from one orientation of each read.
+  boost::optional<uint64_t> start_rc = rc_entry(start);
+  if (!start_rc || *start_rc < start || m_visited.get_bit(start)) {
+    return;
+  }
+
+  std::unordered_set<uint64_t> seen;
+  seen.insert(start);
+  walk_result left, right;
+  walk_left(start, &seen, &left);
+  if (left.visited) {
+    return;
+  }
+
+  unitig u;
+  if (left.circular) {
+    // Circular unitigs are assembled starting from their lowest read,
+    // so they always come out the same.
+    for (const overlap_result_t& step : left.steps) {
+      if (canonical_entry(step.seqset_id) < start) {
+        return;
+      }
+    }
+    if (!m_visited.test_and_set(start)) {
+      return;
+    }
+    u.first_entry = left.steps.empty() ? start : left.steps.back().seqset_id;
+    u.last_entry = start;
+    u.seq = left_bases(left.steps);
+    u.seq += m_seqset->ctx_entry(start).sequence();
+  } else {
+    walk_left(*start_rc, &seen, &right);
+    if (right.visited) {
+      return;
+    }
+    uint64_t left_end = left.steps.empty() ? start : left.steps.back().seqset_id;
+    uint64_t right_end_rc = right.steps.empty() ? *start_rc : right.steps.back().seqset_id;
+
+    // Other threads may be assembling this same unitig from different
+    // start reads; whoever claims the lower end first outputs it.
+    if (!m_visited.test_and_set(
+            std::min(canonical_entry(left_end), canonical_entry(right_end_rc)))) {
+      return;
+    }
+    u.first_entry = left_end;
+    u.last_entry = *rc_entry(right_end_rc);
+    u.seq = left_bases(left.steps);
+    u.seq += m_seqset->ctx_entry(start).sequence();
+    u.seq += left_bases(right.steps).rev_comp();
+  }
+  mark_visited(start, left, right, marks, &u);
+
+  uint64_t rc_last = *rc_entry(u.last_entry);
+  if (rc_last < u.first_entry) {
+    u.seq = u.seq.rev_comp();
+    u.last_entry = *rc_entry(u.first_entry);
+    u.first_entry = rc_last;
+  }
+  if (u.seq.size() >= m_options.min_unitig_len) {
+    result->push_back(std::move(u));
+  }
+}
+
+void unitig_assembler::assemble(progress_handler_t progress) {
+  std::mutex mu;
+  m_unitigs.clear();
+  parallel_for(0, m_seqset->size(),
+               [&](size_t start, size_t limit, parallel_state& st) {
+                 auto* marks = st.get_local<seqset_bitmap_visited::buffer>(&m_visited);
+                 std::vector<unitig> local;
+                 for (uint64_t entry = start; entry != limit; ++entry) {
+                   if (m_readmap->get_bit(entry)) {
+                     assemble_from(entry, marks, &local);
+                   }
+                 }
+                 std::lock_guard<std::mutex> l(mu);
+                 for (unitig& u : local) {
+                   m_unitigs.push_back(std::move(u));
+                 }
+               },
+               progress);
+
+  std::sort(m_unitigs.begin(), m_unitigs.end(), [](const unitig& a, const unitig& b) {
+    return std::make_pair(a.first_entry, a.last_entry) <
+           std::make_pair(b.first_entry, b.last_entry);
+  });
+}
+
+std::vector<unitig_link> unitig_assembler::find_links(progress_handler_t progress) const {
+  // Maps the last read of each unitig, in both orientations, to the
+  // unitig's index and orientation.
+  std::unordered_map<uint64_t, std::pair<size_t, bool>> last_reads;
+  for (size_t i = 0; i != m_unitigs.size(); ++i) {
+    last_reads.emplace(m_unitigs[i].last_entry, std::make_pair(i, false));
+    last_reads.emplace(*rc_entry(m_unitigs[i].first_entry), std::make_pair(i, true));
+  }
+
+  std::mutex mu;
+  std::vector<unitig_link> links;
+  parallel_for(0, m_unitigs.size(),
+               [&](size_t start, size_t limit) {
+                 std::vector<unitig_link> local;
+                 std::vector<overlap_result_t> overlaps;
+                 for (size_t i = start; i != limit; ++i) {
+                   for (bool to_rev : {false, true}) {
+                     uint64_t first = to_rev ? *rc_entry(m_unitigs[i].last_entry)
+                                             : m_unitigs[i].first_entry;
+                     overlaps.clear();
+                     if (!left_overlaps(first, &overlaps)) {
+                       continue;
+                     }
+                     for (const overlap_result_t& overlap : overlaps) {
+                       auto it = last_reads.find(overlap.seqset_id);
+                       if (it == last_reads.end()) {
+                         continue;
+                       }
+                       unitig_link link;
+                       link.from = it->second.first;
+                       link.from_rev = it->second.second;
+                       link.to = i;
+                       link.to_rev = to_rev;
+                       link.overlap = overlap.overlap_bases;
+
+                       // Each link is found from both sides; use the
+                       // orientation that sorts first.
+                       unitig_link flipped = link;
+                       flipped.from = link.to;
+                       flipped.from_rev = !link.to_rev;
+                       flipped.to = link.from;
+                       flipped.to_rev = !link.from_rev;
+                       local.push_back(std::min(link, flipped));
+                     }
+                   }
+                 }
+                 std::lock_guard<std::mutex> l(mu);
+                 links.insert(links.end(), local.begin(), local.end());
+               },
+               progress);
+
+  std::sort(links.begin(), links.end());
+  links.erase(std::unique(links.begin(), links.end()), links.end());
+  return links;
+}
+
+void write_unitigs_fasta(writable& out, const std::vector<unitig>& unitigs) {
+  for (size_t i = 0; i != unitigs.size(); ++i) {
+    const unitig& u = unitigs[i];
+    out.print(">unitig_%lu len=%lu reads=%lu\n", i, u.seq.size(), u.read_count);
+    out.print(u.seq.as_string());
+    out.print("\n");
+  }
+}
+
+void write_unitigs_gfa(writable& out, const std::vector<unitig>& unitigs,
+                       const std::vector<unitig_link>& links) {
+  out.print("H\tVN:Z:1.0\n");
+  for (size_t i = 0; i != unitigs.size(); ++i) {
+    const unitig& u = unitigs[i];
+    out.print("S\tunitig_%lu\t", i);
+    out.print(u.seq.as_string());
+    out.print("\tLN:i:%lu\tRC:i:%lu\n", u.seq.size(), u.read_count);
+  }
+  for (const unitig_link& link : links) {
+    out.print("L\tunitig_%lu\t%c\tunitig_%lu\t%c\t%uM\n", link.from, link.from_rev ? '-' : '+',
+              link.to, link.to_rev ? '-' : '+', link.overlap);
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+// Reference-free assembly of unitigs directly from a seqset and readmap.
+//
+// Reads are nodes in an overlap graph, where read A precedes read B
+// if a suffix of A is a prefix of B.  Overlaps are found with
+// seqset_range::find_overlap_reads_fair, which extends a read to the
+// left with push_front_drop; overlaps on the right side of a read are
+// found by extending its reverse complement.
+//
+// A unitig is a maximal path of reads where each read has a single
+// best overlap in the direction of the path, and is also the single
+// best overlap of the read it extends.  Other overlaps are allowed if
+// they're consistent with the best one (e.g. transitive overlaps).
+//
+// Start reads are distributed across the thread pool by seqset entry
+// id.  Each unitig is only output once; a seqset_bitmap_visited
+// records which reads have already been assembled into a unitig so
+// other start reads in it can be skipped.  Each worker batches its
+// marks in a seqset_bitmap_visited::buffer; until they're flushed
+// another start read may walk the same unitig again, but only the
+// thread that claims its end with test_and_set outputs it.
+
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "modules/bio_base/dna_sequence.h"
+#include "modules/bio_base/readmap.h"
+#include "modules/bio_base/seqset.h"
+#include "modules/bio_base/seqset_bitmap_visited.h"
+#include "modules/io/io.h"
+#include "modules/io/progress.h"
+
+struct unitig_assemble_options {
+  // Minimum number of bases reads must overlap to be adjacent.
+  unsigned min_overlap = 50;
+
+  // Maximum number of overlapping reads to consider when extending a
+  // read.  Reads with more overlaps than this end unitigs.
+  unsigned max_overlaps = 16;
+
+  // Unitigs shorter than this are not output.
+  unsigned min_unitig_len = 0;
+};
+
+struct unitig {
+  // Assembled sequence.
+  dna_sequence seq;
+
+  // Seqset entries of the first and last reads of the unitig, in the
+  // orientation of "seq".  For a circular unitig, "seq" ends with a
+  // copy of the beginning of the first read.
+  uint64_t first_entry = 0;
+  uint64_t last_entry = 0;
+
+  // Number of distinct read sequences assembled into this unitig.
+  size_t entry_count = 0;
+  // Number of reads assembled into this unitig, including duplicates.
+  size_t read_count = 0;
+};
+
+// An overlap of the end of one unitig with the beginning of another,
+// in the given orientations.
+struct unitig_link {
+  size_t from = 0;
+  bool from_rev = false;
+  size_t to = 0;
+  bool to_rev = false;
+  unsigned overlap = 0;
+
+  bool operator<(const unitig_link& rhs) const {
+    return std::tie(from, from_rev, to, to_rev, overlap) <
+           std::tie(rhs.from, rhs.from_rev, rhs.to, rhs.to_rev, rhs.overlap);
+  }
+  bool operator==(const unitig_link& rhs) const {
+    return std::tie(from, from_rev, to, to_rev, overlap) ==
+           std::tie(rhs.from, rhs.from_rev, rhs.to, rhs.to_rev, rhs.overlap);
+  }
+};
+
+class unitig_assembler {
+ public:
+  // "rm" must outlive this assembler.
+  unitig_assembler(const readmap* rm, const unitig_assemble_options& options);
+
+  // Assembles all reads in the readmap into unitigs.  Output is
+  // deterministic regardless of the number of threads.
+  void assemble(progress_handler_t progress = null_progress_handler);
+
+  // Unitigs found by "assemble", sorted by first entry.
+  const std::vector<unitig>& unitigs() const { return m_unitigs; }
+
+  // Returns the overlaps between the ends of the assembled unitigs.
+  // Each overlap is only returned once, in the orientation that sorts
+  // first.
+  std::vector<unitig_link> find_links(progress_handler_t progress = null_progress_handler) const;
+
+ private:
+  struct walk_result {
+    // Reads passed, from nearest to farthest.
+    std::vector<overlap_result_t> steps;
+    // True if the walk returned to its start.
+    bool circular = false;
+    // True if the walk ran into a read that's already been assembled.
+    bool visited = false;
+  };
+
+  // Returns the seqset entry of the reverse complement of the read at
+  // "entry", or boost::none if "entry" doesn't contain a full length
+  // read in both orientations.
+  boost::optional<uint64_t> rc_entry(uint64_t entry) const;
+  uint64_t canonical_entry(uint64_t entry) const;
+
+  // Returns the reads overlapping the left side of "entry", in order
+  // of decreasing overlap.  Returns false if there are too many.
+  bool left_overlaps(uint64_t entry, std::vector<overlap_result_t>* result) const;
+
+  // Returns the read that "entry" extends to the left, if there's a
+  // single best one.
+  boost::optional<overlap_result_t> unique_left(uint64_t entry) const;
+
+  // Returns the next read in the unitig to the left of "entry".
+  boost::optional<overlap_result_t> next_left(uint64_t entry) const;
+
+  void walk_left(uint64_t start, std::unordered_set<uint64_t>* seen, walk_result* result) const;
+
+  // Assembles the unitig containing "start", if nothing else has yet.
+  void assemble_from(uint64_t start, seqset_bitmap_visited::buffer* marks,
+                     std::vector<unitig>* result);
+
+  // Prepends the bases added to the left by each step in "steps".
+  dna_sequence left_bases(const std::vector<overlap_result_t>& steps) const;
+
+  // Adds all the reads in a unitig to "marks" to be marked visited,
+  // and fills in its read counts.
+  void mark_visited(uint64_t start, const walk_result& left, const walk_result& right,
+                    seqset_bitmap_visited::buffer* marks, unitig* result);
+
+  const readmap* const m_readmap;
+  const seqset* const m_seqset;
+  const unitig_assemble_options m_options;
+
+  seqset_bitmap_visited m_visited;
+  std::vector<unitig> m_unitigs;
+};
+
+// Writes unitigs as FASTA, named "unitig_<index>".
+void write_unitigs_fasta(writable& out, const std::vector<unitig>& unitigs);
+
+// Writes unitigs and the links between them in GFA 1 format.
+void write_unitigs_gfa(writable& out, const std::vector<unitig>& unitigs,
+                       const std::vector<unitig_link>& links);
@@ -0,0 +1,166 @@
+#include "modules/bio_base/unitig_assemble.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/bio_base/seqset_testutil.h"
+#include "modules/io/parallel.h"
+
+using namespace testing;
+
+namespace {
+
+constexpr unsigned k_read_len = 40;
+constexpr unsigned k_read_step = 5;
+
+// Returns reads tiling "seq" every k_read_step bases.  If "circular"
+// is true, reads also wrap around the end of "seq".
+std::vector<dna_sequence> tile_reads(const dna_sequence& seq, bool circular = false) {
+  dna_sequence tiled = seq;
+  if (circular) {
+    tiled += seq.subseq(0, k_read_len - 1);
+  }
+  std::vector<dna_sequence> reads;
+  for (size_t pos = 0; pos + k_read_len <= tiled.size(); pos += k_read_step) {
+    reads.push_back(tiled.subseq(pos, k_read_len));
+  }
+  if ((tiled.size() - k_read_len) % k_read_step) {
+    reads.push_back(tiled.subseq(tiled.size() - k_read_len, k_read_len));
+  }
+  return reads;
+}
+
+}  // namespace
+
+class unitig_assemble_test : public Test {
+ public:
+  unitig_assemble_test() : m_rand(1) {
+    m_options.min_overlap = 25;
+  }
+
+  void assemble(const std::vector<dna_sequence>& reads) {
+    std::vector<std::vector<dna_sequence>> all_reads;
+    for (const auto& read : reads) {
+      all_reads.push_back({read});
+    }
+    auto bg = biograph_for_reads(all_reads);
+    m_seqset = bg.first;
+    m_readmap = std::move(bg.second);
+
+    unitig_assembler assembler(m_readmap.get(), m_options);
+    assembler.assemble();
+    m_unitigs = assembler.unitigs();
+    m_links = assembler.find_links();
+  }
+
+  // Returns true if the sequence or its reverse complement is present
+  // in "seq".
+  static bool contains(const dna_sequence& seq, const dna_sequence& part) {
+    return seq.as_string().find(part.as_string()) != std::string::npos ||
+           seq.as_string().find(part.rev_comp().as_string()) != std::string::npos;
+  }
+
+  std::mt19937 m_rand;
+  unitig_assemble_options m_options;
+  std::shared_ptr<seqset> m_seqset;
+  std::unique_ptr<readmap> m_readmap;
+  std::vector<unitig> m_unitigs;
+  std::vector<unitig_link> m_links;
+};
+
+TEST_F(unitig_assemble_test, linear) {
+  dna_sequence genome = rand_dna_sequence(m_rand, 300);
+  assemble(tile_reads(genome));
+
+  ASSERT_THAT(m_unitigs, SizeIs(1));
+  EXPECT_TRUE(m_unitigs[0].seq == genome || m_unitigs[0].seq == genome.rev_comp())
+      << m_unitigs[0].seq;
+  EXPECT_EQ(tile_reads(genome).size(), m_unitigs[0].entry_count);
+  EXPECT_THAT(m_links, IsEmpty());
+}
+
+TEST_F(unitig_assemble_test, repeat) {
+  dna_sequence repeat = rand_dna_sequence(m_rand, 60);
+  dna_sequence a = rand_dna_sequence(m_rand, 100);
+  dna_sequence b = rand_dna_sequence(m_rand, 100);
+  dna_sequence c = rand_dna_sequence(m_rand, 100);
+  dna_sequence d = rand_dna_sequence(m_rand, 100);
+
+  dna_sequence genome1 = a;
+  genome1 += repeat;
+  genome1 += b;
+  dna_sequence genome2 = c;
+  genome2 += repeat;
+  genome2 += d;
+
+  std::vector<dna_sequence> reads = tile_reads(genome1);
+  for (const auto& read : tile_reads(genome2)) {
+    reads.push_back(read);
+  }
+  assemble(reads);
+
+  // The repeat separates the flanks into their own unitigs.
+  ASSERT_THAT(m_unitigs, SizeIs(5));
+  for (const unitig& u : m_unitigs) {
+    EXPECT_TRUE(contains(genome1, u.seq) || contains(genome2, u.seq)) << u.seq;
+  }
+  EXPECT_THAT(m_unitigs, Contains(Field(&unitig::seq, Truly([&](const dna_sequence& seq) {
+                                          return contains(seq, repeat);
+                                        }))));
+
+  // Each flank overlaps the repeat.
+  ASSERT_THAT(m_links, SizeIs(4));
+  for (const unitig_link& link : m_links) {
+    EXPECT_GE(link.overlap, m_options.min_overlap);
+    EXPECT_LT(link.overlap, k_read_len);
+    const dna_sequence& from = m_unitigs[link.from].seq;
+    const dna_sequence& to = m_unitigs[link.to].seq;
+    dna_sequence from_end = link.from_rev ? from.rev_comp() : from;
+    dna_sequence to_start = link.to_rev ? to.rev_comp() : to;
+    EXPECT_EQ(from_end.subseq(from_end.size() - link.overlap, link.overlap),
+              to_start.subseq(0, link.overlap));
+  }
+}
+
+TEST_F(unitig_assemble_test, circular) {
+  dna_sequence genome = rand_dna_sequence(m_rand, 200);
+  assemble(tile_reads(genome, true /* circular */));
+
+  ASSERT_THAT(m_unitigs, SizeIs(1));
+  const unitig& u = m_unitigs[0];
+  ASSERT_THAT(m_links, SizeIs(1));
+  EXPECT_EQ(0, m_links[0].from);
+  EXPECT_EQ(0, m_links[0].to);
+  EXPECT_EQ(m_links[0].from_rev, m_links[0].to_rev);
+
+  // Removing the overlap at the end gives a rotation of the genome.
+  dna_sequence doubled = genome;
+  doubled += genome;
+  EXPECT_EQ(genome.size() + m_links[0].overlap, u.seq.size());
+  EXPECT_TRUE(contains(doubled, u.seq.subseq(0, genome.size()))) << u.seq;
+}
+
+TEST_F(unitig_assemble_test, thread_independent) {
+  std::vector<dna_sequence> reads;
+  for (int i = 0; i < 20; ++i) {
+    for (const auto& read : tile_reads(rand_dna_sequence(m_rand, 150 + i))) {
+      reads.push_back(read);
+    }
+  }
+
+  size_t old_threads = get_thread_count();
+  set_thread_count(1);
+  assemble(reads);
+  std::vector<unitig> single_thread = m_unitigs;
+  set_thread_count(8);
+  assemble(reads);
+  set_thread_count(old_threads);
+
+  ASSERT_EQ(20, m_unitigs.size());
+  ASSERT_EQ(single_thread.size(), m_unitigs.size());
+  for (size_t i = 0; i != m_unitigs.size(); ++i) {
+    EXPECT_EQ(single_thread[i].seq, m_unitigs[i].seq);
+  }
+}
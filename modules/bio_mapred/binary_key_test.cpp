@@ -0,0 +1,93 @@
+#include "modules/bio_base/dna_sequence.h"
+#include "modules/bio_base/seq_position.h"
+#include "modules/bio_base/struct_var.h"
+#include "modules/bio_mapred/dna_sorter.h"
+#include "modules/bio_mapred/seq_position_sorter.h"
+#include "modules/bio_mapred/struct_var_sorter.h"
+#include "modules/io/msgpack_transfer.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace {
+
+int sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+// Checks that for every pair of values, the binary keys produced by
+// "s" order the same way as operator< and as s.compare, and that
+// encoding is deterministic.
+template <class T>
+void check_binary_keys(const sorter& s, const std::vector<T>& vals)
+{
+	ASSERT_TRUE(s.has_binary_keys());
+	std::vector<std::string> keys, encoded;
+	for (const T& val : vals) {
+		keys.push_back(msgpack_serialize(val));
+		std::string enc;
+		s.append_binary_key(enc, keys.back());
+		encoded.push_back(enc);
+
+		std::string again;
+		s.append_binary_key(again, msgpack_serialize(val));
+		EXPECT_EQ(enc, again);
+	}
+
+	for (size_t i = 0; i < vals.size(); i++) {
+		for (size_t j = 0; j < vals.size(); j++) {
+			int expected = vals[i] < vals[j] ? -1 : (vals[j] < vals[i] ? 1 : 0);
+			EXPECT_EQ(expected, sign(s.compare(keys[i], keys[j]))) << i << " vs " << j;
+			EXPECT_EQ(expected, sign(encoded[i].compare(encoded[j]))) << i << " vs " << j;
+		}
+	}
+}
+
+}  // namespace
+
+TEST(binary_key, dna)
+{
+	std::mt19937 rand_source(1);
+	std::vector<dna_sequence> vals = {
+		dna_sequence(""), dna_sequence("A"), dna_sequence("AA"), dna_sequence("AC"),
+		dna_sequence("T"), dna_sequence("TTTT"), dna_sequence("TTTTA"),
+	};
+	for (size_t i = 0; i < 40; i++) {
+		std::string seq;
+		size_t len = rand_source() % 12;
+		for (size_t j = 0; j < len; j++) {
+			seq.push_back("ACGT"[rand_source() % 4]);
+		}
+		vals.emplace_back(seq);
+	}
+	check_binary_keys(dna_sorter(""), vals);
+}
+
+TEST(binary_key, seq_position)
+{
+	std::mt19937_64 rand_source(1);
+	std::vector<seq_position> vals = {
+		seq_position(), seq_position(-1, 5), seq_position(0, 0), seq_position(0, 1),
+		seq_position(1, 0), seq_position(1, 0xFFFFFFFFFFFFFFFFUL), seq_position(2, 256),
+		seq_position(255, 1), seq_position(256, 1),
+	};
+	for (size_t i = 0; i < 40; i++) {
+		vals.emplace_back(int(rand_source() % 5) - 1, rand_source() >> (rand_source() % 64));
+	}
+	check_binary_keys(seq_position_sorter(""), vals);
+}
+
+TEST(binary_key, struct_var)
+{
+	std::mt19937 rand_source(1);
+	std::vector<struct_var_key> vals = {
+		struct_var_key(0, 0), struct_var_key(0, 1), struct_var_key(1, 0),
+		struct_var_key(0xFFFFFFFF, 0), struct_var_key(0xFF, 0x100), struct_var_key(0x100, 0xFF),
+	};
+	for (size_t i = 0; i < 40; i++) {
+		vals.emplace_back(rand_source() % 4, rand_source() >> (rand_source() % 32));
+	}
+	check_binary_keys(struct_var_sorter(""), vals);
+}
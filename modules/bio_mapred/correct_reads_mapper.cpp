@@ -120,16 +120,7 @@ bool correct_reads_mapper::map_one_read(corrected_read& v, const read_id& id, co
      params.max_corrections = m_params.frc_max_corrections;
      params.min_good_run = m_params.frc_min_good_run;
      params.kmer_size = m_kdb->kmer_size();
-     params.kmer_lookup_f = [&](kmer_t kmer, frc_kmer* ki) -> bool {
-       kmer_t canon = canonicalize(kmer, m_kdb->kmer_size(), ki->flipped);
-       auto index = m_kdb->find_table_index(canon);
-       if (index == kmer_set::k_not_present) {
-         return false;
-       }
-       ki->index = index;
-       return true;
-     };
-     frc_output res = fast_read_correct(r.sequence, params);
+     frc_output res = fast_read_correct(r.sequence, params, kmer_set_frc_lookup(*m_kdb));
      unsigned needed_good_bases = m_params.trim_after_portion * v.sequence.size();
      if (res.corrected.size() < needed_good_bases) {
        m_stats.failed_correction_count++;
@@ -31,3 +31,13 @@ size_t dna_sorter::partition(const std::string& key, size_t num_partitions) cons
 	return tot % num_partitions;
 }
 
+void dna_sorter::append_binary_key(std::string& out, const std::string& key) const
+{
+	dna_sequence s;
+	if (key != "") msgpack_deserialize(s, key);
+	// One byte per base preserves the order of dna_sequence::operator<,
+	// including sorting prefixes first.
+	for (size_t i = 0; i < s.size(); i++) {
+		out.push_back(char(int(s[i])));
+	}
+}
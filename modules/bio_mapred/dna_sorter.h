@@ -10,6 +10,8 @@ public:
         dna_sorter(const std::string& params) {}
         int compare(const std::string& key1, const std::string& key2) const override;
         size_t partition(const std::string& key, size_t num_partitions) const override;
+        bool has_binary_keys() const override { return true; }
+        void append_binary_key(std::string& out, const std::string& key) const override;
 };
 
 #endif
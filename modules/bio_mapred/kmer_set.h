@@ -6,6 +6,7 @@
 #include "modules/io/mmap_buffer.h"
 #include "modules/io/progress.h"
 #include "modules/io/packed_vector.h"
+#include "modules/bio_base/fast_read_correct.h"
 #include "modules/bio_base/kmer.h"
 
 #include <algorithm>
@@ -142,6 +143,9 @@ public:
 	const_iterator find(kmer_t x) const;  // Get the index of a kmer, or npos
 	size_t count(kmer_t x) const { return find_table_index(x) == k_not_present ? 0 : 1; }
   size_t find_table_index(kmer_t x) const;
+  // Prefetches the part of the lookup table that find_table_index
+  // will need to find the given kmer.
+  void prefetch(kmer_t x) const { __builtin_prefetch(m_lookup + lookup_for_kmer(x)); }
 
 	struct kmer_serialized;
 
@@ -185,6 +189,27 @@ private:
   std::unique_ptr<flags_table_t> m_flags_table;
 };
 
+// Looks up kmers in a kmer_set for the templated fast_read_correct.
+class kmer_set_frc_lookup {
+ public:
+  explicit kmer_set_frc_lookup(const kmer_set& ks) : m_ks(ks) {}
+
+  bool operator()(kmer_t kmer, frc_kmer* kmer_info) const {
+    kmer_t canon = canonicalize(kmer, m_ks.kmer_size(), kmer_info->flipped);
+    size_t index = m_ks.find_table_index(canon);
+    if (index == kmer_set::k_not_present) {
+      return false;
+    }
+    kmer_info->index = index;
+    return true;
+  }
+
+  void prefetch(kmer_t kmer) const { m_ks.prefetch(canonicalize(kmer, m_ks.kmer_size())); }
+
+ private:
+  const kmer_set& m_ks;
+};
+
 // Made this public for the GC, TODO: fix this
 struct kmer_set::kmer_serialized
 {
@@ -10,8 +10,11 @@
 #include "modules/io/file_io.h"
 #include "modules/io/parallel.h"
 #include "modules/io/msgpack_transfer.h"
+#include "modules/io/spiral_file_mmap.h"
 #include "modules/mapred/manifest_parallel.h"
 
+bool g_make_readmap_serial_linking = false;
+
 void make_readmap::do_make(const std::string& readmap_file_path, const seqset_file& the_seqset_file,
                            manifest corrected_reads, bool is_paired, unsigned max_read_len,
                            progress_handler_t progress) {
@@ -43,6 +46,13 @@ void make_readmap::upgrade(const readmap& old_readmap,
   maker.create_from_upgrade(old_readmap, the_seqset_file, c.create(), lookup_seq, progress);
 }
 
+void make_readmap::compact(const readmap& old_readmap, const std::string& new_readmap_path,
+                           progress_handler_t progress) {
+  make_readmap maker(nullptr);
+  spiral_file_create_mmap c(new_readmap_path);
+  maker.create_from_compact(old_readmap, c.create(), progress);
+}
+
 void make_readmap::fast_migrate(const readmap& old_readmap,
                                 const seqset_mergemap& mergemap,
                                 const spiral_file_create_state& new_readmap,
@@ -60,11 +70,6 @@ void make_readmap::import_reads_from(
 
     progress(0);
 
-	manifest_reader corrected_reads_reader(corrected_reads_manifest);
-	kv_reader corrected_reads_kvs(corrected_reads_reader);
-	std::string read_id;
-	corrected_reads read_pair;
-
 	SPLOG("Constructing mate table builder.");
 	size_t mate_loop_table_size = (is_paired ? 4 : 2) * corrected_reads_manifest.get_num_records();
     CHECK(m_mate_loop_table.empty());
@@ -74,19 +79,25 @@ void make_readmap::import_reads_from(
 		, m_mate_loop_table.size() * sizeof(mate_loop_table_entry)
 	);
 
-	parallel_mate_loop_table_builder the_table_builder(
-		m_mate_loop_table
-		, m_seqset
-		, corrected_reads_manifest.count_file_infos()
-		, corrected_reads_manifest.get_num_records()
-		, is_paired
-	);
 	SPLOG("Starting mate loop table build.");
     progress(0.2);
-	auto functor
-		 = manifest_parallelize<parallel_mate_loop_table_builder, std::string, corrected_reads>
-        (corrected_reads_manifest, the_table_builder, subprogress(progress, 0.2, 0.4));
-	auto counts = functor.get_counts();
+	std::pair<uint64_t, uint64_t> counts;
+	if (corrected_reads_manifest.get_encoding() == packed_read_store::k_manifest_encoding) {
+		counts = import_packed_reads(corrected_reads_manifest, is_paired,
+		                             subprogress(progress, 0.2, 0.4));
+	} else {
+		parallel_mate_loop_table_builder the_table_builder(
+			m_mate_loop_table
+			, m_seqset
+			, corrected_reads_manifest.count_file_infos()
+			, corrected_reads_manifest.get_num_records()
+			, is_paired
+		);
+		auto functor
+			 = manifest_parallelize<parallel_mate_loop_table_builder, std::string, corrected_reads>
+	        (corrected_reads_manifest, the_table_builder, subprogress(progress, 0.2, 0.4));
+		counts = functor.get_counts();
+	}
 	SPLOG("Mate loop table has %lu entries, %lu paired and %lu unpaired", m_mate_loop_table.size(), counts.first, counts.second);
     progress(0.4);
 
@@ -110,6 +121,66 @@ void make_readmap::import_reads_from(
     progress(1);
 }
 
+std::pair<uint64_t, uint64_t> make_readmap::import_packed_reads(
+    const manifest& corrected_reads_manifest, bool is_paired, progress_handler_t progress) {
+  // Open every store up front so each chunk can be processed
+  // independently, reading sequences straight out of the mapped files.
+  std::vector<std::unique_ptr<spiral_file_open_mmap>> files;
+  std::vector<std::unique_ptr<packed_read_store>> stores;
+  std::vector<size_t> first_record_ids;
+  struct chunk_ref {
+    size_t file_info_id;
+    size_t chunk_id;
+  };
+  std::vector<chunk_ref> chunks;
+  size_t num_records = 0;
+  for (const file_info& fi : corrected_reads_manifest) {
+    files.emplace_back(new spiral_file_open_mmap(fi.file.bare_path()));
+    stores.emplace_back(new packed_read_store(files.back()->open()));
+    const packed_read_store& store = *stores.back();
+    if (store.size() != fi.num_records) {
+      throw io_exception(printstring("Packed read store %s has %lu records; expected %lu",
+                                     fi.file.bare_path().c_str(), store.size(), fi.num_records));
+    }
+    for (size_t chunk_id = 0; chunk_id != store.num_chunks(); ++chunk_id) {
+      chunks.push_back(chunk_ref{stores.size() - 1, chunk_id});
+    }
+    first_record_ids.push_back(num_records);
+    num_records += store.size();
+  }
+  CHECK_EQ(num_records, corrected_reads_manifest.get_num_records());
+  SPLOG("Importing %lu records from %lu chunks in %lu packed read stores", num_records,
+        chunks.size(), stores.size());
+
+  // Chunks of the same store may be processed concurrently, so count
+  // reads per chunk instead of per file.
+  parallel_mate_loop_table_builder table_builder(m_mate_loop_table, m_seqset, chunks.size(),
+                                                 num_records, is_paired);
+
+  parallel_for(0, chunks.size(),
+               [&](size_t idx) {
+                 const chunk_ref& ref = chunks[idx];
+                 packed_read_chunk chunk = stores[ref.file_info_id]->chunk(ref.chunk_id);
+                 size_t record_id = first_record_ids[ref.file_info_id] + chunk.first_record_id();
+                 for (size_t record = 0; record != chunk.size(); ++record, ++record_id) {
+                   unsigned read_count = chunk.read_count(record);
+                   size_t read = chunk.first_read(record);
+                   dna_slice sequence;
+                   dna_slice mate_sequence;
+                   if (read_count >= 1) {
+                     sequence = chunk.sequence(read);
+                   }
+                   if (read_count == 2) {
+                     mate_sequence = chunk.sequence(read + 1);
+                   }
+                   table_builder.add_record(sequence, mate_sequence, read_count, idx,
+                                            record_id, "" /* read_id */);
+                 }
+               },
+               progress);
+  return table_builder.get_counts();
+}
+
 std::pair<uint64_t, uint64_t> make_readmap::parallel_mate_loop_table_builder::get_counts() const
 {
 	return std::make_pair(
@@ -121,18 +192,29 @@ std::pair<uint64_t, uint64_t> make_readmap::parallel_mate_loop_table_builder::ge
 void make_readmap::parallel_mate_loop_table_builder::operator()(
     const std::string& read_id, const corrected_reads& read_pair,
     size_t file_info_id, size_t record_id) {
-  dna_slice sequence = read_pair[0].corrected;
   dna_slice mate_sequence;
-  if (read_pair.size() == 2 && m_is_paired) {
+  if (read_pair.size() == 2) {
     mate_sequence = read_pair[1].corrected;
-    m_paired_counts[file_info_id] += m_is_paired ? 4 : 2;
-  } else if (read_pair.size() == 1) {
-    m_unpaired_counts[file_info_id] += m_is_paired ? 4 : 2;
+  }
+  add_record(read_pair.empty() ? dna_slice() : dna_slice(read_pair[0].corrected), mate_sequence,
+             read_pair.size(), file_info_id, record_id, read_id);
+}
+
+void make_readmap::parallel_mate_loop_table_builder::add_record(
+    const dna_slice& sequence, const dna_slice& orig_mate_sequence, unsigned read_count,
+    size_t count_id, size_t record_id, const std::string& read_id) {
+  dna_slice mate_sequence;
+  if (read_count == 2 && m_is_paired) {
+    mate_sequence = orig_mate_sequence;
+    m_paired_counts[count_id] += m_is_paired ? 4 : 2;
+  } else if (read_count == 1) {
+    m_unpaired_counts[count_id] += m_is_paired ? 4 : 2;
   } else {
     throw io_exception(
         boost::format("Unexpected read pairing found for read \"%1%\": %2% "
                       "reads were found in a \"pair.\" m_is_paired = %3%") %
-        read_id % read_pair.size() % m_is_paired);
+        (read_id.empty() ? printstring("#%lu", record_id) : read_id) % read_count %
+        m_is_paired);
   }
 
   auto get_entry = [&](dna_slice read_sequence,
@@ -300,71 +382,195 @@ void make_readmap::create_from_reads(manifest corrected_reads_manifest, bool is_
         },
         subprogress(progress, 0.8, 0.9));
 
-    // Second pass, nonparallelizable so we can stay deterministic.  Claim entries and complete the
-    // link from MATE_RC->LOOP_START
-
+    // Second pass: claim entries and complete the link from MATE_RC->LOOP_START.
     SPLOG("Linking mate loops");
-    subprogress fill_progress(progress, 0.9, 1);
-    mutable_packed_vector<unsigned, 1> claimed(m_mate_loop_table.size(), "make_readmap:claimed");
-    // Given the result from find_first_of, claims the next unclaimed read.  To ensure determinism,
-    // this part should be run without parallelism.
-    auto claim_next = [&](uint64_t try_idx, loop_entry_type type, uint64_t entry_id,
-                          unsigned read_length) -> uint64_t {
-      CHECK_LT(try_idx, m_mate_loop_table.size());
-      {
-        const auto& try_loop_row = m_mate_loop_table[try_idx];
-        DCHECK_EQ(try_loop_row.entry_id, entry_id);
-        DCHECK_EQ(try_loop_row.read_length, read_length);
-        DCHECK_EQ(try_loop_row.type, type);
-      }
+    if (g_make_readmap_serial_linking || get_thread_count() == 1) {
+      link_mate_loops_serial(subprogress(progress, 0.9, 1));
+    } else {
+      link_mate_loops(subprogress(progress, 0.9, 1));
+    }
 
-      try_idx = claimed.claim_next_available(try_idx);
-      CHECK_LT(try_idx, m_mate_loop_table.size());
+    SPLOG("Mate loop entries complete");
+  }
+  progress(1);
+}
 
-      const auto& try_loop_row = m_mate_loop_table[try_idx];
-      CHECK_EQ(try_loop_row.entry_id, entry_id);
-      CHECK_EQ(try_loop_row.read_length, read_length);
-      CHECK_EQ(try_loop_row.type, type);
+uint64_t make_readmap::claim_next(mutable_packed_vector<unsigned, 1>& claimed, uint64_t try_idx,
+                                  loop_entry_type type, uint64_t entry_id,
+                                  unsigned read_length) const {
+  CHECK_LT(try_idx, m_mate_loop_table.size());
+  {
+    const auto& try_loop_row = m_mate_loop_table[try_idx];
+    DCHECK_EQ(try_loop_row.entry_id, entry_id);
+    DCHECK_EQ(try_loop_row.read_length, read_length);
+    DCHECK_EQ(try_loop_row.type, type);
+  }
 
-      return try_idx;
-    };
+  try_idx = claimed.claim_next_available(try_idx);
+  CHECK_LT(try_idx, m_mate_loop_table.size());
 
-    for (size_t idx = 0; idx != m_mate_loop_table.size(); ++idx) {
-      auto& loop_row = m_mate_loop_table[idx];
-      if (loop_row.type != LOOP_START) {
-        continue;
-      }
+  const auto& try_loop_row = m_mate_loop_table[try_idx];
+  CHECK_EQ(try_loop_row.entry_id, entry_id);
+  CHECK_EQ(try_loop_row.read_length, read_length);
+  CHECK_EQ(try_loop_row.type, type);
 
-      if ((idx & 0xFFFF) == 0) {
-        fill_progress(idx * 1.0 / m_mate_loop_table.size());
-      }
+  return try_idx;
+}
 
-      uint64_t rc_idx =
-          claim_next(m_mate_loop_ptr->get(idx), RC, loop_row.loop_entry_id, loop_row.read_length);
-      m_mate_loop_ptr->set(idx, rc_idx);
-      auto& rc_loop_row = m_mate_loop_table[rc_idx];
+void make_readmap::link_mate_loops_serial(progress_handler_t progress) {
+  mutable_packed_vector<unsigned, 1> claimed(m_mate_loop_table.size(), "make_readmap:claimed");
 
-      if (rc_loop_row.loop_entry_id == k_no_loop_entry) {
-        // No mate for this one; just point back to original.
-        m_mate_loop_ptr->set(rc_idx, idx);
-        continue;
-      }
+  for (size_t idx = 0; idx != m_mate_loop_table.size(); ++idx) {
+    auto& loop_row = m_mate_loop_table[idx];
+    if (loop_row.type != LOOP_START) {
+      continue;
+    }
 
-      uint64_t mate_idx = claim_next(m_mate_loop_ptr->get(rc_idx), MATE, rc_loop_row.loop_entry_id,
-                                     rc_loop_row.mate_read_length);
-      m_mate_loop_ptr->set(rc_idx, mate_idx);
-      auto& mate_loop_row = m_mate_loop_table[mate_idx];
+    if ((idx & 0xFFFF) == 0) {
+      progress(idx * 1.0 / m_mate_loop_table.size());
+    }
 
-      uint64_t rc_mate_idx = claim_next(m_mate_loop_ptr->get(mate_idx), MATE_RC,
-                                        mate_loop_row.loop_entry_id, rc_loop_row.mate_read_length);
-      m_mate_loop_ptr->set(mate_idx, rc_mate_idx);
-      // Save loop back to the beginning
-      m_mate_loop_ptr->set(rc_mate_idx, idx);
+    uint64_t rc_idx = claim_next(claimed, m_mate_loop_ptr->get(idx), RC, loop_row.loop_entry_id,
+                                 loop_row.read_length);
+    m_mate_loop_ptr->set(idx, rc_idx);
+    auto& rc_loop_row = m_mate_loop_table[rc_idx];
+
+    if (rc_loop_row.loop_entry_id == k_no_loop_entry) {
+      // No mate for this one; just point back to original.
+      m_mate_loop_ptr->set(rc_idx, idx);
+      continue;
     }
 
-    SPLOG("Mate loop entries complete");
+    uint64_t mate_idx = claim_next(claimed, m_mate_loop_ptr->get(rc_idx), MATE,
+                                   rc_loop_row.loop_entry_id, rc_loop_row.mate_read_length);
+    m_mate_loop_ptr->set(rc_idx, mate_idx);
+    auto& mate_loop_row = m_mate_loop_table[mate_idx];
+
+    uint64_t rc_mate_idx = claim_next(claimed, m_mate_loop_ptr->get(mate_idx), MATE_RC,
+                                      mate_loop_row.loop_entry_id, rc_loop_row.mate_read_length);
+    m_mate_loop_ptr->set(mate_idx, rc_mate_idx);
+    // Save loop back to the beginning
+    m_mate_loop_ptr->set(rc_mate_idx, idx);
+  }
+}
+
+// Every claim is for a group of identical entries, and each claim on
+// a group gets the next unclaimed entry of that group.  So the result
+// only depends on the order that claims arrive at each group.  In the
+// serial version, that's the order of the LOOP_STARTs they came from.
+//
+// Claims happen in three rounds: each LOOP_START claims an RC, then
+// each RC that has a mate claims a MATE, then each MATE claims a
+// MATE_RC.  Within a round, we split the table into partitions that
+// never split a group.  Each source chunk of LOOP_STARTs routes its
+// claims to the partition containing their target, and then each
+// partition resolves its claims in source chunk order.  This keeps
+// the LOOP_START order for every group, so the result is the same as
+// the serial version.
+void make_readmap::link_mate_loops(progress_handler_t progress) {
+  size_t table_size = m_mate_loop_table.size();
+  if (!table_size) {
+    return;
+  }
+  mutable_packed_vector<unsigned, 1> claimed(table_size, "make_readmap:claimed");
+
+  size_t num_parts = std::min<size_t>(std::max<size_t>(get_thread_count() * 4, 1), table_size);
+
+  // Partition boundaries for claim targets.  Groups never span
+  // different entry ids, so only split where the entry id changes.
+  std::vector<size_t> part_starts;
+  part_starts.push_back(0);
+  for (size_t part = 1; part < num_parts; ++part) {
+    size_t part_start = std::max(part_starts.back(), part * table_size / num_parts);
+    while (part_start > 0 && part_start < table_size &&
+           m_mate_loop_table[part_start].entry_id == m_mate_loop_table[part_start - 1].entry_id) {
+      ++part_start;
+    }
+    part_starts.push_back(part_start);
+  }
+  part_starts.push_back(table_size);
+
+  auto source_start = [&](size_t chunk) { return chunk * table_size / num_parts; };
+
+  struct claim {
+    uint64_t claimer;
+    loop_entry_type type;
+    uint64_t entry_id;
+    unsigned read_length;
+  };
+
+  // Returns the claim made in the given round for the LOOP_START at
+  // idx, or false if it doesn't make one.  Claims from earlier rounds
+  // must be complete.
+  auto get_claim = [&](unsigned round, size_t idx, claim* result) -> bool {
+    const auto& loop_row = m_mate_loop_table[idx];
+    if (loop_row.type != LOOP_START) {
+      return false;
+    }
+    if (round == 0) {
+      *result = claim{idx, RC, loop_row.loop_entry_id, loop_row.read_length};
+      return true;
+    }
+    uint64_t rc_idx = m_mate_loop_ptr->get(idx);
+    const auto& rc_loop_row = m_mate_loop_table[rc_idx];
+    if (rc_loop_row.loop_entry_id == k_no_loop_entry) {
+      return false;
+    }
+    if (round == 1) {
+      *result = claim{rc_idx, MATE, rc_loop_row.loop_entry_id, rc_loop_row.mate_read_length};
+      return true;
+    }
+    uint64_t mate_idx = m_mate_loop_ptr->get(rc_idx);
+    *result = claim{mate_idx, MATE_RC, m_mate_loop_table[mate_idx].loop_entry_id,
+                    rc_loop_row.mate_read_length};
+    return true;
+  };
+
+  for (unsigned round = 0; round < 3; ++round) {
+    subprogress round_progress(progress, round / 3.0, (round + 1) / 3.0);
+
+    // Route claims, indexed by [source chunk][target partition].
+    std::vector<std::vector<std::vector<uint64_t>>> routed(num_parts);
+    parallel_for(0, num_parts, [&](size_t chunk) {
+      auto& chunk_routed = routed[chunk];
+      chunk_routed.resize(num_parts);
+      for (size_t idx = source_start(chunk); idx != source_start(chunk + 1); ++idx) {
+        claim c;
+        if (!get_claim(round, idx, &c)) {
+          continue;
+        }
+        uint64_t target = m_mate_loop_ptr->get(c.claimer);
+        size_t part =
+            std::upper_bound(part_starts.begin(), part_starts.end(), target) - part_starts.begin();
+        CHECK_GT(part, 0);
+        chunk_routed[part - 1].push_back(idx);
+      }
+    });
+    round_progress(0.5);
+
+    // Resolve claims for each partition in LOOP_START order.
+    parallel_for(0, num_parts, [&](size_t part) {
+      for (size_t chunk = 0; chunk != num_parts; ++chunk) {
+        for (uint64_t idx : routed[chunk][part]) {
+          claim c;
+          CHECK(get_claim(round, idx, &c));
+          uint64_t claimed_idx = claim_next(claimed, m_mate_loop_ptr->get(c.claimer), c.type,
+                                            c.entry_id, c.read_length);
+          CHECK_LT(claimed_idx, part_starts[part + 1]);
+          m_mate_loop_ptr->set(c.claimer, claimed_idx);
+          if (round == 0 && m_mate_loop_table[claimed_idx].loop_entry_id == k_no_loop_entry) {
+            // No mate for this one; just point back to original.
+            m_mate_loop_ptr->set(claimed_idx, idx);
+          } else if (round == 2) {
+            // Save loop back to the beginning
+            m_mate_loop_ptr->set(claimed_idx, idx);
+          }
+        }
+        routed[chunk][part] = std::vector<uint64_t>();
+      }
+    });
+    round_progress(1);
   }
-  progress(1);
 }
 
 void make_readmap::create_from_migrate(const seqset_file& old_seqset_file,
@@ -456,6 +662,26 @@ void make_readmap::create_from_upgrade(
   }
 }
 
+void make_readmap::create_from_compact(const readmap& old_readmap,
+                                       const spiral_file_create_state& new_readmap,
+                                       progress_handler_t progress) {
+  new_readmap.set_version("readmap", k_compact_readmap_version);
+  new_readmap.create_json<readmap_metadata>("readmap.json", old_readmap.metadata());
+
+  old_readmap.m_sparse_multi->write_compact(new_readmap.create_subpart("read_ids"),
+                                            subprogress(progress, 0, 0.6));
+
+  m_read_lengths = make_unique<mutable_packed_varbit_vector>(
+      new_readmap.create_subpart("read_lengths"), old_readmap.size(), old_readmap.max_read_len());
+  for (size_t read_id = 0; read_id < old_readmap.size(); ++read_id) {
+    m_read_lengths->set(read_id, old_readmap.get_readlength(read_id));
+  }
+  progress(0.8);
+
+  copy_pairing_data(old_readmap, new_readmap);
+  progress(1);
+}
+
 void make_readmap::create_from_fast_migrate(
     const readmap& old_readmap, const seqset_mergemap& mergemap,
     const spiral_file_create_state& new_readmap,
@@ -488,6 +714,11 @@ void make_readmap::create_from_fast_migrate(
 
   m_sparse_multi->finalize();
 
+  copy_pairing_data(old_readmap, new_readmap);
+}
+
+void make_readmap::copy_pairing_data(const readmap& old_readmap,
+                                     const spiral_file_create_state& new_readmap) {
   if (old_readmap.has_pairing_data()) {
     m_pairing_data_present = true;
 
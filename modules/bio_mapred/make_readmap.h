@@ -7,6 +7,7 @@
 #include "modules/bio_base/seqset_mergemap.h"
 #include "modules/bio_base/seqset_bitmap.h"
 #include "modules/bio_base/corrected_read.h"
+#include "modules/bio_base/packed_read_store.h"
 #include "modules/bio_base/readmap.h"
 #include "modules/bio_base/seqset.h"
 
@@ -14,7 +15,9 @@ class make_readmap
 {
 public:
 	// Create a disk file with all the readmap data that can be loaded by
-	// the constructor.
+	// the constructor.  corrected_reads is either a KV manifest of
+	// corrected_reads keyed by read name, or a manifest of packed read
+	// stores with encoding packed_read_store::k_manifest_encoding.
 	static void do_make(
 		const std::string& readmap_file_path
 		, const seqset_file& the_seqset_file
@@ -48,6 +51,13 @@ public:
           lookup_seq,
       progress_handler_t progress = null_progress_handler);
 
+  // Rewrites the readmap, storing the mapping between seqset entries
+  // and read ids using Elias-Fano encoding where that is smaller.
+  // Readmaps written this way can't be opened by versions older than
+  // k_compact_readmap_version.
+  static void compact(const readmap& old_readmap, const std::string& new_readmap_path,
+                      progress_handler_t progress = null_progress_handler);
+
  private:
   // This does mate loops in the same way as "Readmap" does, except
   // that MATE_RC does not point back to LOOP_START.
@@ -116,6 +126,14 @@ public:
     void operator()(const std::string&, const corrected_reads&, size_t file_info_id,
                     size_t record_id);
 
+    // Adds a record with the given reads.  mate_sequence is ignored
+    // unless read_count is 2.  Counts are kept separately for each
+    // count_id, which must not be shared between threads.  read_id is
+    // only used in error messages, and may be empty if the record has
+    // no name.
+    void add_record(const dna_slice& sequence, const dna_slice& mate_sequence, unsigned read_count,
+                    size_t count_id, size_t record_id, const std::string& read_id);
+
     std::pair<uint64_t, uint64_t> get_counts() const;  // Paired first, unpaired second.
 
     void add_read_to_mate_loop_table(
@@ -163,6 +181,9 @@ private:
         const std::function<dna_sequence(uint64_t /* seqset_id */, unsigned)>&
             lookup_seq,
         progress_handler_t progress = null_progress_handler);
+    void create_from_compact(const readmap& old_readmap,
+                             const spiral_file_create_state& new_readmap,
+                             progress_handler_t progress = null_progress_handler);
 
    private:
 	void create_common(const spiral_file_create_state& state,
@@ -170,6 +191,24 @@ private:
                        size_t num_reads, unsigned max_read_len);
 
 	void import_reads_from(manifest corrected_reads_manifest, bool is_paired, progress_handler_t progress = null_progress_handler);
+    // Fills the mate loop table from a manifest of packed read stores.
+    // Returns the number of paired and unpaired entries.
+    std::pair<uint64_t, uint64_t> import_packed_reads(const manifest& corrected_reads_manifest,
+                                                      bool is_paired,
+                                                      progress_handler_t progress);
+
+    // Copies mate pairing information from old_readmap, if present.
+    void copy_pairing_data(const readmap& old_readmap,
+                           const spiral_file_create_state& new_readmap);
+
+    // Links each LOOP_START to its RC, MATE, and MATE_RC, starting
+    // from the first matching entry saved in m_mate_loop_ptr.  Both
+    // versions produce identical results.
+    void link_mate_loops(progress_handler_t progress);
+    void link_mate_loops_serial(progress_handler_t progress);
+    // Given the result from find_first_of, claims the next unclaimed read.
+    uint64_t claim_next(mutable_packed_vector<unsigned, 1>& claimed, uint64_t try_idx,
+                        loop_entry_type type, uint64_t entry_id, unsigned read_length) const;
 
     const seqset_file* m_seqset_file = nullptr;
     const seqset* m_seqset = nullptr;
@@ -184,6 +223,10 @@ private:
 	tracked_vector<mate_loop_table_entry> m_mate_loop_table;
 };
 
+// If true, make_readmap links mate loops using a single thread
+// instead of in parallel.  The results are the same either way.
+extern bool g_make_readmap_serial_linking;
+
 inline bool operator<(const make_readmap::mate_loop_table_entry& lhs,
                       const make_readmap::mate_loop_table_entry& rhs) {
   if (lhs.entry_id != rhs.entry_id) {
@@ -25,3 +25,11 @@ size_t seq_position_sorter::partition(const std::string& key, size_t num_partiti
 	msgpack_deserialize(s1, key);
 	return s1.scaffold_id % num_partitions;
 }
+
+void seq_position_sorter::append_binary_key(std::string& out, const std::string& key) const
+{
+	seq_position s;
+	msgpack_deserialize(s, key);
+	::append_binary_key(out, s.scaffold_id);
+	::append_binary_key(out, s.position);
+}
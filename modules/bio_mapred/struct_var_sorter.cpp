@@ -34,3 +34,10 @@ size_t struct_var_sorter::partition(const std::string& key, size_t num_partition
 	throw io_exception(error_string);
 }
 
+void struct_var_sorter::append_binary_key(std::string& out, const std::string& key) const
+{
+	struct_var_key s;
+	msgpack_deserialize(s, key);
+	::append_binary_key(out, s.variation_id);
+	::append_binary_key(out, s.read_id);
+}
@@ -0,0 +1,143 @@
+#include <signal.h>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "modules/bio_base/biograph_dir.h"
+#include "modules/io/config.h"
+#include "modules/io/log.h"
+#include "modules/io/spiral_file_mmap.h"
+#include "modules/io/version.h"
+
+#include "modules/main/main.h"
+
+static void update_progress(const float& new_progress) {
+  static float prev_progress = 0;
+  if (fabs(new_progress - prev_progress) > 0.0001) {
+    prev_progress = new_progress;
+    print_progress(new_progress);
+  }
+}
+
+class ArchiveBiographMain : public Main {
+ public:
+  ArchiveBiographMain(bool unarchive) : m_unarchive(unarchive) {
+    if (m_unarchive) {
+      m_usage =
+          "%1% version %2%\n\n"
+          "Usage: %1% [OPTIONS] --in <target biograph>\n\n"
+          "Restores a biograph compressed by \"archive\" so it can be memory\n"
+          "mapped again.\n";
+    } else {
+      m_usage =
+          "%1% version %2%\n\n"
+          "Usage: %1% [OPTIONS] --in <target biograph>\n\n"
+          "Compresses the seqset and readmaps of a biograph for cold storage.\n"
+          "Archived biographs can still be opened, but must be decompressed\n"
+          "into memory first.  Use \"unarchive\" to restore the original.\n";
+    }
+  }
+
+ protected:
+  void add_args() override;
+  int run(po::variables_map vars) override;
+  const product_version& get_version() override { return biograph_current_version; }
+
+ private:
+  // Converts the given spiral file in place, if it's not already in
+  // the desired state.
+  void convert(const std::string& description, const std::string& path);
+
+  bool m_unarchive = false;
+  std::string m_bgdir;
+  size_t m_frame_size = 0;
+  int m_compression_level = 0;
+};
+
+// Exits on Control-C.  Files are converted to a temporary path and
+// only renamed over the original once complete, so an interrupted run
+// leaves the biograph usable.
+static void signal_handler(int sig) {
+  // One is enough
+  signal(sig, SIG_IGN);
+  std::cout << "\nControl-C detected.\n";
+  ::exit(1);
+}
+
+void ArchiveBiographMain::add_args() {
+  spiral_file_archive_options defaults;
+  m_general_options.add_options()("in", po::value(&m_bgdir)->required(), "Target biograph");
+  if (!m_unarchive) {
+    m_general_options.add_options()(
+        "frame-size", po::value(&m_frame_size)->default_value(defaults.frame_size),
+        "Size of independently compressed blocks, in bytes")(
+        "compression-level",
+        po::value(&m_compression_level)->default_value(defaults.compression_level),
+        "zlib compression level, 1 (fastest) to 9 (smallest)");
+  }
+  m_options.add(m_general_options);
+
+  m_positional.add("in", 1);
+}
+
+void ArchiveBiographMain::convert(const std::string& description, const std::string& path) {
+  if (spiral_file_is_archived(path) != m_unarchive) {
+    std::cout << "\n" << description << " is already " << (m_unarchive ? "unarchived" : "archived")
+              << std::endl;
+    SPLOG("%s does not need converting", path.c_str());
+    return;
+  }
+
+  std::cout << "\n" << (m_unarchive ? "Unarchiving " : "Archiving ") << description << std::endl;
+  std::string tmp_path = path + ".archive_tmp";
+  if (m_unarchive) {
+    unarchive_spiral_file(path, tmp_path, update_progress);
+  } else {
+    spiral_file_archive_options options;
+    options.frame_size = m_frame_size;
+    options.compression_level = m_compression_level;
+    archive_spiral_file(path, tmp_path, options, update_progress);
+  }
+  SPLOG("Converted %s: %ld bytes to %ld bytes", path.c_str(), fs::file_size(path),
+        fs::file_size(tmp_path));
+  fs::rename(tmp_path, path);
+  print_progress(1.0);
+}
+
+int ArchiveBiographMain::run(po::variables_map vars) {
+  initialize_app("", m_bgdir + "/qc/archive_log.txt");
+
+  // initialize_app() ignores SIGINT, so handle it ourselves.
+  signal(SIGINT, signal_handler);
+
+  if (!m_unarchive && (m_compression_level < 1 || m_compression_level > 9)) {
+    throw std::runtime_error("--compression-level must be between 1 and 9");
+  }
+  if (!m_unarchive && m_frame_size == 0) {
+    throw std::runtime_error("--frame-size must be positive");
+  }
+
+  SPLOG("Opening biograph %s", m_bgdir.c_str());
+  biograph_dir bgdir(m_bgdir, READ_BGDIR);
+  if (!bgdir.is_valid()) {
+    throw io_exception(m_bgdir + " is not a valid biograph");
+  }
+
+  // Readmaps keep their ids so the biograph metadata stays valid.
+  convert("seqset", bgdir.seqset());
+  for (const auto& sample : bgdir.samples()) {
+    convert(sample.first, bgdir.readmap(sample.second));
+  }
+
+  std::cout << "\n" << (m_unarchive ? "Unarchive" : "Archive") << " complete." << std::endl;
+
+  return 0;
+}
+
+std::unique_ptr<Main> archive_main() {
+  return std::unique_ptr<Main>(new ArchiveBiographMain(false /* unarchive */));
+}
+
+std::unique_ptr<Main> unarchive_main() {
+  return std::unique_ptr<Main>(new ArchiveBiographMain(true /* unarchive */));
+}
@@ -14,6 +14,7 @@
 #include "base/base.h"
 #include "modules/bio_base/corrected_read.h"
 #include "modules/bio_base/dna_base_set.h"
+#include "modules/bio_base/packed_read_store.h"
 #include "modules/bio_base/reference.h"
 #include "modules/bio_base/seqset.h"
 #include "modules/bio_base/unaligned_read.h"
@@ -36,6 +37,7 @@
 #include "modules/io/json_transfer.h"
 #include "modules/io/log.h"
 #include "modules/io/runtime_stats.h"
+#include "modules/io/spiral_file_mmap.h"
 #include "modules/io/stopwatch.h"
 #include "modules/io/track_mem.h"
 #include "modules/io/uuid.h"
@@ -780,6 +782,10 @@ int SEQSETMain::run(po::variables_map vars) {
 
   m_stats.start_stage("make_readmap");
   do_readmap(corrected);
+  if (not m_keep_tmp) {
+    SPLOG("Deleting corrected reads");
+    rm_files("corrected_reads_");
+  }
   m_stats.end_stage("make_readmap");
 
   m_stats.start_stage("metadata");
@@ -855,6 +861,9 @@ void SEQSETMain::do_read_correction(std::unique_ptr<kmer_set> ks, const manifest
   size_t corrected_read_count = 0;
   size_t corrected_read_bases = 0;
   std::mutex m_cr_out_mu;
+  // Corrected reads are only needed by make_readmap, so store them in
+  // packed read stores instead of KV files to avoid serializing them.
+  std::vector<file_info> corrected_file_infos(file_infos.size());
   parallel_for(  //
       0, file_infos.size(),
       [&](size_t idx) {
@@ -865,43 +874,52 @@ void SEQSETMain::do_read_correction(std::unique_ptr<kmer_set> ks, const manifest
         read_id key;
         unaligned_reads value;
 
-        manifest local_corrected;
-        output_stream_params cr_osp;
-        cr_osp.encoding = m_tmp_encoding;
-        std::unique_ptr<kv_sink> cr_sink(
-            cr_osp.build(CONF_S(path_bulkdata), "corrected_reads", local_corrected));
+        std::string store_path =
+            printstring("%s/corrected_reads_%06lu.packed", m_tmp_dir.c_str(), idx);
+        size_t local_corrected_records = 0;
         size_t local_corrected_count = 0;
         size_t local_corrected_bases = 0;
-
-        corrected_reads c;
-        while (file_kv_reader.read_msgpack(key, value)) {
-          for (const auto& r : value) {
-            c.emplace_back();
-            if (cr.correct(r, c.back())) {
-              local_corrected_bases += c.back().corrected.size();
-            } else {
-              c.pop_back();
+        {
+          spiral_file_create_mmap store_file(store_path);
+          packed_read_store_builder store(store_file.create(), false /* no quality */);
+
+          corrected_reads c;
+          while (file_kv_reader.read_msgpack(key, value)) {
+            for (const auto& r : value) {
+              c.emplace_back();
+              if (cr.correct(r, c.back())) {
+                local_corrected_bases += c.back().corrected.size();
+              } else {
+                c.pop_back();
+              }
+            }
+            if (!c.empty()) {
+              store.add(c);
+              local_corrected_count += c.size();
+              c.clear();
             }
           }
-          if (!c.empty()) {
-            cr_sink->write_msgpack(key.pair_name, c);
-            local_corrected_count += c.size();
-            c.clear();
-          }
+          store.finalize();
+          local_corrected_records = store.num_records();
         }
-        cr_sink->close();
-        cr_sink.reset();
+        corrected_file_infos[idx] =
+            file_info(path(store_path), fs::file_size(store_path), local_corrected_records);
 
         // Remove uncorrected reads; we don't need them anymore.
         path(fi.file).remove();
 
         std::lock_guard<std::mutex> l(m_cr_out_mu);
-        corrected.add(local_corrected, true);
         corrected_read_count += local_corrected_count;
         corrected_read_bases += local_corrected_bases;
       },
       subprogress(m_update_progress, 0.1, 1));
 
+  // Add in input order so read ids don't depend on thread timing.
+  corrected.set_encoding(packed_read_store::k_manifest_encoding);
+  for (const auto& fi : corrected_file_infos) {
+    corrected.add(fi, 0 /* partition */);
+  }
+
   SPLOG("Generated %ld corrected reads, %ld bases (avg %.2f bases/read)", corrected_read_count,
         corrected_read_bases, corrected_read_bases * 1. / corrected_read_count);
   corrected.metadata().set(meta::ns::readonly, "corrected_read_count", corrected_read_count);
@@ -1,5 +1,6 @@
 #include <signal.h>
 #include <sys/prctl.h>
+#include <unistd.h>
 #include <stdexcept>
 
 #ifdef GPERFTOOLS
@@ -8,6 +9,7 @@
 #endif
 
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
@@ -16,6 +18,7 @@
 
 #include "modules/bio_base/biograph_dir.h"
 #include "modules/bio_base/readmap.h"
+#include "modules/bio_base/region_prefetch.h"
 #include "modules/bio_base/seqset.h"
 #include "modules/bio_format/vcf.h"
 #include "modules/bio_mapred/flatten_seqset.h"
@@ -36,8 +39,10 @@
 #include "modules/variants/add_ref.h"
 #include "modules/variants/align.h"
 #include "modules/variants/assemble.h"
+#include "modules/variants/bgzf_vcf_writer.h"
 #include "modules/variants/calc_coverage.h"
 #include "modules/variants/dedup.h"
+#include "modules/variants/discovery_shard.h"
 #include "modules/variants/genotype.h"
 #include "modules/variants/normalize.h"
 #include "modules/variants/pipeline.h"
@@ -84,6 +89,8 @@ class DiscoveryMain : public Main {
   std::string m_vcf_out_file;
   std::string m_bed_file;
   std::string m_chunk_stats_file;
+  std::string m_shard_str;
+  discovery_shard_spec m_shard;
 
   bool m_force = false;
   bool m_verify_assemble = true;
@@ -94,15 +101,26 @@ class DiscoveryMain : public Main {
   bool m_report_long_traces = false;
   unsigned m_min_pop_overlap;
   std::string m_ref_map_file;
+  bool m_ref_map_in_memory = false;
   unsigned m_min_overlap;
   float m_min_overlap_pct;
   std::mutex m_csv_mu;
   std::mutex m_aligned_csv_mu;
   int m_max_ploids = 2;
+  double m_max_pipeline_mem_gb = 0;
 
   std::map<std::string, std::string> m_vcf_headers;
 
+  struct bed_region {
+    std::string scaffold;
+    size_t start;
+    size_t limit;
+  };
+
   void do_assemble();
+  std::vector<bed_region> read_bed() const;
+  void prefetch_bed_regions(const std::vector<bed_region>& regions, const seqset* ss,
+                            const readmap* rm, const reference& ref);
   void check_for_terminate();
 };
 
@@ -145,7 +163,9 @@ void DiscoveryMain::add_args() {
   m_general_options.add_options()                                                 //
       ("in", po::value(&m_in_biograph)->required(), "Input BioGraph to process")  //
       ("ref", po::value(&m_ref_dir)->required(), "Reference directory")           //
-      ("out", po::value(&m_vcf_out_file)->default_value("-"), "Output VCF file")          //
+      ("out", po::value(&m_vcf_out_file)->default_value("-"),
+       "Output VCF file.  If this ends in .gz, the VCF is sorted, BGZF compressed, and "
+       "indexed.")  //
       ("sample", po::value(&m_readmap_str)->default_value(""),
        "Sample ID (Accession ID, uuid, or coverage file) to process. Only required if the BioGraph "
        "contains multiple samples.")  //
@@ -161,6 +181,10 @@ void DiscoveryMain::add_args() {
        "length (0.5-0.9 recommended)")  //
       ("max-ploids", po::value(&m_max_ploids)->default_value(2),
        "Maximum number of alleles to output")  //
+      ("shard", po::value(&m_shard_str)->default_value(""),
+       "If specified as <index>/<count>, only process shard <index> (starting from 0) of <count> "
+       "balanced parts of the reference.  A shard summary is written next to the output VCF; "
+       "combine the partial VCFs with 'discovery-merge'.")  //
       ;
 
   m_advanced_options.add_options()  //
@@ -169,12 +193,16 @@ void DiscoveryMain::add_args() {
       ("aligned-assemblies-out", po::value(&m_aligned_assembly_out_file)->default_value(""),
        "If specified, aligned assemblies are written to this file in CSV format")  //
       ("ref-map", po::value(&m_ref_map_file)->default_value(""),
-       "If specified, filename to use to store the reference map between runs.  Warning: No "
-       "validity checking is done to make sure this matches the current reference and seqset being "
-       "used.")  //
+       "If specified, filename to use to store the reference map between runs.  By default, the "
+       "reference map is stored in the BioGraph, with a separate map for each reference used.")  //
+      ("ref-map-in-memory", po::bool_switch(&m_ref_map_in_memory)->default_value(false),
+       "Generate the reference map in memory on each run instead of saving it")  //
       ("half-aligned-out", po::value(&m_half_aligned_out_file)->default_value(""),
        "If specified, assemblies which are only aligned on one end are written to this file in CSV "
        "format")  //
+      ("max-pipeline-mem", po::value(&m_max_pipeline_mem_gb)->default_value(0),
+       "If nonzero, maximum GiB of assemblies to buffer between processing steps.  When exceeded, "
+       "no new regions are started until regions in progress finish.")  //
       ;
 
   m_secret_options.add_options()  //
@@ -239,6 +267,21 @@ int DiscoveryMain::run(po::variables_map vars) {
     }
   }
 
+  if (!m_shard_str.empty()) {
+    m_shard = discovery_shard_spec::parse(m_shard_str);
+    if (m_vcf_out_file == "-") {
+      throw std::runtime_error("--out must be specified when using --shard");
+    }
+    std::string summary_file = discovery_shard_summary::path_for_vcf(m_vcf_out_file);
+    if (fs::exists(summary_file)) {
+      fs::remove(summary_file);
+    }
+    if (m_stats_file.empty()) {
+      m_stats_file = m_in_biograph + "/qc/variants_stats_shard_" + std::to_string(m_shard.index) +
+                     "_of_" + std::to_string(m_shard.count) + ".json";
+    }
+  }
+
   if (m_stats_file.empty()) {
     m_stats_file = m_in_biograph + "/qc/variants_stats.json";
   }
@@ -248,7 +291,10 @@ int DiscoveryMain::run(po::variables_map vars) {
     std::cerr << "WARNING: " << m_min_overlap_pct << " is outside of suggested range (0.5, 0.9)\n";
   }
 
-  initialize_app(m_ref_dir, m_in_biograph + "/qc/variants_log.txt");
+  initialize_app(m_ref_dir, m_in_biograph + (m_shard.sharded()
+                                                 ? "/qc/variants_log_shard_" +
+                                                       std::to_string(m_shard.index) + ".txt"
+                                                 : "/qc/variants_log.txt"));
   if (m_ref_dir.empty() or not defaults.check_refdir(m_ref_dir)) {
     throw std::runtime_error("Please check your reference directory.");
   }
@@ -272,6 +318,9 @@ int DiscoveryMain::run(po::variables_map vars) {
   m_stats.add("version", biograph_current_version.make_string());
   m_stats.add("accession_id", m_readmap_str);
   m_stats.add("reference", m_ref_dir);
+  if (m_shard.sharded()) {
+    m_stats.add("shard", m_shard.to_string());
+  }
 
   m_stats.save();
 
@@ -280,6 +329,71 @@ int DiscoveryMain::run(po::variables_map vars) {
   return 0;
 }
 
+std::vector<DiscoveryMain::bed_region> DiscoveryMain::read_bed() const {
+  file_reader bed(m_bed_file);
+  std::string line;
+
+  std::vector<bed_region> regions;
+  while (bed.readline(line, 1000)) {
+    std::vector<std::string> fields;
+    boost::split(fields, line, boost::is_any_of(" \t"), boost::token_compress_on);
+    CHECK_GE(fields.size(), 3) << "bad BED line: '" << line << "'";
+
+    bed_region region;
+    region.scaffold = fields[0];
+    region.start = atol(fields[1].c_str());
+    region.limit = atol(fields[2].c_str());
+    regions.push_back(region);
+  }
+  return regions;
+}
+
+void DiscoveryMain::prefetch_bed_regions(const std::vector<bed_region>& regions,
+                                         const seqset* ss, const readmap* rm,
+                                         const reference& ref) {
+  // Assemblies can extend past the ends of the regions, so include
+  // some flanking sequence.
+  constexpr size_t k_flank = 1000;
+
+  region_prefetch prefetch(ss, rm);
+  const auto& supercontigs = ref.get_assembly().supercontigs;
+  for (const bed_region& region : regions) {
+    size_t start = region.start > k_flank ? region.start - k_flank : 0;
+    size_t limit = region.limit + k_flank;
+    for (const supercontig& sc : supercontigs) {
+      if (sc.scaffold_name != region.scaffold) {
+        continue;
+      }
+      size_t overlap_start = std::max(start, sc.offset);
+      size_t overlap_limit = std::min(limit, sc.offset + sc.len);
+      if (overlap_start >= overlap_limit) {
+        continue;
+      }
+      prefetch.add_sequence(dna_slice(ref.get_dna(sc.tot_offset + overlap_start - sc.offset),
+                                      overlap_limit - overlap_start));
+    }
+  }
+
+  // The saved reference map is looked up by seqset entry too.  An
+  // archived map is already decoded into memory when it's opened, so
+  // only read ahead in a mapped one.
+  spiral_file_open_mmap ref_map_file(m_ref_map_file);
+  spiral_file_open_state ref_map_state = ref_map_file.open();
+  if (!ref_map_file.is_archived()) {
+    prefetch.add_entry_part([&ref_map_state](uint64_t first_entry, uint64_t limit_entry) {
+      return ref_map::open_entry_range(ref_map_state, first_entry, limit_entry);
+    });
+  }
+
+  prefetch_stats stats = prefetch.run(update_progress);
+  js::Object report;
+  report.push_back(js::Pair("ranges", uint64_t(stats.ranges)));
+  report.push_back(js::Pair("pages", uint64_t(stats.pages)));
+  report.push_back(js::Pair("resident_pages", uint64_t(stats.resident_pages)));
+  report.push_back(js::Pair("hit_rate", stats.hit_rate()));
+  m_stats.add("prefetch", report);
+}
+
 void DiscoveryMain::warn_memory_cache(const std::string& item) const {
   SPLOG("WARNING: %s doesn't seem to be cached in RAM!", item.c_str());
   std::cerr << "WARNING: random access to " << item << " seems slow even after caching it in RAM. "
@@ -514,18 +628,33 @@ std::mutex variant_stats_counter::g_mu;
 
 class vcf_pipeline : public scaffold_pipeline_interface {
  public:
+  // Writes records to "sink" in the order they're generated.
   vcf_pipeline(writable* sink) : m_sink(sink) {}
+  // Writes records in sorted order through "sorted".
+  vcf_pipeline(scaffold_sorted_vcf_output* sorted) : m_sorted(sorted) {}
+
+  size_t records() const { return m_records; }
 
   std::unique_ptr<pipeline_interface> pipeline_for_scaffold(
       const assemble_options& options, const std::string& scaffold_name) override {
     CHECK(options.scaffold);
     CHECK(!options.scaffold_name.empty());
-    auto vcf =
-        make_unique<ploidless_vcf_export>(options, scaffold_name, [&](const std::string line) {
-          static std::mutex mu;
-          std::lock_guard<std::mutex> l(mu);
-          m_sink->write(line.data(), line.size());
-        });
+    std::function<void(const std::string&)> output_f;
+    if (m_sorted) {
+      std::shared_ptr<scaffold_sorted_vcf_output::source> source = m_sorted->open(scaffold_name);
+      output_f = [this, source](const std::string& line) {
+        source->add_record(line);
+        ++m_records;
+      };
+    } else {
+      output_f = [this](const std::string& line) {
+        static std::mutex mu;
+        std::lock_guard<std::mutex> l(mu);
+        m_sink->write(line.data(), line.size());
+        ++m_records;
+      };
+    }
+    auto vcf = make_unique<ploidless_vcf_export>(options, scaffold_name, output_f);
     std::unique_ptr<assemble_pipeline> p = make_unique<assemble_pipeline>(options, std::move(vcf));
     p->add_standard_variants_pipeline();
     p->add_step<variant_stats_counter>(options);
@@ -535,6 +664,8 @@ class vcf_pipeline : public scaffold_pipeline_interface {
 
  private:
   writable* m_sink = nullptr;
+  scaffold_sorted_vcf_output* m_sorted = nullptr;
+  std::atomic<size_t> m_records{0};
 };
 
 void DiscoveryMain::write_csv_assembly_header(writable* out) const {
@@ -609,13 +740,42 @@ void DiscoveryMain::do_assemble() {
   m_stats.add("uuid", ss->uuid());
   check_for_terminate();
 
-  SPLOG("Caching seqset into RAM");
-  std::cerr << "\nLoading biograph\n";
+  std::vector<bed_region> bed_regions;
+  if (!m_bed_file.empty()) {
+    bed_regions = read_bed();
+  }
+
+  SPLOG("Opening reference");
+  reference ref("");
+  check_for_terminate();
+
+  if (m_ref_map_file.empty() && !m_ref_map_in_memory) {
+    std::string ref_map_path =
+        biograph_dir(m_in_biograph, READ_BGDIR).ref_map(ref_map::reference_checksum(&ref));
+    if (fs::exists(ref_map_path) || access(m_in_biograph.c_str(), W_OK) == 0) {
+      m_ref_map_file = ref_map_path;
+    } else {
+      SPLOG("Unable to save reference map in read-only BioGraph %s", m_in_biograph.c_str());
+    }
+  }
+
+  // If the reference map is already built, calling a few regions only
+  // touches the parts of the BioGraph near those regions, so prefetch
+  // just those instead of caching the whole seqset.
+  bool prefetch_regions = !bed_regions.empty() && !m_cache_all && !m_ref_map_file.empty() &&
+                          fs::exists(m_ref_map_file);
 
   auto membufs = ss->membufs();
-  membufs.cache_in_memory(subprogress(update_progress, 0, 1));
-  if (!membufs.is_cached_in_memory()) {
-    warn_memory_cache("seqset");
+  if (prefetch_regions) {
+    SPLOG("Prefetching regions in BED file instead of caching seqset into RAM");
+  } else {
+    SPLOG("Caching seqset into RAM");
+    std::cerr << "\nLoading biograph\n";
+
+    membufs.cache_in_memory(subprogress(update_progress, 0, 1));
+    if (!membufs.is_cached_in_memory()) {
+      warn_memory_cache("seqset");
+    }
   }
   m_stats.end_stage("load_seqset");
   check_for_terminate();
@@ -629,11 +789,7 @@ void DiscoveryMain::do_assemble() {
   check_for_terminate();
   rm.calc_read_len_limits_if_needed();
 
-  SPLOG("Opening reference");
-  reference ref("");
-  check_for_terminate();
-
-  boost::optional<ref_map> rmap;
+  std::unique_ptr<ref_map> rmap;
 
   if (m_verify_assemble) {
     assemble_pipeline_interface::global_set_verify_order(true);
@@ -643,31 +799,22 @@ void DiscoveryMain::do_assemble() {
   if (m_ref_map_file.empty()) {
     SPLOG("Generating refmap in memory");
     std::cerr << "\nGenerating refmap\n";
-    rmap.emplace(ss.get(), &ref);
+    rmap = make_unique<ref_map>(ss.get(), &ref);
     rmap->build(update_progress);
   } else {
-    if (!boost::filesystem::exists(m_ref_map_file)) {
-      std::string new_refmap = m_ref_map_file + ".new";
-      unlink(new_refmap.c_str());
-      {
-        spiral_file_create_mmap c(new_refmap);
-        SPLOG("Generating refmap in %s", new_refmap.c_str());
-        std::cerr << "\nGenerating refmap\n";
-        ref_map build_rmap(ss.get(), &ref, c.create());
-        build_rmap.build(update_progress);
-      }
-      rename(new_refmap.c_str(), m_ref_map_file.c_str());
-    }
-
-    SPLOG("Opening refmap %s", m_ref_map_file.c_str());
-    std::cerr << "\nOpening refmap\n";
-    spiral_file_open_mmap o(m_ref_map_file, sfopts);
-    rmap.emplace(ss.get(), &ref, o.open());
+    std::cerr << (fs::exists(m_ref_map_file) ? "\nOpening refmap\n" : "\nGenerating refmap\n");
+    rmap = ref_map::open_or_build(ss.get(), &ref, m_ref_map_file, sfopts, update_progress);
   }
   m_stats.end_stage("generate_refmap");
   check_for_terminate();
 
-  if (!membufs.is_cached_in_memory()) {
+  if (prefetch_regions) {
+    m_stats.start_stage("prefetch_regions");
+    std::cerr << "\nPrefetching regions in BED file\n";
+    prefetch_bed_regions(bed_regions, ss.get(), &rm, ref);
+    m_stats.end_stage("prefetch_regions");
+    check_for_terminate();
+  } else if (!membufs.is_cached_in_memory()) {
     warn_memory_cache("seqset");
   }
 
@@ -680,7 +827,7 @@ void DiscoveryMain::do_assemble() {
   options.seqset = ss.get();
   options.readmap = &rm;
   options.ref = &ref;
-  options.rmap = &rmap.get();
+  options.rmap = rmap.get();
   options.output_assembly_ids = !m_assembly_out_file.empty();
   options.pop_trace_anchor_drop = m_enable_pop_tracer;
   options.output_ml_features = true;
@@ -688,6 +835,7 @@ void DiscoveryMain::do_assemble() {
   options.use_bidir_tracer = m_use_bidir_tracer;
   options.rvg_exclude = m_rvg_exclude;
   options.simple_genotype_filter = m_simple_gt;
+  options.max_pipeline_mem_bytes = m_max_pipeline_mem_gb * 1024 * 1024 * 1024;
   if (m_use_bidir_tracer) {
     options.scaffold_split_size = 400 * 1000;
   }
@@ -790,17 +938,29 @@ void DiscoveryMain::do_assemble() {
     options.report_discovered_assemblies_func = add_ml_features;
   }
 
+  auto header = ploidless_vcf_export::header(options, m_vcf_headers, m_readmap_str);
   std::unique_ptr<file_writer> vcf_out;
-  if (m_vcf_out_file == "-")
-  {
-  	vcf_out = make_unique<file_writer>("/dev/stdout");
+  std::unique_ptr<bgzf_vcf_writer> bgzf_vcf_out;
+  std::unique_ptr<scaffold_sorted_vcf_output> sorted_vcf_out;
+  std::unique_ptr<vcf_pipeline> p;
+  if (boost::algorithm::ends_with(m_vcf_out_file, ".gz")) {
+    // Compressed output is sorted and indexed.
+    bgzf_vcf_out = make_unique<bgzf_vcf_writer>(m_vcf_out_file, header);
+    sorted_vcf_out = make_unique<scaffold_sorted_vcf_output>(bgzf_vcf_out.get());
+    p = make_unique<vcf_pipeline>(sorted_vcf_out.get());
   } else {
-  	vcf_out = make_unique<file_writer>(m_vcf_out_file);
+    if (m_vcf_out_file == "-") {
+      vcf_out = make_unique<file_writer>("/dev/stdout");
+    } else {
+      vcf_out = make_unique<file_writer>(m_vcf_out_file);
+    }
+    vcf_out->write(header.data(), header.size());
+    p = make_unique<vcf_pipeline>(vcf_out.get());
   }
-  auto header = ploidless_vcf_export::header(options, m_vcf_headers, m_readmap_str);
-  vcf_out->write(header.data(), header.size());
-  auto p = make_unique<vcf_pipeline>(vcf_out.get());
 
+  if (m_shard.sharded()) {
+    set_assembly_id_shard(m_shard.index, m_shard.count);
+  }
   trace_ref t(options, p.get());
 #ifdef GPERFTOOLS
   ProfilerStart("/scratch/biograph_variants.prof");
@@ -814,22 +974,24 @@ void DiscoveryMain::do_assemble() {
     std::cerr << "\nAssembling extents in BED file: " << m_bed_file << "\n";
     SPLOG("Assembling extents in BED file %s", m_bed_file.c_str());
 
-    file_reader bed(m_bed_file);
-    std::string line;
-
-    std::vector<std::string> bed_lines;
-    while (bed.readline(line, 1000)) {
-      std::vector<std::string> fields;
-      boost::split(fields, line, boost::is_any_of(" \t"), boost::token_compress_on);
-      CHECK_GE(fields.size(), 3) << "bad BED line: '" << line << "'";
-
-      std::string scaffold = fields[0];
-      size_t start = atol(fields[1].c_str());
-      size_t limit = atol(fields[2].c_str());
-
-      t.add_scaffold_range(scaffold, start, limit);
+    for (const bed_region& region : bed_regions) {
+      t.add_scaffold_range(region.scaffold, region.start, region.limit);
     }
   }
+
+  discovery_shard_summary shard_summary;
+  if (m_shard.sharded()) {
+    t.select_shard(m_shard.index, m_shard.count);
+    shard_summary.shard_index = m_shard.index;
+    shard_summary.shard_count = m_shard.count;
+    shard_summary.work = t.work_descriptions();
+    shard_summary.bases = t.work_bases();
+    std::cerr << "\nProcessing shard " << m_shard.to_string() << ": "
+              << shard_summary.work.size() << " regions, " << shard_summary.bases << " bases\n";
+    SPLOG("Processing shard %s: %lu regions, %lu bases", m_shard.to_string().c_str(),
+          shard_summary.work.size(), shard_summary.bases);
+  }
+
   std::cerr << "\nAssembling...\n";
   m_stats.start_stage("assemble");
   auto st = t.assemble(update_progress);
@@ -852,6 +1014,24 @@ void DiscoveryMain::do_assemble() {
 
   m_stats.add("calls", report);
 
+  if (bgzf_vcf_out) {
+    sorted_vcf_out->close();
+    bgzf_vcf_out->close();
+    std::cerr << "\n" << bgzf_vcf_out->index_path() << " created.\n";
+  }
+
+  if (m_shard.sharded()) {
+    // The pipelines have all been flushed by now, so the partial VCF is
+    // complete once it's closed.
+    if (vcf_out) {
+      vcf_out->close();
+    }
+    shard_summary.records = p->records();
+    shard_summary.calls = vstats.value_map();
+    shard_summary.complete = true;
+    shard_summary.save(m_vcf_out_file);
+  }
+
 #ifdef GPERFTOOLS
   ProfilerStop();
 // HeapProfilerStop();
@@ -864,6 +1044,86 @@ void DiscoveryMain::do_assemble() {
 
 std::unique_ptr<Main> discovery_main() { return std::unique_ptr<Main>(new DiscoveryMain); }
 
+class DiscoveryMergeMain : public Main {
+ public:
+  DiscoveryMergeMain() {
+    m_usage =
+        "%1% version %2%\n\n"
+        "Usage: %1% [OPTIONS] --out <vcf name> <partial vcf> [<partial vcf> ...]\n\n"
+        "Combine the partial VCFs from all shards of a 'discovery --shard' run.\n";
+  }
+
+ protected:
+  void add_args() override;
+  int run(po::variables_map vars) override;
+  const product_version& get_version() override { return biograph_current_version; }
+
+ private:
+  std::vector<std::string> m_in_files;
+  std::string m_vcf_out_file;
+  bool m_force = false;
+};
+
+void DiscoveryMergeMain::add_args() {
+  m_general_options.add_options()                                                           //
+      ("in", po::value(&m_in_files)->required()->multitoken(), "Partial VCFs to combine")  //
+      ("out", po::value(&m_vcf_out_file)->default_value("-"),
+       "Output VCF file.  If this ends in .gz, the VCF is BGZF compressed and indexed.")  //
+      ("force,f", po::bool_switch(&m_force)->default_value(false),
+       "Overwrite existing output file")  //
+      ;
+  m_options.add(m_general_options);
+
+  m_positional.add("in", -1);
+}
+
+int DiscoveryMergeMain::run(po::variables_map vars) {
+  initialize_app("");
+
+  if (fs::exists(m_vcf_out_file) && m_vcf_out_file != "-") {
+    if (m_force) {
+      fs::remove(m_vcf_out_file);
+    } else {
+      std::cerr << "Refusing to overwrite '" << m_vcf_out_file << "'. Use -f to override.\n";
+      exit(1);
+    }
+  }
+
+  discovery_shard_summary merged;
+  if (boost::algorithm::ends_with(m_vcf_out_file, ".gz")) {
+    merged = merge_discovery_shards_bgzf(m_in_files, m_vcf_out_file);
+  } else {
+    std::string out_file = m_vcf_out_file == "-" ? "/dev/stdout" : m_vcf_out_file + ".new";
+    {
+      file_writer vcf_out(out_file);
+      merged = merge_discovery_shards(m_in_files, &vcf_out);
+      vcf_out.close();
+    }
+    if (m_vcf_out_file != "-") {
+      fs::rename(out_file, m_vcf_out_file);
+    }
+  }
+
+  js::Object report;
+  for (const auto& stat : merged.calls) {
+    report.push_back(js::Pair(stat.first, uint64_t(stat.second)));
+  }
+  m_stats.add("command", "discovery-merge");
+  m_stats.add("version", biograph_current_version.make_string());
+  m_stats.add("shards", uint64_t(merged.shard_count));
+  m_stats.add("records", uint64_t(merged.records));
+  m_stats.add("calls", report);
+  m_stats.save();
+
+  std::cerr << "\n" << m_vcf_out_file << " created from " << merged.shard_count << " shards.\n";
+
+  return 0;
+}
+
+std::unique_ptr<Main> discovery_merge_main() {
+  return std::unique_ptr<Main>(new DiscoveryMergeMain);
+}
+
 
 class AssembleMain : public Main {
  public:
@@ -0,0 +1,151 @@
+#include <boost/filesystem.hpp>
+
+#include "modules/bio_base/biograph_dir.h"
+#include "modules/bio_base/readmap.h"
+#include "modules/bio_base/seqset.h"
+#include "modules/bio_base/unitig_assemble.h"
+#include "modules/io/file_io.h"
+#include "modules/io/log.h"
+#include "modules/io/utils.h"
+#include "modules/io/version.h"
+#include "modules/main/main.h"
+
+namespace fs = boost::filesystem;
+
+class DenovoAssembleMain : public Main {
+ public:
+  DenovoAssembleMain() {
+    m_usage =
+        "%1% version %2%\n\n"
+        "Usage: %1% [OPTIONS] --in <biograph> --out <output prefix>\n\n"
+        "Assemble all reads in a BioGraph into unitigs without using reference.  Writes the "
+        "unitigs as <output prefix>.fa, and the assembly graph as <output prefix>.gfa.\n";
+  }
+
+ protected:
+  void add_args() override;
+  int run(po::variables_map vars) override;
+  const product_version& get_version() override { return biograph_current_version; }
+
+ private:
+  std::string m_in_biograph;
+  std::string m_sample;
+  std::string m_out_prefix;
+  bool m_force = false;
+  unitig_assemble_options m_unitig_options;
+};
+
+void DenovoAssembleMain::add_args() {
+  m_general_options.add_options()                                                 //
+      ("in,b", po::value(&m_in_biograph)->required(), "Input BioGraph to process")  //
+      ("out,o", po::value(&m_out_prefix)->default_value("unitigs"),
+       "Output file prefix")  //
+      ("sample", po::value(&m_sample)->default_value(""),
+       "Sample to assemble.  Only required if the BioGraph contains multiple samples.")  //
+      ("force,f", po::bool_switch(&m_force)->default_value(false),
+       "Overwrite existing output files")  //
+      ;
+
+  m_advanced_options.add_options()  //
+      ("min-overlap",
+       po::value(&m_unitig_options.min_overlap)->default_value(m_unitig_options.min_overlap),
+       "Minimum number of bases reads must overlap to be assembled together")  //
+      ("max-overlaps",
+       po::value(&m_unitig_options.max_overlaps)->default_value(m_unitig_options.max_overlaps),
+       "Reads overlapping more than this many other reads on one side end unitigs")  //
+      ("min-unitig-len",
+       po::value(&m_unitig_options.min_unitig_len)
+           ->default_value(m_unitig_options.min_unitig_len),
+       "Minimum length of unitigs to output")  //
+      ;
+
+  m_positional.add("in", 1);
+  m_positional.add("out", 1);
+
+  m_options.add(m_general_options).add(m_advanced_options);
+}
+
+int DenovoAssembleMain::run(po::variables_map vars) {
+  std::string fasta_path = m_out_prefix + ".fa";
+  std::string gfa_path = m_out_prefix + ".gfa";
+  for (const std::string& path : {fasta_path, gfa_path}) {
+    if (fs::exists(path)) {
+      if (m_force) {
+        fs::remove(path);
+      } else {
+        std::cerr << "Refusing to overwrite '" << path << "'. Use -f to override.\n";
+        exit(1);
+      }
+    }
+  }
+
+  if (m_stats_file.empty()) {
+    m_stats_file = m_in_biograph + "/qc/denovo_assemble_stats.json";
+  }
+
+  initialize_app("", m_in_biograph + "/qc/denovo_assemble_log.txt");
+
+  biograph_dir bgdir(m_in_biograph, READ_BGDIR);
+  std::string seqset_path = bgdir.seqset();
+  std::string readmap_path = bgdir.find_readmap(m_sample);
+  m_sample = bgdir.find_readmap_accession(m_sample);
+
+  m_stats.start_stage("load_biograph");
+  SPLOG("Loading seqset: %s", seqset_path.c_str());
+  spiral_file_options sfopts;
+  sfopts.read_into_ram = m_cache_all;
+  auto ss = std::make_shared<seqset>(seqset_path, sfopts);
+  ss->init_shared_lt_search();
+
+  SPLOG("Loading readmap: %s", readmap_path.c_str());
+  readmap rm(ss, readmap_path, sfopts);
+  m_stats.end_stage("load_biograph");
+
+  unitig_assembler assembler(&rm, m_unitig_options);
+  auto progress = [](double p) { print_progress(p); };
+
+  m_stats.start_stage("assemble");
+  std::cerr << "\nAssembling unitigs\n";
+  assembler.assemble(progress);
+  m_stats.end_stage("assemble");
+  SPLOG("Assembled %ld unitigs", assembler.unitigs().size());
+
+  m_stats.start_stage("link");
+  std::cerr << "\nLinking unitigs\n";
+  std::vector<unitig_link> links = assembler.find_links(progress);
+  m_stats.end_stage("link");
+
+  m_stats.start_stage("write");
+  {
+    file_writer fasta(fasta_path);
+    write_unitigs_fasta(fasta, assembler.unitigs());
+    fasta.close();
+  }
+  {
+    file_writer gfa(gfa_path);
+    write_unitigs_gfa(gfa, assembler.unitigs(), links);
+    gfa.close();
+  }
+  m_stats.end_stage("write");
+
+  size_t total_bases = 0;
+  for (const unitig& u : assembler.unitigs()) {
+    total_bases += u.seq.size();
+  }
+
+  m_stats.add("command", "denovo-assemble");
+  m_stats.add("version", biograph_current_version.make_string());
+  m_stats.add("accession_id", m_sample);
+  m_stats.add("unitigs", uint64_t(assembler.unitigs().size()));
+  m_stats.add("unitig_bases", uint64_t(total_bases));
+  m_stats.add("links", uint64_t(links.size()));
+  m_stats.save();
+
+  std::cerr << "\n" << fasta_path << " and " << gfa_path << " created.\n";
+
+  return 0;
+}
+
+std::unique_ptr<Main> denovo_assemble_main() {
+  return std::unique_ptr<Main>(new DenovoAssembleMain);
+}
@@ -0,0 +1,327 @@
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem.hpp>
+
+#include "modules/bio_base/biograph_dir.h"
+#include "modules/bio_base/readmap.h"
+#include "modules/bio_base/seqset.h"
+#include "modules/io/defaults.h"
+#include "modules/io/file_io.h"
+#include "modules/io/log.h"
+#include "modules/io/parallel.h"
+#include "modules/io/utils.h"
+#include "modules/io/version.h"
+#include "modules/main/main.h"
+#include "modules/variants/export_aligned.h"
+#include "modules/variants/trace_ref.h"
+#include "tools/build_stamp.h"
+
+namespace fs = boost::filesystem;
+using namespace variants;
+
+namespace {
+
+// Number of microcontigs to export before writing their output.
+constexpr size_t k_microcontig_batch_size = 1024;
+
+}  // namespace
+
+class ExportAlignedMain : public Main {
+ public:
+  ExportAlignedMain() {
+    m_usage =
+        "%1% version %2%\n\n"
+        "Usage: %1% [OPTIONS] --in <biograph> --variants <vcf.gz> --ref <reference path> "
+        "--out <bam name>\n\n"
+        "Export the reads supporting the variants in a VCF, aligned against reference, as a "
+        "coordinate-sorted and indexed BAM.\n";
+  }
+
+ protected:
+  void add_args() override;
+  int run(po::variables_map vars) override;
+  const product_version& get_version() override { return biograph_current_version; }
+
+ private:
+  std::vector<vcf_region> read_bed() const;
+  std::vector<vcf_region> find_all_microcontigs(const std::vector<vcf_region>& regions);
+  void export_all(const std::vector<vcf_region>& microcontigs,
+                  const aligned_read_exporter& exporter, const reference* ref,
+                  sorted_bam_merger* out);
+
+  std::string m_in_biograph;
+  std::string m_variants_file;
+  std::string m_ref_dir;
+  std::string m_bed_file;
+  std::string m_sample;
+  std::string m_out_file;
+  bool m_force = false;
+  aoffset_t m_min_clearance = 2000;
+  aoffset_t m_min_contig_size = 3000;
+  export_aligned_options m_ea_options;
+
+  std::map<std::string, int32_t> m_tids;
+  size_t m_records = 0;
+};
+
+void ExportAlignedMain::add_args() {
+  m_general_options.add_options()                                                 //
+      ("in,b", po::value(&m_in_biograph)->required(), "Input BioGraph to process")  //
+      ("variants", po::value(&m_variants_file)->required(),
+       "VCF of variants to export reads for.  Must be BGZF compressed with a tabix index.")  //
+      ("ref", po::value(&m_ref_dir)->required(), "Reference directory")              //
+      ("out,o", po::value(&m_out_file)->default_value("output.bam"), "Output BAM file")  //
+      ("sample", po::value(&m_sample)->default_value(""),
+       "Sample to export.  Only required if the BioGraph contains multiple samples.")  //
+      ("force,f", po::bool_switch(&m_force)->default_value(false),
+       "Overwrite existing output file")  //
+      ;
+
+  m_variant_options.add_options()  //
+      ("bed,regions", po::value(&m_bed_file)->default_value(""),
+       "If specified, only export reads for variants in the regions contained in the given BED "
+       "file.")  //
+      ("skipref-on-insert", po::bool_switch(&m_ea_options.refskip_anchor)->default_value(false),
+       "Add a '1N' cigar operation before reads starting inside insertions.  This helps some "
+       "alignment viewers display the insertions properly.")  //
+      ("min-insert", po::value(&m_ea_options.min_insert)->default_value(0),
+       "Minimum insert size.  If specified with --max-insert, only export pairs.")  //
+      ("max-insert", po::value(&m_ea_options.max_insert)->default_value(0),
+       "Maximum insert size.  If specified with --min-insert, only export pairs.")  //
+      ("ideal-insert", po::value(&m_ea_options.ideal_insert)->default_value(0),
+       "If nonzero, only export each pair once, at the closest insert size to this.")  //
+      ;
+
+  m_advanced_options.add_options()  //
+      ("min-clearance", po::value(&m_min_clearance)->default_value(m_min_clearance),
+       "Minimum distance between variants to split them into separate microcontigs")  //
+      ("min-contig-size", po::value(&m_min_contig_size)->default_value(m_min_contig_size),
+       "Minimum size of a microcontig before it can be split from the next")  //
+      ("max-reads-per-entry",
+       po::value(&m_ea_options.max_reads_per_entry)->default_value(0),
+       "If nonzero, maximum number of reads each seqset entry can supply for read coverage")  //
+      ("max-read-cov-paths",
+       po::value(&m_ea_options.max_coverage_paths)
+           ->default_value(m_ea_options.max_coverage_paths),
+       "Maximum number of paths to trace when calculating read coverage")  //
+      ("max-paths",
+       po::value(&m_ea_options.max_alleles)->default_value(m_ea_options.max_alleles),
+       "If nonzero, limit number of paths through VCF entries to the given value")  //
+      ;
+
+  m_positional.add("in", 1);
+  m_positional.add("variants", 1);
+  m_positional.add("ref", 1);
+  m_positional.add("out", 1);
+
+  m_options.add(m_general_options).add(m_variant_options).add(m_advanced_options);
+}
+
+std::vector<vcf_region> ExportAlignedMain::read_bed() const {
+  file_reader bed(m_bed_file);
+  std::string line;
+
+  std::vector<vcf_region> regions;
+  while (bed.readline(line, 1000)) {
+    std::vector<std::string> fields;
+    boost::split(fields, line, boost::is_any_of(" \t"), boost::token_compress_on);
+    CHECK_GE(fields.size(), 3) << "bad BED line: '" << line << "'";
+
+    vcf_region region;
+    region.scaffold_name = fields[0];
+    region.start = atol(fields[1].c_str());
+    region.limit = atol(fields[2].c_str());
+    regions.push_back(region);
+  }
+  return regions;
+}
+
+std::vector<vcf_region> ExportAlignedMain::find_all_microcontigs(
+    const std::vector<vcf_region>& regions) {
+  std::vector<std::vector<vcf_region>> per_region(regions.size());
+  parallel_for(0, regions.size(), [&](size_t start, size_t limit) {
+    tabix_vcf_reader reader(m_variants_file);
+    for (size_t i = start; i != limit; ++i) {
+      per_region[i] = find_microcontigs(&reader, regions[i], m_min_clearance, m_min_contig_size);
+    }
+  });
+
+  std::vector<vcf_region> microcontigs;
+  for (auto& mcs : per_region) {
+    microcontigs.insert(microcontigs.end(), mcs.begin(), mcs.end());
+  }
+
+  // Output is sorted by reference order, so process microcontigs in
+  // that order.
+  std::stable_sort(microcontigs.begin(), microcontigs.end(),
+                   [this](const vcf_region& a, const vcf_region& b) {
+                     int32_t a_tid = m_tids.at(a.scaffold_name);
+                     int32_t b_tid = m_tids.at(b.scaffold_name);
+                     if (a_tid != b_tid) {
+                       return a_tid < b_tid;
+                     }
+                     return a.start < b.start;
+                   });
+  return microcontigs;
+}
+
+void ExportAlignedMain::export_all(const std::vector<vcf_region>& microcontigs,
+                                   const aligned_read_exporter& exporter, const reference* ref,
+                                   sorted_bam_merger* out) {
+  for (size_t batch_start = 0; batch_start < microcontigs.size();
+       batch_start += k_microcontig_batch_size) {
+    size_t batch_limit = std::min(batch_start + k_microcontig_batch_size, microcontigs.size());
+    std::vector<bam_record_batch> results(batch_limit - batch_start);
+    parallel_for(batch_start, batch_limit, [&](size_t start, size_t limit) {
+      tabix_vcf_reader reader(m_variants_file);
+      std::string cur_scaffold_name;
+      variants::scaffold cur_scaffold;
+      for (size_t i = start; i != limit; ++i) {
+        const vcf_region& mc = microcontigs[i];
+        if (mc.scaffold_name != cur_scaffold_name) {
+          cur_scaffold = trace_ref::ref_to_scaffold(ref, mc.scaffold_name);
+          cur_scaffold_name = mc.scaffold_name;
+        }
+        results[i - batch_start] =
+            exporter.export_region(cur_scaffold, m_tids.at(mc.scaffold_name), mc,
+                                   reader.query(mc.scaffold_name, mc.start, mc.limit));
+      }
+    });
+
+    for (size_t i = batch_start; i != batch_limit; ++i) {
+      m_records += results[i - batch_start].records.size();
+      if (i + 1 < microcontigs.size()) {
+        const vcf_region& next = microcontigs[i + 1];
+        out->add(std::move(results[i - batch_start]), m_tids.at(next.scaffold_name),
+                 exporter.min_read_pos(next));
+      } else {
+        out->add(std::move(results[i - batch_start]), std::numeric_limits<int32_t>::max(), 0);
+      }
+    }
+    print_progress(float(batch_limit) / microcontigs.size());
+  }
+}
+
+int ExportAlignedMain::run(po::variables_map vars) {
+  if (fs::exists(m_out_file)) {
+    if (m_force) {
+      fs::remove(m_out_file);
+    } else {
+      std::cerr << "Refusing to overwrite '" << m_out_file << "'. Use -f to override.\n";
+      exit(1);
+    }
+  }
+  if (!boost::algorithm::ends_with(m_variants_file, ".vcf.gz") ||
+      !fs::exists(m_variants_file + ".tbi")) {
+    throw std::runtime_error("--variants must be a BGZF compressed VCF with a tabix index (" +
+                             m_variants_file + ".tbi)");
+  }
+  if (bool(m_ea_options.min_insert) != bool(m_ea_options.max_insert)) {
+    throw std::runtime_error(
+        "Must specify both maximum and minimum insert size if using pairing data");
+  }
+
+  // Pairs spanning two microcontigs would be exported from neither.
+  if (m_ea_options.use_pairs() && m_min_clearance > 0 &&
+      m_min_clearance < 2 * m_ea_options.max_insert) {
+    SPLOG("WARNING: raising --min-clearance from %d to %d (2 * --max-insert)", m_min_clearance,
+          2 * m_ea_options.max_insert);
+    std::cerr << "WARNING: --min-clearance must be at least twice --max-insert; raising it to "
+              << 2 * m_ea_options.max_insert << "\n";
+    m_min_clearance = 2 * m_ea_options.max_insert;
+  }
+
+  if (m_stats_file.empty()) {
+    m_stats_file = m_in_biograph + "/qc/export_aligned_stats.json";
+  }
+
+  initialize_app(m_ref_dir, m_in_biograph + "/qc/export_aligned_log.txt");
+  if (m_ref_dir.empty() or not defaults.check_refdir(m_ref_dir)) {
+    throw std::runtime_error("Please check your reference directory.");
+  }
+
+  biograph_dir bgdir(m_in_biograph, READ_BGDIR);
+  std::string seqset_path = bgdir.seqset();
+  std::string readmap_path = bgdir.find_readmap(m_sample);
+  m_sample = bgdir.find_readmap_accession(m_sample);
+
+  m_stats.start_stage("load_biograph");
+  SPLOG("Loading seqset: %s", seqset_path.c_str());
+  spiral_file_options sfopts;
+  sfopts.read_into_ram = m_cache_all;
+  auto ss = std::make_shared<seqset>(seqset_path, sfopts);
+
+  SPLOG("Loading readmap: %s", readmap_path.c_str());
+  readmap rm(ss, readmap_path, sfopts);
+  if (!rm.has_mate_loop()) {
+    throw io_exception("Readmap " + readmap_path +
+                       " missing mate loop table; upgrade with 'biograph upgrade'");
+  }
+  rm.calc_read_len_limits_if_needed();
+  m_stats.end_stage("load_biograph");
+
+  SPLOG("Opening reference");
+  reference ref("");
+
+  std::vector<std::pair<std::string, int64_t>> contigs;
+  std::string header = "@HD\tVN:1.4\tSO:coordinate\n";
+  std::vector<vcf_region> regions;
+  for (const auto& s : ref.get_assembly().scaffolds) {
+    m_tids.emplace(s.name, contigs.size());
+    contigs.emplace_back(s.name, s.len);
+    header += printstring("@SQ\tSN:%s\tLN:%ld\n", s.name.c_str(), int64_t(s.len));
+
+    vcf_region region;
+    region.scaffold_name = s.name;
+    region.start = 0;
+    region.limit = s.len;
+    regions.push_back(region);
+  }
+  header += printstring("@PG\tID:biograph\tPN:biograph export-aligned\tVN:%s\tCL:%s\n",
+                        biograph_current_version.make_string().c_str(), m_cmdline.c_str());
+  if (!m_bed_file.empty()) {
+    regions = read_bed();
+    for (const auto& region : regions) {
+      if (!m_tids.count(region.scaffold_name)) {
+        throw io_exception("Scaffold " + region.scaffold_name + " in " + m_bed_file +
+                           " not present in reference");
+      }
+    }
+  }
+
+  m_stats.start_stage("find_microcontigs");
+  std::cerr << "\nFinding microcontigs\n";
+  std::vector<vcf_region> microcontigs = find_all_microcontigs(regions);
+  m_stats.end_stage("find_microcontigs");
+  SPLOG("Exporting reads from %ld microcontigs in %ld regions", microcontigs.size(),
+        regions.size());
+
+  m_stats.start_stage("export");
+  std::cerr << "\nExporting aligned reads\n";
+  assemble_options options;
+  options.seqset = ss.get();
+  options.readmap = &rm;
+  aligned_read_exporter exporter(m_ea_options, options);
+  bgzf_bam_writer out(m_out_file, contigs, header);
+  sorted_bam_merger merger(&out);
+  export_all(microcontigs, exporter, &ref, &merger);
+  merger.close();
+  out.close();
+  m_stats.end_stage("export");
+
+  m_stats.add("command", "export-aligned");
+  m_stats.add("version", biograph_current_version.make_string());
+  m_stats.add("accession_id", m_sample);
+  m_stats.add("reference", m_ref_dir);
+  m_stats.add("regions", uint64_t(regions.size()));
+  m_stats.add("microcontigs", uint64_t(microcontigs.size()));
+  m_stats.add("records", uint64_t(m_records));
+  m_stats.save();
+
+  std::cerr << "\n" << m_out_file << " created, with index " << out.index_path() << ".\n";
+
+  return 0;
+}
+
+std::unique_ptr<Main> export_aligned_main() { return std::unique_ptr<Main>(new ExportAlignedMain); }
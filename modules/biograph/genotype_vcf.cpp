@@ -0,0 +1,312 @@
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem.hpp>
+#include <mutex>
+
+#include "modules/bio_base/biograph_dir.h"
+#include "modules/bio_base/readmap.h"
+#include "modules/bio_base/seqset.h"
+#include "modules/io/defaults.h"
+#include "modules/io/file_io.h"
+#include "modules/io/log.h"
+#include "modules/io/parallel.h"
+#include "modules/io/utils.h"
+#include "modules/io/version.h"
+#include "modules/main/main.h"
+#include "modules/variants/genotype_vcf.h"
+#include "modules/variants/trace_ref.h"
+#include "tools/build_stamp.h"
+
+namespace fs = boost::filesystem;
+using namespace variants;
+
+namespace {
+
+// Number of microcontigs to genotype before writing their output.
+constexpr size_t k_microcontig_batch_size = 4096;
+
+}  // namespace
+
+class GenotypeVcfMain : public Main {
+ public:
+  GenotypeVcfMain() {
+    m_usage =
+        "%1% version %2%\n\n"
+        "Usage: %1% [OPTIONS] --in <biograph> --variants <vcf.gz> --ref <reference path> "
+        "--out <vcf name>\n\n"
+        "Genotype the variants in an existing VCF against a BioGraph, annotating each record "
+        "with the same coverage and genotype fields as 'biograph coverage'.\n";
+  }
+
+ protected:
+  void add_args() override;
+  int run(po::variables_map vars) override;
+  const product_version& get_version() override { return biograph_current_version; }
+
+ private:
+  std::vector<vcf_region> read_bed() const;
+  std::vector<vcf_region> find_all_microcontigs(const std::vector<vcf_region>& regions);
+  void genotype_all(const std::vector<vcf_region>& microcontigs, const assemble_options& options,
+                    const reference* ref, const genotype_vcf_format& format, writable* out);
+
+  std::string m_in_biograph;
+  std::string m_variants_file;
+  std::string m_ref_dir;
+  std::string m_bed_file;
+  std::string m_sample;
+  std::string m_out_file;
+  bool m_strip_fmt = false;
+  bool m_force = false;
+  aoffset_t m_min_clearance = 2000;
+  aoffset_t m_min_contig_size = 3000;
+  genotype_vcf_options m_gt_options;
+
+  size_t m_records = 0;
+};
+
+void GenotypeVcfMain::add_args() {
+  m_general_options.add_options()                                                 //
+      ("in,b", po::value(&m_in_biograph)->required(), "Input BioGraph to process")  //
+      ("variants", po::value(&m_variants_file)->required(),
+       "VCF of variants to genotype.  Must be BGZF compressed with a tabix index.")  //
+      ("ref", po::value(&m_ref_dir)->required(), "Reference directory")          //
+      ("out", po::value(&m_out_file)->default_value("-"), "Output VCF file")      //
+      ("sample", po::value(&m_sample)->default_value(""),
+       "Sample to genotype.  Only required if the BioGraph contains multiple samples.")  //
+      ("force,f", po::bool_switch(&m_force)->default_value(false),
+       "Overwrite existing output file")  //
+      ;
+
+  m_variant_options.add_options()  //
+      ("bed,regions", po::value(&m_bed_file)->default_value(""),
+       "If specified, only genotype variants in the regions contained in the given BED file.")  //
+      ("passonly", po::bool_switch(&m_gt_options.pass_only)->default_value(false),
+       "Only genotype variants with a PASS filter; others are output with blank genotype "
+       "fields.")  //
+      ("strip-fmt", po::bool_switch(&m_strip_fmt)->default_value(false),
+       "Only output the FORMAT fields calculated here, dropping those in the input VCF.")  //
+      ("min-insert", po::value(&m_gt_options.min_insert)->default_value(m_gt_options.min_insert),
+       "Minimum insert size for a pair to be considered concordant")  //
+      ("max-insert", po::value(&m_gt_options.max_insert)->default_value(m_gt_options.max_insert),
+       "Maximum insert size for a pair to be considered concordant")  //
+      ;
+
+  m_advanced_options.add_options()  //
+      ("min-clearance", po::value(&m_min_clearance)->default_value(m_min_clearance),
+       "Minimum distance between variants to split them into separate microcontigs")  //
+      ("min-contig-size", po::value(&m_min_contig_size)->default_value(m_min_contig_size),
+       "Minimum size of a microcontig before it can be split from the next")  //
+      ("max-reads-per-entry",
+       po::value(&m_gt_options.max_reads_per_entry)->default_value(0),
+       "If nonzero, maximum number of reads each seqset entry can supply for read coverage")  //
+      ("max-coverage-paths",
+       po::value(&m_gt_options.max_coverage_paths)
+           ->default_value(m_gt_options.max_coverage_paths),
+       "Maximum number of paths to trace when calculating read coverage")  //
+      ("filter-dup-align", po::bool_switch(&m_gt_options.filter_dup_align)->default_value(false),
+       "Only count each read once when it aligns to more than one allele in a region")  //
+      ("ideal-insert", po::value(&m_gt_options.ideal_insert)->default_value(0),
+       "If nonzero, place each pair only once, preferring placements closest to this insert "
+       "size")  //
+      ("placer-max-ambig",
+       po::value(&m_gt_options.placer_max_ambig)->default_value(m_gt_options.placer_max_ambig),
+       "Maximum number of ambiguous placements to consider for each pair when using "
+       "--ideal-insert")  //
+      ;
+
+  m_positional.add("in", 1);
+  m_positional.add("variants", 1);
+  m_positional.add("ref", 1);
+  m_positional.add("out", 1);
+
+  m_options.add(m_general_options).add(m_variant_options).add(m_advanced_options);
+}
+
+std::vector<vcf_region> GenotypeVcfMain::read_bed() const {
+  file_reader bed(m_bed_file);
+  std::string line;
+
+  std::vector<vcf_region> regions;
+  while (bed.readline(line, 1000)) {
+    std::vector<std::string> fields;
+    boost::split(fields, line, boost::is_any_of(" \t"), boost::token_compress_on);
+    CHECK_GE(fields.size(), 3) << "bad BED line: '" << line << "'";
+
+    vcf_region region;
+    region.scaffold_name = fields[0];
+    region.start = atol(fields[1].c_str());
+    region.limit = atol(fields[2].c_str());
+    regions.push_back(region);
+  }
+  return regions;
+}
+
+std::vector<vcf_region> GenotypeVcfMain::find_all_microcontigs(
+    const std::vector<vcf_region>& regions) {
+  std::vector<std::vector<vcf_region>> per_region(regions.size());
+  parallel_for(0, regions.size(), [&](size_t start, size_t limit) {
+    tabix_vcf_reader reader(m_variants_file);
+    for (size_t i = start; i != limit; ++i) {
+      per_region[i] = find_microcontigs(&reader, regions[i], m_min_clearance, m_min_contig_size);
+    }
+  });
+
+  std::vector<vcf_region> microcontigs;
+  for (auto& mcs : per_region) {
+    microcontigs.insert(microcontigs.end(), mcs.begin(), mcs.end());
+  }
+  return microcontigs;
+}
+
+void GenotypeVcfMain::genotype_all(const std::vector<vcf_region>& microcontigs,
+                                   const assemble_options& options, const reference* ref,
+                                   const genotype_vcf_format& format, writable* out) {
+  std::mutex mu;
+  for (size_t batch_start = 0; batch_start < microcontigs.size();
+       batch_start += k_microcontig_batch_size) {
+    size_t batch_limit = std::min(batch_start + k_microcontig_batch_size, microcontigs.size());
+    std::vector<std::string> results(batch_limit - batch_start);
+    parallel_for(batch_start, batch_limit, [&](size_t start, size_t limit) {
+      tabix_vcf_reader reader(m_variants_file);
+      std::string cur_scaffold_name;
+      variants::scaffold cur_scaffold;
+      size_t records = 0;
+      for (size_t i = start; i != limit; ++i) {
+        const vcf_region& mc = microcontigs[i];
+        if (mc.scaffold_name != cur_scaffold_name) {
+          cur_scaffold = trace_ref::ref_to_scaffold(ref, mc.scaffold_name);
+          cur_scaffold_name = mc.scaffold_name;
+        }
+        assemble_options scaffold_options = options;
+        scaffold_options.scaffold = &cur_scaffold;
+        scaffold_options.scaffold_name = mc.scaffold_name;
+        vcf_region_genotyper genotyper(m_gt_options, scaffold_options, &format);
+        std::string result =
+            genotyper.genotype(mc, reader.query(mc.scaffold_name, mc.start, mc.limit));
+        records += std::count(result.begin(), result.end(), '\n');
+        results[i - batch_start] = std::move(result);
+      }
+      std::lock_guard<std::mutex> l(mu);
+      m_records += records;
+    });
+
+    for (const std::string& result : results) {
+      out->write(result.data(), result.size());
+    }
+    print_progress(float(batch_limit) / microcontigs.size());
+  }
+}
+
+int GenotypeVcfMain::run(po::variables_map vars) {
+  if (fs::exists(m_out_file) && m_out_file != "-") {
+    if (m_force) {
+      fs::remove(m_out_file);
+    } else {
+      std::cerr << "Refusing to overwrite '" << m_out_file << "'. Use -f to override.\n";
+      exit(1);
+    }
+  }
+  if (!boost::algorithm::ends_with(m_variants_file, ".vcf.gz") ||
+      !fs::exists(m_variants_file + ".tbi")) {
+    throw std::runtime_error("--variants must be a BGZF compressed VCF with a tabix index (" +
+                             m_variants_file + ".tbi)");
+  }
+
+  // Pairs spanning two microcontigs would be counted in neither.
+  if (m_min_clearance > 0 && m_min_clearance < 2 * m_gt_options.max_insert) {
+    SPLOG("WARNING: raising --min-clearance from %d to %d (2 * --max-insert)", m_min_clearance,
+          2 * m_gt_options.max_insert);
+    std::cerr << "WARNING: --min-clearance must be at least twice --max-insert; raising it to "
+              << 2 * m_gt_options.max_insert << "\n";
+    m_min_clearance = 2 * m_gt_options.max_insert;
+  }
+
+  if (m_stats_file.empty()) {
+    m_stats_file = m_in_biograph + "/qc/genotype_vcf_stats.json";
+  }
+
+  initialize_app(m_ref_dir, m_in_biograph + "/qc/genotype_vcf_log.txt");
+  if (m_ref_dir.empty() or not defaults.check_refdir(m_ref_dir)) {
+    throw std::runtime_error("Please check your reference directory.");
+  }
+
+  biograph_dir bgdir(m_in_biograph, READ_BGDIR);
+  std::string seqset_path = bgdir.seqset();
+  std::string readmap_path = bgdir.find_readmap(m_sample);
+  m_sample = bgdir.find_readmap_accession(m_sample);
+
+  m_stats.start_stage("load_biograph");
+  SPLOG("Loading seqset: %s", seqset_path.c_str());
+  spiral_file_options sfopts;
+  sfopts.read_into_ram = m_cache_all;
+  auto ss = std::make_shared<seqset>(seqset_path, sfopts);
+
+  SPLOG("Loading readmap: %s", readmap_path.c_str());
+  readmap rm(ss, readmap_path, sfopts);
+  if (!rm.has_mate_loop()) {
+    throw io_exception("Readmap " + readmap_path +
+                       " missing mate loop table; upgrade with 'biograph upgrade'");
+  }
+  rm.calc_read_len_limits_if_needed();
+  m_stats.end_stage("load_biograph");
+
+  SPLOG("Opening reference");
+  reference ref("");
+
+  std::vector<vcf_region> regions;
+  if (m_bed_file.empty()) {
+    for (const auto& s : ref.get_assembly().scaffolds) {
+      vcf_region region;
+      region.scaffold_name = s.name;
+      region.start = 0;
+      region.limit = s.len;
+      regions.push_back(region);
+    }
+  } else {
+    regions = read_bed();
+  }
+
+  genotype_vcf_format format(tabix_vcf_reader(m_variants_file).header(), m_sample, m_strip_fmt);
+  if (!format.sample_column()) {
+    SPLOG("Sample %s not present in %s; adding a new sample column", m_sample.c_str(),
+          m_variants_file.c_str());
+  }
+
+  file_writer out(m_out_file == "-" ? "/dev/stdout" : m_out_file);
+  out.print(format.make_header(
+      printstring("##source=\"Spiral Genetics BioGraph Genotype\",version=\"%s\","
+                  "description=\"build-revision='%s',command-line='%s'\"",
+                  biograph_current_version.make_string().c_str(),
+                  get_build_scm_revision().c_str(), m_cmdline.c_str())));
+
+  m_stats.start_stage("find_microcontigs");
+  std::cerr << "\nFinding microcontigs\n";
+  std::vector<vcf_region> microcontigs = find_all_microcontigs(regions);
+  m_stats.end_stage("find_microcontigs");
+  SPLOG("Genotyping %ld microcontigs in %ld regions", microcontigs.size(), regions.size());
+
+  m_stats.start_stage("genotype");
+  std::cerr << "\nGenotyping\n";
+  assemble_options options;
+  options.seqset = ss.get();
+  options.readmap = &rm;
+  genotype_all(microcontigs, options, &ref, format, &out);
+  out.close();
+  m_stats.end_stage("genotype");
+
+  m_stats.add("command", "genotype-vcf");
+  m_stats.add("version", biograph_current_version.make_string());
+  m_stats.add("accession_id", m_sample);
+  m_stats.add("reference", m_ref_dir);
+  m_stats.add("regions", uint64_t(regions.size()));
+  m_stats.add("microcontigs", uint64_t(microcontigs.size()));
+  m_stats.add("records", uint64_t(m_records));
+  m_stats.save();
+
+  std::cerr << "\n" << m_out_file << " created.\n";
+
+  return 0;
+}
+
+std::unique_ptr<Main> genotype_vcf_main() { return std::unique_ptr<Main>(new GenotypeVcfMain); }
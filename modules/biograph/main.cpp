@@ -2,12 +2,17 @@
 #include "modules/main/main.h"
 #include <boost/filesystem.hpp>
 
+std::unique_ptr<Main> archive_main();
 std::unique_ptr<Main> assemble_main(); // retired
 std::unique_ptr<Main> biograph_info_main();
 std::unique_ptr<Main> bwt_query_main();
+std::unique_ptr<Main> denovo_assemble_main();
 std::unique_ptr<Main> discovery_main();
+std::unique_ptr<Main> discovery_merge_main();
+std::unique_ptr<Main> export_aligned_main();
 std::unique_ptr<Main> export_fastq_main();
 std::unique_ptr<Main> export_main();
+std::unique_ptr<Main> genotype_vcf_main();
 std::unique_ptr<Main> make_ref_main();
 std::unique_ptr<Main> merge_seqset_main();
 std::unique_ptr<Main> migrate_readmap_main();
@@ -16,6 +21,7 @@ std::unique_ptr<Main> ref2seqset_main();
 std::unique_ptr<Main> seqset_dump_main();
 std::unique_ptr<Main> seqset_main();
 std::unique_ptr<Main> seqset_query_main();
+std::unique_ptr<Main> unarchive_main();
 std::unique_ptr<Main> upgrade_readmap_main();
 
 void print_generic_help() {
@@ -26,6 +32,10 @@ void print_generic_help() {
                "\n"
                "  bgbinary create\n"
                "  bgbinary discovery\n"
+               "  bgbinary discovery-merge\n"
+               "  bgbinary export-aligned\n"
+               "  bgbinary denovo-assemble\n"
+               "  bgbinary genotype-vcf\n"
                "  bgbinary reference\n"
                "  bgbinary metadata\n"
                "\n";
@@ -55,8 +65,14 @@ int main(int argc, char* argv[]) {
       {"merge", merge_seqset_main},
       {"reference", make_ref_main},
       {"upgrade", upgrade_readmap_main},
+      {"archive", archive_main},
+      {"unarchive", unarchive_main},
       {"variants", assemble_main}, // retired
       {"discovery", discovery_main},
+      {"discovery-merge", discovery_merge_main},
+      {"genotype-vcf", genotype_vcf_main},
+      {"export-aligned", export_aligned_main},
+      {"denovo-assemble", denovo_assemble_main},
 
       // Dev commands
       {"bwtquery", bwt_query_main},
@@ -34,7 +34,10 @@ class UpgradeReadmapMain : public Main {
         "%1% version %2%\n\n"
         "Usage: %1% [OPTIONS] --in <target biograph>\n\n"
         "Upgrades all readmaps in a biograph from v2 (mate pairs) to v3 (mate "
-        "loops)\n";
+        "loops)\n\n"
+        "With --compact, also re-encodes the mapping from sequences to reads\n"
+        "so the readmap takes less space.  Compacted readmaps cannot be read\n"
+        "by older versions.\n";
     ;
   }
 
@@ -44,7 +47,13 @@ class UpgradeReadmapMain : public Main {
   const product_version& get_version() override { return biograph_current_version; }
 
  private:
+  // Rewrites the given readmap using Elias-Fano encoded read ids, if
+  // that makes it smaller.  Returns the new readmap id.
+  std::string compact_readmap(biograph_dir& bgdir, const std::shared_ptr<seqset>& ss_f,
+                              const std::string& sample_name, const std::string& readmap_id);
+
   std::string m_bgdir;
+  bool m_compact = false;
 };
 
 // anchored handles termination in the main loop.
@@ -56,7 +65,9 @@ static void signal_handler(int sig) {
 }
 
 void UpgradeReadmapMain::add_args() {
-  m_general_options.add_options()("in", po::value(&m_bgdir)->required(), "Target biograph");
+  m_general_options.add_options()("in", po::value(&m_bgdir)->required(), "Target biograph")(
+      "compact", po::bool_switch(&m_compact)->default_value(false),
+      "Re-encode read ids to make readmaps smaller");
   m_options.add(m_general_options);
 
   m_positional.add("in", 1);
@@ -94,7 +105,7 @@ int UpgradeReadmapMain::run(po::variables_map vars) {
     if (old_readmap.has_mate_loop()) {
       std::cout << "\n" << sample.first << " is already upgraded" << std::endl;
       SPLOG("%s already has mate loop enabled", sample.second.c_str());
-      out_samples[sample.first] = sample.second;
+      out_samples[sample.first] = compact_readmap(bgdir, ss_f, sample.first, sample.second);
       continue;
     }
 
@@ -125,7 +136,7 @@ int UpgradeReadmapMain::run(po::variables_map vars) {
     if (!old_readmap.has_pairing_data()) {
       std::cout << "\n" << sample.first << " has no pairing data, skipping" << std::endl;
       SPLOG("%s has no pairing data", sample.second.c_str());
-      out_samples[sample.first] = sample.second;
+      out_samples[sample.first] = compact_readmap(bgdir, ss_f, sample.first, sample.second);
       continue;
     }
 
@@ -145,10 +156,10 @@ int UpgradeReadmapMain::run(po::variables_map vars) {
     SPLOG("Rename tmp readmap to %s", bgdir.readmap(sha).c_str());
     fs::rename(output_path, bgdir.readmap(sha));
 
-    out_samples[sample.first] = sha;
-
     fs::remove(fs::path(readmap_path));
     print_progress(1.0);
+
+    out_samples[sample.first] = compact_readmap(bgdir, ss_f, sample.first, sha);
   }
 
   SPLOG("updating metadata");
@@ -167,6 +178,37 @@ int UpgradeReadmapMain::run(po::variables_map vars) {
   return 0;
 }
 
+std::string UpgradeReadmapMain::compact_readmap(biograph_dir& bgdir,
+                                                const std::shared_ptr<seqset>& ss_f,
+                                                const std::string& sample_name,
+                                                const std::string& readmap_id) {
+  if (!m_compact) {
+    return readmap_id;
+  }
+
+  std::string readmap_path = bgdir.readmap(readmap_id);
+  std::string output_path = readmap_path + ".compact";
+  {
+    readmap old_readmap(ss_f, readmap_path);
+    if (old_readmap.has_compact_read_ids() || !old_readmap.can_compact_read_ids()) {
+      std::cout << "\n" << sample_name << " is already compact" << std::endl;
+      SPLOG("%s does not need compacting", readmap_id.c_str());
+      return readmap_id;
+    }
+
+    std::cout << "\nCompacting " << sample_name << std::endl;
+    SPLOG("Compacting %s", readmap_id.c_str());
+    make_readmap::compact(old_readmap, output_path, update_progress);
+  }
+
+  std::string sha = sha1sum(fs::path(output_path));
+  SPLOG("Rename compacted readmap to %s", bgdir.readmap(sha).c_str());
+  fs::rename(output_path, bgdir.readmap(sha));
+  fs::remove(fs::path(readmap_path));
+  print_progress(1.0);
+  return sha;
+}
+
 std::unique_ptr<Main> upgrade_readmap_main() {
   return std::unique_ptr<Main>(new UpgradeReadmapMain);
 }
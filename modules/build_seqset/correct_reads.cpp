@@ -160,17 +160,7 @@ bool correct_reads::correct(const unaligned_read& r, corrected_read& cr) {
   params.max_corrections = m_params.frc_max_corrections;
   params.min_good_run = m_params.frc_min_good_run;
   params.kmer_size = m_kmer_size;
-  const kmer_set* ks = &m_ks;
-  params.kmer_lookup_f = [ks](kmer_t kmer, frc_kmer* ki) -> bool {
-    kmer_t canon = canonicalize(kmer, ks->kmer_size(), ki->flipped);
-    auto index = ks->find_table_index(canon);
-    if (index == kmer_set::k_not_present) {
-      return false;
-    }
-    ki->index = index;
-    return true;
-  };
-  frc_output res = fast_read_correct(r.sequence, params);
+  frc_output res = fast_read_correct(r.sequence, params, kmer_set_frc_lookup(m_ks));
   unsigned needed_good_bases = m_params.trim_after_portion * r.sequence.size();
   if (res.corrected.size() < needed_good_bases) {
     m_stats.failed_correction_count++;
@@ -46,23 +46,20 @@ void push_to_pair_discover::on_walk(active_assembly* generic_act) {
   aoffset_t len = act->a->seq.size();
 
   if (act->a->right_offset) {
-    for (const auto& e : act->a->rc_seqset_entries.entries()) {
-      aoffset_t offset = e.first;
+    act->a->rc_seqset_entries.for_each_range([&](aoffset_t offset, const seqset_range& r) {
       if (offset == len) {
-        continue;
+        return;
       }
-      for (const auto& r : e.second) {
-        if (r.size() < opts().min_overlap) {
-          continue;
-        }
-        anchor_info info;
-        info.truncated = r.truncate(opts().min_overlap);
-        info.orig = r;
-        info.anchor.act = act;
-        info.anchor.offset = len - e.first;
-        act->rc_anchors.emplace_back(std::move(info));
+      if (r.size() < opts().min_overlap) {
+        return;
       }
-    }
+      anchor_info info;
+      info.truncated = r.truncate(opts().min_overlap);
+      info.orig = r;
+      info.anchor.act = act;
+      info.anchor.offset = len - offset;
+      act->rc_anchors.emplace_back(std::move(info));
+    });
   }
 
   if (k_dbg) {
@@ -265,9 +262,9 @@ void push_to_pair_discover::on_trace(const graph_discover::active_assembly* gene
   }
 
   absl::btree_map<aoffset_t, seqset_range_set> path_entries;
-  for (auto elem : act->a->rc_seqset_entries.entries()) {
-    path_entries[act->a->seq.size() - elem.first] = std::move(elem.second);
-  }
+  act->a->rc_seqset_entries.for_each_range([&](aoffset_t offset, const seqset_range& r) {
+    path_entries[act->a->seq.size() - offset].insert(r);
+  });
 
   aoffset_t best_abs_svlen = std::numeric_limits<aoffset_t>::max();
   assembly_ptr best_abs_svlen_a;
@@ -0,0 +1,115 @@
+#include "modules/io/bgzf_writer.h"
+#include "modules/io/log.h"
+#include "modules/io/parallel.h"
+
+#include <htslib/bgzf.h>
+
+#include <algorithm>
+
+namespace {
+
+// Empty BGZF block marking the end of the file, as written by bgzf_close.
+const char k_bgzf_eof[] =
+    "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+constexpr size_t k_bgzf_eof_len = sizeof(k_bgzf_eof) - 1;
+
+}  // namespace
+
+constexpr size_t bgzf_writer::k_blocks_per_thread;
+
+bgzf_writer::bgzf_writer(writable* out, int level) : m_out(out), m_level(level) {
+  m_batch_size = std::max<size_t>(1, get_thread_count() * k_blocks_per_thread) * BGZF_BLOCK_SIZE;
+  m_pending.reserve(m_batch_size);
+}
+
+bgzf_writer::~bgzf_writer() {
+  if (!m_closed && !m_pending.empty()) {
+    SPLOG("bgzf_writer destroyed with %lu bytes of unflushed data", m_pending.size());
+  }
+}
+
+void bgzf_writer::write(const char* buf, size_t len) {
+  CHECK(!m_closed) << "Write after close";
+  while (len) {
+    size_t to_copy = std::min(len, m_batch_size - m_pending.size());
+    m_pending.append(buf, to_copy);
+    m_uoffset_written += to_copy;
+    buf += to_copy;
+    len -= to_copy;
+    if (m_pending.size() == m_batch_size) {
+      compress_pending();
+    }
+  }
+}
+
+void bgzf_writer::compress_pending() {
+  if (m_pending.empty()) {
+    return;
+  }
+
+  size_t nblocks = (m_pending.size() + BGZF_BLOCK_SIZE - 1) / BGZF_BLOCK_SIZE;
+  if (m_compressed.size() < nblocks) {
+    m_compressed.resize(nblocks);
+    m_compressed_len.resize(nblocks);
+  }
+
+  auto compress_block = [&](size_t block_id) {
+    size_t start = block_id * BGZF_BLOCK_SIZE;
+    size_t len = std::min<size_t>(BGZF_BLOCK_SIZE, m_pending.size() - start);
+    std::vector<char>& dst = m_compressed[block_id];
+    dst.resize(BGZF_MAX_BLOCK_SIZE);
+    size_t dlen = dst.size();
+    if (bgzf_compress(dst.data(), &dlen, m_pending.data() + start, len, m_level) != 0) {
+      throw io_exception("Unable to compress BGZF block");
+    }
+    m_compressed_len[block_id] = dlen;
+  };
+
+  if (nblocks == 1) {
+    compress_block(0);
+  } else {
+    parallel_for(0, nblocks, compress_block);
+  }
+
+  for (size_t block_id = 0; block_id != nblocks; ++block_id) {
+    m_blocks.emplace_back(m_uoffset_committed, m_coffset_committed);
+    m_out->write(m_compressed[block_id].data(), m_compressed_len[block_id]);
+    m_uoffset_committed +=
+        std::min<size_t>(BGZF_BLOCK_SIZE, m_pending.size() - block_id * BGZF_BLOCK_SIZE);
+    m_coffset_committed += m_compressed_len[block_id];
+  }
+  CHECK_EQ(m_uoffset_committed, m_uoffset_written);
+  m_pending.clear();
+}
+
+void bgzf_writer::flush() {
+  CHECK(!m_closed) << "Flush after close";
+  compress_pending();
+  m_out->flush();
+}
+
+void bgzf_writer::close() {
+  if (m_closed) {
+    return;
+  }
+  compress_pending();
+  m_out->write(k_bgzf_eof, k_bgzf_eof_len);
+  m_out->flush();
+  m_closed = true;
+}
+
+uint64_t bgzf_writer::virtual_offset(uint64_t uoffset) const {
+  CHECK_LE(uoffset, m_uoffset_committed);
+  if (uoffset == m_uoffset_committed) {
+    // Start of the next block to be written.
+    return m_coffset_committed << 16;
+  }
+  auto it = std::upper_bound(
+      m_blocks.begin(), m_blocks.end(), uoffset,
+      [](uint64_t offset, const std::pair<uint64_t, uint64_t>& block) {
+        return offset < block.first;
+      });
+  CHECK(it != m_blocks.begin());
+  --it;
+  return (it->second << 16) | (uoffset - it->first);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "modules/io/io.h"
+
+#include <string>
+#include <vector>
+
+// Writes BGZF-compressed data (as produced by bgzip) to an underlying
+// writable.  Data is buffered until a batch of blocks is available;
+// the blocks in a batch are compressed in parallel on the thread pool
+// and then written out in order.
+//
+// Virtual offsets (as used by tabix and CSI indexes) can be retrieved
+// for any uncompressed offset that has been committed to the output.
+class bgzf_writer : public writable {
+ public:
+  // Number of BGZF blocks to compress in parallel per thread.
+  static constexpr size_t k_blocks_per_thread = 4;
+
+  // Does not take ownership of "out"; "out" is not closed when this
+  // writer is closed.  "level" is a zlib compression level, or -1 for
+  // the default.
+  bgzf_writer(writable* out, int level = -1);
+  ~bgzf_writer() override;
+
+  void write(const char* buf, size_t len) override;
+
+  // Ends the current BGZF block and writes all buffered data to the
+  // underlying writable.  After flushing, tell() == committed().
+  void flush() override;
+
+  // Flushes and writes the BGZF EOF marker.
+  void close() override;
+
+  // Returns the number of uncompressed bytes written so far.
+  uint64_t tell() const { return m_uoffset_written; }
+
+  // Returns the number of uncompressed bytes that have been
+  // compressed and written to the underlying writable.
+  uint64_t committed() const { return m_uoffset_committed; }
+
+  // Returns the BGZF virtual offset of the given uncompressed offset.
+  // "uoffset" must be <= committed().
+  uint64_t virtual_offset(uint64_t uoffset) const;
+
+ private:
+  void compress_pending();
+
+  writable* m_out = nullptr;
+  int m_level = -1;
+  bool m_closed = false;
+
+  // Uncompressed data not yet compressed.
+  std::string m_pending;
+  size_t m_batch_size = 0;
+
+  // Reusable buffers for compressed blocks.
+  std::vector<std::vector<char>> m_compressed;
+  std::vector<size_t> m_compressed_len;
+
+  // Uncompressed and compressed starting offsets of each block written.
+  std::vector<std::pair<uint64_t, uint64_t>> m_blocks;
+
+  uint64_t m_uoffset_written = 0;
+  uint64_t m_uoffset_committed = 0;
+  uint64_t m_coffset_committed = 0;
+};
@@ -0,0 +1,112 @@
+#include "modules/io/bgzf_writer.h"
+#include "modules/io/file_io.h"
+#include "modules/io/parallel.h"
+#include "modules/test/test_utils.h"
+
+#include <gtest/gtest.h>
+#include <htslib/bgzf.h>
+
+#include <random>
+
+namespace {
+
+std::string random_text(size_t len) {
+  std::mt19937 rand;
+  std::string result;
+  result.reserve(len);
+  while (result.size() < len) {
+    // Somewhat compressible data, with some line structure.
+    result.push_back("ACGT\t\n"[rand() % 6]);
+  }
+  return result;
+}
+
+}  // namespace
+
+class bgzf_writer_test : public ::testing::TestWithParam<size_t /* threads */> {
+ public:
+  void SetUp() override {
+    m_old_threads = get_thread_count();
+    set_thread_count(GetParam());
+    m_path = make_path("bgzf_writer_test.gz");
+  }
+  void TearDown() override { set_thread_count(m_old_threads); }
+
+ protected:
+  std::string read_all() {
+    BGZF* fp = bgzf_open(m_path.c_str(), "r");
+    CHECK(fp);
+    EXPECT_EQ(1, bgzf_check_EOF(fp));
+    std::string result;
+    char buf[4096];
+    ssize_t len;
+    while ((len = bgzf_read(fp, buf, sizeof(buf))) > 0) {
+      result.append(buf, len);
+    }
+    EXPECT_EQ(0, len);
+    bgzf_close(fp);
+    return result;
+  }
+
+  std::string read_at(uint64_t voffset, size_t len) {
+    BGZF* fp = bgzf_open(m_path.c_str(), "r");
+    CHECK(fp);
+    EXPECT_EQ(0, bgzf_seek(fp, voffset, SEEK_SET));
+    std::string result(len, '\0');
+    EXPECT_EQ(len, bgzf_read(fp, &result[0], len));
+    bgzf_close(fp);
+    return result;
+  }
+
+  size_t m_old_threads;
+  std::string m_path;
+};
+
+TEST_P(bgzf_writer_test, empty) {
+  {
+    file_writer out(m_path);
+    bgzf_writer bgzf(&out);
+    EXPECT_EQ(0, bgzf.tell());
+    EXPECT_EQ(0, bgzf.virtual_offset(0));
+    bgzf.close();
+  }
+  EXPECT_EQ("", read_all());
+}
+
+TEST_P(bgzf_writer_test, round_trip) {
+  std::string text = random_text(5 * 1024 * 1024 + 17);
+
+  file_writer out(m_path);
+  bgzf_writer bgzf(&out);
+  std::vector<std::pair<uint64_t /* uoffset */, uint64_t /* voffset */>> offsets;
+  size_t pos = 0;
+  size_t chunk = 1;
+  while (pos < text.size()) {
+    size_t len = std::min(chunk, text.size() - pos);
+    bgzf.write(text.data() + pos, len);
+    pos += len;
+    EXPECT_EQ(pos, bgzf.tell());
+    if (bgzf.committed() > 0) {
+      offsets.emplace_back(bgzf.committed() - 1, bgzf.virtual_offset(bgzf.committed() - 1));
+    }
+    chunk = chunk * 3 + 1;
+    if (chunk > 1024 * 1024) {
+      chunk = 7;
+    }
+  }
+  bgzf.flush();
+  EXPECT_EQ(text.size(), bgzf.committed());
+  offsets.emplace_back(12345, bgzf.virtual_offset(12345));
+  offsets.emplace_back(BGZF_BLOCK_SIZE, bgzf.virtual_offset(BGZF_BLOCK_SIZE));
+  EXPECT_EQ(1, bgzf.virtual_offset(1));
+  bgzf.close();
+  out.close();
+
+  EXPECT_EQ(text, read_all());
+  for (const auto& offset : offsets) {
+    size_t len = std::min<size_t>(100, text.size() - offset.first);
+    EXPECT_EQ(text.substr(offset.first, len), read_at(offset.second, len)) << offset.first;
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(bgzf_writer_threads, bgzf_writer_test, ::testing::Values(1, 4));
@@ -1,8 +1,12 @@
 #include <cassert>
 
+#include <cpuid.h>
+#include <immintrin.h>
+
 #include "base/base.h"
 #include "modules/io/bitcount.h"
 #include "modules/io/log.h"
+#include "modules/io/parallel.h"
 #include "modules/test/coverage.h"
 
 DECLARE_TEST_COVERAGE(bitcount);
@@ -36,6 +40,8 @@ bitcount::bitcount(size_t nbits) : m_nbits(nbits), m_mutable(true) {
       new owned_membuf(subaccum_mem_size(nbits), "bitcount_subaccum");
   m_accum = m_mutable_accum =
       new owned_membuf(accum_mem_size(nbits), "bitcount_accum");
+  m_mutable_select_index =
+      new owned_membuf(select_index_mem_size(nbits), "bitcount_select_index");
 }
 
 bitcount::bitcount(const spiral_file_create_state &state, size_t nbits)
@@ -49,6 +55,13 @@ bitcount::bitcount(const spiral_file_create_state &state, size_t nbits)
       state.create_membuf("subaccum", subaccum_mem_size(nbits));
   m_accum = m_mutable_accum =
       state.create_membuf("accum", accum_mem_size(nbits));
+
+  select_index_metadata select_md;
+  select_md.count_bits = k_find_count_count_bits;
+  select_md.index_bits = k_find_count_index_bits;
+  state.create_json<select_index_metadata>("select_index.json", select_md);
+  m_mutable_select_index =
+      state.create_membuf("select_index", select_index_mem_size(nbits));
 }
 
 bitcount::bitcount(const spiral_file_open_state &state) : m_mutable(false) {
@@ -61,6 +74,18 @@ bitcount::bitcount(const spiral_file_open_state &state) : m_mutable(false) {
   CHECK_EQ(subaccum_mem_size(m_nbits), m_subaccum.size());
   m_accum = state.open_membuf("accum");
   CHECK_EQ(accum_mem_size(m_nbits), m_accum.size());
+
+  // Bitcounts written before the select index was added don't have
+  // one; find_count falls back to a binary search for those.
+  if (state.membuf_present("select_index.json") && state.membuf_present("select_index")) {
+    select_index_metadata select_md =
+        state.open_json<select_index_metadata>("select_index.json");
+    if (select_md.count_bits == k_find_count_count_bits &&
+        select_md.index_bits == k_find_count_index_bits) {
+      m_select_index = state.open_membuf("select_index");
+      CHECK_EQ(select_index_mem_size(m_nbits), m_select_index.size());
+    }
+  }
 }
 
 size_t bitcount::bits_mem_size(size_t nbits) {
@@ -76,6 +101,13 @@ size_t bitcount::accum_mem_size(size_t nbits) {
   return round_div(nbits + 1, 512) * sizeof(uint64_t);
 }
 
+size_t bitcount::select_index_mem_size(size_t nbits) {
+  // One entry for each possible value of (count >>
+  // k_find_count_count_bits), with count in [0, nbits + 1], plus one
+  // more so find_count can always look at the entry after.
+  return (((nbits + 1) >> k_find_count_count_bits) + 2) * sizeof(uint32_t);
+}
+
 void bitcount::init() {
   CHECK(m_mutable);
   memset(m_mutable_bits.mutable_data(), 0, bits_mem_size(m_nbits));
@@ -119,13 +151,15 @@ size_t bitcount::finalize(progress_handler_t prog) {
     mutable_accum()[m_nbits / 512] = total;
   }
 
+  if (m_mutable_select_index.size()) {
+    m_select_index = m_mutable_select_index;
+    fill_select_index();
+  }
+
   return total;
 }
 
-namespace {
-
-// Returns the bit index of the count-th set bit in val.
-unsigned select_bit(uint64_t val, unsigned count) {
+unsigned bitcount::select_bit_portable(uint64_t val, unsigned count) {
   unsigned index = 0;
 
   for (unsigned i = 32; i > 0; i /= 2) {
@@ -140,60 +174,107 @@ unsigned select_bit(uint64_t val, unsigned count) {
   return index;
 }
 
-}  // namespace
+__attribute__((target("bmi2"))) unsigned bitcount::select_bit_bmi2(uint64_t val,
+                                                                   unsigned count) {
+  // Deposit a single bit at the position of the count-th set bit of
+  // val, and find where it landed.
+  return __builtin_ctzll(_pdep_u64(uint64_t(1) << count, val));
+}
 
-void bitcount::make_find_count_index() {
-  m_count_set_to_index.clear();
-  size_t max_shifted = total_bits() >> k_find_count_count_bits;
-  m_count_set_to_index.resize(max_shifted + 2);
-  m_count_set_to_index[0] = 0;
-  CHECK_LT(size() >> k_find_count_index_bits,
-           std::numeric_limits<uint32_t>::max());
-  m_count_set_to_index[max_shifted + 1] = size() >> k_find_count_index_bits;
-
-  size_t cur_shifted = 0;
-  size_t cur_count = 0;
-
-  size_t idx64_max = round_div(size(), 64);
-  for (size_t idx64 = 0; idx64 < idx64_max; ++idx64) {
-    uint64_t cur_val64 = bits()[idx64];
-    size_t new_count = cur_count + __builtin_popcountl(cur_val64);
-    size_t new_shifted = new_count >> k_find_count_count_bits;
-    if (new_shifted == cur_shifted) {
-      // Fast path; we don't need to generate any index entries for
-      // this "accum" so we can skip right to the next one.
-      NOTE_TEST_COVERAGE(bitcount);
-      cur_count = new_count;
-      continue;
+bool bitcount::cpu_has_bmi2() {
+  static const bool has_bmi2 = [] {
+    // We may be called during static initialization, before libgcc
+    // has filled in its CPU model.
+    __builtin_cpu_init();
+    return bool(__builtin_cpu_supports("bmi2"));
+  }();
+  return has_bmi2;
+}
+
+bool bitcount::cpu_has_fast_pdep() {
+  static const bool fast_pdep = [] {
+    if (!cpu_has_bmi2()) {
+      return false;
+    }
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    // "AuthenticAMD"
+    bool is_amd = ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163;
+    if (!is_amd) {
+      return true;
+    }
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    unsigned family = (eax >> 8) & 0xf;
+    if (family == 0xf) {
+      family += (eax >> 20) & 0xff;
     }
+    // Zen3 (family 19h) and later have a native PDEP.
+    return family >= 0x19;
+  }();
+  return fast_pdep;
+}
+
+unsigned bitcount::select_bit(uint64_t val, unsigned count) {
+  DCHECK_LT(count, unsigned(__builtin_popcountl(val)));
+  if (cpu_has_fast_pdep()) {
+    return select_bit_bmi2(val, count);
+  } else {
+    return select_bit_portable(val, count);
+  }
+}
+
+void bitcount::make_find_count_index() {
+  if (has_find_count_index()) {
+    return;
+  }
+  m_select_index = m_mutable_select_index =
+      new owned_membuf(select_index_mem_size(size()), "bitcount_select_index");
+  fill_select_index();
+}
+
+void bitcount::fill_select_index() {
+  uint32_t* index = mutable_select_index();
+  size_t num_entries = m_mutable_select_index.size() / sizeof(uint32_t);
+  CHECK_EQ(select_index_mem_size(size()), m_mutable_select_index.size());
+  CHECK_LT(size() >> k_find_count_index_bits, std::numeric_limits<uint32_t>::max());
+  uint32_t end_entry = size() >> k_find_count_index_bits;
 
-    size_t idx = idx64 * 64;
-    size_t end_idx = std::min<uint64_t>(size(), (idx64 + 1) * 64);
-    while (idx != end_idx) {
-      if (cur_val64 & 1) {
-        cur_count++;
-        if ((cur_count >> k_find_count_count_bits) != cur_shifted) {
-          cur_shifted++;
-          CHECK_EQ(cur_shifted, cur_count >> k_find_count_count_bits);
-          m_count_set_to_index[cur_shifted] = idx >> k_find_count_index_bits;
-
-          NOTE_TEST_COVERAGE(bitcount);
-        }
+  size_t accum_max = round_div(size(), 512);
+  size_t tot = total_bits();
+  size_t max_shifted = tot >> k_find_count_count_bits;
+  CHECK_LT(max_shifted + 1, num_entries);
+
+  index[0] = 0;
+  // Entry "shifted" points at the "accum" entry containing the
+  // (shifted << k_find_count_count_bits)th set bit, counting from 1.
+  // Each entry is written by exactly one accum entry, so we can fill
+  // them in parallel without scanning the bits themselves.
+  auto fill_range = [&](size_t start, size_t limit) {
+    for (size_t accum_idx = start; accum_idx != limit; ++accum_idx) {
+      size_t start_count = accum()[accum_idx];
+      size_t end_count = (accum_idx + 1 < accum_max) ? accum()[accum_idx + 1] : tot;
+      for (size_t shifted = (start_count >> k_find_count_count_bits) + 1;
+           (shifted << k_find_count_count_bits) <= end_count; ++shifted) {
+        NOTE_TEST_COVERAGE(bitcount);
+        index[shifted] = accum_idx;
       }
-      cur_val64 >>= 1;
-      idx++;
-    }
-    CHECK_EQ(cur_shifted, new_shifted);
-    if (idx < size()) {
-      NOTE_TEST_COVERAGE(bitcount);
-      CHECK_EQ(new_count, cur_count);
-      CHECK_EQ(0, cur_val64);
-    } else {
-      NOTE_TEST_COVERAGE(bitcount);
     }
+  };
+  size_t num_chunks = round_div(accum_max, k_select_index_chunk_size);
+  if (num_chunks > 1) {
+    parallel_for(0, num_chunks, [&](size_t chunk) {
+      fill_range(chunk * k_select_index_chunk_size,
+                 std::min(accum_max, (chunk + 1) * k_select_index_chunk_size));
+    });
+  } else {
+    fill_range(0, accum_max);
   }
-  CHECK_EQ(max_shifted, cur_shifted);
-  CHECK_EQ(total_bits(), cur_count);
+
+  std::fill(index + max_shifted + 1, index + num_entries, end_entry);
 }
 
 size_t bitcount::find_count(size_t target_count) const {
@@ -206,7 +287,7 @@ size_t bitcount::find_count(size_t target_count) const {
   size_t shifted = (target_count + 1) >> k_find_count_count_bits;
   size_t accum_max = round_div(size(), 512);
 
-  if (m_count_set_to_index.empty()) {
+  if (!has_find_count_index()) {
     accum_start = std::lower_bound(accum(), accum() + round_div(size(), 512),
                                    target_count + 1) -
                   accum();
@@ -221,8 +302,8 @@ size_t bitcount::find_count(size_t target_count) const {
     NOTE_TEST_COVERAGE_IF(bitcount, accum()[accum_start] == 0);
   } else {
     // Use index to find a much smaller range of accum to search.
-    accum_start = m_count_set_to_index[shifted];
-    // accum_end = m_count_set_to_index[shifted + 1] + 1;
+    accum_start = select_index()[shifted];
+    // accum_end = select_index()[shifted + 1] + 1;
     NOTE_TEST_COVERAGE_IF(bitcount, (size() & 511) != 0);
     NOTE_TEST_COVERAGE_IF(bitcount, (size() & 511) == 0);
   }
@@ -235,10 +316,10 @@ size_t bitcount::find_count(size_t target_count) const {
       NOTE_TEST_COVERAGE(bitcount);
       // Give up on the linear search, and fall back to binary search
       // which is much less friendly with respect to memory latency.
-      CHECK(!m_count_set_to_index.empty())
+      CHECK(has_find_count_index())
           << "Without a find count index, we should've already done a binary "
              "search.";
-      size_t accum_end = m_count_set_to_index[shifted + 1] + 1;
+      size_t accum_end = select_index()[shifted + 1] + 1;
       if (accum_end > accum_max) {
         accum_end = accum_max;
         NOTE_TEST_COVERAGE(bitcount);
@@ -282,7 +363,13 @@ size_t bitcount::find_count(size_t target_count) const {
              << " total bits = " << total_bits();
 }
 
+membuf_cachelist bitcount::ordered_membufs() const { return {m_bits, m_accum, m_subaccum}; }
+
 membuf_cachelist bitcount::membufs() const {
-  return {m_bits, m_accum, m_subaccum};
+  membuf_cachelist result = {m_bits, m_accum, m_subaccum};
+  if (has_find_count_index()) {
+    result += m_select_index;
+  }
+  return result;
 }
 
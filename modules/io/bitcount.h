@@ -5,20 +5,21 @@
 #include <stdlib.h>
 #include <boost/iterator/iterator_facade.hpp>
 #include "modules/io/progress.h"
+#include "modules/io/rank_select.h"
 #include "modules/io/spiral_file.h"
 
 // A utility class that acts as a bitvector, with special support
 // for counting the number of 1 bits from bit 0 to bit n, for any n
 // less than size.  Uses .25 bits of overhead for each bit
-class bitcount {
+class bitcount final : public rank_select_interface {
  public:
   static const product_version bitcount_version;
 
   // Compute memory usage based on size
   static size_t compute_size(size_t size);
 
-  size_t size() const { return m_nbits; }
-  uint64_t total_bits() const { return m_nbits ? count(m_nbits) : 0; }
+  size_t size() const override { return m_nbits; }
+  uint64_t total_bits() const override { return m_nbits ? count(m_nbits) : 0; }
 
   // Associate object with a buffer.   Takes a const buffer, but
   // actually allows it to be modified.  Deprecated.
@@ -45,14 +46,33 @@ class bitcount {
   size_t finalize(progress_handler_t = null_progress_handler);
 
   // Use bitcount
-  bool get(size_t i) const;      // get bit i
+  bool get(size_t i) const override;  // get bit i
   // Count the number of true (1) bits < i.
   // It is guaranteed that count(size()) == total_bits().
-  size_t count(size_t i) const;
+  size_t count(size_t i) const override;
 
-  // Given a count, look up the index that generates it.  Runs in log N time.
+  // Given a count, look up the index that generates it.  Runs in log N
+  // time, or in close to constant time if a select index is present
+  // (see make_find_count_index).
   // It is guaranteed that find_count(total_bits()) == size().
-  size_t find_count(size_t count) const;
+  size_t find_count(size_t count) const override;
+
+  // Scans forward from bit i a word at a time, so stepping through
+  // set bits doesn't need a find_count search per bit.
+  size_t next_set(size_t i) const override;
+
+  // Returns the bit index of the count-th set bit in val, counting
+  // from 0.  Uses PDEP if the CPU has a fast BMI2 implementation.
+  static unsigned select_bit(uint64_t val, unsigned count);
+  // Implementations of select_bit, exposed for testing and benchmarking.
+  static unsigned select_bit_portable(uint64_t val, unsigned count);
+  static unsigned select_bit_bmi2(uint64_t val, unsigned count);
+  // True if the CPU supports BMI2 at all.
+  static bool cpu_has_bmi2();
+  // True if select_bit should use PDEP.  AMD family 17h (Zen1/Zen2)
+  // implements PDEP in microcode, where it is much slower than the
+  // portable path, so it is excluded there.
+  static bool cpu_has_fast_pdep();
 
   // Iterators that make things look like a vector of totals, size + 1 big
   class total_iterator
@@ -87,10 +107,21 @@ class bitcount {
 
   // Generates an index of counts to indexes, which greatly increases
   // the performance of find_count with a small memory penalty.
+  //
+  // Bitcounts created through a spiral_file (or with the nbits
+  // constructor) build this index in parallel during finalize and
+  // save it as the optional "select_index" part, so opening them
+  // never needs to call this.  Does nothing if an index is already
+  // present.
   void make_find_count_index();
 
+  // Returns true if find_count has a select index available.
+  bool has_find_count_index() const { return m_select_index.size() != 0; }
+
   // Returns a list of membufs to cache if memory caching is requested.
-  membuf_cachelist membufs() const;
+  membuf_cachelist membufs() const override;
+  // The bits and counts; the select index is ordered by count instead.
+  membuf_cachelist ordered_membufs() const override;
 
  private:
   // Metadata for this bitcount for when serialized.
@@ -104,12 +135,32 @@ class bitcount {
     size_t nbits = 0;
   };
 
+  // Parameters the select index was built with.  If these don't match
+  // the current parameters, a saved select index is ignored.
+  struct select_index_metadata {
+    TRANSFER_OBJECT {
+      VERSION(0);
+      FIELD(count_bits, TF_STRICT);
+      FIELD(index_bits, TF_STRICT);
+    };
+
+    unsigned count_bits = 0;
+    unsigned index_bits = 0;
+  };
+
   // Storage for the actual bits
   static size_t bits_mem_size(size_t nbits);
   // Storage for subaccum
   static size_t subaccum_mem_size(size_t nbits);
   // Storage for accum, needs room 1 extra bit
   static size_t accum_mem_size(size_t nbits);
+  // Storage for the select index.  This is sized for the worst case
+  // of all bits set, since we don't know how many bits will be set
+  // until finalize.
+  static size_t select_index_mem_size(size_t nbits);
+
+  // Fills in the select index from accum.
+  void fill_select_index();
 
   // The number of bits
   size_t m_nbits = 0;
@@ -178,10 +229,22 @@ class bitcount {
       6 /* 2^6 = 64 bits in each entry in m_bits */
       + 3 /* 2^3 = 8 m_bits entries for each entry of "accum" */;
 
-  // Lookup table for find_count.  Maps from (count <<
-  // k_find_count_count_bits) to (index << k_find_count_index_bits).
-  // index >> k_find_count_index_bits:
-  std::vector<uint32_t> m_count_set_to_index;
+  // Number of "accum" entries to process in each parallel work item
+  // when building the select index.  Each entry only takes a few
+  // cycles, so chunks need to be large to be worth scheduling.
+  static constexpr size_t k_select_index_chunk_size = 1 << 16;
+
+  // Select index for find_count.  Maps from (count >>
+  // k_find_count_count_bits) to (index >> k_find_count_index_bits).
+  // Entries past the last count present point at the end.
+  membuf m_select_index;
+  mutable_membuf m_mutable_select_index;
+  const uint32_t* select_index() const {
+    return reinterpret_cast<const uint32_t*>(m_select_index.data());
+  }
+  uint32_t* mutable_select_index() {
+    return reinterpret_cast<uint32_t*>(m_mutable_select_index.mutable_data());
+  }
 };
 
 inline void bitcount::set(size_t i, bool v) {
@@ -215,6 +278,24 @@ inline bool bitcount::get(size_t i) const {
   return (bits()[i / 64] & (uint64_t(1) << (i & 63))) != 0;
 }
 
+inline size_t bitcount::next_set(size_t i) const {
+  DCHECK_LE(i, size());
+  if (i >= size()) {
+    return size();
+  }
+  size_t word = i / 64;
+  size_t nwords = (size() + 63) / 64;
+  uint64_t x = bits()[word] & (~uint64_t(0) << (i & 63));
+  while (!x) {
+    ++word;
+    if (word == nwords) {
+      return size();
+    }
+    x = bits()[word];
+  }
+  return std::min(size(), word * 64 + __builtin_ctzll(x));
+}
+
 inline size_t bitcount::count(size_t i) const {
 #if ADDRESS_SANITIZER
   // bitcount::count accesses uninitialized memory when calling
@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <iostream>
 #include <random>
+#include <vector>
 
 namespace {
 
@@ -127,12 +128,51 @@ BENCHMARK(BM_bitcount_find_count_with_index);
 static void BM_bitcount_make_find_count_index(benchmark::State& state) {
   init_bc();
 
-  bitcount bc(bcbuf, nbits);
   while (state.KeepRunning()) {
+    // make_find_count_index does nothing if there's already an index,
+    // so start with a fresh bitcount each time.
+    bitcount bc(bcbuf, nbits);
     bc.make_find_count_index();
   }
 }
-BENCHMARK(BM_bitcount_make_find_count_index);
+BENCHMARK(BM_bitcount_make_find_count_index)->Unit(benchmark::kMillisecond);
+
+std::vector<uint64_t> make_select_words() {
+  std::vector<uint64_t> words(1024);
+  for (uint64_t& word : words) {
+    word = random_source();
+    if (!word) {
+      word = 1;
+    }
+  }
+  return words;
+}
+
+template <unsigned (*select_f)(uint64_t, unsigned)>
+static void BM_bitcount_select_bit(benchmark::State& state) {
+  std::vector<uint64_t> words = make_select_words();
+  size_t i = 0;
+  unsigned result = 0;
+  while (state.KeepRunning()) {
+    uint64_t word = words[i & 1023];
+    // Chain each select on the previous result so we measure latency.
+    result = select_f(word, (i + result) % __builtin_popcountl(word));
+    ++i;
+  }
+  benchmark::DoNotOptimize(result);
+}
+
+BENCHMARK_TEMPLATE(BM_bitcount_select_bit, bitcount::select_bit_portable);
+BENCHMARK_TEMPLATE(BM_bitcount_select_bit, bitcount::select_bit);
+
+static void BM_bitcount_select_bit_bmi2(benchmark::State& state) {
+  if (!bitcount::cpu_has_bmi2()) {
+    state.SkipWithError("CPU does not support BMI2");
+    return;
+  }
+  BM_bitcount_select_bit<bitcount::select_bit_bmi2>(state);
+}
+BENCHMARK(BM_bitcount_select_bit_bmi2);
 
 static void BM_bitcount_finalize(benchmark::State& state) {
   init_bc();
@@ -21,6 +21,58 @@ TEST(bitcount, size) {
   EXPECT_EQ(31, __builtin_popcountl(x));
 }
 
+TEST(bitcount, select_bit) {
+  std::mt19937_64 random_source(1);
+  for (size_t i = 0; i < 10000; ++i) {
+    uint64_t val = random_source();
+    if (i & 1) {
+      // Sparse values, too.
+      val &= random_source() & random_source();
+    }
+    unsigned count = 0;
+    for (unsigned bit = 0; bit < 64; ++bit) {
+      if (!(val & (uint64_t(1) << bit))) {
+        continue;
+      }
+      EXPECT_EQ(bit, bitcount::select_bit_portable(val, count)) << val;
+      EXPECT_EQ(bit, bitcount::select_bit(val, count)) << val;
+      if (bitcount::cpu_has_bmi2()) {
+        EXPECT_EQ(bit, bitcount::select_bit_bmi2(val, count)) << val;
+      }
+      ++count;
+    }
+  }
+}
+
+TEST(bitcount, open_without_select_index) {
+  // Bitcounts saved before the select index existed should still open
+  // and fall back to searching "accum".
+  size_t bitcount_size = 5000;
+  spiral_file_create_mem c;
+  {
+    bitcount bc(c.create(), bitcount_size);
+    for (size_t i = 0; i < bitcount_size; i++) {
+      bc.set(i, (i % 7) == 0);
+    }
+    bc.finalize();
+  }
+  spiral_file_mem_storage storage = c.close();
+  EXPECT_EQ(1, storage.paths.erase("select_index"));
+  EXPECT_EQ(1, storage.paths.erase("select_index.json"));
+
+  spiral_file_open_mem o(storage);
+  bitcount bc(o.open());
+  EXPECT_FALSE(bc.has_find_count_index());
+  for (size_t i = 0; i < bc.total_bits(); i++) {
+    EXPECT_EQ(i * 7, bc.find_count(i)) << i;
+  }
+  bc.make_find_count_index();
+  EXPECT_TRUE(bc.has_find_count_index());
+  for (size_t i = 0; i < bc.total_bits(); i++) {
+    EXPECT_EQ(i * 7, bc.find_count(i)) << i;
+  }
+}
+
 class fake_bitcount {
  public:
   fake_bitcount(size_t size) : m_vec(size), m_tots(size + 1) {}
@@ -187,6 +239,28 @@ TEST_P(bitcount_test, find_count) {
   EXPECT_EQ(m_bc_ro->total_bits(), bitcount_size / 2);
 }
 
+TEST_P(bitcount_test, next_set) {
+  size_t bitcount_size = 1000;
+  create_bc(bitcount_size);
+  fake_bitcount bc2(bitcount_size);
+  for (size_t i = 0; i < bitcount_size; i++) {
+    // Leave some runs of more than a word empty.
+    bool x = (i % 300) < 150 && random() % 7 == 0;
+    m_bc->set(i, x);
+    bc2.set(i, x);
+  }
+  finalize_bc();
+
+  size_t expected = bitcount_size;
+  for (size_t i = bitcount_size; i > 0; --i) {
+    if (bc2.get(i - 1)) {
+      expected = i - 1;
+    }
+    EXPECT_EQ(expected, m_bc_ro->next_set(i - 1)) << i - 1;
+  }
+  EXPECT_EQ(bitcount_size, m_bc_ro->next_set(bitcount_size));
+}
+
 TEST_P(bitcount_test, find_count_with_index) {
   size_t bitcount_size = 1024;
   create_bc(bitcount_size);
@@ -207,6 +281,25 @@ TEST_P(bitcount_test, find_count_with_index) {
   EXPECT_EQ(m_bc_ro->total_bits(), bitcount_size / 2);
 }
 
+TEST_P(bitcount_test, select_index_saved) {
+  size_t bitcount_size = 100000;
+  create_bc(bitcount_size);
+  for (size_t i = 0; i < bitcount_size; i++) {
+    m_bc->set(i, (i % 3) == 0);
+  }
+  finalize_bc();
+
+  // Only bitcounts in spiral files keep a select index without being asked.
+  EXPECT_EQ(GetParam() == SPIRAL_FILE, m_bc_ro->has_find_count_index());
+  m_bc_ro->make_find_count_index();
+  EXPECT_TRUE(m_bc_ro->has_find_count_index());
+
+  for (size_t i = 0; i < m_bc_ro->total_bits(); i++) {
+    EXPECT_EQ(i * 3, m_bc_ro->find_count(i)) << i;
+  }
+  EXPECT_EQ(bitcount_size, m_bc_ro->find_count(m_bc_ro->total_bits()));
+}
+
 INSTANTIATE_TEST_CASE_P(old_style_buffer_tests, bitcount_test, ::testing::Values(OLD_STYLE_BUFFER));
 INSTANTIATE_TEST_CASE_P(spiral_file_tests, bitcount_test, ::testing::Values(SPIRAL_FILE));
 
@@ -231,7 +324,19 @@ TEST(bitcount_coverage_test, coverage) {
     size_t size = size_picker(random_source);
     std::uniform_int_distribution<size_t> stride_picker(0, 256);
 
-    bitcount bc(size);
+    // Bitcounts created with just a size build a select index during
+    // finalize; old style buffers only have one if requested.
+    bool old_style = bool_picker(random_source);
+    std::unique_ptr<char[]> buf;
+    std::unique_ptr<bitcount> bc_ptr;
+    if (old_style) {
+      buf.reset(new char[bitcount::compute_size(size)]);
+      bc_ptr.reset(new bitcount(buf.get(), size));
+      bc_ptr->init();
+    } else {
+      bc_ptr.reset(new bitcount(size));
+    }
+    bitcount& bc = *bc_ptr;
 
     size_t stride_left = stride_picker(random_source) * stride_picker(random_source);
     size_t pos = 0;
@@ -251,7 +356,8 @@ TEST(bitcount_coverage_test, coverage) {
       pos++;
     }
     bc.finalize();
-    if (bool_picker(random_source)) {
+    EXPECT_EQ(!old_style, bc.has_find_count_index());
+    if (old_style && bool_picker(random_source)) {
       bc.make_find_count_index();
     }
 
@@ -0,0 +1,256 @@
+#include "modules/io/elias_fano.h"
+#include "modules/io/bitcount.h"
+
+const product_version elias_fano::elias_fano_version{"1.0.0"};
+
+namespace {
+
+size_t round_div(size_t size, size_t div) { return (size + (div - 1)) / div; }
+
+}  // namespace
+
+unsigned elias_fano::low_bits_for(size_t universe, size_t count) {
+  if (count == 0 || universe <= count) {
+    return 0;
+  }
+  return 63 - __builtin_clzll(universe / count);
+}
+
+size_t elias_fano::low_words(size_t count, unsigned low_bits) {
+  // Pad by one word so we can always read two words at a time.
+  return round_div(count * low_bits, 64) + 1;
+}
+
+size_t elias_fano::high_words(size_t universe, size_t count, unsigned low_bits) {
+  // One set bit per value, and one clear bit after each bucket of
+  // high values, including a bucket for "universe" itself.
+  return round_div(count + (universe >> low_bits) + 1, 64);
+}
+
+size_t elias_fano::select1_words(size_t count) { return (count >> k_sample_bits) + 1; }
+
+size_t elias_fano::select0_words(size_t universe, unsigned low_bits) {
+  return (((universe >> low_bits) + 1) >> k_sample_bits) + 1;
+}
+
+size_t elias_fano::compute_size(size_t universe, size_t count) {
+  unsigned low_bits = low_bits_for(universe, count);
+  return (low_words(count, low_bits) + high_words(universe, count, low_bits) +
+          select1_words(count) + select0_words(universe, low_bits)) *
+         sizeof(uint64_t);
+}
+
+elias_fano::elias_fano(size_t universe, size_t count)
+    : m_universe(universe), m_count(count), m_low_bits(low_bits_for(universe, count)) {}
+
+elias_fano::elias_fano(const spiral_file_open_state& state) {
+  state.enforce_max_version("elias_fano", elias_fano_version);
+  ef_metadata md = state.open_json<ef_metadata>("elias_fano.json");
+  m_universe = md.universe;
+  m_count = md.count;
+  m_low_bits = md.low_bits;
+  CHECK_EQ(m_low_bits, low_bits_for(m_universe, m_count));
+  CHECK_EQ(md.sample_bits, k_sample_bits);
+
+  m_low = state.open_membuf("low");
+  CHECK_EQ(low_words(m_count, m_low_bits) * sizeof(uint64_t), m_low.size());
+  m_high = state.open_membuf("high");
+  CHECK_EQ(high_words(m_universe, m_count, m_low_bits) * sizeof(uint64_t), m_high.size());
+  m_select1 = state.open_membuf("select1");
+  CHECK_EQ(select1_words(m_count) * sizeof(uint64_t), m_select1.size());
+  m_select0 = state.open_membuf("select0");
+  CHECK_EQ(select0_words(m_universe, m_low_bits) * sizeof(uint64_t), m_select0.size());
+}
+
+uint64_t elias_fano::low(size_t idx) const {
+  if (!m_low_bits) {
+    return 0;
+  }
+  size_t bit = idx * m_low_bits;
+  size_t word = bit / 64;
+  unsigned offset = bit % 64;
+  uint64_t val = low_data()[word] >> offset;
+  if (offset + m_low_bits > 64) {
+    val |= low_data()[word + 1] << (64 - offset);
+  }
+  return val & ((uint64_t(1) << m_low_bits) - 1);
+}
+
+size_t elias_fano::select1(size_t idx) const {
+  DCHECK_LT(idx, m_count);
+  size_t pos = select1_samples()[idx >> k_sample_bits];
+  size_t remaining = idx & ((size_t(1) << k_sample_bits) - 1);
+  size_t word_idx = pos / 64;
+  uint64_t word = high()[word_idx] & (~uint64_t(0) << (pos % 64));
+  for (;;) {
+    size_t ones = __builtin_popcountll(word);
+    if (remaining < ones) {
+      return word_idx * 64 + bitcount::select_bit(word, remaining);
+    }
+    remaining -= ones;
+    word = high()[++word_idx];
+  }
+}
+
+size_t elias_fano::select0(size_t idx) const {
+  size_t pos = select0_samples()[idx >> k_sample_bits];
+  size_t remaining = idx & ((size_t(1) << k_sample_bits) - 1);
+  size_t word_idx = pos / 64;
+  uint64_t word = ~high()[word_idx] & (~uint64_t(0) << (pos % 64));
+  for (;;) {
+    size_t zeros = __builtin_popcountll(word);
+    if (remaining < zeros) {
+      return word_idx * 64 + bitcount::select_bit(word, remaining);
+    }
+    remaining -= zeros;
+    word = ~high()[++word_idx];
+  }
+}
+
+size_t elias_fano::lower_bound(size_t val, bool* found) const {
+  DCHECK_LE(val, m_universe);
+  size_t bucket = val >> m_low_bits;
+  uint64_t low_val = val & ((uint64_t(1) << m_low_bits) - 1);
+
+  // Values in earlier buckets are all less than val.
+  size_t idx = 0;
+  size_t pos = 0;
+  if (bucket) {
+    pos = select0(bucket - 1);
+    idx = pos - (bucket - 1);
+    ++pos;
+  }
+
+  // Scan this bucket.  Buckets are sized so that they average less
+  // than 2 values each.
+  while (high_bit(pos)) {
+    uint64_t cur_low = low(idx);
+    if (cur_low >= low_val) {
+      *found = (cur_low == low_val);
+      return idx;
+    }
+    ++idx;
+    ++pos;
+  }
+  *found = false;
+  return idx;
+}
+
+bool elias_fano::get(size_t i) const {
+  DCHECK_LT(i, m_universe);
+  bool found;
+  lower_bound(i, &found);
+  return found;
+}
+
+size_t elias_fano::count(size_t i) const {
+  if (i == m_universe) {
+    return m_count;
+  }
+  bool found;
+  return lower_bound(i, &found);
+}
+
+size_t elias_fano::find_count(size_t count) const {
+  if (count == m_count) {
+    return m_universe;
+  }
+  DCHECK_LT(count, m_count);
+  size_t high_val = select1(count) - count;
+  return (high_val << m_low_bits) | low(count);
+}
+
+membuf_cachelist elias_fano::membufs() const { return {m_low, m_high, m_select1, m_select0}; }
+
+elias_fano_builder::elias_fano_builder(const spiral_file_create_state& state, size_t universe,
+                                       size_t count) {
+  m_ef.reset(new elias_fano(universe, count));
+  unsigned low_bits = m_ef->m_low_bits;
+
+  state.set_version("elias_fano", elias_fano::elias_fano_version);
+  elias_fano::ef_metadata md;
+  md.universe = universe;
+  md.count = count;
+  md.low_bits = low_bits;
+  md.sample_bits = elias_fano::k_sample_bits;
+  state.create_json<elias_fano::ef_metadata>("elias_fano.json", md);
+
+  m_ef->m_low = m_low =
+      state.create_membuf("low", elias_fano::low_words(count, low_bits) * sizeof(uint64_t));
+  m_ef->m_high = m_high = state.create_membuf(
+      "high", elias_fano::high_words(universe, count, low_bits) * sizeof(uint64_t));
+  m_ef->m_select1 = m_select1 =
+      state.create_membuf("select1", elias_fano::select1_words(count) * sizeof(uint64_t));
+  m_ef->m_select0 = m_select0 = state.create_membuf(
+      "select0", elias_fano::select0_words(universe, low_bits) * sizeof(uint64_t));
+}
+
+void elias_fano_builder::add(uint64_t value) {
+  CHECK(m_ef);
+  CHECK_LT(m_added, m_ef->m_count);
+  CHECK_LT(value, m_ef->m_universe);
+  if (m_added) {
+    CHECK_GT(value, m_last_value) << "Values must be strictly increasing";
+  }
+  m_last_value = value;
+
+  unsigned low_bits = m_ef->m_low_bits;
+  uint64_t* low = reinterpret_cast<uint64_t*>(m_low.mutable_data());
+  uint64_t* high = reinterpret_cast<uint64_t*>(m_high.mutable_data());
+
+  if (low_bits) {
+    uint64_t low_val = value & ((uint64_t(1) << low_bits) - 1);
+    size_t bit = m_added * low_bits;
+    size_t word = bit / 64;
+    unsigned offset = bit % 64;
+    low[word] |= low_val << offset;
+    if (offset + low_bits > 64) {
+      low[word + 1] |= low_val >> (64 - offset);
+    }
+  }
+
+  size_t high_pos = (value >> low_bits) + m_added;
+  high[high_pos / 64] |= uint64_t(1) << (high_pos % 64);
+  ++m_added;
+}
+
+std::unique_ptr<elias_fano> elias_fano_builder::finalize() {
+  CHECK(m_ef);
+  CHECK_EQ(m_added, m_ef->m_count);
+
+  // Sample positions of set and clear bits.
+  const uint64_t* high = reinterpret_cast<const uint64_t*>(m_high.data());
+  uint64_t* select1 = reinterpret_cast<uint64_t*>(m_select1.mutable_data());
+  uint64_t* select0 = reinterpret_cast<uint64_t*>(m_select0.mutable_data());
+  constexpr size_t k_sample_mask = (size_t(1) << elias_fano::k_sample_bits) - 1;
+
+  size_t high_size = m_ef->m_count + (m_ef->m_universe >> m_ef->m_low_bits) + 1;
+  size_t ones = 0;
+  size_t zeros = 0;
+  for (size_t word_idx = 0; word_idx * 64 < high_size; ++word_idx) {
+    uint64_t word = high[word_idx];
+    uint64_t zero_word = ~word;
+    if (high_size - word_idx * 64 < 64) {
+      zero_word &= (uint64_t(1) << (high_size - word_idx * 64)) - 1;
+    }
+    size_t word_ones = __builtin_popcountll(word);
+    size_t word_zeros = __builtin_popcountll(zero_word);
+
+    for (size_t sample = (ones + k_sample_mask) & ~k_sample_mask; sample < ones + word_ones;
+         sample += k_sample_mask + 1) {
+      select1[sample >> elias_fano::k_sample_bits] =
+          word_idx * 64 + bitcount::select_bit(word, sample - ones);
+    }
+    for (size_t sample = (zeros + k_sample_mask) & ~k_sample_mask; sample < zeros + word_zeros;
+         sample += k_sample_mask + 1) {
+      select0[sample >> elias_fano::k_sample_bits] =
+          word_idx * 64 + bitcount::select_bit(zero_word, sample - zeros);
+    }
+    ones += word_ones;
+    zeros += word_zeros;
+  }
+  CHECK_EQ(ones, m_ef->m_count);
+  CHECK_EQ(zeros, (m_ef->m_universe >> m_ef->m_low_bits) + 1);
+
+  return std::move(m_ef);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+// Elias-Fano encoding of a sorted set of integers in [0, universe).
+//
+// Each value is split into "low" bits, which are stored verbatim in a
+// packed array, and "high" bits, which are stored in unary as a
+// bitvector with one set bit per value and one clear bit per bucket
+// of high values.  This takes about 2 + log2(universe / count) bits
+// per value, which is much smaller than a bitcount when the set is
+// sparse.  When the set is dense (more than about 1/4 of the
+// universe), a bitcount is smaller.
+//
+// Sampled positions of every 2^k_sample_bits'th set and clear bit in
+// the high bitvector let lookups go straight to the right cache line
+// instead of searching.
+
+#include "modules/io/rank_select.h"
+#include "modules/io/spiral_file.h"
+#include "modules/io/transfer_object.h"
+#include "modules/io/version.h"
+
+class elias_fano final : public rank_select_interface {
+ public:
+  static const product_version elias_fano_version;
+
+  // Returns the amount of storage needed to hold "count" values less
+  // than "universe".
+  static size_t compute_size(size_t universe, size_t count);
+
+  // Reads an existing set, as saved by elias_fano_builder.
+  elias_fano(const spiral_file_open_state& state);
+
+  size_t size() const override { return m_universe; }
+  uint64_t total_bits() const override { return m_count; }
+
+  // Returns true if the value i is in the set.
+  bool get(size_t i) const override;
+  // Returns the number of values < i.
+  size_t count(size_t i) const override;
+  // Returns the value with the given index in sorted order.
+  size_t find_count(size_t count) const override;
+
+  membuf_cachelist membufs() const override;
+
+ private:
+  friend class elias_fano_builder;
+
+  struct ef_metadata {
+    TRANSFER_OBJECT {
+      VERSION(0);
+      FIELD(universe, TF_STRICT);
+      FIELD(count, TF_STRICT);
+      FIELD(low_bits, TF_STRICT);
+      FIELD(sample_bits, TF_STRICT);
+    };
+
+    size_t universe = 0;
+    size_t count = 0;
+    unsigned low_bits = 0;
+    unsigned sample_bits = 0;
+  };
+
+  // Sample every 2^k_sample_bits set and clear bits in the high
+  // bitvector.  With a value of 8, the samples take 1/2 bit per
+  // value, and finishing a lookup from a sample scans an average of 8
+  // words.
+  static constexpr unsigned k_sample_bits = 8;
+
+  elias_fano(size_t universe, size_t count);
+
+  // Sizes, in uint64_t words.
+  static unsigned low_bits_for(size_t universe, size_t count);
+  static size_t low_words(size_t count, unsigned low_bits);
+  static size_t high_words(size_t universe, size_t count, unsigned low_bits);
+  static size_t select1_words(size_t count);
+  static size_t select0_words(size_t universe, unsigned low_bits);
+
+  uint64_t low(size_t idx) const;
+  bool high_bit(size_t pos) const { return (high()[pos / 64] >> (pos % 64)) & 1; }
+  // Returns the position of the idx'th set bit in the high bitvector.
+  size_t select1(size_t idx) const;
+  // Returns the position of the idx'th clear bit in the high bitvector.
+  size_t select0(size_t idx) const;
+  // Returns the index of the first value >= "val", and whether that
+  // value is equal to "val".
+  size_t lower_bound(size_t val, bool* found) const;
+
+  size_t m_universe = 0;
+  size_t m_count = 0;
+  unsigned m_low_bits = 0;
+
+  membuf m_low;
+  membuf m_high;
+  membuf m_select1;
+  membuf m_select0;
+
+  const uint64_t* low_data() const { return reinterpret_cast<const uint64_t*>(m_low.data()); }
+  const uint64_t* high() const { return reinterpret_cast<const uint64_t*>(m_high.data()); }
+  const uint64_t* select1_samples() const {
+    return reinterpret_cast<const uint64_t*>(m_select1.data());
+  }
+  const uint64_t* select0_samples() const {
+    return reinterpret_cast<const uint64_t*>(m_select0.data());
+  }
+};
+
+class elias_fano_builder {
+ public:
+  // Starts building a set of exactly "count" values, all less than
+  // "universe".
+  elias_fano_builder(const spiral_file_create_state& state, size_t universe, size_t count);
+
+  // Adds the next value.  Values must be strictly increasing.
+  void add(uint64_t value);
+
+  // Finishes building and returns a read-only version.
+  std::unique_ptr<elias_fano> finalize();
+
+ private:
+  std::unique_ptr<elias_fano> m_ef;
+  mutable_membuf m_low;
+  mutable_membuf m_high;
+  mutable_membuf m_select1;
+  mutable_membuf m_select0;
+
+  size_t m_added = 0;
+  uint64_t m_last_value = 0;
+};
@@ -0,0 +1,122 @@
+#include "modules/io/elias_fano.h"
+#include "modules/io/bitcount.h"
+#include "modules/io/spiral_file_mem.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+using namespace testing;
+
+namespace {
+
+struct ef_test_case {
+  size_t universe;
+  size_t count;
+};
+
+std::ostream& operator<<(std::ostream& os, const ef_test_case& tc) {
+  return os << "universe=" << tc.universe << " count=" << tc.count;
+}
+
+}  // namespace
+
+class elias_fano_test : public TestWithParam<ef_test_case> {
+ protected:
+  void SetUp() override {
+    std::mt19937_64 rand_source(GetParam().universe * 31 + GetParam().count);
+    std::set<uint64_t> vals;
+    if (GetParam().count == GetParam().universe) {
+      for (size_t i = 0; i < GetParam().universe; ++i) {
+        vals.insert(i);
+      }
+    } else {
+      std::uniform_int_distribution<uint64_t> pick(0, GetParam().universe - 1);
+      while (vals.size() < GetParam().count) {
+        vals.insert(pick(rand_source));
+      }
+    }
+    m_expected.assign(vals.begin(), vals.end());
+
+    spiral_file_create_mem c;
+    {
+      elias_fano_builder b(c.create(), GetParam().universe, m_expected.size());
+      for (uint64_t val : m_expected) {
+        b.add(val);
+      }
+      std::unique_ptr<elias_fano> built = b.finalize();
+      check(*built);
+    }
+    m_storage = c.close();
+  }
+
+  void check(const elias_fano& ef) {
+    ASSERT_EQ(GetParam().universe, ef.size());
+    ASSERT_EQ(m_expected.size(), ef.total_bits());
+    for (size_t i = 0; i < m_expected.size(); ++i) {
+      EXPECT_EQ(m_expected[i], ef.find_count(i)) << i;
+    }
+    EXPECT_EQ(ef.size(), ef.find_count(ef.total_bits()));
+
+    // Check count and get everywhere near a value, and at random
+    // places elsewhere.
+    std::set<uint64_t> to_check;
+    for (uint64_t val : m_expected) {
+      for (uint64_t near = (val > 2 ? val - 2 : 0); near <= val + 2; ++near) {
+        to_check.insert(near);
+      }
+    }
+    std::mt19937_64 rand_source(1);
+    std::uniform_int_distribution<uint64_t> pick(0, GetParam().universe);
+    for (size_t i = 0; i < 1000; ++i) {
+      to_check.insert(pick(rand_source));
+    }
+    to_check.insert(0);
+    to_check.insert(GetParam().universe);
+    for (uint64_t pos : to_check) {
+      if (pos > ef.size()) {
+        continue;
+      }
+      size_t expected_count =
+          std::lower_bound(m_expected.begin(), m_expected.end(), pos) - m_expected.begin();
+      EXPECT_EQ(expected_count, ef.count(pos)) << pos;
+      if (pos < ef.size()) {
+        bool expected_get = std::binary_search(m_expected.begin(), m_expected.end(), pos);
+        EXPECT_EQ(expected_get, ef.get(pos)) << pos;
+      }
+    }
+  }
+
+  std::vector<uint64_t> m_expected;
+  spiral_file_mem_storage m_storage;
+};
+
+TEST_P(elias_fano_test, round_trip) {
+  spiral_file_open_mem o(m_storage);
+  elias_fano ef(o.open());
+  check(ef);
+}
+
+INSTANTIATE_TEST_CASE_P(elias_fano_tests, elias_fano_test,
+                        ::testing::Values(ef_test_case{1, 0}, ef_test_case{1, 1},
+                                          ef_test_case{1000, 0}, ef_test_case{1000, 1},
+                                          ef_test_case{1000, 1000}, ef_test_case{1000, 999},
+                                          ef_test_case{1000, 500}, ef_test_case{100000, 300},
+                                          ef_test_case{100000, 3000},
+                                          ef_test_case{uint64_t(1) << 40, 1000},
+                                          ef_test_case{(uint64_t(1) << 40) + 12345, 7}));
+
+TEST(elias_fano, smaller_than_bitcount_when_sparse) {
+  size_t universe = 1000000000;
+  EXPECT_LT(elias_fano::compute_size(universe, universe / 16), bitcount::compute_size(universe));
+  EXPECT_GT(elias_fano::compute_size(universe, universe / 2), bitcount::compute_size(universe));
+}
+
+TEST(elias_fano, values_must_increase) {
+  spiral_file_create_mem c;
+  elias_fano_builder b(c.create(), 100, 2);
+  b.add(5);
+  EXPECT_DEATH(b.add(5), "strictly increasing");
+}
@@ -84,138 +84,371 @@ std::unique_ptr<int_map_interface> int_map_interface::detect_subpart_or_uint16_m
   return detect_subpart(parent_state.open_subpart(subpart_name));
 }
 
+namespace {
+
+const product_version k_less_than_search_version{"1.1.0"};
+
+struct less_than_search_metadata {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(size, TF_STRICT);
+    FIELD(num_levels, TF_STRICT);
+  };
+
+  size_t size = 0;
+  size_t num_levels = 0;
+};
+
+constexpr size_t k_none = std::numeric_limits<size_t>::max();
+
+// Summaries are saturated to fit in a byte.  A saturated summary is
+// still a lower bound on the values it covers, so a summary >=
+// max_val always means the whole range can be skipped.
+uint8_t saturate(uint64_t val) {
+  return std::min<uint64_t>(val, std::numeric_limits<uint8_t>::max());
+}
+
+size_t num_blocks(size_t size, size_t factor) { return (size + (factor - 1)) / factor; }
+
+}  // namespace
+
 struct less_than_search::impl_t {
+  // Values per block.
   static constexpr size_t k_factor1 = 64;
+  // Blocks per superblock.
   static constexpr size_t k_factor2 = 64;
 
-  impl_t(size_t num_mins, size_t max_value);
-  void fill(less_than_search* lt, const int_map_interface* vals);
+  impl_t(size_t num_blocks, size_t num_superblocks);
+
+  void create(const std::function<mutable_membuf(const std::string&, size_t)>& create_membuf);
+  void open(const spiral_file_open_state& state);
+  void set_data();
+
+  size_t sparse_size() const { return num_levels * num_superblocks; }
+
+  uint8_t block_min(size_t block) const { return block_min_data[block]; }
+  // Minimum of superblocks [superblock, superblock + 2^level), truncated to
+  // the number of superblocks.
+  uint8_t sparse(size_t level, size_t superblock) const {
+    return sparse_data[level * num_superblocks + superblock];
+  }
+
+  size_t num_blocks = 0;
+  size_t num_superblocks = 0;
+  size_t num_levels = 0;
+
+  mutable_membuf mutable_block_mins;
+  mutable_membuf mutable_sparse;
 
-  mutable_packed_varbit_vector min_vals;
+  membuf block_mins;
+  membuf sparse_mins;
+
+  const uint8_t* block_min_data = nullptr;
+  const uint8_t* sparse_data = nullptr;
 };
 
 constexpr size_t less_than_search::impl_t::k_factor1;
 constexpr size_t less_than_search::impl_t::k_factor2;
 
-less_than_search::impl_t::impl_t(size_t num_mins, size_t max_value)
-    : min_vals(num_mins, max_value, "less_than_search") {}
+less_than_search::impl_t::impl_t(size_t blocks, size_t superblocks)
+    : num_blocks(blocks), num_superblocks(superblocks) {
+  while ((size_t(1) << num_levels) <= num_superblocks) {
+    ++num_levels;
+  }
+}
 
-void less_than_search::impl_t::fill(less_than_search* lt, const int_map_interface* vals) {
-  parallel_for(0, lt->m_num_factor2, [this, lt, vals](size_t start, size_t limit) {
-    for (size_t f2_pos = start; f2_pos != limit; ++f2_pos) {
-      size_t f1_limit = (f2_pos + 1) * k_factor2;
-      if (f1_limit > lt->m_num_factor1) {
-        f1_limit = lt->m_num_factor1;
-      }
-      size_t f2_min = std::numeric_limits<size_t>::max();
-      for (size_t f1_pos = f2_pos * k_factor2; f1_pos != f1_limit; ++f1_pos) {
-        size_t pos_limit = (f1_pos + 1) * k_factor1;
-        if (pos_limit > lt->m_size) {
-          pos_limit = lt->m_size;
-        }
-        size_t f1_min = std::numeric_limits<size_t>::max();
-        for (size_t pos = f1_pos * k_factor1; pos != pos_limit; ++pos) {
-          f1_min = std::min(f1_min, vals->get(pos));
+void less_than_search::impl_t::create(
+    const std::function<mutable_membuf(const std::string&, size_t)>& create_membuf) {
+  block_mins = mutable_block_mins = create_membuf("block_mins", num_blocks);
+  sparse_mins = mutable_sparse = create_membuf("sparse_mins", sparse_size());
+  set_data();
+}
+
+void less_than_search::impl_t::open(const spiral_file_open_state& state) {
+  block_mins = state.open_membuf("block_mins");
+  CHECK_EQ(num_blocks, block_mins.size());
+  sparse_mins = state.open_membuf("sparse_mins");
+  CHECK_EQ(sparse_size(), sparse_mins.size());
+  set_data();
+}
+
+void less_than_search::impl_t::set_data() {
+  block_min_data = reinterpret_cast<const uint8_t*>(block_mins.data());
+  sparse_data = reinterpret_cast<const uint8_t*>(sparse_mins.data());
+}
+
+less_than_search::less_than_search(const int_map_interface* vals)
+    : m_vals(vals),
+      m_size(vals->size()),
+      m_num_factor1(num_blocks(m_size, impl_t::k_factor1)),
+      m_num_factor2(num_blocks(m_num_factor1, impl_t::k_factor2)),
+      m_impl(make_unique<impl_t>(m_num_factor1, m_num_factor2)) {
+  m_impl->create([](const std::string& name, size_t size) {
+    return mutable_membuf(new owned_membuf(size, "less_than_search:" + name));
+  });
+  fill();
+}
+
+less_than_search::less_than_search(const int_map_interface* vals,
+                                   const spiral_file_create_state& state)
+    : m_vals(vals),
+      m_size(vals->size()),
+      m_num_factor1(num_blocks(m_size, impl_t::k_factor1)),
+      m_num_factor2(num_blocks(m_num_factor1, impl_t::k_factor2)),
+      m_impl(make_unique<impl_t>(m_num_factor1, m_num_factor2)) {
+  state.set_version("less_than_search", k_less_than_search_version);
+  less_than_search_metadata metadata;
+  metadata.size = m_size;
+  metadata.num_levels = m_impl->num_levels;
+  state.create_json<less_than_search_metadata>("less_than_search.json", metadata);
+  m_impl->create([&state](const std::string& name, size_t size) {
+    return state.create_membuf(name, size, state.options().with_delayed_write(true));
+  });
+  fill();
+}
+
+less_than_search::less_than_search(const int_map_interface* vals,
+                                   const spiral_file_open_state& state)
+    : m_vals(vals),
+      m_size(vals->size()),
+      m_num_factor1(num_blocks(m_size, impl_t::k_factor1)),
+      m_num_factor2(num_blocks(m_num_factor1, impl_t::k_factor2)),
+      m_impl(make_unique<impl_t>(m_num_factor1, m_num_factor2)) {
+  state.enforce_max_version("less_than_search", k_less_than_search_version);
+  auto metadata = state.open_json<less_than_search_metadata>("less_than_search.json");
+  CHECK_EQ(m_size, metadata.size) << "Saved less than search does not match values";
+  CHECK_EQ(m_impl->num_levels, metadata.num_levels);
+  m_impl->open(state);
+}
+
+less_than_search::~less_than_search() {}
+
+void less_than_search::fill() {
+  uint8_t* block_mins = reinterpret_cast<uint8_t*>(m_impl->mutable_block_mins.mutable_data());
+  uint8_t* sparse = reinterpret_cast<uint8_t*>(m_impl->mutable_sparse.mutable_data());
+
+  parallel_for(0, m_num_factor2, [&](size_t start, size_t limit) {
+    for (size_t superblock = start; superblock != limit; ++superblock) {
+      size_t block_limit = std::min((superblock + 1) * impl_t::k_factor2, m_num_factor1);
+      uint8_t superblock_min = std::numeric_limits<uint8_t>::max();
+      for (size_t block = superblock * impl_t::k_factor2; block != block_limit; ++block) {
+        uint8_t block_min = std::numeric_limits<uint8_t>::max();
+        size_t pos_limit = std::min((block + 1) * impl_t::k_factor1, m_size);
+        for (size_t pos = block * impl_t::k_factor1; pos < pos_limit; ++pos) {
+          block_min = std::min(block_min, saturate(m_vals->get(pos)));
         }
-        min_vals.set(f1_pos, f1_min);
-        f2_min = std::min(f1_min, f2_min);
+        block_mins[block] = block_min;
+        superblock_min = std::min(superblock_min, block_min);
       }
-      min_vals.set(lt->m_num_factor1 + f2_pos, f2_min);
+      sparse[superblock] = superblock_min;
     }
   });
-}
 
-size_t less_than_search::next_forward_lt(size_t start_pos, size_t max_val) const {
-  CHECK_LT(start_pos, m_size);
-  size_t pos = start_pos;
-  if (m_vals->get(pos) < max_val) {
-    return pos;
+  for (size_t level = 1; level < m_impl->num_levels; ++level) {
+    const uint8_t* prev = sparse + (level - 1) * m_num_factor2;
+    uint8_t* cur = sparse + level * m_num_factor2;
+    size_t half = size_t(1) << (level - 1);
+    parallel_for(0, m_num_factor2, [&](size_t start, size_t limit) {
+      for (size_t superblock = start; superblock != limit; ++superblock) {
+        cur[superblock] = prev[superblock];
+        if (superblock + half < m_num_factor2) {
+          cur[superblock] = std::min(cur[superblock], prev[superblock + half]);
+        }
+      }
+    });
   }
-  while (pos < m_size) {
-    ++pos;
-    if (pos == m_size) {
+
+  m_impl->mutable_block_mins = mutable_membuf();
+  m_impl->mutable_sparse = mutable_membuf();
+}
+
+// Returns the first position >= pos in the given block with a value
+// less than max_val, or k_none.
+size_t less_than_search::forward_in_block(size_t block, size_t pos, size_t max_val) const {
+  size_t limit = std::min((block + 1) * impl_t::k_factor1, m_size);
+  for (; pos < limit; ++pos) {
+    if (m_vals->get(pos) < max_val) {
       return pos;
     }
-    if ((pos % impl_t::k_factor1) == 0) {
-      size_t f1_pos = pos / impl_t::k_factor1;
-      if ((f1_pos % impl_t::k_factor2) == 0) {
-        size_t f2_pos = f1_pos / impl_t::k_factor2;
-
-        if (get_f2(f2_pos) >= max_val) {
-          pos = (f2_pos + 1) * impl_t::k_factor1 * impl_t::k_factor2 - 1;
-          if (pos >= m_size) {
-            return m_size;
-          }
-          continue;
-        }
-      }
+  }
+  return k_none;
+}
 
-      if (get_f1(f1_pos) >= max_val) {
-        pos = (f1_pos + 1) * impl_t::k_factor1 - 1;
-        if (pos >= m_size) {
-          return m_size;
-        }
-        continue;
+// Searches blocks starting at the given block until the end of the
+// given superblock.
+size_t less_than_search::forward_in_superblock(size_t superblock, size_t block,
+                                               size_t max_val) const {
+  size_t block_limit = std::min((superblock + 1) * impl_t::k_factor2, m_num_factor1);
+  for (; block < block_limit; ++block) {
+    if (m_impl->block_min(block) < max_val) {
+      size_t found = forward_in_block(block, block * impl_t::k_factor1, max_val);
+      if (found != k_none) {
+        return found;
       }
     }
-    if (m_vals->get(pos) < max_val) {
-      return pos;
+  }
+  return k_none;
+}
+
+// Returns the first superblock >= the given one whose summary is less
+// than max_val, or k_none.  Gallops forward through the sparse table
+// and then narrows down, so the cost is logarithmic in the distance.
+size_t less_than_search::forward_superblock(size_t superblock, size_t max_val) const {
+  if (superblock >= m_num_factor2) {
+    return k_none;
+  }
+  size_t level = 0;
+  while (m_impl->sparse(level, superblock) >= max_val) {
+    superblock += size_t(1) << level;
+    if (superblock >= m_num_factor2) {
+      return k_none;
+    }
+    if (level + 1 < m_impl->num_levels) {
+      ++level;
     }
   }
-  return pos;
+  while (level > 0) {
+    --level;
+    if (m_impl->sparse(level, superblock) >= max_val) {
+      superblock += size_t(1) << level;
+    }
+  }
+  DCHECK_LT(superblock, m_num_factor2);
+  return superblock;
 }
 
-size_t less_than_search::next_backward_lt(size_t start_pos, size_t max_val) const {
+size_t less_than_search::next_forward_lt(size_t start_pos, size_t max_val) const {
   CHECK_LT(start_pos, m_size);
-  size_t pos = start_pos;
-  if (m_vals->get(pos) < max_val) {
-    return pos;
-  }
-  while (pos > 0) {
-    --pos;
-    if ((pos % impl_t::k_factor1) == (impl_t::k_factor1 - 1)) {
-      size_t f1_pos = pos / impl_t::k_factor1;
-      if ((f1_pos % impl_t::k_factor2) == (impl_t::k_factor2 - 1)) {
-        size_t f2_pos = f1_pos / impl_t::k_factor2;
-
-        if (get_f2(f2_pos) >= max_val) {
-          pos = f2_pos * impl_t::k_factor1 * impl_t::k_factor2;
-          continue;
-        }
-      }
+  if (m_vals->get(start_pos) < max_val) {
+    return start_pos;
+  }
 
-      if (get_f1(f1_pos) >= max_val) {
-        pos = f1_pos * impl_t::k_factor1;
-        continue;
-      }
+  size_t block = start_pos / impl_t::k_factor1;
+  size_t found = forward_in_block(block, start_pos + 1, max_val);
+  if (found != k_none) {
+    return found;
+  }
+
+  size_t superblock = block / impl_t::k_factor2;
+  found = forward_in_superblock(superblock, block + 1, max_val);
+  if (found != k_none) {
+    return found;
+  }
+
+  for (;;) {
+    superblock = forward_superblock(superblock + 1, max_val);
+    if (superblock == k_none) {
+      return m_size;
     }
-    if (m_vals->get(pos) < max_val) {
-      return pos;
+    found = forward_in_superblock(superblock, superblock * impl_t::k_factor2, max_val);
+    if (found != k_none) {
+      return found;
     }
+    // Only saturated summaries get here.
   }
-  return pos;
 }
 
-less_than_search::less_than_search(const int_map_interface* vals)
-    : m_vals(vals),
-      m_size(vals->size()),
-      m_num_factor1((m_size + (impl_t::k_factor1 - 1)) / impl_t::k_factor1),
-      m_num_factor2((m_num_factor1 + (impl_t::k_factor2 - 1)) / impl_t::k_factor2),
-      m_impl(make_unique<impl_t>(m_num_factor1 + m_num_factor2, vals->max_value())) {
-  m_impl->fill(this, vals);
+// Returns the last position <= pos in the given block with a value
+// less than max_val, or k_none.
+size_t less_than_search::backward_in_block(size_t block, size_t pos, size_t max_val) const {
+  size_t first = block * impl_t::k_factor1;
+  for (size_t i = pos + 1; i != first; --i) {
+    if (m_vals->get(i - 1) < max_val) {
+      return i - 1;
+    }
+  }
+  return k_none;
 }
 
-less_than_search::~less_than_search() {}
+// Searches blocks from just before the given block back to the start
+// of the given superblock.
+size_t less_than_search::backward_in_superblock(size_t superblock, size_t block,
+                                                size_t max_val) const {
+  size_t first_block = superblock * impl_t::k_factor2;
+  for (; block != first_block; --block) {
+    if (m_impl->block_min(block - 1) < max_val) {
+      size_t last_pos = std::min(block * impl_t::k_factor1, m_size) - 1;
+      size_t found = backward_in_block(block - 1, last_pos, max_val);
+      if (found != k_none) {
+        return found;
+      }
+    }
+  }
+  return k_none;
+}
+
+// Returns the last superblock <= the given one whose summary is less
+// than max_val, or k_none.
+size_t less_than_search::backward_superblock(size_t superblock, size_t max_val) const {
+  size_t level = 0;
+  for (;;) {
+    size_t width = size_t(1) << level;
+    if (m_impl->sparse(level, superblock + 1 - width) < max_val) {
+      break;
+    }
+    if (superblock < width) {
+      return k_none;
+    }
+    superblock -= width;
+    if (level + 1 < m_impl->num_levels && (width << 1) <= superblock + 1) {
+      ++level;
+    }
+    while ((size_t(1) << level) > superblock + 1) {
+      --level;
+    }
+  }
+  while (level > 0) {
+    --level;
+    size_t width = size_t(1) << level;
+    if (m_impl->sparse(level, superblock + 1 - width) >= max_val) {
+      superblock -= width;
+    }
+  }
+  return superblock;
+}
+
+size_t less_than_search::next_backward_lt(size_t start_pos, size_t max_val) const {
+  CHECK_LT(start_pos, m_size);
+  if (m_vals->get(start_pos) < max_val) {
+    return start_pos;
+  }
+  if (start_pos == 0) {
+    return 0;
+  }
+
+  size_t pos = start_pos - 1;
+  size_t block = pos / impl_t::k_factor1;
+  size_t found = backward_in_block(block, pos, max_val);
+  if (found != k_none) {
+    return found;
+  }
+
+  size_t superblock = block / impl_t::k_factor2;
+  found = backward_in_superblock(superblock, block, max_val);
+  if (found != k_none) {
+    return found;
+  }
 
-size_t less_than_search::get_f1(size_t pos) const {
-  CHECK_LT(pos, m_num_factor1);
-  return m_impl->min_vals.get(pos);
+  while (superblock > 0) {
+    superblock = backward_superblock(superblock - 1, max_val);
+    if (superblock == k_none) {
+      break;
+    }
+    size_t block_limit = std::min((superblock + 1) * impl_t::k_factor2, m_num_factor1);
+    found = backward_in_superblock(superblock, block_limit, max_val);
+    if (found != k_none) {
+      return found;
+    }
+    // Only saturated summaries get here.
+  }
+  return 0;
 }
 
-size_t less_than_search::get_f2(size_t pos) const {
-  CHECK_LT(pos, m_num_factor2);
-  return m_impl->min_vals.get(pos + m_num_factor1);
+membuf_cachelist less_than_search::membufs() const {
+  return membuf_cachelist{m_impl->block_mins, m_impl->sparse_mins};
 }
 
+membuf_cachelist less_than_search::ordered_membufs() const { return m_impl->block_mins; }
+
 size_t less_than_search::get_factor1() { return impl_t::k_factor1; }
 size_t less_than_search::get_factor2() { return impl_t::k_factor2; }
@@ -56,14 +56,38 @@ class uint16_int_map : public int_map_interface {
   membuf m_buffer;
 };
 
+// Finds the nearest position in either direction whose value is
+// less than a given maximum.  Minimums are summarized for blocks of
+// 64 values, and a sparse table over superblocks of 4096 values lets
+// long searches skip ahead in O(log distance) steps.  Summaries are
+// stored as saturated bytes; values above 255 are still found, just
+// more slowly.  This takes about 1/8 bit per value for the blocks,
+// plus log2(superblocks) bytes per superblock for the sparse table.
+//
+// The summaries can be saved in a spiral file so they do not need
+// to be rebuilt each time the values are opened.
 class less_than_search {
  public:
+  // Builds summaries in memory.
   less_than_search(const int_map_interface* vals);
+  // Builds summaries and saves them in the given part.
+  less_than_search(const int_map_interface* vals, const spiral_file_create_state& state);
+  // Opens summaries previously saved for vals.
+  less_than_search(const int_map_interface* vals, const spiral_file_open_state& state);
   ~less_than_search();
 
+  // Returns the first position >= start_pos with a value less than
+  // max_val, or size() if there is none.
   size_t next_forward_lt(size_t start_pos, size_t max_val) const;
+  // Returns the last position <= start_pos with a value less than
+  // max_val, or 0 if there is none.
   size_t next_backward_lt(size_t start_pos, size_t max_val) const;
 
+  membuf_cachelist membufs() const;
+  // The block summaries, which are stored in position order.  The
+  // sparse table is stored a level at a time, so it's left out.
+  membuf_cachelist ordered_membufs() const;
+
   // Testing access:
   static size_t get_factor1();
   static size_t get_factor2();
@@ -71,8 +95,14 @@ class less_than_search {
  private:
   struct impl_t;
 
-  size_t get_f1(size_t f1_pos) const;
-  size_t get_f2(size_t f2_pos) const;
+  void fill();
+
+  size_t forward_in_block(size_t block, size_t pos, size_t max_val) const;
+  size_t forward_in_superblock(size_t superblock, size_t block, size_t max_val) const;
+  size_t forward_superblock(size_t superblock, size_t max_val) const;
+  size_t backward_in_block(size_t block, size_t pos, size_t max_val) const;
+  size_t backward_in_superblock(size_t superblock, size_t block, size_t max_val) const;
+  size_t backward_superblock(size_t superblock, size_t max_val) const;
 
   const int_map_interface* const m_vals;
   const size_t m_size;
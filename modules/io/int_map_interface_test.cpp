@@ -1,9 +1,12 @@
 #include "modules/io/int_map_interface.h"
 #include "modules/io/log.h"
 #include "modules/io/packed_vector.h"
+#include "modules/io/spiral_file_mem.h"
 
 #include "gtest/gtest.h"
 
+#include <random>
+
 TEST(less_than_search_test, search_backward) {
   mutable_packed_vector<size_t, 32> pvec(64 * 64 + 37, "less_than_search_test:search_backward");
   static constexpr size_t k_offset = 123;
@@ -81,3 +84,62 @@ TEST(less_than_search_test, search_forward) {
     }
   }
 }
+
+namespace {
+
+// Fills pvec with mostly large values and a sprinkling of small ones,
+// including values above what fits in a summary byte.
+void fill_sparse(mutable_packed_vector<size_t, 32>& pvec) {
+  std::mt19937 rand_source(1);
+  for (size_t i = 0; i != pvec.size(); ++i) {
+    if (rand_source() % 5000 == 0) {
+      pvec[i] = rand_source() % 20;
+    } else {
+      pvec[i] = 200 + rand_source() % 200;
+    }
+  }
+}
+
+void check_against_brute_force(const less_than_search& search,
+                               const mutable_packed_vector<size_t, 32>& pvec) {
+  std::mt19937 rand_source(2);
+  size_t size = pvec.size();
+  for (size_t iter = 0; iter != 20000; ++iter) {
+    size_t loc = rand_source() % size;
+    size_t max_val = rand_source() % 420;
+
+    size_t expected_forward = loc;
+    while (expected_forward < size && pvec[expected_forward] >= max_val) {
+      ++expected_forward;
+    }
+    size_t expected_backward = loc;
+    while (expected_backward > 0 && pvec[expected_backward] >= max_val) {
+      --expected_backward;
+    }
+
+    EXPECT_EQ(expected_forward, search.next_forward_lt(loc, max_val))
+        << " loc: " << loc << " max: " << max_val;
+    EXPECT_EQ(expected_backward, search.next_backward_lt(loc, max_val))
+        << " loc: " << loc << " max: " << max_val;
+  }
+}
+
+}  // namespace
+
+TEST(less_than_search_test, sparse_values) {
+  mutable_packed_vector<size_t, 32> pvec(64 * 64 * 37 + 11, "less_than_search_test:sparse_values");
+  fill_sparse(pvec);
+  less_than_search search(&pvec);
+  check_against_brute_force(search, pvec);
+}
+
+TEST(less_than_search_test, save_and_open) {
+  mutable_packed_vector<size_t, 32> pvec(64 * 64 * 37 + 11, "less_than_search_test:save_and_open");
+  fill_sparse(pvec);
+
+  spiral_file_create_mem c;
+  { less_than_search search(&pvec, c.create()); }
+  spiral_file_open_mem o(c.close());
+  less_than_search search(&pvec, o.open());
+  check_against_brute_force(search, pvec);
+}
@@ -204,20 +204,27 @@ constexpr double membuf_cachelist::k_gigabytes_per_second;
 constexpr size_t membuf_cachelist::k_cache_chunk_size;
 
 membuf_cachelist::membuf_cachelist(membuf b) {
-  for (size_t i = 0; i < b.size(); i += k_cache_chunk_size) {
-    m_membufs.push_back(b.subbuf(i, std::min(b.size() - i, k_cache_chunk_size)));
+  if (b.size()) {
+    m_membufs.push_back(b);
   }
 }
 
 void membuf_cachelist::cache_in_memory(progress_handler_t progress) const {
+  std::vector<membuf> chunks;
+  for (const membuf& b : m_membufs) {
+    for (size_t i = 0; i < b.size(); i += k_cache_chunk_size) {
+      chunks.push_back(b.subbuf(i, std::min(b.size() - i, k_cache_chunk_size)));
+    }
+  }
+
   size_t sum = 0;
 
   parallel_for(  //
-      0, m_membufs.size(),
-      [this, &sum](size_t i, parallel_state& st) {
+      0, chunks.size(),
+      [&chunks, &sum](size_t i, parallel_state& st) {
         size_t local_sum = 0;
-        const auto* data = m_membufs[i].data();
-        size_t size = m_membufs[i].size();
+        const auto* data = chunks[i].data();
+        size_t size = chunks[i].size();
         for (size_t pos = 0; pos < size; pos += k_cache_stride_size) {
           local_sum += data[pos];
         }
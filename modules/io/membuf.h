@@ -183,6 +183,9 @@ class membuf_cachelist {
 
   membuf_cachelist& operator+=(const membuf_cachelist& rhs);
 
+  // Returns the membufs in this list.
+  const std::vector<membuf>& buffers() const { return m_membufs; }
+
  private:
   // When checking for whether a mapped file is cached in RAM, only
   // look at 1 byte every k_cache_stride_size bytes.  This number
@@ -189,6 +189,17 @@ class packed_vector : public int_map_interface {
   }
   virtual ~packed_vector() = default;
 
+  // Opens only the bytes holding values [first, limit) of a saved
+  // packed vector, without opening the rest of it.  For archived
+  // files, this only decompresses the frames covering that range.
+  static membuf open_range(const spiral_file_open_state& state, size_t first, size_t limit) {
+    CHECK_LE(first, limit);
+    state.enforce_max_version("packed_vector", packed_vector_version);
+    size_t byte_start = first * value_width / 8;
+    size_t byte_limit = (limit * value_width + 7) / 8;
+    return state.open_membuf_range("packed_data", byte_start, byte_limit - byte_start);
+  }
+
   membuf_cachelist membufs() const override { return m_membuf; }
 
  protected:
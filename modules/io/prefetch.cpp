@@ -0,0 +1,145 @@
+#include "modules/io/prefetch.h"
+#include "modules/io/log.h"
+#include "modules/io/parallel.h"
+#include "modules/io/utils.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+constexpr size_t prefetch_plan::k_default_max_gap;
+constexpr size_t prefetch_plan::k_fraction_margin;
+
+namespace {
+
+// Largest piece of a coalesced range to read in a single task.
+constexpr size_t k_max_read_size = 16 * 1024 * 1024;
+
+uintptr_t page_size() {
+  static const uintptr_t k_page_size = sysconf(_SC_PAGESIZE);
+  return k_page_size;
+}
+
+const char* page_down(const char* ptr) {
+  return reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(ptr) & ~(page_size() - 1));
+}
+
+const char* page_up(const char* ptr) {
+  return page_down(ptr + page_size() - 1);
+}
+
+}  // namespace
+
+std::string prefetch_stats::to_string() const {
+  return printstring("%lu ranges, %lu pages, %.1f%% already resident", ranges, pages,
+                     hit_rate() * 100);
+}
+
+void prefetch_plan::add(const membuf& buf, size_t offset, size_t size) {
+  if (offset >= buf.size()) {
+    return;
+  }
+  size = std::min(size, buf.size() - offset);
+  if (!size) {
+    return;
+  }
+  range r;
+  r.buf_start = buf.data();
+  r.start = buf.data() + offset;
+  r.limit = r.start + size;
+  m_ranges.push_back(r);
+}
+
+void prefetch_plan::add_fraction(const membuf_cachelist& bufs, double start, double limit) {
+  CHECK_LE(start, limit);
+  for (const membuf& buf : bufs.buffers()) {
+    double size = buf.size();
+    size_t offset = std::floor(start * size);
+    size_t end = std::ceil(limit * size) + k_fraction_margin;
+    offset = offset > k_fraction_margin ? offset - k_fraction_margin : 0;
+    add(buf, offset, end - offset);
+  }
+}
+
+void prefetch_plan::coalesce() {
+  std::sort(m_ranges.begin(), m_ranges.end(), [](const range& a, const range& b) {
+    if (a.buf_start != b.buf_start) {
+      return a.buf_start < b.buf_start;
+    }
+    return a.start < b.start;
+  });
+
+  std::vector<range> coalesced;
+  for (const range& r : m_ranges) {
+    if (!coalesced.empty()) {
+      range& last = coalesced.back();
+      if (last.buf_start == r.buf_start && r.start <= last.limit + m_max_gap) {
+        last.limit = std::max(last.limit, r.limit);
+        continue;
+      }
+    }
+    coalesced.push_back(r);
+  }
+  m_ranges = std::move(coalesced);
+}
+
+prefetch_stats prefetch_plan::execute(progress_handler_t progress) {
+  coalesce();
+
+  // Split into page aligned pieces small enough to read in parallel.
+  std::vector<std::pair<const char*, size_t>> pieces;
+  for (const range& r : m_ranges) {
+    const char* start = page_down(r.start);
+    const char* limit = page_up(r.limit);
+    while (start < limit) {
+      size_t size = std::min<size_t>(limit - start, k_max_read_size);
+      pieces.emplace_back(start, size);
+      start += size;
+    }
+  }
+
+  std::atomic<size_t> pages{0};
+  std::atomic<size_t> resident_pages{0};
+  parallel_for(  //
+      0, pieces.size(),
+      [&](size_t i) {
+        const char* start = pieces[i].first;
+        size_t size = pieces[i].second;
+        size_t num_pages = size / page_size();
+        void* addr = const_cast<char*>(start);
+
+        std::vector<unsigned char> resident(num_pages);
+        size_t num_resident = 0;
+        if (mincore(addr, size, resident.data()) == 0) {
+          for (unsigned char page : resident) {
+            num_resident += page & 1;
+          }
+        }
+        pages += num_pages;
+        resident_pages += num_resident;
+
+        if (num_resident == num_pages) {
+          return;
+        }
+        // Let the kernel start reading the whole piece at once before
+        // we fault in each page.
+        madvise(addr, size, MADV_WILLNEED);
+        unsigned sum = 0;
+        for (size_t pos = 0; pos < size; pos += page_size()) {
+          sum += start[pos];
+        }
+        // Make sure the reads aren't optimized out.
+        asm volatile("" ::"r"(sum));
+      },
+      progress);
+
+  prefetch_stats stats;
+  stats.ranges = m_ranges.size();
+  stats.pages = pages.load();
+  stats.resident_pages = resident_pages.load();
+  m_ranges.clear();
+  return stats;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+// Reads the parts of memory mapped files that a query is about to
+// touch, so the query doesn't stall on random page faults.
+//
+// Callers add byte ranges of membufs to a prefetch_plan.  When
+// executed, ranges in the same membuf that are close together are
+// coalesced into large reads, which are advised to the kernel with
+// MADV_WILLNEED and then read in parallel.
+
+#include "modules/io/membuf.h"
+#include "modules/io/progress.h"
+
+#include <string>
+#include <vector>
+
+struct prefetch_stats {
+  // Number of coalesced ranges read.
+  size_t ranges = 0;
+  // Number of pages in those ranges.
+  size_t pages = 0;
+  // Number of those pages that were already resident before
+  // prefetching.
+  size_t resident_pages = 0;
+
+  // Fraction of planned pages that were already resident.
+  double hit_rate() const { return pages ? double(resident_pages) / pages : 1; }
+
+  std::string to_string() const;
+};
+
+class prefetch_plan {
+ public:
+  // Ranges in the same membuf separated by less than this many bytes
+  // are read together.
+  static constexpr size_t k_default_max_gap = 1024 * 1024;
+
+  // Extra bytes included on each side of ranges added by fraction,
+  // to allow for imprecision in mapping entries to offsets.
+  static constexpr size_t k_fraction_margin = 4096;
+
+  prefetch_plan(size_t max_gap = k_default_max_gap) : m_max_gap(max_gap) {}
+
+  // Adds the given range of bytes from buf.  The range is clipped to
+  // the size of buf.
+  void add(const membuf& buf, size_t offset, size_t size);
+
+  // Adds the part of each membuf in bufs between the given fractions
+  // of its size.  This is useful for structures that store their
+  // entries in order, where a range of entries corresponds to about
+  // the same fraction of each of their buffers.
+  void add_fraction(const membuf_cachelist& bufs, double start, double limit);
+
+  // Coalesces the planned ranges and reads them.  Returns statistics
+  // on how much of the plan was already resident.
+  prefetch_stats execute(progress_handler_t progress = null_progress_handler);
+
+ private:
+  struct range {
+    // Start of the membuf this range came from, so ranges are never
+    // coalesced across separate mappings.
+    const char* buf_start;
+    const char* start;
+    const char* limit;
+  };
+
+  void coalesce();
+
+  size_t m_max_gap;
+  std::vector<range> m_ranges;
+};
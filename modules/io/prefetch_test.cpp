@@ -0,0 +1,74 @@
+#include "modules/io/prefetch.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+namespace {
+
+// Large enough that owned_membuf allocates page aligned buffers with mmap.
+constexpr size_t k_buf_size = 2 * owned_membuf::k_mmap_threshold;
+
+size_t page_size() { return sysconf(_SC_PAGESIZE); }
+
+}  // namespace
+
+TEST(prefetch_test, coalesces_nearby_ranges) {
+  membuf buf(new owned_membuf(k_buf_size, "prefetch_test"));
+
+  prefetch_plan plan(1024 * 1024 /* max gap */);
+  plan.add(buf, 0, 100);
+  plan.add(buf, 512 * 1024, 100);
+  plan.add(buf, 32 * 1024 * 1024, 100);
+  prefetch_stats stats = plan.execute();
+  EXPECT_EQ(2, stats.ranges);
+  EXPECT_EQ((512 * 1024) / page_size() + 1 + 1, stats.pages);
+}
+
+TEST(prefetch_test, separate_membufs) {
+  membuf buf1(new owned_membuf(k_buf_size, "prefetch_test"));
+  membuf buf2(new owned_membuf(k_buf_size, "prefetch_test"));
+
+  prefetch_plan plan;
+  plan.add(buf1, k_buf_size - 100, 100);
+  plan.add(buf2, 0, 100);
+  EXPECT_EQ(2, plan.execute().ranges);
+}
+
+TEST(prefetch_test, clips_to_membuf) {
+  membuf buf(new owned_membuf(k_buf_size, "prefetch_test"));
+
+  prefetch_plan plan;
+  plan.add(buf, k_buf_size - page_size(), 10 * page_size());
+  plan.add(buf, k_buf_size + page_size(), page_size());
+  prefetch_stats stats = plan.execute();
+  EXPECT_EQ(1, stats.ranges);
+  EXPECT_EQ(1, stats.pages);
+}
+
+TEST(prefetch_test, add_fraction) {
+  membuf small_buf(new owned_membuf(k_buf_size / 2, "prefetch_test"));
+  membuf large_buf(new owned_membuf(k_buf_size, "prefetch_test"));
+
+  prefetch_plan plan(0 /* max gap */);
+  plan.add_fraction(membuf_cachelist{small_buf, large_buf}, 0.5, 0.75);
+  prefetch_stats stats = plan.execute();
+  EXPECT_EQ(2, stats.ranges);
+  size_t expected_pages = (k_buf_size / 2 / 4 + 2 * prefetch_plan::k_fraction_margin) / page_size() +
+                          (k_buf_size / 4 + 2 * prefetch_plan::k_fraction_margin) / page_size();
+  EXPECT_EQ(expected_pages, stats.pages);
+}
+
+TEST(prefetch_test, hit_rate) {
+  membuf buf(new owned_membuf(k_buf_size, "prefetch_test"));
+
+  prefetch_plan plan;
+  plan.add(buf, 0, k_buf_size);
+  prefetch_stats first = plan.execute();
+  EXPECT_EQ(k_buf_size / page_size(), first.pages);
+  EXPECT_LT(first.hit_rate(), 1);
+
+  plan.add(buf, 0, k_buf_size);
+  prefetch_stats second = plan.execute();
+  EXPECT_EQ(first.pages, second.pages);
+  EXPECT_EQ(1, second.hit_rate());
+}
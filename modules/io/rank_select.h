@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modules/io/membuf.h"
+
+// This interface can be implemented by anything that acts as a
+// read-only bit vector supporting rank ("count") and select
+// ("find_count") queries.  Equivalently, it represents a sorted set
+// of integers in [0, size()).  It lets users like sparse_multi open
+// whichever encoding was saved.
+class rank_select_interface {
+ public:
+  virtual ~rank_select_interface() = default;
+
+  // Number of bits present.
+  virtual size_t size() const = 0;
+  // Number of bits that are set.
+  virtual uint64_t total_bits() const = 0;
+
+  // Returns true if bit i is set.
+  virtual bool get(size_t i) const = 0;
+  // Returns the number of set bits < i.
+  // It is guaranteed that count(size()) == total_bits().
+  virtual size_t count(size_t i) const = 0;
+  // Returns the index of the set bit with the given count.
+  // It is guaranteed that find_count(total_bits()) == size().
+  virtual size_t find_count(size_t count) const = 0;
+  // Returns the index of the first set bit >= i, or size() if there
+  // is none.
+  virtual size_t next_set(size_t i) const { return find_count(count(i)); }
+
+  // Returns a list of membufs to cache if memory caching is requested.
+  virtual membuf_cachelist membufs() const = 0;
+  // Returns the membufs stored in bit order, where a range of bits
+  // maps to about the same fraction of each of them.  Encodings that
+  // aren't laid out that way return nothing.
+  virtual membuf_cachelist ordered_membufs() const { return membuf_cachelist(); }
+};
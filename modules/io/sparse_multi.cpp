@@ -1,79 +1,202 @@
 #include "modules/io/sparse_multi.h"
+#include "modules/io/make_unique.h"
 
 const product_version sparse_multi::sparse_multi_version{"1.0.0"};
+const product_version sparse_multi::compact_sparse_multi_version{"1.1.0"};
 
 sparse_multi::sparse_multi(const spiral_file_open_state& state) {
-  state.enforce_max_version("sparse_multi", sparse_multi_version);
+  state.enforce_max_version("sparse_multi", compact_sparse_multi_version);
 
-  m_source_to_mid.reset(new bitcount(state.open_subpart("source_to_mid")));
-  m_dest_to_mid.reset(new bitcount(state.open_subpart("dest_to_mid")));
+  m_source_to_mid = open_part(state.open_subpart("source_to_mid"));
+  m_dest_to_mid = open_part(state.open_subpart("dest_to_mid"));
+  init_fast_path();
+}
+
+void sparse_multi::init_fast_path() {
+  m_source_bc = dynamic_cast<const bitcount*>(m_source_to_mid.get());
+  m_dest_bc = dynamic_cast<const bitcount*>(m_dest_to_mid.get());
+}
+
+std::unique_ptr<rank_select_interface> sparse_multi::open_part(
+    const spiral_file_open_state& state) {
+  if (state.membuf_present("elias_fano.json")) {
+    return make_unique<elias_fano>(state);
+  }
+  return make_unique<bitcount>(state);
+}
+
+size_t sparse_multi::compact_part_size(const rank_select_interface& part) {
+  return std::min(bitcount::compute_size(part.size()),
+                  elias_fano::compute_size(part.size(), part.total_bits()));
+}
+
+void sparse_multi::write_part(const rank_select_interface& part,
+                              const spiral_file_create_state& state) {
+  size_t universe = part.size();
+  size_t count = part.total_bits();
+  if (elias_fano::compute_size(universe, count) < bitcount::compute_size(universe)) {
+    elias_fano_builder ef(state, universe, count);
+    for (size_t i = 0; i != count; ++i) {
+      ef.add(part.find_count(i));
+    }
+    ef.finalize();
+  } else {
+    bitcount bc(state, universe);
+    for (size_t i = 0; i != count; ++i) {
+      bc.set_unlocked(part.find_count(i), true);
+    }
+    bc.finalize();
+  }
+}
+
+void sparse_multi::write_compact(const spiral_file_create_state& state,
+                                 progress_handler_t progress) const {
+  state.set_version("sparse_multi", compact_sparse_multi_version);
+  write_part(*m_source_to_mid, state.create_subpart("source_to_mid"));
+  progress(0.5);
+  write_part(*m_dest_to_mid, state.create_subpart("dest_to_mid"));
+  progress(1);
+}
+
+size_t sparse_multi::stored_size() const {
+  size_t result = 0;
+  for (const rank_select_interface* part : {m_source_to_mid.get(), m_dest_to_mid.get()}) {
+    if (dynamic_cast<const elias_fano*>(part)) {
+      result += elias_fano::compute_size(part->size(), part->total_bits());
+    } else {
+      result += bitcount::compute_size(part->size());
+    }
+  }
+  return result;
+}
+
+size_t sparse_multi::compact_size() const {
+  return compact_part_size(*m_source_to_mid) + compact_part_size(*m_dest_to_mid);
+}
+
+bool sparse_multi::is_compact() const {
+  return dynamic_cast<const elias_fano*>(m_source_to_mid.get()) ||
+         dynamic_cast<const elias_fano*>(m_dest_to_mid.get());
+}
+
+void sparse_multi::make_find_count_index() {
+  for (rank_select_interface* part : {m_source_to_mid.get(), m_dest_to_mid.get()}) {
+    bitcount* bc = dynamic_cast<bitcount*>(part);
+    if (bc) {
+      bc->make_find_count_index();
+    }
+  }
 }
 
 sparse_multi::sparse_multi(std::unique_ptr<bitcount> source_to_mid,
                            std::unique_ptr<bitcount> dest_to_mid)
     : m_source_to_mid(std::move(source_to_mid)),
-      m_dest_to_mid(std::move(dest_to_mid)) {}
+      m_dest_to_mid(std::move(dest_to_mid)) {
+  init_fast_path();
+}
 
-std::pair<uint64_t, uint64_t> sparse_multi::lookup(
-    uint64_t source_index) const {
-  CHECK_LT(source_index, m_source_to_mid->size());
+namespace {
 
-  if (!m_source_to_mid->get(source_index)) {
+// Lookup bodies are templated on the part types so that when both
+// parts are bitcounts, the rank/select calls are direct (and mostly
+// inlined) instead of going through rank_select_interface.
+
+template <typename SourceT, typename DestT>
+std::pair<uint64_t, uint64_t> lookup_impl(const SourceT& source_to_mid,
+                                          const DestT& dest_to_mid,
+                                          uint64_t source_index) {
+  CHECK_LT(source_index, source_to_mid.size());
+
+  if (!source_to_mid.get(source_index)) {
     return std::make_pair(0, 0);
   }
 
-  uint64_t mid_index = m_source_to_mid->count(source_index);
-  uint64_t dest_index_start = m_dest_to_mid->find_count(mid_index);
-  uint64_t dest_index_limit = m_dest_to_mid->find_count(mid_index + 1);
+  uint64_t mid_index = source_to_mid.count(source_index);
+  uint64_t dest_index_start = dest_to_mid.find_count(mid_index);
+  uint64_t dest_index_limit = dest_to_mid.find_count(mid_index + 1);
 
   return std::make_pair(dest_index_start, dest_index_limit);
 }
 
-uint64_t sparse_multi::lookup_lower_bound(uint64_t source_index) const {
-  CHECK_LT(source_index, m_source_to_mid->size());
-  uint64_t mid_index = m_source_to_mid->count(source_index);
-  uint64_t dest_index_start = m_dest_to_mid->find_count(mid_index);
+template <typename SourceT, typename DestT>
+uint64_t lookup_lower_bound_impl(const SourceT& source_to_mid, const DestT& dest_to_mid,
+                                 uint64_t source_index) {
+  CHECK_LT(source_index, source_to_mid.size());
+  uint64_t mid_index = source_to_mid.count(source_index);
+  uint64_t dest_index_start = dest_to_mid.find_count(mid_index);
 
   return dest_index_start;
 }
 
-std::pair<uint64_t, uint64_t> sparse_multi::lookup_range(
-    uint64_t source_index_start, uint64_t source_index_limit) const {
+template <typename SourceT, typename DestT>
+std::pair<uint64_t, uint64_t> lookup_range_impl(const SourceT& source_to_mid,
+                                                const DestT& dest_to_mid,
+                                                uint64_t source_index_start,
+                                                uint64_t source_index_limit) {
   CHECK_LE(source_index_start, source_index_limit);
-  CHECK_LE(source_index_start, m_source_to_mid->size());
-  uint64_t mid_index_start = m_source_to_mid->count(source_index_start);
-  uint64_t dest_index_start = m_dest_to_mid->find_count(mid_index_start);
+  CHECK_LE(source_index_start, source_to_mid.size());
+  uint64_t mid_index_start = source_to_mid.count(source_index_start);
+  uint64_t dest_index_start = dest_to_mid.find_count(mid_index_start);
 
-  DCHECK_LE(source_index_limit, m_source_to_mid->size());
-  uint64_t mid_index_limit = m_source_to_mid->count(source_index_limit);
-  uint64_t dest_index_limit = m_dest_to_mid->find_count(mid_index_limit);
+  DCHECK_LE(source_index_limit, source_to_mid.size());
+  uint64_t mid_index_limit = source_to_mid.count(source_index_limit);
+  uint64_t dest_index_limit = dest_to_mid.find_count(mid_index_limit);
   return std::make_pair(dest_index_start, dest_index_limit);
 }
 
-uint64_t sparse_multi::reverse_lookup(uint64_t dest_index) const {
-  CHECK_LT(dest_index, m_dest_to_mid->size());
-
-  uint64_t mid_index = m_dest_to_mid->count(dest_index);
-  if (!m_dest_to_mid->get(dest_index)) {
+template <typename DestT>
+uint64_t lookup_dest_to_mid_impl(const DestT& dest_to_mid, uint64_t dest_index) {
+  CHECK_LT(dest_index, dest_to_mid.size());
+  uint64_t mid_index = dest_to_mid.count(dest_index);
+  if (!dest_to_mid.get(dest_index)) {
     mid_index--;
   }
-  uint64_t source_index = m_source_to_mid->find_count(mid_index);
+  return mid_index;
+}
+
+}  // namespace
+
+std::pair<uint64_t, uint64_t> sparse_multi::lookup(
+    uint64_t source_index) const {
+  if (m_source_bc && m_dest_bc) {
+    return lookup_impl(*m_source_bc, *m_dest_bc, source_index);
+  }
+  return lookup_impl(*m_source_to_mid, *m_dest_to_mid, source_index);
+}
+
+uint64_t sparse_multi::lookup_lower_bound(uint64_t source_index) const {
+  if (m_source_bc && m_dest_bc) {
+    return lookup_lower_bound_impl(*m_source_bc, *m_dest_bc, source_index);
+  }
+  return lookup_lower_bound_impl(*m_source_to_mid, *m_dest_to_mid, source_index);
+}
+
+std::pair<uint64_t, uint64_t> sparse_multi::lookup_range(
+    uint64_t source_index_start, uint64_t source_index_limit) const {
+  if (m_source_bc && m_dest_bc) {
+    return lookup_range_impl(*m_source_bc, *m_dest_bc, source_index_start,
+                             source_index_limit);
+  }
+  return lookup_range_impl(*m_source_to_mid, *m_dest_to_mid, source_index_start,
+                           source_index_limit);
+}
 
-  return source_index;
+uint64_t sparse_multi::reverse_lookup(uint64_t dest_index) const {
+  return lookup_mid_to_source(lookup_dest_to_mid(dest_index));
 }
 
 uint64_t sparse_multi::lookup_dest_to_mid(uint64_t dest_index) const {
-  CHECK_LT(dest_index, m_dest_to_mid->size());
-  uint64_t mid_index = m_dest_to_mid->count(dest_index);
-  if (!m_dest_to_mid->get(dest_index)) {
-    mid_index--;
+  if (m_dest_bc) {
+    return lookup_dest_to_mid_impl(*m_dest_bc, dest_index);
   }
-  return mid_index;
+  return lookup_dest_to_mid_impl(*m_dest_to_mid, dest_index);
 }
 
 uint64_t sparse_multi::lookup_mid_to_source(uint64_t mid_index) const {
-  uint64_t source_index = m_source_to_mid->find_count(mid_index);
-  return source_index;
+  if (m_source_bc) {
+    return m_source_bc->find_count(mid_index);
+  }
+  return m_source_to_mid->find_count(mid_index);
 }
 
 sparse_multi_builder::sparse_multi_builder(
@@ -153,27 +276,32 @@ void sparse_multi_builder::build_from_old_format(const char* gross_ids_buf,
 }
 
 sparse_multi::iterator& sparse_multi::iterator::seek_to(uint64_t source_index) {
-  m_source_index = source_index;
   CHECK_LE(source_index, m_sm->source_elem_count());
-  if (m_source_index == m_sm->source_elem_count()) {
+  m_mid_index = m_sm->m_source_to_mid->count(source_index);
+  if (m_mid_index == m_sm->m_source_to_mid->total_bits()) {
     seek_to_end();
     return *this;
   }
-  while (!m_sm->m_source_to_mid->get(m_source_index)) {
-    m_source_index++;
-    if (m_source_index == m_sm->source_elem_count()) {
-      seek_to_end();
-      return *this;
-    }
-  }
 
-  uint64_t mid_index = m_sm->m_source_to_mid->count(m_source_index);
-  m_dest_index = m_sm->m_dest_to_mid->find_count(mid_index);
+  // Skip to the first source at or after source_index that has dests.
+  m_source_index = m_sm->m_source_to_mid->find_count(m_mid_index);
+  m_dest_index = m_sm->m_dest_to_mid->find_count(m_mid_index);
   calculate_next_dest();
 
   return *this;
 }
 
+membuf_cachelist sparse_multi::ordered_membufs() const {
+  membuf_cachelist results;
+  if (m_source_to_mid) {
+    results += m_source_to_mid->ordered_membufs();
+  }
+  if (m_dest_to_mid) {
+    results += m_dest_to_mid->ordered_membufs();
+  }
+  return results;
+}
+
 membuf_cachelist sparse_multi::membufs() const {
   membuf_cachelist results;
   if (m_source_to_mid) {
@@ -10,10 +10,17 @@
 // piece of data with only some of the elements in the source array,
 // "sparse_multi" allows a separate array to associate 1 or more
 // pieces of data with only some of the elements in the source array.
+//
+// Internally, there are two bit vectors, source_to_mid and
+// dest_to_mid.  Each is saved either as a bitcount or, if it is
+// sparse enough that it's smaller that way, using Elias-Fano
+// encoding (see write_compact).
 
 #include <boost/iterator/iterator_facade.hpp>
 
 #include "modules/io/bitcount.h"
+#include "modules/io/elias_fano.h"
+#include "modules/io/rank_select.h"
 #include "modules/io/spiral_file.h"
 #include "modules/io/version.h"
 
@@ -36,7 +43,9 @@ class sparse_multi {
 
   // Returns true if the given dest index is the first one in a group
   // of 1 or more dests associated with a source.
-  bool dest_is_first_in_group(uint64_t dest_index) const { return m_dest_to_mid->get(dest_index); }
+  bool dest_is_first_in_group(uint64_t dest_index) const {
+    return m_dest_bc ? m_dest_bc->get(dest_index) : m_dest_to_mid->get(dest_index);
+  }
 
   size_t source_elem_count() const { return m_source_to_mid->size(); }
   size_t dest_elem_count() const { return m_dest_to_mid->size(); }
@@ -45,12 +54,24 @@ class sparse_multi {
   uint64_t lookup_mid_to_source(uint64_t mid_index) const;
 
   static const product_version sparse_multi_version;
+  // Version for sparse multis that may contain Elias-Fano encoded parts.
+  static const product_version compact_sparse_multi_version;
 
   // Makes lookup tables to optimize lookup and reverse_lookup.
-  void make_find_count_index() {
-    m_source_to_mid->make_find_count_index();
-    m_dest_to_mid->make_find_count_index();
-  }
+  void make_find_count_index();
+
+  // Saves a copy of this sparse multi, encoding each part with
+  // whichever of bitcount and Elias-Fano encoding is smaller.
+  void write_compact(const spiral_file_create_state& state,
+                     progress_handler_t progress = null_progress_handler) const;
+
+  // Returns the number of bytes used by the parts as currently
+  // stored, and the number that write_compact would use.
+  size_t stored_size() const;
+  size_t compact_size() const;
+
+  // Returns true if any part is stored using Elias-Fano encoding.
+  bool is_compact() const;
 
   class iterator {
    public:
@@ -70,12 +91,9 @@ class sparse_multi {
 
     iterator& operator++() {
       CHECK_LT(m_source_index, m_sm->source_elem_count());
-      do {
-        m_source_index++;
-        if (m_source_index == m_sm->source_elem_count()) {
-          break;
-        }
-      } while (!m_sm->m_source_to_mid->get(m_source_index));
+      m_mid_index++;
+      m_source_index = m_sm->m_source_bc ? m_sm->m_source_bc->next_set(m_source_index + 1)
+                                         : m_sm->m_source_to_mid->next_set(m_source_index + 1);
 
       m_dest_index = m_next_dest_index;
       calculate_next_dest();
@@ -92,6 +110,7 @@ class sparse_multi {
     }
 
     iterator& seek_to_end() {
+      m_mid_index = m_sm->m_source_to_mid->total_bits();
       m_source_index = m_sm->source_elem_count();
       m_dest_index = m_next_dest_index = m_sm->dest_elem_count();
       return *this;
@@ -101,14 +120,16 @@ class sparse_multi {
     void calculate_next_dest() {
       m_next_dest_index = m_dest_index;
       if (m_dest_index < m_sm->dest_elem_count()) {
-        do {
-          m_next_dest_index++;
-        } while (m_next_dest_index < m_sm->dest_elem_count() &&
-                 !m_sm->m_dest_to_mid->get(m_next_dest_index));
+        m_next_dest_index = m_sm->m_dest_bc ? m_sm->m_dest_bc->next_set(m_dest_index + 1)
+                                            : m_sm->m_dest_to_mid->next_set(m_dest_index + 1);
       }
     }
 
     const sparse_multi* m_sm;
+    // Incrementing steps forward from the current source and dest
+    // positions with next_set instead of searching from scratch for
+    // each mid index.
+    uint64_t m_mid_index;
     uint64_t m_source_index;
     uint64_t m_dest_index;
     uint64_t m_next_dest_index;
@@ -123,13 +144,29 @@ class sparse_multi {
 
   // Returns a list of membufs to cache if memory caching is requested.
   membuf_cachelist membufs() const;
+  // Returns the membufs stored in mid index order; see
+  // rank_select_interface::ordered_membufs.
+  membuf_cachelist ordered_membufs() const;
 
 private:
   friend class sparse_multi_builder;
   sparse_multi(std::unique_ptr<bitcount> source_to_mid, std::unique_ptr<bitcount> dest_to_mid);
 
-  std::unique_ptr<bitcount> m_source_to_mid;
-  std::unique_ptr<bitcount> m_dest_to_mid;
+  static std::unique_ptr<rank_select_interface> open_part(const spiral_file_open_state& state);
+  static void write_part(const rank_select_interface& part, const spiral_file_create_state& state);
+  static size_t compact_part_size(const rank_select_interface& part);
+
+  // Points m_source_bc and m_dest_bc at whichever parts are bitcounts.
+  void init_fast_path();
+
+  std::unique_ptr<rank_select_interface> m_source_to_mid;
+  std::unique_ptr<rank_select_interface> m_dest_to_mid;
+
+  // Non-null when the corresponding part is a bitcount.  Since
+  // bitcount is final, lookups through these skip the virtual calls
+  // to rank_select_interface; Elias-Fano parts still go through it.
+  const bitcount* m_source_bc = nullptr;
+  const bitcount* m_dest_bc = nullptr;
 };
 
 class sparse_multi_builder {
@@ -0,0 +1,110 @@
+#include "modules/io/sparse_multi.h"
+#include "modules/io/spiral_file_mem.h"
+
+#include "benchmark/benchmark.h"
+
+#include <iostream>
+#include <random>
+
+namespace {
+
+// Sparse enough on the source side that write_compact stores
+// source_to_mid with Elias-Fano encoding.
+const size_t num_sources = 64ULL * 1024 * 1024;
+const size_t source_stride = 64;
+const size_t max_dests_per_source = 4;
+
+size_t seed = time(0);
+std::mt19937_64 random_source(seed);
+
+spiral_file_mem_storage bitcount_storage;
+spiral_file_mem_storage compact_storage;
+std::unique_ptr<spiral_file_open_mem> bitcount_open;
+std::unique_ptr<spiral_file_open_mem> compact_open;
+std::unique_ptr<sparse_multi> bitcount_sm;
+std::unique_ptr<sparse_multi> compact_sm;
+
+void init_sm() {
+  if (bitcount_sm) {
+    return;
+  }
+
+  std::cerr << "Populating sparse multi with random data, seed " << seed << "\n";
+  std::uniform_int_distribution<size_t> random_dests(1, max_dests_per_source);
+  std::vector<std::pair<size_t, size_t>> entries;
+  size_t num_dests = 0;
+  for (size_t source = 0; source < num_sources; source += source_stride) {
+    size_t n = random_dests(random_source);
+    entries.emplace_back(source, n);
+    num_dests += n;
+  }
+
+  {
+    spiral_file_create_mem c;
+    sparse_multi_builder b(c.create(), num_sources, num_dests);
+    for (const auto& entry : entries) {
+      for (size_t i = 0; i < entry.second; ++i) {
+        b.add(entry.first);
+      }
+    }
+    b.finalize();
+    bitcount_storage = c.close();
+  }
+  bitcount_open.reset(new spiral_file_open_mem(bitcount_storage));
+  bitcount_sm.reset(new sparse_multi(bitcount_open->open()));
+  CHECK(!bitcount_sm->is_compact());
+
+  {
+    spiral_file_create_mem c;
+    bitcount_sm->write_compact(c.create());
+    compact_storage = c.close();
+  }
+  compact_open.reset(new spiral_file_open_mem(compact_storage));
+  compact_sm.reset(new sparse_multi(compact_open->open()));
+  CHECK(compact_sm->is_compact());
+
+  std::cerr << "Bitcount size: " << bitcount_sm->stored_size()
+            << " bytes, compact size: " << compact_sm->stored_size() << " bytes\n";
+}
+
+// Benchmark argument 0 selects the bitcount-only sparse multi, and 1
+// selects its write_compact copy.
+const sparse_multi& get_sm(bool compact) { return compact ? *compact_sm : *bitcount_sm; }
+
+}  // namespace
+
+static void BM_sparse_multi_lookup(benchmark::State& state) {
+  init_sm();
+  const sparse_multi& sm = get_sm(state.range(0));
+
+  std::uniform_int_distribution<size_t> random_pos(0, num_sources - 1);
+  size_t pos = random_pos(random_source);
+  const size_t stride = random_pos(random_source);
+
+  while (state.KeepRunning()) {
+    // Chain each lookup on the previous result so we measure latency.
+    std::pair<uint64_t, uint64_t> dests = sm.lookup(pos);
+    pos += stride ^ dests.second;
+    pos %= num_sources;
+  }
+}
+BENCHMARK(BM_sparse_multi_lookup)->Arg(0)->Arg(1);
+
+static void BM_sparse_multi_reverse_lookup(benchmark::State& state) {
+  init_sm();
+  const sparse_multi& sm = get_sm(state.range(0));
+  size_t num_dests = sm.dest_elem_count();
+
+  std::uniform_int_distribution<size_t> random_pos(0, num_dests - 1);
+  size_t pos = random_pos(random_source);
+  const size_t stride = random_pos(random_source);
+
+  while (state.KeepRunning()) {
+    uint64_t source = sm.reverse_lookup(pos);
+    pos += stride ^ source;
+    pos %= num_dests;
+  }
+}
+BENCHMARK(BM_sparse_multi_reverse_lookup)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
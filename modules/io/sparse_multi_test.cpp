@@ -281,6 +281,64 @@ TEST_P(sparse_multi_test, verify) {
   }
 }
 
+// Rewrite using write_compact, and make sure the result is equivalent.
+TEST_P(sparse_multi_test, compact) {
+  const std::vector<test_case_part>& parts = GetParam();
+
+  std::cerr << ::testing::PrintToString(parts) << "\n";
+
+  size_t num_srcs = 0, num_dsts = 0;
+
+  for (const test_case_part& part : parts) {
+    num_srcs += part.src_count;
+    num_dsts += part.dest_count * part.src_count;
+  }
+
+  spiral_file_create_mem c;
+  sparse_multi_builder b(c.create(), num_srcs, num_dsts);
+
+  size_t cur_src = 0;
+  for (const test_case_part& part : parts) {
+    for (size_t i = 0; i < part.src_count; i++) {
+      for (size_t j = 0; j < part.dest_count; j++) {
+        b.add(cur_src);
+      }
+      cur_src++;
+    }
+  }
+  auto orig = b.finalize();
+  EXPECT_FALSE(orig->is_compact());
+  EXPECT_LE(orig->compact_size(), orig->stored_size());
+
+  spiral_file_create_mem compact_c;
+  orig->write_compact(compact_c.create());
+  spiral_file_open_mem o(compact_c.close());
+  sparse_multi compact(o.open());
+  EXPECT_EQ(orig->compact_size(), compact.stored_size());
+  EXPECT_EQ(compact.stored_size() < orig->stored_size(), compact.is_compact());
+
+  ASSERT_EQ(num_srcs, compact.source_elem_count());
+  ASSERT_EQ(num_dsts, compact.dest_elem_count());
+  for (size_t src = 0; src < num_srcs; ++src) {
+    EXPECT_EQ(orig->lookup(src), compact.lookup(src)) << src;
+    EXPECT_EQ(orig->lookup_lower_bound(src), compact.lookup_lower_bound(src)) << src;
+  }
+  for (size_t dst = 0; dst < num_dsts; ++dst) {
+    EXPECT_EQ(orig->reverse_lookup(dst), compact.reverse_lookup(dst)) << dst;
+    EXPECT_EQ(orig->dest_is_first_in_group(dst), compact.dest_is_first_in_group(dst)) << dst;
+  }
+  EXPECT_EQ(orig->lookup_range(0, num_srcs), compact.lookup_range(0, num_srcs));
+
+  std::vector<std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> expected_entries, actual_entries;
+  for (const auto& entry : *orig) {
+    expected_entries.push_back(entry);
+  }
+  for (const auto& entry : compact) {
+    actual_entries.push_back(entry);
+  }
+  EXPECT_EQ(expected_entries, actual_entries);
+}
+
 // Build using old "readmap" gross/fine buffers.
 TEST_P(sparse_multi_test, build_from_old_format) {
   const std::vector<test_case_part>& parts = GetParam();
@@ -172,6 +172,12 @@ membuf spiral_file_open_state::open_membuf(const std::string &partname,
   return open_membuf_internal(partname, options);
 }
 
+membuf spiral_file_open_state::open_membuf_range(const std::string &partname, size_t offset,
+                                                 size_t size) const {
+  CHECK(m_version_checked);
+  return m_top->get_path_range(m_dir + partname, offset, size, m_options);
+}
+
 membuf spiral_file_open_state::open_membuf_internal(const std::string &partname,
                                                     const spiral_file_options &options) const {
   return m_top->get_path(m_dir + partname, options);
@@ -236,6 +242,13 @@ spiral_file_open_state spiral_file_open::open(const std::string &part_path) {
   return spiral_file_open_state(this, part_path, m_options);
 }
 
+membuf spiral_file_open::get_path_range(const std::string &path, size_t offset, size_t size,
+                                        const spiral_file_options &options) const {
+  membuf whole = get_path(path, options);
+  CHECK_LE(offset + size, whole.size()) << path;
+  return whole.subbuf(offset, size);
+}
+
 spiral_file_file_info spiral_file_open::file_info() const {
   membuf file_info_buf = get_path(spiral_file::k_file_info_pathname, m_options);
   spiral_file_file_info file_info;
@@ -251,6 +264,7 @@ std::ostream &operator<<(std::ostream &os, const spiral_file_options &opts) {
   os << "delayed_write=" << opts.delayed_write;
   os << ", small_object_threshold=" << opts.small_object_threshold;
   os << ", read_into_ram=" << opts.read_into_ram;
+  os << ", write_threads=" << opts.write_threads;
   return os;
 }
 
@@ -109,6 +109,11 @@ struct spiral_file_options {
   // help when mmap performance is poor (like with gpfs).
   bool read_into_ram = false;
   spiral_file_options with_read_into_ram(bool new_read_into_ram) const;
+
+  // Number of threads to use to write completed parts to disk in the
+  // background.  Several threads can help saturate fast storage.  If
+  // 0, parts are written synchronously when released.
+  unsigned write_threads = 4;
 };
 
 std::ostream &operator<<(std::ostream &os, const spiral_file_options &opts);
@@ -209,6 +214,9 @@ class spiral_file_open_state {
   // Provides access to a raw membuf subpart.
   membuf open_membuf(const std::string &partname) const;
   membuf open_membuf(const std::string &partname, const spiral_file_options &options) const;
+  // Provides access to part of a raw membuf subpart.  For archived
+  // files, this avoids decompressing the whole subpart.
+  membuf open_membuf_range(const std::string &partname, size_t offset, size_t size) const;
   mutable_membuf open_mutable_membuf(const std::string &partname) const;
   mutable_membuf open_mutable_membuf(const std::string &partname,
                                      const spiral_file_options &options) const;
@@ -303,6 +311,8 @@ class spiral_file_open : public spiral_file {
   friend class spiral_file_open_state;
 
   virtual membuf get_path(const std::string &path, const spiral_file_options &options) const = 0;
+  virtual membuf get_path_range(const std::string &path, size_t offset, size_t size,
+                                const spiral_file_options &options) const;
   virtual mutable_membuf get_mutable_path(const std::string &path,
                                           const spiral_file_options &options) = 0;
 
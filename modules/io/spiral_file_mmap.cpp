@@ -1,17 +1,65 @@
 #include "modules/io/spiral_file_mmap.h"
 
+#include "modules/io/json_transfer.h"
 #include "modules/io/mmap_buffer.h"
+#include "modules/io/parallel.h"
+#include "modules/io/transfer_object.h"
+#include "modules/io/version.h"
 #include "vendor/minizip/ioapi_mem.h"
 #include "vendor/minizip/unzip.h"
 #include "vendor/minizip/zip.h"
 
 #include <fcntl.h>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <zlib.h>
 
 namespace {
 
+// Location of frames within an archived part.
+struct spiral_file_archive_part {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(path, TF_STRICT);
+    FIELD(size, TF_STRICT);
+    FIELD(frame_size, TF_STRICT);
+    FIELD(frame_ends, TF_STRICT);
+  };
+
+  std::string path;
+  // Uncompressed size of the part.
+  size_t size = 0;
+  // Uncompressed size of each frame except possibly the last.
+  size_t frame_size = 0;
+  // Offset of the end of each compressed frame, relative to the start
+  // of the part as stored.  A frame that is stored the same size as
+  // its uncompressed size is not compressed.
+  std::vector<uint64_t> frame_ends;
+};
+
+// File format for "archive_index.json".
+struct spiral_file_archive_index {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(version, TF_STRICT);
+    FIELD(parts, TF_STRICT);
+  };
+
+  product_version version;
+  std::vector<spiral_file_archive_part> parts;
+};
+
+const char k_archive_index_pathname[] = "archive_index.json";
+const product_version k_archive_version{"1.0.0"};
+
+// Number of frames to compress or decompress at once when converting
+// files.  This bounds the amount of memory used.
+constexpr size_t k_archive_batch_frames = 64;
+
 void throw_if_unz_error(const std::string& what, int err) {
   if (err != UNZ_OK) {
     throw(io_exception(what + ": Got UNZIP error " + std::to_string(err)));
@@ -125,6 +173,67 @@ void spiral_file_open_mmap::import_zip_contents(const std::string& filename) {
   }
   err = unzClose(uf);
   throw_if_unz_error("unzClose", err);
+
+  if (m_paths.count(k_archive_index_pathname)) {
+    import_archive_index();
+  }
+}
+
+void spiral_file_open_mmap::import_archive_index() {
+  auto index_it = m_paths.find(k_archive_index_pathname);
+  spiral_file_archive_index index;
+  json_deserialize(index,
+                   m_mmap_buffer->subbuf(index_it->second.offset, index_it->second.size).str());
+  m_paths.erase(index_it);
+  if (!k_archive_version.can_read(index.version)) {
+    throw(io_exception("Archive version " + index.version.make_string() +
+                       " newer than supported version " + k_archive_version.make_string()));
+  }
+
+  for (const auto& part : index.parts) {
+    auto it = m_paths.find(part.path);
+    if (it == m_paths.end()) {
+      throw(io_exception("Archived part missing: " + part.path));
+    }
+    path_info& info = it->second;
+    CHECK_GT(part.frame_size, 0) << part.path;
+    CHECK_EQ(part.frame_ends.size(), (part.size + part.frame_size - 1) / part.frame_size)
+        << part.path;
+    if (!part.frame_ends.empty()) {
+      CHECK_EQ(part.frame_ends.back(), info.size) << part.path;
+    }
+    info.archived = true;
+    info.stored_size = info.size;
+    info.size = part.size;
+    info.frame_size = part.frame_size;
+    info.frame_ends = part.frame_ends;
+  }
+  m_archived = true;
+}
+
+void spiral_file_open_mmap::decode_frames(const path_info& i, size_t first_frame,
+                                          size_t last_frame, char* out) const {
+  CHECK_LE(last_frame, i.frame_ends.size());
+  parallel_for(first_frame, last_frame, [&](size_t frame) {
+    size_t stored_start = frame ? i.frame_ends[frame - 1] : 0;
+    size_t stored_size = i.frame_ends[frame] - stored_start;
+    size_t frame_start = frame * i.frame_size;
+    size_t frame_size = std::min(i.frame_size, i.size - frame_start);
+    const char* stored = m_mmap_buffer->data() + i.offset + stored_start;
+    char* dest = out + (frame_start - first_frame * i.frame_size);
+
+    if (stored_size == frame_size) {
+      memcpy(dest, stored, frame_size);
+      return;
+    }
+    uLongf dest_len = frame_size;
+    int err = uncompress(reinterpret_cast<Bytef*>(dest), &dest_len,
+                         reinterpret_cast<const Bytef*>(stored), stored_size);
+    if (err != Z_OK || dest_len != frame_size) {
+      throw(io_exception("Unable to decompress archived spiral file frame " +
+                         std::to_string(frame) + ": zlib error " + std::to_string(err)));
+    }
+  });
 }
 
 membuf spiral_file_open_mmap::get_path(
@@ -135,6 +244,15 @@ membuf spiral_file_open_mmap::get_path(
 
   std::lock_guard<std::mutex> l(i.mu);
 
+  if (i.archived) {
+    if (!i.in_mem_buf) {
+      mutable_membuf decoded = new owned_membuf(i.size, "spiral_file_archive: " + path);
+      decode_frames(i, 0, i.frame_ends.size(), decoded.mutable_data());
+      i.in_mem_buf.emplace(decoded);
+    }
+    return *i.in_mem_buf;
+  }
+
   if (options.read_into_ram) {
     if (!i.in_mem_buf) {
       mutable_membuf in_ram =
@@ -163,10 +281,42 @@ membuf spiral_file_open_mmap::get_path(
   }
 }
 
+membuf spiral_file_open_mmap::get_path_range(const std::string& path, size_t offset, size_t size,
+                                             const spiral_file_options& options) const {
+  auto it = m_paths.find(path);
+  CHECK(it != m_paths.end()) << path;
+  const path_info& i = it->second;
+  CHECK_LE(offset + size, i.size) << path;
+
+  if (!i.archived) {
+    return get_path(path, options).subbuf(offset, size);
+  }
+
+  {
+    std::lock_guard<std::mutex> l(i.mu);
+    if (i.in_mem_buf) {
+      return i.in_mem_buf->subbuf(offset, size);
+    }
+  }
+
+  // Only decode the frames we need.
+  size_t first_frame = offset / i.frame_size;
+  size_t last_frame = std::max(first_frame, (offset + size + i.frame_size - 1) / i.frame_size);
+  size_t decoded_start = first_frame * i.frame_size;
+  size_t decoded_end = std::min(i.size, last_frame * i.frame_size);
+  mutable_membuf decoded = new owned_membuf(std::max(decoded_start, decoded_end) - decoded_start,
+                                            "spiral_file_archive_range: " + path);
+  decode_frames(i, first_frame, last_frame, decoded.mutable_data());
+  return decoded.subbuf(offset - decoded_start, size);
+}
+
 mutable_membuf spiral_file_open_mmap::get_mutable_path(
     const std::string& path, const spiral_file_options& options) {
   CHECK(path_is_present(path));
   path_info& i = m_paths[path];
+  if (i.archived) {
+    throw(io_exception("Archived spiral file parts cannot be opened for writing: " + path));
+  }
 
   std::lock_guard<std::mutex> l(i.mu);
 
@@ -187,11 +337,206 @@ std::set<std::string> spiral_file_open_mmap::contents() const {
   return result;
 }
 
+namespace {
+
+// Maximum amount to write in a single pwrite call.
+constexpr size_t k_max_write_chunk = 64 * 1024 * 1024;
+
+// Parts at least this size passed to create_path_contents are written
+// with the part writer instead of through minizip.
+constexpr size_t k_min_part_writer_size = 1024 * 1024;
+
+// Maximum number of bytes to have queued in a part writer before
+// making callers wait.
+constexpr size_t k_max_pending_write_bytes = size_t(4) * 1024 * 1024 * 1024;
+
+void pwrite_all(int fd, const char* buf, size_t size, size_t offset) {
+  while (size) {
+    size_t to_write_this_chunk = std::min(size, k_max_write_chunk);
+    ssize_t nwrote = pwrite(fd, buf, to_write_this_chunk, offset);
+    if (nwrote <= 0) {
+      throw(io_exception("pwrite to zip: " + std::string(strerror(errno))));
+    }
+    CHECK_LE(nwrote, to_write_this_chunk);
+    buf += nwrote;
+    offset += nwrote;
+    size -= nwrote;
+  }
+}
+
+}  // namespace
+
+// Writes the contents of parts to their reserved locations in the
+// file using a pool of threads.  This lets the writes of several large
+// parts, and several chunks of the same part, be in flight at once.
+class spiral_file_part_writer {
+ public:
+  spiral_file_part_writer(std::shared_ptr<autoclosing_fd> fd, unsigned num_threads);
+  ~spiral_file_part_writer();
+
+  // Queues "contents" to be written at the given file offset.  The
+  // queue keeps a reference to "contents" until it's written.  If
+  // "wait" is true, returns after the write is complete.
+  void write(const membuf& contents, size_t offset, bool wait);
+
+  // Like write(contents, offset, false), but never throws.  Any error
+  // is saved and raised by the next call to write or flush.  This is
+  // safe to call from destructors.
+  void write_nothrow(const membuf& contents, size_t offset) noexcept;
+
+  // Waits for all queued writes to complete.  Throws io_exception if
+  // any write failed.
+  void flush();
+
+ private:
+  struct part_state {
+    size_t chunks_left = 0;
+  };
+  struct chunk {
+    membuf contents;
+    size_t offset;
+    std::shared_ptr<part_state> part;
+  };
+
+  // Queues "contents" for writing.  Must be called with m_mu held.
+  std::shared_ptr<part_state> enqueue(std::unique_lock<std::mutex>& l, const membuf& contents,
+                                      size_t offset);
+  void run_writer();
+  void throw_if_error(std::unique_lock<std::mutex>& l);
+
+  std::shared_ptr<autoclosing_fd> m_fd;
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_mu;
+  // Notified when chunks are added, or when shutting down.
+  std::condition_variable m_chunk_added;
+  // Notified when chunks are finished writing.
+  std::condition_variable m_chunk_done;
+  std::deque<chunk> m_chunks;
+  // Bytes queued or currently being written.
+  size_t m_pending_bytes = 0;
+  bool m_shutdown = false;
+  std::string m_error;
+};
+
 struct spiral_file_mmap_internal {
   zipFile zf = nullptr;
   std::shared_ptr<autoclosing_fd> fd;
+  std::shared_ptr<spiral_file_part_writer> part_writer;
 };
 
+spiral_file_part_writer::spiral_file_part_writer(std::shared_ptr<autoclosing_fd> fd,
+                                                 unsigned num_threads)
+    : m_fd(fd) {
+  CHECK_GT(num_threads, 0);
+  for (unsigned i = 0; i < num_threads; ++i) {
+    m_threads.emplace_back([this]() { run_writer(); });
+  }
+}
+
+spiral_file_part_writer::~spiral_file_part_writer() {
+  {
+    std::unique_lock<std::mutex> l(m_mu);
+    m_chunk_done.wait(l, [this]() { return m_pending_bytes == 0; });
+    m_shutdown = true;
+  }
+  m_chunk_added.notify_all();
+  for (auto& t : m_threads) {
+    t.join();
+  }
+  if (!m_error.empty()) {
+    SPLOG("Error writing spiral file parts: %s", m_error.c_str());
+  }
+}
+
+std::shared_ptr<spiral_file_part_writer::part_state> spiral_file_part_writer::enqueue(
+    std::unique_lock<std::mutex>& l, const membuf& contents, size_t offset) {
+  auto part = std::make_shared<part_state>();
+
+  // Don't let too much memory build up waiting to be written.
+  m_chunk_done.wait(l, [&]() {
+    return m_pending_bytes == 0 ||
+           m_pending_bytes + contents.size() <= k_max_pending_write_bytes;
+  });
+
+  for (size_t chunk_start = 0; chunk_start < contents.size(); chunk_start += k_max_write_chunk) {
+    size_t chunk_size = std::min(k_max_write_chunk, contents.size() - chunk_start);
+    m_chunks.push_back(chunk{contents.subbuf(chunk_start, chunk_size), offset + chunk_start, part});
+    ++part->chunks_left;
+  }
+  m_pending_bytes += contents.size();
+  m_chunk_added.notify_all();
+  return part;
+}
+
+void spiral_file_part_writer::write(const membuf& contents, size_t offset, bool wait) {
+  std::unique_lock<std::mutex> l(m_mu);
+  throw_if_error(l);
+
+  std::shared_ptr<part_state> part = enqueue(l, contents, offset);
+
+  if (wait) {
+    m_chunk_done.wait(l, [&]() { return part->chunks_left == 0; });
+    throw_if_error(l);
+  }
+}
+
+void spiral_file_part_writer::write_nothrow(const membuf& contents, size_t offset) noexcept {
+  std::unique_lock<std::mutex> l(m_mu);
+  if (!m_error.empty()) {
+    // The file is already bad; flush will report it.
+    return;
+  }
+  try {
+    enqueue(l, contents, offset);
+  } catch (const std::exception& e) {
+    m_error = std::string("Unable to queue spiral file part: ") + e.what();
+  }
+}
+
+void spiral_file_part_writer::flush() {
+  std::unique_lock<std::mutex> l(m_mu);
+  m_chunk_done.wait(l, [this]() { return m_pending_bytes == 0; });
+  throw_if_error(l);
+}
+
+void spiral_file_part_writer::throw_if_error(std::unique_lock<std::mutex>& l) {
+  if (!m_error.empty()) {
+    throw(io_exception(m_error));
+  }
+}
+
+void spiral_file_part_writer::run_writer() {
+  std::unique_lock<std::mutex> l(m_mu);
+  for (;;) {
+    m_chunk_added.wait(l, [this]() { return m_shutdown || !m_chunks.empty(); });
+    if (m_chunks.empty()) {
+      return;
+    }
+    chunk c = std::move(m_chunks.front());
+    m_chunks.pop_front();
+
+    l.unlock();
+    std::string error;
+    try {
+      pwrite_all(m_fd->fd(), c.contents.data(), c.contents.size(), c.offset);
+    } catch (const io_exception& e) {
+      error = e.message();
+    }
+    size_t written = c.contents.size();
+    // Release our reference to the contents before reporting completion.
+    c.contents = membuf();
+    l.lock();
+
+    if (!error.empty() && m_error.empty()) {
+      m_error = error;
+    }
+    --c.part->chunks_left;
+    m_pending_bytes -= written;
+    m_chunk_done.notify_all();
+  }
+}
+
 namespace {
 
 void* fopen_func(void* opaque, const void* /* filename */, int /* mode */) {
@@ -315,26 +660,27 @@ class file_writing_membuf : public mutable_membuf_impl {
   // anonymous pages.
   const size_t k_max_malloc_size = 1024 * 1024 * 4;  // 4 MB
 
-  file_writing_membuf(std::shared_ptr<autoclosing_fd> fd, size_t offset,
+  file_writing_membuf(std::shared_ptr<autoclosing_fd> fd,
+                      std::weak_ptr<spiral_file_part_writer> part_writer, size_t offset,
                       size_t size, const std::string& description)
-      : m_fd(fd), m_offset(offset) {
+      : m_fd(fd), m_part_writer(part_writer), m_offset(offset) {
     m_owned = mutable_membuf(new owned_membuf(size, description));
   }
 
   ~file_writing_membuf() {
-    size_t to_write = m_owned.size();
-    size_t offset = m_offset;
-    const char* buf = m_owned.data();
-
-    while (to_write) {
-      // Write a maximum of 64 megs per write call.
-      size_t to_write_this_chunk = std::min<size_t>(to_write, 64 * 1024 * 1024);
-      ssize_t nwrote = pwrite(m_fd->fd(), buf, to_write_this_chunk, offset);
-      CHECK_GT(nwrote, 0) << strerror(errno);
-      CHECK_LE(nwrote, to_write_this_chunk);
-      buf += nwrote;
-      offset += nwrote;
-      to_write -= nwrote;
+    // If the file is still open, hand the contents off to be written
+    // in the background so the caller can go on to the next part.
+    // Errors are raised when the file is closed.
+    std::shared_ptr<spiral_file_part_writer> part_writer = m_part_writer.lock();
+    if (part_writer) {
+      part_writer->write_nothrow(m_owned, m_offset);
+      return;
+    }
+
+    try {
+      pwrite_all(m_fd->fd(), m_owned.data(), m_owned.size(), m_offset);
+    } catch (const io_exception& e) {
+      LOG(FATAL) << e.message();
     }
   }
 
@@ -343,6 +689,7 @@ class file_writing_membuf : public mutable_membuf_impl {
 
  private:
   std::shared_ptr<autoclosing_fd> m_fd;
+  std::weak_ptr<spiral_file_part_writer> m_part_writer;
   mutable_membuf m_owned;
   size_t m_offset = 0;
 };
@@ -367,11 +714,30 @@ spiral_file_create_mmap::spiral_file_create_mmap(
   if (!m_internal->zf) {
     throw(io_exception("zipOpen2_64"));
   }
+
+  if (options.write_threads) {
+    m_internal->part_writer =
+        std::make_shared<spiral_file_part_writer>(m_internal->fd, options.write_threads);
+  }
 }
 
 void spiral_file_create_mmap::create_path_contents(
     const std::string& path, const membuf& contents,
     const spiral_file_options& options) {
+  if (m_internal->part_writer && contents.size() >= k_min_part_writer_size) {
+    // The caller may reuse the memory behind "contents" once we
+    // return, so wait for it to be written.
+    size_t part_offset = reserve_path(path, contents.size());
+    m_internal->part_writer->write(contents, part_offset, true /* wait */);
+    return;
+  }
+
+  begin_stored_path(path);
+  write_stored_path_data(contents);
+  end_stored_path();
+}
+
+void spiral_file_create_mmap::begin_stored_path(const std::string& path) {
   CHECK(m_internal);
   zip_fileinfo file_info = {0};
   int err = zipOpenNewFileInZip2_64(
@@ -380,23 +746,28 @@ void spiral_file_create_mmap::create_path_contents(
       0 /* comment */, 0 /* method: no compression */,
       Z_NO_COMPRESSION /* level */, 0 /* raw */, 1 /* zip64 */);
   throw_if_zip_error("zipOpenNewFileInZip64", err);
+}
 
+void spiral_file_create_mmap::write_stored_path_data(const membuf& contents) {
   membuf contents_left = contents;
 
   while (contents_left.size() > 0) {
     // zip library takes 32 bit size, so only write in 512 MB chunks.
     size_t to_write = std::min<size_t>(contents_left.size(), 512 * 1024 * 1024);
     CHECK_LT(to_write, 0x8FFFFFFF);
-    err = zipWriteInFileInZip(m_internal->zf, contents_left.data(), to_write);
+    int err = zipWriteInFileInZip(m_internal->zf, contents_left.data(), to_write);
     throw_if_zip_error("zipWriteFInileInZip", err);
     contents_left =
         contents_left.subbuf(to_write, contents_left.size() - to_write);
   }
 }
 
-mutable_membuf spiral_file_create_mmap::create_path(
-    const std::string& path, size_t part_size,
-    const spiral_file_options& options) {
+void spiral_file_create_mmap::end_stored_path() {
+  int err = zipCloseFileInZip(m_internal->zf);
+  throw_if_zip_error("zipCloseFileInZip", err);
+}
+
+size_t spiral_file_create_mmap::reserve_path(const std::string& path, size_t part_size) {
   zip_fileinfo file_info = {0};
   int err = zipOpenNewFileInZip2_64(
       m_internal->zf, path.c_str(), &file_info, NULL, 0, NULL,
@@ -432,9 +803,18 @@ mutable_membuf spiral_file_create_mmap::create_path(
   err = zipFlush(m_internal->zf);
   throw_if_zip_error("zipFlush(2)", err);
 
+  return part_offset;
+}
+
+mutable_membuf spiral_file_create_mmap::create_path(
+    const std::string& path, size_t part_size,
+    const spiral_file_options& options) {
+  size_t part_offset = reserve_path(path, part_size);
+
   if (options.delayed_write || part_size < options.small_object_threshold) {
-    return mutable_membuf(new file_writing_membuf(
-        m_internal->fd, part_offset, part_size, "spiral_file: " + path));
+    return mutable_membuf(new file_writing_membuf(m_internal->fd, m_internal->part_writer,
+                                                  part_offset, part_size,
+                                                  "spiral_file: " + path));
   } else {
     mutable_membuf whole_file(
         new mmap_buffer(m_filename, mmap_buffer::mode::read_write));
@@ -445,6 +825,12 @@ mutable_membuf spiral_file_create_mmap::create_path(
 size_t spiral_file_create_mmap::close() {
   CHECK(m_internal);
 
+  if (m_internal->part_writer) {
+    m_internal->part_writer->flush();
+    // Any parts released after this are written synchronously.
+    m_internal->part_writer.reset();
+  }
+
   int err = zipClose_64(m_internal->zf, 0);
   throw_if_zip_error("zipClose_64", err);
 
@@ -459,3 +845,131 @@ spiral_file_create_mmap::~spiral_file_create_mmap() {
     close();
   }
 }
+
+void archive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                         const spiral_file_archive_options& options,
+                         progress_handler_t progress) {
+  spiral_file_open_mmap src(src_path);
+  if (src.is_archived()) {
+    throw(io_exception(src_path + " is already archived"));
+  }
+  CHECK_GT(options.frame_size, 0);
+
+  size_t total_size = 0;
+  for (const auto& path : src.m_paths) {
+    total_size += path.second.size;
+  }
+
+  spiral_file_create_mmap dest(dest_path);
+  spiral_file_archive_index index;
+  index.version = k_archive_version;
+  size_t done_size = 0;
+  for (const auto& path : src.contents()) {
+    membuf contents = src.get_path(path, src.m_spiral_file_opts);
+    if (contents.size() < options.min_part_size) {
+      dest.create_path_contents(path, contents, src.m_spiral_file_opts);
+      done_size += contents.size();
+      continue;
+    }
+
+    spiral_file_archive_part part;
+    part.path = path;
+    part.size = contents.size();
+    part.frame_size = options.frame_size;
+    size_t num_frames = (part.size + part.frame_size - 1) / part.frame_size;
+    size_t stored_size = 0;
+
+    dest.begin_stored_path(path);
+    std::vector<std::string> compressed(k_archive_batch_frames);
+    for (size_t batch_start = 0; batch_start < num_frames; batch_start += k_archive_batch_frames) {
+      size_t batch_end = std::min(num_frames, batch_start + k_archive_batch_frames);
+      parallel_for(batch_start, batch_end, [&](size_t frame) {
+        size_t frame_start = frame * part.frame_size;
+        size_t frame_size = std::min(part.frame_size, part.size - frame_start);
+        std::string& out = compressed[frame - batch_start];
+        uLongf out_len = compressBound(frame_size);
+        out.resize(out_len);
+        int err = compress2(reinterpret_cast<Bytef*>(&out[0]), &out_len,
+                            reinterpret_cast<const Bytef*>(contents.data() + frame_start),
+                            frame_size, options.compression_level);
+        if (err != Z_OK) {
+          throw(io_exception("Unable to compress " + path + ": zlib error " +
+                             std::to_string(err)));
+        }
+        if (out_len >= frame_size) {
+          // Not compressible; store it as is.
+          out.assign(contents.data() + frame_start, frame_size);
+        } else {
+          out.resize(out_len);
+        }
+      });
+      for (size_t frame = batch_start; frame != batch_end; ++frame) {
+        const std::string& out = compressed[frame - batch_start];
+        dest.write_stored_path_data(
+            membuf(new borrowed_membuf(out.data(), out.size())));
+        stored_size += out.size();
+        part.frame_ends.push_back(stored_size);
+      }
+      done_size += std::min(part.size, batch_end * part.frame_size) -
+                   batch_start * part.frame_size;
+      progress(done_size * 1. / total_size);
+    }
+    dest.end_stored_path();
+
+    SPLOG("Archived %s: %ld bytes compressed to %ld bytes", path.c_str(), part.size, stored_size);
+    index.parts.push_back(std::move(part));
+  }
+
+  dest.create_path_contents(
+      k_archive_index_pathname,
+      owned_membuf::from_str(json_serialize(index), "spiral_file_archive_index"),
+      src.m_spiral_file_opts);
+  dest.close();
+  progress(1);
+}
+
+void unarchive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                           progress_handler_t progress) {
+  spiral_file_open_mmap src(src_path);
+  if (!src.is_archived()) {
+    throw(io_exception(src_path + " is not archived"));
+  }
+
+  size_t total_size = 0;
+  for (const auto& path : src.m_paths) {
+    total_size += path.second.size;
+  }
+
+  spiral_file_create_mmap dest(dest_path);
+  size_t done_size = 0;
+  for (const auto& path_and_info : src.m_paths) {
+    const std::string& path = path_and_info.first;
+    const auto& info = path_and_info.second;
+    if (!info.archived) {
+      dest.create_path_contents(path, src.get_path(path, src.m_spiral_file_opts),
+                                src.m_spiral_file_opts);
+      done_size += info.size;
+      continue;
+    }
+
+    // Decode a batch of frames at a time so we don't need to hold
+    // the whole part in memory.
+    size_t batch_size = info.frame_size * k_archive_batch_frames;
+    dest.begin_stored_path(path);
+    for (size_t offset = 0; offset < info.size; offset += batch_size) {
+      size_t size = std::min(batch_size, info.size - offset);
+      dest.write_stored_path_data(
+          src.get_path_range(path, offset, size, src.m_spiral_file_opts));
+      done_size += size;
+      progress(done_size * 1. / total_size);
+    }
+    dest.end_stored_path();
+  }
+  dest.close();
+  progress(1);
+}
+
+bool spiral_file_is_archived(const std::string& path) {
+  spiral_file_open_mmap f(path);
+  return f.is_archived();
+}
@@ -5,6 +5,42 @@
 
 #include <mutex>
 
+// Archived spiral files are still zip files, but each large part is
+// stored as a sequence of independently compressed zlib frames.  An
+// index of the frames is saved in "archive_index.json".
+//
+// spiral_file_open_mmap opens archived files transparently.  Opening
+// an archived part decompresses all its frames in parallel into an
+// anonymous in-memory cache.  Alternatively, open_membuf_range only
+// decodes the frames overlapping the requested range.  Archived parts
+// cannot be opened for writing.
+struct spiral_file_archive_options {
+  // Uncompressed size of each frame.  Smaller frames make range
+  // reads cheaper, but compress less well.
+  size_t frame_size = 1024 * 1024;
+
+  // zlib compression level.
+  int compression_level = 6;
+
+  // Parts smaller than this are stored uncompressed.
+  size_t min_part_size = 64 * 1024;
+};
+
+// Copies the spiral file at src_path to dest_path, compressing its
+// parts.
+void archive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                         const spiral_file_archive_options& options = spiral_file_archive_options(),
+                         progress_handler_t progress = null_progress_handler);
+
+// Copies an archived spiral file to dest_path, decompressing its parts
+// so they can be mmapped again.
+void unarchive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                           progress_handler_t progress = null_progress_handler);
+
+// Returns true if the spiral file at the given path was written by
+// archive_spiral_file.
+bool spiral_file_is_archived(const std::string& path);
+
 class spiral_file_mmap_autoclosing_fd;
 
 class spiral_file_open_mmap : public spiral_file_open {
@@ -21,17 +57,37 @@ class spiral_file_open_mmap : public spiral_file_open {
 
   bool is_mutable() const override;
 
+  // True if this file was written by archive_spiral_file.
+  bool is_archived() const { return m_archived; }
+
  private:
+  friend void archive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                                  const spiral_file_archive_options& options,
+                                  progress_handler_t progress);
+  friend void unarchive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                                    progress_handler_t progress);
+
   struct path_info {
     size_t offset;
+    // Uncompressed size.
     size_t size;
 
+    // For archived parts: the size of the compressed frames as stored,
+    // and the offset of the end of each frame relative to "offset".
+    bool archived = false;
+    size_t stored_size = 0;
+    size_t frame_size = 0;
+    std::vector<uint64_t> frame_ends;
+
     mutable std::mutex mu;
     mutable boost::optional<mutable_membuf> in_mem_buf;
   };
 
   spiral_file_options m_spiral_file_opts;
   membuf get_path(const std::string& path, const spiral_file_options& options) const override;
+  // For archived parts, only decodes the frames overlapping the range.
+  membuf get_path_range(const std::string& path, size_t offset, size_t size,
+                        const spiral_file_options& options) const override;
   mutable_membuf get_mutable_path(const std::string& path,
                                   const spiral_file_options& options) override;
   bool path_is_present(const std::string& path) const override;
@@ -39,12 +95,18 @@ class spiral_file_open_mmap : public spiral_file_open {
 
   // Reads the zip format from m_buf into m_paths.
   void import_zip_contents(const std::string& filename);
+  // Reads the frame index of an archived file.
+  void import_archive_index();
+  // Decompresses frames [first_frame, last_frame) of an archived
+  // part into "out".
+  void decode_frames(const path_info& i, size_t first_frame, size_t last_frame, char* out) const;
 
   std::shared_ptr<spiral_file_mmap_autoclosing_fd> m_fd;
   boost::optional<mutable_membuf> m_mutable_mmap_buffer;
   boost::optional<membuf> m_mmap_buffer;
   std::map<std::string, path_info> m_paths;
   bool m_mutable = false;
+  bool m_archived = false;
 };
 
 struct spiral_file_mmap_internal;
@@ -61,6 +123,21 @@ class spiral_file_create_mmap : public spiral_file_create {
  private:
   friend class file_writing_membuf;
   friend struct spiral_file_mmap_internal;
+  friend void archive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                                  const spiral_file_archive_options& options,
+                                  progress_handler_t progress);
+  friend void unarchive_spiral_file(const std::string& src_path, const std::string& dest_path,
+                                    progress_handler_t progress);
+
+  // Writes a stored (uncompressed) path whose size is not known in
+  // advance.
+  void begin_stored_path(const std::string& path);
+  void write_stored_path_data(const membuf& contents);
+  void end_stored_path();
+
+  // Adds an entry for "path" to the zip directory and reserves space
+  // for its contents.  Returns the file offset of the contents.
+  size_t reserve_path(const std::string& path, size_t size);
 
   mutable_membuf create_path(const std::string& path, size_t size,
                              const spiral_file_options& options) override;
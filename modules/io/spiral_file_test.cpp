@@ -8,6 +8,9 @@
 #include "modules/io/spiral_file_mem.h"
 #include "modules/io/spiral_file_mmap.h"
 
+#include <boost/filesystem.hpp>
+#include <random>
+
 using namespace testing;
 
 namespace {
@@ -189,7 +192,9 @@ std::vector<spiral_file_options> all_options() {
   read_into_ram.small_object_threshold = 1;
   spiral_file_options delayed_write;
   delayed_write.delayed_write = true;
-  return {defaults, read_into_ram, delayed_write};
+  spiral_file_options synchronous_write;
+  synchronous_write.write_threads = 0;
+  return {defaults, read_into_ram, delayed_write, synchronous_write};
 }
 
 INSTANTIATE_TEST_CASE_P(mem_spiral_file_tests_tests, spiral_file_test,
@@ -199,6 +204,134 @@ INSTANTIATE_TEST_CASE_P(mmap_spiral_file_tests, spiral_file_test,
                         ::testing::Combine(::testing::Values(MMAP_TEST),
                                            ::testing::ValuesIn(all_options())));
 
+class spiral_file_part_writer_test : public TestWithParam<unsigned /* write threads */> {};
+
+TEST_P(spiral_file_part_writer_test, large_parts) {
+  std::string path = CONF_S(temp_root) + "/spiral_file_part_writer_test";
+  constexpr size_t k_num_parts = 6;
+  constexpr size_t k_part_size = 3 * 1024 * 1024 + 17;
+
+  auto part_contents = [](size_t part_num) {
+    std::string contents(k_part_size, '\0');
+    std::mt19937 rand_source(part_num);
+    for (char& c : contents) {
+      c = rand_source();
+    }
+    return contents;
+  };
+
+  spiral_file_options options;
+  options.write_threads = GetParam();
+  {
+    spiral_file_create_mmap c(path, options);
+    spiral_file_create_state state = c.create();
+    state.set_version("part_writer_test", my_serializable::my_version);
+    std::vector<mutable_membuf> created;
+    for (size_t i = 0; i < k_num_parts; ++i) {
+      std::string contents = part_contents(i);
+      if (i % 2) {
+        state.create_membuf("part" + std::to_string(i),
+                            owned_membuf::from_str(contents, "spiral_file_test"));
+      } else {
+        mutable_membuf buf = state.create_membuf("part" + std::to_string(i), k_part_size);
+        memcpy(buf.mutable_data(), contents.data(), k_part_size);
+        created.push_back(buf);
+      }
+    }
+    state.create_membuf("small", owned_membuf::from_str("small part", "spiral_file_test"));
+    // Release some parts before closing, and some after.
+    created.erase(created.begin());
+    c.close();
+  }
+
+  spiral_file_open_mmap o(path);
+  spiral_file_open_state state = o.open();
+  state.enforce_max_version("part_writer_test", my_serializable::my_version);
+  for (size_t i = 0; i < k_num_parts; ++i) {
+    EXPECT_EQ(part_contents(i), state.open_membuf("part" + std::to_string(i)).str()) << i;
+  }
+  EXPECT_EQ("small part", state.open_membuf("small").str());
+}
+
+INSTANTIATE_TEST_CASE_P(spiral_file_part_writer_tests, spiral_file_part_writer_test,
+                        ::testing::Values(0, 1, 4));
+
+TEST(spiral_file_archive_test, round_trip) {
+  std::string orig_path = CONF_S(temp_root) + "/spiral_file_archive_orig";
+  std::string archived_path = CONF_S(temp_root) + "/spiral_file_archive_archived";
+  std::string unarchived_path = CONF_S(temp_root) + "/spiral_file_archive_unarchived";
+
+  constexpr size_t k_part_size = 100000;
+  std::string compressible, incompressible;
+  std::mt19937 rand_source(1);
+  for (size_t i = 0; i < k_part_size; ++i) {
+    compressible.push_back("ACGT"[(i / 7) % 4]);
+    incompressible.push_back(char(rand_source()));
+  }
+
+  std::string uuid;
+  {
+    spiral_file_create_mmap c(orig_path);
+    spiral_file_create_state state = c.create();
+    state.set_version("archive_test", my_serializable::my_version);
+    state.create_membuf("compressible", owned_membuf::from_str(compressible, "spiral_file_test"));
+    state.create_membuf("incompressible",
+                        owned_membuf::from_str(incompressible, "spiral_file_test"));
+    state.create_membuf("small", owned_membuf::from_str("small part", "spiral_file_test"));
+    uuid = c.uuid();
+  }
+  EXPECT_FALSE(spiral_file_is_archived(orig_path));
+
+  spiral_file_archive_options options;
+  options.frame_size = 4096;
+  options.min_part_size = 1024;
+  archive_spiral_file(orig_path, archived_path, options);
+  EXPECT_TRUE(spiral_file_is_archived(archived_path));
+  EXPECT_THROW(archive_spiral_file(archived_path, orig_path + ".again", options), io_exception);
+  EXPECT_LT(boost::filesystem::file_size(archived_path),
+            boost::filesystem::file_size(orig_path) - k_part_size / 2);
+
+  {
+    spiral_file_open_mmap o(archived_path);
+    EXPECT_EQ(uuid, o.uuid());
+    EXPECT_THAT(static_cast<const spiral_file_open&>(o).contents(),
+                UnorderedElementsAre("file_info.json", "part_info.json", "compressible",
+                                     "incompressible", "small"));
+    spiral_file_open_state state = o.open();
+    state.enforce_max_version("archive_test", my_serializable::my_version);
+
+    // Ranges that cross frame boundaries should only need those frames.
+    EXPECT_EQ(compressible.substr(4000, 5000),
+              state.open_membuf_range("compressible", 4000, 5000).str());
+    EXPECT_EQ(incompressible.substr(k_part_size - 10, 10),
+              state.open_membuf_range("incompressible", k_part_size - 10, 10).str());
+    EXPECT_EQ("part", state.open_membuf_range("small", 6, 4).str());
+
+    EXPECT_EQ(compressible, state.open_membuf("compressible").str());
+    EXPECT_EQ(incompressible, state.open_membuf("incompressible").str());
+    EXPECT_EQ("small part", state.open_membuf("small").str());
+  }
+  {
+    spiral_file_open_mmap o(archived_path, mmap_buffer::mode::read_write);
+    spiral_file_open_state state = o.open();
+    state.enforce_max_version("archive_test", my_serializable::my_version);
+    EXPECT_THROW(state.open_mutable_membuf("compressible"), io_exception);
+  }
+
+  unarchive_spiral_file(archived_path, unarchived_path);
+  EXPECT_FALSE(spiral_file_is_archived(unarchived_path));
+  {
+    spiral_file_open_mmap o(unarchived_path);
+    EXPECT_EQ(uuid, o.uuid());
+    spiral_file_open_state state = o.open();
+    state.enforce_max_version("archive_test", my_serializable::my_version);
+    EXPECT_EQ(compressible, state.open_membuf("compressible").str());
+    EXPECT_EQ(incompressible, state.open_membuf("incompressible").str());
+    EXPECT_EQ("small part", state.open_membuf("small").str());
+  }
+  EXPECT_EQ(boost::filesystem::file_size(orig_path), boost::filesystem::file_size(unarchived_path));
+}
+
 // TODO(nils): Test error conditions better, for instance:
 // * Missing version info when writing
 // * Missing version check when reading
@@ -1,30 +1,35 @@
 
 #include "modules/mapred/kv_sort.h"
+#include "modules/io/parallel.h"
 #include <algorithm>
-#include <boost/foreach.hpp>
+#include <string.h>
 
-kv_sort::kv_pair::kv_pair(const std::string& _key, const std::string& _value)
-	: key(_key)
-	, value(_value) 
-{}
+namespace {
 
-kv_sort::ptr_compare::ptr_compare(std::shared_ptr<sorter> order) 
-	: m_order(order) 
-{}
+// Size of each arena block, unless a record is bigger than this.
+constexpr size_t k_arena_block_size = 1024 * 1024;
 
-bool kv_sort::ptr_compare::operator()(pair_ptr a, pair_ptr b)
+// Don't bother splitting up sorts smaller than this between threads.
+constexpr size_t k_min_records_per_thread = 16 * 1024;
+
+uint64_t sort_key_prefix(const char* sort_key, size_t size)
 {
-	int r = m_order->compare(a->key, b->key);
-	if (r == 0)
-		return a < b;
-	return r < 0;
+	uint64_t prefix = 0;
+	for (size_t i = 0; i < sizeof(uint64_t); i++) {
+		prefix <<= 8;
+		if (i < size) {
+			prefix |= uint8_t(sort_key[i]);
+		}
+	}
+	return prefix;
 }
 
+}  // namespace
+
 kv_sort::kv_sort(const std::string& serialized_params) 
 	: m_sorted(true)
 	, m_records_size(0)
-	, m_order(nullptr)
-	, m_current(m_pairs.begin())
+	, m_current(m_records.begin())
 {
 	kv_sort::param sort_params;
 	msgpack_deserialize(sort_params, serialized_params);
@@ -34,8 +39,7 @@ kv_sort::kv_sort(const std::string& serialized_params)
 	{
 		m_splitter = splitter_registry::get_safe(sort_params.splitter, sort_params.first_key);
 	}
-	
-	m_order = ptr_compare(m_sorter);
+	m_binary_keys = m_sorter->has_binary_keys();
 }
 
 kv_sort::~kv_sort()
@@ -43,46 +47,153 @@ kv_sort::~kv_sort()
 	clear();
 }
 
+char* kv_sort::arena_alloc(size_t size)
+{
+	if (size > m_arena_left) {
+		size_t block_size = std::max(size, k_arena_block_size);
+		m_arena.emplace_back(new char[block_size]);
+		m_arena_next = m_arena.back().get();
+		m_arena_left = block_size;
+	}
+	char* result = m_arena_next;
+	m_arena_next += size;
+	m_arena_left -= size;
+	return result;
+}
+
 void kv_sort::write(const std::string& key, const std::string& value)
 {
 	m_sorted = false;
-	pair_ptr pair = new kv_pair(key, value);
-	m_pairs.push_back(pair);
+	CHECK_LT(key.size(), std::numeric_limits<uint32_t>::max());
+	CHECK_LT(value.size(), std::numeric_limits<uint32_t>::max());
+	CHECK_LT(m_records.size(), std::numeric_limits<uint32_t>::max());
+
+	record r;
+	r.key_size = key.size();
+	r.value_size = value.size();
+	r.index = m_records.size();
+	r.separate_sort_key = false;
+	r.sort_key_size = 0;
+	r.prefix = 0;
+
+	size_t data_size = key.size() + value.size();
+	if (m_binary_keys) {
+		m_sort_key.clear();
+		m_sorter->append_binary_key(m_sort_key, key);
+		CHECK_LT(m_sort_key.size(), std::numeric_limits<uint32_t>::max());
+		r.sort_key_size = m_sort_key.size();
+		r.separate_sort_key = (m_sort_key != key);
+		if (r.separate_sort_key) {
+			data_size += m_sort_key.size();
+		}
+		r.prefix = sort_key_prefix(m_sort_key.data(), m_sort_key.size());
+	} else {
+		m_keys.push_back(key);
+	}
+
+	char* data = arena_alloc(data_size);
+	memcpy(data, key.data(), key.size());
+	memcpy(data + key.size(), value.data(), value.size());
+	if (r.separate_sort_key) {
+		memcpy(data + key.size() + value.size(), m_sort_key.data(), m_sort_key.size());
+	}
+	r.data = data;
+
+	m_records.push_back(r);
 	m_records_size += kv_serial_size(key.size(), value.size());
 }
 
+bool kv_sort::binary_less(const record& a, const record& b) const
+{
+	if (a.prefix != b.prefix) {
+		return a.prefix < b.prefix;
+	}
+	// The prefixes cover the first 8 bytes of each key.
+	size_t common = std::min(a.sort_key_size, b.sort_key_size);
+	if (common > sizeof(uint64_t)) {
+		int r = memcmp(a.sort_key() + sizeof(uint64_t), b.sort_key() + sizeof(uint64_t),
+			common - sizeof(uint64_t));
+		if (r != 0) {
+			return r < 0;
+		}
+	}
+	if (a.sort_key_size != b.sort_key_size) {
+		return a.sort_key_size < b.sort_key_size;
+	}
+	return a.index < b.index;
+}
+
+bool kv_sort::sorter_less(const record& a, const record& b) const
+{
+	int r = m_sorter->compare(m_keys[a.index], m_keys[b.index]);
+	if (r == 0)
+		return a.index < b.index;
+	return r < 0;
+}
+
+void kv_sort::sort_records()
+{
+	auto less = [this](const record& a, const record& b) {
+		return m_binary_keys ? binary_less(a, b) : sorter_less(a, b);
+	};
+
+	// Sort a section per thread, then merge sections pairwise.
+	size_t num_sections = std::max<size_t>(1, std::min<size_t>(get_thread_count(),
+		m_records.size() / k_min_records_per_thread));
+	std::vector<collection_t::iterator> bounds;
+	for (size_t i = 0; i <= num_sections; i++) {
+		bounds.push_back(m_records.begin() + m_records.size() * i / num_sections);
+	}
+
+	parallel_for(0, num_sections, [&](size_t section) {
+		std::sort(bounds[section], bounds[section + 1], less);
+	});
+
+	for (size_t width = 1; width < num_sections; width *= 2) {
+		size_t num_merges = (num_sections + 2 * width - 1) / (2 * width);
+		parallel_for(0, num_merges, [&](size_t merge) {
+			size_t start = merge * 2 * width;
+			size_t mid = std::min(start + width, num_sections);
+			size_t end = std::min(start + 2 * width, num_sections);
+			std::inplace_merge(bounds[start], bounds[mid], bounds[end], less);
+		});
+	}
+}
+
 void kv_sort::prep_read()
 {
 	if (!m_sorted)
 	{
-		std::sort(m_pairs.begin(), m_pairs.end(), m_order);
-		m_current = m_pairs.begin();
+		sort_records();
+		m_current = m_records.begin();
 		m_sorted = true;
 	}
 }
 
 bool kv_sort::read(std::string& key, std::string& value)
 {
-	if (m_current == m_pairs.end())
+	if (m_current == m_records.end())
 		return false;
 
-	key = (*m_current)->key;
-	value = (*m_current)->value;
+	key.assign(m_current->key(), m_current->key_size);
+	value.assign(m_current->value(), m_current->value_size);
 	m_current++;
 	return true;
 }
 
 void kv_sort::reset()
 {
-	m_current = m_pairs.begin();
+	m_current = m_records.begin();
 }
 
 void kv_sort::clear()
 {
-	BOOST_FOREACH(pair_ptr p, m_pairs)
-		delete p;
-	m_pairs.clear();
-	m_current = m_pairs.begin();
+	m_records.clear();
+	m_keys.clear();
+	m_arena.clear();
+	m_arena_left = 0;
+	m_arena_next = nullptr;
+	m_current = m_records.begin();
 	m_records_size = 0;
 }
 
@@ -92,7 +203,6 @@ void kv_sort::set_file_info(file_info& fi) const
 		throw io_exception("kv_sort wasn't sorted before trying to get file_info");
 	fi.size = get_size();
 	fi.num_records = get_num_records();
-	fi.first_key = (*m_pairs.begin())->key;
-	fi.last_key = (*m_pairs.rbegin())->key;
+	fi.first_key.assign(m_records.begin()->key(), m_records.begin()->key_size);
+	fi.last_key.assign(m_records.rbegin()->key(), m_records.rbegin()->key_size);
 }
-
@@ -6,29 +6,36 @@
 #include "modules/mapred/sorter.h"
 #include "modules/mapred/manifest.h"
 #include "modules/mapred/splitter.h"
+#include <memory>
 #include <vector>
 #include <queue>
 #include <set>
 
 class kv_sort : public kv_sink, public reset_kv_source
 {
-	struct kv_pair
+	// Records are stored contiguously in an arena instead of being
+	// allocated individually.  Each record's data consists of the key,
+	// the value, and then the binary sort key if it's different from
+	// the key.
+	struct record
 	{
-        	kv_pair(const std::string& key, const std::string& value);
-        	std::string key;
-        	std::string value;
-	};
-	typedef const kv_pair *pair_ptr;
-	class ptr_compare
-	{
-	public: 
-        	ptr_compare(std::shared_ptr<sorter> order);
-        	bool operator()(pair_ptr a, pair_ptr b);
-	private:
-        	std::shared_ptr<sorter> m_order;
+		// First 8 bytes of the binary sort key, big endian and zero
+		// padded, so most comparisons don't need to look at the data.
+		uint64_t prefix;
+		const char* data;
+		uint32_t key_size;
+		uint32_t value_size;
+		uint32_t sort_key_size;
+		// Insertion order, used to keep the sort stable.
+		uint32_t index;
+		bool separate_sort_key;
+
+		const char* key() const { return data; }
+		const char* value() const { return data + key_size; }
+		const char* sort_key() const { return separate_sort_key ? data + key_size + value_size : data; }
 	};
 
-	typedef std::vector<pair_ptr> collection_t;
+	typedef std::vector<record> collection_t;
 
 public:
 	struct param
@@ -59,20 +66,38 @@ public:
 	void clear();
 	bool oversized(size_t goal_size) const { return (get_size() + 64 * get_num_records()) > goal_size; }
 	bool legal_split(const std::string& key) const { return true; }
-	size_t get_num_records() const { return m_pairs.size(); }
+	size_t get_num_records() const { return m_records.size(); }
 	size_t get_size() const { return m_records_size; }
 	void set_file_info(file_info& fi) const;
 	bool split_now(const std::string& key) const { return m_splitter ? (*m_splitter)(key) : false; }
 	void update_split(const std::string& key) { if (m_splitter) m_splitter->set_initial_key(key); }
 
 private:
+	// Sorts the records in memory using multiple threads.
+	void sort_records();
+	// Copies "size" bytes to the arena and returns where they were put.
+	char* arena_alloc(size_t size);
+	bool binary_less(const record& a, const record& b) const;
+	bool sorter_less(const record& a, const record& b) const;
+
 	bool m_sorted;
 	size_t m_records_size;
 	std::shared_ptr<sorter> m_sorter;
 	std::unique_ptr<splitter> m_splitter;
-	ptr_compare m_order;
-	collection_t m_pairs;
+	bool m_binary_keys = false;
+	collection_t m_records;
 	collection_t::const_iterator m_current;
+
+	// Blocks of record data.
+	std::vector<std::unique_ptr<char[]>> m_arena;
+	size_t m_arena_left = 0;
+	char* m_arena_next = nullptr;
+
+	// Keys in insertion order, only kept if the sorter doesn't support
+	// binary keys.
+	std::vector<std::string> m_keys;
+	// Scratch space for encoding binary keys.
+	std::string m_sort_key;
 };
 
 #endif
@@ -7,6 +7,11 @@
 #include "modules/mapred/map_task.h"
 #include "modules/io/config.h"
 #include "modules/io/make_unique.h"
+#include "modules/io/parallel.h"
+#include "modules/mapred/kv_sort.h"
+
+#include <chrono>
+#include <random>
 
 void main_sort_test(const std::string& encoding)
 {
@@ -61,3 +66,129 @@ TEST(sort_test, gzip)
 {
 	main_sort_test(codec::gzip);
 }
+
+namespace {
+
+// Same order as the "uint64" sorter, but without binary keys, so
+// kv_sort has to call compare.
+class uint64_compare_only_sorter : public simple_sorter<uint64_t>
+{
+public:
+	uint64_compare_only_sorter(const std::string& params) : simple_sorter<uint64_t>(params) {}
+	bool has_binary_keys() const override { return false; }
+};
+
+REGISTER_1(sorter, uint64_compare_only, const std::string&);
+
+std::vector<std::pair<std::string, std::string>> kv_sort_all(
+	const std::string& sorter_name, const std::vector<std::pair<std::string, std::string>>& input)
+{
+	kv_sort sorted(msgpack_serialize(kv_sort::param(sorter_name, "")));
+	for (const auto& kv : input) {
+		sorted.write(kv.first, kv.second);
+	}
+	sorted.prep_read();
+	std::vector<std::pair<std::string, std::string>> result;
+	std::string key, value;
+	while (sorted.read(key, value)) {
+		result.emplace_back(key, value);
+	}
+	return result;
+}
+
+}  // namespace
+
+TEST(sort_test, kv_sort_lexical)
+{
+	std::vector<std::pair<std::string, std::string>> input;
+	std::mt19937 rand_source(1);
+	for (size_t i = 0; i < 100000; i++) {
+		// Short keys with lots of duplicates, some of them prefixes
+		// of others, and some with high bit characters.
+		std::string key;
+		size_t key_len = rand_source() % 12;
+		for (size_t j = 0; j < key_len; j++) {
+			key.push_back("ab\xff\0"[rand_source() % 4]);
+		}
+		input.emplace_back(key, std::to_string(i));
+	}
+	std::vector<std::pair<std::string, std::string>> expected = input;
+	std::stable_sort(expected.begin(), expected.end(),
+		[](const std::pair<std::string, std::string>& a, const std::pair<std::string, std::string>& b) {
+			return a.first < b.first;
+		});
+
+	size_t orig_threads = get_thread_count();
+	for (size_t threads : {1, 4}) {
+		set_thread_count(threads);
+		EXPECT_TRUE(kv_sort_all("lexical", input) == expected) << threads;
+	}
+	set_thread_count(orig_threads);
+}
+
+TEST(sort_test, kv_sort_binary_keys_match_compare)
+{
+	std::vector<std::pair<std::string, std::string>> input;
+	std::mt19937_64 rand_source(1);
+	for (size_t i = 0; i < 100000; i++) {
+		uint64_t key = rand_source();
+		if (i % 3) {
+			key %= 1000;
+		}
+		input.emplace_back(msgpack_serialize(key), std::to_string(i));
+	}
+
+	size_t orig_threads = get_thread_count();
+	for (size_t threads : {1, 4}) {
+		set_thread_count(threads);
+		auto sorted = kv_sort_all("uint64", input);
+		EXPECT_TRUE(sorted == kv_sort_all("uint64_compare_only", input)) << threads;
+
+		uint64_t prev = 0;
+		for (const auto& kv : sorted) {
+			uint64_t key;
+			msgpack_deserialize(key, kv.first);
+			ASSERT_LE(prev, key);
+			prev = key;
+		}
+	}
+	set_thread_count(orig_threads);
+}
+
+TEST(sort_test, binary_key_integers)
+{
+	std::vector<int64_t> vals = {std::numeric_limits<int64_t>::min(), -1000, -1, 0, 1, 1000,
+		std::numeric_limits<int64_t>::max()};
+	for (size_t i = 1; i < vals.size(); i++) {
+		std::string a, b;
+		append_binary_key(a, vals[i - 1]);
+		append_binary_key(b, vals[i]);
+		EXPECT_LT(a, b) << vals[i - 1] << " " << vals[i];
+	}
+}
+
+// Reports kv_sort throughput.  Normally the test is disabled.
+TEST(sort_test, DISABLED_kv_sort_benchmark)
+{
+	constexpr size_t k_num_records = 2000000;
+	std::vector<std::pair<std::string, std::string>> input;
+	std::mt19937_64 rand_source(1);
+	for (size_t i = 0; i < k_num_records; i++) {
+		input.emplace_back(msgpack_serialize(uint64_t(rand_source())), std::string(20, 'x'));
+	}
+
+	for (const std::string& sorter_name : {"uint64_compare_only", "uint64"}) {
+		kv_sort sorted(msgpack_serialize(kv_sort::param(sorter_name, "")));
+		auto start = std::chrono::steady_clock::now();
+		for (const auto& kv : input) {
+			sorted.write(kv.first, kv.second);
+		}
+		sorted.prep_read();
+		std::string key, value;
+		while (sorted.read(key, value)) {
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		SPLOG("kv_sort with %s sorter: %ld records in %.2f seconds, %.0f records/sec",
+			sorter_name.c_str(), k_num_records, elapsed.count(), k_num_records / elapsed.count());
+	}
+}
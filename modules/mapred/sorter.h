@@ -3,10 +3,27 @@
 #define __sorter_h__
 
 #include <string>
+#include <type_traits>
 
 #include "modules/io/msgpack_transfer.h"
 #include "modules/io/registry.h"
 
+// Appends "value" to "out" such that comparing the results bytewise
+// gives the same order as comparing the values numerically.
+template<class T>
+typename std::enable_if<std::is_integral<T>::value>::type append_binary_key(std::string& out, T value)
+{
+	typedef typename std::make_unsigned<T>::type unsigned_t;
+	unsigned_t encoded = unsigned_t(value);
+	if (std::is_signed<T>::value) {
+		// Flip the sign bit so negative values sort first.
+		encoded ^= unsigned_t(1) << (sizeof(T) * 8 - 1);
+	}
+	for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+		out.push_back(char((encoded >> shift) & 0xFF));
+	}
+}
+
 class sorter
 {
 public:
@@ -19,6 +36,18 @@ public:
 	virtual std::string bump_back(const std::string& key) const { return key; }
 	virtual size_t partition(const std::string& key, size_t num_partitions) const = 0;
 
+	// Sorters may optionally provide an order-preserving binary
+	// encoding of their keys.  If has_binary_keys returns true,
+	// append_binary_key must append an encoding of "key" to "out" such
+	// that comparing encodings with memcmp (with a prefix sorting
+	// before anything longer) gives the same order as compare.  This
+	// lets kv_sort sort without deserializing keys.
+	virtual bool has_binary_keys() const { return false; }
+	virtual void append_binary_key(std::string& out, const std::string& key) const
+	{
+		throw io_exception("Sorter does not support binary keys");
+	}
+
 	inline bool gt(const std::string& key1, const std::string& key2) { return this->compare(key1, key2) >= 1; }
 	inline bool lt(const std::string& key1, const std::string& key2) { return this->compare(key1, key2) <= -1; }
 };
@@ -43,6 +72,24 @@ public:
 	{
 		return 0; // Correct but terrible is using partitioning
 	}
+
+	bool has_binary_keys() const override { return std::is_integral<T>::value; }
+	void append_binary_key(std::string& out, const std::string& key) const override
+	{
+		append_binary_key_impl(out, key, std::is_integral<T>());
+	}
+
+private:
+	void append_binary_key_impl(std::string& out, const std::string& key, std::true_type) const
+	{
+		T a;
+		msgpack_deserialize(a, key);
+		::append_binary_key(out, a);
+	}
+	void append_binary_key_impl(std::string& out, const std::string& key, std::false_type) const
+	{
+		sorter::append_binary_key(out, key);
+	}
 };
 
 DECLARE_REGISTRY_1(sorter, std::string const&);
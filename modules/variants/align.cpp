@@ -57,12 +57,21 @@ void aligner::on_assembly(assembly_ptr a) {
     std::cout << "Starting alignment of " << *a << " against " << s << "\n";
   }
 
+  if (w.s.end_pos() >= k_min_index_len) {
+    // Each piece of this assembly searches some part of this region of
+    // reference, so index it once up front instead of scanning it on
+    // every search.
+    m_index = make_unique<scaffold_match_index>(w.s);
+    m_index_start = w.v.left_offset;
+  }
+
   m_work.emplace_back(std::move(w));
   while (!m_work.empty()) {
     w = std::move(m_work.back());
     m_work.pop_back();
     process(a.get(), std::move(w));
   }
+  m_index.reset();
 
   std::sort(a->aligned_variants.begin(), a->aligned_variants.end());
   if (k_align_debug) {
@@ -101,8 +110,9 @@ void aligner::process(assembly* a, work_item w) {
   }
 
   aoffset_t match_len, seq_match_start, scaffold_match_start;
-  if (find_biggest_match_with_ends(m_options, w.v.seq, w.s, &match_len,
-                                   &seq_match_start, &scaffold_match_start)) {
+  if (find_biggest_match_with_ends(m_options, w.v.seq, w.s, &match_len, &seq_match_start,
+                                   &scaffold_match_start, m_index.get(),
+                                   w.v.left_offset - m_index_start)) {
     CHECK_GE(match_len, 0);
     work_item left;
     left.v.left_offset = w.v.left_offset;
@@ -157,14 +167,16 @@ bool aligner::find_biggest_match_with_ends(const assemble_options& options,
                                            dna_slice seq, const scaffold& s,
                                            aoffset_t* match_len,
                                            aoffset_t* seq_match_start,
-                                           aoffset_t* scaffold_match_start) {
+                                           aoffset_t* scaffold_match_start,
+                                           const scaffold_match_index* index,
+                                           aoffset_t index_offset) {
   if (k_align_debug) {
     std::cout << "Searching for biggest match with ends\n";
   }
   aoffset_t min_match_size;
   if (find_biggest_match(options, seq, s, match_len, seq_match_start,
                          scaffold_match_start, &min_match_size,
-                         anchor_type_t::ANCHORED_TO_BOTH)) {
+                         anchor_type_t::ANCHORED_TO_BOTH, index, index_offset)) {
     if (k_align_debug) {
       std::cout << "Found middle match of size " << *match_len << "\n";
     }
@@ -234,7 +246,9 @@ bool aligner::find_biggest_match(const assemble_options& options, dna_slice seq,
                                  aoffset_t* seq_match_start,
                                  aoffset_t* scaffold_match_start,
                                  aoffset_t* min_match_size,
-                                 anchor_type_t anchor) {
+                                 anchor_type_t anchor,
+                                 const scaffold_match_index* index,
+                                 aoffset_t index_offset) {
   *min_match_size =
       std::max<int>(seq.size(), s.end_pos()) / options.ref_align_factor;
 
@@ -261,6 +275,11 @@ bool aligner::find_biggest_match(const assemble_options& options, dna_slice seq,
   }
 
   *match_len = 0;
+  if (index && *min_match_size >= scaffold_match_index::k_min_match_len) {
+    return find_biggest_match_indexed(seq, s, *index, index_offset, match_len, seq_match_start,
+                                      scaffold_match_start, *min_match_size, anchor);
+  }
+
   auto match_sizes = boost::irange(*min_match_size, max_match_size + 1);
   auto match_sizes_it = std::upper_bound(
       match_sizes.begin(), match_sizes.end(), false, [&](bool found, int size) {
@@ -287,29 +306,84 @@ bool aligner::find_biggest_match(const assemble_options& options, dna_slice seq,
   return true;
 }
 
-bool aligner::find_match(dna_slice seq, const scaffold& s, int match_len,
-                         aoffset_t* seq_match_start,
-                         aoffset_t* scaffold_match_start,
-                         anchor_type_t anchor) {
-  if (match_len > s.end_pos() || match_len > int(seq.size())) {
+bool aligner::find_biggest_match_indexed(dna_slice seq, const scaffold& s,
+                                         const scaffold_match_index& index,
+                                         aoffset_t index_offset, aoffset_t* match_len,
+                                         aoffset_t* seq_match_start,
+                                         aoffset_t* scaffold_match_start,
+                                         aoffset_t min_match_size, anchor_type_t anchor) {
+  // The biggest match is the longest maximal match, so there's no need
+  // to search over match sizes.
+  std::vector<scaffold_match_index::match> longest;
+  aoffset_t longest_len = 0;
+  index.find_matches(seq, index_offset, index_offset + s.end_pos(),
+                     [&](const scaffold_match_index::match& m) {
+                       if (m.len < longest_len) {
+                         return;
+                       }
+                       if (m.len > longest_len) {
+                         longest.clear();
+                         longest_len = m.len;
+                       }
+                       longest.push_back(m);
+                     });
+  if (longest_len < min_match_size) {
     return false;
   }
-  aoffset_t seq_anchor = 0;
-  aoffset_t scaffold_anchor = 0;
+
+  // Choose the same match as find_match would: the one closest to the
+  // anchor, breaking ties by the latest scaffold position and then the
+  // earliest sequence position.
+  aoffset_t seq_anchor, scaffold_anchor;
+  get_match_anchors(seq, s, longest_len, anchor, &seq_anchor, &scaffold_anchor);
+  int64_t best_distance = std::numeric_limits<int64_t>::max();
+  for (const auto& m : longest) {
+    aoffset_t scaffold_start = m.scaffold_start - index_offset;
+    int64_t distance =
+        llabs(int64_t(m.seq_start - seq_anchor) - int64_t(scaffold_start - scaffold_anchor));
+    if (distance < best_distance ||
+        (distance == best_distance &&
+         (scaffold_start > *scaffold_match_start ||
+          (scaffold_start == *scaffold_match_start && m.seq_start < *seq_match_start)))) {
+      best_distance = distance;
+      *seq_match_start = m.seq_start;
+      *scaffold_match_start = scaffold_start;
+    }
+  }
+  *match_len = longest_len;
+  return true;
+}
+
+void aligner::get_match_anchors(dna_slice seq, const scaffold& s, int match_len,
+                                anchor_type_t anchor, aoffset_t* seq_anchor,
+                                aoffset_t* scaffold_anchor) {
+  *seq_anchor = 0;
+  *scaffold_anchor = 0;
   switch (anchor) {
     case anchor_type_t::ANCHORED_TO_BOTH:
-      seq_anchor = (seq.size() - match_len) / 2;
-      scaffold_anchor = (s.end_pos() - match_len) / 2;
+      *seq_anchor = (seq.size() - match_len) / 2;
+      *scaffold_anchor = (s.end_pos() - match_len) / 2;
       break;
     case anchor_type_t::ANCHORED_TO_LEFT:
-      seq_anchor = 0;
-      scaffold_anchor = 0;
+      *seq_anchor = 0;
+      *scaffold_anchor = 0;
       break;
     case anchor_type_t::ANCHORED_TO_RIGHT:
-      seq_anchor = seq.size();
-      scaffold_anchor = s.end_pos();
+      *seq_anchor = seq.size();
+      *scaffold_anchor = s.end_pos();
       break;
   }
+}
+
+bool aligner::find_match(dna_slice seq, const scaffold& s, int match_len,
+                         aoffset_t* seq_match_start,
+                         aoffset_t* scaffold_match_start,
+                         anchor_type_t anchor) {
+  if (match_len > s.end_pos() || match_len > int(seq.size())) {
+    return false;
+  }
+  aoffset_t seq_anchor, scaffold_anchor;
+  get_match_anchors(seq, s, match_len, anchor, &seq_anchor, &scaffold_anchor);
 
   int kmer_size = match_len;
   if (kmer_size > 30) {
@@ -382,6 +456,74 @@ bool aligner::find_match(dna_slice seq, const scaffold& s, int match_len,
   return best_distance != std::numeric_limits<int64_t>::max();
 }
 
+scaffold_match_index::scaffold_match_index(const scaffold& s) : m_scaffold(s) {
+  const auto& extents = m_scaffold.extents();
+  for (unsigned extent_idx = 0; extent_idx != extents.size(); ++extent_idx) {
+    const auto& e = extents[extent_idx];
+    aoffset_t offset = e.offset;
+    for (kmer_t kmer : kmer_view(e.sequence, k_kmer_size)) {
+      if (offset % k_sample_interval == 0) {
+        m_entries.push_back(entry{kmer, offset, extent_idx});
+      }
+      ++offset;
+    }
+  }
+  std::sort(m_entries.begin(), m_entries.end(), [](const entry& lhs, const entry& rhs) {
+    return lhs.kmer < rhs.kmer || (lhs.kmer == rhs.kmer && lhs.offset < rhs.offset);
+  });
+}
+
+void scaffold_match_index::find_matches(dna_slice seq, aoffset_t start, aoffset_t limit,
+                                        const match_func_t& f) const {
+  if (aoffset_t(seq.size()) < k_kmer_size) {
+    return;
+  }
+
+  // For each diagonal (scaffold offset - seq offset), the seq offset
+  // where the last match found on that diagonal ended.  Any later seeds
+  // on the diagonal before that are part of the same match.
+  std::unordered_map<aoffset_t, aoffset_t> diagonal_ends;
+  const aoffset_t seq_size = seq.size();
+  aoffset_t seq_offset = 0;
+  for (kmer_t kmer : kmer_view(seq, k_kmer_size)) {
+    auto range = std::equal_range(
+        m_entries.begin(), m_entries.end(), kmer, kmer_less_than());
+    for (auto it = range.first; it != range.second; ++it) {
+      aoffset_t offset = it->offset;
+      if (offset < start || offset + k_kmer_size > limit) {
+        continue;
+      }
+      aoffset_t diagonal = offset - seq_offset;
+      auto end_it = diagonal_ends.find(diagonal);
+      if (end_it != diagonal_ends.end() && end_it->second > seq_offset) {
+        continue;
+      }
+
+      const scaffold::extent& e = m_scaffold.extents()[it->extent_idx];
+      aoffset_t scaffold_lo = std::max(start, e.offset);
+      aoffset_t scaffold_hi = std::min<aoffset_t>(limit, e.offset + e.sequence.size());
+      dna_const_iterator ref = e.sequence.begin() + (offset - e.offset);
+
+      aoffset_t left = 0;
+      while (seq_offset - left > 0 && offset - left > scaffold_lo &&
+             seq[seq_offset - left - 1] == *(ref - (left + 1))) {
+        ++left;
+      }
+      aoffset_t right = k_kmer_size;
+      while (seq_offset + right < seq_size && offset + right < scaffold_hi &&
+             seq[seq_offset + right] == *(ref + right)) {
+        ++right;
+      }
+      diagonal_ends[diagonal] = seq_offset + right;
+
+      if (left + right >= k_min_match_len) {
+        f(match{seq_offset - left, offset - left, left + right});
+      }
+    }
+    ++seq_offset;
+  }
+}
+
 void align_splitter::set_matches_reference(assembly& a) {
   CHECK_EQ(a.seq.size(), a.right_offset - a.left_offset);
   a.matches_reference = true;
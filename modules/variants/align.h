@@ -1,10 +1,55 @@
 #pragma once
 
+#include <functional>
+
+#include "modules/bio_base/kmer.h"
 #include "modules/variants/assemble.h"
 #include "modules/variants/scaffold.h"
 
 namespace variants {
 
+// Index of sampled kmers in a scaffold, used to find long exact matches
+// against a sequence without scanning the whole scaffold.  Only every
+// k_sample_interval'th kmer of the scaffold is indexed, which is enough
+// to find all matches of at least k_min_match_len bases.
+class scaffold_match_index {
+ public:
+  static constexpr int k_kmer_size = 20;
+  static constexpr int k_sample_interval = 11;
+  static constexpr int k_min_match_len = k_kmer_size + k_sample_interval - 1;
+
+  explicit scaffold_match_index(const scaffold& s);
+
+  struct match {
+    aoffset_t seq_start;
+    aoffset_t scaffold_start;
+    aoffset_t len;
+  };
+  using match_func_t = std::function<void(const match&)>;
+
+  // Calls f for each maximal exact match of at least k_min_match_len
+  // bases between seq and the part of the scaffold in [start, limit).
+  // Matches do not span extents.
+  void find_matches(dna_slice seq, aoffset_t start, aoffset_t limit,
+                    const match_func_t& f) const;
+
+ private:
+  struct entry {
+    kmer_t kmer;
+    aoffset_t offset;
+    unsigned extent_idx;
+  };
+
+  struct kmer_less_than {
+    bool operator()(const entry& lhs, kmer_t rhs) const { return lhs.kmer < rhs; }
+    bool operator()(kmer_t lhs, const entry& rhs) const { return lhs < rhs.kmer; }
+  };
+
+  scaffold m_scaffold;
+  // Sorted by kmer, then offset.
+  std::vector<entry> m_entries;
+};
+
 class aligner : public sorted_output_pipeline_step {
  public:
   aligner(const assemble_options& options, pipeline_step_t output)
@@ -34,17 +79,25 @@ class aligner : public sorted_output_pipeline_step {
   };
 
   // Return true if a match is found.
+  //
+  // If "index" is given, it must index a scaffold which contains "s"
+  // starting at "index_offset".  It is used to find the match if the
+  // minimum match size allows; results are the same either way.
   static bool find_biggest_match(const assemble_options& options, dna_slice seq,
                                  const scaffold& s, int* match_len,
                                  aoffset_t* seq_match_start,
                                  aoffset_t* scaffold_match_start,
                                  aoffset_t* min_match_size,
-                                 anchor_type_t anchor);
+                                 anchor_type_t anchor,
+                                 const scaffold_match_index* index = nullptr,
+                                 aoffset_t index_offset = 0);
   static bool find_biggest_match_with_ends(const assemble_options& options,
                                            dna_slice seq, const scaffold& s,
                                            int* match_len,
                                            aoffset_t* seq_match_start,
-                                           aoffset_t* scaffold_match_start);
+                                           aoffset_t* scaffold_match_start,
+                                           const scaffold_match_index* index = nullptr,
+                                           aoffset_t index_offset = 0);
 
   static bool find_end_matches(const assemble_options& options, dna_slice seq,
                                const scaffold& s, int* match_len,
@@ -65,9 +118,28 @@ class aligner : public sorted_output_pipeline_step {
 
   void process(assembly* a, work_item w);
 
+  static void get_match_anchors(dna_slice seq, const scaffold& s, int match_len,
+                                anchor_type_t anchor, aoffset_t* seq_anchor,
+                                aoffset_t* scaffold_anchor);
+  static bool find_biggest_match_indexed(dna_slice seq, const scaffold& s,
+                                         const scaffold_match_index& index,
+                                         aoffset_t index_offset, int* match_len,
+                                         aoffset_t* seq_match_start,
+                                         aoffset_t* scaffold_match_start,
+                                         aoffset_t min_match_size, anchor_type_t anchor);
+
+  // Reference regions at least this long get a scaffold_match_index
+  // while aligning.
+  static constexpr aoffset_t k_min_index_len = 1024;
+
   assemble_options m_options;
   const scaffold* m_scaffold = nullptr;
 
+  // Index of the reference region of the assembly currently being
+  // aligned, and the reference position it starts at.
+  std::unique_ptr<scaffold_match_index> m_index;
+  aoffset_t m_index_start = 0;
+
   std::vector<work_item> m_work;
 };
 
@@ -2,6 +2,7 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <random>
 
 #include "modules/bio_base/dna_testutil.h"
 
@@ -201,4 +202,76 @@ std::vector<match_test_param> test_params() {
 INSTANTIATE_TEST_CASE_P(find_match_tests, find_match_test,
                         ::testing::ValuesIn(test_params()));
 
+// Builds sequences out of a few repeated blocks, with some mutations,
+// so that there are lots of equally good matches.
+dna_sequence rand_repetitive_dna(std::mt19937& rand_source, const std::vector<dna_sequence>& blocks,
+                                 size_t num_blocks) {
+  dna_sequence result;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    dna_sequence block = blocks[rand_source() % blocks.size()];
+    if (rand_source() % 2) {
+      block[rand_source() % block.size()] = dna_base(int(rand_source() % 4));
+    }
+    result += block.subseq(0, 1 + rand_source() % block.size());
+  }
+  return result;
+}
+
+TEST(scaffold_match_index_test, same_as_unindexed) {
+  std::mt19937 rand_source(1);
+  std::vector<dna_sequence> blocks;
+  for (int i = 0; i < 4; ++i) {
+    blocks.push_back(rand_dna_sequence(rand_source, 20 + rand_source() % 60));
+  }
+
+  assemble_options opts;
+  size_t indexed_matches = 0;
+  for (int i = 0; i < 200; ++i) {
+    scaffold indexed;
+    aoffset_t offset = rand_source() % 20;
+    for (int j = 0; j < 3; ++j) {
+      dna_sequence extent = rand_repetitive_dna(rand_source, blocks, 40);
+      indexed.add(offset, extent);
+      offset += extent.size() + rand_source() % 20;
+    }
+    indexed.set_end_pos(offset);
+    scaffold_match_index index(indexed);
+
+    for (int j = 0; j < 10; ++j) {
+      aoffset_t start = rand_source() % (indexed.end_pos() / 2);
+      aoffset_t len = rand_source() % (indexed.end_pos() - start);
+      scaffold s = indexed.subscaffold(start, len);
+      dna_sequence seq = rand_repetitive_dna(rand_source, blocks, 1 + rand_source() % 20);
+
+      for (auto anchor : {aligner::anchor_type_t::ANCHORED_TO_BOTH,
+                          aligner::anchor_type_t::ANCHORED_TO_LEFT,
+                          aligner::anchor_type_t::ANCHORED_TO_RIGHT}) {
+        int match_len = -1, indexed_match_len = -1;
+        aoffset_t seq_start = -1, indexed_seq_start = -1;
+        aoffset_t scaffold_start = -1, indexed_scaffold_start = -1;
+        aoffset_t min_match_size = -1, indexed_min_match_size = -1;
+        bool did_match =
+            aligner::find_biggest_match(opts, seq, s, &match_len, &seq_start, &scaffold_start,
+                                        &min_match_size, anchor);
+        bool indexed_did_match = aligner::find_biggest_match(
+            opts, seq, s, &indexed_match_len, &indexed_seq_start, &indexed_scaffold_start,
+            &indexed_min_match_size, anchor, &index, start);
+        ASSERT_EQ(did_match, indexed_did_match) << seq << " vs " << s << " " << anchor;
+        EXPECT_EQ(min_match_size, indexed_min_match_size);
+        EXPECT_EQ(match_len, indexed_match_len);
+        if (did_match) {
+          EXPECT_EQ(seq_start, indexed_seq_start) << seq << " vs " << s << " " << anchor;
+          EXPECT_EQ(scaffold_start, indexed_scaffold_start) << seq << " vs " << s << " "
+                                                            << anchor;
+          if (min_match_size >= scaffold_match_index::k_min_match_len) {
+            ++indexed_matches;
+          }
+        }
+      }
+    }
+  }
+  // Make sure we exercised the index.
+  EXPECT_GT(indexed_matches, 100);
+}
+
 }  // namespace variants
@@ -3,6 +3,7 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <random>
 
 #include "modules/bio_base/dna_testutil.h"
 #include "modules/variants/assemble_testutil.h"
@@ -283,6 +284,30 @@ TEST_F(align_test, sorts_by_left) {
   expect_sorted(assembly::left_offset_less_than);
 }
 
+// Long enough reference regions get indexed while aligning.
+TEST_F(align_test, large_deletion) {
+  std::mt19937 rand_source(1);
+  dna_sequence ref = rand_dna_sequence(rand_source, 3000);
+  m_scaffold.add(0, ref);
+
+  dna_sequence snp_base;
+  snp_base.push_back(ref[200].complement());
+  assembly a;
+  a.left_offset = 0;
+  a.left_anchor_len = 1;
+  a.right_offset = ref.size();
+  a.right_anchor_len = 1;
+  a.seq = ref.subseq(0, 200) + snp_base + ref.subseq(201, 199) + ref.subseq(2600, 400);
+  align(a);
+
+  ASSERT_THAT(m_aligned, SizeIs(1));
+  const auto& vars = m_aligned[0].aligned_variants;
+  ASSERT_THAT(vars, SizeIs(2));
+  EXPECT_THAT(vars[0], VarIs(200, snp_base, 201));
+  EXPECT_EQ(vars[1].right_offset - vars[1].left_offset, 2200);
+  EXPECT_EQ(vars[1].seq.size(), 0);
+}
+
 // Examples that have been seen in the wild, and where they should align.
 class wild_align_test : public align_test {
  public:
@@ -2,8 +2,10 @@
 
 #include <boost/core/demangle.hpp>
 #include <boost/range/adaptor/reversed.hpp>
+#include <algorithm>
 #include <chrono>
 #include <ctime>
+#include <limits>
 #include <random>
 
 #include "modules/bio_base/readmap.h"
@@ -299,6 +301,15 @@ void sorted_output_pipeline_step::flush_sorted() {
   m_output->flush();
 }
 
+void sorted_output_pipeline_step::release_queued_mem(size_t mem) {
+  if (!mem) {
+    return;
+  }
+  mem = std::min(mem, m_queued_mem);
+  m_queued_mem -= mem;
+  m_mem_consumer->remove(mem);
+}
+
 void sorted_output_pipeline_step::track_left_offset(aoffset_t offset) {
   CHECK_GE(offset, m_flush_point);
   m_left_offsets.insert(offset);
@@ -328,8 +339,13 @@ void sorted_output_pipeline_step::flush_sorted_to(aoffset_t flush_offset) {
     assembly_ptr a = std::move(it->second);
     m_output_queue.erase(it);
     CHECK_EQ(a.get(), aptr);
+    release_queued_mem(assembly_mem_usage(*a));
     m_output->add(std::move(a));
   }
+  if (m_output_queue.empty()) {
+    // Make sure estimates don't accumulate drift.
+    release_queued_mem(m_queued_mem);
+  }
 
   m_flush_point = flush_offset;
 }
@@ -340,6 +356,12 @@ void sorted_output_pipeline_step::sort_and_output(assembly_ptr a) {
   }
   aoffset_t left_offset = min(a->left_offset, a->right_offset);
   CHECK_GE(left_offset, m_flush_point);
+  if (!m_mem_consumer) {
+    m_mem_consumer = pipeline_mem_governor::global().get_consumer(description());
+  }
+  size_t mem = assembly_mem_usage(*a);
+  m_mem_consumer->add(mem);
+  m_queued_mem += mem;
   assembly* aptr = a.get();
   m_output_queue.emplace(aptr, std::move(a));
 }
@@ -870,10 +892,47 @@ std::string dump_assembly_and_vars(const assembly& a) {
   return os.str();
 }
 
+size_t assembly_mem_usage(const assembly& a) {
+  size_t tot = sizeof(assembly);
+  tot += a.seq.size() / 4;
+  tot += a.merged_assembly_ids.capacity() * sizeof(size_t);
+  tot += a.rc_read_ids.memory_used();
+  tot += (a.coverage.capacity() + a.pair_coverage.capacity()) * sizeof(int);
+  tot += (a.left_pair_matches.capacity() + a.right_pair_matches.capacity()) * sizeof(uint32_t);
+  tot += a.aligned_variants.capacity() * sizeof(aligned_var);
+  for (const auto& v : a.aligned_variants) {
+    tot += v.seq.size() / 4;
+  }
+  for (const auto& sub : a.sub_assemblies) {
+    if (sub && *sub) {
+      tot += assembly_mem_usage(**sub);
+    }
+  }
+  return tot;
+}
+
+namespace {
+
+std::atomic<uint64_t> g_assembly_id{1};
+uint64_t g_assembly_id_shard_index = 0;
+uint64_t g_assembly_id_shard_count = 1;
+
+}  // namespace
+
 size_t allocate_assembly_id() {
-  static std::atomic<uint64_t> g_assembly_id{1};
+  uint64_t id = g_assembly_id.fetch_add(1);
+  if (g_assembly_id_shard_count == 1) {
+    return id;
+  }
+  return (id - 1) * g_assembly_id_shard_count + g_assembly_id_shard_index + 1;
+}
 
-  return g_assembly_id.fetch_add(1);
+void set_assembly_id_shard(size_t shard_index, size_t shard_count) {
+  CHECK_GT(shard_count, 0);
+  CHECK_LT(shard_index, shard_count);
+  CHECK_EQ(g_assembly_id.load(), 1) << "Assembly ids have already been allocated";
+  g_assembly_id_shard_index = shard_index;
+  g_assembly_id_shard_count = shard_count;
 }
 
 namespace {
@@ -1092,8 +1151,8 @@ std::string sorted_output_pipeline_step::sorted_output_stats(
   if (relative_to) {
     out << "(" << (*relative_to - m_flush_point) << " behind)";
   }
-  out << ", " << m_output_queue.size() << " sorted assemblies queued, " << m_left_offsets.size()
-      << " left offsets tracked";
+  out << ", " << m_output_queue.size() << " sorted assemblies queued (" << m_queued_mem
+      << " bytes), " << m_left_offsets.size() << " left offsets tracked";
   if (!m_left_offsets.empty()) {
     aoffset_t earliest_tracked = *m_left_offsets.begin();
     out << ", earliest tracked=" << earliest_tracked;
@@ -1340,8 +1399,6 @@ optional_aoffset max(const optional_aoffset& lhs, const optional_aoffset& rhs) {
 
 const optional_aoffset optional_aoffset::none;
 
-const absl::btree_set<seqset_range> seqset_path::g_empty;
-
 void seqset_path::propagate_from_end(const absl::btree_set<seqset_range>& new_ends, dna_slice seq,
                                      const assemble_options& opts) {
   constexpr bool k_dbg = false;
@@ -1359,15 +1416,20 @@ void seqset_path::propagate_from_end(const absl::btree_set<seqset_range>& new_en
 
   absl::btree_set<seqset_range> cur = new_ends;
   seqset_set_dedup_prefixes(cur);
-  m_entries[seq.size()] = cur;
-  m_entries.try_emplace(0);  // Just in case it doesn't exist already.
-  CHECK_EQ(m_entries.begin()->first, 0);
-  CHECK_EQ(m_entries.rbegin()->first, seq.size());
+  set_entries_at_offset(seq.size(), cur);
+  if (find_packed(0) == m_packed.end() && !m_multi.count(0)) {
+    // Just in case it doesn't exist already.
+    set_entries_at_offset(0, {});
+  }
+
+  std::vector<aoffset_t> offs = offsets();
+  CHECK_EQ(offs.front(), 0);
+  CHECK_EQ(offs.back(), seq.size());
 
   aoffset_t offset = seq.size();
-  auto it = m_entries.rbegin();
-  CHECK_EQ(it->first, offset);
-  CHECK(it != m_entries.rend());
+  auto it = offs.rbegin();
+  CHECK_EQ(*it, offset);
+  CHECK(it != offs.rend());
   ++it;
 
   while (offset) {
@@ -1383,12 +1445,12 @@ void seqset_path::propagate_from_end(const absl::btree_set<seqset_range>& new_en
       std::cerr << "offset=" << offset << " cur=" << cur << "\n";
     }
 
-    CHECK(it != m_entries.rend());
-    if (it->first == offset) {
-      it->second = cur;
+    CHECK(it != offs.rend());
+    if (*it == offset) {
+      set_entries_at_offset(offset, cur);
       ++it;
     } else {
-      CHECK_LT(it->first, offset);
+      CHECK_LT(*it, offset);
     }
 
     if (opts.readmap) {
@@ -1414,59 +1476,169 @@ void seqset_path::propagate_from_end(const absl::btree_set<seqset_range>& new_en
       }
     }
   }
-  CHECK(it == m_entries.rend());
+  CHECK(it == offs.rend());
 }
 
 void seqset_path::clear() {
-  m_entries.clear();
+  m_seqset = nullptr;
+  m_packed.clear();
+  m_multi.clear();
   m_mates.clear();
 }
 
-const absl::btree_set<seqset_range>& seqset_path::starts() const {
+absl::btree_set<seqset_range> seqset_path::starts() const {
   if (empty()) {
-    return g_empty;
+    return {};
   } else {
-    return m_entries.begin()->second;
+    return entries_at_offset(first_offset());
   }
 }
 
-const absl::btree_set<seqset_range>& seqset_path::ends() const {
+absl::btree_set<seqset_range> seqset_path::ends() const {
   if (empty()) {
-    return g_empty;
+    return {};
   } else {
-    return m_entries.rbegin()->second;
+    return entries_at_offset(last_offset());
   }
 }
 
+absl::btree_map<aoffset_t, absl::btree_set<seqset_range>> seqset_path::entries() const {
+  absl::btree_map<aoffset_t, absl::btree_set<seqset_range>> result = m_multi;
+  for (const packed_range& p : m_packed) {
+    result[p.offset].insert(unpack(p));
+  }
+  return result;
+}
+
 size_t seqset_path::size() const {
   CHECK(!empty());
-  return m_entries.rbegin()->first;
+  return last_offset();
+}
+
+bool seqset_path::pack(aoffset_t offset, const seqset_range& r, packed_range* result) {
+  if (!r.get_seqset() || (m_seqset && r.get_seqset() != m_seqset)) {
+    return false;
+  }
+  if (r.begin() >= (uint64_t(1) << 40) || r.size() >= (1U << 24) || r.end() < r.begin() ||
+      r.end() - r.begin() > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  m_seqset = r.get_seqset();
+  result->begin = r.begin();
+  result->size = r.size();
+  result->offset = offset;
+  result->end_delta = r.end() - r.begin();
+  return true;
+}
+
+seqset_range seqset_path::unpack(const packed_range& p) const {
+  DCHECK(m_seqset);
+  return m_seqset->ctx_range(p.size, p.begin, p.begin + p.end_delta);
+}
+
+std::vector<seqset_path::packed_range>::iterator seqset_path::find_packed(aoffset_t offset) {
+  auto it = std::lower_bound(m_packed.begin(), m_packed.end(), offset, packed_offset_lt());
+  if (it != m_packed.end() && it->offset == offset) {
+    return it;
+  }
+  return m_packed.end();
+}
+
+std::vector<seqset_path::packed_range>::const_iterator seqset_path::find_packed(
+    aoffset_t offset) const {
+  auto it = std::lower_bound(m_packed.begin(), m_packed.end(), offset, packed_offset_lt());
+  if (it != m_packed.end() && it->offset == offset) {
+    return it;
+  }
+  return m_packed.end();
+}
+
+absl::btree_set<seqset_range> seqset_path::entries_at_offset(aoffset_t offset) const {
+  auto packed_it = find_packed(offset);
+  if (packed_it != m_packed.end()) {
+    return {unpack(*packed_it)};
+  }
+  auto multi_it = m_multi.find(offset);
+  if (multi_it != m_multi.end()) {
+    return multi_it->second;
+  }
+  return {};
 }
 
-absl::btree_set<seqset_range> seqset_path::entries_at_offset(aoffset_t offset) {
-  absl::btree_set<seqset_range> entries;
-  auto range = m_entries.equal_range(offset);
-  for (auto it = range.first; it != range.second; ++it) {
-    entries.insert(it->second.begin(), it->second.end());
+void seqset_path::set_entries_at_offset(aoffset_t offset, absl::btree_set<seqset_range> rs) {
+  packed_range p;
+  if (rs.size() == 1 && pack(offset, *rs.begin(), &p)) {
+    m_multi.erase(offset);
+    auto it = std::lower_bound(m_packed.begin(), m_packed.end(), offset, packed_offset_lt());
+    if (it != m_packed.end() && it->offset == offset) {
+      *it = p;
+    } else {
+      m_packed.insert(it, p);
+    }
+    return;
   }
-  return entries;
+
+  auto it = find_packed(offset);
+  if (it != m_packed.end()) {
+    m_packed.erase(it);
+  }
+  m_multi[offset] = std::move(rs);
+}
+
+aoffset_t seqset_path::first_offset() const {
+  DCHECK(!empty());
+  if (m_multi.empty()) {
+    return m_packed.front().offset;
+  } else if (m_packed.empty()) {
+    return m_multi.begin()->first;
+  } else {
+    return std::min(m_packed.front().offset, m_multi.begin()->first);
+  }
+}
+
+aoffset_t seqset_path::last_offset() const {
+  DCHECK(!empty());
+  if (m_multi.empty()) {
+    return m_packed.back().offset;
+  } else if (m_packed.empty()) {
+    return m_multi.rbegin()->first;
+  } else {
+    return std::max(m_packed.back().offset, m_multi.rbegin()->first);
+  }
+}
+
+std::vector<aoffset_t> seqset_path::offsets() const {
+  std::vector<aoffset_t> result;
+  result.reserve(m_packed.size() + m_multi.size());
+  for (const packed_range& p : m_packed) {
+    result.push_back(p.offset);
+  }
+  for (const auto& e : m_multi) {
+    result.push_back(e.first);
+  }
+  std::inplace_merge(result.begin(), result.begin() + m_packed.size(), result.end());
+  return result;
 }
 
 void seqset_path::add(aoffset_t offset, seqset_range r) {
-  auto& e = m_entries[offset];
+  absl::btree_set<seqset_range> e = entries_at_offset(offset);
   e.insert(r);
   seqset_set_dedup_prefixes(e);
+  set_entries_at_offset(offset, std::move(e));
 }
 void seqset_path::add(aoffset_t offset, const absl::btree_set<seqset_range>& rs) {
-  auto& e = m_entries[offset];
+  absl::btree_set<seqset_range> e = entries_at_offset(offset);
   e.insert(rs.begin(), rs.end());
   seqset_set_dedup_prefixes(e);
+  set_entries_at_offset(offset, std::move(e));
 }
 
 seqset_path::~seqset_path() {}
 
 void seqset_path::swap(seqset_path& rhs) {
-  m_entries.swap(rhs.m_entries);
+  std::swap(m_seqset, rhs.m_seqset);
+  m_packed.swap(rhs.m_packed);
+  m_multi.swap(rhs.m_multi);
   m_mates.swap(rhs.m_mates);
 }
 
@@ -3,12 +3,14 @@
 #include <boost/any.hpp>
 #include <boost/container/small_vector.hpp>
 #include <boost/optional.hpp>
+#include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "modules/bio_base/reference.h"
 #include "modules/bio_base/seq_position.h"
 #include "modules/io/autostats.h"
 #include "modules/io/ref_count.h"
+#include "modules/variants/pipeline_mem.h"
 #include "modules/variants/read_set.h"
 #include "modules/variants/ref_map.h"
 
@@ -236,6 +238,12 @@ using phase_set = string_set;
 // will start with seqset->find(a prefix of the path sequence).
 //
 // However, as part of a graph, there will often be more than one end.
+//
+// Most offsets only have a single seqset range, so those are packed
+// into 16 bytes each and kept in a flat vector, with the seqset
+// pointer stored once for the whole path.  Offsets with more than one
+// range (or ranges that don't fit the packed form) are kept in a
+// separate map of sets.
 struct assemble_options;
 // Removes all seqset entries in "rs" that are prefixes of other
 // entries in "rs".  This is used when we use push_front_drop on a set
@@ -254,34 +262,87 @@ class seqset_path {
                           const assemble_options& opts);
 
   // Returns starts, e.g. get_marked()[0].  An empty result indicates no data available.
-  const absl::btree_set<seqset_range>& starts() const;
+  absl::btree_set<seqset_range> starts() const;
 
   // Return ends, e.g. get_marked()[seq.size()].  An empty result indicates no data available.
-  const absl::btree_set<seqset_range>& ends() const;
+  absl::btree_set<seqset_range> ends() const;
 
-  const absl::btree_map<aoffset_t, absl::btree_set<seqset_range>>& entries() const {
-    return m_entries;
-  }
+  // Returns all entries, indexed by offset.  This unpacks the whole
+  // path, so prefer for_each_range when possible.
+  absl::btree_map<aoffset_t, absl::btree_set<seqset_range>> entries() const;
+
+  // Calls f(offset, range) for each range in the path, in order of
+  // offset.
+  template <typename F>
+  void for_each_range(F&& f) const;
 
   size_t size() const;
 
   const absl::btree_set<seqset_range>& mates() const { return m_mates; }
 
-  bool empty() const { return m_entries.empty(); }
+  bool empty() const { return m_packed.empty() && m_multi.empty(); }
   void clear();
 
   void swap(seqset_path& rhs);
 
  private:
-  static const absl::btree_set<seqset_range> g_empty;
+  struct packed_range {
+    uint64_t begin : 40;
+    uint64_t size : 24;
+    aoffset_t offset;
+    uint32_t end_delta;
+  };
+  static_assert(sizeof(packed_range) == 16, "packed_range should fit in 16 bytes");
+
+  struct packed_offset_lt {
+    bool operator()(const packed_range& lhs, aoffset_t rhs) const { return lhs.offset < rhs; }
+  };
+
+  // Returns true and fills in "result" if "r" fits in the packed form.
+  bool pack(aoffset_t offset, const seqset_range& r, packed_range* result);
+  seqset_range unpack(const packed_range& p) const;
+
+  std::vector<packed_range>::iterator find_packed(aoffset_t offset);
+  std::vector<packed_range>::const_iterator find_packed(aoffset_t offset) const;
+
+  absl::btree_set<seqset_range> entries_at_offset(aoffset_t offset) const;
+  void set_entries_at_offset(aoffset_t offset, absl::btree_set<seqset_range> rs);
+
+  aoffset_t first_offset() const;
+  aoffset_t last_offset() const;
+  // Returns all offsets present, in order.
+  std::vector<aoffset_t> offsets() const;
 
-  absl::btree_set<seqset_range> entries_at_offset(aoffset_t offset);
+  // Seqset that all the packed ranges belong to.
+  const seqset* m_seqset = nullptr;
 
-  absl::btree_map<aoffset_t, absl::btree_set<seqset_range>> m_entries;
+  // Offsets with exactly one range, sorted by offset.
+  std::vector<packed_range> m_packed;
+
+  // All other offsets.  Offsets present here are not present in m_packed.
+  absl::btree_map<aoffset_t, absl::btree_set<seqset_range>> m_multi;
 
   absl::btree_set<seqset_range> m_mates;
 };
 
+template <typename F>
+void seqset_path::for_each_range(F&& f) const {
+  auto packed_it = m_packed.begin();
+  auto multi_it = m_multi.begin();
+  while (packed_it != m_packed.end() || multi_it != m_multi.end()) {
+    if (multi_it == m_multi.end() ||
+        (packed_it != m_packed.end() && packed_it->offset < multi_it->first)) {
+      f(packed_it->offset, unpack(*packed_it));
+      ++packed_it;
+    } else {
+      for (const seqset_range& r : multi_it->second) {
+        f(multi_it->first, r);
+      }
+      ++multi_it;
+    }
+  }
+}
+
 struct assembly {
   assembly();
   assembly(optional_aoffset left_off, optional_aoffset right_off, dna_sequence aseq, size_t asm_id);
@@ -446,6 +507,12 @@ class canon_assembly_order {
 
 size_t allocate_assembly_id();
 
+// Makes allocate_assembly_id only return ids that are unique to this
+// shard, so that outputs of separate discovery processes can be
+// merged without phase ids colliding.  Must be called before any
+// assembly ids are allocated.
+void set_assembly_id_shard(size_t shard_index, size_t shard_count);
+
 struct half_aligned_assembly {
   std::string scaffold_name;
   aoffset_t offset;
@@ -534,6 +601,10 @@ struct assemble_options {
   // Size of chunks to split a scaffold into to parallelize.
   size_t scaffold_split_size = 1000 * 1000;
 
+  // If nonzero, trace_ref stops starting new chunks while pipeline
+  // steps are buffering more than this many bytes of assemblies.
+  size_t max_pipeline_mem_bytes = 0;
+
   // Costs, used to trace out rejoin paths:
 
   // Cost per read that matches an ambiguous location in reference (to
@@ -801,6 +872,10 @@ void check_assembly_from_user(const assembly& a);
 
 // An assembly including variants.
 std::string dump_assembly_and_vars(const assembly& a);
+
+// Returns an approximation of the number of bytes used by an assembly,
+// for tracking memory held by pipeline steps.
+size_t assembly_mem_usage(const assembly& a);
 std::string dump_coverage(const std::vector<int>& cov);
 
 struct assemble_stats : public autostats_base {
@@ -906,6 +981,11 @@ class sorted_output_pipeline_step : public assemble_pipeline_interface {
   // no way to extract elements from the queue.
   std::multimap<assembly*, assembly_ptr, canon_assembly_order> m_output_queue;
   std::multiset<aoffset_t> m_left_offsets;
+
+  // Memory held by m_output_queue, as reported to pipeline_mem_governor.
+  void release_queued_mem(size_t mem);
+  pipeline_mem_governor::consumer* m_mem_consumer = nullptr;
+  size_t m_queued_mem = 0;
 };
 
 class assemble_lambda_output : public assemble_pipeline_interface {
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 
 #include "modules/bio_base/dna_testutil.h"
+#include "modules/bio_base/seqset_testutil.h"
 #include "modules/variants/assemble_testutil.h"
 
 using namespace testing;
@@ -259,3 +260,71 @@ TEST_F(merge_test, wild1) {
   do_merge();
   EXPECT_FALSE(m_result) << *m_result;
 }
+
+class seqset_path_test : public Test {
+ public:
+  seqset_path_test() : m_seqset(seqset_for_reads({tseq("abcdefg"), tseq("hijklmn")})) {}
+
+  std::vector<std::pair<aoffset_t, dna_sequence>> path_seqs(const seqset_path& path) {
+    std::vector<std::pair<aoffset_t, dna_sequence>> result;
+    path.for_each_range([&](aoffset_t offset, const seqset_range& r) {
+      result.emplace_back(offset, r.sequence());
+    });
+    return result;
+  }
+
+ protected:
+  std::unique_ptr<seqset> m_seqset;
+};
+
+TEST_F(seqset_path_test, propagate) {
+  dna_sequence seq = tseq("abcdefg");
+  aoffset_t mid = tseq("abc").size();
+
+  seqset_path path;
+  path.add(mid, m_seqset->find(tseq("d")));
+  assemble_options opts;
+  path.propagate_from_end({m_seqset->ctx_begin()}, seq, opts);
+
+  EXPECT_EQ(seq.size(), path.size());
+  EXPECT_THAT(path.ends(), ElementsAre(m_seqset->ctx_begin()));
+  EXPECT_THAT(path.starts(), ElementsAre(m_seqset->find(seq)));
+  EXPECT_THAT(path_seqs(path),
+              ElementsAre(std::make_pair(0, seq),
+                          std::make_pair(mid, seq.subseq(mid, seq.size() - mid)),
+                          std::make_pair(aoffset_t(seq.size()), dna_sequence())));
+
+  seqset_path copied = path;
+  EXPECT_EQ(path.entries(), copied.entries());
+}
+
+TEST_F(seqset_path_test, multiple_per_offset) {
+  seqset_range abc = m_seqset->find(tseq("abc"));
+  seqset_range hij = m_seqset->find(tseq("hij"));
+
+  seqset_path path;
+  path.add(5, abc);
+  path.add(0, abc);
+  EXPECT_THAT(path.starts(), ElementsAre(abc));
+  path.add(0, hij);
+  EXPECT_THAT(path.starts(), UnorderedElementsAre(abc, hij));
+  EXPECT_THAT(path.ends(), ElementsAre(abc));
+  EXPECT_EQ(5, path.size());
+
+  // Prefixes of existing entries are redundant.
+  path.add(5, m_seqset->find(tseq("ab")));
+  EXPECT_THAT(path.ends(), ElementsAre(abc));
+
+  auto entries = path.entries();
+  ASSERT_THAT(entries, SizeIs(2));
+  EXPECT_THAT(entries[0], UnorderedElementsAre(abc, hij));
+  EXPECT_THAT(entries[5], ElementsAre(abc));
+
+  seqset_path other;
+  other.swap(path);
+  EXPECT_TRUE(path.empty());
+  EXPECT_THAT(other.starts(), UnorderedElementsAre(abc, hij));
+  other.clear();
+  EXPECT_TRUE(other.empty());
+  EXPECT_THAT(other.starts(), IsEmpty());
+}
@@ -0,0 +1,150 @@
+// Replays a captured assembly stream (see assembly_stream.h) through a
+// single pipeline step, so that step can be benchmarked on real data
+// without re-running discovery.
+//
+// Usage:
+//   assembly_replay_benchmark --assemblies=captured.asm [--biograph=sample.bg]
+//       [--step=read_cov] [--benchmark_filter=...]
+//
+// Steps that need coverage (read_cov, pair_cov, place_pair_cov)
+// require --biograph, which should be the biograph the stream was
+// captured from.  If no step is given, all steps that can run are
+// benchmarked.
+
+#include "benchmark/benchmark.h"
+#include "modules/bio_base/biograph.h"
+#include "modules/io/file_io.h"
+#include "modules/io/make_unique.h"
+#include "modules/io/utils.h"
+#include "modules/variants/assembly_stream.h"
+#include "modules/variants/genotype.h"
+#include "modules/variants/pair_cov.h"
+#include "modules/variants/phase.h"
+#include "modules/variants/place_pair_cov.h"
+#include "modules/variants/read_cov.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+
+namespace po = boost::program_options;
+using namespace variants;
+
+namespace {
+
+using step_maker_t = std::function<pipeline_step_t(pipeline_step_t)>;
+
+std::vector<assembly_ptr> g_assemblies;
+std::unique_ptr<biograph> g_biograph;
+std::shared_ptr<readmap> g_readmap;
+assemble_options g_options;
+
+void BM_replay(benchmark::State& state, const step_maker_t& make_step) {
+  size_t output_count = 0;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    std::vector<assembly_ptr> input;
+    input.reserve(g_assemblies.size());
+    for (const auto& a : g_assemblies) {
+      input.emplace_back(make_unique<assembly>(*a));
+    }
+    state.ResumeTiming();
+
+    pipeline_step_t step = make_step(make_unique<assemble_lambda_output>(
+        [&output_count](assembly_ptr a) { ++output_count; }, "replay_output"));
+    for (auto& a : input) {
+      step->add(std::move(a));
+    }
+    step->flush();
+    step.reset();
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * g_assemblies.size());
+  state.SetLabel(
+      printstring("%ld outputs", output_count / std::max<size_t>(state.iterations(), 1)));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+
+  std::string assemblies_path;
+  std::string biograph_path;
+  std::string readmap_id;
+  std::string step_name;
+  po::options_description desc("Options");
+  desc.add_options()
+      ("assemblies", po::value(&assemblies_path)->required(), "Assembly stream to replay")
+      ("biograph", po::value(&biograph_path), "Biograph the stream was captured from")
+      ("readmap", po::value(&readmap_id), "Readmap ID, if the biograph has more than one")
+      ("step", po::value(&step_name), "Only benchmark this step");
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  } catch (const po::error& e) {
+    std::cerr << e.what() << "\n" << desc << "\n";
+    return 1;
+  }
+
+  {
+    file_reader in(assemblies_path);
+    assembly_stream_reader r(&in);
+    g_assemblies = r.read_all();
+  }
+  std::cerr << "Loaded " << g_assemblies.size() << " assemblies from " << assemblies_path
+            << "\n";
+
+  if (!biograph_path.empty()) {
+    g_biograph = make_unique<biograph>(biograph_path, biograph::cache_strategy::RAM);
+    g_readmap = g_biograph->open_readmap(readmap_id);
+    g_options.seqset = g_biograph->get_seqset().get();
+    g_options.readmap = g_readmap.get();
+  }
+
+  std::map<std::string, step_maker_t> steps;
+  if (g_options.readmap) {
+    steps["read_cov"] = [](pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<read_cov>(g_options, std::move(output));
+    };
+    steps["pair_cov"] = [](pipeline_step_t output) -> pipeline_step_t {
+      assemble_options options = g_options;
+      options.min_pair_distance = 200;
+      options.max_pair_distance = 1000;
+      return make_unique<pair_cov>(options, std::move(output));
+    };
+    steps["place_pair_cov"] = [](pipeline_step_t output) -> pipeline_step_t {
+      assemble_options options = g_options;
+      options.min_pair_distance = 200;
+      options.max_pair_distance = 1000;
+      place_pair_options popts;
+      popts.ideal_pair_distance = 400;
+      return make_unique<place_pair_cov>(options, popts, std::move(output));
+    };
+  }
+  steps["join_phases"] = [](pipeline_step_t output) -> pipeline_step_t {
+    return make_unique<join_phases>(1000 /* max phase len */, 1000 /* max phase asm len */,
+                                    std::move(output));
+  };
+  steps["genotyper"] = [](pipeline_step_t output) -> pipeline_step_t {
+    return make_unique<genotyper>(g_options, std::move(output));
+  };
+
+  if (!step_name.empty()) {
+    if (!steps.count(step_name)) {
+      std::cerr << "Unknown step " << step_name
+                << "; steps that need coverage also need --biograph\n";
+      return 1;
+    }
+    step_maker_t make_step = steps[step_name];
+    steps.clear();
+    steps[step_name] = make_step;
+  }
+
+  for (const auto& step : steps) {
+    ::benchmark::RegisterBenchmark(("BM_replay/" + step.first).c_str(), BM_replay, step.second)
+        ->Unit(::benchmark::kMillisecond);
+  }
+  ::benchmark::RunSpecifiedBenchmarks();
+
+  g_assemblies.clear();
+}
@@ -0,0 +1,526 @@
+#include "modules/variants/assembly_stream.h"
+#include "modules/io/make_unique.h"
+#include "modules/io/utils.h"
+
+#include <string.h>
+
+namespace variants {
+
+namespace {
+
+constexpr char k_magic[] = "BGASMSTR";
+constexpr size_t k_magic_len = sizeof(k_magic) - 1;
+constexpr uint64_t k_format_version = 1;
+
+// Bits in the per-assembly flags field.
+enum : uint64_t {
+  k_has_left_offset = 1 << 0,
+  k_has_right_offset = 1 << 1,
+  k_matches_reference = 1 << 2,
+  k_bypass_coverage = 1 << 3,
+  k_has_edge_coverage = 1 << 4,
+  k_has_read_coverage = 1 << 5,
+  k_has_pair_read_coverage = 1 << 6,
+  k_has_align_count = 1 << 7,
+  k_has_ml_features = 1 << 8
+};
+
+void append_varint(std::string& out, uint64_t val) {
+  while (val >= 0x80) {
+    out.push_back(char(val | 0x80));
+    val >>= 7;
+  }
+  out.push_back(char(val));
+}
+
+class encoder {
+ public:
+  const std::string& str() const { return m_buf; }
+
+  void put_uint(uint64_t val) { append_varint(m_buf, val); }
+  // Zigzag encodes so small negative numbers stay small.
+  void put_int(int64_t val) { put_uint((uint64_t(val) << 1) ^ uint64_t(val >> 63)); }
+  template <typename T>
+  void put_raw(T val) {
+    m_buf.append(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+  void put_string(const std::string& str) {
+    put_uint(str.size());
+    m_buf.append(str);
+  }
+
+  void put_seq(const dna_sequence& seq) {
+    put_uint(seq.size());
+    if (!seq.empty()) {
+      m_buf.append(seq.as_packed());
+    }
+  }
+
+  void put_offset(const optional_aoffset& offset) {
+    if (offset) {
+      put_int(aoffset_t(offset));
+    }
+  }
+
+  void put_read_ids(const read_id_set& ids) {
+    std::vector<uint32_t> vec = ids.to_vector();
+    put_uint(vec.size());
+    uint32_t prev = 0;
+    for (uint32_t id : vec) {
+      put_uint(id - prev);
+      prev = id;
+    }
+  }
+
+  void put_depths(const std::vector<int>& depths) {
+    put_uint(depths.size());
+    int prev = 0;
+    for (int depth : depths) {
+      put_int(int64_t(depth) - prev);
+      prev = depth;
+    }
+  }
+
+  template <typename T>
+  void put_uints(const std::vector<T>& vals) {
+    put_uint(vals.size());
+    for (const auto& val : vals) {
+      put_uint(val);
+    }
+  }
+
+  void put_strings(const string_set& strs) {
+    put_uint(strs.size());
+    for (const auto& str : strs) {
+      put_string(str);
+    }
+  }
+
+  void put_read_coverage(const read_coverage_t& cov) {
+    put_int(cov.assembly_len());
+    put_uint(cov.reads().size());
+    int prev_offset = 0;
+    for (const auto& rd : cov.reads()) {
+      put_int(int64_t(rd.offset) - prev_offset);
+      prev_offset = rd.offset;
+      put_int(rd.read_len);
+      put_read_ids(rd.read_ids);
+    }
+  }
+
+  void put_assembly(const assembly& a);
+
+ private:
+  std::string m_buf;
+};
+
+void encoder::put_assembly(const assembly& a) {
+  uint64_t flags = 0;
+  if (a.left_offset) {
+    flags |= k_has_left_offset;
+  }
+  if (a.right_offset) {
+    flags |= k_has_right_offset;
+  }
+  if (a.matches_reference) {
+    flags |= k_matches_reference;
+  }
+  if (a.bypass_coverage) {
+    flags |= k_bypass_coverage;
+  }
+  if (a.edge_coverage) {
+    flags |= k_has_edge_coverage;
+  }
+  if (a.read_coverage) {
+    flags |= k_has_read_coverage;
+  }
+  if (a.pair_read_coverage) {
+    flags |= k_has_pair_read_coverage;
+  }
+  if (a.align_count) {
+    flags |= k_has_align_count;
+  }
+  if (a.ml_features) {
+    flags |= k_has_ml_features;
+  }
+  put_uint(flags);
+
+  put_uint(a.assembly_id);
+  put_uints(a.merged_assembly_ids);
+  put_offset(a.left_offset);
+  put_int(a.left_anchor_len);
+  put_offset(a.right_offset);
+  put_int(a.right_anchor_len);
+  put_seq(a.seq);
+
+  put_uint(a.trace_steps);
+  put_uint(a.unique_pairs_used);
+  put_uint(a.min_overlap);
+  put_uint(a.left_anchor_ambiguous_bases);
+  put_uint(a.other_depth);
+  put_uint(a.other_pair_depth);
+  put_uint(a.ref_depth);
+  put_uint(a.strand_count);
+  put_raw(a.genotype_quality);
+
+  put_read_ids(a.rc_read_ids);
+  put_depths(a.coverage);
+  put_depths(a.pair_coverage);
+  put_uints(a.left_pair_matches);
+  put_uints(a.right_pair_matches);
+  put_int(a.score);
+
+  put_uint(a.aligned_variants.size());
+  for (const auto& v : a.aligned_variants) {
+    put_int(v.left_offset);
+    put_int(v.right_offset);
+    put_seq(v.seq);
+    put_int(v.max_alt_depth);
+  }
+
+  if (a.edge_coverage) {
+    const edge_coverage_t& ec = *a.edge_coverage;
+    put_read_ids(ec.variant_start);
+    put_read_ids(ec.variant_end);
+    put_read_ids(ec.interior);
+    put_read_ids(ec.reference_start);
+    put_read_ids(ec.reference_end);
+    put_int(ec.start_common);
+    put_int(ec.end_common);
+  }
+  if (a.read_coverage) {
+    put_read_coverage(*a.read_coverage);
+  }
+  if (a.pair_read_coverage) {
+    put_read_coverage(*a.pair_read_coverage);
+  }
+  if (a.align_count) {
+    put_uint(a.align_count->local_read_lens);
+    put_uint(a.align_count->local_aligned_bases);
+    put_uint(a.align_count->tot_aligned_bases);
+  }
+  put_uint(a.read_cov_max_paths);
+  put_strings(a.tags);
+  put_strings(a.phase_ids);
+
+  put_uint(a.sub_assemblies.size());
+  for (const auto& sub : a.sub_assemblies) {
+    CHECK(sub);
+    CHECK(*sub);
+    put_assembly(**sub);
+  }
+
+  if (a.ml_features) {
+    const assembly_ml_features& f = *a.ml_features;
+    put_int(f.score);
+    put_int(f.refspan);
+    put_int(f.lanch);
+    put_int(f.ranch);
+    put_raw(f.refgc);
+    put_raw(f.altgc);
+    put_seq(f.alt_seq);
+  }
+}
+
+class decoder {
+ public:
+  decoder(const char* begin, const char* end) : m_pos(begin), m_end(end) {}
+
+  bool done() const { return m_pos == m_end; }
+
+  uint64_t get_uint() {
+    uint64_t val = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      check_avail(1);
+      uint8_t byte = *m_pos++;
+      val |= uint64_t(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        return val;
+      }
+    }
+    throw(io_exception("Invalid varint in assembly stream"));
+  }
+  int64_t get_int() {
+    uint64_t val = get_uint();
+    return int64_t(val >> 1) ^ -int64_t(val & 1);
+  }
+  template <typename T>
+  T get_raw() {
+    check_avail(sizeof(T));
+    T val;
+    memcpy(&val, m_pos, sizeof(T));
+    m_pos += sizeof(T);
+    return val;
+  }
+  std::string get_string() {
+    size_t len = get_uint();
+    check_avail(len);
+    std::string str(m_pos, len);
+    m_pos += len;
+    return str;
+  }
+
+  dna_sequence get_seq() {
+    size_t size = get_uint();
+    if (!size) {
+      return dna_sequence();
+    }
+    size_t packed_len = size / 4 + 1;
+    check_avail(packed_len);
+    dna_sequence seq(std::string(m_pos, packed_len), true /* packed */);
+    m_pos += packed_len;
+    if (seq.size() != size) {
+      throw(io_exception("Invalid sequence in assembly stream"));
+    }
+    return seq;
+  }
+
+  read_id_set get_read_ids() {
+    read_id_set ids;
+    size_t count = get_uint();
+    uint32_t id = 0;
+    for (size_t i = 0; i != count; ++i) {
+      id += get_uint();
+      ids.insert(id);
+    }
+    return ids;
+  }
+
+  std::vector<int> get_depths() {
+    std::vector<int> depths(get_uint());
+    int prev = 0;
+    for (int& depth : depths) {
+      depth = prev + get_int();
+      prev = depth;
+    }
+    return depths;
+  }
+
+  template <typename T>
+  std::vector<T> get_uints() {
+    std::vector<T> vals(get_uint());
+    for (T& val : vals) {
+      val = get_uint();
+    }
+    return vals;
+  }
+
+  string_set get_strings() {
+    string_set strs;
+    size_t count = get_uint();
+    for (size_t i = 0; i != count; ++i) {
+      strs.insert(get_string());
+    }
+    return strs;
+  }
+
+  read_coverage_t get_read_coverage() {
+    int assembly_len = get_int();
+    std::vector<read_coverage_read_t> reads(get_uint());
+    int prev_offset = 0;
+    for (auto& rd : reads) {
+      rd.offset = prev_offset + get_int();
+      prev_offset = rd.offset;
+      rd.read_len = get_int();
+      rd.read_ids = get_read_ids();
+    }
+    return read_coverage_t(assembly_len, std::move(reads));
+  }
+
+  assembly_ptr get_assembly();
+
+ private:
+  void check_avail(size_t len) const {
+    if (size_t(m_end - m_pos) < len) {
+      throw(io_exception("Truncated assembly stream record"));
+    }
+  }
+
+  const char* m_pos;
+  const char* const m_end;
+};
+
+assembly_ptr decoder::get_assembly() {
+  assembly_ptr a = make_unique<assembly>();
+  uint64_t flags = get_uint();
+
+  a->assembly_id = get_uint();
+  a->merged_assembly_ids = get_uints<size_t>();
+  if (flags & k_has_left_offset) {
+    a->left_offset = aoffset_t(get_int());
+  } else {
+    a->left_offset = optional_aoffset::none;
+  }
+  a->left_anchor_len = get_int();
+  if (flags & k_has_right_offset) {
+    a->right_offset = aoffset_t(get_int());
+  } else {
+    a->right_offset = optional_aoffset::none;
+  }
+  a->right_anchor_len = get_int();
+  a->seq = get_seq();
+
+  a->trace_steps = get_uint();
+  a->unique_pairs_used = get_uint();
+  a->min_overlap = get_uint();
+  a->left_anchor_ambiguous_bases = get_uint();
+  a->other_depth = get_uint();
+  a->other_pair_depth = get_uint();
+  a->ref_depth = get_uint();
+  a->strand_count = get_uint();
+  a->genotype_quality = get_raw<double>();
+
+  a->rc_read_ids = get_read_ids();
+  a->coverage = get_depths();
+  a->pair_coverage = get_depths();
+  a->left_pair_matches = get_uints<uint32_t>();
+  a->right_pair_matches = get_uints<uint32_t>();
+  a->score = get_int();
+  a->matches_reference = flags & k_matches_reference;
+
+  a->aligned_variants.resize(get_uint());
+  for (auto& v : a->aligned_variants) {
+    v.left_offset = get_int();
+    v.right_offset = get_int();
+    v.seq = get_seq();
+    v.max_alt_depth = get_int();
+  }
+
+  a->bypass_coverage = flags & k_bypass_coverage;
+  if (flags & k_has_edge_coverage) {
+    a->edge_coverage.emplace();
+    edge_coverage_t& ec = *a->edge_coverage;
+    ec.variant_start = get_read_ids();
+    ec.variant_end = get_read_ids();
+    ec.interior = get_read_ids();
+    ec.reference_start = get_read_ids();
+    ec.reference_end = get_read_ids();
+    ec.start_common = get_int();
+    ec.end_common = get_int();
+  }
+  if (flags & k_has_read_coverage) {
+    a->read_coverage.emplace(get_read_coverage());
+  }
+  if (flags & k_has_pair_read_coverage) {
+    a->pair_read_coverage.emplace(get_read_coverage());
+  }
+  if (flags & k_has_align_count) {
+    a->align_count.emplace();
+    a->align_count->local_read_lens = get_uint();
+    a->align_count->local_aligned_bases = get_uint();
+    a->align_count->tot_aligned_bases = get_uint();
+  }
+  a->read_cov_max_paths = get_uint();
+  a->tags = get_strings();
+  a->phase_ids = get_strings();
+
+  size_t num_subs = get_uint();
+  for (size_t i = 0; i != num_subs; ++i) {
+    a->sub_assemblies.push_back(std::make_shared<assembly_ptr>(get_assembly()));
+  }
+
+  if (flags & k_has_ml_features) {
+    a->ml_features.emplace();
+    assembly_ml_features& f = *a->ml_features;
+    f.score = get_int();
+    f.refspan = get_int();
+    f.lanch = get_int();
+    f.ranch = get_int();
+    f.refgc = get_raw<float>();
+    f.altgc = get_raw<float>();
+    f.alt_seq = get_seq();
+  }
+  return a;
+}
+
+}  // namespace
+
+assembly_stream_writer::assembly_stream_writer(writable* out) : m_out(out) {
+  std::string header(k_magic, k_magic_len);
+  append_varint(header, k_format_version);
+  m_out->write(header);
+}
+
+void assembly_stream_writer::write(const assembly& a) {
+  encoder enc;
+  enc.put_assembly(a);
+
+  std::string len;
+  append_varint(len, enc.str().size());
+
+  std::lock_guard<std::mutex> l(m_mu);
+  m_out->write(len);
+  m_out->write(enc.str());
+  ++m_count;
+}
+
+pipeline_step_t assembly_stream_writer::make_capture_step(pipeline_step_t output) {
+  return make_unique<assemble_lambda_copy>([this](const assembly& a) { write(a); },
+                                           std::move(output), "assembly_stream_capture");
+}
+
+assembly_stream_reader::assembly_stream_reader(readable* in) : m_in(in) {
+  char magic[k_magic_len];
+  if (m_in->read(magic, k_magic_len) != k_magic_len || memcmp(magic, k_magic, k_magic_len)) {
+    throw(io_exception("Not an assembly stream"));
+  }
+  uint64_t version = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    uint8_t byte;
+    if (shift >= 64 || m_in->read(reinterpret_cast<char*>(&byte), 1) != 1) {
+      throw(io_exception("Truncated assembly stream header"));
+    }
+    version |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  if (version != k_format_version) {
+    throw(io_exception(printstring("Unsupported assembly stream version %lu", version)));
+  }
+}
+
+assembly_ptr assembly_stream_reader::read() {
+  uint64_t len = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    uint8_t byte;
+    if (m_in->read(reinterpret_cast<char*>(&byte), 1) != 1) {
+      if (shift == 0) {
+        // Clean end of stream.
+        return nullptr;
+      }
+      throw(io_exception("Truncated assembly stream record"));
+    }
+    if (shift >= 64) {
+      throw(io_exception("Invalid record length in assembly stream"));
+    }
+    len |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+
+  m_buf.resize(len);
+  if (m_in->read(&m_buf[0], len) != len) {
+    throw(io_exception("Truncated assembly stream record"));
+  }
+  decoder dec(m_buf.data(), m_buf.data() + m_buf.size());
+  assembly_ptr a = dec.get_assembly();
+  if (!dec.done()) {
+    throw(io_exception("Extra data at end of assembly stream record"));
+  }
+  return a;
+}
+
+std::vector<assembly_ptr> assembly_stream_reader::read_all() {
+  std::vector<assembly_ptr> result;
+  for (;;) {
+    assembly_ptr a = read();
+    if (!a) {
+      return result;
+    }
+    result.push_back(std::move(a));
+  }
+}
+
+}  // namespace variants
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "modules/io/io.h"
+#include "modules/variants/assemble.h"
+
+#include <mutex>
+
+namespace variants {
+
+// Compact binary serialization of a stream of assemblies.  This lets
+// the input to a pipeline step be captured once from a real run and
+// replayed later, e.g. to benchmark a single step without re-running
+// discovery from the start.
+//
+// All fields of an assembly are saved except for user_data and the
+// seqset_entries caches, which are recalculated as needed.
+// Sequences are stored 2 bits per base, and integers are stored as
+// varints, with read ids and coverage delta encoded.
+class assembly_stream_writer {
+ public:
+  // Writes a stream header to "out", which must outlive this writer.
+  explicit assembly_stream_writer(writable* out);
+  assembly_stream_writer() = delete;
+
+  // Appends an assembly to the stream.  This may be called from
+  // multiple threads at once.
+  void write(const assembly& a);
+
+  // Number of assemblies written so far.
+  size_t count() const { return m_count; }
+
+  // Returns a pipeline step that writes each assembly to this stream
+  // before passing it along to "output".
+  pipeline_step_t make_capture_step(pipeline_step_t output);
+
+ private:
+  std::mutex m_mu;
+  writable* const m_out;
+  std::atomic<size_t> m_count{0};
+};
+
+class assembly_stream_reader {
+ public:
+  // Reads the stream header from "in", which must outlive this
+  // reader.  Throws io_exception if "in" does not contain an
+  // assembly stream.
+  explicit assembly_stream_reader(readable* in);
+  assembly_stream_reader() = delete;
+
+  // Returns the next assembly from the stream, or a null pointer if
+  // the end of the stream has been reached.
+  assembly_ptr read();
+
+  // Reads all remaining assemblies from the stream.
+  std::vector<assembly_ptr> read_all();
+
+ private:
+  readable* const m_in;
+  std::string m_buf;
+};
+
+}  // namespace variants
@@ -0,0 +1,249 @@
+#include "modules/variants/assembly_stream.h"
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/io/mem_io.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+namespace variants {
+
+using namespace testing;
+using namespace dna_testutil;
+
+class assembly_stream_test : public Test {
+ protected:
+  assembly_stream_test() : m_io("", track_alloc("assembly_stream_test")) {}
+
+  static assembly_ptr make_full_assembly() {
+    assembly_ptr a = make_unique<assembly>();
+    a->assembly_id = 12345;
+    a->merged_assembly_ids = {7, 8};
+    a->left_offset = 1000;
+    a->left_anchor_len = 3;
+    a->right_offset = 1010;
+    a->right_anchor_len = 4;
+    a->seq = tseq("abcdefghijklmnop");
+    a->trace_steps = 17;
+    a->unique_pairs_used = 2;
+    a->min_overlap = 80;
+    a->left_anchor_ambiguous_bases = 5;
+    a->other_depth = 6;
+    a->other_pair_depth = 1;
+    a->ref_depth = 9;
+    a->strand_count = 2;
+    a->genotype_quality = 0.75;
+    for (uint32_t read_id : std::vector<uint32_t>{5, 6, 7, 100, 100000, 4000000000U}) {
+      a->rc_read_ids.insert(read_id);
+    }
+    for (uint32_t read_id = 200000; read_id < 210000; read_id += 3) {
+      a->rc_read_ids.insert(read_id);
+    }
+    a->coverage = {1, 5, 3, 0, 8};
+    a->pair_coverage = {0, -1, 2};
+    a->left_pair_matches = {3, 1, 2};
+    a->right_pair_matches = {9};
+    a->score = -12345678901;
+    a->aligned_variants.emplace_back();
+    a->aligned_variants.back().left_offset = 1003;
+    a->aligned_variants.back().right_offset = 1005;
+    a->aligned_variants.back().seq = tseq("q");
+    a->aligned_variants.back().max_alt_depth = 4;
+    a->bypass_coverage = true;
+
+    a->edge_coverage.emplace();
+    a->edge_coverage->variant_start.insert(1);
+    a->edge_coverage->variant_end.insert(2);
+    a->edge_coverage->interior.insert(3);
+    a->edge_coverage->reference_start.insert(4);
+    a->edge_coverage->reference_end.insert(5);
+    a->edge_coverage->start_common = 6;
+    a->edge_coverage->end_common = 7;
+
+    a->read_coverage.emplace(a->seq.size(),
+                             std::vector<read_coverage_read_t>{
+                                 read_coverage_read_t(-5, 10, 20), read_coverage_read_t(2, 11, 5)});
+    a->pair_read_coverage.emplace(a->seq.size(), std::vector<read_coverage_read_t>{
+                                                     read_coverage_read_t(0, 12, 16)});
+    a->align_count.emplace();
+    a->align_count->local_read_lens = 1;
+    a->align_count->local_aligned_bases = 2;
+    a->align_count->tot_aligned_bases = 3;
+    a->read_cov_max_paths = 4;
+    a->tags.insert("tag1");
+    a->tags.insert("tag2");
+    a->phase_ids.insert("phase1");
+
+    a->ml_features.emplace();
+    a->ml_features->score = 1;
+    a->ml_features->refspan = 2;
+    a->ml_features->lanch = 3;
+    a->ml_features->ranch = 4;
+    a->ml_features->refgc = 0.5;
+    a->ml_features->altgc = 0.25;
+    a->ml_features->alt_seq = tseq("z");
+    return a;
+  }
+
+  void expect_same(const assembly& expected, const assembly& actual) {
+    EXPECT_EQ(dump_assembly_and_vars(expected), dump_assembly_and_vars(actual));
+    EXPECT_EQ(expected.assembly_id, actual.assembly_id);
+    EXPECT_EQ(expected.merged_assembly_ids, actual.merged_assembly_ids);
+    EXPECT_EQ(expected.left_offset, actual.left_offset);
+    EXPECT_EQ(expected.left_anchor_len, actual.left_anchor_len);
+    EXPECT_EQ(expected.right_offset, actual.right_offset);
+    EXPECT_EQ(expected.right_anchor_len, actual.right_anchor_len);
+    EXPECT_EQ(expected.seq, actual.seq);
+    EXPECT_EQ(expected.trace_steps, actual.trace_steps);
+    EXPECT_EQ(expected.unique_pairs_used, actual.unique_pairs_used);
+    EXPECT_EQ(expected.min_overlap, actual.min_overlap);
+    EXPECT_EQ(expected.left_anchor_ambiguous_bases, actual.left_anchor_ambiguous_bases);
+    EXPECT_EQ(expected.other_depth, actual.other_depth);
+    EXPECT_EQ(expected.other_pair_depth, actual.other_pair_depth);
+    EXPECT_EQ(expected.ref_depth, actual.ref_depth);
+    EXPECT_EQ(expected.strand_count, actual.strand_count);
+    EXPECT_EQ(expected.genotype_quality, actual.genotype_quality);
+    EXPECT_EQ(expected.rc_read_ids, actual.rc_read_ids);
+    EXPECT_EQ(expected.coverage, actual.coverage);
+    EXPECT_EQ(expected.pair_coverage, actual.pair_coverage);
+    EXPECT_EQ(expected.left_pair_matches, actual.left_pair_matches);
+    EXPECT_EQ(expected.right_pair_matches, actual.right_pair_matches);
+    EXPECT_EQ(expected.score, actual.score);
+    EXPECT_EQ(expected.matches_reference, actual.matches_reference);
+    EXPECT_EQ(expected.aligned_variants, actual.aligned_variants);
+    ASSERT_EQ(expected.aligned_variants.size(), actual.aligned_variants.size());
+    for (size_t i = 0; i != expected.aligned_variants.size(); ++i) {
+      EXPECT_EQ(expected.aligned_variants[i].max_alt_depth,
+                actual.aligned_variants[i].max_alt_depth);
+    }
+    EXPECT_EQ(expected.bypass_coverage, actual.bypass_coverage);
+    ASSERT_EQ(bool(expected.edge_coverage), bool(actual.edge_coverage));
+    if (expected.edge_coverage) {
+      EXPECT_EQ(expected.edge_coverage->variant_start, actual.edge_coverage->variant_start);
+      EXPECT_EQ(expected.edge_coverage->variant_end, actual.edge_coverage->variant_end);
+      EXPECT_EQ(expected.edge_coverage->interior, actual.edge_coverage->interior);
+      EXPECT_EQ(expected.edge_coverage->reference_start, actual.edge_coverage->reference_start);
+      EXPECT_EQ(expected.edge_coverage->reference_end, actual.edge_coverage->reference_end);
+      EXPECT_EQ(expected.edge_coverage->start_common, actual.edge_coverage->start_common);
+      EXPECT_EQ(expected.edge_coverage->end_common, actual.edge_coverage->end_common);
+    }
+    EXPECT_EQ(expected.read_coverage, actual.read_coverage);
+    EXPECT_EQ(expected.pair_read_coverage, actual.pair_read_coverage);
+    ASSERT_EQ(bool(expected.align_count), bool(actual.align_count));
+    if (expected.align_count) {
+      EXPECT_EQ(expected.align_count->local_read_lens, actual.align_count->local_read_lens);
+      EXPECT_EQ(expected.align_count->local_aligned_bases,
+                actual.align_count->local_aligned_bases);
+      EXPECT_EQ(expected.align_count->tot_aligned_bases, actual.align_count->tot_aligned_bases);
+    }
+    EXPECT_EQ(expected.read_cov_max_paths, actual.read_cov_max_paths);
+    EXPECT_EQ(expected.tags, actual.tags);
+    EXPECT_EQ(expected.phase_ids, actual.phase_ids);
+    ASSERT_EQ(expected.sub_assemblies.size(), actual.sub_assemblies.size());
+    for (size_t i = 0; i != expected.sub_assemblies.size(); ++i) {
+      expect_same(**expected.sub_assemblies[i], **actual.sub_assemblies[i]);
+    }
+    ASSERT_EQ(bool(expected.ml_features), bool(actual.ml_features));
+    if (expected.ml_features) {
+      EXPECT_EQ(expected.ml_features->score, actual.ml_features->score);
+      EXPECT_EQ(expected.ml_features->refspan, actual.ml_features->refspan);
+      EXPECT_EQ(expected.ml_features->lanch, actual.ml_features->lanch);
+      EXPECT_EQ(expected.ml_features->ranch, actual.ml_features->ranch);
+      EXPECT_EQ(expected.ml_features->refgc, actual.ml_features->refgc);
+      EXPECT_EQ(expected.ml_features->altgc, actual.ml_features->altgc);
+      EXPECT_EQ(expected.ml_features->alt_seq, actual.ml_features->alt_seq);
+    }
+  }
+
+  mem_io m_io;
+};
+
+TEST_F(assembly_stream_test, empty) {
+  { assembly_stream_writer w(&m_io); }
+  assembly_stream_reader r(&m_io);
+  EXPECT_FALSE(r.read());
+}
+
+TEST_F(assembly_stream_test, round_trip) {
+  std::vector<assembly_ptr> expected;
+  expected.push_back(make_full_assembly());
+
+  assembly_ptr unanchored = make_unique<assembly>();
+  unanchored->left_offset = optional_aoffset::none;
+  unanchored->right_offset = 5;
+  unanchored->seq = tseq("abc");
+  expected.push_back(std::move(unanchored));
+
+  assembly_ptr empty_seq = make_unique<assembly>();
+  empty_seq->left_offset = 10;
+  empty_seq->right_offset = 20;
+  empty_seq->matches_reference = true;
+  expected.push_back(std::move(empty_seq));
+
+  assembly_ptr with_subs = make_full_assembly();
+  with_subs->sub_assemblies.push_back(std::make_shared<assembly_ptr>(make_full_assembly()));
+  with_subs->sub_assemblies.push_back(std::make_shared<assembly_ptr>(make_unique<assembly>()));
+  expected.push_back(std::move(with_subs));
+
+  {
+    assembly_stream_writer w(&m_io);
+    for (const auto& a : expected) {
+      w.write(*a);
+    }
+    EXPECT_EQ(expected.size(), w.count());
+  }
+
+  assembly_stream_reader r(&m_io);
+  std::vector<assembly_ptr> actual = r.read_all();
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i != expected.size(); ++i) {
+    SCOPED_TRACE(i);
+    expect_same(*expected[i], *actual[i]);
+  }
+  EXPECT_FALSE(actual[1]->left_offset);
+  EXPECT_EQ(0, actual[2]->seq.size());
+}
+
+TEST_F(assembly_stream_test, capture_step) {
+  std::vector<assembly_ptr> passed;
+  {
+    assembly_stream_writer w(&m_io);
+    pipeline_step_t step = w.make_capture_step(make_unique<assemble_lambda_output>(
+        [&](assembly_ptr a) { passed.push_back(std::move(a)); }, "test_output"));
+    for (int i = 0; i != 3; ++i) {
+      assembly_ptr a = make_unique<assembly>();
+      a->assembly_id = i;
+      a->left_offset = i * 10;
+      a->right_offset = i * 10 + 5;
+      a->seq = tseq("abcde");
+      step->add(std::move(a));
+    }
+    step.reset();
+    EXPECT_EQ(3, w.count());
+  }
+  ASSERT_EQ(3, passed.size());
+
+  assembly_stream_reader r(&m_io);
+  std::vector<assembly_ptr> captured = r.read_all();
+  ASSERT_EQ(3, captured.size());
+  for (size_t i = 0; i != 3; ++i) {
+    expect_same(*passed[i], *captured[i]);
+  }
+}
+
+TEST_F(assembly_stream_test, truncated) {
+  {
+    assembly_stream_writer w(&m_io);
+    w.write(*make_full_assembly());
+  }
+  std::string data = m_io.str();
+  mem_io truncated(data.substr(0, data.size() - 3), track_alloc("assembly_stream_test"));
+  assembly_stream_reader r(&truncated);
+  EXPECT_THROW(r.read(), io_exception);
+}
+
+TEST_F(assembly_stream_test, not_a_stream) {
+  m_io.print("scaffold_name,left_offset,right_offset\n");
+  EXPECT_THROW(assembly_stream_reader r(&m_io), io_exception);
+}
+
+}  // namespace variants
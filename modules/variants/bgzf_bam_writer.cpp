@@ -0,0 +1,292 @@
+#include "modules/variants/bgzf_bam_writer.h"
+#include "base/base.h"
+#include "modules/io/log.h"
+#include "modules/io/utils.h"
+
+#include <htslib/hts.h>
+
+#include <cstring>
+#include <unistd.h>
+
+namespace variants {
+
+namespace {
+
+constexpr int k_min_shift = 14;
+constexpr int k_bai_levels = 5;
+
+// Offsets of fields within an encoded BAM record, including the
+// leading block_size field.
+constexpr size_t k_ref_id_offset = 4;
+constexpr size_t k_pos_offset = 8;
+constexpr size_t k_bin_offset = 14;
+constexpr size_t k_read_name_len_offset = 12;
+constexpr size_t k_n_cigar_offset = 16;
+constexpr size_t k_read_name_offset = 36;
+
+// BAM CIGAR operations, in order of their numeric codes.
+constexpr char k_cigar_ops[] = "MIDNSHP=X";
+// Bitmasks of CIGAR operations that consume query and reference bases.
+constexpr uint32_t k_consumes_query = 0x193;  // M, I, S, =, X
+constexpr uint32_t k_consumes_ref = 0x18D;    // M, D, N, =, X
+
+void append_le16(std::string* out, uint16_t val) {
+  out->push_back(char(val & 0xFF));
+  out->push_back(char(val >> 8));
+}
+
+void append_le32(std::string* out, uint32_t val) {
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(char((val >> (8 * i)) & 0xFF));
+  }
+}
+
+uint32_t read_le32(const char* buf) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(buf);
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint16_t read_le16(const char* buf) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(buf);
+  return uint16_t(p[0]) | uint16_t(p[1]) << 8;
+}
+
+// Returns the bin to store in a record's 16-bit bin field, using the
+// bins of an index with the given number of levels.  Bins in the lower
+// levels of a deep CSI index don't fit, so those records get the
+// smallest enclosing bin that does.
+uint16_t record_bin(int64_t beg, int64_t end, int n_lvls) {
+  int bin = hts_reg2bin(beg, end, k_min_shift, n_lvls);
+  while (bin > 0xFFFF) {
+    bin = hts_bin_parent(bin);
+  }
+  return bin;
+}
+
+}  // namespace
+
+void append_bam_record(std::string* out, int32_t tid, int32_t pos, const std::string& read_name,
+                       uint16_t flag, uint8_t mapq, const std::string& cigar,
+                       const dna_sequence& seq) {
+  if (pos < 0) {
+    throw io_exception(printstring("Invalid position %d for read %s", pos, read_name.c_str()));
+  }
+  std::vector<uint32_t> ops;
+  if (cigar.empty()) {
+    ops.push_back(uint32_t(seq.size()) << 4);
+  } else {
+    uint32_t len = 0;
+    bool have_len = false;
+    for (char c : cigar) {
+      if (c >= '0' && c <= '9') {
+        len = len * 10 + (c - '0');
+        have_len = true;
+        continue;
+      }
+      const char* op = strchr(k_cigar_ops, c);
+      if (!op || !c || !have_len) {
+        throw io_exception("Invalid CIGAR: " + cigar);
+      }
+      ops.push_back(len << 4 | uint32_t(op - k_cigar_ops));
+      len = 0;
+      have_len = false;
+    }
+    if (have_len) {
+      throw io_exception("Invalid CIGAR: " + cigar);
+    }
+  }
+  if (ops.size() > 0xFFFF) {
+    throw io_exception(printstring("Too many CIGAR operations (%ld) for read %s", ops.size(),
+                                   read_name.c_str()));
+  }
+
+  int64_t query_len = 0;
+  int64_t ref_len = 0;
+  for (uint32_t op : ops) {
+    if (k_consumes_query & (1 << (op & 0xF))) {
+      query_len += op >> 4;
+    }
+    if (k_consumes_ref & (1 << (op & 0xF))) {
+      ref_len += op >> 4;
+    }
+  }
+  if (query_len != int64_t(seq.size())) {
+    throw io_exception(printstring("CIGAR %s does not match length %ld of read %s", cigar.c_str(),
+                                   seq.size(), read_name.c_str()));
+  }
+
+  size_t seq_bytes = (seq.size() + 1) / 2;
+  size_t block_size = k_read_name_offset - 4 + read_name.size() + 1 + 4 * ops.size() +
+                      seq_bytes + seq.size();
+  out->reserve(out->size() + block_size + 4);
+
+  append_le32(out, block_size);
+  append_le32(out, tid);
+  append_le32(out, pos);
+  out->push_back(char(read_name.size() + 1));
+  out->push_back(char(mapq));
+  append_le16(out, record_bin(pos, pos + std::max<int64_t>(ref_len, 1), k_bai_levels));
+  append_le16(out, ops.size());
+  append_le16(out, flag);
+  append_le32(out, seq.size());
+  append_le32(out, uint32_t(-1));  // next refID
+  append_le32(out, uint32_t(-1));  // next pos
+  append_le32(out, 0);             // template length
+  out->append(read_name.c_str(), read_name.size() + 1);
+  for (uint32_t op : ops) {
+    append_le32(out, op);
+  }
+
+  // Bases are stored 4 bits each, as 1, 2, 4, and 8 for A, C, G, and T.
+  size_t seq_start = out->size();
+  out->resize(seq_start + seq_bytes);
+  for (size_t i = 0; i < seq.size(); ++i) {
+    uint8_t code = 1 << int(seq[i]);
+    (*out)[seq_start + i / 2] |= char(i % 2 ? code : code << 4);
+  }
+  // Missing base qualities.
+  out->append(seq.size(), char(0xFF));
+}
+
+std::pair<int32_t, int32_t> bam_record_position(const char* rec) {
+  return std::make_pair(int32_t(read_le32(rec + k_ref_id_offset)),
+                        int32_t(read_le32(rec + k_pos_offset)));
+}
+
+constexpr int64_t bgzf_bam_writer::k_max_bai_len;
+
+bgzf_bam_writer::bgzf_bam_writer(const std::string& path,
+                                 const std::vector<std::pair<std::string, int64_t>>& contigs,
+                                 const std::string& header_text)
+    : m_path(path), m_file(path), m_bgzf(&m_file), m_num_contigs(contigs.size()) {
+  int64_t max_len = 0;
+  std::string header = "BAM\1";
+  append_le32(&header, header_text.size());
+  header += header_text;
+  append_le32(&header, contigs.size());
+  for (const auto& contig : contigs) {
+    append_le32(&header, contig.first.size() + 1);
+    header.append(contig.first.c_str(), contig.first.size() + 1);
+    append_le32(&header, contig.second);
+    max_len = std::max(max_len, contig.second);
+  }
+  m_bgzf.write(header.data(), header.size());
+  // Keep the header in its own blocks so that the offset of the first
+  // record is known right away.
+  m_bgzf.flush();
+
+  uint64_t offset0 = m_bgzf.virtual_offset(m_bgzf.tell());
+  if (max_len < k_max_bai_len) {
+    m_index_fmt = HTS_FMT_BAI;
+    m_n_lvls = k_bai_levels;
+  } else {
+    // Same number of levels as "samtools index -c".
+    m_index_fmt = HTS_FMT_CSI;
+    m_n_lvls = 0;
+    for (int64_t s = 1LL << k_min_shift; max_len + 256 > s; s <<= 3) {
+      ++m_n_lvls;
+    }
+  }
+  m_idx = hts_idx_init(contigs.size(), m_index_fmt, offset0, k_min_shift, m_n_lvls);
+  if (!m_idx) {
+    throw io_exception("Unable to initialize index for " + m_path);
+  }
+}
+
+bgzf_bam_writer::~bgzf_bam_writer() {
+  if (m_idx) {
+    hts_idx_destroy(m_idx);
+  }
+}
+
+void bgzf_bam_writer::write_record(const char* rec, size_t len) {
+  CHECK(!m_closed);
+  if (len < k_read_name_offset || read_le32(rec) + 4 != len) {
+    throw io_exception("Malformed BAM record");
+  }
+
+  int32_t tid;
+  int32_t beg;
+  std::tie(tid, beg) = bam_record_position(rec);
+  if (tid < 0 || size_t(tid) >= m_num_contigs) {
+    throw io_exception(printstring("BAM record has invalid reference id %d", tid));
+  }
+  if (beg < 0) {
+    throw io_exception(printstring("BAM record has invalid position %d", beg));
+  }
+  if (tid < m_cur_tid) {
+    throw io_exception(printstring("BAM records must be sorted by reference; %d found after %d",
+                                   tid, m_cur_tid));
+  } else if (tid == m_cur_tid && beg < m_cur_pos) {
+    throw io_exception(printstring("BAM records must be sorted by position; %d found after %ld",
+                                   beg, m_cur_pos));
+  }
+  m_cur_tid = tid;
+  m_cur_pos = beg;
+
+  const char* cigar = rec + k_read_name_offset + uint8_t(rec[k_read_name_len_offset]);
+  uint16_t n_cigar = read_le16(rec + k_n_cigar_offset);
+  int64_t ref_len = 0;
+  for (uint16_t i = 0; i < n_cigar; ++i) {
+    uint32_t op = read_le32(cigar + 4 * i);
+    if (k_consumes_ref & (1 << (op & 0xF))) {
+      ref_len += op >> 4;
+    }
+  }
+
+  int64_t end = beg + std::max<int64_t>(ref_len, 1);
+
+  // Store the bin for the index actually being written, in case it's
+  // a CSI index.
+  std::string bin;
+  append_le16(&bin, record_bin(beg, end, m_n_lvls));
+  m_bgzf.write(rec, k_bin_offset);
+  m_bgzf.write(bin.data(), bin.size());
+  m_bgzf.write(rec + k_bin_offset + bin.size(), len - k_bin_offset - bin.size());
+  ++m_records;
+
+  pending_record pending;
+  pending.tid = tid;
+  pending.beg = beg;
+  pending.end = end;
+  pending.uoffset_end = m_bgzf.tell();
+  m_pending.push_back(pending);
+  index_committed();
+}
+
+void bgzf_bam_writer::index_committed() {
+  while (!m_pending.empty() && m_pending.front().uoffset_end <= m_bgzf.committed()) {
+    const pending_record& rec = m_pending.front();
+    if (hts_idx_push(m_idx, rec.tid, rec.beg, rec.end, m_bgzf.virtual_offset(rec.uoffset_end),
+                     1 /* is mapped */) < 0) {
+      throw io_exception("Unable to add record to index for " + m_path);
+    }
+    m_pending.pop_front();
+  }
+}
+
+void bgzf_bam_writer::close() {
+  if (m_closed) {
+    return;
+  }
+  m_bgzf.flush();
+  index_committed();
+  CHECK(m_pending.empty());
+  hts_idx_finish(m_idx, m_bgzf.virtual_offset(m_bgzf.tell()));
+  m_bgzf.close();
+  m_file.close();
+
+  if (hts_idx_save(m_idx, m_path.c_str(), m_index_fmt) < 0) {
+    throw io_exception("Unable to save index " + index_path());
+  }
+  // Readers prefer a CSI index if present, so make sure there's no stale
+  // index of the other format left over.
+  unlink((m_path + (m_index_fmt == HTS_FMT_BAI ? ".csi" : ".bai")).c_str());
+  m_closed = true;
+}
+
+std::string bgzf_bam_writer::index_path() const {
+  return m_path + (m_index_fmt == HTS_FMT_BAI ? ".bai" : ".csi");
+}
+
+}  // namespace variants
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "modules/bio_base/dna_sequence.h"
+#include "modules/io/bgzf_writer.h"
+#include "modules/io/file_io.h"
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct __hts_idx_t;
+
+namespace variants {
+
+// Appends an encoded BAM record for an aligned read to "out",
+// including its leading block_size field.  "cigar" is a SAM format
+// CIGAR string; if empty, the whole read is treated as matching.
+// Base qualities are omitted.  Throws io_exception if "pos" is
+// negative, since only mapped reads are supported.
+void append_bam_record(std::string* out, int32_t tid, int32_t pos, const std::string& read_name,
+                       uint16_t flag, uint8_t mapq, const std::string& cigar,
+                       const dna_sequence& seq);
+
+// Returns the tid and position of an encoded BAM record.
+std::pair<int32_t, int32_t> bam_record_position(const char* rec);
+
+// Writes a coordinate-sorted BAM compressed with BGZF, building a BAI
+// index as records are written.  If any contig is too long to be
+// represented in a BAI index, a CSI index is written instead, and the
+// bin field of each record is recalculated to match it.
+class bgzf_bam_writer {
+ public:
+  // Maximum contig length representable in a BAI index.
+  static constexpr int64_t k_max_bai_len = 1LL << 29;
+
+  // "contigs" gives the name and length of each reference sequence;
+  // records refer to them by index.  "header_text" is the SAM header
+  // text, which should include an @SQ line for each contig.
+  bgzf_bam_writer(const std::string& path,
+                  const std::vector<std::pair<std::string, int64_t>>& contigs,
+                  const std::string& header_text);
+  ~bgzf_bam_writer();
+
+  // Writes a single record as encoded by append_bam_record.  Throws
+  // io_exception if records are not in coordinate order.
+  void write_record(const char* rec, size_t len);
+  void write_record(const std::string& rec) { write_record(rec.data(), rec.size()); }
+
+  // Finishes writing the BAM and saves the index.
+  void close();
+
+  // Path of the index written, once closed.
+  std::string index_path() const;
+
+  size_t records() const { return m_records; }
+
+ private:
+  struct pending_record {
+    int32_t tid;
+    int64_t beg;
+    int64_t end;
+    uint64_t uoffset_end;
+  };
+
+  void index_committed();
+
+  std::string m_path;
+  file_writer m_file;
+  bgzf_writer m_bgzf;
+
+  size_t m_num_contigs = 0;
+  int m_index_fmt;
+  int m_n_lvls;
+  __hts_idx_t* m_idx = nullptr;
+
+  int32_t m_cur_tid = -1;
+  int64_t m_cur_pos = 0;
+
+  // Records which are not yet compressed, and so do not have a
+  // virtual offset yet.
+  std::deque<pending_record> m_pending;
+
+  size_t m_records = 0;
+  bool m_closed = false;
+};
+
+}  // namespace variants
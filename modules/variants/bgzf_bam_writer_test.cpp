@@ -0,0 +1,167 @@
+#include "modules/variants/bgzf_bam_writer.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <htslib/bgzf.h>
+#include <htslib/sam.h>
+#include <cstring>
+
+#include "modules/test/test_utils.h"
+
+using namespace testing;
+
+namespace variants {
+
+namespace {
+
+const std::vector<std::pair<std::string, int64_t>> k_contigs = {
+    {"1", 1000000}, {"2", 1000000}, {"X", 1000000}};
+
+std::string sam_header(const std::vector<std::pair<std::string, int64_t>>& contigs) {
+  std::string header = "@HD\tVN:1.4\tSO:coordinate\n";
+  for (const auto& contig : contigs) {
+    header += printstring("@SQ\tSN:%s\tLN:%ld\n", contig.first.c_str(), contig.second);
+  }
+  return header;
+}
+
+std::string record(int32_t tid, int32_t pos, const std::string& name = "read",
+                   const std::string& cigar = "4M", const std::string& seq = "ACGT",
+                   uint16_t flag = 0) {
+  std::string rec;
+  append_bam_record(&rec, tid, pos, name, flag, 255, cigar, dna_sequence(seq));
+  return rec;
+}
+
+}  // namespace
+
+class bgzf_bam_writer_test : public Test {
+ protected:
+  void SetUp() override { m_path = make_path("bgzf_bam_writer_test.bam"); }
+
+  // Returns the records overlapping the given region in SAM format, as
+  // found using the index.
+  std::vector<std::string> query(const std::string& region) {
+    samFile* fp = sam_open(m_path.c_str(), "r");
+    CHECK(fp);
+    bam_hdr_t* hdr = sam_hdr_read(fp);
+    CHECK(hdr);
+    hts_idx_t* idx = sam_index_load(fp, m_path.c_str());
+    CHECK(idx);
+    std::vector<std::string> result;
+    hts_itr_t* itr = sam_itr_querys(idx, hdr, region.c_str());
+    if (itr) {
+      bam1_t* b = bam_init1();
+      kstring_t str = {0, 0, nullptr};
+      while (sam_itr_next(fp, itr, b) >= 0) {
+        str.l = 0;
+        CHECK_GE(sam_format1(hdr, b, &str), 0);
+        result.emplace_back(str.s, str.l);
+      }
+      free(str.s);
+      bam_destroy1(b);
+      hts_itr_destroy(itr);
+    }
+    hts_idx_destroy(idx);
+    bam_hdr_destroy(hdr);
+    sam_close(fp);
+    return result;
+  }
+
+  // Returns the bin field of each record as stored in the file.  (htslib
+  // recalculates it when reading records.)
+  std::vector<uint16_t> stored_bins() {
+    BGZF* fp = bgzf_open(m_path.c_str(), "r");
+    CHECK(fp);
+    std::string data;
+    char buf[65536];
+    ssize_t len;
+    while ((len = bgzf_read(fp, buf, sizeof(buf))) > 0) {
+      data.append(buf, len);
+    }
+    CHECK_EQ(0, bgzf_close(fp));
+
+    auto le32 = [&](size_t offset) {
+      uint32_t val;
+      memcpy(&val, data.data() + offset, sizeof(val));
+      return val;
+    };
+    size_t offset = 4;
+    offset += 4 + le32(offset);  // Header text
+    uint32_t n_ref = le32(offset);
+    offset += 4;
+    for (uint32_t i = 0; i < n_ref; ++i) {
+      offset += 4 + le32(offset) + 4;  // Name and length
+    }
+    std::vector<uint16_t> result;
+    while (offset < data.size()) {
+      uint16_t bin;
+      memcpy(&bin, data.data() + offset + 14, sizeof(bin));
+      result.push_back(bin);
+      offset += 4 + le32(offset);
+    }
+    return result;
+  }
+
+  std::string m_path;
+};
+
+TEST_F(bgzf_bam_writer_test, indexed) {
+  bgzf_bam_writer out(m_path, k_contigs, sam_header(k_contigs));
+  for (int pos = 0; pos < 200000; pos += 7) {
+    out.write_record(record(0, pos));
+  }
+  out.write_record(record(2, 5, "ins", "2M3I2M", "ACGTACG", 16));
+  out.write_record(record(2, 100, "del", "2M4900D2M", "ACGT"));
+  out.write_record(record(2, 6000, "pad", "2M1P1I1N1M", "ACGT"));
+  out.close();
+  EXPECT_EQ(m_path + ".bai", out.index_path());
+  EXPECT_EQ(200000 / 7 + 1 + 3, out.records());
+
+  EXPECT_THAT(query("1:20-30"), ElementsAre("read\t0\t1\t22\t255\t4M\t*\t0\t0\tACGT\t*",
+                                            "read\t0\t1\t29\t255\t4M\t*\t0\t0\tACGT\t*"));
+  EXPECT_THAT(query("2"), IsEmpty());
+  EXPECT_THAT(query("X:7-8"), ElementsAre("ins\t16\tX\t6\t255\t2M3I2M\t*\t0\t0\tACGTACG\t*"));
+  EXPECT_THAT(query("X:4000-4001"),
+              ElementsAre("del\t0\tX\t101\t255\t2M4900D2M\t*\t0\t0\tACGT\t*"));
+  EXPECT_THAT(query("X:6003-6003"),
+              ElementsAre("pad\t0\tX\t6001\t255\t2M1P1I1N1M\t*\t0\t0\tACGT\t*"));
+  EXPECT_EQ(4681, stored_bins().front());
+}
+
+TEST_F(bgzf_bam_writer_test, long_contig_uses_csi) {
+  std::vector<std::pair<std::string, int64_t>> contigs = {{"big", 1000000000}};
+  bgzf_bam_writer out(m_path, contigs, sam_header(contigs));
+  out.write_record(record(0, 899999999));
+  out.close();
+  EXPECT_EQ(m_path + ".csi", out.index_path());
+
+  EXPECT_THAT(query("big:899999990-900000010"),
+              ElementsAre("read\t0\tbig\t900000000\t255\t4M\t*\t0\t0\tACGT\t*"));
+  // This contig needs 6 levels, and bins in the lowest level don't
+  // fit in 16 bits, so the read gets its level 5 bin.
+  EXPECT_THAT(stored_bins(), ElementsAre(4681 + (899999999 >> 17)));
+}
+
+TEST_F(bgzf_bam_writer_test, bad_records) {
+  std::string rec;
+  EXPECT_THROW(append_bam_record(&rec, 0, 0, "r", 0, 255, "5M", dna_sequence("ACGT")),
+               io_exception);
+  EXPECT_THROW(append_bam_record(&rec, 0, 0, "r", 0, 255, "4Q", dna_sequence("ACGT")),
+               io_exception);
+  EXPECT_THROW(append_bam_record(&rec, 0, 0, "r", 0, 255, "M", dna_sequence("ACGT")),
+               io_exception);
+  EXPECT_THROW(append_bam_record(&rec, 0, -1, "r", 0, 255, "4M", dna_sequence("ACGT")),
+               io_exception);
+
+  bgzf_bam_writer out(m_path, k_contigs, sam_header(k_contigs));
+  out.write_record(record(1, 100));
+  EXPECT_THROW(out.write_record(record(1, 99)), io_exception);
+  EXPECT_THROW(out.write_record(record(0, 200)), io_exception);
+  EXPECT_THROW(out.write_record(record(3, 200)), io_exception);
+  std::string negative_pos = record(1, 200);
+  negative_pos.replace(8, 4, 4, char(0xFF));
+  EXPECT_THROW(out.write_record(negative_pos), io_exception);
+}
+
+}  // namespace variants
@@ -0,0 +1,483 @@
+#include "modules/variants/bgzf_vcf_writer.h"
+#include "base/base.h"
+#include "modules/io/log.h"
+#include "modules/io/make_unique.h"
+#include "modules/io/utils.h"
+
+#include <htslib/hts.h>
+#include <htslib/tbx.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unistd.h>
+
+namespace variants {
+
+namespace {
+
+constexpr int k_min_shift = 14;
+constexpr int k_tabix_levels = 5;
+
+void append_le32(std::string* out, uint32_t val) {
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(char((val >> (8 * i)) & 0xFF));
+  }
+}
+
+// Returns the position of the field after the one starting at "pos",
+// or std::string::npos if there isn't one.
+size_t next_field(const char* line, size_t len, size_t pos) {
+  const char* tab = static_cast<const char*>(memchr(line + pos, '\t', len - pos));
+  if (!tab) {
+    return std::string::npos;
+  }
+  return tab - line + 1;
+}
+
+}  // namespace
+
+constexpr int64_t bgzf_vcf_writer::k_max_tabix_len;
+
+bgzf_vcf_writer::bgzf_vcf_writer(const std::string& path, const std::string& header)
+    : m_path(path), m_file(path), m_bgzf(&m_file) {
+  parse_header(header);
+  m_bgzf.write(header.data(), header.size());
+  // Keep the header in its own blocks so that the offset of the first
+  // record is known right away.
+  m_bgzf.flush();
+
+  if (m_index_fmt == HTS_FMT_TBI) {
+    m_idx = hts_idx_init(0, HTS_FMT_TBI, m_bgzf.virtual_offset(m_bgzf.tell()), k_min_shift,
+                         k_tabix_levels);
+  } else {
+    m_idx = hts_idx_init(0, HTS_FMT_CSI, m_bgzf.virtual_offset(m_bgzf.tell()), k_min_shift,
+                         (TBX_MAX_SHIFT - k_min_shift + 2) / 3);
+  }
+  if (!m_idx) {
+    throw io_exception("Unable to initialize index for " + m_path);
+  }
+}
+
+bgzf_vcf_writer::~bgzf_vcf_writer() {
+  if (m_idx) {
+    hts_idx_destroy(m_idx);
+  }
+}
+
+void bgzf_vcf_writer::parse_header(const std::string& header) {
+  static const char k_prefix[] = "##contig=<";
+  int64_t max_len = 0;
+  size_t pos = 0;
+  while (pos < header.size()) {
+    size_t end = header.find('\n', pos);
+    if (end == std::string::npos) {
+      end = header.size();
+    }
+    if (header.compare(pos, strlen(k_prefix), k_prefix) == 0) {
+      std::string line = header.substr(pos, end - pos);
+      size_t id_pos = line.find("ID=");
+      if (id_pos == std::string::npos) {
+        throw io_exception("Missing contig ID in VCF header line: " + line);
+      }
+      id_pos += 3;
+      std::string id = line.substr(id_pos, line.find_first_of(",>", id_pos) - id_pos);
+      size_t len_pos = line.find("length=");
+      if (len_pos != std::string::npos) {
+        max_len = std::max<int64_t>(max_len, std::stoll(line.substr(len_pos + 7)));
+      }
+      if (!m_contig_index.emplace(id, m_contigs.size()).second) {
+        throw io_exception("Duplicate contig in VCF header: " + id);
+      }
+      m_contigs.push_back(id);
+    }
+    pos = end + 1;
+  }
+  m_index_fmt = max_len < k_max_tabix_len ? HTS_FMT_TBI : HTS_FMT_CSI;
+}
+
+void bgzf_vcf_writer::write_record(const char* line, size_t len) {
+  CHECK(!m_closed);
+  CHECK(len && line[len - 1] == '\n') << "VCF record must end in a newline";
+
+  // Starting offsets of CHROM, POS, ID, REF, ALT, QUAL, FILTER, and INFO.
+  size_t fields[8] = {0};
+  size_t nfields = 1;
+  while (nfields < 8) {
+    fields[nfields] = next_field(line, len, fields[nfields - 1]);
+    if (fields[nfields] == std::string::npos) {
+      break;
+    }
+    ++nfields;
+  }
+  if (nfields < 5) {
+    throw io_exception("Malformed VCF record: " + std::string(line, len - 1));
+  }
+  std::string chrom(line, fields[1] - 1);
+  int64_t beg = strtoll(line + fields[1], nullptr, 10) - 1;
+  int64_t end = beg + (fields[4] - 1 - fields[3]);
+
+  // Structural variants specify their extent with END= in the INFO field.
+  if (nfields == 8) {
+    size_t info_field = fields[7];
+    size_t info_end = next_field(line, len, info_field);
+    if (info_end == std::string::npos) {
+      info_end = len;
+    }
+    for (size_t i = info_field; i + 4 < info_end; ++i) {
+      if ((i == info_field || line[i - 1] == ';') && memcmp(line + i, "END=", 4) == 0) {
+        end = strtoll(line + i + 4, nullptr, 10);
+        break;
+      }
+    }
+  }
+
+  auto it = m_contig_index.find(chrom);
+  if (it == m_contig_index.end()) {
+    throw io_exception("VCF record has contig not present in header: " + chrom);
+  }
+  if (m_tid_names.empty() || it->second != m_cur_contig) {
+    if (!m_tid_names.empty() && it->second < m_cur_contig) {
+      throw io_exception("VCF records must be sorted by contig; " + chrom + " found after " +
+                         m_tid_names.back());
+    }
+    m_tid_names.push_back(chrom);
+    m_cur_contig = it->second;
+  } else if (beg < m_cur_pos) {
+    throw io_exception(printstring("VCF records must be sorted by position; %s:%ld found after %ld",
+                                   chrom.c_str(), beg + 1, m_cur_pos + 1));
+  }
+  m_cur_pos = beg;
+
+  m_bgzf.write(line, len);
+  ++m_records;
+
+  pending_record rec;
+  rec.tid = m_tid_names.size() - 1;
+  rec.beg = beg;
+  rec.end = std::max(end, beg + 1);
+  rec.uoffset_end = m_bgzf.tell();
+  m_pending.push_back(rec);
+  index_committed();
+}
+
+void bgzf_vcf_writer::index_committed() {
+  while (!m_pending.empty() && m_pending.front().uoffset_end <= m_bgzf.committed()) {
+    const pending_record& rec = m_pending.front();
+    if (hts_idx_push(m_idx, rec.tid, rec.beg, rec.end, m_bgzf.virtual_offset(rec.uoffset_end),
+                     1 /* is mapped */) < 0) {
+      throw io_exception("Unable to add record to index for " + m_path);
+    }
+    m_pending.pop_front();
+  }
+}
+
+void bgzf_vcf_writer::close() {
+  if (m_closed) {
+    return;
+  }
+  m_bgzf.flush();
+  index_committed();
+  CHECK(m_pending.empty());
+  hts_idx_finish(m_idx, m_bgzf.virtual_offset(m_bgzf.tell()));
+  m_bgzf.close();
+  m_file.close();
+
+  // Index metadata, in the same format as tbx_set_meta.
+  std::string meta;
+  const tbx_conf_t& conf = tbx_conf_vcf;
+  for (int32_t val : {conf.preset, conf.sc, conf.bc, conf.ec, conf.meta_char, conf.line_skip}) {
+    append_le32(&meta, val);
+  }
+  size_t names_len = 0;
+  for (const auto& name : m_tid_names) {
+    names_len += name.size() + 1;
+  }
+  append_le32(&meta, names_len);
+  for (const auto& name : m_tid_names) {
+    meta.append(name.c_str(), name.size() + 1);
+  }
+  if (hts_idx_set_meta(m_idx, meta.size(),
+                       reinterpret_cast<uint8_t*>(const_cast<char*>(meta.data())),
+                       1 /* copy */) < 0 ||
+      hts_idx_save(m_idx, m_path.c_str(), m_index_fmt) < 0) {
+    throw io_exception("Unable to save index " + index_path());
+  }
+  // Readers prefer a CSI index if present, so make sure there's no stale
+  // index of the other format left over.
+  unlink((m_path + (m_index_fmt == HTS_FMT_TBI ? ".csi" : ".tbi")).c_str());
+  m_closed = true;
+}
+
+std::string bgzf_vcf_writer::index_path() const {
+  return m_path + (m_index_fmt == HTS_FMT_TBI ? ".tbi" : ".csi");
+}
+
+namespace {
+
+struct record_view {
+  int64_t pos;
+  const char* data;
+  size_t len;
+};
+
+// Order in which scaffold_sorted_vcf_output writes records within a
+// scaffold.
+bool record_less(const record_view& a, const record_view& b) {
+  if (a.pos != b.pos) {
+    return a.pos < b.pos;
+  }
+  int cmp = memcmp(a.data, b.data, std::min(a.len, b.len));
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  return a.len < b.len;
+}
+
+int64_t parse_vcf_pos(const std::string& line) {
+  size_t pos_field = line.find('\t');
+  if (pos_field == std::string::npos) {
+    throw io_exception("Malformed VCF record: " + line);
+  }
+  return strtoll(line.c_str() + pos_field + 1, nullptr, 10);
+}
+
+// Reads back a sorted run written by scaffold_sorted_vcf_output::maybe_spill.
+class spilled_run {
+ public:
+  explicit spilled_run(const std::string& path) : m_reader(path) { advance(); }
+
+  bool done() const { return m_done; }
+  record_view current() const { return record_view{m_pos, m_line.data(), m_line.size()}; }
+
+  void advance() {
+    m_done = !m_reader.readline(m_line, std::numeric_limits<size_t>::max());
+    if (!m_done) {
+      m_line.push_back('\n');
+      m_pos = parse_vcf_pos(m_line);
+    }
+  }
+
+ private:
+  file_reader m_reader;
+  std::string m_line;
+  int64_t m_pos = 0;
+  bool m_done = false;
+};
+
+}  // namespace
+
+constexpr size_t scaffold_sorted_vcf_output::k_default_max_buffered_bytes;
+constexpr size_t scaffold_sorted_vcf_output::k_min_spill_bytes;
+
+scaffold_sorted_vcf_output::scaffold_sorted_vcf_output(bgzf_vcf_writer* out,
+                                                       size_t max_buffered_bytes)
+    : m_out(out),
+      m_max_buffered_bytes(max_buffered_bytes),
+      m_mem_consumer(pipeline_mem_governor::global().get_consumer("scaffold_sorted_vcf_output")),
+      m_scaffolds(out->contigs().size()) {}
+
+scaffold_sorted_vcf_output::~scaffold_sorted_vcf_output() {
+  std::lock_guard<std::mutex> l(m_mu);
+  if (m_next_scaffold != m_scaffolds.size()) {
+    SPLOG("scaffold_sorted_vcf_output destroyed without writing all scaffolds");
+  }
+  for (const auto& sc : m_scaffolds) {
+    m_mem_consumer->remove(sc.buffered_bytes);
+    for (const std::string& path : sc.spill_paths) {
+      unlink(path.c_str());
+    }
+  }
+}
+
+std::shared_ptr<scaffold_sorted_vcf_output::source> scaffold_sorted_vcf_output::open(
+    const std::string& scaffold_name) {
+  const auto& contigs = m_out->contigs();
+  auto it = std::find(contigs.begin(), contigs.end(), scaffold_name);
+  if (it == contigs.end()) {
+    throw io_exception("Scaffold not present in VCF header: " + scaffold_name);
+  }
+  size_t scaffold_index = it - contigs.begin();
+
+  std::lock_guard<std::mutex> l(m_mu);
+  CHECK_GE(scaffold_index, m_next_scaffold)
+      << "Source opened for " << scaffold_name << " after it was written";
+  ++m_scaffolds[scaffold_index].outstanding;
+  return std::shared_ptr<source>(new source(this, scaffold_index));
+}
+
+scaffold_sorted_vcf_output::source::~source() { m_output->release(m_scaffold_index); }
+
+void scaffold_sorted_vcf_output::source::add_record(const std::string& line) {
+  m_output->add_record(m_scaffold_index, line);
+}
+
+void scaffold_sorted_vcf_output::add_record(size_t scaffold_index, const std::string& line) {
+  record_ref rec;
+  rec.pos = parse_vcf_pos(line);
+  rec.len = line.size();
+
+  std::unique_lock<std::mutex> l(m_mu);
+  scaffold_records& sc = m_scaffolds[scaffold_index];
+  CHECK_GT(sc.outstanding, 0);
+  rec.offset = sc.arena.size();
+  sc.arena.append(line);
+  sc.records.push_back(rec);
+  sc.buffered_bytes += line.size() + sizeof(record_ref);
+  m_buffered_bytes += line.size() + sizeof(record_ref);
+  m_mem_consumer->add(line.size() + sizeof(record_ref));
+  ++m_records;
+  maybe_spill(l);
+}
+
+void scaffold_sorted_vcf_output::maybe_spill(std::unique_lock<std::mutex>& l) {
+  if (m_buffered_bytes <= m_max_buffered_bytes) {
+    return;
+  }
+  size_t largest = m_next_scaffold;
+  for (size_t i = m_next_scaffold; i < m_scaffolds.size(); ++i) {
+    if (m_scaffolds[i].buffered_bytes > m_scaffolds[largest].buffered_bytes) {
+      largest = i;
+    }
+  }
+  if (largest == m_scaffolds.size() || m_scaffolds[largest].buffered_bytes < k_min_spill_bytes) {
+    return;
+  }
+
+  scaffold_records& sc = m_scaffolds[largest];
+  std::string arena;
+  std::vector<record_ref> records;
+  std::swap(arena, sc.arena);
+  std::swap(records, sc.records);
+  size_t spilled_bytes = sc.buffered_bytes;
+  sc.buffered_bytes = 0;
+  m_buffered_bytes -= spilled_bytes;
+  std::string path =
+      printstring("%s.spill.%lu.%lu", m_out->path().c_str(), largest, sc.spill_paths.size());
+  sc.spill_paths.push_back(path);
+  ++m_spills;
+  // Keep the scaffold from being written until the run is complete.
+  ++sc.outstanding;
+
+  l.unlock();
+  std::exception_ptr error;
+  try {
+    std::sort(records.begin(), records.end(), [&arena](const record_ref& a, const record_ref& b) {
+      return record_less(record_view{a.pos, arena.data() + a.offset, a.len},
+                         record_view{b.pos, arena.data() + b.offset, b.len});
+    });
+    file_writer out(path);
+    for (const auto& rec : records) {
+      out.write(arena.data() + rec.offset, rec.len);
+    }
+    out.close();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  m_mem_consumer->remove(spilled_bytes);
+  l.lock();
+
+  --sc.outstanding;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  write_ready(l);
+}
+
+void scaffold_sorted_vcf_output::release(size_t scaffold_index) {
+  std::unique_lock<std::mutex> l(m_mu);
+  CHECK_GT(m_scaffolds[scaffold_index].outstanding, 0);
+  --m_scaffolds[scaffold_index].outstanding;
+  write_ready(l);
+}
+
+void scaffold_sorted_vcf_output::write_ready(std::unique_lock<std::mutex>& l) {
+  if (m_writing) {
+    // The thread that's currently writing will pick up anything that
+    // becomes ready.
+    return;
+  }
+  m_writing = true;
+  while (m_next_scaffold < m_scaffolds.size() &&
+         m_scaffolds[m_next_scaffold].outstanding == 0) {
+    scaffold_records sc;
+    std::swap(sc, m_scaffolds[m_next_scaffold]);
+    ++m_next_scaffold;
+    m_buffered_bytes -= sc.buffered_bytes;
+
+    l.unlock();
+    try {
+      write_scaffold(&sc);
+    } catch (...) {
+      m_mem_consumer->remove(sc.buffered_bytes);
+      for (const std::string& path : sc.spill_paths) {
+        unlink(path.c_str());
+      }
+      l.lock();
+      m_writing = false;
+      throw;
+    }
+    m_mem_consumer->remove(sc.buffered_bytes);
+    l.lock();
+  }
+  m_writing = false;
+}
+
+void scaffold_sorted_vcf_output::write_scaffold(scaffold_records* sc) {
+  const std::string& arena = sc->arena;
+  auto view = [&arena](const record_ref& rec) {
+    return record_view{rec.pos, arena.data() + rec.offset, rec.len};
+  };
+  std::sort(sc->records.begin(), sc->records.end(),
+            [&view](const record_ref& a, const record_ref& b) {
+              return record_less(view(a), view(b));
+            });
+
+  std::vector<std::unique_ptr<spilled_run>> runs;
+  for (const std::string& path : sc->spill_paths) {
+    runs.emplace_back(make_unique<spilled_run>(path));
+  }
+  auto mem_it = sc->records.begin();
+  for (;;) {
+    spilled_run* next_run = nullptr;
+    for (const auto& run : runs) {
+      if (!run->done() && (!next_run || record_less(run->current(), next_run->current()))) {
+        next_run = run.get();
+      }
+    }
+    if (mem_it != sc->records.end() &&
+        (!next_run || !record_less(next_run->current(), view(*mem_it)))) {
+      m_out->write_record(arena.data() + mem_it->offset, mem_it->len);
+      ++mem_it;
+    } else if (next_run) {
+      record_view rec = next_run->current();
+      m_out->write_record(rec.data, rec.len);
+      next_run->advance();
+    } else {
+      break;
+    }
+  }
+  runs.clear();
+  for (const std::string& path : sc->spill_paths) {
+    unlink(path.c_str());
+  }
+  sc->spill_paths.clear();
+}
+
+void scaffold_sorted_vcf_output::close() {
+  std::unique_lock<std::mutex> l(m_mu);
+  write_ready(l);
+  CHECK_EQ(m_next_scaffold, m_scaffolds.size()) << "Sources still outstanding at close";
+}
+
+size_t scaffold_sorted_vcf_output::records() const {
+  std::lock_guard<std::mutex> l(m_mu);
+  return m_records;
+}
+
+size_t scaffold_sorted_vcf_output::spills() const {
+  std::lock_guard<std::mutex> l(m_mu);
+  return m_spills;
+}
+
+}  // namespace variants
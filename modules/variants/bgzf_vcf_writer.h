@@ -0,0 +1,178 @@
+#pragma once
+
+#include "modules/io/bgzf_writer.h"
+#include "modules/io/file_io.h"
+#include "modules/variants/pipeline_mem.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct __hts_idx_t;
+
+namespace variants {
+
+// Writes a coordinate-sorted VCF compressed with BGZF, building a
+// tabix index as records are written.  If any contig in the header is
+// too long to be represented in a tabix index, a CSI index is written
+// instead.
+class bgzf_vcf_writer {
+ public:
+  // Maximum contig length representable in a tabix index.
+  static constexpr int64_t k_max_tabix_len = 1LL << 29;
+
+  // "header" must include the ##contig lines; records must be sorted
+  // in the order contigs are listed there.
+  bgzf_vcf_writer(const std::string& path, const std::string& header);
+  ~bgzf_vcf_writer();
+
+  // Writes a single VCF record, including its trailing newline.
+  // Throws io_exception if records are not in coordinate order.
+  void write_record(const char* line, size_t len);
+  void write_record(const std::string& line) { write_record(line.data(), line.size()); }
+
+  // Finishes writing the VCF and saves the index.
+  void close();
+
+  // Contigs in header order.
+  const std::vector<std::string>& contigs() const { return m_contigs; }
+
+  // Path of the VCF being written.
+  const std::string& path() const { return m_path; }
+
+  // Path of the index written, once closed.
+  std::string index_path() const;
+
+  size_t records() const { return m_records; }
+
+ private:
+  struct pending_record {
+    int tid;
+    int64_t beg;
+    int64_t end;
+    uint64_t uoffset_end;
+  };
+
+  void parse_header(const std::string& header);
+  void index_committed();
+
+  std::string m_path;
+  file_writer m_file;
+  bgzf_writer m_bgzf;
+
+  std::vector<std::string> m_contigs;
+  std::unordered_map<std::string, size_t> m_contig_index;
+  int m_index_fmt;
+  __hts_idx_t* m_idx = nullptr;
+
+  // Names of contigs with records, in the order they were seen; these
+  // become the tabix sequence ids.
+  std::vector<std::string> m_tid_names;
+  size_t m_cur_contig = 0;
+  int64_t m_cur_pos = 0;
+
+  // Records which are not yet compressed, and so do not have a
+  // virtual offset yet.
+  std::deque<pending_record> m_pending;
+
+  size_t m_records = 0;
+  bool m_closed = false;
+};
+
+// Collects VCF records for a sorted VCF from concurrent sources, each
+// of which outputs records for a single scaffold in arbitrary order.
+// Records for a scaffold are buffered until all sources for that
+// scaffold and all previous scaffolds are released, and are then
+// sorted and written.
+//
+// A slow early scaffold can hold up writing everything after it, so
+// when more than "max_buffered_bytes" of records are buffered, the
+// largest buffer is sorted and spilled to a temporary file next to
+// the output.  Spilled runs are merged back in when their scaffold is
+// written.  Buffers smaller than k_min_spill_bytes are never spilled,
+// so memory use is at most about max_buffered_bytes plus
+// k_min_spill_bytes per scaffold.
+//
+// All sources must be opened before any are released.
+class scaffold_sorted_vcf_output {
+ public:
+  static constexpr size_t k_default_max_buffered_bytes = 256 * 1024 * 1024;
+  static constexpr size_t k_min_spill_bytes = 1024 * 1024;
+
+  class source {
+   public:
+    ~source();
+
+    // Adds a record, including its trailing newline.
+    void add_record(const std::string& line);
+
+   private:
+    friend class scaffold_sorted_vcf_output;
+    source(scaffold_sorted_vcf_output* output, size_t scaffold_index)
+        : m_output(output), m_scaffold_index(scaffold_index) {}
+
+    scaffold_sorted_vcf_output* const m_output;
+    const size_t m_scaffold_index;
+  };
+
+  scaffold_sorted_vcf_output(bgzf_vcf_writer* out,
+                             size_t max_buffered_bytes = k_default_max_buffered_bytes);
+  ~scaffold_sorted_vcf_output();
+
+  std::shared_ptr<source> open(const std::string& scaffold_name);
+
+  // Writes all remaining records.  All sources must have been released.
+  void close();
+
+  // Number of records added.
+  size_t records() const;
+
+  // Number of times a buffer has been spilled to disk.
+  size_t spills() const;
+
+ private:
+  struct record_ref {
+    int64_t pos;
+    size_t offset;
+    size_t len;
+  };
+  struct scaffold_records {
+    size_t outstanding = 0;
+    // Record contents, stored contiguously to avoid allocating for
+    // each record.
+    std::string arena;
+    std::vector<record_ref> records;
+    // Bytes reported to pipeline_mem_governor for this scaffold.
+    size_t buffered_bytes = 0;
+    // Sorted runs of records spilled to disk.
+    std::vector<std::string> spill_paths;
+  };
+
+  void add_record(size_t scaffold_index, const std::string& line);
+  void release(size_t scaffold_index);
+  void write_ready(std::unique_lock<std::mutex>& l);
+  // Spills the largest buffer if over budget.
+  void maybe_spill(std::unique_lock<std::mutex>& l);
+  // Sorts and writes a scaffold's records, merging in any spilled runs.
+  void write_scaffold(scaffold_records* sc);
+
+  bgzf_vcf_writer* const m_out;
+  const size_t m_max_buffered_bytes;
+  pipeline_mem_governor::consumer* const m_mem_consumer;
+  mutable std::mutex m_mu;
+  std::vector<scaffold_records> m_scaffolds;
+  // Index of next scaffold to be written.
+  size_t m_next_scaffold = 0;
+  // True if a thread is currently writing scaffolds.
+  bool m_writing = false;
+  size_t m_records = 0;
+  // Total of buffered_bytes across all scaffolds.
+  size_t m_buffered_bytes = 0;
+  size_t m_spills = 0;
+};
+
+}  // namespace variants
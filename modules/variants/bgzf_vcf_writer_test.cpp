@@ -0,0 +1,200 @@
+#include "modules/variants/bgzf_vcf_writer.h"
+
+#include <boost/filesystem.hpp>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <htslib/hts.h>
+#include <htslib/tbx.h>
+
+#include "modules/io/parallel.h"
+#include "modules/test/test_utils.h"
+
+using namespace testing;
+
+namespace variants {
+
+namespace {
+
+const char k_header[] =
+    "##fileformat=VCFv4.1\n"
+    "##contig=<ID=1,length=1000000>\n"
+    "##contig=<ID=2,length=1000000>\n"
+    "##contig=<ID=X,length=1000000>\n"
+    "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n";
+
+std::string record(const std::string& chrom, int pos, const std::string& ref = "A",
+                   const std::string& info = "NS=1") {
+  return printstring("%s\t%d\t.\t%s\tG\t100\tPASS\t%s\tGT\t0/1\n", chrom.c_str(), pos,
+                     ref.c_str(), info.c_str());
+}
+
+}  // namespace
+
+class bgzf_vcf_writer_test : public Test {
+ protected:
+  void SetUp() override { m_path = make_path("bgzf_vcf_writer_test.vcf.gz"); }
+
+  // Returns the records overlapping the given region, as found using
+  // the index.
+  std::vector<std::string> query(const std::string& region) {
+    htsFile* fp = hts_open(m_path.c_str(), "r");
+    CHECK(fp);
+    tbx_t* tbx = tbx_index_load(m_path.c_str());
+    CHECK(tbx);
+    std::vector<std::string> result;
+    hts_itr_t* itr = tbx_itr_querys(tbx, region.c_str());
+    if (itr) {
+      kstring_t str = {0, 0, nullptr};
+      while (tbx_itr_next(fp, tbx, itr, &str) >= 0) {
+        result.emplace_back(str.s, str.l);
+        result.back() += "\n";
+      }
+      free(str.s);
+      tbx_itr_destroy(itr);
+    }
+    tbx_destroy(tbx);
+    hts_close(fp);
+    return result;
+  }
+
+  std::string m_path;
+};
+
+TEST_F(bgzf_vcf_writer_test, indexed) {
+  bgzf_vcf_writer out(m_path, k_header);
+  EXPECT_THAT(out.contigs(), ElementsAre("1", "2", "X"));
+  for (int pos = 1; pos < 200000; pos += 7) {
+    out.write_record(record("1", pos));
+  }
+  out.write_record(record("X", 5, "ACGT"));
+  out.write_record(record("X", 100, "A", "NS=1;END=5000;SVLEN=-4900"));
+  out.write_record(record("X", 6000));
+  out.close();
+  EXPECT_EQ(m_path + ".tbi", out.index_path());
+
+  EXPECT_THAT(query("1:20-30"), ElementsAre(record("1", 22), record("1", 29)));
+  EXPECT_THAT(query("1:199998-300000"), ElementsAre(record("1", 199998)));
+  EXPECT_THAT(query("2"), IsEmpty());
+  EXPECT_THAT(query("X:7-8"), ElementsAre(record("X", 5, "ACGT")));
+  EXPECT_THAT(query("X:4000-4001"),
+              ElementsAre(record("X", 100, "A", "NS=1;END=5000;SVLEN=-4900")));
+  EXPECT_THAT(query("X:5500-7000"), ElementsAre(record("X", 6000)));
+}
+
+TEST_F(bgzf_vcf_writer_test, long_contig_uses_csi) {
+  std::string header =
+      "##fileformat=VCFv4.1\n"
+      "##contig=<ID=big,length=1000000000>\n"
+      "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n";
+  bgzf_vcf_writer out(m_path, header);
+  out.write_record(record("big", 900000000));
+  out.close();
+  EXPECT_EQ(m_path + ".csi", out.index_path());
+
+  htsFile* fp = hts_open(m_path.c_str(), "r");
+  tbx_t* tbx = tbx_index_load2(m_path.c_str(), out.index_path().c_str());
+  ASSERT_TRUE(tbx);
+  hts_itr_t* itr = tbx_itr_querys(tbx, "big:899999990-900000010");
+  ASSERT_TRUE(itr);
+  kstring_t str = {0, 0, nullptr};
+  ASSERT_GE(tbx_itr_next(fp, tbx, itr, &str), 0);
+  EXPECT_EQ(record("big", 900000000), std::string(str.s, str.l) + "\n");
+  free(str.s);
+  tbx_itr_destroy(itr);
+  tbx_destroy(tbx);
+  hts_close(fp);
+}
+
+TEST_F(bgzf_vcf_writer_test, unsorted) {
+  bgzf_vcf_writer out(m_path, k_header);
+  out.write_record(record("2", 100));
+  EXPECT_THROW(out.write_record(record("2", 99)), io_exception);
+  EXPECT_THROW(out.write_record(record("1", 200)), io_exception);
+  EXPECT_THROW(out.write_record(record("Y", 200)), io_exception);
+}
+
+TEST_F(bgzf_vcf_writer_test, scaffold_sorted) {
+  bgzf_vcf_writer out(m_path, k_header);
+  scaffold_sorted_vcf_output sorted(&out);
+
+  auto x = sorted.open("X");
+  auto one_a = sorted.open("1");
+  auto one_b = sorted.open("1");
+
+  x->add_record(record("X", 50));
+  x->add_record(record("X", 10));
+  x.reset();
+  EXPECT_EQ(0, out.records());
+
+  one_b->add_record(record("1", 500));
+  one_a->add_record(record("1", 7, "AC"));
+  one_a->add_record(record("1", 7));
+  one_a.reset();
+  EXPECT_EQ(0, out.records());
+  one_b.reset();
+  EXPECT_EQ(5, out.records());
+
+  sorted.close();
+  out.close();
+  EXPECT_EQ(5, sorted.records());
+
+  EXPECT_THAT(query("1"), ElementsAre(record("1", 7), record("1", 7, "AC"), record("1", 500)));
+  EXPECT_THAT(query("X"), ElementsAre(record("X", 10), record("X", 50)));
+}
+
+TEST_F(bgzf_vcf_writer_test, scaffold_sorted_parallel) {
+  bgzf_vcf_writer out(m_path, k_header);
+  scaffold_sorted_vcf_output sorted(&out);
+
+  constexpr size_t k_chunks = 50;
+  constexpr int k_chunk_size = 1000;
+  std::vector<std::shared_ptr<scaffold_sorted_vcf_output::source>> sources;
+  for (size_t i = 0; i < k_chunks; ++i) {
+    sources.push_back(sorted.open(i % 2 ? "2" : "1"));
+  }
+  parallel_for(0, k_chunks, [&](size_t i) {
+    for (int pos = k_chunk_size; pos > 0; --pos) {
+      sources[i]->add_record(record(i % 2 ? "2" : "1", i * k_chunk_size + pos));
+    }
+    sources[i].reset();
+  });
+  sorted.close();
+  out.close();
+
+  std::vector<std::string> recs = query("1");
+  ASSERT_EQ(k_chunks / 2 * k_chunk_size, recs.size());
+  EXPECT_EQ(record("1", 1), recs.front());
+  EXPECT_EQ(k_chunks / 2 * k_chunk_size, query("2").size());
+}
+
+TEST_F(bgzf_vcf_writer_test, scaffold_sorted_spills) {
+  bgzf_vcf_writer out(m_path, k_header);
+  // Spill whenever a buffer is big enough.
+  scaffold_sorted_vcf_output sorted(&out, 1 /* max buffered bytes */);
+
+  // Hold up scaffold 1 while scaffold 2 buffers several spills' worth.
+  auto one = sorted.open("1");
+  auto two = sorted.open("2");
+  constexpr int k_two_records = 100000;
+  for (int pos = k_two_records; pos > 0; --pos) {
+    two->add_record(record("2", (pos * 7919) % k_two_records + 1));
+  }
+  two.reset();
+  EXPECT_GE(sorted.spills(), 2u);
+  one->add_record(record("1", 20));
+  one->add_record(record("1", 10));
+  EXPECT_EQ(0, out.records());
+  one.reset();
+  sorted.close();
+  out.close();
+
+  EXPECT_THAT(query("1"), ElementsAre(record("1", 10), record("1", 20)));
+  std::vector<std::string> recs = query("2");
+  ASSERT_EQ(size_t(k_two_records), recs.size());
+  for (int pos = 1; pos <= k_two_records; ++pos) {
+    EXPECT_EQ(record("2", pos), recs[pos - 1]);
+  }
+  EXPECT_FALSE(boost::filesystem::exists(m_path + ".spill.1.0"));
+}
+
+}  // namespace variants
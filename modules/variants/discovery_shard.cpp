@@ -0,0 +1,286 @@
+#include "modules/variants/discovery_shard.h"
+
+#include "modules/io/file_io.h"
+#include "modules/io/json_transfer.h"
+#include "modules/io/log.h"
+#include "modules/variants/bgzf_vcf_writer.h"
+
+#include <htslib/bgzf.h>
+#include <htslib/kstring.h>
+
+#include <boost/filesystem.hpp>
+
+namespace variants {
+
+namespace {
+
+struct vcf_record {
+  size_t contig_index;
+  size_t pos;
+  std::string line;
+
+  bool operator<(const vcf_record& rhs) const {
+    if (contig_index != rhs.contig_index) {
+      return contig_index < rhs.contig_index;
+    }
+    if (pos != rhs.pos) {
+      return pos < rhs.pos;
+    }
+    return line < rhs.line;
+  }
+};
+
+// Extracts the contig id from a "##contig=<ID=...,...>" header line.
+bool parse_contig_header(const std::string& line, std::string* contig_id) {
+  static const std::string k_prefix = "##contig=<ID=";
+  if (line.compare(0, k_prefix.size(), k_prefix) != 0) {
+    return false;
+  }
+  size_t end = line.find_first_of(",>", k_prefix.size());
+  if (end == std::string::npos) {
+    throw io_exception("Malformed contig header line: " + line);
+  }
+  *contig_id = line.substr(k_prefix.size(), end - k_prefix.size());
+  return true;
+}
+
+// Lines in the header that may legitimately differ between shards.
+bool header_line_varies(const std::string& line) {
+  return line.compare(0, 11, "##fileDate=") == 0 || line.compare(0, 9, "##source=") == 0;
+}
+
+// Reads lines from a VCF which may be either plain text or BGZF compressed.
+class vcf_line_reader {
+ public:
+  vcf_line_reader(const std::string& path) : m_path(path) {
+    m_fp = bgzf_open(path.c_str(), "r");
+    if (!m_fp) {
+      throw io_exception("Unable to open " + path);
+    }
+  }
+  ~vcf_line_reader() {
+    free(m_str.s);
+    bgzf_close(m_fp);
+  }
+
+  bool getline(std::string& line) {
+    int ret = bgzf_getline(m_fp, '\n', &m_str);
+    if (ret < -1) {
+      throw io_exception("Error reading " + m_path);
+    }
+    if (ret == -1) {
+      return false;
+    }
+    line.assign(m_str.s, m_str.l);
+    return true;
+  }
+
+ private:
+  std::string m_path;
+  BGZF* m_fp = nullptr;
+  kstring_t m_str = {0, 0, nullptr};
+};
+
+discovery_shard_summary merge_discovery_shards_internal(
+    const std::vector<std::string>& vcf_paths,
+    const std::function<void(const std::string& header)>& write_header,
+    const std::function<void(const std::string& record)>& write_record);
+
+}  // namespace
+
+discovery_shard_spec discovery_shard_spec::parse(const std::string& spec) {
+  discovery_shard_spec result;
+  size_t slash = spec.find('/');
+  if (slash == std::string::npos || slash == 0 || slash + 1 == spec.size() ||
+      spec.find_first_not_of("0123456789/") != std::string::npos ||
+      spec.find('/', slash + 1) != std::string::npos) {
+    throw io_exception("Shard must be specified as <index>/<count>, e.g. 0/4: '" + spec + "'");
+  }
+  result.index = std::stoul(spec.substr(0, slash));
+  result.count = std::stoul(spec.substr(slash + 1));
+  if (result.count == 0 || result.index >= result.count) {
+    throw io_exception("Shard index must be less than shard count: '" + spec + "'");
+  }
+  return result;
+}
+
+std::string discovery_shard_spec::to_string() const { return printstring("%lu/%lu", index, count); }
+
+std::string discovery_shard_summary::path_for_vcf(const std::string& vcf_path) {
+  return vcf_path + ".shard.json";
+}
+
+void discovery_shard_summary::save(const std::string& vcf_path) const {
+  std::string path = path_for_vcf(vcf_path);
+  std::string new_path = path + ".new";
+  {
+    file_writer out(new_path);
+    out.print("%s\n", json_serialize(*this, true /* pretty */).c_str());
+    out.close();
+  }
+  boost::filesystem::rename(new_path, path);
+}
+
+discovery_shard_summary discovery_shard_summary::load(const std::string& vcf_path) {
+  std::string path = path_for_vcf(vcf_path);
+  if (!boost::filesystem::exists(path)) {
+    throw io_exception("Missing shard summary " + path + "; shard did not complete");
+  }
+  discovery_shard_summary result;
+  json_deserialize(result, slurp_file(path));
+  return result;
+}
+
+discovery_shard_summary merge_discovery_shards(const std::vector<std::string>& vcf_paths,
+                                               writable* out) {
+  return merge_discovery_shards_internal(
+      vcf_paths, [out](const std::string& header) { out->write(header.data(), header.size()); },
+      [out](const std::string& record) { out->write(record.data(), record.size()); });
+}
+
+discovery_shard_summary merge_discovery_shards_bgzf(const std::vector<std::string>& vcf_paths,
+                                                    const std::string& out_path) {
+  std::unique_ptr<bgzf_vcf_writer> out;
+  discovery_shard_summary merged = merge_discovery_shards_internal(
+      vcf_paths,
+      [&out, &out_path](const std::string& header) {
+        out.reset(new bgzf_vcf_writer(out_path, header));
+      },
+      [&out](const std::string& record) { out->write_record(record); });
+  out->close();
+  return merged;
+}
+
+namespace {
+
+discovery_shard_summary merge_discovery_shards_internal(
+    const std::vector<std::string>& vcf_paths,
+    const std::function<void(const std::string& header)>& write_header,
+    const std::function<void(const std::string& record)>& write_record) {
+  if (vcf_paths.empty()) {
+    throw io_exception("No partial VCFs specified to merge");
+  }
+
+  discovery_shard_summary merged;
+  merged.complete = true;
+  std::vector<std::string> shard_paths;
+  for (const auto& vcf_path : vcf_paths) {
+    discovery_shard_summary summary = discovery_shard_summary::load(vcf_path);
+    if (!summary.complete) {
+      throw io_exception("Shard " + vcf_path + " did not complete");
+    }
+    if (shard_paths.empty()) {
+      merged.shard_count = summary.shard_count;
+      shard_paths.resize(summary.shard_count);
+    } else if (summary.shard_count != merged.shard_count) {
+      throw io_exception(printstring("%s is from a run with %lu shards; expected %lu",
+                                     vcf_path.c_str(), summary.shard_count, merged.shard_count));
+    }
+    if (summary.shard_index >= merged.shard_count) {
+      throw io_exception("Invalid shard index in " + vcf_path);
+    }
+    if (!shard_paths[summary.shard_index].empty()) {
+      throw io_exception("Shard " + std::to_string(summary.shard_index) + " present in both " +
+                         shard_paths[summary.shard_index] + " and " + vcf_path);
+    }
+    shard_paths[summary.shard_index] = vcf_path;
+
+    merged.work.insert(merged.work.end(), summary.work.begin(), summary.work.end());
+    merged.bases += summary.bases;
+    merged.records += summary.records;
+    for (const auto& call : summary.calls) {
+      merged.calls[call.first] += call.second;
+    }
+  }
+
+  std::string missing;
+  for (size_t i = 0; i != shard_paths.size(); ++i) {
+    if (shard_paths[i].empty()) {
+      if (!missing.empty()) {
+        missing += ",";
+      }
+      missing += std::to_string(i);
+    }
+  }
+  if (!missing.empty()) {
+    throw io_exception(printstring("Missing shards %s of %lu", missing.c_str(),
+                                   merged.shard_count));
+  }
+
+  std::vector<std::string> header;
+  std::map<std::string, size_t> contig_index;
+  std::vector<vcf_record> records;
+  records.reserve(merged.records);
+  for (const auto& vcf_path : shard_paths) {
+    vcf_line_reader in(vcf_path);
+    bool first_shard = header.empty();
+    size_t header_line = 0;
+    size_t shard_records = 0;
+    std::string line;
+    while (in.getline(line)) {
+      if (line.empty()) {
+        continue;
+      }
+      if (line[0] == '#') {
+        if (first_shard) {
+          std::string contig_id;
+          if (parse_contig_header(line, &contig_id)) {
+            contig_index.emplace(contig_id, contig_index.size());
+          }
+          header.push_back(line);
+        } else if (header_line >= header.size() ||
+                   (header[header_line] != line && !header_line_varies(line))) {
+          throw io_exception("VCF header of " + vcf_path + " does not match " +
+                             shard_paths.front());
+        }
+        ++header_line;
+        continue;
+      }
+
+      size_t chrom_end = line.find('\t');
+      size_t pos_end = chrom_end == std::string::npos ? chrom_end : line.find('\t', chrom_end + 1);
+      if (pos_end == std::string::npos) {
+        throw io_exception("Malformed VCF record in " + vcf_path + ": " + line);
+      }
+      auto it = contig_index.find(line.substr(0, chrom_end));
+      if (it == contig_index.end()) {
+        throw io_exception("VCF record in " + vcf_path + " has unknown contig: " + line);
+      }
+      vcf_record rec;
+      rec.contig_index = it->second;
+      rec.pos = std::stoul(line.substr(chrom_end + 1, pos_end - chrom_end - 1));
+      rec.line = std::move(line);
+      records.emplace_back(std::move(rec));
+      ++shard_records;
+    }
+    if (!first_shard && header_line != header.size()) {
+      throw io_exception("VCF header of " + vcf_path + " does not match " + shard_paths.front());
+    }
+    size_t expected_records = discovery_shard_summary::load(vcf_path).records;
+    if (shard_records != expected_records) {
+      throw io_exception(printstring("%s contains %lu records, but its summary lists %lu",
+                                     vcf_path.c_str(), shard_records, expected_records));
+    }
+  }
+
+  SPLOG("Merging %lu records from %lu shards", records.size(), shard_paths.size());
+  std::sort(records.begin(), records.end());
+
+  std::string header_str;
+  for (const auto& line : header) {
+    header_str += line;
+    header_str += '\n';
+  }
+  write_header(header_str);
+  for (auto& rec : records) {
+    rec.line += '\n';
+    write_record(rec.line);
+  }
+
+  merged.shard_index = 0;
+  return merged;
+}
+
+}  // namespace
+
+}  // namespace variants
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "modules/io/io.h"
+#include "modules/io/transfer_object.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace variants {
+
+// Identifies which part of a sharded discovery run a process is
+// responsible for.
+struct discovery_shard_spec {
+  size_t index = 0;
+  size_t count = 1;
+
+  // Parses a shard specification of the form "i/N", where 0 <= i < N.
+  static discovery_shard_spec parse(const std::string& spec);
+
+  bool sharded() const { return count > 1; }
+  std::string to_string() const;
+};
+
+// Summary of a partial discovery run, written as a sidecar next to
+// the partial VCF.  A partial VCF without a complete summary is
+// assumed to be from a failed shard which needs to be retried.
+struct discovery_shard_summary {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(shard_index, TF_STRICT);
+    FIELD(shard_count, TF_STRICT);
+    FIELD(work);
+    FIELD(bases);
+    FIELD(records, TF_STRICT);
+    FIELD(calls);
+    FIELD(complete, TF_STRICT);
+  };
+
+  size_t shard_index = 0;
+  size_t shard_count = 1;
+
+  // Regions traced by this shard.
+  std::vector<std::string> work;
+
+  // Number of reference bases traced by this shard.
+  size_t bases = 0;
+
+  // Number of VCF records written by this shard.
+  size_t records = 0;
+
+  // Variant statistics, as reported in the "calls" section of the
+  // discovery stats.
+  std::map<std::string, size_t> calls;
+
+  // True if the shard ran to completion.
+  bool complete = false;
+
+  // Returns the path of the sidecar for the given partial VCF.
+  static std::string path_for_vcf(const std::string& vcf_path);
+
+  void save(const std::string& vcf_path) const;
+  static discovery_shard_summary load(const std::string& vcf_path);
+};
+
+// Merges the partial VCFs (plain or BGZF compressed) from all shards
+// of a discovery run into "out".  Throws an io_exception if any shard is missing or
+// incomplete.  Records are written in canonical order (by contig
+// order in the header, then position, then record contents), so the
+// result does not depend on how the run was sharded or on thread
+// scheduling.  The header is taken from the first shard.
+//
+// Returns the combined summary of all shards.
+discovery_shard_summary merge_discovery_shards(const std::vector<std::string>& vcf_paths,
+                                               writable* out);
+
+// Same as merge_discovery_shards, but writes a BGZF compressed VCF
+// along with its index to "out_path".
+discovery_shard_summary merge_discovery_shards_bgzf(const std::vector<std::string>& vcf_paths,
+                                                    const std::string& out_path);
+
+}  // namespace variants
@@ -0,0 +1,169 @@
+#include "modules/variants/discovery_shard.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <htslib/bgzf.h>
+
+#include <boost/filesystem.hpp>
+
+#include "modules/io/bgzf_writer.h"
+#include "modules/io/file_io.h"
+#include "modules/io/mem_io.h"
+#include "modules/test/test_utils.h"
+#include "modules/variants/trace_ref.h"
+
+using namespace testing;
+
+namespace variants {
+
+namespace {
+
+const char k_header[] =
+    "##fileformat=VCFv4.1\n"
+    "##contig=<ID=1,length=1000>\n"
+    "##contig=<ID=2,length=1000>\n"
+    "##contig=<ID=X,length=1000>\n"
+    "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n";
+
+}  // namespace
+
+class discovery_shard_test : public Test {
+ protected:
+  std::string write_shard(size_t shard_index, size_t shard_count,
+                          const std::vector<std::string>& records, bool compressed = false) {
+    std::string vcf_path = make_path(printstring("shard_%lu_of_%lu.vcf%s", shard_index,
+                                                 shard_count, compressed ? ".gz" : ""));
+    {
+      file_writer file(vcf_path);
+      bgzf_writer bgzf(&file);
+      writable& out = compressed ? static_cast<writable&>(bgzf) : file;
+      out.write(k_header, strlen(k_header));
+      for (const auto& rec : records) {
+        out.print("%s\n", rec.c_str());
+      }
+      if (compressed) {
+        bgzf.close();
+      }
+    }
+
+    discovery_shard_summary summary;
+    summary.shard_index = shard_index;
+    summary.shard_count = shard_count;
+    summary.records = records.size();
+    summary.calls["snp"] = records.size();
+    summary.complete = true;
+    summary.save(vcf_path);
+    return vcf_path;
+  }
+
+  std::vector<std::string> merge(const std::vector<std::string>& vcf_paths) {
+    mem_io out("", track_alloc("discovery_shard_test"));
+    m_merged = merge_discovery_shards(vcf_paths, &out);
+    std::string merged = out.str();
+    EXPECT_EQ(merged.substr(0, strlen(k_header)), k_header);
+    std::vector<std::string> result;
+    size_t pos = strlen(k_header);
+    while (pos < merged.size()) {
+      size_t end = merged.find('\n', pos);
+      result.push_back(merged.substr(pos, end - pos));
+      pos = end + 1;
+    }
+    return result;
+  }
+
+  discovery_shard_summary m_merged;
+};
+
+TEST_F(discovery_shard_test, parse_spec) {
+  discovery_shard_spec spec = discovery_shard_spec::parse("3/8");
+  EXPECT_EQ(3, spec.index);
+  EXPECT_EQ(8, spec.count);
+  EXPECT_TRUE(spec.sharded());
+  EXPECT_EQ("3/8", spec.to_string());
+
+  EXPECT_FALSE(discovery_shard_spec::parse("0/1").sharded());
+
+  EXPECT_THROW(discovery_shard_spec::parse("8/8"), io_exception);
+  EXPECT_THROW(discovery_shard_spec::parse("0/0"), io_exception);
+  EXPECT_THROW(discovery_shard_spec::parse("3"), io_exception);
+  EXPECT_THROW(discovery_shard_spec::parse("/3"), io_exception);
+  EXPECT_THROW(discovery_shard_spec::parse("-1/3"), io_exception);
+  EXPECT_THROW(discovery_shard_spec::parse("1/2/3"), io_exception);
+}
+
+TEST_F(discovery_shard_test, assign_balanced) {
+  std::vector<size_t> sizes = {100, 100, 100, 100, 30, 100, 100, 70, 100};
+  std::vector<size_t> shards = trace_ref::assign_shards(sizes, 4);
+  ASSERT_EQ(sizes.size(), shards.size());
+
+  std::vector<size_t> shard_bases(4, 0);
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    ASSERT_LT(shards[i], 4);
+    shard_bases[shards[i]] += sizes[i];
+  }
+  EXPECT_THAT(shard_bases, UnorderedElementsAre(200, 200, 200, 200));
+
+  // Assignment is deterministic.
+  EXPECT_EQ(shards, trace_ref::assign_shards(sizes, 4));
+}
+
+TEST_F(discovery_shard_test, merge_canonical_order) {
+  std::string a = write_shard(0, 2, {"2\t5\t.\tA\tG", "1\t100\t.\tA\tC", "X\t1\t.\tG\tT"});
+  std::string b = write_shard(1, 2, {"1\t7\t.\tC\tA", "1\t100\t.\tA\tAT", "2\t1\t.\tT\tC"});
+
+  EXPECT_THAT(merge({b, a}),
+              ElementsAre("1\t7\t.\tC\tA", "1\t100\t.\tA\tAT", "1\t100\t.\tA\tC", "2\t1\t.\tT\tC",
+                          "2\t5\t.\tA\tG", "X\t1\t.\tG\tT"));
+  EXPECT_EQ(2, m_merged.shard_count);
+  EXPECT_EQ(6, m_merged.records);
+  EXPECT_EQ(6, m_merged.calls["snp"]);
+}
+
+TEST_F(discovery_shard_test, merge_bgzf) {
+  std::string a = write_shard(0, 2, {"2\t5\t.\tA\tG", "1\t100\t.\tA\tC"});
+  std::string b = write_shard(1, 2, {"1\t7\t.\tC\tA"}, true /* compressed */);
+
+  std::string out_path = make_path("merged.vcf.gz");
+  discovery_shard_summary merged = merge_discovery_shards_bgzf({a, b}, out_path);
+  EXPECT_EQ(3, merged.records);
+  EXPECT_TRUE(boost::filesystem::exists(out_path + ".tbi"));
+
+  BGZF* fp = bgzf_open(out_path.c_str(), "r");
+  ASSERT_TRUE(fp);
+  std::string contents;
+  char buf[1024];
+  ssize_t len;
+  while ((len = bgzf_read(fp, buf, sizeof(buf))) > 0) {
+    contents.append(buf, len);
+  }
+  bgzf_close(fp);
+  EXPECT_EQ(std::string(k_header) + "1\t7\t.\tC\tA\n1\t100\t.\tA\tC\n2\t5\t.\tA\tG\n",
+            contents);
+
+  EXPECT_THAT(merge({a, b}),
+              ElementsAre("1\t7\t.\tC\tA", "1\t100\t.\tA\tC", "2\t5\t.\tA\tG"));
+}
+
+TEST_F(discovery_shard_test, missing_shard) {
+  std::string a = write_shard(0, 3, {"1\t7\t.\tC\tA"});
+  std::string c = write_shard(2, 3, {"1\t8\t.\tC\tA"});
+  EXPECT_THROW(merge({a, c}), io_exception);
+}
+
+TEST_F(discovery_shard_test, incomplete_shard) {
+  std::string a = write_shard(0, 2, {"1\t7\t.\tC\tA"});
+  std::string b = write_shard(1, 2, {"1\t8\t.\tC\tA"});
+  unlink(discovery_shard_summary::path_for_vcf(b).c_str());
+  EXPECT_THROW(merge({a, b}), io_exception);
+}
+
+TEST_F(discovery_shard_test, truncated_shard) {
+  std::string a = write_shard(0, 2, {"1\t7\t.\tC\tA"});
+  std::string b = write_shard(1, 2, {"1\t8\t.\tC\tA", "1\t9\t.\tC\tA"});
+  discovery_shard_summary summary = discovery_shard_summary::load(b);
+  summary.records = 3;
+  summary.save(b);
+  EXPECT_THROW(merge({a, b}), io_exception);
+}
+
+}  // namespace variants
@@ -0,0 +1,192 @@
+#include "modules/variants/export_aligned.h"
+
+#include <htslib/sam.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "modules/io/make_unique.h"
+#include "modules/variants/align_reads.h"
+#include "modules/variants/filter_dup_align.h"
+
+namespace variants {
+
+namespace {
+
+constexpr uint8_t k_mapq = 255;
+
+// Returns the name and flags of the SAM record for a read, the same
+// as SamMapper in sam_output.py.  Mates are named after the lower of
+// their forward read ids.
+std::pair<uint32_t, uint16_t> read_name_and_flag(const readmap* rm, uint32_t read_id) {
+  uint16_t flag = 0;
+  uint32_t fwd_read_id = read_id;
+  if (!rm->get_is_forward(read_id)) {
+    flag |= BAM_FREVERSE;
+    fwd_read_id = rm->get_rev_comp(read_id);
+  }
+  if (!rm->has_mate(fwd_read_id)) {
+    return std::make_pair(fwd_read_id, flag | BAM_FREAD1);
+  }
+  flag |= BAM_FPAIRED;
+  uint32_t canon_read_id = std::min(fwd_read_id, rm->get_mate(fwd_read_id));
+  flag |= canon_read_id == fwd_read_id ? BAM_FREAD1 : BAM_FREAD2;
+  return std::make_pair(canon_read_id, flag);
+}
+
+}  // namespace
+
+void bam_record_batch::sort() {
+  const std::string& a = arena;
+  std::sort(records.begin(), records.end(), [&a](const record_ref& lhs, const record_ref& rhs) {
+    if (lhs.tid != rhs.tid) {
+      return lhs.tid < rhs.tid;
+    }
+    if (lhs.pos != rhs.pos) {
+      return lhs.pos < rhs.pos;
+    }
+    int cmp = memcmp(a.data() + lhs.offset, a.data() + rhs.offset, std::min(lhs.len, rhs.len));
+    if (cmp != 0) {
+      return cmp < 0;
+    }
+    return lhs.len < rhs.len;
+  });
+}
+
+aligned_read_exporter::aligned_read_exporter(const export_aligned_options& ea_options,
+                                             const assemble_options& options)
+    : m_ea_options(ea_options), m_options(options) {
+  CHECK(m_options.seqset);
+  CHECK(m_options.readmap);
+  if (bool(m_ea_options.min_insert) != bool(m_ea_options.max_insert)) {
+    throw io_exception("Must specify both maximum and minimum insert size if using pairing data");
+  }
+
+  // Same steps as ParallelRegions in parallel_regions.py, except that
+  // when using pairs, enough reference is added to find mates too.
+  m_pad_size = m_options.readmap->max_read_len();
+  if (m_ea_options.use_pairs()) {
+    m_pad_size += m_ea_options.max_insert;
+  }
+  std::vector<region_pipeline_step> steps;
+  region_pipeline_step step;
+  step.name = "trim_ref";
+  steps.push_back(step);
+
+  step = region_pipeline_step();
+  step.name = "add_ref";
+  step.params["pad_bases"] = std::to_string(m_pad_size);
+  steps.push_back(step);
+
+  if (m_ea_options.max_alleles) {
+    step = region_pipeline_step();
+    step.name = "limit_alleles";
+    step.params["max_alleles"] = std::to_string(m_ea_options.max_alleles);
+    steps.push_back(step);
+  }
+
+  step = region_pipeline_step();
+  step.name = "read_cov";
+  step.params["max_reads_per_entry"] = std::to_string(m_ea_options.max_reads_per_entry);
+  step.params["max_coverage_paths"] = std::to_string(m_ea_options.max_coverage_paths);
+  steps.push_back(step);
+
+  if (m_ea_options.use_pairs()) {
+    step = region_pipeline_step();
+    step.params["min_insert_size"] = std::to_string(m_ea_options.min_insert);
+    step.params["max_insert_size"] = std::to_string(m_ea_options.max_insert);
+    if (m_ea_options.ideal_insert) {
+      step.name = "place_pair_cov";
+      step.params["ideal_insert_size"] = std::to_string(m_ea_options.ideal_insert);
+      step.params["max_ambig"] = std::to_string(m_ea_options.placer_max_ambig);
+    } else {
+      step.name = "pair_cov";
+    }
+    steps.push_back(step);
+  }
+  m_pipeline = make_unique<region_pipeline>(m_options, steps);
+}
+
+bam_record_batch aligned_read_exporter::export_region(const scaffold& s, int32_t tid,
+                                                      const vcf_region& region,
+                                                      const std::vector<std::string>& lines) const {
+  region_pipeline_result result = m_pipeline->run_region(s, region, lines);
+
+  const readmap* rm = m_options.readmap;
+  bam_record_batch out;
+  auto on_aligned = [&](const read_id_set& read_ids, aligned_read aligned) {
+    for (uint32_t read_id : read_ids) {
+      auto name_and_flag = read_name_and_flag(rm, read_id);
+      bam_record_batch::record_ref rec;
+      rec.tid = tid;
+      rec.pos = aligned.left_offset;
+      rec.offset = out.arena.size();
+      append_bam_record(&out.arena, tid, aligned.left_offset,
+                        std::to_string(name_and_flag.first), name_and_flag.second, k_mapq,
+                        aligned.cigar, aligned.seq);
+      rec.len = out.arena.size() - rec.offset;
+      out.records.push_back(rec);
+    }
+  };
+
+  pipeline_step_t align = make_unique<align_reads>(
+      on_aligned, m_ea_options.refskip_anchor,
+      make_unique<assemble_lambda_output>([](assembly_ptr) {}, "export_aligned_discard"));
+  if (!m_ea_options.use_pairs()) {
+    align = make_unique<filter_dup_align>(sort_block_for_align, std::move(align));
+  }
+  for (assembly_ptr& a : result.assemblies) {
+    if (m_ea_options.use_pairs()) {
+      // Only export reads whose pairs were found.
+      a->read_coverage = a->pair_read_coverage;
+    }
+    align->add(std::move(a));
+  }
+  align.reset();
+
+  out.sort();
+  return out;
+}
+
+void sorted_bam_merger::add(bam_record_batch batch, int32_t next_tid, int32_t next_pos) {
+  if (!batch.records.empty()) {
+    pending_batch pending;
+    pending.batch = std::move(batch);
+    m_pending.push_back(std::move(pending));
+  }
+  write_before(next_tid, next_pos);
+}
+
+void sorted_bam_merger::close() {
+  write_before(std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max());
+  CHECK(m_pending.empty());
+}
+
+void sorted_bam_merger::write_before(int32_t tid, int32_t pos) {
+  auto limit = std::make_pair(tid, pos);
+  for (;;) {
+    // Few batches are pending at once, so a linear search for the
+    // lowest record is fine.
+    pending_batch* lowest = nullptr;
+    std::pair<int32_t, int32_t> lowest_pos;
+    for (pending_batch& pending : m_pending) {
+      const auto& rec = pending.batch.records[pending.next_record];
+      auto rec_pos = std::make_pair(rec.tid, rec.pos);
+      if (!lowest || rec_pos < lowest_pos) {
+        lowest = &pending;
+        lowest_pos = rec_pos;
+      }
+    }
+    if (!lowest || !(lowest_pos < limit)) {
+      return;
+    }
+
+    const auto& rec = lowest->batch.records[lowest->next_record];
+    m_out->write_record(lowest->batch.arena.data() + rec.offset, rec.len);
+    if (++lowest->next_record == lowest->batch.records.size()) {
+      m_pending.erase(m_pending.begin() + (lowest - m_pending.data()));
+    }
+  }
+}
+
+}  // namespace variants
@@ -0,0 +1,118 @@
+#pragma once
+
+// Exports reads aligned to the variants in a VCF as a coordinate-sorted
+// BAM.
+//
+// This is a native version of the "biograph export_aligned" tool.
+// Each region's records are run through the same coverage pipeline,
+// and align_reads traces each supporting read through the resulting
+// assemblies to find its alignment against reference.
+
+#include <string>
+#include <vector>
+
+#include "modules/variants/assemble.h"
+#include "modules/variants/bgzf_bam_writer.h"
+#include "modules/variants/genotype_vcf.h"
+#include "modules/variants/region_pipeline.h"
+
+namespace variants {
+
+struct export_aligned_options {
+  // If both are nonzero, only export pairs, using pair coverage with
+  // these insert size bounds.
+  aoffset_t min_insert = 0;
+  aoffset_t max_insert = 0;
+
+  // If nonzero, and insert size bounds are given, place each pair
+  // only once, optimizing for closest to this insert size.
+  aoffset_t ideal_insert = 0;
+  unsigned placer_max_ambig = 15;
+
+  // If nonzero, maximum number of reads that each seqset entry can
+  // supply for read coverage.
+  unsigned max_reads_per_entry = 0;
+  size_t max_coverage_paths = 3000;
+
+  // If nonzero, maximum number of simultaneous alleles to trace.
+  size_t max_alleles = 100;
+
+  // If true, add a "1N" CIGAR operation before reads starting inside
+  // insertions, which helps some viewers display them.
+  bool refskip_anchor = false;
+
+  bool use_pairs() const { return min_insert && max_insert; }
+};
+
+// Encoded BAM records, as produced by append_bam_record.
+struct bam_record_batch {
+  struct record_ref {
+    int32_t tid;
+    int32_t pos;
+    size_t offset;
+    size_t len;
+  };
+
+  // Sorts records by position.  Records at the same position are
+  // sorted by contents so output is deterministic.
+  void sort();
+
+  // Record contents, stored contiguously to avoid allocating for
+  // each record.
+  std::string arena;
+  std::vector<record_ref> records;
+};
+
+// Exports the reads supporting the variants in regions of reference.
+class aligned_read_exporter {
+ public:
+  // "options" must have seqset and readmap set.
+  aligned_read_exporter(const export_aligned_options& ea_options, const assemble_options& options);
+
+  // Aligns the reads supporting the records in "lines" (as returned by
+  // a tabix query for the region) that start inside the region.
+  // Returns BAM records referring to reference sequence "tid", sorted
+  // by position.
+  bam_record_batch export_region(const scaffold& s, int32_t tid, const vcf_region& region,
+                                 const std::vector<std::string>& lines) const;
+
+  // Returns the lowest position a read exported for the given region
+  // can start at.
+  aoffset_t min_read_pos(const vcf_region& region) const { return region.start - m_pad_size; }
+
+ private:
+  export_aligned_options m_ea_options;
+  assemble_options m_options;
+  aoffset_t m_pad_size = 0;
+  std::unique_ptr<region_pipeline> m_pipeline;
+};
+
+// Merges sorted batches of records from consecutive regions into a
+// bgzf_bam_writer.  Reads exported for adjacent regions may overlap,
+// so records are held until no later batch can contain anything
+// before them.
+class sorted_bam_merger {
+ public:
+  sorted_bam_merger(bgzf_bam_writer* out) : m_out(out) {}
+
+  // Adds a sorted batch of records.  All records in batches added
+  // after this one must be at or after position "next_pos" of
+  // reference sequence "next_tid".
+  void add(bam_record_batch batch, int32_t next_tid, int32_t next_pos);
+
+  // Writes all remaining records.
+  void close();
+
+ private:
+  struct pending_batch {
+    bam_record_batch batch;
+    size_t next_record = 0;
+  };
+
+  void write_before(int32_t tid, int32_t pos);
+
+  bgzf_bam_writer* const m_out;
+  std::vector<pending_batch> m_pending;
+};
+
+}  // namespace variants
@@ -0,0 +1,162 @@
+#include "modules/variants/export_aligned.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <htslib/sam.h>
+
+#include "absl/strings/str_split.h"
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/variants/assemble_testutil.h"
+#include "modules/test/test_utils.h"
+
+namespace variants {
+
+using namespace testing;
+using namespace dna_testutil;
+
+namespace {
+
+const std::vector<std::pair<std::string, int64_t>> k_contigs = {{"1", 1000}, {"2", 1000}};
+
+bam_record_batch make_batch(int32_t tid, std::vector<int32_t> positions) {
+  bam_record_batch batch;
+  for (int32_t pos : positions) {
+    bam_record_batch::record_ref rec;
+    rec.tid = tid;
+    rec.pos = pos;
+    rec.offset = batch.arena.size();
+    append_bam_record(&batch.arena, tid, pos, std::to_string(pos), 0, 255, "", dna_sequence("A"));
+    rec.len = batch.arena.size() - rec.offset;
+    batch.records.push_back(rec);
+  }
+  batch.sort();
+  return batch;
+}
+
+}  // namespace
+
+class export_aligned_test : public assemble_test {
+ public:
+  export_aligned_test() {
+    m_options.scaffold_name = "1";
+    m_path = make_path("export_aligned_test.bam");
+  }
+
+  // Writes the given batches, and returns the (name, flag, pos, cigar,
+  // seq) fields of all records written.
+  std::vector<std::string> write_and_read(std::function<void(sorted_bam_merger*)> f) {
+    std::string header;
+    for (const auto& contig : k_contigs) {
+      header += printstring("@SQ\tSN:%s\tLN:%ld\n", contig.first.c_str(), contig.second);
+    }
+    {
+      bgzf_bam_writer out(m_path, k_contigs, header);
+      sorted_bam_merger merger(&out);
+      f(&merger);
+      merger.close();
+      out.close();
+    }
+
+    std::vector<std::string> result;
+    samFile* fp = sam_open(m_path.c_str(), "r");
+    CHECK(fp);
+    bam_hdr_t* hdr = sam_hdr_read(fp);
+    CHECK(hdr);
+    bam1_t* b = bam_init1();
+    kstring_t str = {0, 0, nullptr};
+    while (sam_read1(fp, hdr, b) >= 0) {
+      str.l = 0;
+      CHECK_GE(sam_format1(hdr, b, &str), 0);
+      std::vector<std::string> fields = absl::StrSplit(std::string(str.s, str.l), '\t');
+      CHECK_GE(fields.size(), 10);
+      result.push_back(fields[0] + " " + fields[1] + " " + fields[2] + ":" + fields[3] + " " +
+                       fields[5] + " " + fields[9]);
+    }
+    free(str.s);
+    bam_destroy1(b);
+    bam_hdr_destroy(hdr);
+    sam_close(fp);
+    return result;
+  }
+
+  std::vector<std::string> export_records(const std::vector<std::string>& records) {
+    aligned_read_exporter exporter(m_ea_options, m_options);
+    vcf_region r;
+    r.scaffold_name = "1";
+    r.start = 0;
+    r.limit = m_scaffold.end_pos();
+    bam_record_batch batch = exporter.export_region(m_scaffold, 0, r, records);
+    return write_and_read([&](sorted_bam_merger* merger) {
+      merger->add(std::move(batch), 1, 0);
+    });
+  }
+
+  std::string base_at(aoffset_t pos) {
+    dna_slice slice = m_scaffold.subscaffold(pos, 1).get_simple();
+    return dna_sequence(slice.begin(), slice.end()).as_string();
+  }
+
+  export_aligned_options m_ea_options;
+  std::string m_path;
+};
+
+TEST_F(export_aligned_test, merge_overlapping) {
+  std::vector<std::string> result = write_and_read([](sorted_bam_merger* merger) {
+    merger->add(make_batch(0, {30, 10, 50}), 0, 20);
+    merger->add(make_batch(0, {20, 60}), 0, 55);
+    merger->add(make_batch(0, {55}), 1, 0);
+    merger->add(bam_record_batch(), 1, 0);
+    merger->add(make_batch(1, {5}), 1, 10);
+  });
+  EXPECT_THAT(result, ElementsAre("10 0 1:11 1M A", "20 0 1:21 1M A", "30 0 1:31 1M A",
+                                  "50 0 1:51 1M A", "55 0 1:56 1M A", "60 0 1:61 1M A",
+                                  "5 0 2:6 1M A"));
+}
+
+TEST_F(export_aligned_test, insert) {
+  use_ref_parts({{0, tseq("abcdefghijklmnopqrstuvwxyz")}});
+  use_paired_reads({{tseq("bcdefgh"), tseq_rc("uvwxyz")},
+                    {tseq("abcde") + dna_T + tseq("fghi"), tseq_rc("tuvwxy")}});
+
+  // 1-based position of the last base of "abcde"
+  int pos = tseq("abcde").size();
+  std::string ref = base_at(pos - 1);
+  std::vector<std::string> result =
+      export_records({printstring("1\t%d\t.\t%s\t%sT\t50\tPASS\t.\tGT\t1/1", pos, ref.c_str(),
+                                  ref.c_str())});
+  EXPECT_THAT(result, Contains(HasSubstr(printstring(" 1:1 %dM1I%dM ", pos,
+                                                     int(tseq("fghi").size())))));
+  EXPECT_THAT(result, Contains(HasSubstr(printstring(" 1:%d %dM ", int(tseq("a").size()) + 1,
+                                                     int(tseq("bcdefgh").size())))));
+  EXPECT_THAT(result, Each(Not(StartsWith("0 0 "))));
+
+  for (size_t i = 1; i < result.size(); ++i) {
+    int prev_pos = std::stoi(result[i - 1].substr(result[i - 1].find(':') + 1));
+    int cur_pos = std::stoi(result[i].substr(result[i].find(':') + 1));
+    EXPECT_LE(prev_pos, cur_pos) << result[i - 1] << " vs " << result[i];
+  }
+}
+
+TEST_F(export_aligned_test, pairs_only) {
+  use_ref_parts({{0, tseq("abcdefghijklmnopqrstuvwxyz")}});
+  use_paired_reads({{tseq("abcde") + dna_T + tseq("fghi"), tseq_rc("tuvwxy")}},
+                   {tseq("bcdefgh")});
+  m_ea_options.min_insert = 1;
+  m_ea_options.max_insert = 1000;
+
+  int pos = tseq("abcde").size();
+  std::string ref = base_at(pos - 1);
+  std::vector<std::string> result =
+      export_records({printstring("1\t%d\t.\t%s\t%sT\t50\tPASS\t.\tGT\t1/1", pos, ref.c_str(),
+                                  ref.c_str())});
+  // The unpaired read isn't exported, but both mates of the pair are,
+  // with the same name.
+  ASSERT_THAT(result, ElementsAre(HasSubstr(printstring(" 65 1:1 %dM1I%dM ", pos,
+                                                        int(tseq("fghi").size()))),
+                                  HasSubstr(printstring(" 145 1:%d %dM ",
+                                                        int(tseq("abcdefghijklmnopqrs").size()) + 1,
+                                                        int(tseq("tuvwxy").size())))));
+  EXPECT_EQ(result[0].substr(0, result[0].find(' ')), result[1].substr(0, result[1].find(' ')));
+}
+
+}  // namespace variants
@@ -0,0 +1,887 @@
+#include "modules/variants/genotype_vcf.h"
+
+#include <htslib/kseq.h>
+#include <htslib/kstring.h>
+
+#include <algorithm>
+#include <boost/regex.hpp>
+#include <cmath>
+
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "modules/io/digest.h"
+#include "modules/io/log.h"
+#include "modules/variants/add_ref.h"
+#include "modules/variants/align_count.h"
+#include "modules/variants/apply_edges.h"
+#include "modules/variants/filter_dup_align.h"
+#include "modules/variants/pair_cov.h"
+#include "modules/variants/pair_edge_cov.h"
+#include "modules/variants/place_pair_cov.h"
+#include "modules/variants/read_cov.h"
+#include "modules/variants/trim_ref.h"
+
+namespace variants {
+
+namespace {
+
+// Default for overlap fields that take a minimum.
+constexpr int k_max_overlap_default = 32767;
+
+// Coverage fields, in the order "biograph coverage" lists them.
+const std::vector<std::string> k_cov_tags = {
+    "US", "DS", "UC",  "DC",  "UDC", "UCC", "DDC", "DCC", "UMO", "DMO",
+    "UXO", "DXO", "NR", "MO", "XO",  "XC",  "AC",  "EC",  "MC",  "MP"};
+const std::vector<std::string> k_gt_tags = {"GT", "GQ", "PL", "DP", "AD", "RC"};
+const std::vector<std::string> k_ac_tags = {"AC_LR", "AC_AB", "AC_TA"};
+
+const char k_gt_header[] =
+    "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n"
+    "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Genotype Quality\">\n"
+    "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Sample Depth\">\n"
+    "##FORMAT=<ID=AD,Number=R,Type=Integer,Description="
+    "\"Allelic depths for the ref and alt alleles in the order listed\">\n"
+    "##FORMAT=<ID=PL,Number=G,Type=Integer,Description="
+    "\"Phred-scaled likelihoods of the genotypes at a locus\">\n"
+    "##FORMAT=<ID=RC,Number=1,Type=Integer,Description="
+    "\"Number of reads supporting redundant alleles at a locus\">\n"
+    "##FORMAT=<ID=AC_LR,Number=1,Type=Integer,Description="
+    "\"Sum of lengths of distinct reads in the variant\">\n"
+    "##FORMAT=<ID=AC_AB,Number=1,Type=Integer,Description="
+    "\"Sum of total aligned bases in this variant\">\n"
+    "##FORMAT=<ID=AC_TA,Number=1,Type=Integer,Description="
+    "\"Sum of total aligned bases in other strands for reads in this variant\">\n";
+
+// Common names of known reference digests.
+const std::map<std::string, std::string> k_refhash_names = {
+    {"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", "no_contigs_present"},
+    {"1e4ef0c15393ae133ad336a36a376bb62e564a43a65892966002e75713282aec", "hs37d5"},
+    {"9d1184b1f957da7a499793e838a6509626bf772c8f437c0972c25f30fbab9fd7", "human_g1k_v37"},
+    {"11cc1f8edf231691097cb007d1cdf603fc53d6019ae2899b6cae23be1ab3393b",
+     "GRCh38_full_analysis_set_plus_decoy_hla"},
+    {"1f5faf40c2b1b8715e9df75375cb392117a9c5734fca790e6399d7a50e90ebdd", "grch38"},
+    {"2a1c2512c0d779999183f59350ab7fdb2f89326737af53564d7bd6f1e18aa9be", "hg19"},
+    {"37a6fd3d23b48379f4cf17f2fb56faf4cd73226225bc8d7b0f9204e93e3cc901", "hg38"},
+    {"870d360f9f3ac29b34cfee2a0ab74a78775fcb117ec6c305b243fbf042f7c842", "GRCh38_GenBank"},
+    {"65c1965612d479ea8b0530e87a03fe4f9f14dbc11b83274ecdaa700f08d1a1b9", "GRCh38_RefSeq"},
+    {"0238e98a614a374caee7b393a2b92f81c714f4075de9c1dce7b9194e044a427c", "GRCh38.p13_GenBank"},
+    {"8450f353b5b093d0520c73e2b1118d5655154a7e417e7c94b5fb4c1c3f6b5110", "GRCh38.p13_RefSeq"},
+    {"c9f4018aea11b732113e2b2a57f79e6253c7dd9438bc79d39f35dda93c446948",
+     "Homo_sapiens.GRCh38.dna.primary_assembly"},
+    {"7d36a47714a3b3c19d758cafc4c20bc8d319a0bdd06d9d6ab786897c64f2a8a0",
+     "Homo_sapiens.GRCh38.dna.toplevel"},
+    {"4677415a4ecde9fceca5280f41bd984d90ccd7cd715489ab92fb43250b3cf432", "e_coli_k12_ASM584v1"},
+    {"30fad211ba7f62ded67e44167d223332fedb8d8ede00e9bebc8cd633d70664ef", "lambdaToyData"},
+    {"3d613562b94854287581e37855661ac50e29d109fcbdb73178eca0e91d62012a", "chm13"},
+    {"7847c0ab77e76b50834dbc15bb5d104cacce3bbaa9ec443ae49ab25297312768", "GRCh37.p13_RefSeq"},
+};
+
+std::vector<std::string> split_lines(const std::string& text) {
+  std::vector<std::string> lines = absl::StrSplit(text, '\n', absl::SkipEmpty());
+  for (std::string& line : lines) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+  }
+  return lines;
+}
+
+bool is_dna(const std::string& seq) {
+  return std::all_of(seq.begin(), seq.end(), [](char c) {
+    switch (c) {
+      case 'A':
+      case 'C':
+      case 'G':
+      case 'T':
+      case 'a':
+      case 'c':
+      case 'g':
+      case 't':
+        return true;
+      default:
+        return false;
+    }
+  });
+}
+
+// Python-compatible log10, as math.log(x, 10).
+double py_log10(double x) { return std::log(x) / std::log(10); }
+
+// Coverage statistics for one side (reference or variant) of an allele.
+struct allele_coverage {
+  int upstream_span = 0;
+  int dnstream_span = 0;
+  int upstream_coverage = 0;
+  int dnstream_coverage = 0;
+  int upstream_dir_cov = 0;
+  int upstream_com_cov = 0;
+  int dnstream_dir_cov = 0;
+  int dnstream_com_cov = 0;
+  int upstream_min_overlap = k_max_overlap_default;
+  int dnstream_min_overlap = k_max_overlap_default;
+  int upstream_max_overlap = 0;
+  int dnstream_max_overlap = 0;
+  int num_reads = 0;
+  int min_overlap = k_max_overlap_default;
+  int max_overlap = 0;
+  int max_coverage = 0;
+  int average_coverage = 0;
+  int median_coverage = 0;
+  int minimum_coverage = 0;
+  int read_cov_max_paths = 0;
+
+  // Values in the same order as k_cov_tags.
+  std::vector<int> values() const {
+    return {upstream_span,        dnstream_span,        upstream_coverage,    dnstream_coverage,
+            upstream_dir_cov,     upstream_com_cov,     dnstream_dir_cov,     dnstream_com_cov,
+            upstream_min_overlap, dnstream_min_overlap, upstream_max_overlap, dnstream_max_overlap,
+            num_reads,            min_overlap,          max_overlap,          max_coverage,
+            average_coverage,     median_coverage,      minimum_coverage,     read_cov_max_paths};
+  }
+
+  void add_depth_stats(const read_coverage_t& cov, const std::vector<int>& depths) {
+    CHECK(!depths.empty());
+    num_reads += cov.get_tot_read_count();
+
+    max_coverage = *std::max_element(depths.begin(), depths.end());
+    minimum_coverage = *std::min_element(depths.begin(), depths.end());
+    int64_t sum = 0;
+    for (int depth : depths) {
+      sum += depth;
+    }
+    average_coverage = std::nearbyint(double(sum) / depths.size());
+
+    std::vector<int> sorted = depths;
+    std::sort(sorted.begin(), sorted.end());
+    size_t mid = sorted.size() / 2;
+    if (sorted.size() % 2) {
+      median_coverage = sorted[mid];
+    } else {
+      median_coverage = std::nearbyint((sorted[mid - 1] + sorted[mid]) / 2.0);
+    }
+
+    std::tie(min_overlap, max_overlap) = cov.get_overlap_min_max();
+  }
+
+  void set_upstream_span(const read_coverage_t& cov, int offset) {
+    read_coverage_t spanning = cov.get_reads_spanning_offset(offset);
+    upstream_span = spanning.get_max_flank(offset);
+    std::tie(upstream_min_overlap, upstream_max_overlap) = spanning.get_overlap_min_max();
+  }
+
+  void set_dnstream_span(const read_coverage_t& cov, int offset) {
+    read_coverage_t spanning = cov.get_reads_spanning_offset(offset);
+    dnstream_span = spanning.get_max_flank(offset);
+    std::tie(dnstream_min_overlap, dnstream_max_overlap) = spanning.get_overlap_min_max();
+  }
+
+  // Calculates everything we can about a variant without knowing
+  // anything about the assemblies around it.
+  void add_var_depths(int seq_len, const read_coverage_t& cov, const std::vector<int>& depths,
+                      const std::vector<int>& dir_depths) {
+    add_depth_stats(cov, depths);
+
+    upstream_coverage = depths.front();
+    upstream_dir_cov = dir_depths.front();
+    upstream_com_cov = depths.front() - dir_depths.front();
+
+    dnstream_coverage = depths.back();
+    dnstream_dir_cov = dir_depths.back();
+    dnstream_com_cov = depths.back() - dir_depths.back();
+
+    set_upstream_span(cov, 0);
+    set_dnstream_span(cov, seq_len);
+  }
+
+  // Saves coverage of reference reads crossing the junction on one
+  // side of a variant.  "cov" is centered on the junction.
+  void add_ref_depths(bool ref_is_upstream, const read_coverage_t& cov,
+                      const std::vector<int>& depths, const std::vector<int>& dir_depths) {
+    add_depth_stats(cov, depths);
+
+    if (ref_is_upstream) {
+      upstream_coverage = depths.front();
+      upstream_dir_cov = dir_depths.front();
+      upstream_com_cov = depths.front() - dir_depths.front();
+      set_upstream_span(cov, 0);
+    } else {
+      dnstream_coverage = depths.front();
+      dnstream_dir_cov = dir_depths.front();
+      dnstream_com_cov = depths.front() - dir_depths.front();
+      set_dnstream_span(cov, 0);
+    }
+  }
+};
+
+// State for a VCF record while its alleles pass through the pipeline.
+struct vcf_record_state {
+  std::vector<std::string> fields;
+  std::string sample_field;
+  std::vector<std::string> alts;
+
+  size_t alleles_remaining = 0;
+  // Indexed by position in "alts".  A record may list the same ALT
+  // more than once, so these can't be keyed by sequence.
+  std::vector<edge_coverage_t> edge_covs;
+
+  // FORMAT fields calculated so far.
+  std::map<std::string, std::string> new_fmt;
+};
+
+// Stored in assembly::user_data for each allele.
+struct genotype_allele {
+  std::shared_ptr<vcf_record_state> record;
+  // Index of this allele in record->alts.
+  size_t alt_index = 0;
+
+  allele_coverage var_cov;
+  allele_coverage ref_cov;
+};
+
+genotype_allele* get_allele(assembly* a) { return boost::any_cast<genotype_allele>(&a->user_data); }
+
+// Annotates each variant with coverage of itself and of the reference
+// reads that cross its junctions.
+class allele_coverage_step : public apply_edges_step {
+ public:
+  allele_coverage_step(const readmap* rm, pipeline_step_t output)
+      : apply_edges_step(std::move(output)), m_readmap(rm) {}
+  ~allele_coverage_step() override { flush(); }
+
+  void on_assembly(assembly_ptr a) override {
+    genotype_allele* allele = get_allele(a.get());
+    if (allele && !a->matches_reference) {
+      CHECK(a->read_coverage) << *a;
+      allele->var_cov.read_cov_max_paths = a->read_cov_max_paths;
+      std::vector<int> depths = a->read_coverage->calc_depths();
+      std::vector<int> dir_depths =
+          a->read_coverage->calc_depths(true /* fwd */, false /* rev */, true, m_readmap);
+      allele->var_cov.add_var_depths(a->seq.size(), *a->read_coverage, depths, dir_depths);
+    }
+    apply_edges_step::on_assembly(std::move(a));
+  }
+
+  void on_assembly_edges(optional_aoffset reference_pos, const std::vector<assembly_ptr>& left_edges,
+                         const std::vector<assembly_ptr>& inserts,
+                         const std::vector<assembly_ptr>& right_edges) override {
+    std::vector<assembly*> left_vars, right_vars;
+    boost::optional<read_coverage_t> left_ref_cov, right_ref_cov;
+    size_t ref_max_paths = 0;
+    for (const auto& a : left_edges) {
+      if (!a->matches_reference) {
+        left_vars.push_back(a.get());
+        continue;
+      }
+      if (left_ref_cov) {
+        SPLOG("Duplicate reference assemblies encountered at %d", int(reference_pos));
+      }
+      left_ref_cov = a->read_coverage->get_and_adjust_reads_spanning_offset(a->seq.size());
+      ref_max_paths = std::max(ref_max_paths, a->read_cov_max_paths);
+    }
+    for (const auto& a : right_edges) {
+      if (!a->matches_reference) {
+        right_vars.push_back(a.get());
+        continue;
+      }
+      if (right_ref_cov) {
+        SPLOG("Duplicate reference assemblies encountered at %d", int(reference_pos));
+      }
+      right_ref_cov = a->read_coverage->get_and_adjust_reads_spanning_offset(0);
+      ref_max_paths = std::max(ref_max_paths, a->read_cov_max_paths);
+    }
+
+    if (!left_ref_cov || !right_ref_cov) {
+      if (!left_vars.empty() || !right_vars.empty() || !inserts.empty()) {
+        SPLOG("Missing reference coverage at %d", int(reference_pos));
+      }
+      return;
+    }
+
+    // Only count reference reads that continue both upstream and
+    // downstream in reference.
+    read_coverage_t ref_cov = left_ref_cov->intersection_with(*right_ref_cov);
+    std::vector<int> depths = ref_cov.calc_depths();
+    std::vector<int> dir_depths =
+        ref_cov.calc_depths(true /* fwd */, false /* rev */, true, m_readmap);
+    if (depths.size() != 1) {
+      SPLOG("Expected coverage for only the junction at %d", int(reference_pos));
+      return;
+    }
+
+    genotype_allele* last = nullptr;
+    auto add_ref = [&](assembly* a, bool ref_is_upstream) {
+      genotype_allele* allele = get_allele(a);
+      if (!allele) {
+        return;
+      }
+      allele->ref_cov.add_ref_depths(ref_is_upstream, ref_cov, depths, dir_depths);
+      last = allele;
+    };
+    for (assembly* a : left_vars) {
+      add_ref(a, false /* ref is downstream */);
+    }
+    for (const auto& a : inserts) {
+      add_ref(a.get(), false /* ref is downstream */);
+    }
+    for (const auto& a : inserts) {
+      add_ref(a.get(), true /* ref is upstream */);
+    }
+    for (assembly* a : right_vars) {
+      add_ref(a, true /* ref is upstream */);
+    }
+    // "biograph coverage" only records this on the last allele seen.
+    if (last) {
+      last->ref_cov.read_cov_max_paths = ref_max_paths;
+    }
+  }
+
+ private:
+  const readmap* m_readmap = nullptr;
+};
+
+// Saves the combined reference and variant coverage for each variant.
+void save_coverage_fields(const assembly& a) {
+  const genotype_allele* allele = boost::any_cast<genotype_allele>(&a.user_data);
+  if (a.matches_reference || !allele) {
+    return;
+  }
+  std::vector<int> ref_values = allele->ref_cov.values();
+  std::vector<int> var_values = allele->var_cov.values();
+  for (size_t i = 0; i < k_cov_tags.size(); ++i) {
+    allele->record->new_fmt[k_cov_tags[i]] =
+        std::to_string(ref_values[i]) + "," + std::to_string(var_values[i]);
+  }
+}
+
+// Collects pair edge coverage for all the alleles in a record, and
+// outputs the last allele of each record with the genotype fields
+// calculated.  Reference assemblies are discarded.
+class genotype_step : public assemble_pipeline_interface {
+ public:
+  genotype_step(pipeline_step_t output) : m_output(std::move(output)) {}
+
+  void on_assembly(assembly_ptr a) override {
+    genotype_allele* allele = get_allele(a.get());
+    if (a->matches_reference || !allele) {
+      return;
+    }
+    vcf_record_state* record = allele->record.get();
+    if (!record->alleles_remaining) {
+      return;
+    }
+    CHECK_LT(allele->alt_index, record->edge_covs.size());
+    record->edge_covs[allele->alt_index] =
+        a->edge_coverage ? *a->edge_coverage : edge_coverage_t();
+    if (--record->alleles_remaining) {
+      return;
+    }
+
+    std::vector<edge_coverage_t> covs = std::move(record->edge_covs);
+    record->edge_covs.clear();
+    for (auto& field : calc_genotype_fields(covs)) {
+      record->new_fmt[field.first] = std::move(field.second);
+    }
+    m_output->add(std::move(a));
+  }
+
+ private:
+  pipeline_step_t m_output;
+};
+
+}  // namespace
+
+std::vector<assembly_ptr> sort_block_for_align(std::vector<assembly_ptr> block) {
+  auto priority = [](const assembly_ptr& a) {
+    return std::make_tuple(
+        // Sort reference first, so we always have reference coverage present
+        a->matches_reference,
+        // Otherwise, prefer things with less structural variant length
+        -std::abs(aoffset_t(a->right_offset) - aoffset_t(a->left_offset) - aoffset_t(a->seq.size())),
+        // Otherwise, prefer things with longer sequence length
+        a->seq.size(),
+        // Otherwise, prefer things with more supporting reads
+        a->read_coverage ? a->read_coverage->size() : 0);
+  };
+  std::stable_sort(block.begin(), block.end(), [&](const assembly_ptr& a, const assembly_ptr& b) {
+    return priority(a) > priority(b);
+  });
+  return block;
+}
+
+tabix_vcf_reader::tabix_vcf_reader(const std::string& path) : m_path(path) {
+  m_fp = hts_open(path.c_str(), "r");
+  if (!m_fp) {
+    throw io_exception("Unable to open " + path);
+  }
+  m_tbx = tbx_index_load(path.c_str());
+  if (!m_tbx) {
+    hts_close(m_fp);
+    throw io_exception("Unable to load tabix index for " + path);
+  }
+}
+
+tabix_vcf_reader::~tabix_vcf_reader() {
+  tbx_destroy(m_tbx);
+  hts_close(m_fp);
+}
+
+std::string tabix_vcf_reader::header() {
+  // Read from a separate handle so queries aren't disturbed.
+  htsFile* fp = hts_open(m_path.c_str(), "r");
+  if (!fp) {
+    throw io_exception("Unable to open " + m_path);
+  }
+  std::string header;
+  kstring_t str = {0, 0, nullptr};
+  while (hts_getline(fp, KS_SEP_LINE, &str) >= 0) {
+    if (!str.l || str.s[0] != '#') {
+      break;
+    }
+    header.append(str.s, str.l);
+    header += "\n";
+  }
+  free(str.s);
+  hts_close(fp);
+  return header;
+}
+
+std::vector<std::string> tabix_vcf_reader::query(const std::string& scaffold_name,
+                                                 aoffset_t start, aoffset_t limit) {
+  std::vector<std::string> result;
+  int tid = tbx_name2id(m_tbx, scaffold_name.c_str());
+  if (tid < 0) {
+    return result;
+  }
+  hts_itr_t* itr = tbx_itr_queryi(m_tbx, tid, std::max<aoffset_t>(start, 0), limit);
+  if (!itr) {
+    return result;
+  }
+  kstring_t str = {0, 0, nullptr};
+  int ret;
+  while ((ret = tbx_itr_next(m_fp, m_tbx, itr, &str)) >= 0) {
+    result.emplace_back(str.s, str.l);
+  }
+  free(str.s);
+  tbx_itr_destroy(itr);
+  if (ret < -1) {
+    throw io_exception("Error reading " + m_path);
+  }
+  return result;
+}
+
+std::vector<vcf_region> find_microcontigs(tabix_vcf_reader* reader, const vcf_region& region,
+                                          aoffset_t min_clearance, aoffset_t min_contig_size) {
+  std::vector<vcf_region> result;
+  int64_t chrom_start = int64_t(region.start) - 1;
+  int64_t chrom_end = region.limit;
+  int64_t last_start = 0;
+  int64_t last_end = 0;
+  int64_t end = 0;
+  int64_t padding = min_clearance / 2;
+
+  auto add_microcontig = [&](int64_t start, int64_t limit) {
+    vcf_region mc;
+    mc.scaffold_name = region.scaffold_name;
+    mc.start = std::max<int64_t>(0, start);
+    mc.limit = std::min(limit, chrom_end);
+    result.push_back(mc);
+  };
+
+  for (const std::string& line : reader->query(region.scaffold_name, chrom_start, chrom_end)) {
+    std::vector<absl::string_view> fields = absl::StrSplit(line, absl::MaxSplits('\t', 4));
+    CHECK_GE(fields.size(), 4) << "Bad VCF record: " << line;
+    int64_t pos = std::stoll(std::string(fields[1])) - 1;
+    // VCF records always have at least one reference base.
+    end = pos + fields[3].size() - 1;
+
+    if (last_start == 0) {
+      last_start = pos;
+      last_end = end;
+      continue;
+    }
+
+    // Tabix returns any record that overlaps the region; skip records
+    // that don't start inside it.
+    if (pos < chrom_start || pos >= chrom_end) {
+      continue;
+    }
+
+    if (pos - last_end > min_clearance && last_end - last_start + min_clearance > min_contig_size) {
+      add_microcontig(last_start - padding, last_end + padding);
+      last_start = pos;
+      last_end = end;
+    } else {
+      last_end = std::max(end, last_end);
+    }
+  }
+  if (last_start > 0) {
+    // "biograph coverage" pads the last microcontig past the end of the
+    // last record seen rather than the furthest end.
+    add_microcontig(last_start - padding, end + padding);
+  }
+  return result;
+}
+
+std::string vcf_refhash_digest(const std::string& header) {
+  static const boost::regex k_contig_re("^##contig=.*ID=(.*),length=(\\d+)");
+  std::map<std::string, std::string> contigs;
+  for (const std::string& line : split_lines(header)) {
+    if (line.empty() || line[0] != '#') {
+      break;
+    }
+    boost::smatch m;
+    if (boost::regex_search(line, m, k_contig_re)) {
+      contigs[m[1]] = std::to_string(std::stoull(m[2]));
+    }
+  }
+
+  std::string contig_list;
+  for (const auto& contig : contigs) {
+    contig_list += contig.first + ":" + contig.second + "\n";
+  }
+  return mdsum(contig_list, "sha256");
+}
+
+std::string vcf_refhash_name(const std::string& digest) {
+  auto it = k_refhash_names.find(digest);
+  if (it != k_refhash_names.end()) {
+    return it->second;
+  }
+  return "unknown-" + digest.substr(0, 8);
+}
+
+const std::vector<std::string> genotype_vcf_format::k_formats = {
+    "GT", "GQ", "PL", "DP", "AD", "AC_LR", "AC_AB", "AC_TA"};
+
+genotype_vcf_format::genotype_vcf_format(const std::string& template_header,
+                                         const std::string& sample, bool strip_fmt)
+    : m_sample(sample), m_formats(k_formats) {
+  static const boost::regex k_format_re("^##FORMAT=<ID=([^,]+)");
+
+  std::set<std::string> new_tags;
+  new_tags.insert(k_cov_tags.begin(), k_cov_tags.end());
+  new_tags.insert(k_gt_tags.begin(), k_gt_tags.end());
+  new_tags.insert(k_ac_tags.begin(), k_ac_tags.end());
+
+  for (const std::string& line : split_lines(template_header)) {
+    if (line.compare(0, 2, "##") == 0) {
+      boost::smatch m;
+      if (boost::regex_search(line, m, k_format_re)) {
+        std::string id = m[1];
+        if (!strip_fmt && std::find(m_formats.begin(), m_formats.end(), id) == m_formats.end()) {
+          m_formats.push_back(id);
+        }
+        if (new_tags.count(id)) {
+          continue;
+        }
+      }
+      m_header_lines.push_back(line);
+    } else if (line.compare(0, 1, "#") == 0) {
+      m_chrom_fields = absl::StrSplit(line, '\t');
+      break;
+    }
+  }
+  if (m_chrom_fields.empty()) {
+    throw io_exception("VCF header missing #CHROM line");
+  }
+  if (m_chrom_fields.size() < 10) {
+    m_chrom_fields.resize(10);
+  }
+  auto sample_it = std::find(m_chrom_fields.begin(), m_chrom_fields.end(), sample);
+  if (sample_it != m_chrom_fields.end() && sample_it - m_chrom_fields.begin() >= 9) {
+    m_sample_column = sample_it - m_chrom_fields.begin();
+  }
+  m_chrom_fields[9] = sample;
+  m_chrom_fields.resize(10);
+
+  for (const std::string& tag : k_cov_tags) {
+    m_defaults[tag] = (tag == "UMO" || tag == "DMO" || tag == "MO")
+                          ? std::to_string(k_max_overlap_default)
+                          : "0";
+  }
+  for (const std::string& tag : k_gt_tags) {
+    m_defaults[tag] = ".";
+  }
+  m_defaults["GT"] = "./.";
+  for (const std::string& tag : k_ac_tags) {
+    m_defaults[tag] = ".";
+  }
+}
+
+std::string genotype_vcf_format::make_header(const std::string& source_line) const {
+  std::string header;
+  bool has_refhash = false;
+  for (const std::string& line : m_header_lines) {
+    header += line + "\n";
+    if (line.find("##refhash=") != std::string::npos) {
+      has_refhash = true;
+    }
+  }
+  std::string template_header = header;
+  header += k_gt_header;
+  header += source_line + "\n";
+  if (!has_refhash) {
+    std::string digest = vcf_refhash_digest(template_header);
+    header += "##refhash=" + digest + ",name=" + vcf_refhash_name(digest) + "\n";
+  }
+  header += absl::StrJoin(m_chrom_fields, "\t") + "\n";
+  return header;
+}
+
+std::string genotype_vcf_format::format_record(
+    const std::vector<std::string>& fields, const std::string& sample_field,
+    const std::map<std::string, std::string>& new_fmt) const {
+  std::vector<std::string> out_fields(fields.begin(),
+                                      fields.begin() + std::min<size_t>(fields.size(), 9));
+  out_fields.resize(9);
+
+  std::vector<std::string> fmt = absl::StrSplit(out_fields[8], ':');
+  std::map<std::string, std::string> samp_data;
+  if (!sample_field.empty() && sample_field != ".") {
+    std::vector<std::string> values = absl::StrSplit(sample_field, ':');
+    for (size_t i = 0; i < fmt.size() && i < values.size(); ++i) {
+      samp_data.emplace(fmt[i], values[i]);
+    }
+  }
+
+  using fmt_map = std::map<std::string, std::string>;
+  const std::vector<const fmt_map*> sources = {&new_fmt, &m_defaults, &samp_data};
+  std::vector<std::string> sample_values;
+  for (const std::string& tag : m_formats) {
+    std::string value = ".";
+    for (const fmt_map* source : sources) {
+      auto it = source->find(tag);
+      if (it != source->end()) {
+        value = it->second;
+        break;
+      }
+    }
+    sample_values.push_back(std::move(value));
+  }
+  out_fields[8] = absl::StrJoin(m_formats, ":");
+  return absl::StrJoin(out_fields, "\t") + "\t" + absl::StrJoin(sample_values, ":") + "\n";
+}
+
+std::map<std::string, std::string> calc_genotype_fields(
+    const std::vector<edge_coverage_t>& allele_edge_covs) {
+  // Reads seen supporting more than one allele are redundant, and
+  // can only count towards alternate alleles.
+  read_id_set ref_reads, redundant_reads, seen_reads;
+  std::vector<int> allele_covs = {0};
+  for (const edge_coverage_t& ec : allele_edge_covs) {
+    ref_reads |= ec.reference_start;
+    ref_reads |= ec.reference_end;
+    read_id_set var_reads = ec.variant_start | ec.variant_end;
+    allele_covs.push_back(var_reads.size());
+    redundant_reads |= (seen_reads & var_reads);
+    seen_reads |= var_reads;
+  }
+  redundant_reads |= (seen_reads & ref_reads);
+  allele_covs[0] = (ref_reads - redundant_reads).size();
+
+  int tot_coverage = 0;
+  for (int cov : allele_covs) {
+    tot_coverage += cov;
+  }
+
+  std::map<std::string, std::string> result;
+  result["GT"] = "./.";
+  result["GQ"] = ".";
+  result["PL"] = ".";
+  result["AD"] = absl::StrJoin(allele_covs, ",");
+  result["DP"] = std::to_string(tot_coverage);
+  if (tot_coverage == 0) {
+    result["RC"] = ".";
+    return result;
+  }
+  result["RC"] = std::to_string(redundant_reads.size());
+
+  // Log likelihoods of 0, 1, and 2 copies of each allele.
+  static const double k_priors[3] = {0.05, 0.5, 0.95};
+  std::vector<std::array<double, 3>> probs;
+  for (int alt : allele_covs) {
+    int n = tot_coverage;
+    int k = alt;
+    if (k * 2 > n) {
+      k = n - k;
+    }
+    double comb = 0;
+    for (int d = 1; d <= k; ++d) {
+      comb += py_log10(n);
+      comb -= py_log10(d);
+      --n;
+    }
+    int non_alt = tot_coverage - alt;
+    std::array<double, 3> p;
+    for (int i = 0; i < 3; ++i) {
+      p[i] = comb + alt * py_log10(k_priors[i]) + non_alt * py_log10(1 - k_priors[i]);
+    }
+    probs.push_back(p);
+  }
+
+  std::vector<int> pls;
+  boost::optional<double> max_gq;
+  for (size_t a1 = 0; a1 < probs.size(); ++a1) {
+    for (size_t a2 = a1; a2 < probs.size(); ++a2) {
+      double gq = 0;
+      for (size_t i = 0; i < probs.size(); ++i) {
+        if (i == a1 || i == a2) {
+          gq += probs[i][a1 == a2 ? 2 : 1];
+        } else {
+          gq += probs[i][0];
+        }
+      }
+      double pl = 10 * (-gq / 10);
+      pls.push_back(std::min(99, int(std::nearbyint(pl))));
+      if (!max_gq || gq > *max_gq) {
+        max_gq = gq;
+        result["GT"] = std::to_string(a1) + "/" + std::to_string(a2);
+        result["GQ"] = std::to_string(pls.back());
+      }
+    }
+  }
+  result["PL"] = absl::StrJoin(pls, ",");
+  return result;
+}
+
+vcf_region_genotyper::vcf_region_genotyper(const genotype_vcf_options& gt_options,
+                                           const assemble_options& options,
+                                           const genotype_vcf_format* format)
+    : m_gt_options(gt_options), m_options(options), m_format(format) {
+  CHECK(m_options.seqset);
+  CHECK(m_options.readmap);
+  CHECK(m_options.scaffold);
+}
+
+std::string vcf_region_genotyper::genotype(const vcf_region& region,
+                                           const std::vector<std::string>& lines) {
+  CHECK_EQ(region.scaffold_name, m_options.scaffold_name);
+  std::string out;
+
+  // Each step gets only the options "biograph coverage" gives it.
+  assemble_options ref_opts;
+  ref_opts.scaffold = m_options.scaffold;
+  ref_opts.scaffold_name = m_options.scaffold_name;
+
+  assemble_options cov_opts;
+  cov_opts.seqset = m_options.seqset;
+  cov_opts.readmap = m_options.readmap;
+  cov_opts.read_cov_max_reads_per_entry = m_gt_options.max_reads_per_entry;
+  cov_opts.max_coverage_paths = m_gt_options.max_coverage_paths;
+
+  assemble_options pair_opts;
+  pair_opts.seqset = m_options.seqset;
+  pair_opts.readmap = m_options.readmap;
+  pair_opts.min_pair_distance = m_gt_options.min_insert;
+  pair_opts.max_pair_distance = m_gt_options.max_insert;
+
+  // The pipeline is built in three parts, since place_pair_cov must
+  // be flushed explicitly after everything upstream is flushed.
+  pipeline_step_t tail = make_unique<assemble_lambda_output>(
+      [&](assembly_ptr a) {
+        genotype_allele* allele = get_allele(a.get());
+        CHECK(allele);
+        CHECK(a->align_count);
+        vcf_record_state* record = allele->record.get();
+        record->new_fmt["AC_LR"] = std::to_string(a->align_count->local_read_lens);
+        record->new_fmt["AC_AB"] = std::to_string(a->align_count->local_aligned_bases);
+        record->new_fmt["AC_TA"] = std::to_string(a->align_count->tot_aligned_bases);
+        out += m_format->format_record(record->fields, record->sample_field, record->new_fmt);
+      },
+      "genotype_vcf_output");
+  tail = make_unique<align_count>(assemble_options(), std::move(tail));
+  tail = make_unique<genotype_step>(std::move(tail));
+  tail = make_unique<pair_edge_cov>(assemble_options(), std::move(tail));
+  tail = make_unique<assemble_lambda_copy>(save_coverage_fields, std::move(tail),
+                                           "genotype_vcf_coverage");
+  tail = make_unique<allele_coverage_step>(m_options.readmap, std::move(tail));
+  if (m_gt_options.ideal_insert) {
+    place_pair_options popts;
+    popts.ideal_pair_distance = m_gt_options.ideal_insert;
+    popts.max_ambig = m_gt_options.placer_max_ambig;
+    tail = make_unique<place_pair_cov>(pair_opts, popts, std::move(tail));
+  } else {
+    tail = make_unique<pair_cov>(pair_opts, std::move(tail));
+  }
+  assemble_pipeline_interface* tail_input = tail.get();
+
+  pipeline_step_t mid = make_unique<assemble_lambda_output>(
+      [tail_input](assembly_ptr a) { tail_input->add(std::move(a)); }, "genotype_vcf_forward");
+  if (m_gt_options.filter_dup_align) {
+    mid = make_unique<filter_dup_align>(sort_block_for_align, std::move(mid));
+  }
+  mid = make_unique<read_cov>(cov_opts, std::move(mid));
+  aoffset_t pad_size = m_gt_options.max_insert + m_options.seqset->max_read_len();
+  mid = make_unique<add_ref>(ref_opts, pad_size, false /* whole ref */, 0 /* max len */,
+                             std::move(mid));
+  assemble_pipeline_interface* mid_input = mid.get();
+
+  pipeline_step_t head = make_unique<ref_trimmer>(
+      ref_opts, make_unique<assemble_lambda_output>(
+                    [mid_input](assembly_ptr a) {
+                      if (!a->matches_reference) {
+                        mid_input->add(std::move(a));
+                      }
+                    },
+                    "genotype_vcf_discard_ref"));
+
+  // Records that aren't genotyped are output afterwards with blank fields.
+  std::vector<std::shared_ptr<vcf_record_state>> skipped;
+  size_t asm_id = 0;
+  for (const std::string& line : lines) {
+    size_t id = asm_id++;
+    auto record = std::make_shared<vcf_record_state>();
+    record->fields = absl::StrSplit(line, '\t');
+    if (record->fields.size() < 5) {
+      throw io_exception("Bad VCF record: " + line);
+    }
+    aoffset_t pos = std::stol(record->fields[1]);
+    if (pos <= region.start || pos > region.limit) {
+      continue;
+    }
+    const std::string& ref = record->fields[3];
+    const std::string& alt_field = record->fields[4];
+    if (ref.find('N') != std::string::npos || alt_field.find('N') != std::string::npos) {
+      continue;
+    }
+    auto sample_column = m_format->sample_column();
+    if (sample_column && *sample_column < record->fields.size()) {
+      record->sample_field = record->fields[*sample_column];
+    }
+    record->fields.resize(std::min<size_t>(record->fields.size(), 9));
+    record->alts = absl::StrSplit(alt_field, ',');
+
+    bool pass = record->fields.size() > 6 && record->fields[6].find("PASS") != std::string::npos;
+    bool genotypable = std::all_of(record->alts.begin(), record->alts.end(), is_dna);
+    if ((m_gt_options.pass_only && !pass) || !genotypable) {
+      skipped.push_back(record);
+      continue;
+    }
+
+    record->alleles_remaining = record->alts.size();
+    record->edge_covs.resize(record->alts.size());
+    aoffset_t left = pos - 1;
+    aoffset_t right = left + ref.size();
+    for (size_t alt_index = 0; alt_index != record->alts.size(); ++alt_index) {
+      const std::string& alt = record->alts[alt_index];
+      assembly_ptr a = make_unique<assembly>(left, right, dna_sequence(alt), id);
+      genotype_allele allele;
+      allele.record = record;
+      allele.alt_index = alt_index;
+      a->user_data = std::move(allele);
+      head->add(std::move(a));
+    }
+  }
+
+  head.reset();
+  mid.reset();
+  tail->flush();
+  tail.reset();
+
+  for (const auto& record : skipped) {
+    out += m_format->format_record(record->fields, record->sample_field, record->new_fmt);
+  }
+  return out;
+}
+
+}  // namespace variants
@@ -0,0 +1,153 @@
+#pragma once
+
+// Genotypes the variants in an existing VCF against a BioGraph.
+//
+// This is a native version of the "biograph coverage" tool.  Each
+// record's alleles are turned into assemblies, run through the same
+// coverage pipeline (read_cov, pair_cov, pair_edge_cov, align_count)
+// and annotated with the same FORMAT fields.
+
+#include <htslib/hts.h>
+#include <htslib/tbx.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "modules/variants/assemble.h"
+
+namespace variants {
+
+struct genotype_vcf_options {
+  // Pair distance bounds used when calculating pair coverage.
+  aoffset_t min_insert = 200;
+  aoffset_t max_insert = 1000;
+
+  // If nonzero, maximum number of reads that each seqset entry can
+  // supply for read coverage.
+  unsigned max_reads_per_entry = 0;
+  size_t max_coverage_paths = 3000;
+
+  // If true, count each read only once per local area.
+  bool filter_dup_align = false;
+
+  // If nonzero, place paired reads only once, optimizing for closest
+  // to this insert size.
+  aoffset_t ideal_insert = 0;
+  unsigned placer_max_ambig = 15;
+
+  // If true, only PASS records are genotyped; other records are
+  // output with blank genotype fields.
+  bool pass_only = false;
+};
+
+struct vcf_region {
+  std::string scaffold_name;
+  aoffset_t start = 0;
+  aoffset_t limit = 0;
+
+  bool operator==(const vcf_region& rhs) const {
+    return scaffold_name == rhs.scaffold_name && start == rhs.start && limit == rhs.limit;
+  }
+  friend std::ostream& operator<<(std::ostream& os, const vcf_region& r) {
+    return os << r.scaffold_name << ":" << r.start << "-" << r.limit;
+  }
+};
+
+// Reads records from a BGZF compressed VCF with a tabix index.  Each
+// reader loads its own index and file handle; use one per thread.
+class tabix_vcf_reader {
+ public:
+  tabix_vcf_reader(const std::string& path);
+  ~tabix_vcf_reader();
+
+  // Returns all header lines, including the "#CHROM" line.
+  std::string header();
+
+  // Returns the records overlapping [start, limit), without trailing
+  // newlines.
+  std::vector<std::string> query(const std::string& scaffold_name, aoffset_t start,
+                                 aoffset_t limit);
+
+ private:
+  std::string m_path;
+  htsFile* m_fp = nullptr;
+  tbx_t* m_tbx = nullptr;
+};
+
+// Splits a region into microcontigs: groups of records separated by
+// at least min_clearance bases, padded by half the clearance on each
+// side.  This matches the splitting done by "biograph coverage".
+std::vector<vcf_region> find_microcontigs(tabix_vcf_reader* reader, const vcf_region& region,
+                                          aoffset_t min_clearance, aoffset_t min_contig_size);
+
+// Returns a digest of the contigs listed in a VCF header, and the
+// common name of the reference if known.  This matches "biograph
+// refhash".
+std::string vcf_refhash_digest(const std::string& header);
+std::string vcf_refhash_name(const std::string& digest);
+
+// Rewrites headers and records to hold the genotype fields.
+class genotype_vcf_format {
+ public:
+  // FORMAT fields always output, in order.
+  static const std::vector<std::string> k_formats;
+
+  genotype_vcf_format(const std::string& template_header, const std::string& sample,
+                      bool strip_fmt);
+
+  // Returns the header to output.  "source_line" is the "##source="
+  // line, without a trailing newline.
+  std::string make_header(const std::string& source_line) const;
+
+  // Returns the index of the column in the template VCF holding the
+  // sample being genotyped, if present.
+  boost::optional<size_t> sample_column() const { return m_sample_column; }
+
+  // Returns the given record with the sample field replaced by the
+  // values in new_fmt.  Fields not present in new_fmt are output as
+  // their defaults.
+  std::string format_record(const std::vector<std::string>& fields,
+                            const std::string& sample_field,
+                            const std::map<std::string, std::string>& new_fmt) const;
+
+  const std::vector<std::string>& formats() const { return m_formats; }
+
+ private:
+  std::vector<std::string> m_header_lines;
+  std::vector<std::string> m_chrom_fields;
+  std::string m_sample;
+  boost::optional<size_t> m_sample_column;
+  std::vector<std::string> m_formats;
+  std::map<std::string, std::string> m_defaults;
+};
+
+// Genotypes the records in a region of a single scaffold.
+class vcf_region_genotyper {
+ public:
+  // "options" must have seqset, readmap, scaffold, and scaffold_name set.
+  vcf_region_genotyper(const genotype_vcf_options& gt_options, const assemble_options& options,
+                       const genotype_vcf_format* format);
+
+  // Genotypes the records in "lines" (as returned by a tabix query
+  // for the region) that start inside the region.  Returns the
+  // formatted records, each with a trailing newline.
+  std::string genotype(const vcf_region& region, const std::vector<std::string>& lines);
+
+ private:
+  genotype_vcf_options m_gt_options;
+  assemble_options m_options;
+  const genotype_vcf_format* m_format = nullptr;
+};
+
+// Sorts a block of assemblies for resolving ambiguously mapped reads
+// with filter_dup_align; earlier in the block is higher priority.
+std::vector<assembly_ptr> sort_block_for_align(std::vector<assembly_ptr> block);
+
+// Calculates the genotype fields (GT, GQ, PL, DP, AD, and RC) for a
+// record, given the pair edge coverage for each of its alleles in
+// ALT order.
+std::map<std::string, std::string> calc_genotype_fields(
+    const std::vector<edge_coverage_t>& allele_edge_covs);
+
+}  // namespace variants
@@ -0,0 +1,327 @@
+#include "modules/variants/genotype_vcf.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include "absl/strings/str_split.h"
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/variants/assemble_testutil.h"
+#include "modules/variants/bgzf_vcf_writer.h"
+#include "modules/test/test_utils.h"
+
+namespace variants {
+
+using namespace testing;
+using namespace dna_testutil;
+
+namespace {
+
+const char k_template_header[] =
+    "##fileformat=VCFv4.1\n"
+    "##contig=<ID=1,length=1000>\n"
+    "##contig=<ID=2,length=2000>\n"
+    "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Old genotype\">\n"
+    "##FORMAT=<ID=OG,Number=1,Type=String,Description=\"Original field\">\n"
+    "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tOTHER\tSAMPLE\n";
+
+std::vector<std::string> split_fields(const std::string& line) {
+  std::string trimmed = line;
+  if (!trimmed.empty() && trimmed.back() == '\n') {
+    trimmed.pop_back();
+  }
+  return absl::StrSplit(trimmed, '\t');
+}
+
+// Returns the value of the given FORMAT field in a formatted record.
+std::string sample_value(const std::string& record, const std::string& tag) {
+  std::vector<std::string> fields = split_fields(record);
+  CHECK_EQ(fields.size(), 10) << record;
+  std::vector<std::string> fmt = absl::StrSplit(fields[8], ':');
+  std::vector<std::string> values = absl::StrSplit(fields[9], ':');
+  CHECK_EQ(fmt.size(), values.size()) << record;
+  for (size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] == tag) {
+      return values[i];
+    }
+  }
+  return "(missing)";
+}
+
+read_id_set read_ids(std::initializer_list<uint32_t> ids) {
+  read_id_set result;
+  for (uint32_t id : ids) {
+    result.insert(id);
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(genotype_vcf_test, refhash) {
+  // sha256 of "1:1000\n2:2000\n"
+  EXPECT_EQ(vcf_refhash_digest(k_template_header),
+            "90eb5ef061c5efb5200f7427d5668bef579b830491d81fc52c99b9c8f61ccad4");
+  EXPECT_EQ(vcf_refhash_name(vcf_refhash_digest("#CHROM\n")), "no_contigs_present");
+  EXPECT_EQ(vcf_refhash_name("90eb5ef061c5efb5200f7427d5668bef579b830491d81fc52c99b9c8f61ccad4"),
+            "unknown-90eb5ef0");
+}
+
+TEST(genotype_vcf_test, header) {
+  genotype_vcf_format fmt(k_template_header, "SAMPLE", false /* strip fmt */);
+  EXPECT_THAT(fmt.sample_column(), Optional(10));
+  EXPECT_THAT(fmt.formats(),
+              ElementsAre("GT", "GQ", "PL", "DP", "AD", "AC_LR", "AC_AB", "AC_TA", "OG"));
+
+  std::string header = fmt.make_header("##source=test");
+  EXPECT_THAT(header, HasSubstr("Original field"));
+  EXPECT_THAT(header, Not(HasSubstr("Old genotype")));
+  EXPECT_THAT(header, HasSubstr("##source=test\n##refhash=90eb5ef0"));
+  EXPECT_THAT(header, EndsWith("\tFORMAT\tSAMPLE\n"));
+
+  genotype_vcf_format stripped(k_template_header, "NEW", true /* strip fmt */);
+  EXPECT_EQ(stripped.sample_column(), boost::none);
+  EXPECT_THAT(stripped.formats(),
+              ElementsAre("GT", "GQ", "PL", "DP", "AD", "AC_LR", "AC_AB", "AC_TA"));
+  EXPECT_THAT(stripped.make_header("##source=test"), EndsWith("\tFORMAT\tNEW\n"));
+}
+
+TEST(genotype_vcf_test, format_record) {
+  genotype_vcf_format fmt(k_template_header, "SAMPLE", false /* strip fmt */);
+  std::vector<std::string> fields =
+      split_fields("1\t10\t.\tA\tG\t50\tPASS\t.\tGT:OG\t0/0:x\t1/1:orig");
+
+  EXPECT_EQ(fmt.format_record(fields, "1/1:orig", {{"GT", "0/1"}, {"AC_LR", "150"}}),
+            "1\t10\t.\tA\tG\t50\tPASS\t.\tGT:GQ:PL:DP:AD:AC_LR:AC_AB:AC_TA:OG\t"
+            "0/1:.:.:.:.:150:.:.:orig\n");
+  EXPECT_EQ(fmt.format_record(fields, ".", {}),
+            "1\t10\t.\tA\tG\t50\tPASS\t.\tGT:GQ:PL:DP:AD:AC_LR:AC_AB:AC_TA:OG\t"
+            "./.:.:.:.:.:.:.:.:.\n");
+}
+
+TEST(genotype_vcf_test, genotype_no_coverage) {
+  auto fields = calc_genotype_fields({edge_coverage_t(), edge_coverage_t()});
+  EXPECT_EQ(fields["GT"], "./.");
+  EXPECT_EQ(fields["GQ"], ".");
+  EXPECT_EQ(fields["PL"], ".");
+  EXPECT_EQ(fields["RC"], ".");
+  EXPECT_EQ(fields["DP"], "0");
+  EXPECT_EQ(fields["AD"], "0,0,0");
+}
+
+TEST(genotype_vcf_test, genotype_het) {
+  edge_coverage_t ec;
+  ec.reference_start = read_ids({1, 2});
+  ec.reference_end = read_ids({2, 3});
+  ec.variant_start = read_ids({4, 5});
+  ec.variant_end = read_ids({6});
+  auto fields = calc_genotype_fields({ec});
+  EXPECT_EQ(fields["GT"], "0/1");
+  EXPECT_EQ(fields["GQ"], "1");
+  EXPECT_EQ(fields["PL"], "5,1,5");
+  EXPECT_EQ(fields["DP"], "6");
+  EXPECT_EQ(fields["AD"], "3,3");
+  EXPECT_EQ(fields["RC"], "0");
+}
+
+TEST(genotype_vcf_test, genotype_hom_alt) {
+  edge_coverage_t ec;
+  ec.variant_start = read_ids({1, 2, 3});
+  ec.variant_end = read_ids({3, 4, 5});
+  auto fields = calc_genotype_fields({ec});
+  EXPECT_EQ(fields["GT"], "1/1");
+  EXPECT_EQ(fields["GQ"], "0");
+  EXPECT_EQ(fields["PL"], "13,3,0");
+  EXPECT_EQ(fields["AD"], "0,5");
+}
+
+TEST(genotype_vcf_test, genotype_redundant) {
+  // Read 7 supports both alleles and the reference, so it only counts
+  // towards the alleles.
+  edge_coverage_t ec1;
+  ec1.reference_start = read_ids({1, 2, 7});
+  ec1.variant_start = read_ids({3, 4, 7});
+  edge_coverage_t ec2;
+  ec2.variant_end = read_ids({7});
+  auto fields = calc_genotype_fields({ec1, ec2});
+  EXPECT_EQ(fields["AD"], "2,3,1");
+  EXPECT_EQ(fields["GT"], "0/1");
+  EXPECT_EQ(fields["GQ"], "2");
+  EXPECT_EQ(fields["PL"], "7,2,4,5,3,10");
+  EXPECT_EQ(fields["RC"], "1");
+}
+
+// golden/genotype_vcf_gtanno.vcf holds the genotype fields that the
+// Python coverage tool's GTAnno produces for the edge coverage given
+// in each record's EC INFO field.
+TEST(genotype_vcf_test, genotype_matches_python) {
+  std::ifstream in("golden/genotype_vcf_gtanno.vcf");
+  ASSERT_TRUE(in.good());
+  std::string line;
+  size_t records = 0;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::vector<std::string> fields = split_fields(line);
+    ASSERT_EQ(10, fields.size()) << line;
+    ASSERT_THAT(fields[7], StartsWith("EC=")) << line;
+
+    std::vector<edge_coverage_t> covs;
+    for (absl::string_view allele : absl::StrSplit(fields[7].substr(3), ',')) {
+      std::vector<std::string> parts = absl::StrSplit(allele, '|');
+      ASSERT_EQ(4, parts.size()) << line;
+      std::vector<read_id_set> sets;
+      for (const std::string& part : parts) {
+        read_id_set ids;
+        if (part != ".") {
+          for (absl::string_view id : absl::StrSplit(part, '/')) {
+            ids.insert(std::stoul(std::string(id)));
+          }
+        }
+        sets.push_back(std::move(ids));
+      }
+      edge_coverage_t ec;
+      ec.reference_start = sets[0];
+      ec.reference_end = sets[1];
+      ec.variant_start = sets[2];
+      ec.variant_end = sets[3];
+      covs.push_back(std::move(ec));
+    }
+    ASSERT_EQ(covs.size(), std::vector<std::string>(absl::StrSplit(fields[4], ',')).size())
+        << line;
+
+    auto calculated = calc_genotype_fields(covs);
+    std::vector<std::string> tags = absl::StrSplit(fields[8], ':');
+    std::vector<std::string> expected = absl::StrSplit(fields[9], ':');
+    ASSERT_EQ(tags.size(), expected.size()) << line;
+    for (size_t i = 0; i < tags.size(); ++i) {
+      EXPECT_EQ(expected[i], calculated[tags[i]]) << tags[i] << " in " << line;
+    }
+    ++records;
+  }
+  EXPECT_GT(records, 10);
+}
+
+class genotype_vcf_microcontig_test : public Test {
+ public:
+  void write_vcf(const std::vector<std::pair<int, std::string>>& records) {
+    m_path = make_path("genotype_vcf_test.vcf.gz");
+    bgzf_vcf_writer w(m_path, k_template_header);
+    for (const auto& r : records) {
+      w.write_record(printstring("1\t%d\t.\t%s\tG\t50\tPASS\t.\tGT\t0/1\t0/1\n", r.first,
+                                 r.second.c_str()));
+    }
+    w.close();
+  }
+
+  vcf_region region(const std::string& name, aoffset_t start, aoffset_t limit) {
+    vcf_region r;
+    r.scaffold_name = name;
+    r.start = start;
+    r.limit = limit;
+    return r;
+  }
+
+  std::string m_path;
+};
+
+TEST_F(genotype_vcf_microcontig_test, split) {
+  write_vcf({{10, "A"}, {20, "AAAAA"}, {200, "A"}, {210, "A"}, {500, "A"}});
+  tabix_vcf_reader reader(m_path);
+  EXPECT_THAT(reader.header(), HasSubstr("#CHROM"));
+  EXPECT_THAT(reader.query("1", 0, 1000), SizeIs(5));
+  EXPECT_THAT(reader.query("2", 0, 1000), IsEmpty());
+  EXPECT_THAT(reader.query("nonexistent", 0, 1000), IsEmpty());
+
+  EXPECT_THAT(find_microcontigs(&reader, region("1", 0, 1000), 100 /* clearance */,
+                                10 /* min contig size */),
+              ElementsAre(region("1", 0, 73), region("1", 149, 259), region("1", 449, 549)));
+
+  // Contigs too small to split are merged with their neighbors.
+  EXPECT_THAT(find_microcontigs(&reader, region("1", 0, 1000), 100 /* clearance */,
+                                150 /* min contig size */),
+              ElementsAre(region("1", 0, 259), region("1", 449, 549)));
+
+  EXPECT_THAT(find_microcontigs(&reader, region("2", 0, 1000), 100, 10), IsEmpty());
+}
+
+class genotype_vcf_pipeline_test : public assemble_test {
+ public:
+  genotype_vcf_pipeline_test() {
+    m_gt_options.min_insert = 1;
+    m_options.scaffold_name = "1";
+  }
+
+  std::string genotype(const std::vector<std::string>& records) {
+    std::string header =
+        "##fileformat=VCFv4.1\n"
+        "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n";
+    m_format.emplace(header, "SAMPLE", false /* strip fmt */);
+    vcf_region_genotyper genotyper(m_gt_options, m_options, &*m_format);
+    vcf_region r;
+    r.scaffold_name = "1";
+    r.start = 0;
+    r.limit = m_scaffold.end_pos();
+    return genotyper.genotype(r, records);
+  }
+
+  std::string base_at(aoffset_t pos) {
+    dna_slice slice = m_scaffold.subscaffold(pos, 1).get_simple();
+    return dna_sequence(slice.begin(), slice.end()).as_string();
+  }
+
+  genotype_vcf_options m_gt_options;
+  boost::optional<genotype_vcf_format> m_format;
+};
+
+TEST_F(genotype_vcf_pipeline_test, insert) {
+  use_ref_parts({{0, tseq("abcdefghijklmnopqrstuvwxyz")}});
+  use_paired_reads({{tseq("bcdefgh"), tseq_rc("uvwxyz")},
+                    {tseq("abcde") + dna_T + tseq("fghi"), tseq_rc("tuvwxy")}});
+
+  // 1-based position of the last base of "abcde"
+  int pos = tseq("abcde").size();
+  std::string ref = base_at(pos - 1);
+  std::string out =
+      genotype({printstring("1\t%d\t.\t%s\t%sT\t50\tPASS\t.\tGT\t1/1", pos, ref.c_str(),
+                            ref.c_str()),
+                printstring("1\t%d\t.\tN\tNT\t50\tPASS\t.\tGT\t1/1", pos + 5)});
+
+  std::vector<std::string> lines = absl::StrSplit(out, '\n', absl::SkipEmpty());
+  ASSERT_THAT(lines, SizeIs(1)) << out;
+  EXPECT_THAT(lines[0], StartsWith(printstring("1\t%d\t.\t%s\t%sT\t50\tPASS\t.\t", pos,
+                                               ref.c_str(), ref.c_str())));
+  EXPECT_EQ(sample_value(lines[0], "GT"), "0/1") << out;
+  EXPECT_EQ(sample_value(lines[0], "AD"), "1,1") << out;
+  EXPECT_EQ(sample_value(lines[0], "DP"), "2") << out;
+  EXPECT_EQ(sample_value(lines[0], "GQ"), "1") << out;
+  EXPECT_EQ(sample_value(lines[0], "PL"), "2,1,2") << out;
+  EXPECT_NE(sample_value(lines[0], "AC_LR"), ".") << out;
+}
+
+TEST_F(genotype_vcf_pipeline_test, pass_only) {
+  use_ref_parts({{0, tseq("abcdefghijklmnopqrstuvwxyz")}});
+  use_paired_reads({{tseq("bcdefgh"), tseq_rc("uvwxyz")},
+                    {tseq("abcde") + dna_T + tseq("fghi"), tseq_rc("tuvwxy")}});
+  m_gt_options.pass_only = true;
+
+  int pos = tseq("abcde").size();
+  std::string ref = base_at(pos - 1);
+  std::string out =
+      genotype({printstring("1\t%d\t.\t%s\t%sT\t50\tlowq\t.\tGT\t1/1", pos, ref.c_str(),
+                            ref.c_str()),
+                printstring("1\t%d\t.\t%s\t<DEL>\t50\tPASS\t.\tGT\t1/1", pos, ref.c_str())});
+
+  // Records that aren't genotyped are each output once, with blank
+  // genotype fields.
+  std::vector<std::string> lines = absl::StrSplit(out, '\n', absl::SkipEmpty());
+  ASSERT_THAT(lines, SizeIs(2)) << out;
+  for (const auto& line : lines) {
+    EXPECT_EQ(sample_value(line, "GT"), "./.") << line;
+    EXPECT_EQ(sample_value(line, "AD"), ".") << line;
+  }
+}
+
+}  // namespace variants
@@ -0,0 +1,137 @@
+#include "modules/variants/pipeline_mem.h"
+#include "base/base.h"
+#include "modules/io/log.h"
+#include "modules/io/utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+namespace variants {
+
+constexpr int pipeline_mem_governor::k_report_interval_secs;
+constexpr size_t pipeline_mem_governor::k_min_report_bytes;
+
+namespace {
+
+std::string mib_str(size_t bytes) { return printstring("%.1f MiB", bytes / (1024. * 1024)); }
+
+}  // namespace
+
+void pipeline_mem_governor::consumer::add(size_t bytes) {
+  m_bytes += bytes;
+  m_governor->m_usage += bytes;
+}
+
+void pipeline_mem_governor::consumer::remove(size_t bytes) {
+  DCHECK_GE(m_bytes.load(), bytes) << m_description;
+  m_bytes -= bytes;
+  m_governor->m_usage -= bytes;
+  m_governor->note_removed();
+}
+
+pipeline_mem_governor& pipeline_mem_governor::global() {
+  static pipeline_mem_governor g;
+  return g;
+}
+
+void pipeline_mem_governor::set_budget(size_t budget_bytes) {
+  std::lock_guard<std::mutex> l(m_mu);
+  m_budget = budget_bytes;
+  m_cv.notify_all();
+}
+
+pipeline_mem_governor::consumer* pipeline_mem_governor::get_consumer(
+    const std::string& description) {
+  std::lock_guard<std::mutex> l(m_mu);
+  auto& c = m_consumers[description];
+  if (!c) {
+    c.reset(new consumer(this, description));
+  }
+  return c.get();
+}
+
+std::vector<std::pair<std::string, size_t>> pipeline_mem_governor::usage_by_consumer() const {
+  std::lock_guard<std::mutex> l(m_mu);
+  return usage_by_consumer_locked();
+}
+
+std::vector<std::pair<std::string, size_t>> pipeline_mem_governor::usage_by_consumer_locked()
+    const {
+  std::vector<std::pair<std::string, size_t>> result;
+  for (const auto& c : m_consumers) {
+    size_t bytes = c.second->bytes();
+    if (bytes) {
+      result.emplace_back(c.first, bytes);
+    }
+  }
+  std::stable_sort(result.begin(), result.end(),
+                   [](const std::pair<std::string, size_t>& a,
+                      const std::pair<std::string, size_t>& b) { return a.second > b.second; });
+  return result;
+}
+
+std::string pipeline_mem_governor::usage_report() const {
+  std::lock_guard<std::mutex> l(m_mu);
+  return usage_report_locked();
+}
+
+std::string pipeline_mem_governor::usage_report_locked() const {
+  std::stringstream out;
+  out << mib_str(usage()) << " buffered in pipelines";
+  if (m_budget) {
+    out << " (budget " << mib_str(m_budget) << ")";
+  }
+  size_t small_bytes = 0;
+  for (const auto& c : usage_by_consumer_locked()) {
+    if (c.second < k_min_report_bytes) {
+      small_bytes += c.second;
+      continue;
+    }
+    out << "\n  " << c.first << ": " << mib_str(c.second);
+  }
+  if (small_bytes) {
+    out << "\n  Other: " << mib_str(small_bytes);
+  }
+  return out.str();
+}
+
+void pipeline_mem_governor::note_removed() {
+  if (!m_waiters || over_budget()) {
+    return;
+  }
+  std::lock_guard<std::mutex> l(m_mu);
+  m_cv.notify_all();
+}
+
+void pipeline_mem_governor::start_work() {
+  std::unique_lock<std::mutex> l(m_mu);
+  if (over_budget() && m_active_work) {
+    ++m_throttle_count;
+    ++m_waiters;
+    SPLOG("Pausing new work until in-progress work releases memory: %s",
+          usage_report_locked().c_str());
+    while (over_budget() && m_active_work) {
+      if (m_cv.wait_for(l, std::chrono::seconds(k_report_interval_secs)) ==
+          std::cv_status::timeout) {
+        SPLOG("Still waiting for memory: %s", usage_report_locked().c_str());
+      }
+    }
+    --m_waiters;
+  }
+  ++m_active_work;
+}
+
+void pipeline_mem_governor::finish_work() {
+  std::lock_guard<std::mutex> l(m_mu);
+  CHECK_GT(m_active_work, 0);
+  --m_active_work;
+  m_cv.notify_all();
+}
+
+size_t pipeline_mem_governor::throttle_count() const {
+  std::lock_guard<std::mutex> l(m_mu);
+  return m_throttle_count;
+}
+
+}  // namespace variants
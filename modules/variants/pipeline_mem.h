@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace variants {
+
+// pipeline_mem_governor keeps track of how much memory is held by
+// assemblies buffered in pipeline steps, and throttles the start of
+// new work while that exceeds a budget.  This keeps a few pathological
+// regions from growing the process without bound; work that's already
+// in progress is allowed to finish and release its buffers.
+class pipeline_mem_governor {
+ public:
+  // Memory held by all pipeline steps with the same description.
+  class consumer {
+   public:
+    void add(size_t bytes);
+    void remove(size_t bytes);
+
+    const std::string& description() const { return m_description; }
+    size_t bytes() const { return m_bytes; }
+
+   private:
+    friend class pipeline_mem_governor;
+    consumer(pipeline_mem_governor* governor, const std::string& description)
+        : m_governor(governor), m_description(description) {}
+
+    pipeline_mem_governor* const m_governor;
+    const std::string m_description;
+    std::atomic<size_t> m_bytes{0};
+  };
+
+  pipeline_mem_governor() = default;
+  pipeline_mem_governor(const pipeline_mem_governor&) = delete;
+  pipeline_mem_governor& operator=(const pipeline_mem_governor&) = delete;
+
+  // Governor used by sorted_output_pipeline_step and trace_ref.
+  static pipeline_mem_governor& global();
+
+  // Sets the maximum number of buffered bytes before new work is
+  // throttled.  0 means no limit.
+  void set_budget(size_t budget_bytes);
+  size_t budget() const { return m_budget; }
+
+  // Returns the consumer for the given description, creating it if
+  // necessary.  The returned consumer lives as long as this governor.
+  consumer* get_consumer(const std::string& description);
+
+  // Total bytes currently buffered by all consumers.
+  size_t usage() const { return m_usage; }
+  bool over_budget() const { return m_budget && m_usage > m_budget; }
+
+  // Returns consumers currently holding memory, largest first.
+  std::vector<std::pair<std::string, size_t>> usage_by_consumer() const;
+  // Returns a human readable summary of usage_by_consumer.
+  std::string usage_report() const;
+
+  // Called before and after each new work item.  start_work blocks
+  // while over budget, unless there's no other work in progress to
+  // release memory.
+  void start_work();
+  void finish_work();
+
+  // Number of times start_work has had to wait.
+  size_t throttle_count() const;
+
+ private:
+  // Wakes up any waiting workers if we've dropped back under budget.
+  void note_removed();
+  std::vector<std::pair<std::string, size_t>> usage_by_consumer_locked() const;
+  std::string usage_report_locked() const;
+
+  // Report which steps hold memory at most this often while throttling.
+  static constexpr int k_report_interval_secs = 60;
+  // Only itemize consumers holding at least this many bytes.
+  static constexpr size_t k_min_report_bytes = 1024 * 1024;
+
+  std::atomic<size_t> m_budget{0};
+  std::atomic<size_t> m_usage{0};
+  std::atomic<size_t> m_waiters{0};
+
+  mutable std::mutex m_mu;
+  std::condition_variable m_cv;
+  std::map<std::string, std::unique_ptr<consumer>> m_consumers;
+  size_t m_active_work = 0;
+  size_t m_throttle_count = 0;
+};
+
+}  // namespace variants
@@ -0,0 +1,110 @@
+#include "modules/variants/pipeline_mem.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace testing;
+using namespace variants;
+
+TEST(pipeline_mem_test, tracks_usage) {
+  pipeline_mem_governor g;
+  auto* a = g.get_consumer("a");
+  auto* b = g.get_consumer("b");
+  EXPECT_EQ(a, g.get_consumer("a"));
+
+  a->add(100);
+  b->add(300);
+  a->add(50);
+  EXPECT_EQ(450, g.usage());
+  EXPECT_THAT(g.usage_by_consumer(), ElementsAre(Pair("b", 300), Pair("a", 150)));
+
+  b->remove(300);
+  EXPECT_EQ(150, g.usage());
+  EXPECT_THAT(g.usage_by_consumer(), ElementsAre(Pair("a", 150)));
+  EXPECT_THAT(g.usage_report(), HasSubstr("buffered in pipelines"));
+}
+
+TEST(pipeline_mem_test, unlimited_by_default) {
+  pipeline_mem_governor g;
+  g.get_consumer("a")->add(1ULL << 40);
+  EXPECT_FALSE(g.over_budget());
+  g.start_work();
+  g.start_work();
+  g.finish_work();
+  g.finish_work();
+  EXPECT_EQ(0, g.throttle_count());
+  g.get_consumer("a")->remove(1ULL << 40);
+}
+
+TEST(pipeline_mem_test, never_blocks_without_other_work) {
+  pipeline_mem_governor g;
+  g.set_budget(100);
+  g.get_consumer("a")->add(1000);
+  EXPECT_TRUE(g.over_budget());
+  // Nothing else is in progress to release memory, so this must proceed.
+  g.start_work();
+  g.finish_work();
+  EXPECT_EQ(0, g.throttle_count());
+  g.get_consumer("a")->remove(1000);
+}
+
+TEST(pipeline_mem_test, throttles_until_released) {
+  pipeline_mem_governor g;
+  g.set_budget(100);
+  auto* a = g.get_consumer("a");
+
+  g.start_work();
+  a->add(1000);
+
+  std::atomic<bool> started{false};
+  std::thread waiter([&]() {
+    g.start_work();
+    started = true;
+    g.finish_work();
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(started);
+
+  // Still over budget.
+  a->remove(500);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(started);
+
+  a->remove(450);
+  waiter.join();
+  EXPECT_TRUE(started);
+  EXPECT_EQ(1, g.throttle_count());
+  g.finish_work();
+  a->remove(50);
+}
+
+TEST(pipeline_mem_test, resumes_when_work_finishes) {
+  pipeline_mem_governor g;
+  g.set_budget(100);
+  auto* a = g.get_consumer("a");
+
+  g.start_work();
+  a->add(1000);
+
+  std::atomic<bool> started{false};
+  std::thread waiter([&]() {
+    g.start_work();
+    started = true;
+    g.finish_work();
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(started);
+
+  // Memory that isn't released by work in progress shouldn't hold up
+  // new work forever.
+  g.finish_work();
+  waiter.join();
+  EXPECT_TRUE(started);
+  a->remove(1000);
+}
@@ -2,6 +2,8 @@
 #include "modules/variants/scaffold.h"
 #include "tools/build_stamp.h"
 
+#include <stdarg.h>
+
 namespace variants {
 
 namespace {
@@ -11,6 +13,29 @@ const char* remove_beginning_newline(const char* str) {
   return str + 1;
 }
 
+// Appends formatted output to "out" without allocating a temporary
+// string for short fields.
+void append_printf(std::string& out, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+void append_printf(std::string& out, const char* format, ...) {
+  char buf[64];
+  va_list ap;
+  va_start(ap, format);
+  int len = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  CHECK_GE(len, 0);
+  if (size_t(len) < sizeof(buf)) {
+    out.append(buf, len);
+    return;
+  }
+  size_t old_size = out.size();
+  out.resize(old_size + len + 1);
+  va_start(ap, format);
+  vsnprintf(&out[old_size], len + 1, format, ap);
+  va_end(ap);
+  out.resize(old_size + len);
+}
+
 }
 
 void ploidless_vcf_export::on_assembly(assembly_ptr a) {
@@ -27,9 +52,13 @@ void ploidless_vcf_export::on_assembly(assembly_ptr a) {
     min_pair_depth = container_min(a->pair_coverage);
   }
 
-  std::string var_seq = a->seq.as_string();
-  std::string ref_seq =
-      m_options.scaffold->subscaffold_str(a->left_offset, a->right_offset - a->left_offset);
+  std::string& var_seq = m_var_seq;
+  var_seq.clear();
+  for (dna_base b : a->seq) {
+    var_seq.push_back(char(b));
+  }
+  std::string& ref_seq = m_ref_seq;
+  ref_seq = m_options.scaffold->subscaffold_str(a->left_offset, a->right_offset - a->left_offset);
 
   aoffset_t left_offset = a->left_offset;
 
@@ -40,65 +69,64 @@ void ploidless_vcf_export::on_assembly(assembly_ptr a) {
       ref_seq += base_to_add;
     } else {
       std::string base_to_add = m_options.scaffold->subscaffold_str(a->left_offset - 1, 1);
-      var_seq = base_to_add + var_seq;
-      ref_seq = base_to_add + ref_seq;
+      var_seq.insert(0, base_to_add);
+      ref_seq.insert(0, base_to_add);
       --left_offset;
     }
   }
 
-  std::string unphased_genotype;
-  std::string phased_genotype;
-  std::string filter_str;
+  const char* unphased_genotype = nullptr;
+  const char* phased_genotype = nullptr;
   switch (a->strand_count) {
     case 0:
-      filter_str = "FILTERED";
-      unphased_genotype = "0/1";
-      phased_genotype = "0|1";
-      break;
     case 1:
-      filter_str = "PASS";
       unphased_genotype = "0/1";
       phased_genotype = "0|1";
       break;
     case 2:
-      filter_str = "PASS";
       unphased_genotype = "1/1";
       phased_genotype = "1|1";
       break;
     default:
       CHECK_LE(a->strand_count, 2) << "Outputting VCF with more than 2 strands not supported";
   }
-  mem_io line("", track_alloc("ploidless_vcf_export:line"));
+
+  // The line buffer is reused between records to avoid allocating for
+  // each record.
+  std::string& line = m_line;
+  line.clear();
 
   //__________________________________________________________________
   //				VCF Mandatory fixed fields
   // #CHROM
-  line.print("%s\t", m_scaffold_name.c_str());
+  line += m_scaffold_name;
+  line += '\t';
   // POS
-  line.print("%d\t", left_offset + 1 /* VCFs are 1-indexed */);
+  append_printf(line, "%d\t", left_offset + 1 /* VCFs are 1-indexed */);
   // ID
-  line.print(".\t");
+  line += ".\t";
   // REF
-  line.print("%s\t", ref_seq.c_str());
+  line += ref_seq;
+  line += '\t';
   // ALT
-  line.print("%s\t", var_seq.c_str());
+  line += var_seq;
+  line += '\t';
   // QUAL
-  line.print("%d\t", 100);
+  append_printf(line, "%d\t", 100);
   // FILTER
-  line.print("PASS\t");
+  line += "PASS\t";
 
   //__________________________________________________________________
   //				INFO
 
   // Always output NS to avoid a potentially empty INFO column.
-  line.print("NS=1");
+  line += "NS=1";
 
   // Optional AIDs
   if (m_options.output_assembly_ids) {
-    line.print(";AID=");
-    line.print("%ld", a->assembly_id);
+    append_printf(line, ";AID=%ld", a->assembly_id);
     for (size_t i = 0; i < a->merged_assembly_ids.size(); i++) {
-      line.print(",%ld", a->merged_assembly_ids[i]);
+      append_printf(line, ",%ld", a->merged_assembly_ids[i]);
     }
   }
   // SVLEN and SVTYPE
@@ -106,26 +134,27 @@ void ploidless_vcf_export::on_assembly(assembly_ptr a) {
       ref_seq.size() >= m_options.vcf_sv_size_threshold) {
     aoffset_t right_offset = left_offset + ref_seq.size();
     aoffset_t rightmost_ref_base = right_offset - 1;
-    line.print(";END=%d", rightmost_ref_base + 1 /* VCFs are 1-indexed */);
+    append_printf(line, ";END=%d", rightmost_ref_base + 1 /* VCFs are 1-indexed */);
     int svlen = int(var_seq.size()) - int(ref_seq.size());
-    line.print(";SVLEN=%d", svlen);
+    append_printf(line, ";SVLEN=%d", svlen);
     if (svlen < 0) {
-      line.print(";SVTYPE=DEL");
+      line += ";SVTYPE=DEL";
     } else if (svlen > 0) {
-      line.print(";SVTYPE=INS");
+      line += ";SVTYPE=INS";
     } else {
-      line.print(";SVTYPE=CPX");
+      line += ";SVTYPE=CPX";
     }
   }
   if (m_options.use_bidir_tracer) {
-    line.print(";GENBY=%s", a->tags.to_string_short().c_str());
+    line += ";GENBY=";
+    line += a->tags.to_string_short();
   } else {
     if (a->tags.contains("POP")) {
       CHECK(m_options.pop_trace_anchor_drop || m_options.use_pop_tracer);
-      line.print(";POP");
+      line += ";POP";
     }
   }
-  line.print("\t");
+  line += '\t';
 
   //__________________________________________________________________
   //				FORMAT
@@ -133,52 +162,52 @@ void ploidless_vcf_export::on_assembly(assembly_ptr a) {
   // NOTE: Per the VCF spec, GT *must* be the first field if it is present. Because reasons.
   // https://samtools.github.io/hts-specs/VCFv4.2.pdf
   //
-  line.print("GT:PG:GQ:PI:OV:DP:AD:PDP:PAD");
+  line += "GT:PG:GQ:PI:OV:DP:AD:PDP:PAD";
   if (m_options.output_ml_features) {
-    line.print(":LASCORE:LAREFSPAN:LARANCH:LALANCH:LAREFGC:LAALTGC:LAALTSEQLEN:NUMASM");
+    line += ":LASCORE:LAREFSPAN:LARANCH:LALANCH:LAREFGC:LAALTGC:LAALTSEQLEN:NUMASM";
   }
-  line.print("\t");
+  line += '\t';
 
   //__________________________________________________________________
   //				SAMPLE
   // GT: Genotype
-  line.print("%s:", unphased_genotype.c_str());
+  append_printf(line, "%s:", unphased_genotype);
   // PG: Phased Genotype
-  line.print("%s:", phased_genotype.c_str());
+  append_printf(line, "%s:", phased_genotype);
   // GQ: Genotype quality
-  line.print("%d:", int(a->genotype_quality * 100));
+  append_printf(line, "%d:", int(a->genotype_quality * 100));
   // PI: Phase ID
-  line.print("%ld:", a->assembly_id);
+  append_printf(line, "%ld:", a->assembly_id);
   // OV: Overlap
-  line.print("%d:", a->min_overlap);
+  append_printf(line, "%d:", a->min_overlap);
   // DP: total depth across all alleles
-  line.print("%d:", a->other_depth + min_depth + a->ref_depth);
+  append_printf(line, "%d:", a->other_depth + min_depth + a->ref_depth);
   // AD: allelic depth
-  line.print("%d,%d:", a->ref_depth, min_depth);
+  append_printf(line, "%d,%d:", a->ref_depth, min_depth);
   // PDP: total pair-confirmed-read depth across all alleles
   // TODO(nils): Add ref pair coverage.
-  line.print("%d:", a->other_pair_depth + min_pair_depth);
+  append_printf(line, "%d:", a->other_pair_depth + min_pair_depth);
   // PAD: pair-confirmed-read allelic depth for this and reference
   // TODO(nils): Add ref pair coverage.
-  line.print("%d,%d", 0, min_pair_depth);
+  append_printf(line, "%d,%d", 0, min_pair_depth);
 
   if (m_options.output_ml_features) {
     CHECK(a->ml_features) << "Missing ML features on assembly? " << *a;
     const assembly_ml_features& f = *a->ml_features;
-    line.print(":%d", f.score);
-    line.print(":%d", f.refspan);
-    line.print(":%d", f.lanch);
-    line.print(":%d", f.ranch);
-    line.print(":%f", f.refgc);
-    line.print(":%f", f.altgc);
-    line.print(":%lu", f.alt_seq.size());
-    line.print(":%lu", a->merged_assembly_ids.size() + 1);
+    append_printf(line, ":%d", f.score);
+    append_printf(line, ":%d", f.refspan);
+    append_printf(line, ":%d", f.lanch);
+    append_printf(line, ":%d", f.ranch);
+    append_printf(line, ":%f", f.refgc);
+    append_printf(line, ":%f", f.altgc);
+    append_printf(line, ":%lu", f.alt_seq.size());
+    append_printf(line, ":%lu", a->merged_assembly_ids.size() + 1);
   }
   //__________________________________________________________________
   //                              NEWLINE
-  line.print("\n");
+  line += '\n';
 
-  m_output(line.str());
+  m_output(line);
 }
 
 std::string ploidless_vcf_export::header(const assemble_options& options,
@@ -8,6 +8,9 @@ namespace variants {
 
 class ploidless_vcf_export : public assemble_pipeline_interface {
  public:
+  // output_f is called with each formatted VCF record, including the
+  // trailing newline.  The string passed is only valid until output_f
+  // returns.
   ploidless_vcf_export(const assemble_options& options, std::string scaffold_name,
                        const std::function<void(const std::string&)>& output_f)
       : m_options(options), m_scaffold_name(scaffold_name), m_output(output_f) {}
@@ -22,6 +25,11 @@ class ploidless_vcf_export : public assemble_pipeline_interface {
   assemble_options m_options;
   std::string m_scaffold_name;
   std::function<void(const std::string&)> m_output;
+
+  // Buffers reused between records.
+  std::string m_line;
+  std::string m_var_seq;
+  std::string m_ref_seq;
 };
 
 }  // namespace variants
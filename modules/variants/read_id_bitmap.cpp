@@ -0,0 +1,606 @@
+#include "modules/variants/read_id_bitmap.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace variants {
+
+constexpr unsigned read_id_bitmap::k_chunk_bits;
+constexpr unsigned read_id_bitmap::k_block_bits;
+constexpr size_t read_id_bitmap::k_chunks_per_block;
+constexpr size_t read_id_bitmap::k_block_words;
+constexpr size_t read_id_bitmap::k_max_sparse_chunks;
+
+bool read_id_bitmap::g_use_avx2 = true;
+
+namespace {
+
+constexpr uint32_t k_no_key = std::numeric_limits<uint32_t>::max();
+
+#if defined(__x86_64__)
+bool cpu_has_avx2() {
+  static const bool result = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+  return result;
+}
+
+// Counts the bits in each 64-bit lane, using a nibble lookup table.
+__attribute__((target("avx2"))) inline __m256i popcount_avx2(__m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,  //
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(v, low_mask);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  __m256i counts =
+      _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+#endif
+
+struct union_op {
+  static constexpr bool k_keep_lhs_only = true;
+  static constexpr bool k_keep_rhs_only = true;
+  // True if the result is always a subset of the given operand.
+  static constexpr bool k_subset_of_lhs = false;
+  static constexpr bool k_subset_of_rhs = false;
+
+  template <typename T>
+  static T apply(T lhs, T rhs) {
+    return lhs | rhs;
+  }
+#if defined(__x86_64__)
+  __attribute__((target("avx2"))) static __m256i apply_avx2(__m256i lhs, __m256i rhs) {
+    return _mm256_or_si256(lhs, rhs);
+  }
+#endif
+};
+
+struct intersection_op {
+  static constexpr bool k_keep_lhs_only = false;
+  static constexpr bool k_keep_rhs_only = false;
+  static constexpr bool k_subset_of_lhs = true;
+  static constexpr bool k_subset_of_rhs = true;
+
+  template <typename T>
+  static T apply(T lhs, T rhs) {
+    return lhs & rhs;
+  }
+#if defined(__x86_64__)
+  __attribute__((target("avx2"))) static __m256i apply_avx2(__m256i lhs, __m256i rhs) {
+    return _mm256_and_si256(lhs, rhs);
+  }
+#endif
+};
+
+struct difference_op {
+  static constexpr bool k_keep_lhs_only = true;
+  static constexpr bool k_keep_rhs_only = false;
+  static constexpr bool k_subset_of_lhs = true;
+  static constexpr bool k_subset_of_rhs = false;
+
+  template <typename T>
+  static T apply(T lhs, T rhs) {
+    return lhs & ~rhs;
+  }
+#if defined(__x86_64__)
+  __attribute__((target("avx2"))) static __m256i apply_avx2(__m256i lhs, __m256i rhs) {
+    return _mm256_andnot_si256(rhs, lhs);
+  }
+#endif
+};
+
+// Applies Op to each word of two dense blocks, storing the result in
+// "out".  Returns the number of bits set in the result.
+template <typename Op>
+size_t apply_words_portable(const uint64_t* lhs, const uint64_t* rhs, uint64_t* out) {
+  size_t count = 0;
+  for (size_t i = 0; i != read_id_bitmap::k_block_words; ++i) {
+    out[i] = Op::apply(lhs[i], rhs[i]);
+    count += __builtin_popcountll(out[i]);
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+template <typename Op>
+__attribute__((target("avx2"))) size_t apply_words_avx2(const uint64_t* lhs, const uint64_t* rhs,
+                                                         uint64_t* out) {
+  static_assert(read_id_bitmap::k_block_words % 4 == 0,
+                "Blocks must be a whole number of AVX2 registers");
+  __m256i counts = _mm256_setzero_si256();
+  for (size_t i = 0; i != read_id_bitmap::k_block_words; i += 4) {
+    __m256i result =
+        Op::apply_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i)),
+                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+    counts = _mm256_add_epi64(counts, popcount_avx2(result));
+  }
+  return _mm256_extract_epi64(counts, 0) + _mm256_extract_epi64(counts, 1) +
+         _mm256_extract_epi64(counts, 2) + _mm256_extract_epi64(counts, 3);
+}
+#endif
+
+template <typename Op>
+size_t apply_words(const uint64_t* lhs, const uint64_t* rhs, uint64_t* out) {
+#if defined(__x86_64__)
+  if (read_id_bitmap::g_use_avx2 && cpu_has_avx2()) {
+    return apply_words_avx2<Op>(lhs, rhs, out);
+  }
+#endif
+  return apply_words_portable<Op>(lhs, rhs, out);
+}
+
+}  // namespace
+
+std::vector<read_id_bitmap::dense_block>::iterator read_id_bitmap::find_dense(uint32_t key) {
+  return std::lower_bound(m_dense.begin(), m_dense.end(), key,
+                          [](const dense_block& block, uint32_t k) { return block.key < k; });
+}
+
+std::vector<read_id_bitmap::dense_block>::const_iterator read_id_bitmap::find_dense(
+    uint32_t key) const {
+  return std::lower_bound(m_dense.begin(), m_dense.end(), key,
+                          [](const dense_block& block, uint32_t k) { return block.key < k; });
+}
+
+void read_id_bitmap::clear() {
+  m_sparse.clear();
+  m_dense.clear();
+}
+
+size_t read_id_bitmap::size() const {
+  size_t tot = 0;
+  for (const auto& c : m_sparse) {
+    tot += __builtin_popcount(c.mask);
+  }
+  for (const auto& block : m_dense) {
+    tot += block.cardinality;
+  }
+  return tot;
+}
+
+void read_id_bitmap::add_chunk(uint32_t chunk_id, uint32_t mask) {
+  if (!mask) {
+    return;
+  }
+  uint32_t key = chunk_id / k_chunks_per_block;
+  if (!m_dense.empty()) {
+    auto dense_it = find_dense(key);
+    if (dense_it != m_dense.end() && dense_it->key == key) {
+      uint32_t chunk_idx = chunk_id % k_chunks_per_block;
+      uint64_t& word = dense_it->words[chunk_idx / 2];
+      uint64_t new_bits = uint64_t(mask) << ((chunk_idx % 2) * k_chunk_bits);
+      dense_it->cardinality += __builtin_popcountll(new_bits & ~word);
+      word |= new_bits;
+      return;
+    }
+  }
+
+  std::vector<chunk>::iterator it;
+  if (m_sparse.empty() || m_sparse.back().chunk_id < chunk_id) {
+    m_sparse.push_back(chunk{chunk_id, mask});
+    it = m_sparse.end() - 1;
+  } else {
+    it = std::lower_bound(m_sparse.begin(), m_sparse.end(), chunk_id);
+    if (it != m_sparse.end() && it->chunk_id == chunk_id) {
+      it->mask |= mask;
+      return;
+    }
+    it = m_sparse.insert(it, chunk{chunk_id, mask});
+  }
+
+  // A chunk was added; see if this block should now be dense.
+  uint32_t block_start = key * k_chunks_per_block;
+  auto block_end = std::lower_bound(it, m_sparse.end(), block_start + k_chunks_per_block);
+  if (size_t(block_end - m_sparse.begin()) > k_max_sparse_chunks &&
+      (block_end - k_max_sparse_chunks - 1)->chunk_id >= block_start) {
+    make_dense(key);
+  }
+}
+
+void read_id_bitmap::erase(uint32_t read_id) {
+  uint32_t chunk_id = read_id / k_chunk_bits;
+  uint32_t key = read_id >> k_block_bits;
+  if (!m_dense.empty()) {
+    uint32_t chunk_idx = chunk_id % k_chunks_per_block;
+    auto dense_it = find_dense(key);
+    if (dense_it != m_dense.end() && dense_it->key == key) {
+      uint64_t& word = dense_it->words[chunk_idx / 2];
+      uint64_t bit = uint64_t(1) << ((chunk_idx % 2) * k_chunk_bits + read_id % k_chunk_bits);
+      if (word & bit) {
+        word &= ~bit;
+        if (!--dense_it->cardinality) {
+          m_dense.erase(dense_it);
+        }
+      }
+      return;
+    }
+  }
+
+  auto it = std::lower_bound(m_sparse.begin(), m_sparse.end(), chunk_id);
+  if (it != m_sparse.end() && it->chunk_id == chunk_id) {
+    it->mask &= ~(uint32_t(1) << (read_id % k_chunk_bits));
+    if (!it->mask) {
+      m_sparse.erase(it);
+    }
+  }
+}
+
+uint32_t read_id_bitmap::chunk_mask(uint32_t chunk_id) const {
+  if (!m_dense.empty()) {
+    uint32_t key = chunk_id / k_chunks_per_block;
+    auto dense_it = find_dense(key);
+    if (dense_it != m_dense.end() && dense_it->key == key) {
+      return dense_it->chunk(chunk_id % k_chunks_per_block);
+    }
+  }
+  auto it = std::lower_bound(m_sparse.begin(), m_sparse.end(), chunk_id);
+  if (it != m_sparse.end() && it->chunk_id == chunk_id) {
+    return it->mask;
+  }
+  return 0;
+}
+
+read_id_bitmap::dense_block read_id_bitmap::to_dense(uint32_t key, const chunk* begin,
+                                                     const chunk* end) {
+  uint32_t block_start = key * k_chunks_per_block;
+  dense_block block;
+  block.key = key;
+  block.words.resize(k_block_words, 0);
+  for (const chunk* c = begin; c != end; ++c) {
+    uint32_t chunk_idx = c->chunk_id - block_start;
+    block.words[chunk_idx / 2] |= uint64_t(c->mask) << ((chunk_idx % 2) * k_chunk_bits);
+    block.cardinality += __builtin_popcount(c->mask);
+  }
+  return block;
+}
+
+void read_id_bitmap::make_dense(uint32_t key) {
+  uint32_t block_start = key * k_chunks_per_block;
+  auto begin = std::lower_bound(m_sparse.begin(), m_sparse.end(), block_start);
+  auto end = std::lower_bound(begin, m_sparse.end(), block_start + k_chunks_per_block);
+  dense_block block = to_dense(key, &*begin, &*begin + (end - begin));
+  m_sparse.erase(begin, end);
+  m_dense.insert(find_dense(key), std::move(block));
+}
+
+void read_id_bitmap::make_dense_where_needed() {
+  std::vector<dense_block> new_dense;
+  auto out = m_sparse.begin();
+  auto it = m_sparse.begin();
+  while (it != m_sparse.end()) {
+    uint32_t key = it->chunk_id / k_chunks_per_block;
+    uint32_t next_block_start = (key + 1) * k_chunks_per_block;
+    if (size_t(m_sparse.end() - it) > k_max_sparse_chunks &&
+        it[k_max_sparse_chunks].chunk_id < next_block_start) {
+      auto block_end =
+          std::lower_bound(it + k_max_sparse_chunks, m_sparse.end(), next_block_start);
+      new_dense.push_back(to_dense(key, &*it, &*it + (block_end - it)));
+      it = block_end;
+      continue;
+    }
+
+    // Few enough chunks that the block must end within the next
+    // k_max_sparse_chunks + 1 chunks.
+    auto search_end = m_sparse.end() - it > ssize_t(k_max_sparse_chunks)
+                          ? it + k_max_sparse_chunks + 1
+                          : m_sparse.end();
+    auto block_end = std::lower_bound(it, search_end, next_block_start);
+    if (out == it) {
+      out = block_end;
+    } else {
+      out = std::copy(it, block_end, out);
+    }
+    it = block_end;
+  }
+  if (new_dense.empty()) {
+    return;
+  }
+  m_sparse.erase(out, m_sparse.end());
+
+  std::vector<dense_block> merged;
+  merged.reserve(m_dense.size() + new_dense.size());
+  std::merge(std::make_move_iterator(m_dense.begin()), std::make_move_iterator(m_dense.end()),
+             std::make_move_iterator(new_dense.begin()), std::make_move_iterator(new_dense.end()),
+             std::back_inserter(merged),
+             [](const dense_block& a, const dense_block& b) { return a.key < b.key; });
+  m_dense = std::move(merged);
+}
+
+void read_id_bitmap::append_block(dense_block block) {
+  if (!block.cardinality) {
+    return;
+  }
+  constexpr size_t k_max_chunks = k_max_sparse_chunks / 2;
+  bool sparse = block.cardinality <= k_max_chunks;
+  if (!sparse && block.cardinality <= k_max_chunks * k_chunk_bits) {
+    size_t nchunks = 0;
+    for (uint64_t word : block.words) {
+      nchunks += bool(uint32_t(word)) + bool(word >> k_chunk_bits);
+    }
+    sparse = nchunks <= k_max_chunks;
+  }
+  if (!sparse) {
+    m_dense.push_back(std::move(block));
+    return;
+  }
+  uint32_t block_start = block.key * k_chunks_per_block;
+  for (size_t i = 0; i != k_chunks_per_block; ++i) {
+    uint32_t mask = block.chunk(i);
+    if (mask) {
+      m_sparse.push_back(chunk{uint32_t(block_start + i), mask});
+    }
+  }
+}
+
+template <typename Op>
+void read_id_bitmap::combine_block(uint32_t key, const block_view& lhs, const block_view& rhs) {
+  // If the result is a subset of a sparse operand, it can stay sparse.
+  if (Op::k_subset_of_lhs && !lhs.dense) {
+    for (const chunk* c = lhs.sparse_begin; c != lhs.sparse_end; ++c) {
+      uint32_t mask = Op::apply(c->mask, rhs.dense->chunk(c->chunk_id % k_chunks_per_block));
+      if (mask) {
+        m_sparse.push_back(chunk{c->chunk_id, mask});
+      }
+    }
+    return;
+  }
+  if (Op::k_subset_of_rhs && !rhs.dense) {
+    for (const chunk* c = rhs.sparse_begin; c != rhs.sparse_end; ++c) {
+      uint32_t mask = Op::apply(lhs.dense->chunk(c->chunk_id % k_chunks_per_block), c->mask);
+      if (mask) {
+        m_sparse.push_back(chunk{c->chunk_id, mask});
+      }
+    }
+    return;
+  }
+
+  std::vector<uint64_t> lhs_storage, rhs_storage;
+  auto get_words = [key](const block_view& view, std::vector<uint64_t>* storage) {
+    if (view.dense) {
+      return view.dense->words.data();
+    }
+    uint32_t block_start = key * k_chunks_per_block;
+    storage->resize(k_block_words, 0);
+    for (const chunk* c = view.sparse_begin; c != view.sparse_end; ++c) {
+      uint32_t chunk_idx = c->chunk_id - block_start;
+      (*storage)[chunk_idx / 2] |= uint64_t(c->mask) << ((chunk_idx % 2) * k_chunk_bits);
+    }
+    return const_cast<const uint64_t*>(storage->data());
+  };
+
+  dense_block block;
+  block.key = key;
+  block.words.resize(k_block_words);
+  block.cardinality = apply_words<Op>(get_words(lhs, &lhs_storage), get_words(rhs, &rhs_storage),
+                                      block.words.data());
+  append_block(std::move(block));
+}
+
+template <typename Op>
+read_id_bitmap read_id_bitmap::combine(const read_id_bitmap& lhs, const read_id_bitmap& rhs) {
+  read_id_bitmap result;
+  size_t reserve = lhs.m_sparse.size();
+  if (Op::k_keep_rhs_only) {
+    reserve += rhs.m_sparse.size();
+  } else if (Op::k_subset_of_rhs) {
+    reserve = std::min(reserve, rhs.m_sparse.size());
+  }
+  result.m_sparse.reserve(reserve);
+  std::vector<chunk>& out = result.m_sparse;
+
+  const chunk* it = lhs.m_sparse.data();
+  const chunk* end = it + lhs.m_sparse.size();
+  const chunk* rhs_it = rhs.m_sparse.data();
+  const chunk* rhs_end = rhs_it + rhs.m_sparse.size();
+  auto dense_it = lhs.m_dense.begin();
+  auto rhs_dense_it = rhs.m_dense.begin();
+
+  for (;;) {
+    uint32_t key = k_no_key;
+    if (dense_it != lhs.m_dense.end()) {
+      key = dense_it->key;
+    }
+    if (rhs_dense_it != rhs.m_dense.end()) {
+      key = std::min(key, rhs_dense_it->key);
+    }
+
+    // Merge sparse chunks up to the next dense block.
+    uint64_t limit = uint64_t(key) * k_chunks_per_block;
+    const chunk* sparse_end = end;
+    const chunk* rhs_sparse_end = rhs_end;
+    if (key != k_no_key) {
+      sparse_end = std::lower_bound(it, end, limit);
+      rhs_sparse_end = std::lower_bound(rhs_it, rhs_end, limit);
+    }
+    while (it != sparse_end && rhs_it != rhs_sparse_end) {
+      if (it->chunk_id < rhs_it->chunk_id) {
+        if (Op::k_keep_lhs_only) {
+          out.push_back(*it);
+        }
+        ++it;
+        continue;
+      }
+      if (rhs_it->chunk_id < it->chunk_id) {
+        if (Op::k_keep_rhs_only) {
+          out.push_back(*rhs_it);
+        }
+        ++rhs_it;
+        continue;
+      }
+      uint32_t mask = Op::apply(it->mask, rhs_it->mask);
+      if (mask) {
+        out.push_back(chunk{it->chunk_id, mask});
+      }
+      ++it;
+      ++rhs_it;
+    }
+    if (Op::k_keep_lhs_only) {
+      out.insert(out.end(), it, sparse_end);
+    }
+    if (Op::k_keep_rhs_only) {
+      out.insert(out.end(), rhs_it, rhs_sparse_end);
+    }
+    it = sparse_end;
+    rhs_it = rhs_sparse_end;
+
+    if (key == k_no_key) {
+      break;
+    }
+
+    // Combine the dense block with the corresponding block of the
+    // other operand.
+    uint64_t block_limit = limit + k_chunks_per_block;
+    block_view lhs_block, rhs_block;
+    if (dense_it != lhs.m_dense.end() && dense_it->key == key) {
+      lhs_block.dense = &*dense_it;
+      ++dense_it;
+    } else {
+      lhs_block.sparse_begin = it;
+      while (it != end && it->chunk_id < block_limit) {
+        ++it;
+      }
+      lhs_block.sparse_end = it;
+    }
+    if (rhs_dense_it != rhs.m_dense.end() && rhs_dense_it->key == key) {
+      rhs_block.dense = &*rhs_dense_it;
+      ++rhs_dense_it;
+    } else {
+      rhs_block.sparse_begin = rhs_it;
+      while (rhs_it != rhs_end && rhs_it->chunk_id < block_limit) {
+        ++rhs_it;
+      }
+      rhs_block.sparse_end = rhs_it;
+    }
+    result.combine_block<Op>(key, lhs_block, rhs_block);
+  }
+
+  if (!Op::k_subset_of_lhs && !Op::k_subset_of_rhs) {
+    // Merging sparse blocks may have made them too dense.
+    result.make_dense_where_needed();
+  }
+  return result;
+}
+
+read_id_bitmap read_id_bitmap::operator|(const read_id_bitmap& rhs) const {
+  return combine<union_op>(*this, rhs);
+}
+
+read_id_bitmap read_id_bitmap::operator&(const read_id_bitmap& rhs) const {
+  return combine<intersection_op>(*this, rhs);
+}
+
+read_id_bitmap read_id_bitmap::operator-(const read_id_bitmap& rhs) const {
+  return combine<difference_op>(*this, rhs);
+}
+
+read_id_bitmap& read_id_bitmap::operator|=(const read_id_bitmap& rhs) {
+  (*this) = (*this) | rhs;
+  return *this;
+}
+
+read_id_bitmap& read_id_bitmap::operator&=(const read_id_bitmap& rhs) {
+  (*this) = (*this) & rhs;
+  return *this;
+}
+
+read_id_bitmap& read_id_bitmap::operator-=(const read_id_bitmap& rhs) {
+  (*this) = (*this) - rhs;
+  return *this;
+}
+
+bool read_id_bitmap::operator==(const read_id_bitmap& rhs) const {
+  if (m_dense.empty() && rhs.m_dense.empty()) {
+    return m_sparse == rhs.m_sparse;
+  }
+
+  // Blocks may be dense in one and sparse in the other depending on
+  // how they were built, so compare chunk by chunk.
+  auto it = chunk_begin();
+  auto rhs_it = rhs.chunk_begin();
+  while (!it.done() && !rhs_it.done()) {
+    if (it.chunk_id() != rhs_it.chunk_id() || it.mask() != rhs_it.mask()) {
+      return false;
+    }
+    it.next();
+    rhs_it.next();
+  }
+  return it.done() && rhs_it.done();
+}
+
+size_t read_id_bitmap::chunk_count() const {
+  size_t count = m_sparse.size();
+  for (const auto& block : m_dense) {
+    for (size_t i = 0; i != k_chunks_per_block; ++i) {
+      if (block.chunk(i)) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+size_t read_id_bitmap::memory_used() const {
+  size_t tot = m_sparse.capacity() * sizeof(chunk) + m_dense.capacity() * sizeof(dense_block);
+  for (const auto& block : m_dense) {
+    tot += block.words.capacity() * sizeof(uint64_t);
+  }
+  return tot;
+}
+
+read_id_bitmap::chunk_iterator::chunk_iterator(const read_id_bitmap* bitmap, size_t sparse_idx,
+                                               size_t dense_idx)
+    : m_bitmap(bitmap), m_sparse_idx(sparse_idx), m_dense_idx(dense_idx) {
+  load();
+}
+
+void read_id_bitmap::chunk_iterator::next_with_dense() {
+  if (m_in_dense) {
+    ++m_dense_chunk;
+  } else {
+    ++m_sparse_idx;
+  }
+  load();
+}
+
+void read_id_bitmap::chunk_iterator::load() {
+  const auto& sparse = m_bitmap->m_sparse;
+  const auto& dense = m_bitmap->m_dense;
+  while (m_dense_idx < dense.size()) {
+    const dense_block& block = dense[m_dense_idx];
+    uint32_t block_start = block.key * k_chunks_per_block;
+    if (m_sparse_idx < sparse.size() && sparse[m_sparse_idx].chunk_id < block_start) {
+      break;
+    }
+    while (m_dense_chunk < k_chunks_per_block) {
+      uint32_t mask = block.chunk(m_dense_chunk);
+      if (mask) {
+        m_chunk_id = block_start + m_dense_chunk;
+        m_mask = mask;
+        m_in_dense = true;
+        return;
+      }
+      ++m_dense_chunk;
+    }
+    ++m_dense_idx;
+    m_dense_chunk = 0;
+  }
+
+  m_in_dense = false;
+  if (m_sparse_idx < sparse.size()) {
+    m_chunk_id = sparse[m_sparse_idx].chunk_id;
+    m_mask = sparse[m_sparse_idx].mask;
+  } else {
+    m_chunk_id = 0;
+    m_mask = 0;
+  }
+}
+
+}  // namespace variants
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace variants {
+
+// read_id_bitmap is a compressed bitmap of read ids, in the style of
+// "roaring" bitmaps.  Read ids are split into blocks of 64K by their
+// upper 16 bits, and each nonempty block is stored in one of two
+// ways:
+//
+//   Sparse: a sorted list of chunks of 32 read ids, each with a mask
+//   of which read ids in the chunk are present.  All sparse blocks
+//   share a single list.  Since read ids from the same seqset entry
+//   are consecutive, reads tend to clump together, so this is usually
+//   much smaller than a list of individual read ids.
+//
+//   Dense: a 64K bit bitmap.  Set operations between dense blocks use
+//   AVX2 if the CPU supports it.
+//
+// read_id_set uses this as its representation for large sets.
+class read_id_bitmap {
+ public:
+  // Read ids are grouped into chunks of this size; this matches
+  // read_id_set's chunk size.
+  static constexpr unsigned k_chunk_bits = 32;
+  static constexpr unsigned k_block_bits = 16;
+  static constexpr size_t k_chunks_per_block = (size_t(1) << k_block_bits) / k_chunk_bits;
+  static constexpr size_t k_block_words = (size_t(1) << k_block_bits) / 64;
+
+  // Blocks with more than this many nonempty chunks are stored as
+  // dense bitmaps; past this point a dense block uses less memory than
+  // the chunk list, and bitmap operations are much faster than merging.
+  // Results of set operations with no more than half this many
+  // nonempty chunks in a block are stored sparsely.
+  static constexpr size_t k_max_sparse_chunks = k_block_words;
+
+  read_id_bitmap() = default;
+  read_id_bitmap(const read_id_bitmap&) = default;
+  read_id_bitmap(read_id_bitmap&&) = default;
+  read_id_bitmap& operator=(const read_id_bitmap&) = default;
+  read_id_bitmap& operator=(read_id_bitmap&&) = default;
+
+  void insert(uint32_t read_id) {
+    add_chunk(read_id / k_chunk_bits, uint32_t(1) << (read_id % k_chunk_bits));
+  }
+  void erase(uint32_t read_id);
+  bool contains(uint32_t read_id) const {
+    return chunk_mask(read_id / k_chunk_bits) & (uint32_t(1) << (read_id % k_chunk_bits));
+  }
+  void clear();
+  bool empty() const { return m_sparse.empty() && m_dense.empty(); }
+  size_t size() const;
+
+  // Adds the read ids present in "mask" starting at chunk_id *
+  // k_chunk_bits.  This is most efficient when chunks are added in
+  // increasing order.
+  void add_chunk(uint32_t chunk_id, uint32_t mask);
+
+  // Returns the read ids present in the given chunk, as a mask
+  // starting at chunk_id * k_chunk_bits.
+  uint32_t chunk_mask(uint32_t chunk_id) const;
+
+  read_id_bitmap operator|(const read_id_bitmap& rhs) const;
+  read_id_bitmap operator&(const read_id_bitmap& rhs) const;
+  read_id_bitmap operator-(const read_id_bitmap& rhs) const;
+  read_id_bitmap& operator|=(const read_id_bitmap& rhs);
+  read_id_bitmap& operator&=(const read_id_bitmap& rhs);
+  read_id_bitmap& operator-=(const read_id_bitmap& rhs);
+
+  bool operator==(const read_id_bitmap& rhs) const;
+  bool operator!=(const read_id_bitmap& rhs) const { return !(*this == rhs); }
+
+  // Returns the number of nonempty chunks.
+  size_t chunk_count() const;
+
+  // Returns the number of blocks stored as dense bitmaps.
+  size_t dense_block_count() const { return m_dense.size(); }
+
+  // Number of bytes used, for benchmarks and statistics.
+  size_t memory_used() const;
+
+  // Iterates through nonempty chunks in order.
+  class chunk_iterator {
+   public:
+    chunk_iterator() = default;
+
+    bool done() const {
+      return m_sparse_idx == m_bitmap->m_sparse.size() && m_dense_idx == m_bitmap->m_dense.size();
+    }
+    uint32_t chunk_id() const { return m_chunk_id; }
+    uint32_t mask() const { return m_mask; }
+    void next() {
+      if (m_in_dense || m_dense_idx != m_bitmap->m_dense.size()) {
+        next_with_dense();
+        return;
+      }
+      // Only sparse chunks remain.
+      const auto& sparse = m_bitmap->m_sparse;
+      if (++m_sparse_idx < sparse.size()) {
+        m_chunk_id = sparse[m_sparse_idx].chunk_id;
+        m_mask = sparse[m_sparse_idx].mask;
+      } else {
+        m_chunk_id = 0;
+        m_mask = 0;
+      }
+    }
+
+    bool operator==(const chunk_iterator& rhs) const {
+      return m_sparse_idx == rhs.m_sparse_idx && m_dense_idx == rhs.m_dense_idx &&
+             m_dense_chunk == rhs.m_dense_chunk;
+    }
+    bool operator!=(const chunk_iterator& rhs) const { return !(*this == rhs); }
+
+   private:
+    friend class read_id_bitmap;
+    chunk_iterator(const read_id_bitmap* bitmap, size_t sparse_idx, size_t dense_idx);
+
+    void next_with_dense();
+    // Finds the next nonempty chunk at or after the current position.
+    void load();
+
+    const read_id_bitmap* m_bitmap = nullptr;
+    size_t m_sparse_idx = 0;
+    size_t m_dense_idx = 0;
+    // Index of the current chunk within the current dense block.
+    size_t m_dense_chunk = 0;
+    // True if the current chunk is in a dense block.
+    bool m_in_dense = false;
+
+    uint32_t m_chunk_id = 0;
+    uint32_t m_mask = 0;
+  };
+
+  chunk_iterator chunk_begin() const { return chunk_iterator(this, 0, 0); }
+  chunk_iterator chunk_end() const {
+    return chunk_iterator(this, m_sparse.size(), m_dense.size());
+  }
+
+  // If false, uses portable code even if AVX2 is available.  Used for
+  // testing and benchmarking.
+  static bool g_use_avx2;
+
+ private:
+  struct chunk {
+    uint32_t chunk_id;
+    uint32_t mask;
+
+    bool operator<(uint32_t rhs) const { return chunk_id < rhs; }
+    bool operator==(const chunk& rhs) const {
+      return chunk_id == rhs.chunk_id && mask == rhs.mask;
+    }
+  };
+  struct dense_block {
+    // Upper 16 bits of all read ids in this block.
+    uint32_t key = 0;
+    // Number of read ids present.
+    uint32_t cardinality = 0;
+    std::vector<uint64_t> words;
+
+    uint32_t chunk(size_t chunk_idx) const {
+      return words[chunk_idx / 2] >> ((chunk_idx % 2) * k_chunk_bits);
+    }
+  };
+
+  // A block of an operand of a set operation, which is either dense
+  // or a range of sparse chunks.
+  struct block_view {
+    const dense_block* dense = nullptr;
+    const chunk* sparse_begin = nullptr;
+    const chunk* sparse_end = nullptr;
+  };
+
+  template <typename Op>
+  static read_id_bitmap combine(const read_id_bitmap& lhs, const read_id_bitmap& rhs);
+  template <typename Op>
+  void combine_block(uint32_t key, const block_view& lhs, const block_view& rhs);
+
+  // Adds a block to the end of this bitmap, storing it sparsely if it
+  // has few enough chunks.
+  void append_block(dense_block block);
+
+  // Builds a dense block from a range of sparse chunks, all of which
+  // must be in the block with the given key.
+  static dense_block to_dense(uint32_t key, const chunk* begin, const chunk* end);
+  // Converts the sparse chunks in the given block to a dense block.
+  void make_dense(uint32_t key);
+  // Converts any sparse blocks with too many chunks to dense blocks.
+  void make_dense_where_needed();
+
+  std::vector<dense_block>::iterator find_dense(uint32_t key);
+  std::vector<dense_block>::const_iterator find_dense(uint32_t key) const;
+
+  // Chunks in sparse blocks, sorted by chunk id.
+  std::vector<chunk> m_sparse;
+  // Dense blocks, sorted by key.
+  std::vector<dense_block> m_dense;
+};
+
+}  // namespace variants
@@ -0,0 +1,188 @@
+#include "modules/variants/read_id_bitmap.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+using namespace testing;
+using namespace variants;
+
+namespace {
+
+enum class distribution {
+  // Read ids spread thinly over many blocks.
+  SPARSE,
+  // Enough read ids in a block to store it as a dense bitmap.
+  DENSE,
+  // Clumps of consecutive read ids, some long enough to fill a block.
+  CLUMPED
+};
+
+std::set<uint32_t> random_ids(distribution dist, unsigned seed) {
+  std::mt19937 rand(seed);
+  std::set<uint32_t> result;
+  switch (dist) {
+    case distribution::SPARSE:
+      for (unsigned i = 0; i < 2000; ++i) {
+        result.insert(rand() % (1U << 24));
+      }
+      break;
+    case distribution::DENSE:
+      for (unsigned i = 0; i < 30000; ++i) {
+        result.insert(rand() % (3U << 16));
+      }
+      break;
+    case distribution::CLUMPED:
+      for (unsigned i = 0; i < 30; ++i) {
+        uint32_t start = rand() % (4U << 16);
+        uint32_t len = rand() % 5000;
+        for (uint32_t id = start; id < start + len; ++id) {
+          result.insert(id);
+        }
+      }
+      break;
+  }
+  return result;
+}
+
+read_id_bitmap to_bitmap(const std::set<uint32_t>& ids) {
+  read_id_bitmap result;
+  for (uint32_t id : ids) {
+    result.insert(id);
+  }
+  return result;
+}
+
+// Builds the bitmap in reverse order, which exercises inserting into
+// the middle of sparse blocks.
+read_id_bitmap to_bitmap_reversed(const std::set<uint32_t>& ids) {
+  read_id_bitmap result;
+  for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+    result.insert(*it);
+  }
+  return result;
+}
+
+std::set<uint32_t> to_set(const read_id_bitmap& bitmap) {
+  std::set<uint32_t> result;
+  for (auto it = bitmap.chunk_begin(); !it.done(); it.next()) {
+    uint32_t mask = it.mask();
+    EXPECT_NE(0, mask);
+    EXPECT_EQ(mask, bitmap.chunk_mask(it.chunk_id()));
+    while (mask) {
+      result.insert(it.chunk_id() * read_id_bitmap::k_chunk_bits + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+  EXPECT_EQ(result.size(), bitmap.size());
+  return result;
+}
+
+}  // namespace
+
+class read_id_bitmap_test
+    : public TestWithParam<std::tuple<distribution, distribution, bool /* use avx2 */>> {
+ public:
+  void SetUp() override {
+    m_old_use_avx2 = read_id_bitmap::g_use_avx2;
+    read_id_bitmap::g_use_avx2 = std::get<2>(GetParam());
+    m_lhs_set = random_ids(std::get<0>(GetParam()), 1);
+    m_rhs_set = random_ids(std::get<1>(GetParam()), 2);
+  }
+  void TearDown() override { read_id_bitmap::g_use_avx2 = m_old_use_avx2; }
+
+ protected:
+  bool m_old_use_avx2;
+  std::set<uint32_t> m_lhs_set;
+  std::set<uint32_t> m_rhs_set;
+};
+
+TEST_P(read_id_bitmap_test, round_trip) {
+  for (const read_id_bitmap& lhs : {to_bitmap(m_lhs_set), to_bitmap_reversed(m_lhs_set)}) {
+    EXPECT_THAT(to_set(lhs), ContainerEq(m_lhs_set));
+    for (uint32_t id : m_lhs_set) {
+      ASSERT_TRUE(lhs.contains(id)) << id;
+      ASSERT_FALSE(lhs.contains(id + 1) && !m_lhs_set.count(id + 1)) << id + 1;
+    }
+  }
+}
+
+TEST_P(read_id_bitmap_test, set_ops) {
+  std::set<uint32_t> expected_union, expected_intersection, expected_difference;
+  std::set_union(m_lhs_set.begin(), m_lhs_set.end(), m_rhs_set.begin(), m_rhs_set.end(),
+                 std::inserter(expected_union, expected_union.end()));
+  std::set_intersection(m_lhs_set.begin(), m_lhs_set.end(), m_rhs_set.begin(), m_rhs_set.end(),
+                        std::inserter(expected_intersection, expected_intersection.end()));
+  std::set_difference(m_lhs_set.begin(), m_lhs_set.end(), m_rhs_set.begin(), m_rhs_set.end(),
+                      std::inserter(expected_difference, expected_difference.end()));
+
+  read_id_bitmap lhs = to_bitmap(m_lhs_set);
+  read_id_bitmap rhs = to_bitmap(m_rhs_set);
+  EXPECT_THAT(to_set(lhs | rhs), ContainerEq(expected_union));
+  EXPECT_THAT(to_set(lhs & rhs), ContainerEq(expected_intersection));
+  EXPECT_THAT(to_set(lhs - rhs), ContainerEq(expected_difference));
+  EXPECT_EQ(lhs | rhs, rhs | lhs);
+  EXPECT_EQ(lhs & rhs, rhs & lhs);
+  EXPECT_EQ(lhs | rhs, to_bitmap(expected_union));
+  EXPECT_EQ(lhs & rhs, to_bitmap(expected_intersection));
+  EXPECT_EQ(lhs - rhs, to_bitmap(expected_difference));
+
+  // Results of operations should be usable as operands.
+  EXPECT_THAT(to_set((lhs | rhs) - rhs), ContainerEq(expected_difference));
+  EXPECT_THAT(to_set((lhs | rhs) & lhs), ContainerEq(m_lhs_set));
+}
+
+TEST_P(read_id_bitmap_test, erase) {
+  read_id_bitmap lhs = to_bitmap(m_lhs_set);
+  std::set<uint32_t> expected = m_lhs_set;
+  for (uint32_t id : m_rhs_set) {
+    lhs.erase(id);
+    expected.erase(id);
+  }
+  EXPECT_THAT(to_set(lhs), ContainerEq(expected));
+  EXPECT_EQ(lhs, to_bitmap(expected));
+}
+
+TEST_P(read_id_bitmap_test, add_chunks) {
+  read_id_bitmap lhs = to_bitmap(m_lhs_set);
+  read_id_bitmap rhs = to_bitmap(m_rhs_set);
+  for (auto it = rhs.chunk_begin(); !it.done(); it.next()) {
+    lhs.add_chunk(it.chunk_id(), it.mask());
+  }
+  std::set<uint32_t> expected = m_lhs_set;
+  expected.insert(m_rhs_set.begin(), m_rhs_set.end());
+  EXPECT_THAT(to_set(lhs), ContainerEq(expected));
+}
+
+INSTANTIATE_TEST_CASE_P(  //
+    read_id_bitmap_tests, read_id_bitmap_test,
+    ::testing::Combine(
+        ::testing::Values(distribution::SPARSE, distribution::DENSE, distribution::CLUMPED),
+        ::testing::Values(distribution::SPARSE, distribution::DENSE, distribution::CLUMPED),
+        ::testing::Bool()));
+
+TEST(read_id_bitmap_dense, consecutive_ids) {
+  read_id_bitmap ids;
+  for (uint32_t id = 1000; id < 200000; ++id) {
+    ids.insert(id);
+  }
+  EXPECT_EQ(3, ids.dense_block_count());
+  EXPECT_EQ(199000, ids.size());
+  EXPECT_TRUE(ids.contains(1000));
+  EXPECT_TRUE(ids.contains(199999));
+  EXPECT_FALSE(ids.contains(999));
+  EXPECT_FALSE(ids.contains(200000));
+  EXPECT_EQ(0xFFFFFF00, ids.chunk_mask(1000 / read_id_bitmap::k_chunk_bits));
+  EXPECT_EQ((199999 - 1000) / read_id_bitmap::k_chunk_bits + 1, ids.chunk_count());
+
+  // Erasing all but a few ids should leave a correct, small result.
+  read_id_bitmap few;
+  few.insert(1000);
+  few.insert(150000);
+  read_id_bitmap erased = ids & few;
+  EXPECT_EQ(0, erased.dense_block_count());
+  EXPECT_EQ(few, erased);
+  EXPECT_EQ(few, few - (few - ids));
+}
@@ -1,4 +1,5 @@
 #include "modules/variants/read_set.h"
+#include "modules/io/make_unique.h"
 
 namespace variants {
 
@@ -34,6 +35,10 @@ void read_coverage_set::insert(int offset, const read_id_set& read_ids, int read
 constexpr size_t read_id_set::k_mask_bits;
 constexpr size_t big_read_id_set::k_mask_bits;
 constexpr size_t read_id_set::k_num_small_elem;
+constexpr size_t read_id_set::k_max_small_elems;
+
+static_assert(read_id_set::k_mask_bits == read_id_bitmap::k_chunk_bits,
+              "read_id_set and read_id_bitmap chunk sizes must match");
 
 read_id_set::read_id_set(const big_read_id_set& orig) {
   m_impl.reserve(orig.m_impl.size());
@@ -43,9 +48,80 @@ read_id_set::read_id_set(const big_read_id_set& orig) {
     new_elem.read_id_bits = e.second;
     m_impl.push_back(new_elem);
   }
+  maybe_promote();
+}
+
+read_id_set::read_id_set(const read_id_set& rhs) : m_impl(rhs.m_impl) {
+  if (rhs.m_bitmap) {
+    m_bitmap = make_unique<read_id_bitmap>(*rhs.m_bitmap);
+  }
+}
+
+read_id_set& read_id_set::operator=(const read_id_set& rhs) {
+  if (this != &rhs) {
+    m_impl = rhs.m_impl;
+    if (rhs.m_bitmap) {
+      m_bitmap = make_unique<read_id_bitmap>(*rhs.m_bitmap);
+    } else {
+      m_bitmap.reset();
+    }
+  }
+  return *this;
+}
+
+void read_id_set::maybe_promote() {
+  if (m_bitmap || m_impl.size() <= k_max_small_elems) {
+    return;
+  }
+  m_bitmap = make_unique<read_id_bitmap>();
+  for (const auto& e : m_impl) {
+    m_bitmap->add_chunk(e.chunk_id, e.read_id_bits);
+  }
+  impl_t().swap(m_impl);
+}
+
+void read_id_set::maybe_demote() {
+  if (!m_bitmap) {
+    return;
+  }
+  size_t nchunks = 0;
+  for (auto it = m_bitmap->chunk_begin(); !it.done(); it.next()) {
+    if (++nchunks > k_max_small_elems / 2) {
+      return;
+    }
+  }
+  m_impl.reserve(nchunks);
+  for (auto it = m_bitmap->chunk_begin(); !it.done(); it.next()) {
+    elem new_elem;
+    new_elem.chunk_id = it.chunk_id();
+    new_elem.read_id_bits = it.mask();
+    m_impl.push_back(new_elem);
+  }
+  m_bitmap.reset();
+}
+
+const read_id_bitmap& read_id_set::as_bitmap(read_id_bitmap* storage) const {
+  if (m_bitmap) {
+    return *m_bitmap;
+  }
+  storage->clear();
+  for (const auto& e : m_impl) {
+    storage->add_chunk(e.chunk_id, e.read_id_bits);
+  }
+  return *storage;
+}
+
+read_id_set read_id_set::from_bitmap(read_id_bitmap bitmap) {
+  read_id_set result;
+  result.m_bitmap = make_unique<read_id_bitmap>(std::move(bitmap));
+  result.maybe_demote();
+  return result;
 }
 
 size_t read_id_set::size() const {
+  if (m_bitmap) {
+    return m_bitmap->size();
+  }
   size_t tot = 0;
   for (const auto& e : m_impl) {
     tot += __builtin_popcountl(e.read_id_bits);
@@ -53,6 +129,16 @@ size_t read_id_set::size() const {
   return tot;
 }
 
+size_t read_id_set::memory_used() const {
+  if (m_bitmap) {
+    return sizeof(read_id_bitmap) + m_bitmap->memory_used();
+  }
+  if (m_impl.capacity() > k_num_small_elem) {
+    return m_impl.capacity() * sizeof(elem);
+  }
+  return 0;
+}
+
 std::ostream& operator<<(std::ostream& os, const read_id_set& ids) {
   bool first = true;
   os << "ReadIds(";
@@ -68,6 +154,11 @@ std::ostream& operator<<(std::ostream& os, const read_id_set& ids) {
 }
 
 void read_id_set::insert(const read_id_set& old_ids) {
+  if (m_bitmap || old_ids.m_bitmap) {
+    (*this) |= old_ids;
+    return;
+  }
+
   if (m_impl.empty()) {
     m_impl = old_ids.m_impl;
     return;
@@ -85,9 +176,15 @@ void read_id_set::insert(const read_id_set& old_ids) {
       m_impl.insert(it, old_elem);
     }
   }
+  maybe_promote();
 }
 
 void read_id_set::insert(uint32_t read_id) {
+  if (m_bitmap) {
+    m_bitmap->insert(read_id);
+    return;
+  }
+
   uint32_t chunk_id = read_id / k_mask_bits;
   unsigned offset = read_id & (k_mask_bits - 1);
   auto it = std::lower_bound(m_impl.begin(), m_impl.end(), chunk_id);
@@ -100,9 +197,15 @@ void read_id_set::insert(uint32_t read_id) {
   rs.chunk_id = chunk_id;
   rs.read_id_bits |= 1UL << offset;
   m_impl.insert(it, std::move(rs));
+  maybe_promote();
 }
 
 void read_id_set::erase(uint32_t read_id) {
+  if (m_bitmap) {
+    m_bitmap->erase(read_id);
+    return;
+  }
+
   uint32_t chunk_id = read_id / k_mask_bits;
   unsigned offset = read_id & (k_mask_bits - 1);
 
@@ -116,9 +219,16 @@ void read_id_set::erase(uint32_t read_id) {
   }
 }
 
-void read_id_set::clear() { m_impl.clear(); }
+void read_id_set::clear() {
+  m_impl.clear();
+  m_bitmap.reset();
+}
 
 bool read_id_set::contains(uint32_t read_id) const {
+  if (m_bitmap) {
+    return m_bitmap->contains(read_id);
+  }
+
   uint32_t chunk_id = read_id / k_mask_bits;
   unsigned offset = read_id & (k_mask_bits - 1);
 
@@ -129,39 +239,7 @@ bool read_id_set::contains(uint32_t read_id) const {
   return false;
 }
 
-read_id_set read_id_set::intersection(const read_id_set& rhs) const {
-  read_id_set result;
-  result.m_impl.reserve(std::min(m_impl.size(), rhs.m_impl.size()));
-
-  auto it1 = m_impl.begin();
-  auto it2 = rhs.m_impl.begin();
-  while (it1 != m_impl.end() && it2 != rhs.m_impl.end()) {
-    if (it1->chunk_id < it2->chunk_id) {
-      ++it1;
-      continue;
-    }
-    if (it2->chunk_id < it1->chunk_id) {
-      ++it2;
-      continue;
-    }
-
-    CHECK_EQ(it1->chunk_id, it2->chunk_id);
-    elem intersection = *it1;
-    intersection.read_id_bits &= it2->read_id_bits;
-
-    if (!intersection.read_id_bits) {
-      ++it1;
-      ++it2;
-      continue;
-    }
-
-    result.m_impl.emplace_back(std::move(intersection));
-
-    ++it1;
-    ++it2;
-  }
-  return result;
-}
+read_id_set read_id_set::intersection(const read_id_set& rhs) const { return (*this) & rhs; }
 
 std::vector<uint32_t> read_id_set::to_vector() const {
   std::vector<uint32_t> result(begin(), end());
@@ -169,6 +247,11 @@ std::vector<uint32_t> read_id_set::to_vector() const {
 }
 
 read_id_set read_id_set::operator|(const read_id_set& rhs) const {
+  if (m_bitmap || rhs.m_bitmap) {
+    read_id_bitmap lhs_storage, rhs_storage;
+    return from_bitmap(as_bitmap(&lhs_storage) | rhs.as_bitmap(&rhs_storage));
+  }
+
   read_id_set result;
 
   result.m_impl.reserve(m_impl.size() + rhs.m_impl.size());
@@ -198,14 +281,34 @@ read_id_set read_id_set::operator|(const read_id_set& rhs) const {
   std::copy(it, m_impl.end(), std::back_inserter(result.m_impl));
   std::copy(rhs_it, rhs.m_impl.end(), std::back_inserter(result.m_impl));
 
+  result.maybe_promote();
   return result;
 }
 
 read_id_set read_id_set::operator-(const read_id_set& rhs) const {
+  if (m_bitmap) {
+    read_id_bitmap rhs_storage;
+    return from_bitmap((*m_bitmap) - rhs.as_bitmap(&rhs_storage));
+  }
+
   read_id_set result;
 
   result.m_impl.reserve(m_impl.size());
 
+  if (rhs.m_bitmap) {
+    // The result is no bigger than this set, so look up each of our
+    // chunks instead of converting.
+    for (const auto& e : m_impl) {
+      elem new_elem;
+      new_elem.chunk_id = e.chunk_id;
+      new_elem.read_id_bits = e.read_id_bits & ~rhs.m_bitmap->chunk_mask(e.chunk_id);
+      if (new_elem.read_id_bits) {
+        result.m_impl.emplace_back(new_elem);
+      }
+    }
+    return result;
+  }
+
   auto it = m_impl.begin();
   auto rhs_it = rhs.m_impl.begin();
 
@@ -237,8 +340,29 @@ read_id_set read_id_set::operator-(const read_id_set& rhs) const {
 }
 
 read_id_set read_id_set::operator&(const read_id_set& rhs) const {
+  if (m_bitmap && rhs.m_bitmap) {
+    return from_bitmap((*m_bitmap) & (*rhs.m_bitmap));
+  }
+
   read_id_set result;
 
+  if (m_bitmap || rhs.m_bitmap) {
+    // The result is no bigger than the small side, so look up each of
+    // its chunks in the big side.
+    const read_id_set& small = m_bitmap ? rhs : *this;
+    const read_id_bitmap& big = m_bitmap ? *m_bitmap : *rhs.m_bitmap;
+    result.m_impl.reserve(small.m_impl.size());
+    for (const auto& e : small.m_impl) {
+      elem new_elem;
+      new_elem.chunk_id = e.chunk_id;
+      new_elem.read_id_bits = e.read_id_bits & big.chunk_mask(e.chunk_id);
+      if (new_elem.read_id_bits) {
+        result.m_impl.emplace_back(new_elem);
+      }
+    }
+    return result;
+  }
+
   result.m_impl.reserve(std::min(m_impl.size(), rhs.m_impl.size()));
 
   auto it = m_impl.begin();
@@ -269,6 +393,12 @@ read_id_set read_id_set::operator&(const read_id_set& rhs) const {
 }
 
 read_id_set& read_id_set::operator|=(const read_id_set& rhs) {
+  if (m_bitmap && !rhs.m_bitmap) {
+    for (const auto& e : rhs.m_impl) {
+      m_bitmap->add_chunk(e.chunk_id, e.read_id_bits);
+    }
+    return *this;
+  }
   (*this) = (*this) | rhs;
   return *this;
 }
@@ -290,6 +420,13 @@ read_id_set read_id_set::operator|(const big_read_id_set& rhs) const {
 }
 
 read_id_set& read_id_set::operator|=(const big_read_id_set& rhs) {
+  if (m_bitmap) {
+    for (const auto& chunk : rhs.m_impl) {
+      m_bitmap->add_chunk(chunk.first, chunk.second);
+    }
+    return *this;
+  }
+
   big_read_id_set result = rhs;
   result |= *this;
   m_impl.clear();
@@ -300,10 +437,16 @@ read_id_set& read_id_set::operator|=(const big_read_id_set& rhs) {
     new_elem.read_id_bits = chunk.second;
     m_impl.push_back(new_elem);
   }
+  maybe_promote();
   return *this;
 }
 
 read_id_set& read_id_set::operator&=(const big_read_id_set& rhs) {
+  if (m_bitmap) {
+    (*this) = (*this) & read_id_set(rhs);
+    return *this;
+  }
+
   auto rhs_it = rhs.m_impl.begin();
   for (auto& chunk : m_impl) {
     auto next_it = rhs.m_impl.find(chunk.chunk_id);
@@ -324,6 +467,10 @@ read_id_set& read_id_set::operator&=(const big_read_id_set& rhs) {
 }
 
 read_id_set read_id_set::operator&(const big_read_id_set& rhs) const {
+  if (m_bitmap) {
+    return (*this) & read_id_set(rhs);
+  }
+
   read_id_set result;
   result.m_impl.reserve(m_impl.size());
 
@@ -353,6 +500,11 @@ read_id_set read_id_set::operator&(const big_read_id_set& rhs) const {
 }
 
 read_id_set& read_id_set::operator-=(const big_read_id_set& rhs) {
+  if (m_bitmap) {
+    (*this) = (*this) - read_id_set(rhs);
+    return *this;
+  }
+
   auto rhs_it = rhs.m_impl.begin();
   for (auto& chunk : m_impl) {
     auto next_it = rhs.m_impl.find(chunk.chunk_id);
@@ -374,7 +526,52 @@ read_id_set read_id_set::operator-(const big_read_id_set& rhs) const {
   return result;
 }
 
+bool read_id_set::operator==(const read_id_set& rhs) const {
+  if (!m_bitmap && !rhs.m_bitmap) {
+    return m_impl == rhs.m_impl;
+  }
+  if (m_bitmap && rhs.m_bitmap) {
+    return *m_bitmap == *rhs.m_bitmap;
+  }
+
+  // Sets of the same size may have different representations
+  // depending on how they were built.
+  const read_id_set& small = m_bitmap ? rhs : *this;
+  const read_id_bitmap& big = m_bitmap ? *m_bitmap : *rhs.m_bitmap;
+  auto it = big.chunk_begin();
+  for (const auto& e : small.m_impl) {
+    if (it.done() || it.chunk_id() != e.chunk_id || it.mask() != e.read_id_bits) {
+      return false;
+    }
+    it.next();
+  }
+  return it.done();
+}
+
 bool read_id_set::total_order_lt(const read_id_set& rhs) const {
+  if (m_bitmap || rhs.m_bitmap) {
+    std::vector<std::pair<uint32_t, read_id_mask_t>> chunks, rhs_chunks;
+    for_each_chunk([&chunks](uint32_t chunk_id, read_id_mask_t bits) {
+      chunks.emplace_back(chunk_id, bits);
+    });
+    rhs.for_each_chunk([&rhs_chunks](uint32_t chunk_id, read_id_mask_t bits) {
+      rhs_chunks.emplace_back(chunk_id, bits);
+    });
+    if (chunks.size() != rhs_chunks.size()) {
+      return chunks.size() < rhs_chunks.size();
+    }
+    for (size_t i = 0; i != chunks.size(); ++i) {
+      if (chunks[i].first != rhs_chunks[i].first) {
+        // Matches the comparison of chunk ids below.
+        return true;
+      }
+      if (chunks[i].second != rhs_chunks[i].second) {
+        return chunks[i].second < rhs_chunks[i].second;
+      }
+    }
+    return false;
+  }
+
   ssize_t size_diff = ssize_t(m_impl.size()) - ssize_t(rhs.m_impl.size());
   if (size_diff) {
     return size_diff < 0;
@@ -924,46 +1121,46 @@ size_t big_read_id_set::size() const {
 
 big_read_id_set& big_read_id_set::operator|=(const read_id_set& rhs) {
   auto it = m_impl.begin();
-  for (const auto& chunk : rhs.m_impl) {
-    it = m_impl.insert(it, std::make_pair(chunk.chunk_id, 0));
-    it->second |= chunk.read_id_bits;
-  }
+  rhs.for_each_chunk([&](uint32_t chunk_id, read_id_mask_t read_id_bits) {
+    it = m_impl.insert(it, std::make_pair(chunk_id, 0));
+    it->second |= read_id_bits;
+  });
   return *this;
 }
 
 big_read_id_set& big_read_id_set::operator-=(const read_id_set& rhs) {
   auto it = m_impl.begin();
-  for (const auto& chunk : rhs.m_impl) {
-    auto next_it = m_impl.find(chunk.chunk_id);
+  rhs.for_each_chunk([&](uint32_t chunk_id, read_id_mask_t read_id_bits) {
+    auto next_it = m_impl.find(chunk_id);
     if (next_it == m_impl.end()) {
-      continue;
+      return;
     }
     it = next_it;
-    it->second &= ~chunk.read_id_bits;
+    it->second &= ~read_id_bits;
     if (it->second) {
       ++it;
     } else {
       it = m_impl.erase(it);
     }
-  }
+  });
   return *this;
 }
 
 big_read_id_set& big_read_id_set::operator&=(const read_id_set& rhs) {
   auto it = m_impl.begin();
-  for (const auto& chunk : rhs.m_impl) {
-    auto next_it = m_impl.find(chunk.chunk_id);
+  rhs.for_each_chunk([&](uint32_t chunk_id, read_id_mask_t read_id_bits) {
+    auto next_it = m_impl.find(chunk_id);
     if (next_it == m_impl.end()) {
-      continue;
+      return;
     }
     it = m_impl.erase(it, next_it);
-    it->second &= chunk.read_id_bits;
+    it->second &= read_id_bits;
     if (it->second) {
       ++it;
     } else {
       it = m_impl.erase(it);
     }
-  }
+  });
   m_impl.erase(it, m_impl.end());
   return *this;
 }
@@ -6,6 +6,9 @@
 #include "absl/container/flat_hash_map.h"
 #include "base/base.h"
 #include "modules/bio_base/readmap.h"
+#include "modules/variants/read_id_bitmap.h"
+
+#include <memory>
 
 namespace variants {
 
@@ -14,6 +17,10 @@ namespace variants {
 // we track lists of read ids they can sometimes clump up.  Using a
 // mask to keep track of which read ids are present saves a lot of
 // memory if a lot of nearby read ids are present in a set.
+//
+// Large sets (such as the reads supporting a large assembly) are
+// stored as a read_id_bitmap instead, which makes set operations on
+// them much faster.
 using read_id_mask_t = uint32_t;
 class big_read_id_set;
 class read_id_set {
@@ -40,11 +47,20 @@ class read_id_set {
   static constexpr size_t k_num_small_elem = 3;
   using impl_t = boost::container::small_vector<elem, k_num_small_elem>;
 
+  // Sets with more than this many elements switch to using a
+  // read_id_bitmap.  Results of set operations with fewer than half
+  // this many switch back.
+  static constexpr size_t k_max_small_elems = 64;
+
  public:
   using value_type = const uint32_t;
 
   read_id_set() = default;
   read_id_set(const big_read_id_set&);
+  read_id_set(const read_id_set& rhs);
+  read_id_set(read_id_set&&) = default;
+  read_id_set& operator=(const read_id_set& rhs);
+  read_id_set& operator=(read_id_set&&) = default;
 
   template <typename Iterator>
   void insert(Iterator begin, const Iterator& end) {
@@ -57,7 +73,7 @@ class read_id_set {
   void insert(const read_id_set& old_read_ids);
   void erase(uint32_t read_id);
   void clear();
-  bool empty() const { return m_impl.empty(); }
+  bool empty() const { return m_bitmap ? m_bitmap->empty() : m_impl.empty(); }
   bool contains(uint32_t read_id) const;
 
   read_id_set intersection(const read_id_set& rhs) const;
@@ -91,7 +107,7 @@ class read_id_set {
   class iterator : public std::iterator<std::forward_iterator_tag, const uint32_t> {
    public:
     bool operator==(const iterator& rhs) const {
-      return m_cur == rhs.m_cur && m_read_id == rhs.m_read_id;
+      return m_cur == rhs.m_cur && m_chunks == rhs.m_chunks && m_read_id == rhs.m_read_id;
     }
     bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
     const uint32_t& operator*() const {
@@ -109,12 +125,19 @@ class read_id_set {
     }
 
     iterator(impl_t::const_iterator new_cur) : m_cur(new_cur) {}
+    iterator(read_id_bitmap::chunk_iterator new_chunks)
+        : m_chunks(new_chunks), m_use_chunks(true) {}
 
    private:
     void advance_to_current() {
       if (m_read_id == std::numeric_limits<uint32_t>::max()) {
-        m_bits_left = m_cur->read_id_bits;
-        m_read_id = m_cur->chunk_id * k_mask_bits;
+        if (m_use_chunks) {
+          m_bits_left = m_chunks.mask();
+          m_read_id = m_chunks.chunk_id() * k_mask_bits;
+        } else {
+          m_bits_left = m_cur->read_id_bits;
+          m_read_id = m_cur->chunk_id * k_mask_bits;
+        }
       }
       CHECK(m_bits_left);
       unsigned offset = __builtin_ctzl(m_bits_left);
@@ -129,32 +152,71 @@ class read_id_set {
       m_bits_left >>= 1;
       ++m_read_id;
       if (!m_bits_left) {
-        ++m_cur;
+        if (m_use_chunks) {
+          m_chunks.next();
+        } else {
+          ++m_cur;
+        }
         m_read_id = std::numeric_limits<uint32_t>::max();
       }
     }
 
     impl_t::const_iterator m_cur;
+    read_id_bitmap::chunk_iterator m_chunks;
+    bool m_use_chunks = false;
     uint32_t m_read_id = std::numeric_limits<uint32_t>::max();
     read_id_mask_t m_bits_left = 0;
   };
 
-  iterator begin() const { return iterator(m_impl.begin()); }
-  iterator end() const { return iterator(m_impl.end()); }
+  iterator begin() const {
+    return m_bitmap ? iterator(m_bitmap->chunk_begin()) : iterator(m_impl.begin());
+  }
+  iterator end() const {
+    return m_bitmap ? iterator(m_bitmap->chunk_end()) : iterator(m_impl.end());
+  }
 
-  bool operator==(const read_id_set& rhs) const { return m_impl == rhs.m_impl; }
-  bool operator!=(const read_id_set& rhs) const { return m_impl != rhs.m_impl; }
+  bool operator==(const read_id_set& rhs) const;
+  bool operator!=(const read_id_set& rhs) const { return !(*this == rhs); }
 
   using const_iterator = iterator;
 
   size_t size() const;
 
+  // Approximate number of bytes allocated outside of this object.
+  size_t memory_used() const;
+
   // Return a total ordering on read id sets.
   bool total_order_lt(const read_id_set& rhs) const;
   friend std::ostream& operator<<(std::ostream& os, const read_id_set& ids);
 
  protected:
+  // Calls f(chunk_id, read_id_bits) for each nonempty chunk, in order.
+  template <typename F>
+  void for_each_chunk(const F& f) const {
+    if (m_bitmap) {
+      for (auto it = m_bitmap->chunk_begin(); !it.done(); it.next()) {
+        f(it.chunk_id(), it.mask());
+      }
+    } else {
+      for (const auto& e : m_impl) {
+        f(e.chunk_id, e.read_id_bits);
+      }
+    }
+  }
+
+  // Switches to a read_id_bitmap if m_impl has grown too big.
+  void maybe_promote();
+  // Switches back to m_impl if m_bitmap is small.
+  void maybe_demote();
+  // Returns the contents of this set as a bitmap, using "storage" if
+  // this set is not already represented as one.
+  const read_id_bitmap& as_bitmap(read_id_bitmap* storage) const;
+  static read_id_set from_bitmap(read_id_bitmap bitmap);
+
+  // Only one of these is used at a time; m_impl is empty when m_bitmap
+  // is present.
   impl_t m_impl;
+  std::unique_ptr<read_id_bitmap> m_bitmap;
 };
 
 // Variant of read_id_set that allows faster operations at the expense
@@ -0,0 +1,149 @@
+#include "benchmark/benchmark.h"
+#include "modules/variants/read_set.h"
+
+#include <random>
+
+std::random_device random_dev;
+
+namespace variants {
+
+// Builds pairs of read id sets resembling those seen when tracing
+// assemblies: clumps of consecutive read ids (reads from the same
+// seqset entry) scattered over the readmap.  "spread" is the ratio of
+// the range of read ids to the number of reads.
+class read_set_benchmark {
+ public:
+  read_set_benchmark(size_t num_reads, size_t spread = 16)
+      : m_rand_source(random_dev()), m_spread(spread) {
+    m_lhs = make_set(num_reads);
+    m_rhs = make_set(num_reads);
+    m_big_rhs |= m_rhs;
+  }
+
+  read_id_set make_set(size_t num_reads) {
+    std::uniform_int_distribution<uint32_t> rand_start(0, num_reads * m_spread);
+    std::uniform_int_distribution<uint32_t> rand_clump(1, 40);
+    read_id_set result;
+    while (result.size() < num_reads) {
+      uint32_t start = rand_start(m_rand_source);
+      uint32_t clump = rand_clump(m_rand_source);
+      for (uint32_t read_id = start; read_id != start + clump; ++read_id) {
+        result.insert(read_id);
+      }
+    }
+    return result;
+  }
+
+  const read_id_set& lhs() const { return m_lhs; }
+  const read_id_set& rhs() const { return m_rhs; }
+  const big_read_id_set& big_rhs() const { return m_big_rhs; }
+
+ private:
+  std::mt19937 m_rand_source;
+  size_t m_spread;
+
+  read_id_set m_lhs;
+  read_id_set m_rhs;
+  big_read_id_set m_big_rhs;
+};
+
+}  // namespace variants
+
+using namespace variants;
+
+static void BM_union(benchmark::State& state) {
+  read_set_benchmark b(state.range(0), state.range(2));
+  read_id_bitmap::g_use_avx2 = state.range(1);
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(b.lhs() | b.rhs());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * 2);
+}
+
+static void BM_intersection(benchmark::State& state) {
+  read_set_benchmark b(state.range(0), state.range(2));
+  read_id_bitmap::g_use_avx2 = state.range(1);
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(b.lhs() & b.rhs());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * 2);
+}
+
+static void BM_difference(benchmark::State& state) {
+  read_set_benchmark b(state.range(0), state.range(2));
+  read_id_bitmap::g_use_avx2 = state.range(1);
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(b.lhs() - b.rhs());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * 2);
+}
+
+static void BM_union_in_place(benchmark::State& state) {
+  read_set_benchmark b(state.range(0), state.range(2));
+  read_id_bitmap::g_use_avx2 = state.range(1);
+
+  while (state.KeepRunning()) {
+    read_id_set result = b.lhs();
+    result |= b.rhs();
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * 2);
+}
+
+// Compare against the btree-based big_read_id_set.
+static void BM_big_union(benchmark::State& state) {
+  read_set_benchmark b(state.range(0));
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(b.big_rhs() | b.lhs());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * 2);
+}
+
+static void BM_big_intersection(benchmark::State& state) {
+  read_set_benchmark b(state.range(0));
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(b.big_rhs() & b.lhs());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * 2);
+}
+
+static void BM_iterate(benchmark::State& state) {
+  read_set_benchmark b(state.range(0));
+
+  while (state.KeepRunning()) {
+    uint64_t tot = 0;
+    for (uint32_t read_id : b.lhs()) {
+      tot += read_id;
+    }
+    benchmark::DoNotOptimize(tot);
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0));
+}
+
+// Set sizes from a handful of reads (the small inline representation)
+// up to the tens of thousands of reads seen in large assemblies.  Sets
+// with a spread of 2 are dense enough to be stored as bitmaps.
+static void set_sizes(benchmark::internal::Benchmark* b) {
+  for (int num_reads : {4, 64, 1024, 16384, 65536}) {
+    for (int use_avx2 : {0, 1}) {
+      for (int spread : {16, 2}) {
+        b->Args({num_reads, use_avx2, spread});
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_union)->Apply(set_sizes);
+BENCHMARK(BM_intersection)->Apply(set_sizes);
+BENCHMARK(BM_difference)->Apply(set_sizes);
+BENCHMARK(BM_union_in_place)->Apply(set_sizes);
+BENCHMARK(BM_big_union)->RangeMultiplier(16)->Range(4, 65536);
+BENCHMARK(BM_big_intersection)->RangeMultiplier(16)->Range(4, 65536);
+BENCHMARK(BM_iterate)->RangeMultiplier(16)->Range(4, 65536);
+
+BENCHMARK_MAIN();
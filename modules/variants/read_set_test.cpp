@@ -83,6 +83,115 @@ INSTANTIATE_TEST_CASE_P(read_id_set_tests, read_id_set_test,
                             ::testing::Range(0, 1 << k_num_read_id_set_values),
                             ::testing::Range(0, 1 << k_num_read_id_set_values)));
 
+// Sets with enough elements to be stored as a read_id_bitmap.
+class large_read_id_set_test : public Test {
+ public:
+  static std::set<uint32_t> spread_ids(uint32_t start, uint32_t step, size_t count) {
+    std::set<uint32_t> result;
+    for (size_t i = 0; i != count; ++i) {
+      result.insert(start + i * step);
+    }
+    return result;
+  }
+
+  static read_id_set to_read_id_set(const std::set<uint32_t>& ids) {
+    read_id_set result;
+    result.insert(ids.begin(), ids.end());
+    return result;
+  }
+
+  static std::set<uint32_t> to_set(const read_id_set& ids) {
+    std::set<uint32_t> result(ids.begin(), ids.end());
+    EXPECT_EQ(result.size(), ids.size());
+    return result;
+  }
+};
+
+TEST_F(large_read_id_set_test, mixed_sizes) {
+  std::set<uint32_t> big1 = spread_ids(0, 37, 5000);
+  std::set<uint32_t> big2 = spread_ids(1000, 3, 50000);
+  std::set<uint32_t> small = {0, 37, 38, 1003, 999999};
+
+  for (const auto& lhs : {big1, big2, small}) {
+    for (const auto& rhs : {big1, big2, small}) {
+      read_id_set lhs_ids = to_read_id_set(lhs);
+      read_id_set rhs_ids = to_read_id_set(rhs);
+
+      std::set<uint32_t> expected;
+      std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                     std::inserter(expected, expected.end()));
+      EXPECT_THAT(to_set(lhs_ids | rhs_ids), ContainerEq(expected));
+      read_id_set inserted = lhs_ids;
+      inserted.insert(rhs_ids);
+      EXPECT_EQ(inserted, lhs_ids | rhs_ids);
+
+      expected.clear();
+      std::set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                            std::inserter(expected, expected.end()));
+      EXPECT_THAT(to_set(lhs_ids & rhs_ids), ContainerEq(expected));
+      EXPECT_THAT(to_set(lhs_ids.intersection(rhs_ids)), ContainerEq(expected));
+
+      expected.clear();
+      std::set_difference(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                          std::inserter(expected, expected.end()));
+      EXPECT_THAT(to_set(lhs_ids - rhs_ids), ContainerEq(expected));
+      read_id_set subtracted = lhs_ids;
+      subtracted -= rhs_ids;
+      EXPECT_EQ(subtracted, lhs_ids - rhs_ids);
+    }
+  }
+}
+
+TEST_F(large_read_id_set_test, representation_independent) {
+  std::set<uint32_t> ids = spread_ids(500, 40, 100);
+  read_id_set large = to_read_id_set(ids);
+
+  // Erasing doesn't switch back to the small representation, but
+  // results of set operations do.
+  read_id_set erased = large;
+  for (uint32_t id : spread_ids(500 + 40 * 50, 40, 50)) {
+    erased.erase(id);
+  }
+  read_id_set small = large & to_read_id_set(spread_ids(500, 40, 50));
+  EXPECT_THAT(to_set(erased), ContainerEq(spread_ids(500, 40, 50)));
+  EXPECT_EQ(erased, small);
+  EXPECT_EQ(small, erased);
+  EXPECT_FALSE(erased.total_order_lt(small));
+  EXPECT_FALSE(small.total_order_lt(erased));
+
+  EXPECT_NE(small, large);
+  EXPECT_TRUE(small.total_order_lt(large));
+  EXPECT_FALSE(large.total_order_lt(small));
+
+  read_id_set copied = large;
+  EXPECT_EQ(copied, large);
+  copied.insert(7);
+  EXPECT_NE(copied, large);
+  EXPECT_TRUE(copied.contains(7));
+  EXPECT_FALSE(large.contains(7));
+  copied.clear();
+  EXPECT_TRUE(copied.empty());
+  EXPECT_EQ(0, copied.size());
+}
+
+TEST_F(large_read_id_set_test, big_read_id_set) {
+  std::set<uint32_t> ids = spread_ids(0, 5, 10000);
+  std::set<uint32_t> other_ids = spread_ids(10, 7, 10000);
+  read_id_set large = to_read_id_set(ids);
+  read_id_set other_large = to_read_id_set(other_ids);
+
+  big_read_id_set big;
+  big |= other_large;
+  EXPECT_EQ(other_ids.size(), big.size());
+  EXPECT_EQ(read_id_set(big), other_large);
+  EXPECT_EQ(large & other_large, large & big);
+  EXPECT_EQ(large - other_large, large - big);
+  EXPECT_EQ(large | other_large, large | big);
+  EXPECT_EQ(read_id_set(big - large), other_large - large);
+  EXPECT_EQ(read_id_set(big & large), other_large & large);
+  EXPECT_EQ(read_id_set(big | large), other_large | large);
+}
+
 read_id_set read_id_set_for_elems(const std::vector<uint32_t>& elems) {
   read_id_set new_container;
   new_container.insert(elems.begin(), elems.end());
@@ -1,6 +1,14 @@
 #include "modules/variants/ref_map.h"
 
+#include <boost/filesystem.hpp>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "modules/io/hash_io.h"
+#include "modules/io/make_unique.h"
 #include "modules/io/parallel.h"
+#include "modules/io/spiral_file_mmap.h"
 
 namespace variants {
 
@@ -20,6 +28,11 @@ ref_map::ref_map(const seqset* the_seqset, const reference* ref)
 ref_map::ref_map(const seqset* the_seqset, const reference* ref,
                  const spiral_file_create_state& state)
     : m_seqset(the_seqset), m_ref(ref) {
+  ref_map_metadata metadata;
+  metadata.seqset_uuid = m_seqset->uuid();
+  metadata.reference_checksum = reference_checksum(m_ref);
+  state.create_json<ref_map_metadata>("ref_map.json", metadata);
+
   m_mutable_ref_map.reset(new mutable_packed_vector<unsigned, 8>(state, m_seqset->size()));
   m_ref_map = m_mutable_ref_map;
 }
@@ -27,10 +40,78 @@ ref_map::ref_map(const seqset* the_seqset, const reference* ref,
 ref_map::ref_map(const seqset* the_seqset, const reference* ref,
                  const spiral_file_open_state& state)
     : m_seqset(the_seqset), m_ref(ref) {
+  if (state.subpart_present("ref_map.json")) {
+    ref_map_metadata metadata = state.open_json<ref_map_metadata>("ref_map.json");
+    if (!metadata.seqset_uuid.empty() && !m_seqset->uuid().empty() &&
+        metadata.seqset_uuid != m_seqset->uuid()) {
+      throw io_exception("Reference map was built for seqset " + metadata.seqset_uuid +
+                         ", not " + m_seqset->uuid());
+    }
+    if (metadata.reference_checksum != reference_checksum(m_ref)) {
+      throw io_exception("Reference map was built for a different reference (checksum " +
+                         metadata.reference_checksum + ")");
+    }
+  }
   m_ref_map.reset(new packed_vector<unsigned, 8>(state));
   CHECK_EQ(m_ref_map->size(), m_seqset->size());
 }
 
+std::unique_ptr<ref_map> ref_map::open_or_build(const seqset* the_seqset, const reference* ref,
+                                                const std::string& path,
+                                                const spiral_file_options& options,
+                                                progress_handler_t progress) {
+  if (!boost::filesystem::exists(path)) {
+    boost::filesystem::path parent = boost::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+      boost::filesystem::create_directories(parent);
+    }
+
+    // Each process builds into its own temporary file, so concurrent
+    // runs don't interfere with each other.
+    std::string new_path = path + ".new." + std::to_string(getpid());
+    unlink(new_path.c_str());
+    try {
+      {
+        spiral_file_create_mmap c(new_path);
+        SPLOG("Generating refmap in %s", new_path.c_str());
+        ref_map build_rmap(the_seqset, ref, c.create());
+        build_rmap.build(progress);
+      }
+      if (rename(new_path.c_str(), path.c_str()) != 0) {
+        throw io_exception("Unable to rename " + new_path + " to " + path + ": " +
+                           strerror(errno));
+      }
+    } catch (...) {
+      // Don't leave a partial ref map behind.
+      unlink(new_path.c_str());
+      throw;
+    }
+  } else {
+    progress(1);
+  }
+
+  SPLOG("Opening refmap %s", path.c_str());
+  spiral_file_open_mmap o(path, options);
+  return make_unique<ref_map>(the_seqset, ref, o.open());
+}
+
+membuf ref_map::open_entry_range(const spiral_file_open_state& state, uint64_t first_entry,
+                                 uint64_t limit_entry) {
+  return packed_vector<unsigned, 8>::open_range(state, first_entry, limit_entry);
+}
+
+std::string ref_map::reference_checksum(const reference* ref) {
+  md5_hash_writer hasher;
+  for (const auto& scaffold : ref->get_flat_ref().get_index().scaffolds) {
+    hasher.print("%s\t%lu\t%s\n", scaffold.name.c_str(), scaffold.size, scaffold.md5.c_str());
+  }
+  for (const auto& extent : ref->get_flat_ref().get_index().extents) {
+    hasher.print("%lu\t%lu\t%lu\n", extent.scaffold_name, extent.offset, extent.size);
+  }
+  hasher.finish();
+  return hasher.hex();
+}
+
 namespace {
 
 struct extent_slice {
@@ -42,14 +123,19 @@ struct extent_slice {
 }  // namespace
 
 void ref_map::flush_updates(std::vector<uint64_t>& seqset_ids, bool is_rev_comp) {
-  for (size_t flush_id = 0; flush_id != k_num_flush_buckets; ++flush_id) {
-    std::lock_guard<std::mutex> l(m_flush_bucket_mu[flush_id]);
-    size_t flush_start = flush_id * m_seqset_entries_per_flush_bucket;
+  // Sort so each bucket's updates are contiguous and each bucket's
+  // lock only needs to be taken once.
+  std::sort(seqset_ids.begin(), seqset_ids.end());
+  auto bucket_start = seqset_ids.begin();
+  while (bucket_start != seqset_ids.end()) {
+    size_t flush_id = *bucket_start / m_seqset_entries_per_flush_bucket;
+    DCHECK_LT(flush_id, k_num_flush_buckets);
     size_t flush_limit = (flush_id + 1) * m_seqset_entries_per_flush_bucket;
-    for (uint64_t seqset_id : seqset_ids) {
-      if (seqset_id < flush_start || seqset_id >= flush_limit) {
-        continue;
-      }
+    auto bucket_end = std::lower_bound(bucket_start, seqset_ids.end(), flush_limit);
+
+    std::lock_guard<std::mutex> l(m_flush_bucket_mu[flush_id]);
+    for (auto it = bucket_start; it != bucket_end; ++it) {
+      uint64_t seqset_id = *it;
       uint8_t old_val = m_mutable_ref_map->at(seqset_id);
       unsigned old_count = old_val & k_count_mask;
       unsigned new_count = old_count;
@@ -65,6 +151,7 @@ void ref_map::flush_updates(std::vector<uint64_t>& seqset_ids, bool is_rev_comp)
       }
       m_mutable_ref_map->at(seqset_id).set_unlocked(new_val);
     }
+    bucket_start = bucket_end;
   }
   seqset_ids.clear();
 }
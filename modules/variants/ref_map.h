@@ -6,6 +6,7 @@
 #include "modules/io/packed_vector.h"
 #include "modules/io/progress.h"
 #include "modules/io/spiral_file.h"
+#include "modules/io/transfer_object.h"
 
 namespace variants {
 
@@ -44,6 +45,17 @@ struct ref_anchor {
   ref_anchor& operator-=(int64_t offset) { return (*this) += (-offset); }
 };
 
+// Identifies the seqset and reference a saved ref_map was built from.
+struct ref_map_metadata {
+  TRANSFER_OBJECT {
+    VERSION(0);
+    FIELD(seqset_uuid);
+    FIELD(reference_checksum);
+  };
+  std::string seqset_uuid;
+  std::string reference_checksum;
+};
+
 // ref_map tracks which entries in a seqset match reference, and how
 // ambiguous those matches are.
 class ref_map {
@@ -97,8 +109,30 @@ class ref_map {
 
   ref_map(const seqset* the_seqset, const reference* ref);
   ref_map(const seqset* the_seqset, const reference* ref, const spiral_file_create_state& state);
+  // Throws io_exception if the saved map was built from a different
+  // seqset or reference.  Maps saved before this was recorded are not
+  // checked.
   ref_map(const seqset* the_seqset, const reference* ref, const spiral_file_open_state& state);
 
+  // Opens the map saved at "path", building and saving it first if it
+  // doesn't exist.  The map is built in a temporary file which is
+  // renamed into place when complete, so an interrupted build never
+  // leaves a partial map, and concurrent runs can share the same path.
+  static std::unique_ptr<ref_map> open_or_build(
+      const seqset* the_seqset, const reference* ref, const std::string& path,
+      const spiral_file_options& options = spiral_file_options(),
+      progress_handler_t progress = null_progress_handler);
+
+  // Returns a checksum identifying the contents of a reference, made
+  // from the names, sizes, and MD5s of its scaffolds.  Suitable for
+  // keeping maps for several references side by side.
+  static std::string reference_checksum(const reference* ref);
+
+  // Opens the part of a saved map covering seqset entries
+  // [first_entry, limit_entry), without opening the rest of it.
+  static membuf open_entry_range(const spiral_file_open_state& state, uint64_t first_entry,
+                                 uint64_t limit_entry);
+
   void build(progress_handler_t progress = null_progress_handler);
 
   entry get(uint64_t seqset_id) const;
@@ -4,6 +4,8 @@
 #include "modules/bio_base/dna_testutil.h"
 #include "modules/bio_base/reference_testutil.h"
 #include "modules/bio_base/seqset_testutil.h"
+#include "modules/io/spiral_file_mmap.h"
+#include "modules/test/test_utils.h"
 #include "modules/variants/ref_map.h"
 
 using namespace testing;
@@ -243,6 +245,43 @@ TEST_P(ref_map_chunk_test, chunking) {
   }
 }
 
+TEST_F(ref_map_test, open_or_build) {
+  use_reference({tseq("abcdefghijklmno")});
+  use_reads({tseq("abcde"), tseq("lmnop")});
+  std::string path = make_path("ref_map_test/maps/") + ref_map::reference_checksum(m_ref.get());
+
+  std::unique_ptr<ref_map> built = ref_map::open_or_build(m_seqset, m_ref.get(), path);
+  ASSERT_TRUE(boost::filesystem::exists(path));
+  uint64_t abcde_id = m_seqset->find(tseq("abcde")).begin();
+  uint64_t lmnop_id = m_seqset->find(tseq("lmnop")).begin();
+  EXPECT_TRUE(built->get(abcde_id).fwd_match());
+  EXPECT_FALSE(built->get(lmnop_id).is_match());
+
+  // Opening again uses the saved map.
+  std::unique_ptr<ref_map> opened = ref_map::open_or_build(m_seqset, m_ref.get(), path);
+  EXPECT_TRUE(opened->get(abcde_id).fwd_match());
+  EXPECT_FALSE(opened->get(lmnop_id).is_match());
+
+  // A map for a different reference is kept separately, and the saved
+  // map can't be used with it.
+  std::unique_ptr<reference> other_ref = create_reference({tseq("hijklmnop")});
+  std::string other_checksum = ref_map::reference_checksum(other_ref.get());
+  EXPECT_NE(other_checksum, ref_map::reference_checksum(m_ref.get()));
+  {
+    spiral_file_open_mmap o(path);
+    EXPECT_THROW(ref_map(m_seqset, other_ref.get(), o.open()), io_exception);
+
+    // Entry ranges can be opened on their own, one byte per entry.
+    membuf range = ref_map::open_entry_range(o.open(), abcde_id, abcde_id + 1);
+    ASSERT_EQ(1, range.size());
+    EXPECT_TRUE(ref_map::entry(uint8_t(range.data()[0])).fwd_match());
+  }
+  std::string other_path = make_path("ref_map_test/maps/") + other_checksum;
+  std::unique_ptr<ref_map> other = ref_map::open_or_build(m_seqset, other_ref.get(), other_path);
+  EXPECT_TRUE(other->get(lmnop_id).fwd_match());
+  EXPECT_TRUE(built->get(abcde_id).fwd_match());
+}
+
 INSTANTIATE_TEST_CASE_P(ref_map_chunk_tests, ref_map_chunk_test,
                         ::testing::Values(std::make_pair(0, 1),
                                           std::make_pair(0, 2),
@@ -0,0 +1,338 @@
+#include "modules/variants/region_pipeline.h"
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "modules/io/parallel.h"
+#include "modules/variants/add_ref.h"
+#include "modules/variants/align_count.h"
+#include "modules/variants/dedup_cov_reads.h"
+#include "modules/variants/limit_alleles.h"
+#include "modules/variants/pair_cov.h"
+#include "modules/variants/pair_edge_cov.h"
+#include "modules/variants/place_pair_cov.h"
+#include "modules/variants/read_cov.h"
+#include "modules/variants/trim_ref.h"
+
+namespace variants {
+
+namespace {
+
+// Parses the parameters for a single step, making sure each supplied
+// parameter is used.
+class step_params {
+ public:
+  step_params(const region_pipeline_step& step) : m_step(step), m_unused(step.params) {}
+
+  int64_t get_int(const std::string& name, int64_t default_value) {
+    auto it = m_unused.find(name);
+    if (it == m_unused.end()) {
+      return default_value;
+    }
+    int64_t result;
+    if (!absl::SimpleAtoi(it->second, &result)) {
+      throw io_exception("Parameter " + name + " of " + m_step.name +
+                         " must be an integer; got: " + it->second);
+    }
+    m_unused.erase(it);
+    return result;
+  }
+
+  bool get_bool(const std::string& name, bool default_value) {
+    auto it = m_unused.find(name);
+    if (it == m_unused.end()) {
+      return default_value;
+    }
+    bool result;
+    if (!absl::SimpleAtob(it->second, &result)) {
+      throw io_exception("Parameter " + name + " of " + m_step.name +
+                         " must be a boolean; got: " + it->second);
+    }
+    m_unused.erase(it);
+    return result;
+  }
+
+  void check_all_used() const {
+    if (!m_unused.empty()) {
+      std::vector<std::string> names;
+      for (const auto& param : m_unused) {
+        names.push_back(param.first);
+      }
+      throw io_exception("Unknown parameters for " + m_step.name + ": " +
+                         absl::StrJoin(names, ", "));
+    }
+  }
+
+ private:
+  const region_pipeline_step& m_step;
+  std::map<std::string, std::string> m_unused;
+};
+
+// Passes through assemblies that satisfy a predicate.
+class filter_step : public assemble_pipeline_interface {
+ public:
+  filter_step(const std::function<bool(const assembly_ptr&)>& keep_f, pipeline_step_t output,
+              const std::string& description)
+      : m_keep_f(keep_f), m_output(std::move(output)), m_description(description) {}
+
+  void on_assembly(assembly_ptr a) override {
+    if (m_keep_f(a)) {
+      m_output->add(std::move(a));
+    }
+  }
+  std::string description() const override { return m_description; }
+
+ private:
+  std::function<bool(const assembly_ptr&)> m_keep_f;
+  pipeline_step_t m_output;
+  std::string m_description;
+};
+
+// Owns a step which must be flushed explicitly before it's destroyed.
+class flush_on_destroy_step : public assemble_pipeline_interface {
+ public:
+  flush_on_destroy_step(pipeline_step_t step) : m_step(std::move(step)) {}
+  ~flush_on_destroy_step() override { m_step->flush(); }
+
+  void on_assembly(assembly_ptr a) override { m_step->add(std::move(a)); }
+  std::string description() const override { return m_step->description(); }
+
+ private:
+  pipeline_step_t m_step;
+};
+
+// Same priority as LimitAlleles in parallel_regions.py: reference
+// first, then the most phases, then the most bases.
+std::vector<assembly_ptr> sort_alleles_by_priority(std::vector<assembly_ptr> asms) {
+  auto priority = [](const assembly_ptr& a) {
+    return std::make_tuple(a->matches_reference, a->phase_ids.size(),
+                           aoffset_t(a->right_offset - a->left_offset) + aoffset_t(a->seq.size()));
+  };
+  std::stable_sort(asms.begin(), asms.end(), [&](const assembly_ptr& a, const assembly_ptr& b) {
+    return priority(a) > priority(b);
+  });
+  return asms;
+}
+
+bool not_reference(const assembly_ptr& a) { return !a->matches_reference; }
+
+void on_allele_limited(const assembly_ptr& a) {
+  a->read_coverage.emplace();
+  a->pair_read_coverage.emplace();
+  a->bypass_coverage = true;
+  a->phase_ids.clear();
+}
+
+const std::vector<std::string> g_step_names = {
+    "add_ref",  "align_count",   "dedup_cov_reads", "discard_ref", "filter",  "limit_alleles",
+    "pair_cov", "pair_edge_cov", "place_pair_cov",  "read_cov",    "trim_ref"};
+
+}  // namespace
+
+region_pipeline::region_pipeline(const assemble_options& options,
+                                 const std::vector<region_pipeline_step>& steps)
+    : m_options(options) {
+  CHECK(m_options.seqset);
+  CHECK(m_options.readmap);
+  for (const auto& step : steps) {
+    m_step_factories.push_back(make_step_factory(step));
+  }
+}
+
+region_pipeline::~region_pipeline() = default;
+
+std::vector<std::string> region_pipeline::step_names() { return g_step_names; }
+
+region_pipeline::step_factory_t region_pipeline::make_step_factory(
+    const region_pipeline_step& step) {
+  step_params params(step);
+  step_factory_t result;
+
+  if (step.name == "trim_ref") {
+    // Like the python trim_ref, discard reference-only assemblies.
+    result = [](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      pipeline_step_t discard_ref =
+          make_unique<filter_step>(not_reference, std::move(output), "region_pipeline_trim_ref");
+      return make_unique<ref_trimmer>(opts, std::move(discard_ref));
+    };
+  } else if (step.name == "add_ref") {
+    unsigned pad_bases = params.get_int("pad_bases", 0);
+    bool whole_ref = params.get_bool("whole_ref", false);
+    int max_len = params.get_int("max_len", 0);
+    result = [=](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<add_ref>(opts, pad_bases, whole_ref, max_len, std::move(output));
+    };
+  } else if (step.name == "discard_ref") {
+    result = [](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<filter_step>(not_reference, std::move(output),
+                                      "region_pipeline_discard_ref");
+    };
+  } else if (step.name == "filter") {
+    if (!step.filter) {
+      throw io_exception("filter steps must supply a filter function");
+    }
+    auto keep_f = step.filter;
+    result = [keep_f](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<filter_step>(keep_f, std::move(output), "region_pipeline_filter");
+    };
+  } else if (step.name == "limit_alleles") {
+    size_t max_alleles = params.get_int("max_alleles", 100);
+    result = [max_alleles](const assemble_options& opts,
+                           pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<limit_alleles>(max_alleles, sort_alleles_by_priority, on_allele_limited,
+                                        std::move(output));
+    };
+  } else if (step.name == "read_cov") {
+    int max_reads_per_entry = params.get_int("max_reads_per_entry", 0);
+    int max_coverage_paths = params.get_int("max_coverage_paths", 0);
+    result = [=](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      assemble_options cov_opts = opts;
+      cov_opts.read_cov_max_reads_per_entry = max_reads_per_entry;
+      cov_opts.max_coverage_paths = max_coverage_paths;
+      return make_unique<read_cov>(cov_opts, std::move(output));
+    };
+  } else if (step.name == "pair_cov" || step.name == "place_pair_cov") {
+    aoffset_t min_insert = params.get_int("min_insert_size", 200);
+    aoffset_t max_insert = params.get_int("max_insert_size", 1000);
+    if (step.name == "pair_cov") {
+      result = [=](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+        assemble_options pair_opts = opts;
+        pair_opts.min_pair_distance = min_insert;
+        pair_opts.max_pair_distance = max_insert;
+        return make_unique<pair_cov>(pair_opts, std::move(output));
+      };
+    } else {
+      place_pair_options popts;
+      popts.ideal_pair_distance = params.get_int("ideal_insert_size", 400);
+      popts.max_ambig = params.get_int("max_ambig", 15);
+      result = [=](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+        assemble_options pair_opts = opts;
+        pair_opts.min_pair_distance = min_insert;
+        pair_opts.max_pair_distance = max_insert;
+        return make_unique<flush_on_destroy_step>(
+            make_unique<place_pair_cov>(pair_opts, popts, std::move(output)));
+      };
+    }
+  } else if (step.name == "pair_edge_cov") {
+    result = [](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<pair_edge_cov>(opts, std::move(output));
+    };
+  } else if (step.name == "align_count") {
+    result = [](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<align_count>(opts, std::move(output));
+    };
+  } else if (step.name == "dedup_cov_reads") {
+    result = [](const assemble_options& opts, pipeline_step_t output) -> pipeline_step_t {
+      return make_unique<dedup_cov_reads>(opts, std::move(output));
+    };
+  } else {
+    throw io_exception("Unknown region pipeline step " + step.name + "; supported steps are: " +
+                       absl::StrJoin(g_step_names, ", "));
+  }
+
+  params.check_all_used();
+  return result;
+}
+
+region_pipeline_result region_pipeline::run_region(
+    const scaffold& s, const vcf_region& region, const std::vector<std::string>& vcf_lines) const {
+  region_pipeline_result result;
+  result.region = region;
+
+  assemble_options opts = m_options;
+  opts.scaffold = &s;
+  opts.scaffold_name = region.scaffold_name;
+
+  // Each step is flushed and destroyed before the next one is, the
+  // same as when each step is a separate python generator.
+  std::vector<pipeline_step_t> steps(m_step_factories.size() + 1);
+  steps.back() = make_unique<assemble_lambda_output>(
+      [&result](assembly_ptr a) { result.assemblies.push_back(std::move(a)); },
+      "region_pipeline_output");
+  for (size_t i = m_step_factories.size(); i > 0; --i) {
+    assemble_pipeline_interface* next_input = steps[i].get();
+    steps[i - 1] = m_step_factories[i - 1](
+        opts, make_unique<assemble_lambda_output>(
+                  [next_input](assembly_ptr a) { next_input->add(std::move(a)); },
+                  "region_pipeline_forward"));
+  }
+
+  aoffset_t last_pos = std::numeric_limits<aoffset_t>::min();
+  for (const std::string& line : vcf_lines) {
+    std::vector<std::string> fields = absl::StrSplit(line, '\t');
+    if (fields.size() < 5) {
+      throw io_exception("Bad VCF record: " + line);
+    }
+    aoffset_t pos = std::stol(fields[1]);
+    if (pos <= region.start || pos > region.limit) {
+      continue;
+    }
+    if (pos < last_pos) {
+      throw io_exception("VCF records must be sorted by position; got: " + line);
+    }
+    last_pos = pos;
+    size_t line_idx = result.vcf_lines.size();
+    result.vcf_lines.push_back(line);
+
+    aoffset_t left = pos - 1;
+    aoffset_t right = left + fields[3].size();
+    for (absl::string_view alt : absl::StrSplit(fields[4], ',')) {
+      bool is_dna = !alt.empty() && std::all_of(alt.begin(), alt.end(), [](char c) {
+        return c == 'A' || c == 'C' || c == 'G' || c == 'T';
+      });
+      if (!is_dna) {
+        continue;
+      }
+      auto a = make_unique<assembly>(left, right, dna_sequence(std::string(alt)));
+      result.vcf_line_for_assembly[a->assembly_id] = line_idx;
+      steps.front()->add(std::move(a));
+    }
+  }
+
+  for (auto& step : steps) {
+    step.reset();
+  }
+  return result;
+}
+
+void region_pipeline::run(const std::vector<vcf_region>& regions, const std::string& vcf_path,
+                          const scaffold_func_t& get_scaffold, size_t batch_size,
+                          const output_func_t& output_f, size_t max_threads) const {
+  CHECK_GT(batch_size, 0);
+  size_t max_num_chunks = max_threads ? max_threads : std::numeric_limits<size_t>::max();
+  for (size_t batch_start = 0; batch_start < regions.size(); batch_start += batch_size) {
+    size_t batch_limit = std::min(regions.size(), batch_start + batch_size);
+    std::vector<region_pipeline_result> results(batch_limit - batch_start);
+    auto process = [&](size_t start, size_t limit) {
+      std::unique_ptr<tabix_vcf_reader> reader;
+      if (!vcf_path.empty()) {
+        reader = make_unique<tabix_vcf_reader>(vcf_path);
+      }
+      for (size_t i = start; i != limit; ++i) {
+        const vcf_region& region = regions[i];
+        const scaffold* s = get_scaffold(region.scaffold_name);
+        if (!s) {
+          throw io_exception("Unknown scaffold " + region.scaffold_name);
+        }
+        std::vector<std::string> lines;
+        if (reader) {
+          lines = reader->query(region.scaffold_name, region.start, region.limit);
+        }
+        results[i - batch_start] = run_region(*s, region, lines);
+      }
+    };
+    parallel_pool().execute_worklist(
+        make_parallel_for_worklist(batch_start, batch_limit, process, max_num_chunks));
+    for (auto& result : results) {
+      if (!output_f(std::move(result))) {
+        return;
+      }
+    }
+  }
+}
+
+}  // namespace variants
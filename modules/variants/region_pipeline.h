@@ -0,0 +1,91 @@
+#pragma once
+
+// Runs a declaratively specified assembly pipeline over many regions
+// of reference in parallel.  Each region's pipeline runs entirely on a
+// worker thread; results are returned in region order.
+//
+// This replaces chaining python generators together for each region,
+// which serializes every step on the python interpreter.
+
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "modules/variants/assemble.h"
+#include "modules/variants/genotype_vcf.h"
+
+namespace variants {
+
+// A single step of a region pipeline.
+struct region_pipeline_step {
+  // Name of the step; see region_pipeline::step_names().
+  std::string name;
+
+  // Parameters for this step, by name.  Values are parsed according to
+  // the type each step expects; unknown parameters are an error.
+  std::map<std::string, std::string> params;
+
+  // Used by "filter" steps.  Called for each assembly; assemblies for
+  // which this returns false are discarded.
+  std::function<bool(const assembly_ptr&)> filter;
+};
+
+struct region_pipeline_result {
+  vcf_region region;
+
+  // VCF records that start in this region, without trailing newlines.
+  std::vector<std::string> vcf_lines;
+
+  // For assemblies generated from a VCF record, the index in
+  // vcf_lines of that record, by assembly id.
+  std::unordered_map<size_t, size_t> vcf_line_for_assembly;
+
+  // Assemblies output by the last step of the pipeline.
+  std::vector<assembly_ptr> assemblies;
+};
+
+class region_pipeline {
+ public:
+  using scaffold_func_t = std::function<const scaffold*(const std::string& scaffold_name)>;
+  using output_func_t = std::function<bool(region_pipeline_result)>;
+
+  // "options" must have seqset and readmap set.  Throws io_exception
+  // if any steps or parameters are unknown or malformed.
+  region_pipeline(const assemble_options& options, const std::vector<region_pipeline_step>& steps);
+  ~region_pipeline();
+
+  // Returns the names of all supported steps.
+  static std::vector<std::string> step_names();
+
+  // Runs the pipeline on a single region of "s".  "vcf_lines" are VCF
+  // records as returned by a tabix query for the region; records that
+  // don't start in the region are ignored.
+  region_pipeline_result run_region(const scaffold& s, const vcf_region& region,
+                                    const std::vector<std::string>& vcf_lines) const;
+
+  // Runs the pipeline on all the given regions, using the thread pool.
+  // Input records are read from "vcf_path", which must be BGZF
+  // compressed with a tabix index; if empty, each region starts with
+  // no assemblies.  Up to "batch_size" regions are processed at once.
+  // If "max_threads" is nonzero, at most that many work items run
+  // concurrently for this pipeline.
+  //
+  // "output_f" is called from the calling thread with the result for
+  // each region, in order.  If it returns false, processing stops.
+  void run(const std::vector<vcf_region>& regions, const std::string& vcf_path,
+           const scaffold_func_t& get_scaffold, size_t batch_size,
+           const output_func_t& output_f, size_t max_threads = 0) const;
+
+ private:
+  using step_factory_t =
+      std::function<pipeline_step_t(const assemble_options& opts, pipeline_step_t output)>;
+
+  static step_factory_t make_step_factory(const region_pipeline_step& step);
+
+  assemble_options m_options;
+  std::vector<step_factory_t> m_step_factories;
+};
+
+}  // namespace variants
@@ -0,0 +1,170 @@
+#include "modules/variants/region_pipeline.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "modules/bio_base/dna_testutil.h"
+#include "modules/variants/assemble_testutil.h"
+#include "modules/variants/bgzf_vcf_writer.h"
+#include "modules/test/test_utils.h"
+
+namespace variants {
+
+using namespace testing;
+using namespace dna_testutil;
+
+class region_pipeline_test : public assemble_test {
+ public:
+  region_pipeline_test() {
+    use_ref_parts({{0, tseq("abcdefghijklmnopqrstuvwxyz")}});
+    use_reads({tseq("bcdefgh"), tseq("abcde") + dna_T + tseq("fghi")});
+
+    // 1-based position of the last base of "abcde"
+    m_pos = tseq("abcde").size();
+    dna_slice ref_base = m_scaffold.subscaffold(m_pos - 1, 1).get_simple();
+    m_ref = dna_sequence(ref_base.begin(), ref_base.end()).as_string();
+    m_insert_line = printstring("1\t%d\t.\t%s\t%sT\t50\tPASS\t.", m_pos, m_ref.c_str(),
+                                m_ref.c_str());
+  }
+
+  region_pipeline_step step(const std::string& name,
+                            std::map<std::string, std::string> params = {}) {
+    region_pipeline_step result;
+    result.name = name;
+    result.params = std::move(params);
+    return result;
+  }
+
+  vcf_region whole_region() {
+    vcf_region r;
+    r.scaffold_name = "1";
+    r.start = 0;
+    r.limit = m_scaffold.end_pos();
+    return r;
+  }
+
+  region_pipeline_result run(const std::vector<region_pipeline_step>& steps,
+                             const std::vector<std::string>& lines) {
+    region_pipeline p(m_options, steps);
+    return p.run_region(m_scaffold, whole_region(), lines);
+  }
+
+  int m_pos;
+  std::string m_ref;
+  std::string m_insert_line;
+};
+
+TEST_F(region_pipeline_test, bad_steps) {
+  EXPECT_THROW(run({step("nonexistent")}, {}), io_exception);
+  EXPECT_THROW(run({step("read_cov", {{"nonexistent", "1"}})}, {}), io_exception);
+  EXPECT_THROW(run({step("read_cov", {{"max_coverage_paths", "many"}})}, {}), io_exception);
+  EXPECT_THROW(run({step("add_ref", {{"whole_ref", "maybe"}})}, {}), io_exception);
+  EXPECT_THROW(run({step("filter")}, {}), io_exception);
+  EXPECT_THAT(region_pipeline::step_names(), Contains("read_cov"));
+}
+
+TEST_F(region_pipeline_test, vcf_to_coverage) {
+  auto result = run({step("trim_ref"), step("add_ref", {{"pad_bases", "100"}}), step("read_cov")},
+                    {m_insert_line,
+                     printstring("1\t%d\t.\t%s\t<DEL>\t50\tPASS\t.", m_pos + 2, m_ref.c_str()),
+                     "1\t1000\t.\tA\tG\t50\tPASS\t."});
+
+  // The record starting outside the region is ignored.
+  EXPECT_THAT(result.vcf_lines, SizeIs(2));
+  EXPECT_EQ(result.vcf_lines[0], m_insert_line);
+
+  int ref_count = 0;
+  int var_count = 0;
+  for (const auto& a : result.assemblies) {
+    EXPECT_TRUE(a->read_coverage) << *a;
+    if (a->matches_reference) {
+      ++ref_count;
+      EXPECT_FALSE(result.vcf_line_for_assembly.count(a->assembly_id)) << *a;
+    } else {
+      ++var_count;
+      EXPECT_EQ(a->seq, dna_sequence("T")) << *a;
+      ASSERT_TRUE(result.vcf_line_for_assembly.count(a->assembly_id)) << *a;
+      EXPECT_EQ(result.vcf_line_for_assembly.at(a->assembly_id), 0);
+      EXPECT_EQ(a->read_coverage->get_tot_read_count(), 1) << *a;
+    }
+  }
+  EXPECT_EQ(var_count, 1);
+  EXPECT_GT(ref_count, 0);
+}
+
+TEST_F(region_pipeline_test, unsorted) {
+  EXPECT_THROW(run({step("add_ref")}, {m_insert_line, "1\t2\t.\tA\tG\t50\tPASS\t."}),
+               io_exception);
+}
+
+TEST_F(region_pipeline_test, filter) {
+  region_pipeline_step filter = step("filter");
+  size_t seen = 0;
+  filter.filter = [&](const assembly_ptr& a) {
+    ++seen;
+    return a->matches_reference;
+  };
+  auto result = run({step("add_ref", {{"pad_bases", "5"}}), filter}, {m_insert_line});
+  EXPECT_GT(seen, result.assemblies.size());
+  for (const auto& a : result.assemblies) {
+    EXPECT_TRUE(a->matches_reference) << *a;
+  }
+  EXPECT_THAT(result.assemblies, Not(IsEmpty()));
+
+  result = run({step("add_ref", {{"pad_bases", "5"}}), step("discard_ref")}, {m_insert_line});
+  ASSERT_THAT(result.assemblies, SizeIs(1));
+  EXPECT_FALSE(result.assemblies[0]->matches_reference);
+}
+
+TEST_F(region_pipeline_test, run_in_order) {
+  std::string path = make_path("region_pipeline_test.vcf.gz");
+  bgzf_vcf_writer w(path,
+                    "##fileformat=VCFv4.1\n"
+                    "##contig=<ID=1,length=1000>\n"
+                    "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n");
+  w.write_record(m_insert_line + "\n");
+  w.close();
+
+  std::vector<vcf_region> regions;
+  for (aoffset_t start = 0; start < m_scaffold.end_pos(); start += 3) {
+    vcf_region r = whole_region();
+    r.start = start;
+    r.limit = std::min<aoffset_t>(start + 3, m_scaffold.end_pos());
+    regions.push_back(r);
+  }
+
+  region_pipeline p(m_options, {step("discard_ref")});
+  std::vector<vcf_region> seen_regions;
+  size_t var_count = 0;
+  p.run(regions, path,
+        [&](const std::string& scaffold_name) -> const scaffold* {
+          return scaffold_name == "1" ? &m_scaffold : nullptr;
+        },
+        2 /* batch size */,
+        [&](region_pipeline_result result) {
+          seen_regions.push_back(result.region);
+          var_count += result.assemblies.size();
+          for (const auto& a : result.assemblies) {
+            EXPECT_GE(a->left_offset, result.region.start);
+            EXPECT_LT(a->left_offset, result.region.limit);
+          }
+          return true;
+        });
+  EXPECT_EQ(seen_regions, regions);
+  // The record is only processed in the region it starts in.
+  EXPECT_EQ(var_count, 1);
+
+  // Stops early when asked.
+  size_t output_count = 0;
+  p.run(regions, "", [&](const std::string&) -> const scaffold* { return &m_scaffold; }, 2,
+        [&](region_pipeline_result) { return ++output_count < 3; });
+  EXPECT_EQ(output_count, 3);
+
+  vcf_region unknown = whole_region();
+  unknown.scaffold_name = "2";
+  EXPECT_THROW(p.run({unknown}, "", [&](const std::string&) -> const scaffold* { return nullptr; },
+                     1, [&](region_pipeline_result) { return true; }),
+               io_exception);
+}
+
+}  // namespace variants
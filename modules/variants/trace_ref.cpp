@@ -63,9 +63,7 @@ void trace_ref::add_scaffold_range(const std::string& scaffold_name, size_t star
   }
 }
 
-assemble_stats trace_ref::assemble(progress_handler_t progress) {
-  // std::cout << m_work.size() << " work items\n";
-
+void trace_ref::sort_work() {
   auto atoi_or_maxint = [](const std::string& s) -> int {
     try {
       return std::stoi(s);
@@ -97,8 +95,83 @@ assemble_stats trace_ref::assemble(progress_handler_t progress) {
               if (a.scaffold_name != b.scaffold_name) {
                 return b.scaffold_name < a.scaffold_name;
               }
-              return a.start < b.start;
+              if (a.start != b.start) {
+                return a.start < b.start;
+              }
+              return a.limit < b.limit;
             });
+}
+
+std::vector<size_t> trace_ref::assign_shards(const std::vector<size_t>& work_sizes,
+                                             size_t shard_count) {
+  CHECK_GT(shard_count, 0);
+
+  // Greedily hand out the largest remaining work item to the least
+  // loaded shard.  Ties are broken by position so that every shard
+  // computes the same assignment.
+  std::vector<size_t> order(work_sizes.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return work_sizes[a] > work_sizes[b]; });
+
+  std::vector<size_t> shard_bases(shard_count, 0);
+  std::vector<size_t> result(work_sizes.size());
+  for (size_t idx : order) {
+    size_t shard = std::min_element(shard_bases.begin(), shard_bases.end()) - shard_bases.begin();
+    result[idx] = shard;
+    shard_bases[shard] += work_sizes[idx];
+  }
+  return result;
+}
+
+void trace_ref::select_shard(size_t shard_index, size_t shard_count) {
+  CHECK_LT(shard_index, shard_count);
+  sort_work();
+
+  std::vector<size_t> work_sizes;
+  work_sizes.reserve(m_work.size());
+  for (const auto& w : m_work) {
+    work_sizes.push_back(w->limit - w->start);
+  }
+  std::vector<size_t> shards = assign_shards(work_sizes, shard_count);
+
+  std::vector<std::unique_ptr<work_info>> selected;
+  for (size_t i = 0; i != m_work.size(); ++i) {
+    if (shards[i] == shard_index) {
+      selected.push_back(std::move(m_work[i]));
+    } else {
+      m_work[i]->p.reset();
+    }
+  }
+  m_work = std::move(selected);
+}
+
+std::vector<std::string> trace_ref::work_descriptions() {
+  sort_work();
+  std::vector<std::string> result;
+  for (const auto& w : m_work) {
+    result.push_back(w->to_string());
+  }
+  return result;
+}
+
+size_t trace_ref::work_bases() const {
+  size_t result = 0;
+  for (const auto& w : m_work) {
+    result += w->limit - w->start;
+  }
+  return result;
+}
+
+assemble_stats trace_ref::assemble(progress_handler_t progress) {
+  // std::cout << m_work.size() << " work items\n";
+  sort_work();
+
+  pipeline_mem_governor& mem_governor = pipeline_mem_governor::global();
+  mem_governor.set_budget(m_options.max_pipeline_mem_bytes);
+  size_t orig_throttle_count = mem_governor.throttle_count();
 
   assemble_stats tot_st;
   std::mutex mu;
@@ -110,12 +183,26 @@ assemble_stats trace_ref::assemble(progress_handler_t progress) {
         }
         auto& w = m_work[idx];
 
-        assemble_stats st = execute_work(std::move(w));
+        // Don't start on new chunks while buffered assemblies from
+        // chunks in progress are over budget.
+        mem_governor.start_work();
+        assemble_stats st;
+        try {
+          st = execute_work(std::move(w));
+        } catch (...) {
+          mem_governor.finish_work();
+          throw;
+        }
+        mem_governor.finish_work();
 
         std::lock_guard<std::mutex> l(mu);
         tot_st += st;
       },
       progress);
+  if (mem_governor.throttle_count() != orig_throttle_count) {
+    SPLOG("Paused starting new work %ld times to stay within pipeline memory budget",
+          mem_governor.throttle_count() - orig_throttle_count);
+  }
   if (m_aborted) {
     for (auto& work : m_work) {
       abort_work(std::move(work));
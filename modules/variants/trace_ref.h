@@ -15,6 +15,26 @@ class trace_ref {
   void add_scaffold(const std::string& scaffold_name);
   void add_scaffold_range(const std::string& scaffold_name, size_t start, size_t limit);
 
+  // Restricts the queued work to the subset belonging to shard
+  // "shard_index" out of "shard_count".  Work is distributed so that
+  // each shard gets roughly the same number of reference bases, and
+  // the assignment only depends on the queued work, so all shards
+  // must queue the same regions before calling this.  Each work item
+  // has its own pipeline, so the union of all shards' output is the
+  // same as tracing everything in a single process.
+  void select_shard(size_t shard_index, size_t shard_count);
+
+  // Returns the shard each work item belongs to, given the number of
+  // reference bases in each work item.
+  static std::vector<size_t> assign_shards(const std::vector<size_t>& work_sizes,
+                                           size_t shard_count);
+
+  // Returns descriptions of the queued work, in the order it will be traced.
+  std::vector<std::string> work_descriptions();
+
+  // Returns the number of reference bases in the queued work.
+  size_t work_bases() const;
+
   assemble_stats assemble(progress_handler_t progress = null_progress_handler);
 
   // True if no work has been queued.
@@ -59,6 +79,7 @@ class trace_ref {
   using in_progress_key_t = std::pair<work_info*, std::string /* desc */>;
   static std::map<in_progress_key_t, time_t /* start time */> g_in_progress;
   std::shared_ptr<scaffold> get_scaffold(const std::string& scaffold_name) const;
+  void sort_work();
   assemble_stats execute_work(std::unique_ptr<work_info> w) const;
   assemble_stats execute_work_direction(work_info* w, bool rev_comp,
                                         const assemble_options& opts) const;
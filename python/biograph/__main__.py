@@ -31,9 +31,12 @@ def get_version(args):
 TOOLS = {
     "coverage": coverage.main,
     "create": bgbinary_cmds.create_cmd,
+    "denovo-assemble": bgbinary_cmds.denovo_assemble_cmd,
     "discovery":bgbinary_cmds.discovery_cmd,
+    "discovery-merge": bgbinary_cmds.discovery_merge_cmd,
     "exp_discover": discover.main,
     "export_aligned": export_aligned.main,
+    "export-aligned": bgbinary_cmds.export_aligned_cmd,
     "full_pipeline": bgbinary_cmds.full_pipeline,
     "install_test": install_tests.main,
     "qual_classifier": qual_classifier,
@@ -56,7 +59,10 @@ biograph v{version()} - the BioGraph genome processing pipeline
         reference       {TOOLS['reference'].__doc__}
         create          {TOOLS['create'].__doc__}
         discovery       {TOOLS['discovery'].__doc__}
+        discovery-merge {TOOLS['discovery-merge'].__doc__}
         coverage        {TOOLS['coverage'].__doc__}
+        export-aligned  {TOOLS['export-aligned'].__doc__}
+        denovo-assemble {TOOLS['denovo-assemble'].__doc__}
         qual_classifier {TOOLS['qual_classifier'].__doc__}
         gt_classifier   {TOOLS['gt_classifier'].__doc__}
         vdb             {TOOLS['vdb'].__doc__}
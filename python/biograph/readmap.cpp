@@ -1,6 +1,8 @@
 #include "python/biograph/readmap.h"
 #include <pybind11/operators.h>
+#include <pybind11/stl.h>
 #include "modules/bio_base/dna_sequence.h"
+#include "modules/io/parallel.h"
 #include "python/biograph/seqset.h"
 #include "python/common.h"
 
@@ -22,6 +24,105 @@ std::vector<int> readmap_get_approx_seq_coverage(const readmap& rm, dna_sequence
   return rm.approx_coverage(dna_slice(seq.begin(), seq.end()));
 }
 
+// Concatenates per-entry result lists into a single array, filling
+// in "offsets" so that the results for entry i are at
+// [offsets[i], offsets[i+1]).
+template <typename T>
+std::vector<T> flatten_results(std::vector<std::vector<T>>& per_entry,
+                               std::vector<uint64_t>* offsets) {
+  offsets->assign(per_entry.size() + 1, 0);
+  for (size_t i = 0; i != per_entry.size(); ++i) {
+    (*offsets)[i + 1] = (*offsets)[i] + per_entry[i].size();
+  }
+  std::vector<T> result;
+  result.reserve(offsets->back());
+  for (auto& entry_results : per_entry) {
+    result.insert(result.end(), entry_results.begin(), entry_results.end());
+    std::vector<T>().swap(entry_results);
+  }
+  return result;
+}
+
+tuple readmap_get_prefix_read_ids_many(const readmap& rm,
+                                       seqset_range_columns::input_array<uint64_t> begins,
+                                       seqset_range_columns::input_array<uint64_t> ends,
+                                       seqset_range_columns::input_array<uint32_t> sizes,
+                                       int min_read_len) {
+  seqset_range_columns ranges(begins, ends, sizes);
+  const seqset& ss = *rm.get_seqset();
+  std::vector<std::vector<uint32_t>> read_ids(ranges.size());
+  std::vector<uint64_t> offsets;
+  std::vector<uint32_t> all_read_ids;
+  {
+    gil_scoped_release allow_threads;
+    python_parallel_lock l;
+    parallel_for(0, ranges.size(), [&](size_t start, size_t limit) {
+      for (size_t i = start; i != limit; ++i) {
+        seqset_range r = ranges.get(ss, i);
+        if (!r.valid()) {
+          continue;
+        }
+        for (const readmap::read& rd : rm.get_prefix_reads(r, min_read_len)) {
+          read_ids[i].push_back(rd.get_read_id());
+        }
+      }
+    });
+    all_read_ids = flatten_results(read_ids, &offsets);
+  }
+  return make_tuple(as_numpy_array(std::move(offsets)), as_numpy_array(std::move(all_read_ids)));
+}
+
+tuple readmap_get_reads_containing_many(const readmap& rm,
+                                        seqset_range_columns::input_array<uint64_t> begins,
+                                        seqset_range_columns::input_array<uint64_t> ends,
+                                        seqset_range_columns::input_array<uint32_t> sizes) {
+  seqset_range_columns ranges(begins, ends, sizes);
+  const seqset& ss = *rm.get_seqset();
+  std::vector<std::vector<uint32_t>> read_ids(ranges.size());
+  std::vector<std::vector<int32_t>> read_offsets(ranges.size());
+  std::vector<uint64_t> offsets;
+  std::vector<uint32_t> all_read_ids;
+  std::vector<int32_t> all_read_offsets;
+  {
+    gil_scoped_release allow_threads;
+    python_parallel_lock l;
+    parallel_for(0, ranges.size(), [&](size_t start, size_t limit) {
+      for (size_t i = start; i != limit; ++i) {
+        seqset_range r = ranges.get(ss, i);
+        if (!r.valid()) {
+          continue;
+        }
+        for (const auto& offset_and_read : rm.get_reads_containing(r)) {
+          read_offsets[i].push_back(offset_and_read.first);
+          read_ids[i].push_back(offset_and_read.second.get_read_id());
+        }
+      }
+    });
+    all_read_offsets = flatten_results(read_offsets, &offsets);
+    all_read_ids = flatten_results(read_ids, &offsets);
+  }
+  return make_tuple(as_numpy_array(std::move(offsets)), as_numpy_array(std::move(all_read_ids)),
+                    as_numpy_array(std::move(all_read_offsets)));
+}
+
+tuple readmap_get_approx_seq_coverage_many(const readmap& rm,
+                                           const std::vector<dna_sequence>& seqs) {
+  std::vector<std::vector<int>> coverage(seqs.size());
+  std::vector<uint64_t> offsets;
+  std::vector<int> all_coverage;
+  {
+    gil_scoped_release allow_threads;
+    python_parallel_lock l;
+    parallel_for(0, seqs.size(), [&](size_t start, size_t limit) {
+      for (size_t i = start; i != limit; ++i) {
+        coverage[i] = rm.approx_coverage(dna_slice(seqs[i].begin(), seqs[i].end()));
+      }
+    });
+    all_coverage = flatten_results(coverage, &offsets);
+  }
+  return make_tuple(as_numpy_array(std::move(offsets)), as_numpy_array(std::move(all_coverage)));
+}
+
 }  // namespace
 
 void bind_readmap(module& m) {
@@ -59,6 +160,22 @@ Raises a RuntimeError if the file cannot be opened.
            "Returns the coverage of a sequence. Sequence must be longer than read length.  This "
            "may return the wrong value in some cases where the read length is shorter than the "
            "seqset entry length.")
+      .def("get_prefix_read_ids_many", readmap_get_prefix_read_ids_many, arg("begins"),
+           arg("ends"), arg("sizes"), arg("min_read_len") = 0,
+           "Batch version of get_prefix_reads, taking entries as (begins, ends, sizes) arrays as "
+           "returned by Seqset.find_many.  Releases the GIL and processes entries in parallel.  "
+           "Returns a tuple of numpy arrays (offsets, read_ids); the read ids for entry i are "
+           "read_ids[offsets[i]:offsets[i+1]].")
+      .def("get_reads_containing_many", readmap_get_reads_containing_many, arg("begins"),
+           arg("ends"), arg("sizes"),
+           "Batch version of get_reads_containing, taking entries as (begins, ends, sizes) "
+           "arrays as returned by Seqset.find_many.  Returns a tuple of numpy arrays (offsets, "
+           "read_ids, read_offsets); the reads containing entry i are at [offsets[i], "
+           "offsets[i+1]) in read_ids and read_offsets.")
+      .def("get_approx_seq_coverage_many", readmap_get_approx_seq_coverage_many, arg("seqs"),
+           "Batch version of get_approx_seq_coverage.  Releases the GIL and calculates coverage "
+           "of each sequence in parallel.  Returns a tuple of numpy arrays (offsets, coverage); "
+           "the coverage for sequence i is coverage[offsets[i]:offsets[i+1]].")
       .def("get_read_count", &readmap::get_read_count, "Return the number of reads in this readmap")
       .def("get_num_bases", &readmap::get_num_bases, "Return the number of bases in this readmap")
       .def("get_pair_stats", &readmap::get_pair_stats,
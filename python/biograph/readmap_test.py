@@ -120,6 +120,37 @@ class ReadmapTestCases(unittest.TestCase):
                     (3, 11165, 'GGATGAAATGAGTTGCCATCTGGTGCTCACCACGG')]
         )
 
+    def test_prefix_reads_many(self):
+        seqs = ["AAAATTACAGAGTACACAACATCCATGAAACGCAT", "A",
+                "GGATGAAATGAGTTGCCATCTGGTGCTCACCACGG"]
+        begins, ends, sizes = self.seqset.find_many(seqs)
+        offsets, read_ids = self.rm1.get_prefix_read_ids_many(begins, ends, sizes)
+        self.assertEqual(len(offsets), len(seqs) + 1)
+        for i, seq in enumerate(seqs):
+            expected = [read.get_read_id()
+                        for read in self.rm1.get_prefix_reads(self.seqset.find(seq))]
+            self.assertEqual(list(read_ids[offsets[i]:offsets[i + 1]]), expected)
+        self.assertEqual(list(read_ids[offsets[0]:offsets[1]]), [123, 124])
+
+    def test_reads_containing_many(self):
+        seqs = ["TGAAATGAGTTGCCATCTGGTGCTCAC", "GATTACAGATTACAGATTACA"]
+        begins, ends, sizes = self.seqset.find_many(seqs)
+        offsets, read_ids, read_offsets = self.rm1.get_reads_containing_many(
+            begins, ends, sizes)
+        self.assertEqual(list(offsets), [0, 8, 8])
+        expected = [(offset, read.get_read_id())
+                    for offset, read in self.rm1.get_reads_containing(self.seqset.find(seqs[0]))]
+        self.assertEqual(list(zip(read_offsets, read_ids)), expected)
+
+    def test_approx_seq_coverage_many(self):
+        seqs = ["GGATGAAATGAGTTGCCATCTGGTGCTCACCACGGATCAGCAATTCGTTGACGGTGGT",
+                "AAAATTACAGAGTACACAACATCCATGAAACGCATAAAATTACAGAG"]
+        offsets, coverage = self.rm1.get_approx_seq_coverage_many(seqs)
+        self.assertEqual(len(offsets), len(seqs) + 1)
+        for i, seq in enumerate(seqs):
+            self.assertEqual(list(coverage[offsets[i]:offsets[i + 1]]),
+                             self.rm1.get_approx_seq_coverage(seq))
+
     def test_pair_stats(self):
         st1 = self.rm1.get_pair_stats()
         self.assertEqual(st1.paired_reads, 0)
@@ -5,6 +5,9 @@
 
 #include <pybind11/functional.h>
 #include <pybind11/operators.h>
+#include <pybind11/stl.h>
+
+#include "modules/io/parallel.h"
 
 using namespace pybind11;
 
@@ -41,8 +44,100 @@ std::function<object(const T&, Arg...)> valid_or_none(seqset_range (T::*f)(Arg..
   };
 }
 
+tuple seqset_find_many(const seqset& ss, const std::vector<dna_sequence>& seqs) {
+  seqset_range_columns found(seqs.size());
+  {
+    gil_scoped_release allow_threads;
+    python_parallel_lock l;
+    parallel_for(0, seqs.size(), [&](size_t start, size_t limit) {
+      for (size_t i = start; i != limit; ++i) {
+        found.set(i, ss.find(seqs[i]));
+      }
+    });
+  }
+  return found.release_to_numpy();
+}
+
+tuple seqset_push_front_drop_many(const seqset& ss,
+                                  seqset_range_columns::input_array<uint64_t> begins,
+                                  seqset_range_columns::input_array<uint64_t> ends,
+                                  seqset_range_columns::input_array<uint32_t> sizes,
+                                  const std::string& bases, unsigned min_ctx) {
+  seqset_range_columns ranges(begins, ends, sizes);
+  if (bases.size() != ranges.size()) {
+    throw std::invalid_argument("Must supply exactly one base per entry");
+  }
+  seqset_range_columns pushed(ranges.size());
+  {
+    gil_scoped_release allow_threads;
+    python_parallel_lock l;
+    parallel_for(0, ranges.size(), [&](size_t start, size_t limit) {
+      for (size_t i = start; i != limit; ++i) {
+        seqset_range r = ranges.get(ss, i);
+        if (r.valid()) {
+          pushed.set(i, r.push_front_drop(dna_base(bases[i]), min_ctx));
+        }
+      }
+    });
+  }
+  return pushed.release_to_numpy();
+}
+
 }  // namespace
 
+seqset_range_columns::seqset_range_columns(size_t n) : m_begins(n), m_ends(n), m_sizes(n) {}
+
+seqset_range_columns::seqset_range_columns(input_array<uint64_t> begins, input_array<uint64_t> ends,
+                                           input_array<uint32_t> sizes) {
+  if (begins.ndim() != 1 || ends.ndim() != 1 || sizes.ndim() != 1) {
+    throw std::invalid_argument("Entry begins, ends, and sizes must be one dimensional");
+  }
+  size_t n = begins.shape(0);
+  if (size_t(ends.shape(0)) != n || size_t(sizes.shape(0)) != n) {
+    throw std::invalid_argument("Entry begins, ends, and sizes must be the same length");
+  }
+  m_begins.assign(begins.data(), begins.data() + n);
+  m_ends.assign(ends.data(), ends.data() + n);
+  m_sizes.assign(sizes.data(), sizes.data() + n);
+}
+
+void seqset_range_columns::set(size_t idx, const seqset_range& r) {
+  if (r.valid()) {
+    m_begins[idx] = r.begin();
+    m_ends[idx] = r.end();
+    m_sizes[idx] = r.size();
+  } else {
+    m_begins[idx] = m_ends[idx] = 0;
+    m_sizes[idx] = 0;
+  }
+}
+
+seqset_range seqset_range_columns::get(const seqset& ss, size_t idx) const {
+  uint64_t begin = m_begins[idx];
+  uint64_t end = m_ends[idx];
+  if (begin >= end) {
+    return seqset_range();
+  }
+  if (end > ss.size()) {
+    throw std::out_of_range("Seqset entry id " + std::to_string(end) + " out of range");
+  }
+  seqset_range entry = ss.ctx_entry(begin);
+  if (m_sizes[idx] > entry.size()) {
+    throw std::invalid_argument("Seqset entry size too large at index " + std::to_string(idx));
+  }
+  seqset_range r = entry.truncate(m_sizes[idx]);
+  if (r.begin() != begin || r.end() != end) {
+    throw std::invalid_argument("Begin, end, and size do not describe a seqset entry at index " +
+                                std::to_string(idx));
+  }
+  return r;
+}
+
+tuple seqset_range_columns::release_to_numpy() {
+  return make_tuple(as_numpy_array(std::move(m_begins)), as_numpy_array(std::move(m_ends)),
+                    as_numpy_array(std::move(m_sizes)));
+}
+
 void bind_seqset(module& m) {
   class_<seqset, std::shared_ptr<seqset>>(m, "Seqset",
                                           R"DOC(
@@ -94,6 +189,29 @@ Example:
     print bad_entry.valid  # False
 
 See also: SeqsetEntry
+)DOC")
+      .def("find_many", seqset_find_many, arg("seqs"),
+           R"DOC(
+Search the Seqset for each of a list of sequences, releasing the GIL 
+and running the searches in parallel.  Returns a tuple of numpy 
+arrays (begins, ends, sizes) with one element per sequence, holding 
+the entry ids and sequence length of each result.  Sequences that 
+are not found have begin == end == 0.
+
+Example:
+
+    begins, ends, sizes = my_sample.find_many(['ACGT', 'GATTACA'])
+    found = begins != ends
+
+See also: find, push_front_drop_many
+)DOC")
+      .def("push_front_drop_many", seqset_push_front_drop_many, arg("begins"), arg("ends"),
+           arg("sizes"), arg("bases"), arg("min_ctx") = 0,
+           R"DOC(
+Batch version of SeqsetEntry.push_front_drop.  Takes entries as 
+(begins, ends, sizes) arrays, as returned by find_many, and a string 
+with one base per entry.  Returns the resulting entries in the same 
+form.  Entries with begin == end are passed through as not found.
 )DOC")
       .def("empty_entry", valid_or_none(&seqset::ctx_begin),
            R"DOC(
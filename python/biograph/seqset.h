@@ -1,8 +1,41 @@
 #pragma once
 
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include "python/biograph/readmap.h"
 #include "modules/bio_base/seqset.h"
 #include "modules/io/spiral_file.h"
 
 void bind_seqset(pybind11::module& m);
+
+// A batch of seqset ranges stored as parallel begin, end, and size
+// columns, for passing to and from python as numpy arrays.  Invalid
+// ranges are stored with begin == end == 0.
+class seqset_range_columns {
+ public:
+  template <typename T>
+  using input_array = pybind11::array_t<T, pybind11::array::c_style | pybind11::array::forcecast>;
+
+  // Creates columns with space for "n" invalid ranges.
+  explicit seqset_range_columns(size_t n);
+  // Copies columns supplied from python.  Must be called with the GIL held.
+  seqset_range_columns(input_array<uint64_t> begins, input_array<uint64_t> ends,
+                       input_array<uint32_t> sizes);
+
+  size_t size() const { return m_begins.size(); }
+
+  void set(size_t idx, const seqset_range& r);
+
+  // Reconstructs the range at "idx" in "ss".  Returns an invalid
+  // range if it was stored as invalid.
+  seqset_range get(const seqset& ss, size_t idx) const;
+
+  // Returns a (begins, ends, sizes) tuple of numpy arrays, moving the
+  // contents of these columns into them.
+  pybind11::tuple release_to_numpy();
+
+ private:
+  std::vector<uint64_t> m_begins;
+  std::vector<uint64_t> m_ends;
+  std::vector<uint32_t> m_sizes;
+};
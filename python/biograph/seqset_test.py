@@ -104,5 +104,36 @@ class SeqsetTestCases(unittest.TestCase):
         pushed = self.gattaca.push_front_drop("G", 6)
         self.assertEqual(pushed.sequence(), biograph.Sequence("GGATTAC"))
 
+    def test_find_many(self):
+        seqs = ["GATTACA", "GATTACAGATTACA", "", biograph.Sequence("TGATTACA")]
+        begins, ends, sizes = self.seqset.find_many(seqs)
+        self.assertEqual(len(begins), len(seqs))
+        for i, seq in enumerate(seqs):
+            entry = self.seqset.find(seq)
+            if entry is None:
+                self.assertEqual((begins[i], ends[i], sizes[i]), (0, 0, 0))
+            else:
+                self.assertEqual(begins[i], entry.get_begin_entry_id())
+                self.assertEqual(ends[i], entry.get_end_entry_id())
+                self.assertEqual(sizes[i], len(entry))
+
+    def test_push_front_drop_many(self):
+        begins, ends, sizes = self.seqset.find_many(["GATTACA", "GATTACA", "GATTACAGATTACA"])
+        p_begins, p_ends, p_sizes = self.seqset.push_front_drop_many(
+            begins, ends, sizes, "GTA")
+        pushed = self.gattaca.push_front_drop("G")
+        self.assertEqual((p_begins[0], p_ends[0], p_sizes[0]),
+                         (pushed.get_begin_entry_id(), pushed.get_end_entry_id(), len(pushed)))
+        pushed = self.gattaca.push_front_drop("T")
+        self.assertEqual((p_begins[1], p_ends[1], p_sizes[1]),
+                         (pushed.get_begin_entry_id(), pushed.get_end_entry_id(), len(pushed)))
+        self.assertEqual((p_begins[2], p_ends[2], p_sizes[2]), (0, 0, 0))
+
+        _, p_ends, _ = self.seqset.push_front_drop_many(begins, ends, sizes, "GGG", 7)
+        self.assertEqual(list(p_ends), [0, 0, 0])
+
+        with self.assertRaises(ValueError):
+            self.seqset.push_front_drop_many(begins, ends, sizes, "G")
+
 if __name__ == '__main__':
     unittest.main(verbosity=2)
@@ -142,8 +142,10 @@ def check_discovery(args, pipe_args): # pylint:disable=unused-argument
             successful = False
     return successful
 
-def discovery_cmd(args, base_cmd="bgbinary discovery {args}", dryrun=False):
-    ''' Discover variants on a BioGraph vs. a reference '''
+def _bgbinary_subcmd(name, args, base_cmd, dryrun):
+    """
+    Run a bgbinary subcommand, logging its completion under name
+    """
     if not LOGGINGSETUP:
         log.setup_logging()
     if isinstance(args, list):
@@ -154,9 +156,25 @@ def discovery_cmd(args, base_cmd="bgbinary discovery {args}", dryrun=False):
     ret = cmd_exe(cmd, cap_stderr=False, pipefail=True)
     log.debug(ret)
     if not LOGGINGSETUP:
-        log.info("Finished discovery")
+        log.info(f"Finished {name}")
     return ret
 
+def discovery_cmd(args, base_cmd="bgbinary discovery {args}", dryrun=False):
+    ''' Discover variants on a BioGraph vs. a reference '''
+    return _bgbinary_subcmd("discovery", args, base_cmd, dryrun)
+
+def discovery_merge_cmd(args, base_cmd="bgbinary discovery-merge {args}", dryrun=False):
+    ''' Combine partial VCFs from a sharded discovery run '''
+    return _bgbinary_subcmd("discovery-merge", args, base_cmd, dryrun)
+
+def export_aligned_cmd(args, base_cmd="bgbinary export-aligned {args}", dryrun=False):
+    ''' Export reads supporting variants as an indexed BAM '''
+    return _bgbinary_subcmd("export-aligned", args, base_cmd, dryrun)
+
+def denovo_assemble_cmd(args, base_cmd="bgbinary denovo-assemble {args}", dryrun=False):
+    ''' Assemble reads into unitigs without reference (FASTA + GFA) '''
+    return _bgbinary_subcmd("denovo-assemble", args, base_cmd, dryrun)
+
 def check_coverage(args, pipe_args): # pylint:disable=unused-argument
     """
     ensure the biograph, reference, and out are not specified in the create command
@@ -44,6 +44,11 @@ from biograph._capi import (
     align_count,
     AlignCountGenerator,
     AlignCount,
+    capture_assemblies,
+    CaptureAssembliesGenerator,
+    replay_assemblies,
+    ReplayAssembliesGenerator,
+    RegionPipeline,
 )
 
 # Remove unsightly _capi from published class names.
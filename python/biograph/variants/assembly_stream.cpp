@@ -0,0 +1,79 @@
+#include "python/biograph/variants/assembly_stream.h"
+
+#include "modules/io/file_io.h"
+#include "python/biograph/variants/assembly.h"
+#include "python/biograph/variants/pipeline.h"
+#include "python/common.h"
+
+using namespace pybind11;
+using namespace variants;
+
+class __attribute__((visibility("hidden"))) capture_assemblies_generator
+    : public asm_pipeline_wrapper {
+ public:
+  capture_assemblies_generator(object input, const std::string& filename);
+  void init();
+
+  void on_input(assembly_ptr a) override;
+  void on_input_done() override;
+
+ private:
+  file_writer m_file;
+  assembly_stream_writer m_writer;
+
+  pipeline_step_t m_capture;
+};
+
+capture_assemblies_generator::capture_assemblies_generator(object input,
+                                                           const std::string& filename)
+    : asm_pipeline_wrapper(input), m_file(filename), m_writer(&m_file) {}
+
+void capture_assemblies_generator::init() {
+  m_capture = m_writer.make_capture_step(make_pipeline_output());
+}
+
+void capture_assemblies_generator::on_input(assembly_ptr a) { m_capture->add(std::move(a)); }
+
+void capture_assemblies_generator::on_input_done() {
+  m_capture.reset();
+  m_file.close();
+}
+
+class __attribute__((visibility("hidden"))) replay_assemblies_generator {
+ public:
+  replay_assemblies_generator(const std::string& filename);
+  void init() {}
+
+  assembly_ptr next();
+
+ private:
+  file_reader m_file;
+  assembly_stream_reader m_reader;
+};
+
+replay_assemblies_generator::replay_assemblies_generator(const std::string& filename)
+    : m_file(filename), m_reader(&m_file) {}
+
+assembly_ptr replay_assemblies_generator::next() {
+  assembly_ptr a;
+  {
+    gil_scoped_release allow_threads;
+    a = m_reader.read();
+  }
+  if (!a) {
+    PyErr_SetObject(PyExc_StopIteration, Py_None);
+    throw error_already_set();
+  }
+  return a;
+}
+
+void bind_assembly_stream(module& m) {
+  define_pipeline_generator<capture_assemblies_generator, object /* input */,
+                            const std::string& /* filename */>(
+      m, "capture_assemblies", "CaptureAssembliesGenerator", arg("input"), arg("filename"),
+      R"DOC(Passes through assemblies from "input" unchanged, saving a copy of each to
+the given file.  The saved assemblies can be read back using replay_assemblies.)DOC");
+  define_pipeline_generator<replay_assemblies_generator, const std::string& /* filename */>(
+      m, "replay_assemblies", "ReplayAssembliesGenerator", arg("filename"),
+      R"DOC(Generates the assemblies previously saved by capture_assemblies.)DOC");
+}
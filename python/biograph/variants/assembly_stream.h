@@ -0,0 +1,10 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+
+#include "modules/variants/assembly_stream.h"
+
+// Captures assemblies passing between pipeline steps to a file, and
+// replays them later.
+
+void bind_assembly_stream(pybind11::module& m);
@@ -249,6 +249,7 @@ class __attribute__((visibility("hidden"))) parallel_discover : public scaffold_
     }
     m_assemble_started = true;
     m_run_assemble = std::async(std::launch::async, [this, progress_handler]() {
+      python_parallel_lock parallel_lock;
       m_trace_ref->assemble(progress_handler);
       m_trace_ref.reset();
     });
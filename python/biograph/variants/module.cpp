@@ -8,6 +8,7 @@
 #include "python/biograph/variants/apply_edges.h"
 #include "python/biograph/variants/apply_graph.h"
 #include "python/biograph/variants/assembly.h"
+#include "python/biograph/variants/assembly_stream.h"
 #include "python/biograph/variants/dedup_cov_reads.h"
 #include "python/biograph/variants/discover.h"
 #include "python/biograph/variants/filter_dup_align.h"
@@ -18,6 +19,7 @@
 #include "python/biograph/variants/phase.h"
 #include "python/biograph/variants/place_pair_cov.h"
 #include "python/biograph/variants/read_cov.h"
+#include "python/biograph/variants/region_pipeline.h"
 #include "python/biograph/variants/trim_ref.h"
 #include "python/common.h"
 
@@ -43,4 +45,6 @@ void bind_variants_module(module& m) {
   bind_place_pair_cov(m);
   bind_apply_graph(m);
   bind_align_count(m);
+  bind_assembly_stream(m);
+  bind_region_pipeline(m);
 }
@@ -0,0 +1,275 @@
+#include "python/biograph/variants/region_pipeline.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "absl/strings/str_split.h"
+#include "modules/variants/trace_ref.h"
+#include "python/biograph/variants/assembly.h"
+#include "python/biograph/variants/pipeline_common.h"
+#include "python/common.h"
+
+using namespace pybind11;
+using namespace variants;
+
+namespace {
+
+// Converts a python callable into a filter for a "filter" step.  The
+// GIL is acquired whenever the callable is called or released, since
+// this happens on worker threads.
+std::function<bool(const assembly_ptr&)> make_py_filter(object f) {
+  std::shared_ptr<object> held(new object(std::move(f)), [](object* o) {
+    gil_scoped_acquire gil;
+    delete o;
+  });
+  return [held](const assembly_ptr& a) -> bool {
+    gil_scoped_acquire gil;
+    return (*held)(a).cast<bool>();
+  };
+}
+
+region_pipeline_step make_step(handle py_step) {
+  region_pipeline_step step;
+  if (isinstance<str>(py_step)) {
+    step.name = py_step.cast<std::string>();
+    return step;
+  }
+
+  tuple t = py_step.cast<tuple>();
+  if (t.size() != 2) {
+    throw std::invalid_argument(
+        "Pipeline steps must be a step name or a (name, params) tuple; got: " +
+        std::string(str(py_step)));
+  }
+  step.name = t[0].cast<std::string>();
+  if (step.name == "filter") {
+    step.filter = make_py_filter(reinterpret_borrow<object>(t[1]));
+    return step;
+  }
+  for (auto param : t[1].cast<dict>()) {
+    object value = reinterpret_borrow<object>(param.second);
+    step.params[param.first.cast<std::string>()] = str(value);
+  }
+  return step;
+}
+
+}  // namespace
+
+// Runs a region_pipeline in a background thread, and supplies the
+// results to python in region order.
+class __attribute__((visibility("hidden"))) region_pipeline_runner {
+ public:
+  region_pipeline_runner(const std::shared_ptr<readmap>& rm, const reference_wrapper& ref,
+                         list regions, list steps, const std::string& vcf_path,
+                         size_t batch_size, size_t threads);
+  ~region_pipeline_runner();
+
+  object next();
+
+ private:
+  void run_thread();
+
+  std::shared_ptr<readmap> m_readmap;
+  std::map<std::string, scaffold> m_scaffolds;
+  std::vector<vcf_region> m_regions;
+  std::unique_ptr<region_pipeline> m_pipeline;
+  std::string m_vcf_path;
+  size_t m_batch_size;
+  size_t m_threads;
+
+  std::mutex m_mu;
+  std::condition_variable m_cv;
+  std::deque<region_pipeline_result> m_results;
+  bool m_done = false;
+  bool m_cancelled = false;
+  std::exception_ptr m_exception;
+  std::thread m_thread;
+};
+
+region_pipeline_runner::region_pipeline_runner(const std::shared_ptr<readmap>& rm,
+                                               const reference_wrapper& ref, list regions,
+                                               list steps, const std::string& vcf_path,
+                                               size_t batch_size, size_t threads)
+    : m_readmap(rm), m_vcf_path(vcf_path), m_batch_size(batch_size), m_threads(threads) {
+  if (!m_batch_size) {
+    throw std::invalid_argument("batch_size must be at least 1");
+  }
+
+  for (handle py_region : regions) {
+    tuple t = py_region.cast<tuple>();
+    if (t.size() != 3) {
+      throw std::invalid_argument("Regions must be (scaffold_name, start, limit) tuples");
+    }
+    vcf_region region;
+    region.scaffold_name = t[0].cast<std::string>();
+    region.start = t[1].cast<aoffset_t>();
+    region.limit = t[2].cast<aoffset_t>();
+    if (!m_scaffolds.count(region.scaffold_name)) {
+      m_scaffolds[region.scaffold_name] =
+          trace_ref::ref_to_scaffold(ref.get_reference().get(), region.scaffold_name);
+    }
+    m_regions.push_back(region);
+  }
+
+  std::vector<region_pipeline_step> pipeline_steps;
+  for (handle py_step : steps) {
+    pipeline_steps.push_back(make_step(py_step));
+  }
+
+  assemble_options options;
+  options.seqset = m_readmap->get_seqset().get();
+  options.readmap = m_readmap.get();
+  m_pipeline = make_unique<region_pipeline>(options, pipeline_steps);
+
+  m_thread = std::thread([this]() { run_thread(); });
+}
+
+region_pipeline_runner::~region_pipeline_runner() {
+  gil_scoped_release allow_threads;
+  {
+    std::lock_guard<std::mutex> l(m_mu);
+    m_cancelled = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+  m_results.clear();
+}
+
+void region_pipeline_runner::run_thread() {
+  try {
+    auto get_scaffold = [this](const std::string& scaffold_name) -> const scaffold* {
+      auto it = m_scaffolds.find(scaffold_name);
+      return it == m_scaffolds.end() ? nullptr : &it->second;
+    };
+    for (size_t start = 0; start < m_regions.size(); start += m_batch_size) {
+      std::vector<vcf_region> batch(
+          m_regions.begin() + start,
+          m_regions.begin() + std::min(m_regions.size(), start + m_batch_size));
+      std::vector<region_pipeline_result> results;
+      {
+        python_parallel_lock parallel_lock;
+        m_pipeline->run(batch, m_vcf_path, get_scaffold, m_batch_size,
+                        [&](region_pipeline_result result) {
+                          results.push_back(std::move(result));
+                          return true;
+                        },
+                        m_threads);
+      }
+
+      std::unique_lock<std::mutex> l(m_mu);
+      // Don't get more than a batch ahead of python.
+      m_cv.wait(l, [&]() { return m_cancelled || m_results.size() < m_batch_size; });
+      if (m_cancelled) {
+        return;
+      }
+      for (auto& result : results) {
+        m_results.push_back(std::move(result));
+      }
+      m_cv.notify_all();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> l(m_mu);
+    m_exception = std::current_exception();
+  }
+  std::lock_guard<std::mutex> l(m_mu);
+  m_done = true;
+  m_cv.notify_all();
+}
+
+object region_pipeline_runner::next() {
+  region_pipeline_result result;
+  bool finished = false;
+  std::exception_ptr exception;
+  {
+    gil_scoped_release allow_threads;
+    std::unique_lock<std::mutex> l(m_mu);
+    m_cv.wait(l, [&]() { return m_done || !m_results.empty(); });
+    if (m_results.empty()) {
+      finished = true;
+      exception = m_exception;
+    } else {
+      result = std::move(m_results.front());
+      m_results.pop_front();
+      m_cv.notify_all();
+    }
+  }
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+  if (finished) {
+    PyErr_SetObject(PyExc_StopIteration, Py_None);
+    throw error_already_set();
+  }
+
+  list assemblies;
+  for (assembly_ptr& a : result.assemblies) {
+    auto line_it = result.vcf_line_for_assembly.find(a->assembly_id);
+    object py_a = cast(std::move(a));
+    if (line_it != result.vcf_line_for_assembly.end()) {
+      std::vector<std::string> fields = absl::StrSplit(result.vcf_lines[line_it->second], '\t');
+      py_a.attr("vcf_line") = cast(fields);
+    }
+    assemblies.append(py_a);
+  }
+  const vcf_region& r = result.region;
+  return make_tuple(make_tuple(r.scaffold_name, r.start, r.limit), assemblies);
+}
+
+void bind_region_pipeline(module& m) {
+  class_<region_pipeline_runner, std::shared_ptr<region_pipeline_runner>>(m, "RegionPipeline",
+                                                                          R"DOC(
+Runs a pipeline of assembly steps over many regions of reference in
+parallel, in native code.  Iterating over a RegionPipeline yields a
+(region, assemblies) tuple for each region, in the order the regions
+were given.
+
+regions is a list of (scaffold_name, start, limit) tuples.
+
+steps is a list of steps to run on each region, in order.  Each step
+is either a step name or a (name, params) tuple, where params is a
+dict of parameters.  Supported steps and parameters are:
+
+    trim_ref
+    add_ref: pad_bases, whole_ref, max_len
+    discard_ref
+    limit_alleles: max_alleles
+    read_cov: max_reads_per_entry, max_coverage_paths
+    pair_cov: min_insert_size, max_insert_size
+    place_pair_cov: min_insert_size, max_insert_size, ideal_insert_size, max_ambig
+    pair_edge_cov
+    align_count
+    dedup_cov_reads
+
+A ("filter", func) step calls the python function func on each
+assembly; assemblies for which it returns False are discarded.  This
+is the only time python code runs during processing.
+
+If vcf is given, it must be a BGZF compressed VCF with a tabix index;
+each region starts with assemblies for the records that start in it,
+with the "vcf_line" attribute set to the record's fields.
+
+If threads is nonzero, at most that many regions are processed at
+once.
+
+Example:
+
+    for region, asms in bgexvar.RegionPipeline(
+            rm, ref, [("1", 0, 1000000)],
+            ["trim_ref", ("add_ref", {"pad_bases": 1100}),
+             "read_cov", "pair_cov", "pair_edge_cov"],
+            vcf="input.vcf.gz"):
+        ...
+)DOC")
+      .def(init<const std::shared_ptr<readmap>&, const reference_wrapper&, list, list,
+                const std::string&, size_t, size_t>(),
+           arg("readmap"), arg("ref"), arg("regions"), arg("steps"), arg("vcf") = "",
+           arg("batch_size") = 256, arg("threads") = 0)
+      .def("__iter__", just_return_self)
+      .def("__next__", &region_pipeline_runner::next)
+      .def("next", &region_pipeline_runner::next)
+      .def_static("step_names", &region_pipeline::step_names,
+                  "Returns the names of all supported pipeline steps");
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+
+#include "python/biograph/reference.h"
+#include "modules/variants/region_pipeline.h"
+
+void bind_region_pipeline(pybind11::module& m);
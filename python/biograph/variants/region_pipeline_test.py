@@ -0,0 +1,114 @@
+# pylint: disable=missing-docstring
+
+from __future__ import print_function
+
+import unittest
+import tabix
+import biograph
+import biograph.variants as bgexvar
+
+class RegionPipelineTestCases(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.bg = biograph.BioGraph("datasets/lambdaToyData/benchmark/proband_lambda.bg")
+        cls.rm = cls.bg.open_readmap()
+        cls.ref = biograph.Reference("datasets/lambdaToyData/benchmark/ref_lambda")
+        cls.vcf_file = "datasets/lambdaToyData/benchmark/family.vcf.gz"
+        cls.reflen = int(cls.ref.scaffold_lens["lambda"])
+        cls.regions = [("lambda", start, min(start + 10000, cls.reflen))
+                       for start in range(0, cls.reflen, 10000)]
+
+    def python_pipeline(self, region):
+        ctg, start, limit = region
+        asms = []
+        for vcf_line in tabix.open(self.vcf_file).query(ctg, start, limit):
+            pos = int(vcf_line[1])
+            if pos <= start or pos > limit:
+                continue
+            for alt in vcf_line[4].split(","):
+                if set(alt) - set("ACGT"):
+                    continue
+                a = bgexvar.Assembly(pos - 1, pos - 1 + len(vcf_line[3]), alt, len(asms))
+                asms.append(a)
+        entries = bgexvar.trim_ref(self.ref, ctg, asms)
+        entries = bgexvar.add_ref_assemblies(self.ref, ctg, entries, 200)
+        entries = bgexvar.generate_read_cov(self.rm, entries)
+        return list(entries)
+
+    @staticmethod
+    def summarize(asms):
+        return sorted((a.left_offset, a.right_offset, str(a.seq), a.matches_reference,
+                       a.read_coverage.get_tot_read_count()) for a in asms)
+
+    def test_matches_python(self):
+        steps = ["trim_ref", ("add_ref", {"pad_bases": 200}), "read_cov"]
+        seen_regions = []
+        for region, asms in bgexvar.RegionPipeline(self.rm, self.ref, self.regions, steps,
+                                                   vcf=self.vcf_file, batch_size=2):
+            seen_regions.append(region)
+            self.assertEqual(self.summarize(asms),
+                             self.summarize(self.python_pipeline(region)))
+            for a in asms:
+                if a.matches_reference:
+                    self.assertFalse(hasattr(a, "vcf_line"))
+                else:
+                    self.assertEqual(a.vcf_line[0], "lambda")
+                    self.assertGreaterEqual(int(a.vcf_line[1]), region[1])
+        self.assertEqual(seen_regions, self.regions)
+
+    def test_python_filter(self):
+        seen = []
+
+        def only_snps(a):
+            seen.append(a.left_offset)
+            return a.matches_reference or a.right_offset - a.left_offset == len(a.seq)
+
+        steps = [("filter", only_snps), ("add_ref", {"pad_bases": 10})]
+        asms = []
+        for _, region_asms in bgexvar.RegionPipeline(self.rm, self.ref, self.regions, steps,
+                                                     vcf=self.vcf_file):
+            asms += region_asms
+        self.assertTrue(seen)
+        variants = [a for a in asms if not a.matches_reference]
+        self.assertTrue(variants)
+        self.assertLess(len(variants), len(seen))
+        for a in variants:
+            self.assertEqual(len(a.vcf_line[3]), len(a.seq))
+
+    def test_filter_runs_parallel_work(self):
+        # Filters run inside the pipeline's parallel work, so calling
+        # a *_many API from one must not deadlock.
+        seqset = self.bg.seqset
+        checked = []
+
+        def in_seqset(a):
+            seq = str(a.seq)[:30]
+            begins, ends, sizes = seqset.find_many([seq])
+            entry = seqset.find(seq)
+            if entry is None:
+                self.assertEqual((begins[0], ends[0], sizes[0]), (0, 0, 0))
+            else:
+                self.assertEqual((begins[0], ends[0], sizes[0]),
+                                 (entry.get_begin_entry_id(), entry.get_end_entry_id(),
+                                  len(entry)))
+            checked.append(a.left_offset)
+            return entry is not None
+
+        steps = [("filter", in_seqset), "read_cov"]
+        regions = 0
+        for _ in bgexvar.RegionPipeline(self.rm, self.ref, self.regions, steps,
+                                        vcf=self.vcf_file, batch_size=2, threads=2):
+            regions += 1
+        self.assertEqual(regions, len(self.regions))
+        self.assertTrue(checked)
+
+    def test_bad_steps(self):
+        with self.assertRaises(RuntimeError):
+            bgexvar.RegionPipeline(self.rm, self.ref, self.regions, ["nonexistent"])
+        with self.assertRaises(RuntimeError):
+            bgexvar.RegionPipeline(self.rm, self.ref, self.regions,
+                                   [("read_cov", {"nonexistent": 1})])
+        self.assertIn("read_cov", bgexvar.RegionPipeline.step_names())
+
+if __name__ == '__main__':
+    unittest.main(verbosity=2)
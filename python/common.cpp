@@ -1,5 +1,14 @@
 #include "python/common.h"
 
+#include "modules/io/parallel.h"
+
+python_parallel_lock::python_parallel_lock() {
+  static std::mutex mu;
+  if (!parallel_pool().get_state()) {
+    m_lock = std::unique_lock<std::mutex>(mu);
+  }
+}
+
 void execute_with_py_progress(pybind11::object py_progress_f,
                               const std::function<void(progress_handler_t progress)> f) {
   std::mutex mu;
@@ -20,7 +29,10 @@ void execute_with_py_progress(pybind11::object py_progress_f,
   };
 
   std::future<void> run_thread = std::async(std::launch::async, [&]() {
-    f(progress_handler);
+    {
+      python_parallel_lock parallel_lock;
+      f(progress_handler);
+    }
     std::lock_guard<std::mutex> l(mu);
     done = true;
     cond.notify_all();
@@ -30,7 +42,12 @@ void execute_with_py_progress(pybind11::object py_progress_f,
     std::unique_lock<std::mutex> l(mu);
 
     while (!done) {
-      cond.wait(l, [&]() { return done || pending_progress; });
+      {
+        // Let python filters in other parallel operations run while
+        // we wait our turn.
+        pybind11::gil_scoped_release allow_threads;
+        cond.wait(l, [&]() { return done || pending_progress; });
+      }
 
       if (done) {
         break;
@@ -1,5 +1,8 @@
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <boost/optional.hpp>
+#include <mutex>
+#include <vector>
 
 #include "modules/io/progress.h"
 
@@ -10,6 +13,20 @@
 void execute_with_py_progress(pybind11::object py_progress,
                               const std::function<void(progress_handler_t progress)> f);
 
+// The thread pool only supports one top-level parallel operation at
+// a time.  Python entry points that run parallel work hold a
+// python_parallel_lock while doing so, acquiring it only after
+// releasing the GIL.  Inside a work item (e.g. a python filter called
+// by a RegionPipeline), the enclosing operation already holds it and
+// new parallel work runs nested inside it, so nothing is locked.
+class python_parallel_lock {
+ public:
+  python_parallel_lock();
+
+ private:
+  std::unique_lock<std::mutex> m_lock;
+};
+
 // Convenience func to generate a result for __str__ from operator<<(std::ostream&, T)
 template <typename T>
 std::string str_from_ostream(const T& val) {
@@ -18,6 +35,17 @@ std::string str_from_ostream(const T& val) {
   return s.str();
 }
 
+// Returns a numpy array that takes ownership of the contents of
+// "vec" without copying them.  The buffer is freed when the array is
+// garbage collected.
+template <typename T>
+pybind11::array_t<T> as_numpy_array(std::vector<T>&& vec) {
+  auto* owned = new std::vector<T>(std::move(vec));
+  pybind11::capsule free_when_done(
+      owned, [](void* p) { delete reinterpret_cast<std::vector<T>*>(p); });
+  return pybind11::array_t<T>(owned->size(), owned->data(), free_when_done);
+}
+
 namespace pybind11 {
 namespace detail {
 